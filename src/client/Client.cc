@@ -45,6 +45,7 @@ using namespace std;
 #include "messages/MClientRequestForward.h"
 #include "messages/MClientReply.h"
 #include "messages/MClientFileCaps.h"
+#include "messages/MClientFileCapsBatch.h"
 
 #include "messages/MGenericMessage.h"
 
@@ -63,7 +64,7 @@ using namespace std;
 
 #include "config.h"
 
-#define  dout(l)    if (l<=g_conf.debug || l <= g_conf.debug_client) *_dout << dbeginl << g_clock.now() << " client" << whoami /*<< "." << pthread_self() */ << " "
+#define  dout(l)    dout_if(l, l<=g_conf.debug || l <= g_conf.debug_client) << g_clock.now() << " client" << whoami /*<< "." << pthread_self() */ << " "
 
 #define  tout       if (g_conf.client_trace) traceout
 
@@ -123,6 +124,7 @@ Client::Client(Messenger *m, MonMap *mm) : timer(client_lock)
 
   // 
   root = 0;
+  cap_ack_batch = 0;
 
   lru.lru_set_max(g_conf.client_cache_size);
 
@@ -262,6 +264,7 @@ void Client::init()
     client_logtype.add_inc("stat");
     client_logtype.add_avg("owrlat");
     client_logtype.add_avg("ordlat");
+    client_logtype.add_avg("omixlat");
     client_logtype.add_inc("owr");
     client_logtype.add_inc("ord");
     
@@ -963,6 +966,9 @@ void Client::dispatch(Message *m)
   case CEPH_MSG_CLIENT_FILECAPS:
     handle_file_caps((MClientFileCaps*)m);
     break;
+  case CEPH_MSG_CLIENT_FILECAPS_BATCH:
+    handle_file_caps_batch((MClientFileCapsBatch*)m);
+    break;
 
   case CEPH_MSG_STATFS_REPLY:
     handle_statfs_reply((MStatfsReply*)m);
@@ -1121,10 +1127,6 @@ public:
 void Client::handle_file_caps(MClientFileCaps *m)
 {
   int mds = m->get_source().num();
-  Inode *in = 0;
-  if (inode_map.count(m->get_ino())) in = inode_map[ m->get_ino() ];
-
-  m->clear_payload();  // for if/when we send back to MDS
 
   // note push seq increment
   if (mds_sessions.count(mds) == 0) 
@@ -1132,6 +1134,64 @@ void Client::handle_file_caps(MClientFileCaps *m)
   //assert(mds_sessions.count(mds));   // HACK FIXME SOON
   mds_sessions[mds]++;
 
+  _handle_file_caps(m);
+}
+
+/*
+ * one push, many caps.  handle each in order, and send back whatever
+ * acks we can give right away as a single batch.
+ */
+void Client::handle_file_caps_batch(MClientFileCapsBatch *m)
+{
+  int mds = m->get_source().num();
+  dout(5) << "handle_file_caps_batch " << m->size() << " from mds" << mds << dendl;
+
+  if (mds_sessions.count(mds) == 0) 
+    dout(0) << "got file_caps without session from mds" << mds << " msg " << *m << dendl;
+  mds_sessions[mds]++;
+
+  list<MClientFileCaps*> ls;
+  m->split(ls);
+  entity_inst_t from = m->get_source_inst();
+  delete m;
+
+  assert(!cap_ack_batch);
+  cap_ack_batch = new MClientFileCapsBatch;
+  for (list<MClientFileCaps*>::iterator p = ls.begin(); p != ls.end(); ++p)
+    _handle_file_caps(*p);
+  MClientFileCapsBatch *acks = cap_ack_batch;
+  cap_ack_batch = 0;
+
+  if (acks->empty()) {
+    delete acks;
+  } else if (acks->size() == 1) {
+    list<MClientFileCaps*> one;
+    acks->split(one);
+    delete acks;
+    messenger->send_message(one.front(), from);
+  } else {
+    dout(5) << "handle_file_caps_batch acking " << acks->size() << " to mds" << mds << dendl;
+    messenger->send_message(acks, from);
+  }
+}
+
+void Client::send_cap_ack(MClientFileCaps *m)
+{
+  if (cap_ack_batch) {
+    cap_ack_batch->add(m);
+    delete m;
+  } else
+    messenger->send_message(m, m->get_source_inst());
+}
+
+void Client::_handle_file_caps(MClientFileCaps *m)
+{
+  int mds = m->get_source().num();
+  Inode *in = 0;
+  if (inode_map.count(m->get_ino())) in = inode_map[ m->get_ino() ];
+
+  m->clear_payload();  // for if/when we send back to MDS
+
   // reap?
   if (m->get_op() == CEPH_CAP_OP_IMPORT) {
     int other = m->get_migrate_mds();
@@ -1214,7 +1274,7 @@ void Client::handle_file_caps(MClientFileCaps *m)
     m->set_op(CEPH_CAP_OP_ACK);
     m->set_caps(0);
     m->set_wanted(0);
-    messenger->send_message(m, m->get_source_inst());
+    send_cap_ack(m);
     return;
   }
 
@@ -1329,7 +1389,7 @@ void Client::implemented_caps(MClientFileCaps *m, Inode *in)
     in->file_wr_size = 0;
   }
 
-  messenger->send_message(m, m->get_source_inst());
+  send_cap_ack(m);
 }
 
 
@@ -2930,7 +2990,12 @@ int Client::_read(Fh *f, off_t offset, off_t size, bufferlist *bl)
 
   if (g_conf.client_oc) {
     // object cache ON
-    rvalue = r = in->fc.read(offset, size, *bl, client_lock);  // may block.
+    off_t ra_off, ra_len;
+    f->readahead.update(offset, size, in->inode.layout, in->inode.size, ra_off, ra_len);
+    if (ra_len)
+      dout(10) << "_read readahead " << ra_off << "~" << ra_len
+	       << " (window " << f->readahead.get_window() << ")" << dendl;
+    rvalue = r = in->fc.read(offset, size, *bl, client_lock, ra_off, ra_len);  // may block.
 
     /*
     if (in->inode.ino == 0x10000000075 && hackbuf) {
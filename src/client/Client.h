@@ -36,6 +36,7 @@
 #include "common/Timer.h"
 
 #include "FileCache.h"
+#include "osdc/Readahead.h"
 
 
 // stl
@@ -356,6 +357,8 @@ struct Fh {
   bool pos_locked;           // pos is currently in use
   list<Cond*> pos_waiters;   // waiters for pos
 
+  Readahead readahead;
+
   Fh() : inode(0), pos(0), mds(0), mode(0), pos_locked(false) {}
 };
 
@@ -503,6 +506,7 @@ protected:
 
   // cap weirdness
   map<inodeno_t, map<int, class MClientFileCaps*> > cap_reap_queue;  // ino -> mds -> msg .. set of (would-be) stale caps to reap
+  class MClientFileCapsBatch *cap_ack_batch;  // acks collected while we handle a batch
 
 
   // file handles, etc.
@@ -678,6 +682,9 @@ protected:
 
   // file caps
   void handle_file_caps(class MClientFileCaps *m);
+  void handle_file_caps_batch(class MClientFileCapsBatch *m);
+  void _handle_file_caps(class MClientFileCaps *m);
+  void send_cap_ack(class MClientFileCaps *m);
   void implemented_caps(class MClientFileCaps *m, Inode *in);
   void release_caps(Inode *in, int retain=0);
   void update_caps_wanted(Inode *in);
@@ -20,8 +20,8 @@
 #include "msg/Messenger.h"
 
 #include "config.h"
-#define dout(x)  if (x <= g_conf.debug_client) *_dout << dbeginl << g_clock.now() << " " << oc->objecter->messenger->get_myname() << ".filecache "
-#define derr(x)  if (x <= g_conf.debug_client) *_derr << dbeginl << g_clock.now() << " " << oc->objecter->messenger->get_myname() << ".filecache "
+#define dout(x)  dout_if(x, x <= g_conf.debug_client) << g_clock.now() << " " << oc->objecter->messenger->get_myname() << ".filecache "
+#define derr(x)  derr_if(x, x <= g_conf.debug_client) << g_clock.now() << " " << oc->objecter->messenger->get_myname() << ".filecache "
 
 
 
@@ -171,7 +171,12 @@ void FileCache::check_caps()
 
 // read/write
 
-int FileCache::read(off_t offset, size_t size, bufferlist& blist, Mutex& client_lock)
+/*
+ * ra_off~ra_len, if any, is prefetched (when we may cache) after the
+ * read itself is under way.
+ */
+int FileCache::read(off_t offset, size_t size, bufferlist& blist, Mutex& client_lock,
+		    off_t ra_off, size_t ra_len)
 {
   int r = 0;
 
@@ -195,6 +200,8 @@ int FileCache::read(off_t offset, size_t size, bufferlist& blist, Mutex& client_
     C_Cond *onfinish = new C_Cond(&cond, &done, &rvalue);
     
     r = oc->file_read(inode, offset, size, &blist, onfinish);
+    if (ra_len)
+      oc->file_readahead(inode, ra_off, ra_len);
     
     if (r == 0) {
       // block
@@ -76,7 +76,8 @@ class FileCache {
   void set_caps(int caps, Context *onimplement=0);
   void check_caps();
   
-  int read(off_t offset, size_t size, bufferlist& blist, Mutex& client_lock);  // may block.
+  int read(off_t offset, size_t size, bufferlist& blist, Mutex& client_lock,
+	   off_t ra_off=0, size_t ra_len=0);  // may block.
   void write(off_t offset, size_t size, bufferlist& blist, Mutex& client_lock);  // may block.
 
 };
@@ -20,6 +20,7 @@ using namespace std;
 
 #include "SyntheticClient.h"
 #include "osdc/Objecter.h"
+#include "osdc/Filer.h"
 
 #include "include/filepath.h"
 #include "mds/mdstypes.h"
@@ -35,8 +36,8 @@ using namespace std;
 
 #include "config.h"
 
-#define  dout(l)    if (l<=g_conf.debug || l<=g_conf.debug_client) *_dout << dbeginl << g_clock.now() << " synthetic" << (this->whoami >= 0 ? this->whoami:client->get_nodeid()) << " "
-#define  derr(l)    if (l<=g_conf.debug || l<=g_conf.debug_client) *_derr << dbeginl << g_clock.now() << " synthetic" << (this->whoami >= 0 ? this->whoami:client->get_nodeid()) << " "
+#define  dout(l)    dout_if(l, l<=g_conf.debug || l<=g_conf.debug_client) << g_clock.now() << " synthetic" << (this->whoami >= 0 ? this->whoami:client->get_nodeid()) << " "
+#define  derr(l)    derr_if(l, l<=g_conf.debug || l<=g_conf.debug_client) << g_clock.now() << " synthetic" << (this->whoami >= 0 ? this->whoami:client->get_nodeid()) << " "
 
 // traces
 //void trace_include(SyntheticClient *syn, Client *cl, string& prefix);
@@ -112,6 +113,10 @@ void parse_syn_options(vector<const char*>& args)
         syn_iargs.push_back( atoi(args[++i]) );
         syn_iargs.push_back( atoi(args[++i]) );
         syn_iargs.push_back( atoi(args[++i]) );
+      } else if (strcmp(args[i],"statstorm") == 0) {
+        syn_modes.push_back( SYNCLIENT_MODE_STATSTORM );
+        syn_iargs.push_back( atoi(args[++i]) );
+        syn_iargs.push_back( atoi(args[++i]) );
       } else if (strcmp(args[i],"readdirs") == 0) {
         syn_modes.push_back( SYNCLIENT_MODE_READDIRS );
         syn_iargs.push_back( atoi(args[++i]) );
@@ -138,11 +143,22 @@ void parse_syn_options(vector<const char*>& args)
         syn_iargs.push_back( atoi(args[++i]) );
         syn_iargs.push_back( atoi(args[++i]) );
 
+      } else if (strcmp(args[i],"openhold") == 0) {
+        syn_modes.push_back( SYNCLIENT_MODE_OPENHOLD );
+        syn_iargs.push_back( atoi(args[++i]) );
+        syn_iargs.push_back( atoi(args[++i]) );
+
       } else if (strcmp(args[i],"createobjects") == 0) {
         syn_modes.push_back( SYNCLIENT_MODE_CREATEOBJECTS );
         syn_iargs.push_back( atoi(args[++i]) );
         syn_iargs.push_back( atoi(args[++i]) );
         syn_iargs.push_back( atoi(args[++i]) );
+      } else if (strcmp(args[i],"objectmixed") == 0) {
+        syn_modes.push_back( SYNCLIENT_MODE_OBJECTMIXED );
+        syn_iargs.push_back( atoi(args[++i]) );
+        syn_iargs.push_back( atoi(args[++i]) );
+        syn_iargs.push_back( atoi(args[++i]) );
+        syn_iargs.push_back( atoi(args[++i]) );
       } else if (strcmp(args[i],"objectrw") == 0) {
         syn_modes.push_back( SYNCLIENT_MODE_OBJECTRW );
         syn_iargs.push_back( atoi(args[++i]) );
@@ -450,6 +466,18 @@ int SyntheticClient::run()
 	did_run_me();
       }
       break;
+    case SYNCLIENT_MODE_STATSTORM:
+      {
+        string sarg1 = get_sarg(0);
+        int iarg1 = iargs.front();  iargs.pop_front();
+        int iarg2 = iargs.front();  iargs.pop_front();
+        if (run_me()) {
+          dout(2) << "statstorm " << sarg1 << " " << iarg1 << " " << iarg2 << dendl;
+          stat_storm(sarg1.c_str(), iarg1, iarg2);
+        }
+	did_run_me();
+      }
+      break;
     case SYNCLIENT_MODE_READDIRS:
       {
         string sarg1 = get_sarg(0);
@@ -538,6 +566,18 @@ int SyntheticClient::run()
       }
       break;
 
+    case SYNCLIENT_MODE_OPENHOLD:
+      {
+        int num = iargs.front();  iargs.pop_front();
+        int secs = iargs.front();  iargs.pop_front();
+        if (run_me()) {
+          dout(2) << "openhold " << num << " " << secs << dendl;
+          open_hold(num, secs);
+        }
+	did_run_me();
+      }
+      break;
+
     case SYNCLIENT_MODE_CREATEOBJECTS:
       {
         int count = iargs.front();  iargs.pop_front();
@@ -568,6 +608,21 @@ int SyntheticClient::run()
       }
       break;
 
+    case SYNCLIENT_MODE_OBJECTMIXED:
+      {
+        int count = iargs.front();  iargs.pop_front();
+        int size = iargs.front();  iargs.pop_front();
+        int streammb = iargs.front();  iargs.pop_front();
+        int streamop = iargs.front();  iargs.pop_front();
+        if (run_me()) {
+          dout(2) << "objectmixed " << count << " " << size << " " << streammb
+		  << " " << streamop << dendl;
+          object_mixed(count, size, streammb, streamop);
+        }
+	did_run_me();
+      }
+      break;
+
     case SYNCLIENT_MODE_FULLWALK:
       {
         string sarg1;// = get_sarg(0);
@@ -1521,6 +1576,35 @@ int SyntheticClient::stat_dirs(const char *basedir, int dirs, int files, int dep
   
   return 0;
 }
+/*
+ * lstat basedir/file.N, N in [0,files), count times over, and report
+ * the rate.  with client_cache_stat_ttl 0 every lstat goes to the mds, so
+ * a few of these in parallel measure mds read throughput.
+ */
+int SyntheticClient::stat_storm(const char *basedir, int files, int count)
+{
+  char d[500];
+  struct stat st;
+  int n = 0;
+  utime_t start = g_clock.now();
+  for (int c=0; c<count; c++) {
+    if (time_to_stop()) break;
+    for (int i=0; i<files; i++) {
+      sprintf(d, "%s/file.%d", basedir, i);
+      if (client->lstat(d, &st) < 0) {
+	dout(1) << "stat_storm failed stat on " << d << ", stopping" << dendl;
+	return -1;
+      }
+      n++;
+    }
+  }
+  utime_t e = g_clock.now();
+  e -= start;
+  dout(1) << "stat_storm " << n << " stats in " << e << " = " 
+	  << ((double)e > 0 ? (double)n / (double)e : 0) << " stats/sec" << dendl;
+  return 0;
+}
+
 int SyntheticClient::read_dirs(const char *basedir, int dirs, int files, int depth)
 {
   if (time_to_stop()) return 0;
@@ -1689,6 +1773,28 @@ int SyntheticClient::open_shared(int num, int count)
   return 0;
 }
 
+/*
+ * open file.0 .. file.num-1 read-only, creating any that aren't there,
+ * and keep them open for secs, so the mds has that many caps to issue,
+ * revoke and reissue for us.
+ */
+int SyntheticClient::open_hold(int num, int secs)
+{
+  char d[255];
+  list<int> fds;
+  for (int n=0; n<num; n++) {
+    sprintf(d,"file.%d", n);
+    int fd = client->open(d, O_RDONLY|O_CREAT, 0644);
+    if (fd > 0) fds.push_back(fd);
+  }
+  dout(1) << "open_hold holding " << fds.size() << " files for " << secs << "s" << dendl;
+  sleep(secs);
+  while (!fds.empty()) {
+    client->close(fds.front());
+    fds.pop_front();
+  }
+  return 0;
+}
 
 // Hits OSD 0 with writes to various files with OSD 0 as the primary.
 int SyntheticClient::overload_osd_0(int n, int size, int wrsize) {
@@ -2092,6 +2198,137 @@ int SyntheticClient::object_rw(int nobj, int osize, int wrpc,
 
 
 
+/*
+ * a big sequential stream and small random reads at the same time.
+ * we write a streammb MB file (striped per g_OSD_FileLayout), then
+ * keep one streamop-byte read of it in flight while reading osize bytes
+ * from random objects of the nobj made by createobjects, one at a time.
+ * reports stream throughput and small read latency.
+ */
+class C_MixedStream : public Context {
+public:
+  Filer *filer;
+  inode_t inode;
+  off_t size, op, pos;
+  bufferlist bl;
+  bool *stop;
+  uint64_t *bytes;
+  int *inflight;
+  C_MixedStream(Filer *f, inode_t& i, off_t s, off_t o, off_t p,
+		bool *st, uint64_t *b, int *in) :
+    filer(f), inode(i), size(s), op(o), pos(p), stop(st), bytes(b), inflight(in) {}
+  void start() {
+    (*inflight)++;
+    filer->read(inode, pos, op, &bl, this);
+  }
+  void finish(int r) {
+    // called under client_lock
+    (*inflight)--;
+    if (r > 0)
+      *bytes += r;
+    if (*stop) 
+      return;
+    off_t next = pos + op;
+    if (next + op > size)
+      next = 0;
+    C_MixedStream *c = new C_MixedStream(filer, inode, size, op, next, stop, bytes, inflight);
+    c->start();
+  }
+};
+
+int SyntheticClient::object_mixed(int nobj, int osize, int streammb, int streamop)
+{
+  dout(5) << "object_mixed " << nobj << " size=" << osize 
+	  << " with a " << streammb << " MB stream of " << streamop << " byte reads"
+	  << dendl;
+
+  inode_t inode;
+  inode.ino = 0x2000 + client->get_nodeid();
+  inode.layout = g_OSD_FileLayout;
+  off_t size = (off_t)streammb << 20;
+
+  // lay down the stream
+  Mutex lock;
+  Cond cond;
+  int unack = 0;
+  int unsafe = 0;
+  bufferptr bp(1 << 20);
+  bp.zero();
+  bufferlist bl;
+  bl.push_back(bp);
+  for (off_t off = 0; off < size; off += bl.length()) {
+    client->client_lock.Lock();
+    client->filer->write(inode, off, bl.length(), bl, 0,
+			 new C_Ref(lock, cond, &unack),
+			 new C_Ref(lock, cond, &unsafe));
+    client->client_lock.Unlock();
+  }
+  lock.Lock();
+  while (unsafe > 0)
+    cond.Wait(lock);
+  lock.Unlock();
+
+  // go
+  bool stop = false;
+  uint64_t bytes = 0;
+  int inflight = 0;
+  client->client_lock.Lock();
+  C_MixedStream *c = new C_MixedStream(client->filer, inode, size, streamop, 0, &stop, &bytes, &inflight);
+  c->start();
+  client->client_lock.Unlock();
+
+  utime_t start = g_clock.now();
+  int nread = 0;
+  double latsum = 0, latmax = 0;
+  while (!time_to_stop()) {
+    object_t oid(0x1000, rand() % nobj);
+    ceph_object_layout layout = client->osdmap->make_object_layout(oid, pg_t::TYPE_REP, g_OSD_FileLayout.fl_pg_size);
+    bufferlist inbl;
+    utime_t s = g_clock.now();
+    client->client_lock.Lock();
+    client->objecter->read(oid, 0, osize, layout, &inbl, 
+			   new C_Ref(lock, cond, &unack));
+    client->client_lock.Unlock();
+
+    lock.Lock();
+    while (unack > 0)
+      cond.Wait(lock);
+    lock.Unlock();
+
+    utime_t lat = g_clock.now();
+    lat -= s;
+    nread++;
+    latsum += (double)lat;
+    if ((double)lat > latmax)
+      latmax = lat;
+    if (client_logger)
+      client_logger->favg("omixlat", lat);
+  }
+  utime_t elapsed = g_clock.now();
+  elapsed -= start;
+
+  client->client_lock.Lock();
+  stop = true;
+  uint64_t streamed = bytes;
+  client->client_lock.Unlock();
+
+  dout(0) << "object_mixed stream " << (double)streamed / (double)elapsed / (1024.0*1024.0) << " MB/s"
+	  << ", " << nread << " small reads, lat avg " << (nread ? latsum / nread : 0)
+	  << " max " << latmax << dendl;
+
+  // wait for the last stream read
+  while (1) {
+    client->client_lock.Lock();
+    int n = inflight;
+    client->client_lock.Unlock();
+    if (!n)
+      break;
+    usleep(10000);
+  }
+  return 0;
+}
+
+
 
 int SyntheticClient::read_random(string& fn, int size, int rdsize)   // size is in MB, wrsize in bytes
 {
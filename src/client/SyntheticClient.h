@@ -31,11 +31,13 @@
 #define SYNCLIENT_MODE_MAKEDIRS     8      // dirs files depth
 #define SYNCLIENT_MODE_STATDIRS     9     // dirs files depth
 #define SYNCLIENT_MODE_READDIRS     10     // dirs files depth
+#define SYNCLIENT_MODE_STATSTORM    15     // files count
 
 #define SYNCLIENT_MODE_MAKEFILES    11     // num count private
 #define SYNCLIENT_MODE_MAKEFILES2   12     // num count private
 #define SYNCLIENT_MODE_CREATESHARED 13     // num
 #define SYNCLIENT_MODE_OPENSHARED   14     // num count
+#define SYNCLIENT_MODE_OPENHOLD     16     // num secs
 
 #define SYNCLIENT_MODE_WRITEFILE   20
 #define SYNCLIENT_MODE_READFILE    21
@@ -53,6 +55,7 @@
 
 #define SYNCLIENT_MODE_CREATEOBJECTS 35
 #define SYNCLIENT_MODE_OBJECTRW 36
+#define SYNCLIENT_MODE_OBJECTMIXED 37
 
 #define SYNCLIENT_MODE_OPENTEST     40
 #define SYNCLIENT_MODE_OPTEST       41
@@ -211,11 +214,13 @@ class SyntheticClient {
   int make_dirs(const char *basedir, int dirs, int files, int depth);
   int stat_dirs(const char *basedir, int dirs, int files, int depth);
   int read_dirs(const char *basedir, int dirs, int files, int depth);
+  int stat_storm(const char *basedir, int files, int count);
   int make_files(int num, int count, int priv, bool more);
   int link_test();
 
   int create_shared(int num);
   int open_shared(int num, int count);
+  int open_hold(int num, int secs);
 
   int write_file(string& fn, int mb, int chunk);
   int write_fd(int fd, int size, int wrsize);
@@ -226,6 +231,7 @@ class SyntheticClient {
   int create_objects(int nobj, int osize, int inflight);
   int object_rw(int nobj, int osize, int wrpc, int overlap, 
 		double rskew, double wskew);
+  int object_mixed(int nobj, int osize, int streammb, int streamop);
 
   int read_random(string& fn, int mb, int chunk);
   int read_random_ex(string& fn, int mb, int chunk);
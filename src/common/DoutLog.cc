@@ -0,0 +1,454 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * asynchronous dout backend.
+ *
+ * each thread formats its lines into its own ostringstream and, at
+ * dendl, stamps the line with a global sequence number and pushes it
+ * onto its own single-producer/single-consumer queue.  nothing on that
+ * path takes a lock.  a writer thread drains all the queues every
+ * dout_flush_ms (sooner if one gets half full), writes the batch out in
+ * sequence order, and flushes each stream once per batch.  a thread
+ * that finds its queue full drains it itself.
+ *
+ * every line the writer sees also goes into a ring of the last
+ * dout_recent_entries lines, along with lines at or under debug_recent
+ * that weren't otherwise going to be written.  the ring is dumped to
+ * the log on a fatal signal (which includes a failed assert), with
+ * write(2) straight to _dout_fd, and only if no one holds the locks.
+ */
+
+#include "config.h"
+#include "common/Mutex.h"
+#include "common/Cond.h"
+#include "common/Clock.h"
+#include "common/Thread.h"
+
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <string>
+using namespace std;
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+struct DoutEntry {
+  unsigned long seq;
+  ostream *out;           // 0 = recent ring only
+  string text;
+};
+
+struct DoutThread {
+  DoutEntry *q;
+  unsigned qsize;
+  volatile unsigned head;  // next slot to fill; only the owner moves it
+  volatile unsigned tail;  // next slot to drain; only drain() moves it
+  volatile bool dead;      // thread exited; free once drained
+
+  // one stream per nesting level (something formatted into a dout line
+  // may dout itself)
+  vector<ostringstream*> ss;
+  vector<ostream*> out;
+  int depth;
+
+  DoutThread *next;
+
+  DoutThread(unsigned n) : q(new DoutEntry[n]), qsize(n), head(0), tail(0),
+			   dead(false), depth(0), next(0) {}
+  ~DoutThread() {
+    delete[] q;
+    for (unsigned i=0; i<ss.size(); i++)
+      delete ss[i];
+  }
+};
+
+class DoutWriter : public Thread {
+  void *entry();
+};
+
+static pthread_once_t dout_once = PTHREAD_ONCE_INIT;
+static pthread_key_t dout_key;
+
+static volatile unsigned long dout_seq = 0;
+
+static Mutex *threads_lock;        // protects the thread list
+static DoutThread *threads = 0;
+
+static Mutex *writer_lock;         // protects the rest; held while draining
+static pthread_t writer_holder;    // for fatal_signal: who has writer_lock
+static volatile bool writer_held = false;
+static Cond *writer_cond;
+static DoutWriter *writer;
+static volatile bool writer_running = false;
+static bool writer_stop = false;
+static volatile bool stopped = false;  // after exit(); write lines in place
+
+static vector<string> recent;
+static unsigned recent_next = 0;
+
+static void lock_writer()
+{
+  writer_lock->Lock();
+  writer_holder = pthread_self();
+  writer_held = true;
+}
+
+static void unlock_writer()
+{
+  writer_held = false;
+  writer_lock->Unlock();
+}
+
+
+// -- setup
+
+static void thread_exit(void *p)
+{
+  ((DoutThread*)p)->dead = true;
+}
+
+static void fork_prepare()
+{
+  lock_writer();
+  threads_lock->Lock();
+}
+
+static void fork_parent()
+{
+  threads_lock->Unlock();
+  unlock_writer();
+}
+
+static void fork_child()
+{
+  // only the forking thread made it over; the writer needs restarting.
+  DoutThread *me = (DoutThread*)pthread_getspecific(dout_key);
+  for (DoutThread *t = threads; t; t = t->next)
+    if (t != me)
+      t->dead = true;
+  writer_running = false;
+  writer_stop = false;
+  threads_lock->Unlock();
+  unlock_writer();
+}
+
+static void init()
+{
+  pthread_key_create(&dout_key, thread_exit);
+  threads_lock = new Mutex;
+  writer_lock = new Mutex;
+  writer_cond = new Cond;
+  writer = new DoutWriter;
+  pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+static void shutdown();
+static void fatal_signal(int sig);
+
+static void start_writer()
+{
+  static bool registered = false;
+
+  lock_writer();
+  if (!writer_running && !stopped) {
+    if (!registered) {
+      registered = true;
+      atexit(shutdown);
+
+      int sigs[] = { SIGSEGV, SIGABRT, SIGBUS, SIGILL, SIGFPE, 0 };
+      for (int i=0; sigs[i]; i++) {
+	struct sigaction sa;
+	sigaction(sigs[i], 0, &sa);
+	if (sa.sa_handler == SIG_DFL)
+	  signal(sigs[i], fatal_signal);
+      }
+    }
+    recent.resize(g_conf.dout_recent_entries);
+    writer_running = true;
+    writer->create();
+  }
+  unlock_writer();
+}
+
+static DoutThread *get_thread()
+{
+  pthread_once(&dout_once, init);
+
+  DoutThread *t = (DoutThread*)pthread_getspecific(dout_key);
+  if (!t) {
+    int n = g_conf.dout_async_entries;
+    if (n < 2)
+      n = 2;
+    t = new DoutThread(n);
+    pthread_setspecific(dout_key, t);
+    threads_lock->Lock();
+    t->next = threads;
+    threads = t;
+    threads_lock->Unlock();
+  }
+  if (!writer_running)
+    start_writer();
+  return t;
+}
+
+
+// -- writing
+
+struct entry_seq_lt {
+  bool operator()(const DoutEntry *a, const DoutEntry *b) const {
+    return a->seq < b->seq;
+  }
+};
+
+/*
+ * write out everything queued so far.  writer_lock must be held.
+ */
+static void drain()
+{
+  vector<DoutEntry*> batch;
+  vector< pair<DoutThread*,unsigned> > took;
+
+  threads_lock->Lock();
+  DoutThread **pt = &threads;
+  while (*pt) {
+    DoutThread *t = *pt;
+    unsigned head = t->head;
+    __sync_synchronize();  // read the entries after head
+    if (head == t->tail) {
+      if (t->dead) {
+	*pt = t->next;
+	delete t;
+	continue;
+      }
+    } else {
+      for (unsigned i = t->tail; i != head; i++)
+	batch.push_back(&t->q[i % t->qsize]);
+      took.push_back(pair<DoutThread*,unsigned>(t, head));
+    }
+    pt = &t->next;
+  }
+  threads_lock->Unlock();
+
+  if (batch.empty())
+    return;
+  sort(batch.begin(), batch.end(), entry_seq_lt());
+
+  vector<ostream*> streams;
+  _dout_lock.Lock();
+  for (unsigned i=0; i<batch.size(); i++) {
+    DoutEntry *e = batch[i];
+    if (e->out) {
+      *e->out << e->text << '\n';
+      if (find(streams.begin(), streams.end(), e->out) == streams.end())
+	streams.push_back(e->out);
+    }
+    if (!recent.empty()) {
+      recent[recent_next].swap(e->text);
+      recent_next = (recent_next + 1) % recent.size();
+    }
+  }
+  for (unsigned i=0; i<streams.size(); i++)
+    streams[i]->flush();
+  _dout_lock.Unlock();
+
+  __sync_synchronize();  // done with the entries before we give them back
+  for (unsigned i=0; i<took.size(); i++)
+    took[i].first->tail = took[i].second;
+}
+
+void *DoutWriter::entry()
+{
+  lock_writer();
+  while (!writer_stop) {
+    drain();
+    int ms = g_conf.dout_flush_ms;
+    writer_held = false;
+    writer_cond->WaitInterval(*writer_lock, utime_t(ms / 1000, (ms % 1000) * 1000));
+    writer_holder = pthread_self();
+    writer_held = true;
+  }
+  unlock_writer();
+  return 0;
+}
+
+static void shutdown()
+{
+  lock_writer();
+  writer_stop = true;
+  writer_cond->Signal();
+  unlock_writer();
+  if (writer_running)
+    writer->join();
+
+  lock_writer();
+  drain();
+  stopped = true;
+  writer_running = false;
+  unlock_writer();
+}
+
+
+// -- interface
+
+ostream& _dout_begin(ostream& out, int mode)
+{
+  DoutThread *t = get_thread();
+  if (t->depth == (int)t->ss.size()) {
+    t->ss.push_back(new ostringstream);
+    t->out.push_back(0);
+  }
+  t->out[t->depth] = (mode == 1) ? &out:0;
+  return *t->ss[t->depth++];
+}
+
+ostream& _dout_end(ostream& out)
+{
+  DoutThread *t = (DoutThread*)pthread_getspecific(dout_key);
+  assert(t && t->depth > 0);
+  int d = --t->depth;
+  ostringstream *ss = t->ss[d];
+
+  if (stopped) {
+    if (t->out[d]) {
+      _dout_lock.Lock();
+      *t->out[d] << ss->str() << std::endl;
+      _dout_lock.Unlock();
+    }
+    ss->str("");
+    return out;
+  }
+
+  if (t->head - t->tail == t->qsize)
+    dout_flush();
+
+  DoutEntry &e = t->q[t->head % t->qsize];
+  e.seq = __sync_fetch_and_add(&dout_seq, 1);
+  e.out = t->out[d];
+  e.text = ss->str();
+  ss->str("");
+  __sync_synchronize();  // fill the entry before we publish it
+  t->head++;
+
+  if (t->head - t->tail == t->qsize / 2)
+    writer_cond->Signal();
+  return out;
+}
+
+/*
+ * write out everything queued so far, from this thread.
+ */
+void dout_flush()
+{
+  pthread_once(&dout_once, init);
+  lock_writer();
+  drain();
+  unlock_writer();
+}
+
+void dout_dump_recent()
+{
+  pthread_once(&dout_once, init);
+  lock_writer();
+  drain();
+  _dout_lock.Lock();
+  *_dout << "--- begin dump of recent events ---\n";
+  for (unsigned i=0; i<recent.size(); i++) {
+    string& s = recent[(recent_next + i) % recent.size()];
+    if (s.length())
+      *_dout << s << '\n';
+  }
+  *_dout << "--- end dump of recent events ---" << std::endl;
+  _dout_lock.Unlock();
+  unlock_writer();
+}
+
+/*
+ * signal handler helpers: no locks, no allocation, no streams.
+ */
+static void sig_write(const char *s, size_t len)
+{
+  while (len > 0) {
+    ssize_t r = ::write(_dout_fd, s, len);
+    if (r <= 0)
+      return;
+    s += r;
+    len -= r;
+  }
+}
+
+static void sig_write(const char *s)
+{
+  sig_write(s, strlen(s));
+}
+
+static void sig_write_line(const string& s)
+{
+  if (s.length()) {
+    sig_write(s.data(), s.length());
+    sig_write("\n", 1);
+  }
+}
+
+static void fatal_signal(int sig)
+{
+  signal(sig, SIG_DFL);
+
+  char num[12];
+  int i = sizeof(num) - 1;
+  num[i] = 0;
+  int n = sig;
+  do {
+    num[--i] = '0' + n % 10;
+    n /= 10;
+  } while (n);
+  sig_write("*** caught signal ");
+  sig_write(num + i);
+  sig_write(" ***\n");
+
+  // we may have crashed holding one of these, or another thread may be
+  // stuck in one.  don't wait, and don't touch the ring if it may be
+  // half updated.  they are recursive, so a try-lock alone would let us
+  // back into our own critical section: check for that first.
+  if (!writer_lock ||
+      (writer_held && pthread_equal(writer_holder, pthread_self())) ||
+      !writer_lock->TryLock()) {
+    sig_write("--- dout writer busy, not dumping recent events ---\n");
+  } else {
+    if (_dout_lock.is_locked() || !_dout_lock.TryLock()) {
+      sig_write("--- dout busy, not dumping recent events ---\n");
+    } else {
+      sig_write("--- begin dump of recent events ---\n");
+      for (unsigned i=0; i<recent.size(); i++)
+	sig_write_line(recent[(recent_next + i) % recent.size()]);
+
+      // lines not yet drained, thread by thread
+      if (!threads_lock->is_locked() && threads_lock->TryLock()) {
+	for (DoutThread *t = threads; t; t = t->next)
+	  for (unsigned j = t->tail; j != t->head; j++)
+	    sig_write_line(t->q[j % t->qsize].text);
+	threads_lock->Unlock();
+      }
+      sig_write("--- end dump of recent events ---\n");
+      _dout_lock.Unlock();
+    }
+    writer_lock->Unlock();
+  }
+
+  raise(sig);
+}
@@ -0,0 +1,76 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef __LOADFORECAST_H
+#define __LOADFORECAST_H
+
+/**
+ * LoadForecast -- short term forecast of a regularly sampled load.
+ *
+ * Holt's linear (double exponential) smoothing: a smoothed level plus a
+ * smoothed trend.  A single burst moves the level by only alpha of its
+ * size, and the trend by less, so a one-off spike doesn't look like a
+ * lasting shift, while a sustained ramp is picked up within a few samples.
+ *
+ * Samples are assumed to be evenly spaced; predict(n) is n sample
+ * intervals ahead.
+ */
+
+class LoadForecast {
+  double alpha;     // level smoothing, 0..1
+  double beta;      // trend smoothing, 0..1
+  double level;
+  double trend;
+  double last;      // last raw sample
+  int n;            // samples seen
+
+ public:
+  LoadForecast(double a = .5, double b = .2) :
+    alpha(a), beta(b), level(0), trend(0), last(0), n(0) { }
+
+  void set_params(double a, double b) {
+    alpha = a;
+    beta = b;
+  }
+
+  void sample(double v) {
+    if (n == 0) {
+      level = v;
+      trend = 0;
+    } else {
+      double l = alpha * v + (1.0 - alpha) * (level + trend);
+      trend = beta * (l - level) + (1.0 - beta) * trend;
+      level = l;
+    }
+    last = v;
+    n++;
+  }
+
+  double predict(double steps) const {
+    double p = level + steps * trend;
+    return p < 0 ? 0 : p;
+  }
+
+  double get_level() const { return level; }
+  double get_trend() const { return trend; }
+  double get_last() const { return last; }
+  int get_num_samples() const { return n; }
+
+  void reset() {
+    level = trend = last = 0;
+    n = 0;
+  }
+};
+
+#endif
@@ -18,6 +18,7 @@
 
 #include "LogType.h"
 #include "Logger.h"
+#include "PerfCounters.h"
 
 #include <iostream>
 #include "Clock.h"
@@ -158,6 +159,8 @@ Logger::~Logger()
   {
     _flush();
     out.close();
+    if (json_out.is_open())
+      json_out.close();
     logger_list.remove(this); // slow, but rare.
     if (logger_list.empty()) 
       logger_event = 0;       // stop the timer events.
@@ -166,6 +169,31 @@ Logger::~Logger()
 }
 
 
+void Logger::add_perf(PerfCounters *p)
+{
+  logger_lock.Lock();
+  perfs.push_back(p);
+  wrote_header = -1;  // new columns
+  if (!json_out.is_open()) {
+    string fn = filename + ".json";
+    json_out.open(fn.c_str(), ofstream::out|ofstream::app);
+  }
+  logger_lock.Unlock();
+}
+
+void Logger::remove_perf(PerfCounters *p)
+{
+  logger_lock.Lock();
+  for (vector<PerfCounters*>::iterator i = perfs.begin(); i != perfs.end(); i++)
+    if (*i == p) {
+      perfs.erase(i);
+      wrote_header = -1;
+      break;
+    }
+  logger_lock.Unlock();
+}
+
+
 /*
 void Logger::flush()
 {
@@ -187,6 +215,8 @@ void Logger::_flush()
       if (type->avg[i]) 
 	out << "\t" << type->keys[i] << "*\t" << type->keys[i] << "~";
     }
+    for (unsigned i=0; i<perfs.size(); i++)
+      perfs[i]->write_header(out);
     out << std::endl;  //out << "\t (" << type->keymap.size() << ")" << endl;
     wrote_header = type->version;
     wrote_header_last = 0;
@@ -218,7 +248,18 @@ void Logger::_flush()
       }
     }
   }
+  for (unsigned i=0; i<perfs.size(); i++)
+    perfs[i]->write_interval(out);
   out << std::endl;
+
+  if (!perfs.empty()) {
+    json_out << "{\"t\": " << last_flush;
+    for (unsigned i=0; i<perfs.size(); i++) {
+      json_out << ", ";
+      perfs[i]->dump_json(json_out);
+    }
+    json_out << "}" << std::endl;
+  }
   
   // reset the counters
   for (unsigned i=0; i<type->keys.size(); i++) {
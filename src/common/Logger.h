@@ -28,6 +28,8 @@ using std::ofstream;
 
 #include "LogType.h"
 
+class PerfCounters;
+
 
 class Logger {
  protected:
@@ -56,6 +58,10 @@ class Logger {
   int wrote_header;
   int wrote_header_last;
 
+  // lock-free counters written along with ours
+  vector<PerfCounters*> perfs;
+  ofstream json_out;
+
  public:
   Logger(string fn, LogType *type, bool append=false);
   ~Logger();
@@ -72,6 +78,9 @@ class Logger {
   void _flush();
 
   void set_start(utime_t s);
+
+  void add_perf(PerfCounters *p);
+  void remove_perf(PerfCounters *p);
 };
 
 #endif
@@ -56,6 +56,15 @@ public:
     assert(nlock == 1 || recursive);
   }
 
+  bool TryLock() {
+    int r = pthread_mutex_trylock(&_m);
+    if (r)
+      return false;
+    nlock++;
+    assert(nlock == 1 || recursive);
+    return true;
+  }
+
   void Unlock() {
     assert(nlock > 0);
     --nlock;
@@ -0,0 +1,194 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "PerfCounters.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+pthread_key_t PerfCounters::shard_key;
+pthread_once_t PerfCounters::shard_once = PTHREAD_ONCE_INIT;
+
+static volatile unsigned next_shard = 0;
+
+void PerfCounters::init_shard_key()
+{
+  pthread_key_create(&shard_key, 0);
+}
+
+unsigned PerfCounters::new_shard()
+{
+  unsigned s = __sync_fetch_and_add(&next_shard, 1) % PERF_SHARDS + 1;
+  pthread_setspecific(shard_key, (void*)(uintptr_t)s);
+  return s;
+}
+
+
+PerfCounters::PerfCounters(const char *n, PerfCountersType *t) :
+  name(n), type(t)
+{
+  // pad each shard out to a cache line so threads don't share one
+  stride = (type->num_vals + 7) & ~7;
+  if (!stride)
+    stride = 8;
+  vals = 0;
+  if (posix_memalign((void**)&vals, 64, PERF_SHARDS * stride * sizeof(uint64_t)))
+    assert(0);
+  memset(vals, 0, PERF_SHARDS * stride * sizeof(uint64_t));
+  last.resize(type->num_vals);
+}
+
+PerfCounters::~PerfCounters()
+{
+  free(vals);
+}
+
+void PerfCounters::tinc(int idx, utime_t lat)
+{
+  PerfCountersType::desc_t& d = desc(idx);
+  assert(d.kind == PERFC_LAT);
+
+  uint64_t us = (uint64_t)lat.sec() * 1000000 + lat.usec();
+  int b = 0;
+  for (uint64_t t = us; t && b < PERF_LAT_BUCKETS-1; t >>= 1)
+    b++;
+
+  uint64_t *v = &vals[get_shard() * stride + d.slot];
+  __sync_fetch_and_add(&v[0], 1);
+  __sync_fetch_and_add(&v[1], us);
+  __sync_fetch_and_add(&v[2 + b], 1);
+}
+
+uint64_t PerfCounters::sum(unsigned slot)
+{
+  uint64_t t = 0;
+  for (int s=0; s<PERF_SHARDS; s++)
+    t += vals[s * stride + slot];
+  return t;
+}
+
+uint64_t PerfCounters::get(int idx)
+{
+  PerfCountersType::desc_t& d = desc(idx);
+  if (d.kind == PERFC_SET)
+    return vals[d.slot];
+  return sum(d.slot);
+}
+
+void PerfCounters::get_lat(int idx, uint64_t& count, double& s, vector<uint64_t>& buckets)
+{
+  PerfCountersType::desc_t& d = desc(idx);
+  assert(d.kind == PERFC_LAT);
+  count = sum(d.slot);
+  s = (double)sum(d.slot + 1) / 1000000.0;
+  buckets.resize(PERF_LAT_BUCKETS);
+  for (int b=0; b<PERF_LAT_BUCKETS; b++)
+    buckets[b] = sum(d.slot + 2 + b);
+}
+
+
+// -- output
+
+void PerfCounters::write_header(ostream& out)
+{
+  for (unsigned i=0; i<type->descs.size(); i++) {
+    PerfCountersType::desc_t& d = type->descs[i];
+    if (!d.kind)
+      continue;
+    out << "\t" << d.name;
+    if (d.kind == PERFC_LAT)
+      out << "\t" << d.name << "*\t" << d.name << "%99";
+  }
+}
+
+/*
+ * one Logger line's worth: u64s as the change since last time, lats
+ * as the average, count and 99th percentile of the samples since last
+ * time.
+ */
+void PerfCounters::write_interval(ostream& out)
+{
+  for (unsigned i=0; i<type->descs.size(); i++) {
+    PerfCountersType::desc_t& d = type->descs[i];
+    switch (d.kind) {
+    case PERFC_U64:
+      {
+	uint64_t v = sum(d.slot);
+	out << "\t" << (v - last[d.slot]);
+	last[d.slot] = v;
+      }
+      break;
+
+    case PERFC_SET:
+      out << "\t" << vals[d.slot];
+      break;
+
+    case PERFC_LAT:
+      {
+	uint64_t n[2 + PERF_LAT_BUCKETS];
+	for (int j=0; j<2 + PERF_LAT_BUCKETS; j++) {
+	  uint64_t v = sum(d.slot + j);
+	  n[j] = v - last[d.slot + j];
+	  last[d.slot + j] = v;
+	}
+	if (!n[0]) {
+	  out << "\t0\t0\t0";
+	  break;
+	}
+	// p99 is the top of the bucket it falls in
+	uint64_t want = n[0] - n[0] / 100, seen = 0;
+	int b = 0;
+	while (b < PERF_LAT_BUCKETS-1 && (seen += n[2 + b]) < want)
+	  b++;
+	double p99 = (double)(1ULL << b) / 1000000.0;
+	out << "\t" << ((double)n[1] / (double)n[0] / 1000000.0)
+	    << "\t" << n[0]
+	    << "\t" << p99;
+      }
+      break;
+    }
+  }
+}
+
+/*
+ * totals since startup, as a JSON object.
+ */
+void PerfCounters::dump_json(ostream& out)
+{
+  out << "\"" << name << "\": {";
+  bool first = true;
+  for (unsigned i=0; i<type->descs.size(); i++) {
+    PerfCountersType::desc_t& d = type->descs[i];
+    if (!d.kind)
+      continue;
+    if (!first)
+      out << ", ";
+    first = false;
+    out << "\"" << d.name << "\": ";
+    if (d.kind == PERFC_LAT) {
+      uint64_t count;
+      double s;
+      vector<uint64_t> buckets;
+      get_lat(type->first + 1 + i, count, s, buckets);
+      while (!buckets.empty() && buckets.back() == 0)
+	buckets.pop_back();
+      out << "{\"count\": " << count << ", \"sum\": " << s << ", \"hist\": [";
+      for (unsigned b=0; b<buckets.size(); b++)
+	out << (b ? ", ":"") << buckets[b];
+      out << "]}";
+    } else
+      out << get(type->first + 1 + i);
+  }
+  out << "}";
+}
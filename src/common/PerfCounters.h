@@ -0,0 +1,158 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+
+#ifndef __PERFCOUNTERS_H
+#define __PERFCOUNTERS_H
+
+#include "include/types.h"
+#include "include/utime.h"
+
+#include <vector>
+#include <iostream>
+using std::vector;
+using std::ostream;
+
+#include <pthread.h>
+
+
+/*
+ * counters with indices fixed at compile time.
+ *
+ * each user declares an enum of its counters, bracketed by a first and
+ * last value, and describes each one once to a PerfCountersType:
+ *
+ *   enum { l_foo_first = 1000, l_foo_op, l_foo_op_lat, l_foo_last };
+ *   foo_perftype.add_u64(l_foo_op, "op");
+ *   foo_perftype.add_lat(l_foo_op_lat, "oplat");
+ *
+ * updates take no lock: every thread adds into its own shard (threads
+ * are handed shards round-robin, and atomic adds cover two threads that
+ * end up sharing one), and readers sum the shards.
+ *
+ *  u64  a counter.  the Logger writes how much it went up each interval.
+ *  set  a gauge; the last value set.
+ *  lat  latency samples: count, sum, and a histogram with log2 buckets
+ *       of microseconds.  the Logger writes the interval's average,
+ *       count and 99th percentile (in seconds).
+ *
+ * attach a PerfCounters to a Logger with Logger::add_perf() to have it
+ * written out with the Logger's own columns, and as JSON to the
+ * Logger's file + ".json".
+ */
+
+#define PERF_SHARDS     16
+#define PERF_LAT_BUCKETS 32
+
+enum {
+  PERFC_U64 = 1,
+  PERFC_SET = 2,
+  PERFC_LAT = 3
+};
+
+class PerfCountersType {
+public:
+  struct desc_t {
+    const char *name;
+    int kind;
+    unsigned slot;    // first value in a shard; lat: count, sum(usec), buckets
+    desc_t() : name(0), kind(0), slot(0) {}
+  };
+
+private:
+  int first;
+  vector<desc_t> descs;
+  unsigned num_vals;
+
+  void add(int idx, const char *name, int kind) {
+    assert(idx > first && idx - first - 1 < (int)descs.size());
+    desc_t& d = descs[idx - first - 1];
+    if (d.kind)
+      return;  // already described
+    d.name = name;
+    d.kind = kind;
+    d.slot = num_vals;
+    num_vals += (kind == PERFC_LAT) ? 2 + PERF_LAT_BUCKETS : 1;
+  }
+
+  friend class PerfCounters;
+
+public:
+  PerfCountersType(int f, int l) : first(f), descs(l - f - 1), num_vals(0) {}
+
+  void add_u64(int idx, const char *name) { add(idx, name, PERFC_U64); }
+  void add_set(int idx, const char *name) { add(idx, name, PERFC_SET); }
+  void add_lat(int idx, const char *name) { add(idx, name, PERFC_LAT); }
+
+  bool empty() { return num_vals == 0; }
+};
+
+
+class PerfCounters {
+  const char *name;
+  PerfCountersType *type;
+  unsigned stride;         // values per shard, padded to a cache line
+  uint64_t *vals;          // PERF_SHARDS * stride
+  vector<uint64_t> last;   // totals as of the last interval written
+
+  static pthread_key_t shard_key;
+  static pthread_once_t shard_once;
+  static void init_shard_key();
+  static unsigned new_shard();
+
+  static unsigned get_shard() {
+    pthread_once(&shard_once, init_shard_key);
+    unsigned s = (unsigned)(uintptr_t)pthread_getspecific(shard_key);
+    if (!s)
+      s = new_shard();
+    return s - 1;
+  }
+
+  PerfCountersType::desc_t& desc(int idx) {
+    return type->descs[idx - type->first - 1];
+  }
+  uint64_t sum(unsigned slot);
+
+  // don't allow copying.
+  void operator=(PerfCounters &o) {}
+  PerfCounters(const PerfCounters &o) {}
+
+public:
+  PerfCounters(const char *n, PerfCountersType *t);
+  ~PerfCounters();
+
+  const char *get_name() { return name; }
+
+  void inc(int idx, uint64_t v = 1) {
+    PerfCountersType::desc_t& d = desc(idx);
+    assert(d.kind == PERFC_U64);
+    __sync_fetch_and_add(&vals[get_shard() * stride + d.slot], v);
+  }
+  void set(int idx, uint64_t v) {
+    PerfCountersType::desc_t& d = desc(idx);
+    assert(d.kind == PERFC_SET);
+    vals[d.slot] = v;  // shard 0
+  }
+  void tinc(int idx, utime_t lat);
+
+  uint64_t get(int idx);
+  void get_lat(int idx, uint64_t& count, double& sum, vector<uint64_t>& buckets);
+
+  // for the Logger (under its lock)
+  void write_header(ostream& out);
+  void write_interval(ostream& out);
+  void dump_json(ostream& out);
+};
+
+#endif
@@ -0,0 +1,92 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef __PHIACCRUAL_H
+#define __PHIACCRUAL_H
+
+#include <math.h>
+#include <deque>
+using std::deque;
+
+#include "Clock.h"
+
+/*
+ * phi accrual failure detector (Hayashibara et al).  we keep the last
+ * 'window' heartbeat inter-arrival times, model them as a normal
+ * distribution, and report
+ *
+ *   phi = -log10( P(the next heartbeat is still coming) )
+ *
+ * for the time since the last one.  phi 1 means a 10% chance we're
+ * wrong to call the peer dead, phi 8 one in 10^8.  stddev is floored at
+ * 'min_stddev' so that a very regular peer isn't declared dead the
+ * moment it's a little late.
+ */
+class PhiAccrual {
+  deque<double> intervals;
+  double sum, sumsq;
+  utime_t last;
+  unsigned window;
+  double min_stddev;
+
+public:
+  PhiAccrual(unsigned w=100, double ms=.1) :
+    sum(0), sumsq(0), window(w), min_stddev(ms) {}
+
+  void set_window(unsigned w, double ms) {
+    window = w;
+    min_stddev = ms;
+  }
+
+  void heartbeat(utime_t now) {
+    if (last.sec()) {
+      double i = (double)(now - last);
+      intervals.push_back(i);
+      sum += i;
+      sumsq += i*i;
+      while (intervals.size() > window) {
+	sum -= intervals.front();
+	sumsq -= intervals.front() * intervals.front();
+	intervals.pop_front();
+      }
+    }
+    last = now;
+  }
+
+  utime_t get_last() { return last; }
+  unsigned get_num_samples() { return intervals.size(); }
+  double get_mean() {
+    return intervals.empty() ? 0 : sum / intervals.size();
+  }
+  double get_stddev() {
+    if (intervals.size() < 2)
+      return min_stddev;
+    double m = get_mean();
+    double v = sumsq / intervals.size() - m*m;
+    double s = v > 0 ? sqrt(v) : 0;
+    return s < min_stddev ? min_stddev : s;
+  }
+
+  double phi(utime_t now) {
+    if (intervals.empty())
+      return 0;
+    double t = (double)(now - last);
+    double p = .5 * erfc((t - get_mean()) / (get_stddev() * M_SQRT2));
+    if (p < 1e-300)
+      return 300;
+    return -log10(p);
+  }
+};
+
+#endif
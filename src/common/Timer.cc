@@ -21,14 +21,15 @@
 #include "config.h"
 #include "include/Context.h"
 
-#define dout(x)  if (x <= g_conf.debug_timer) *_dout << dbeginl << g_clock.now() << " TIMER "
-#define derr(x)  if (x <= g_conf.debug_timer) *_derr << dbeginl << g_clock.now() << " TIMER "
+#define dout(x)  dout_if(x, x <= g_conf.debug_timer) << g_clock.now() << " TIMER "
+#define derr(x)  derr_if(x, x <= g_conf.debug_timer) << g_clock.now() << " TIMER "
 
 #define DBL 10
 
 #include <signal.h>
 #include <sys/time.h>
 #include <math.h>
+#include <string.h>
 
 // single global instance
 Timer      g_timer;
@@ -37,17 +38,206 @@ Timer      g_timer;
 
 /**** thread solution *****/
 
-bool Timer::get_next_due(utime_t& when)
+Timer::Timer() :
+  cur_tick(0),
+  free_entries(0),
+  hash_buckets(TIMER_SLOTS), hash_mask(TIMER_SLOTS-1),
+  thread_stop(false),
+  timed_sleep(false),
+  sleeping(false),
+  sleep_tick(0),
+  timer_thread(this),
+  num_event(0)
 {
-  if (scheduled.empty()) {
+  memset(nonempty, 0, sizeof(nonempty));
+}
+
+Timer::~Timer()
+{
+  // stop.
+  cancel_timer();
+
+  // scheduled
+  for (int l=0; l<TIMER_LEVELS; l++)
+    for (int s=0; s<TIMER_SLOTS; s++)
+      for (Entry *e = wheel[l][s].head; e; e = e->next)
+	delete e->callback;
+  for (unsigned i=0; i<slabs.size(); i++)
+    delete[] slabs[i];
+}
+
+
+// -- entries
+
+Timer::Entry *Timer::new_entry()
+{
+  if (!free_entries) {
+    Entry *slab = new Entry[TIMER_SLAB];
+    slabs.push_back(slab);
+    for (int i=0; i<TIMER_SLAB; i++)
+      free_entry(&slab[i]);
+  }
+  Entry *e = free_entries;
+  free_entries = e->next;
+  return e;
+}
+
+Timer::Entry **Timer::hash_find(Context *c)
+{
+  unsigned long h = (unsigned long)c;
+  Entry **p = &hash_buckets[(h >> 4 ^ h >> 12) & hash_mask];
+  while (*p && (*p)->callback != c)
+    p = &(*p)->hnext;
+  return p;
+}
+
+void Timer::hash_grow()
+{
+  vector<Entry*> old(hash_buckets.size() * 2);
+  old.swap(hash_buckets);
+  hash_mask = hash_buckets.size() - 1;
+  for (unsigned i=0; i<old.size(); i++) {
+    Entry *e = old[i];
+    while (e) {
+      Entry *next = e->hnext;
+      Entry **p = hash_find(e->callback);
+      e->hnext = *p;
+      *p = e;
+      e = next;
+    }
+  }
+}
+
+
+// -- wheel
+
+void Timer::wheel_add(Entry *e)
+{
+  if (e->tick < cur_tick)
+    e->tick = cur_tick;   // overdue; fire on the next tick we process
+  uint64_t delta = e->tick - cur_tick;
+  uint64_t t = e->tick;
+
+  int l = 0;
+  while (l < TIMER_LEVELS-1 && delta >> (TIMER_SLOT_BITS * (l+1)))
+    l++;
+  if (delta >> (TIMER_SLOT_BITS * TIMER_LEVELS))
+    t = cur_tick + (1ULL << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1;  // past the top; re-placed when cascaded
+
+  unsigned s = (t >> (TIMER_SLOT_BITS * l)) & (TIMER_SLOTS-1);
+  Slot &slot = wheel[l][s];
+  e->level = l;
+  e->slot = s;
+  e->prev = 0;
+  e->next = slot.head;
+  if (slot.head)
+    slot.head->prev = e;
+  slot.head = e;
+  nonempty[l][s / 64] |= 1ULL << (s % 64);
+}
+
+void Timer::wheel_remove(Entry *e)
+{
+  Slot &slot = wheel[e->level][e->slot];
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    slot.head = e->next;
+  if (e->next)
+    e->next->prev = e->prev;
+  if (!slot.head)
+    nonempty[e->level][e->slot / 64] &= ~(1ULL << (e->slot % 64));
+}
+
+/*
+ * redistribute a higher level's slot into the levels below.
+ */
+void Timer::cascade(int l, unsigned s)
+{
+  Entry *e = wheel[l][s].head;
+  wheel[l][s].head = 0;
+  nonempty[l][s / 64] &= ~(1ULL << (s % 64));
+  while (e) {
+    Entry *next = e->next;
+    wheel_add(e);
+    e = next;
+  }
+}
+
+/*
+ * process cur_tick: cascade whatever comes due at it, and move
+ * everything due to pending.
+ */
+void Timer::run_tick()
+{
+  for (int l = TIMER_LEVELS-1; l > 0; l--)
+    if ((cur_tick & ((1ULL << (TIMER_SLOT_BITS * l)) - 1)) == 0)
+      cascade(l, (cur_tick >> (TIMER_SLOT_BITS * l)) & (TIMER_SLOTS-1));
+
+  unsigned s = cur_tick & (TIMER_SLOTS-1);
+  Entry *e = wheel[0][s].head;
+  wheel[0][s].head = 0;
+  nonempty[0][s / 64] &= ~(1ULL << (s % 64));
+  while (e) {
+    Entry *next = e->next;
+    Entry **p = hash_find(e->callback);
+    assert(*p == e);
+    *p = e->hnext;
+    pending.push_back(e->callback);
+    free_entry(e);
+    num_event--;
+    e = next;
+  }
+  cur_tick++;
+}
+
+static int find_slot(uint64_t *bits, unsigned from, unsigned to)
+{
+  for (unsigned s = from; s < to; ) {
+    uint64_t w = bits[s / 64] >> (s % 64);
+    if (w) {
+      s += __builtin_ctzll(w);
+      return s < to ? (int)s : -1;
+    }
+    s = (s / 64 + 1) * 64;
+  }
+  return -1;
+}
+
+/*
+ * the next tick with anything to do: either events coming due (level 0)
+ * or a higher-level slot to cascade.
+ */
+bool Timer::get_next_due(uint64_t& when)
+{
+  if (num_event == 0) {
     dout(10) << "get_next_due - nothing scheduled" << dendl;
     return false;
-  } else {
-    map< utime_t, set<Context*> >::iterator it = scheduled.begin();
-    when = it->first;
-    dout(10) << "get_next_due - " << when << dendl;
-    return true;
   }
+
+  when = (uint64_t)-1;
+  for (int l=0; l<TIMER_LEVELS; l++) {
+    int shift = TIMER_SLOT_BITS * l;
+    uint64_t span = 1ULL << (shift + TIMER_SLOT_BITS);
+    uint64_t base = cur_tick & ~(span - 1);
+    unsigned pos = (cur_tick >> shift) & (TIMER_SLOTS-1);
+
+    int js[3];
+    js[0] = find_slot(nonempty[l], pos, TIMER_SLOTS);
+    js[1] = js[0] == (int)pos ? find_slot(nonempty[l], pos+1, TIMER_SLOTS) : -1;
+    js[2] = find_slot(nonempty[l], 0, pos);
+    for (int i=0; i<3; i++) {
+      if (js[i] < 0)
+	continue;
+      uint64_t t = base + ((uint64_t)js[i] << shift);
+      if (t < cur_tick)
+	t += span;   // next time around
+      if (t < when)
+	when = t;
+    }
+  }
+  dout(10) << "get_next_due - " << from_tick(when) << dendl;
+  return true;
 }
 
 
@@ -59,74 +249,51 @@ void Timer::timer_entry()
     
     // now
     utime_t now = g_clock.now();
+    uint64_t now_tick = ((uint64_t)now.sec() * 1000000 + now.usec()) / TIMER_TICK_US;
 
-    // any events due?
-    utime_t next;
-    bool next_due = get_next_due(next);
-    
-    if (next_due && now >= next) {
-      // move to pending list
-      list<Context*> pending;
-
-      map< utime_t, set<Context*> >::iterator it = scheduled.begin();
-      while (it != scheduled.end()) {
-        if (it->first > now) break;
-
-        utime_t t = it->first;
-        dout(DBL) << "queueing event(s) scheduled at " << t << dendl;
-
-        for (set<Context*>::iterator cit = it->second.begin();
-             cit != it->second.end();
-             cit++) {
-          pending.push_back(*cit);
-          event_times.erase(*cit);
-          num_event--;
-        }
-
-        map< utime_t, set<Context*> >::iterator previt = it;
-        it++;
-        scheduled.erase(previt);
-      }
+    // move everything due to pending
+    uint64_t next;
+    while (get_next_due(next) && next <= now_tick) {
+      cur_tick = next;
+      run_tick();
+    }
 
-      if (!pending.empty()) {
-        sleeping = false;
-        lock.Unlock();
-        { 
-	  // make sure we're not holding any locks while we do callbacks
-          // make the callbacks myself.
-          for (list<Context*>::iterator cit = pending.begin();
-               cit != pending.end();
-               cit++) {
-            dout(DBL) << "start callback " << *cit << dendl;
-            (*cit)->finish(0);
-            dout(DBL) << "finish callback " << *cit << dendl;
-	    delete *cit;
-          }
-          pending.clear();
-          assert(pending.empty());
-        }
-        lock.Lock();
+    if (!pending.empty()) {
+      dout(DBL) << "firing " << pending.size() << " event(s)" << dendl;
+      sleeping = false;
+      lock.Unlock();
+      {
+	// make sure we're not holding any locks while we do callbacks
+	// make the callbacks myself.  only this thread touches pending.
+	for (unsigned i=0; i<pending.size(); i++) {
+	  dout(DBL) << "start callback " << pending[i] << dendl;
+	  pending[i]->finish(0);
+	  dout(DBL) << "finish callback " << pending[i] << dendl;
+	  delete pending[i];
+	}
+	pending.clear();
       }
-
+      lock.Lock();
+      continue;
     }
-    else {
-      // sleep
-      if (next_due) {
-        dout(DBL) << "sleeping until " << next << dendl;
-        timed_sleep = true;
-        sleeping = true;
-        timeout_cond.WaitUntil(lock, next);  // wait for waker or time
-        utime_t now = g_clock.now();
-        dout(DBL) << "kicked or timed out at " << now << dendl;
-      } else {
-        dout(DBL) << "sleeping" << dendl;
-        timed_sleep = false;
-        sleeping = true;
-        sleep_cond.Wait(lock);         // wait for waker
-        utime_t now = g_clock.now();
-        dout(DBL) << "kicked at " << now << dendl;
-      }
+
+    // sleep
+    if (num_event) {
+      utime_t until = from_tick(next);
+      dout(DBL) << "sleeping until " << until << dendl;
+      timed_sleep = true;
+      sleeping = true;
+      sleep_tick = next;
+      timeout_cond.WaitUntil(lock, until);  // wait for waker or time
+      dout(DBL) << "kicked or timed out at " << g_clock.now() << dendl;
+    } else {
+      dout(DBL) << "sleeping" << dendl;
+      timed_sleep = false;
+      sleeping = true;
+      sleep_cond.Wait(lock);         // wait for waker
+      dout(DBL) << "kicked at " << g_clock.now() << dendl;
     }
+    sleeping = false;
   }
 
   lock.Unlock();
@@ -199,15 +366,31 @@ void Timer::add_event_at(utime_t when,
 
   dout(DBL) << "add_event " << callback << " at " << when << dendl;
 
+  if (num_event == 0) {
+    // nothing on the wheel; skip ahead to now.
+    utime_t now = g_clock.now();
+    uint64_t now_tick = ((uint64_t)now.sec() * 1000000 + now.usec()) / TIMER_TICK_US;
+    if (now_tick > cur_tick)
+      cur_tick = now_tick;
+  }
+
   // insert
-  scheduled[when].insert(callback);
-  assert(event_times.count(callback) == 0);
-  event_times[callback] = when;
+  Entry **p = hash_find(callback);
+  assert(*p == 0);
+  Entry *e = new_entry();
+  e->callback = callback;
+  e->tick = to_tick(when);
+  e->hnext = 0;
+  *p = e;
+  wheel_add(e);
   
   num_event++;
+  if ((unsigned)num_event > hash_buckets.size())
+    hash_grow();
   
   // make sure i wake up on time
-  register_timer();
+  if (!sleeping || !timed_sleep || e->tick < sleep_tick)
+    register_timer();
   
   lock.Unlock();
 }
@@ -218,20 +401,18 @@ bool Timer::cancel_event(Context *callback)
   
   dout(DBL) << "cancel_event " << callback << dendl;
 
-  if (!event_times.count(callback)) {
+  Entry **p = hash_find(callback);
+  if (!*p) {
     dout(DBL) << "cancel_event " << callback << " isn't scheduled (probably executing)" << dendl;
     lock.Unlock();
     return false;     // wasn't scheduled.
   }
 
-  utime_t tp = event_times[callback];
-  event_times.erase(callback);
-
-  assert(scheduled.count(tp));
-  assert(scheduled[tp].count(callback));
-  scheduled[tp].erase(callback);
-  if (scheduled[tp].empty())
-    scheduled.erase(tp);
+  Entry *e = *p;
+  *p = e->hnext;
+  wheel_remove(e);
+  free_entry(e);
+  num_event--;
   
   lock.Unlock();
 
@@ -306,8 +487,14 @@ void SafeTimer::cancel_all()
 {
   assert(lock.is_locked());
   
-  while (!scheduled.empty()) 
-    cancel_event(scheduled.begin()->first);
+  vector<Context*> ls;
+  ls.reserve(scheduled.size());
+  for (hash_map<Context*,Context*>::iterator p = scheduled.begin();
+       p != scheduled.end();
+       p++)
+    ls.push_back(p->first);
+  for (unsigned i=0; i<ls.size(); i++)
+    cancel_event(ls[i]);
 }
 
 void SafeTimer::join()
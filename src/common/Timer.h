@@ -26,8 +26,10 @@
 
 #include <map>
 #include <set>
+#include <vector>
 using std::map;
 using std::set;
+using std::vector;
 
 #include <ext/hash_map>
 using namespace __gnu_cxx;
@@ -35,6 +37,17 @@ using namespace __gnu_cxx;
 
 /*** Timer
  * schedule callbacks
+ *
+ * events live on a hierarchical hashed timer wheel: TIMER_LEVELS levels
+ * of TIMER_SLOTS slots, ticking every TIMER_TICK_US.  an event goes into
+ * the lowest level whose span covers how far off it is; as time reaches
+ * a higher-level slot, its events are redistributed into the levels
+ * below.  events are rounded up to a tick, so they never fire early.
+ *
+ * adding and canceling are O(1) and don't allocate: entries come off a
+ * slab free list, and are found by Context* through a chained hash
+ * threaded through the entries themselves.  the thread fires everything
+ * due in one batch, outside the lock.
  */
 
 //class Messenger;
@@ -50,12 +63,61 @@ namespace __gnu_cxx {
 }
 
 
+#define TIMER_TICK_US     1000
+#define TIMER_SLOT_BITS   8
+#define TIMER_SLOTS       (1 << TIMER_SLOT_BITS)
+#define TIMER_LEVELS      4
+#define TIMER_SLAB        1024
+
 class Timer {
  private:
-  map< utime_t, set<Context*> >  scheduled;    // time -> (context ...)
-  hash_map< Context*, utime_t >  event_times;  // event -> time
+  struct Entry {
+    Context *callback;
+    uint64_t tick;          // due
+    Entry *next, *prev;     // slot list (next is the free list, too)
+    Entry *hnext;           // hash chain
+    short level, slot;
+  };
+
+  struct Slot {
+    Entry *head;
+    Slot() : head(0) {}
+  };
 
-  bool get_next_due(utime_t &when);
+  Slot      wheel[TIMER_LEVELS][TIMER_SLOTS];
+  uint64_t  nonempty[TIMER_LEVELS][TIMER_SLOTS / 64];   // bitmaps of slots
+  uint64_t  cur_tick;       // next tick to process
+
+  vector<Entry*> slabs;
+  Entry    *free_entries;
+
+  vector<Entry*> hash_buckets;  // size is a power of 2
+  unsigned  hash_mask;
+
+  vector<Context*> pending;     // fired, to be called back
+
+  static uint64_t to_tick(utime_t t) {
+    return ((uint64_t)t.sec() * 1000000 + t.usec() + TIMER_TICK_US - 1) / TIMER_TICK_US;
+  }
+  static utime_t from_tick(uint64_t tick) {
+    uint64_t us = tick * TIMER_TICK_US;
+    return utime_t(us / 1000000, us % 1000000);
+  }
+
+  Entry *new_entry();
+  void free_entry(Entry *e) {
+    e->next = free_entries;
+    free_entries = e;
+  }
+
+  Entry **hash_find(Context *c);
+  void hash_grow();
+
+  void wheel_add(Entry *e);
+  void wheel_remove(Entry *e);
+  void cascade(int level, unsigned slot);
+  void run_tick();
+  bool get_next_due(uint64_t &when);
 
   void register_timer();  // make sure i get a callback
   void cancel_timer();    // make sure i get a callback
@@ -64,6 +126,7 @@ class Timer {
   Mutex     lock;
   bool      timed_sleep;
   bool      sleeping;
+  uint64_t  sleep_tick;     // when a timed sleep ends
   Cond      sleep_cond;
   Cond      timeout_cond;
 
@@ -85,29 +148,8 @@ class Timer {
 
 
  public:
-  Timer() :
-    thread_stop(false),
-    timed_sleep(false),
-    sleeping(false),
-    timer_thread(this),
-    num_event(0)
-  { 
-  }
-  ~Timer() { 
-    // stop.
-    cancel_timer();
-
-    // scheduled
-    for (map< utime_t, set<Context*> >::iterator it = scheduled.begin();
-         it != scheduled.end();
-         it++) {
-      for (set<Context*>::iterator sit = it->second.begin();
-           sit != it->second.end();
-           sit++)
-        delete *sit;
-    }
-    scheduled.clear();
-  }
+  Timer();
+  ~Timer();
   
   void init() {
     register_timer();
@@ -140,7 +182,7 @@ class Timer {
 class SafeTimer {
   Mutex&        lock;
   Cond          cond;
-  map<Context*,Context*> scheduled;  // actual -> wrapper
+  hash_map<Context*,Context*> scheduled;  // actual -> wrapper
   map<Context*,Context*> canceled;
   
   class EventWrapper : public Context {
@@ -38,6 +38,7 @@ atomic_t buffer_total_alloc;
 Mutex _dout_lock;
 ostream *_dout = &std::cout;
 ostream *_derr = &std::cerr;
+int _dout_fd = 1;
 char _dout_file[100] = {0};
 char _dout_dir[1000] = {0};
 char _dout_symlink_path[1000] = {0};
@@ -130,6 +131,10 @@ md_config_t g_conf = {
   logger_calc_variance: true,
 
   dout_dir: 0, //"out",
+  dout_async: true,          // format lines per thread, write them from a writer thread
+  dout_async_entries: 1024,  // per-thread queue
+  dout_flush_ms: 50,
+  dout_recent_entries: 10000,
 
   fake_clock: false,
   fakemessenger_serialize: true,
@@ -165,6 +170,7 @@ md_config_t g_conf = {
   debug_ms: 0,
   debug_mon: 1,
   debug_paxos: 0,
+  debug_recent: 0,       // format and keep lines up to this level, for the crash dump
   
   debug_after: 0,
   
@@ -198,8 +204,18 @@ md_config_t g_conf = {
   mon_stop_on_last_unmount: false,
   mon_stop_with_last_mds: false,
   mon_allow_mds_bully: false,   // allow a booting mds to (forcibly) claim an mds # .. FIXME
+  mon_store_log: false,         // LogMonitorStore (one log file) instead of a file per key
+  mon_store_log_compact_min: 16 << 20,  // don't compact a log smaller than this
+  mon_store_log_compact_ratio: 2.0,     // compact when log size > ratio * live data
+  mon_osdmap_merge: true,       // send clients merged osdmap incrementals
+  mon_osdmap_merge_min: 8,      // ...if they're at least this many epochs behind
+  mon_osdmap_merge_compress: true,
+  mon_osdmap_merge_cache: 4 << 20,  // bytes of merged incrementals to keep around
 
   paxos_propose_interval: 1.0,  // gather updates for this long before proposing a map update
+  paxos_pipeline_window: 3,     // values begun but not yet accepted by the whole quorum
+
+  mon_pgmap_full_interval: 100, // store the full pgmap every N versions
 
   // --- client ---
   client_cache_size: 1000,
@@ -219,12 +235,16 @@ md_config_t g_conf = {
   client_oc_size:      1024*1024* 10,    // MB * n
   client_oc_max_dirty: 1024*1024* 10,    // MB * n  (dirty OR tx)
   client_oc_max_sync_write: 128*1024,   // synx writes >= this use wrlock
+  client_readahead_min: 128*1024,       // first readahead window (0 = no readahead)
 
   // --- objecter ---
   objecter_buffer_uncommitted: true,  // this must be true for proper failure handling
   objecter_map_request_interval: 15.0, // request a new map every N seconds, if we have pending io
   objecter_tick_interval: 5.0,
   objecter_timeout: 10.0,    // before we ask for a map
+  objecter_osd_window: 8,            // ops in flight per osd (0 = no limit)
+  objecter_osd_window_bytes: 1<<20,  // bytes in flight per osd (0 = no limit)
+  objecter_max_op_bytes: 512<<10,    // split bigger extents (0 = don't)
 
   // --- journaler ---
   journaler_allow_split_entries: true,
@@ -247,8 +267,14 @@ md_config_t g_conf = {
   mds_cap_timeout: 100,        // cap bits time out if client idle
   mds_session_autoclose: 300, // autoclose idle session 
 
+  mds_cap_batch: false,       // one MClientFileCapsBatch per client per dispatch
+
+  mds_table_delta_max: 1<<20, // anchortable/sessionmap: rewrite the base once the delta log is this big
+
   mds_tick_interval: 5,
 
+  mds_fastread: false,   // answer cached stat/readdir without an MDRequest
+
   mds_log: true,
   mds_log_max_events: -1, //MDS_CACHE_SIZE / 3,
   mds_log_max_segments: 100,
@@ -279,6 +305,14 @@ md_config_t g_conf = {
   mds_bal_midchunk: .3,       // any sub bigger than this taken in full
   mds_bal_minchunk: .001,     // never take anything smaller than this
 
+  mds_bal_predict: false,     // export on forecast load, net of migration cost
+  mds_bal_predict_alpha: .3,  // level smoothing
+  mds_bal_predict_beta: .02,  // trend smoothing
+  mds_bal_predict_horizon: 2, // forecast this many bal intervals ahead
+  mds_bal_predict_item_cost: .05, // load units per cached dentry exported
+  mds_bal_predict_depth: 3,   // track dirfrags this far below subtree roots
+  mds_bal_predict_trace: false, // write baltrace.mdsN for testbalancer
+
   mds_trim_on_rejoin: true,
   mds_shutdown_check: 0, //30,
 
@@ -317,6 +351,8 @@ md_config_t g_conf = {
   osd_max_rep: 4,
   osd_min_raid_width: 4,
   osd_max_raid_width: 3, //6, 
+  osd_raid_parity: 1,         // parity chunks per raid pg (1 = raid4)
+  osd_raid_chunk_size: 4096,  // bytes per chunk per stripe
 
   osd_maxthreads: 2,    // 0 == no threading
   osd_max_opq: 10,
@@ -324,19 +360,41 @@ md_config_t g_conf = {
   osd_age: .8,
   osd_age_time: 0,
   osd_heartbeat_interval: 1,
-  osd_heartbeat_grace: 30,
+  osd_heartbeat_grace: 30,       // upper bound, with or without phi
+  osd_heartbeat_phi: 8,          // phi accrual threshold; 0 for grace only
+  osd_heartbeat_phi_window: 100, // heartbeat intervals to remember
+  osd_heartbeat_phi_min_stddev: .25,
   osd_pg_stats_interval:  5,
+  osd_pg_stats_ratio: .01,      // report a pg's stats once they move by this fraction
+  osd_pg_stats_max_age: 60,     // ...or once the last report is this old
   osd_replay_window: 5,
   osd_max_pull: 2,
   osd_pad_pg_log: false,
+  osd_list_max: 1024,
+  osd_scrub_interval: 86400,
+  osd_scrub_tick: .1,
+  osd_scrub_chunk: 64,
+  osd_scrub_max_bps: 10 << 20,
+  osd_scrub_max_opq: 2,
+  osd_object_context_max: 1024,
+  osd_rep_ack_quorum: 0,
+  osd_rep_batch_max: 64,
+  osd_rep_batch_delay: .001,
 
   osd_auto_weight: false,
 
   osd_hack_fast_startup: false,  // this breaks localized pgs.
 
+  osd_map_cache_mappings: true,
+  osd_map_mapping_threads: 4,         // threads to build a pg mapping table
+  osd_map_mapping_parallel_min: 8192, // ..if pg_num is at least this
+
   
   // --- fakestore ---
-  fakestore_fake_sync: .2,    // seconds
+  fakestore_fake_sync: 0,     // seconds; if set, "commit" on a timer, not durably
+  fakestore_commit_ms: 200,   // syncfs interval
+  fakestore_fd_cache_size: 256,
+  fakestore_list_ahead: 65536,
   fakestore_fsync: false,//true,
   fakestore_writesync: false,
   fakestore_syncthreads: 4,
@@ -388,6 +446,7 @@ md_config_t g_conf = {
 
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
 
 
 void env_to_vec(std::vector<const char*>& args) 
@@ -563,6 +622,14 @@ void parse_config_options(std::vector<const char*>& args)
     else if (strcmp(args[i], "--doutdir") == 0) {
       g_conf.dout_dir = args[++i];
     }
+    else if (strcmp(args[i], "--dout_async") == 0) 
+      g_conf.dout_async = atoi(args[++i]);
+    else if (strcmp(args[i], "--dout_async_entries") == 0) 
+      g_conf.dout_async_entries = atoi(args[++i]);
+    else if (strcmp(args[i], "--dout_flush_ms") == 0) 
+      g_conf.dout_flush_ms = atoi(args[++i]);
+    else if (strcmp(args[i], "--dout_recent_entries") == 0) 
+      g_conf.dout_recent_entries = atoi(args[++i]);
 
     else if (strcmp(args[i], "--debug") == 0) 
       if (!g_conf.debug_after) 
@@ -659,6 +726,11 @@ void parse_config_options(std::vector<const char*>& args)
         g_conf.debug_paxos = atoi(args[++i]);
       else 
         g_debug_after_conf.debug_paxos = atoi(args[++i]);
+    else if (strcmp(args[i], "--debug_recent") == 0) 
+      if (!g_conf.debug_after) 
+        g_conf.debug_recent = atoi(args[++i]);
+      else 
+        g_debug_after_conf.debug_recent = atoi(args[++i]);
 
     else if (strcmp(args[i], "--debug_after") == 0) {
       g_conf.debug_after = atoi(args[++i]);
@@ -681,6 +753,12 @@ void parse_config_options(std::vector<const char*>& args)
 
     else if (strcmp(args[i], "--objecter_buffer_uncommitted") == 0) 
       g_conf.objecter_buffer_uncommitted = atoi(args[++i]);
+    else if (strcmp(args[i], "--objecter_osd_window") == 0) 
+      g_conf.objecter_osd_window = atoi(args[++i]);
+    else if (strcmp(args[i], "--objecter_osd_window_bytes") == 0) 
+      g_conf.objecter_osd_window_bytes = atoi(args[++i]);
+    else if (strcmp(args[i], "--objecter_max_op_bytes") == 0) 
+      g_conf.objecter_max_op_bytes = atoi(args[++i]);
 
     else if (strcmp(args[i], "--journaler_safe") == 0) 
       g_conf.journaler_safe = atoi(args[++i]);
@@ -694,6 +772,15 @@ void parse_config_options(std::vector<const char*>& args)
     else if (strcmp(args[i], "--mds_cache_size") == 0) 
       g_conf.mds_cache_size = atoi(args[++i]);
 
+    else if (strcmp(args[i], "--mds_table_delta_max") == 0) 
+      g_conf.mds_table_delta_max = atoi(args[++i]);
+    else if (strcmp(args[i], "--mds_cap_batch") == 0) 
+      g_conf.mds_cap_batch = atoi(args[++i]);
+    else if (strcmp(args[i], "--mds_cap_timeout") == 0) 
+      g_conf.mds_cap_timeout = atof(args[++i]);
+    else if (strcmp(args[i], "--mds_fastread") == 0) 
+      g_conf.mds_fastread = atoi(args[++i]);
+
     else if (strcmp(args[i], "--mds_beacon_interval") == 0) 
       g_conf.mds_beacon_interval = atoi(args[++i]);
     else if (strcmp(args[i], "--mds_beacon_grace") == 0) 
@@ -750,6 +837,20 @@ void parse_config_options(std::vector<const char*>& args)
       g_conf.mds_bal_midchunk = atoi(args[++i]);
     else if (strcmp(args[i], "--mds_bal_minchunk") == 0) 
       g_conf.mds_bal_minchunk = atoi(args[++i]);
+    else if (strcmp(args[i], "--mds_bal_predict") == 0) 
+      g_conf.mds_bal_predict = atoi(args[++i]);
+    else if (strcmp(args[i], "--mds_bal_predict_alpha") == 0) 
+      g_conf.mds_bal_predict_alpha = atof(args[++i]);
+    else if (strcmp(args[i], "--mds_bal_predict_beta") == 0) 
+      g_conf.mds_bal_predict_beta = atof(args[++i]);
+    else if (strcmp(args[i], "--mds_bal_predict_horizon") == 0) 
+      g_conf.mds_bal_predict_horizon = atof(args[++i]);
+    else if (strcmp(args[i], "--mds_bal_predict_item_cost") == 0) 
+      g_conf.mds_bal_predict_item_cost = atof(args[++i]);
+    else if (strcmp(args[i], "--mds_bal_predict_depth") == 0) 
+      g_conf.mds_bal_predict_depth = atoi(args[++i]);
+    else if (strcmp(args[i], "--mds_bal_predict_trace") == 0) 
+      g_conf.mds_bal_predict_trace = atoi(args[++i]);
     
     else if (strcmp(args[i], "--mds_local_osd") == 0) 
       g_conf.mds_local_osd = atoi(args[++i]);
@@ -771,6 +872,8 @@ void parse_config_options(std::vector<const char*>& args)
       g_conf.client_cache_stat_ttl = atoi(args[++i]);
     else if (strcmp(args[i], "--client_cache_readdir_ttl") == 0)
       g_conf.client_cache_readdir_ttl = atoi(args[++i]);
+    else if (strcmp(args[i], "--client_tick_interval") == 0)
+      g_conf.client_tick_interval = atof(args[++i]);
     else if (strcmp(args[i], "--client_trace") == 0)
       g_conf.client_trace = args[++i];
 
@@ -785,6 +888,26 @@ void parse_config_options(std::vector<const char*>& args)
       g_conf.mon_stop_on_last_unmount = atoi(args[++i]);
     else if (strcmp(args[i], "--mon_stop_with_last_mds") == 0)
       g_conf.mon_stop_with_last_mds = atoi(args[++i]);
+    else if (strcmp(args[i], "--mon_store_log") == 0)
+      g_conf.mon_store_log = atoi(args[++i]);
+    else if (strcmp(args[i], "--mon_store_log_compact_min") == 0)
+      g_conf.mon_store_log_compact_min = atoi(args[++i]);
+    else if (strcmp(args[i], "--mon_store_log_compact_ratio") == 0)
+      g_conf.mon_store_log_compact_ratio = atof(args[++i]);
+    else if (strcmp(args[i], "--mon_osdmap_merge") == 0)
+      g_conf.mon_osdmap_merge = atoi(args[++i]);
+    else if (strcmp(args[i], "--mon_osdmap_merge_min") == 0)
+      g_conf.mon_osdmap_merge_min = atoi(args[++i]);
+    else if (strcmp(args[i], "--mon_osdmap_merge_compress") == 0)
+      g_conf.mon_osdmap_merge_compress = atoi(args[++i]);
+    else if (strcmp(args[i], "--mon_osdmap_merge_cache") == 0)
+      g_conf.mon_osdmap_merge_cache = atoi(args[++i]);
+    else if (strcmp(args[i], "--paxos_propose_interval") == 0)
+      g_conf.paxos_propose_interval = atof(args[++i]);
+    else if (strcmp(args[i], "--paxos_pipeline_window") == 0)
+      g_conf.paxos_pipeline_window = atoi(args[++i]);
+    else if (strcmp(args[i], "--mon_pgmap_full_interval") == 0)
+      g_conf.mon_pgmap_full_interval = atoi(args[++i]);
 
     else if (strcmp(args[i], "--client_oc") == 0)
       g_conf.client_oc = atoi(args[++i]);
@@ -792,6 +915,8 @@ void parse_config_options(std::vector<const char*>& args)
       g_conf.client_oc_size = atoi(args[++i]);
     else if (strcmp(args[i], "--client_oc_max_dirty") == 0)
       g_conf.client_oc_max_dirty = atoi(args[++i]);
+    else if (strcmp(args[i], "--client_readahead_min") == 0)
+      g_conf.client_readahead_min = atoi(args[++i]);
 
     else if (strcmp(args[i], "--client_hack_balance_reads") == 0)
       g_conf.client_hack_balance_reads = atoi(args[++i]);
@@ -834,6 +959,14 @@ void parse_config_options(std::vector<const char*>& args)
       g_conf.fakestore_fsync = atoi(args[++i]);
     else if (strcmp(args[i], "--fakestore_writesync") == 0) 
       g_conf.fakestore_writesync = atoi(args[++i]);
+    else if (strcmp(args[i], "--fakestore_fake_sync") == 0) 
+      g_conf.fakestore_fake_sync = atof(args[++i]);
+    else if (strcmp(args[i], "--fakestore_commit_ms") == 0) 
+      g_conf.fakestore_commit_ms = atoi(args[++i]);
+    else if (strcmp(args[i], "--fakestore_fd_cache_size") == 0) 
+      g_conf.fakestore_fd_cache_size = atoi(args[++i]);
+    else if (strcmp(args[i], "--fakestore_list_ahead") == 0) 
+      g_conf.fakestore_list_ahead = atoi(args[++i]);
     else if (strcmp(args[i], "--fakestore_dev") == 0) 
       g_conf.fakestore_dev = args[++i];
     else if (strcmp(args[i], "--fakestore_fake_attrs") == 0) 
@@ -876,9 +1009,21 @@ void parse_config_options(std::vector<const char*>& args)
     else if (strcmp(args[i], "--osd_mkfs") == 0) 
       g_conf.osd_mkfs = atoi(args[++i]);
     else if (strcmp(args[i], "--osd_heartbeat_interval") == 0) 
-      g_conf.osd_heartbeat_interval = atoi(args[++i]);
+      g_conf.osd_heartbeat_interval = atof(args[++i]);
     else if (strcmp(args[i], "--osd_heartbeat_grace") == 0) 
-      g_conf.osd_heartbeat_grace = atoi(args[++i]);
+      g_conf.osd_heartbeat_grace = atof(args[++i]);
+    else if (strcmp(args[i], "--osd_heartbeat_phi") == 0) 
+      g_conf.osd_heartbeat_phi = atof(args[++i]);
+    else if (strcmp(args[i], "--osd_heartbeat_phi_window") == 0) 
+      g_conf.osd_heartbeat_phi_window = atoi(args[++i]);
+    else if (strcmp(args[i], "--osd_heartbeat_phi_min_stddev") == 0) 
+      g_conf.osd_heartbeat_phi_min_stddev = atof(args[++i]);
+    else if (strcmp(args[i], "--osd_pg_stats_interval") == 0) 
+      g_conf.osd_pg_stats_interval = atoi(args[++i]);
+    else if (strcmp(args[i], "--osd_pg_stats_ratio") == 0) 
+      g_conf.osd_pg_stats_ratio = atof(args[++i]);
+    else if (strcmp(args[i], "--osd_pg_stats_max_age") == 0) 
+      g_conf.osd_pg_stats_max_age = atoi(args[++i]);
     
     else if (strcmp(args[i], "--osd_age") == 0) 
       g_conf.osd_age = atof(args[++i]);
@@ -888,12 +1033,40 @@ void parse_config_options(std::vector<const char*>& args)
       g_conf.osd_pg_bits = atoi(args[++i]);
     else if (strcmp(args[i], "--osd_max_rep") == 0) 
       g_conf.osd_max_rep = atoi(args[++i]);
+    else if (strcmp(args[i], "--osd_min_raid_width") == 0) 
+      g_conf.osd_min_raid_width = atoi(args[++i]);
+    else if (strcmp(args[i], "--osd_max_raid_width") == 0) 
+      g_conf.osd_max_raid_width = atoi(args[++i]);
+    else if (strcmp(args[i], "--osd_raid_parity") == 0) 
+      g_conf.osd_raid_parity = atoi(args[++i]);
+    else if (strcmp(args[i], "--osd_raid_chunk_size") == 0) 
+      g_conf.osd_raid_chunk_size = atoi(args[++i]);
     else if (strcmp(args[i], "--osd_maxthreads") == 0) 
       g_conf.osd_maxthreads = atoi(args[++i]);
     else if (strcmp(args[i], "--osd_max_pull") == 0) 
       g_conf.osd_max_pull = atoi(args[++i]);
     else if (strcmp(args[i], "--osd_pad_pg_log") == 0) 
       g_conf.osd_pad_pg_log = atoi(args[++i]);
+    else if (strcmp(args[i], "--osd_list_max") == 0) 
+      g_conf.osd_list_max = atoi(args[++i]);
+    else if (strcmp(args[i], "--osd_scrub_interval") == 0) 
+      g_conf.osd_scrub_interval = atof(args[++i]);
+    else if (strcmp(args[i], "--osd_scrub_tick") == 0) 
+      g_conf.osd_scrub_tick = atof(args[++i]);
+    else if (strcmp(args[i], "--osd_scrub_chunk") == 0) 
+      g_conf.osd_scrub_chunk = atoi(args[++i]);
+    else if (strcmp(args[i], "--osd_scrub_max_bps") == 0) 
+      g_conf.osd_scrub_max_bps = atoi(args[++i]);
+    else if (strcmp(args[i], "--osd_scrub_max_opq") == 0) 
+      g_conf.osd_scrub_max_opq = atoi(args[++i]);
+    else if (strcmp(args[i], "--osd_object_context_max") == 0) 
+      g_conf.osd_object_context_max = atoi(args[++i]);
+    else if (strcmp(args[i], "--osd_rep_ack_quorum") == 0) 
+      g_conf.osd_rep_ack_quorum = atoi(args[++i]);
+    else if (strcmp(args[i], "--osd_rep_batch_max") == 0) 
+      g_conf.osd_rep_batch_max = atoi(args[++i]);
+    else if (strcmp(args[i], "--osd_rep_batch_delay") == 0) 
+      g_conf.osd_rep_batch_delay = atof(args[++i]);
 
     else if (strcmp(args[i], "--osd_auto_weight") == 0) 
       g_conf.osd_auto_weight = atoi(args[++i]);
@@ -901,6 +1074,13 @@ void parse_config_options(std::vector<const char*>& args)
     else if (strcmp(args[i], "--osd_hack_fast_startup") == 0) 
       g_conf.osd_hack_fast_startup = atoi(args[++i]);
 
+    else if (strcmp(args[i], "--osd_map_cache_mappings") == 0) 
+      g_conf.osd_map_cache_mappings = atoi(args[++i]);
+    else if (strcmp(args[i], "--osd_map_mapping_threads") == 0) 
+      g_conf.osd_map_mapping_threads = atoi(args[++i]);
+    else if (strcmp(args[i], "--osd_map_mapping_parallel_min") == 0) 
+      g_conf.osd_map_mapping_parallel_min = atoi(args[++i]);
+
     else if (strcmp(args[i], "--bdev_lock") == 0) 
       g_conf.bdev_lock = atoi(args[++i]);
     else if (strcmp(args[i], "--bdev_el_bidir") == 0) 
@@ -1035,6 +1215,9 @@ void parse_config_options(std::vector<const char*>& args)
       delete out;
     } else {
       _dout = out;
+      _dout_fd = ::open(fn, O_WRONLY|O_APPEND);
+      if (_dout_fd < 0)
+	_dout_fd = 1;
     }
   }
 
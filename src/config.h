@@ -58,6 +58,10 @@ struct md_config_t {
   bool logger_calc_variance;
 
   const char *dout_dir;
+  bool dout_async;
+  int dout_async_entries;
+  int dout_flush_ms;
+  int dout_recent_entries;
 
   bool fake_clock;
   bool fakemessenger_serialize;
@@ -93,6 +97,7 @@ struct md_config_t {
   int debug_ms;
   int debug_mon;
   int debug_paxos;
+  int debug_recent;
 
   int debug_after;
 
@@ -135,8 +140,18 @@ struct md_config_t {
   bool mon_stop_on_last_unmount;
   bool mon_stop_with_last_mds;
   bool mon_allow_mds_bully;
+  bool mon_store_log;
+  int mon_store_log_compact_min;
+  double mon_store_log_compact_ratio;
+  bool mon_osdmap_merge;
+  int mon_osdmap_merge_min;
+  bool mon_osdmap_merge_compress;
+  int mon_osdmap_merge_cache;
 
   double paxos_propose_interval;
+  int paxos_pipeline_window;
+
+  int mon_pgmap_full_interval;
 
   // client
   int      client_cache_size;
@@ -156,12 +171,16 @@ struct md_config_t {
   int      client_oc_size;
   int      client_oc_max_dirty;
   size_t   client_oc_max_sync_write;
+  int      client_readahead_min;
 
   // objecter
   bool  objecter_buffer_uncommitted;
   double objecter_map_request_interval;
   double objecter_tick_interval;
   double objecter_timeout;
+  int   objecter_osd_window;
+  int   objecter_osd_window_bytes;
+  int   objecter_max_op_bytes;
 
   // journaler
   bool  journaler_allow_split_entries;
@@ -184,8 +203,14 @@ struct md_config_t {
   float mds_cap_timeout;
   float mds_session_autoclose;
 
+  bool  mds_cap_batch;
+
+  int   mds_table_delta_max;
+
   float mds_tick_interval;
 
+  bool mds_fastread;
+
   bool mds_log;
   int mds_log_max_events;
   int mds_log_max_segments;
@@ -216,6 +241,14 @@ struct md_config_t {
   float mds_bal_midchunk;
   float mds_bal_minchunk;
 
+  bool  mds_bal_predict;
+  float mds_bal_predict_alpha;
+  float mds_bal_predict_beta;
+  float mds_bal_predict_horizon;
+  float mds_bal_predict_item_cost;
+  int   mds_bal_predict_depth;
+  bool  mds_bal_predict_trace;
+
   bool  mds_trim_on_rejoin;
   int   mds_shutdown_check;
 
@@ -253,23 +286,47 @@ struct md_config_t {
   int   osd_max_rep;
   int   osd_min_raid_width;
   int   osd_max_raid_width;
+  int   osd_raid_parity;
+  int   osd_raid_chunk_size;
   int   osd_maxthreads;
   int   osd_max_opq;
   bool  osd_mkfs;
   float   osd_age;
   int   osd_age_time;
-  int   osd_heartbeat_interval;  
-  int   osd_heartbeat_grace;
+  double osd_heartbeat_interval;  
+  double osd_heartbeat_grace;
+  double osd_heartbeat_phi;
+  int   osd_heartbeat_phi_window;
+  double osd_heartbeat_phi_min_stddev;
   int   osd_pg_stats_interval;
+  double osd_pg_stats_ratio;
+  int   osd_pg_stats_max_age;
   int   osd_replay_window;
   int   osd_max_pull;
   bool  osd_pad_pg_log;
+  int   osd_list_max;      // objects per collection_list_partial
+  double osd_scrub_interval;  // scrub each pg this often (sec); 0 = never
+  double osd_scrub_tick;
+  int   osd_scrub_chunk;     // objects per scrub chunk
+  int   osd_scrub_max_bps;   // scrub read bandwidth, bytes/sec
+  int   osd_scrub_max_opq;   // pause scrub while more ops than this are queued
+  int   osd_object_context_max;  // cached object contexts per pg
+  int   osd_rep_ack_quorum;  // copies (incl. primary) that ack before the client does; 0 = all
+  int   osd_rep_batch_max;   // replica acks/commits per reply message
+  double osd_rep_batch_delay;  // hold replica commits this long to batch them (sec)
 
   bool osd_auto_weight;
 
   bool osd_hack_fast_startup;
 
+  bool osd_map_cache_mappings;
+  int  osd_map_mapping_threads;
+  int  osd_map_mapping_parallel_min;
+
   double   fakestore_fake_sync;
+  int   fakestore_commit_ms;
+  int   fakestore_fd_cache_size;
+  int   fakestore_list_ahead;    // objects kept per collection_list_partial scan
   bool  fakestore_fsync;
   bool  fakestore_writesync;
   int   fakestore_syncthreads;   // such crap
@@ -341,22 +398,51 @@ int rename_output_file();
 /**
  * for cleaner output, bracket each line with
  * dbeginl (in the dout macro) and dendl (in place of endl).
+ *
+ * with dout_async (the default), dbeginl hands back a per-thread
+ * stream to format into and dendl queues the line for the writer
+ * thread (see common/DoutLog.cc), so no lock is held while formatting.
+ * otherwise lines are written in place under _dout_lock.
+ *
+ * the dout_if/derr_if macros also let through lines at or under
+ * debug_recent, which are formatted but only kept in memory, to be
+ * dumped if we crash.
  */
 extern Mutex _dout_lock;
-struct _dbeginl_t { _dbeginl_t(int) {} };
+struct _dbeginl_t {
+  int mode;       // 1 = write it, 2 = keep it in the recent ring only
+  _dbeginl_t(int m) : mode(m) {}
+};
 struct _dendl_t { _dendl_t(int) {} };
-static const _dbeginl_t dbeginl = 0;
+static const _dbeginl_t dbeginl = 1;
 static const _dendl_t dendl = 0;
 
+ostream& _dout_begin(ostream& out, int mode);
+ostream& _dout_end(ostream& out);
+void dout_flush();
+void dout_dump_recent();
+
+inline int _dout_mode(int l, bool print) {
+  if (print)
+    return 1;
+  if (g_conf.dout_async && l <= g_conf.debug_recent)
+    return 2;
+  return 0;
+}
+
 // intentionally conflict with endl
 class _bad_endl_use_dendl_t { public: _bad_endl_use_dendl_t(int) {} };
 static const _bad_endl_use_dendl_t endl = 0;
 
-inline ostream& operator<<(ostream& out, _dbeginl_t) {
+inline ostream& operator<<(ostream& out, _dbeginl_t b) {
+  if (g_conf.dout_async)
+    return _dout_begin(out, b.mode);
   _dout_lock.Lock();
   return out;
 }
 inline ostream& operator<<(ostream& out, _dendl_t) {
+  if (g_conf.dout_async)
+    return _dout_end(out);
   out << std::endl;
   _dout_lock.Unlock();
   return out;
@@ -369,12 +455,16 @@ inline ostream& operator<<(ostream& out, _bad_endl_use_dendl_t) {
 // the streams
 extern ostream *_dout;
 extern ostream *_derr;
+extern int _dout_fd;      // _dout's fd, for the fatal signal dump
 
 // generic macros
-#define generic_dout(x) if ((x) <= g_conf.debug) *_dout << dbeginl
-#define generic_derr(x) if ((x) <= g_conf.debug) *_derr << dbeginl
+#define dout_if(x, cond) if (int _dout_m = _dout_mode((x), (cond))) *_dout << _dbeginl_t(_dout_m)
+#define derr_if(x, cond) if (int _dout_m = _dout_mode((x), (cond))) *_derr << _dbeginl_t(_dout_m)
+
+#define generic_dout(x) dout_if(x, (x) <= g_conf.debug)
+#define generic_derr(x) derr_if(x, (x) <= g_conf.debug)
 
-#define pdout(x,p) if ((x) <= (p)) *_dout << dbeginl
+#define pdout(x,p) dout_if(x, (x) <= (p))
 
 
 #endif
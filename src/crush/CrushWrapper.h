@@ -36,11 +36,15 @@ public:
     assert(i < map->max_devices);
     map->device_offload[i] = o;
   }
+  int get_max_devices() {
+    return map ? map->max_devices : 0;
+  }
   unsigned get_offload(int i) {
     assert(i < map->max_devices);
     return map->device_offload[i];
   }
 
+  // an indep position that couldn't be filled comes back as -1
   void do_rule(int rule, int x, vector<int>& out, int maxout, int forcefeed) {
     int rawout[maxout];
     
@@ -48,7 +52,18 @@ public:
 
     out.resize(numrep);
     for (int i=0; i<numrep; i++)
-      out[i] = rawout[i];
+      out[i] = rawout[i] == CRUSH_ITEM_NONE ? -1:rawout[i];
+  }
+
+  // out[i*maxout ...] for x[i], with outlen[i] of them.  holes are -1.
+  void do_rule_batch(int rule, const vector<int>& x, vector<int>& out, vector<int>& outlen, int maxout) {
+    out.resize(x.size() * maxout);
+    outlen.resize(x.size());
+    if (x.empty()) return;
+    crush_do_rule_batch(map, rule, &x[0], x.size(), &out[0], maxout, &outlen[0]);
+    for (unsigned i=0; i<out.size(); i++)
+      if (out[i] == CRUSH_ITEM_NONE)
+	out[i] = -1;
   }
 
   void _encode(bufferlist &bl) {
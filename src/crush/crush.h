@@ -26,6 +26,9 @@ enum {
 #define CRUSH_MAX_DEPTH 10
 #define CRUSH_MAX_SET   10
 
+/* an indep position nothing could be found for */
+#define CRUSH_ITEM_NONE   0x7fffffff
+
 struct crush_rule_step {
 	__u32 op;
 	__s32 arg1;
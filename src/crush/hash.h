@@ -77,4 +77,119 @@ static __inline__ unsigned crush_hash32_5(unsigned a, unsigned b, unsigned c, un
 	return (hash & 0xFFFFFFFF);
 }
 
+
+/*
+ * the same hashes, on several inputs at once.  lane i of the output is
+ * exactly crush_hash32_N() of lane i of the inputs.  SSE2 does 4 lanes;
+ * with AVX2 the 3-input hash (the straw draw) also has an 8 lane form.
+ * scalar loops otherwise, and always in the kernel.
+ */
+#if !defined(__KERNEL__) && defined(__SSE2__) && !defined(CRUSH_NO_SIMD)
+# define CRUSH_HASH_SSE2
+# include <emmintrin.h>
+#endif
+#if !defined(__KERNEL__) && defined(__AVX2__) && !defined(CRUSH_NO_SIMD)
+# define CRUSH_HASH_AVX2
+# include <immintrin.h>
+#endif
+
+#ifdef CRUSH_HASH_SSE2
+#define hashmix_x4(a,b,c) \
+	a=_mm_sub_epi32(a,b);  a=_mm_sub_epi32(a,c);  a=_mm_xor_si128(a,_mm_srli_epi32(c,13)); \
+	b=_mm_sub_epi32(b,c);  b=_mm_sub_epi32(b,a);  b=_mm_xor_si128(b,_mm_slli_epi32(a,8));  \
+	c=_mm_sub_epi32(c,a);  c=_mm_sub_epi32(c,b);  c=_mm_xor_si128(c,_mm_srli_epi32(b,13)); \
+	a=_mm_sub_epi32(a,b);  a=_mm_sub_epi32(a,c);  a=_mm_xor_si128(a,_mm_srli_epi32(c,12)); \
+	b=_mm_sub_epi32(b,c);  b=_mm_sub_epi32(b,a);  b=_mm_xor_si128(b,_mm_slli_epi32(a,16)); \
+	c=_mm_sub_epi32(c,a);  c=_mm_sub_epi32(c,b);  c=_mm_xor_si128(c,_mm_srli_epi32(b,5));  \
+	a=_mm_sub_epi32(a,b);  a=_mm_sub_epi32(a,c);  a=_mm_xor_si128(a,_mm_srli_epi32(c,3));  \
+	b=_mm_sub_epi32(b,c);  b=_mm_sub_epi32(b,a);  b=_mm_xor_si128(b,_mm_slli_epi32(a,10)); \
+	c=_mm_sub_epi32(c,a);  c=_mm_sub_epi32(c,b);  c=_mm_xor_si128(c,_mm_srli_epi32(b,15));
+#endif
+
+#ifdef CRUSH_HASH_AVX2
+#define hashmix_x8(a,b,c) \
+	a=_mm256_sub_epi32(a,b);  a=_mm256_sub_epi32(a,c);  a=_mm256_xor_si256(a,_mm256_srli_epi32(c,13)); \
+	b=_mm256_sub_epi32(b,c);  b=_mm256_sub_epi32(b,a);  b=_mm256_xor_si256(b,_mm256_slli_epi32(a,8));  \
+	c=_mm256_sub_epi32(c,a);  c=_mm256_sub_epi32(c,b);  c=_mm256_xor_si256(c,_mm256_srli_epi32(b,13)); \
+	a=_mm256_sub_epi32(a,b);  a=_mm256_sub_epi32(a,c);  a=_mm256_xor_si256(a,_mm256_srli_epi32(c,12)); \
+	b=_mm256_sub_epi32(b,c);  b=_mm256_sub_epi32(b,a);  b=_mm256_xor_si256(b,_mm256_slli_epi32(a,16)); \
+	c=_mm256_sub_epi32(c,a);  c=_mm256_sub_epi32(c,b);  c=_mm256_xor_si256(c,_mm256_srli_epi32(b,5));  \
+	a=_mm256_sub_epi32(a,b);  a=_mm256_sub_epi32(a,c);  a=_mm256_xor_si256(a,_mm256_srli_epi32(c,3));  \
+	b=_mm256_sub_epi32(b,c);  b=_mm256_sub_epi32(b,a);  b=_mm256_xor_si256(b,_mm256_slli_epi32(a,10)); \
+	c=_mm256_sub_epi32(c,a);  c=_mm256_sub_epi32(c,b);  c=_mm256_xor_si256(c,_mm256_srli_epi32(b,15));
+#endif
+
+/* a, b, c: 4 lanes each */
+static __inline__ void crush_hash32_3_x4(const unsigned *a, const unsigned *b, const unsigned *c,
+					 unsigned *out) {
+#ifdef CRUSH_HASH_SSE2
+	__m128i va = _mm_loadu_si128((const __m128i*)a);
+	__m128i vb = _mm_loadu_si128((const __m128i*)b);
+	__m128i vc = _mm_loadu_si128((const __m128i*)c);
+	__m128i hash = _mm_xor_si128(_mm_set1_epi32(crush_hash_seed),
+				     _mm_xor_si128(va, _mm_xor_si128(vb, vc)));
+	__m128i x = _mm_set1_epi32(231232);
+	__m128i y = _mm_set1_epi32(1232);
+	hashmix_x4(va, vb, hash);
+	hashmix_x4(vc, x, hash);
+	hashmix_x4(y, va, hash);
+	hashmix_x4(vb, x, hash);
+	hashmix_x4(y, vc, hash);
+	_mm_storeu_si128((__m128i*)out, hash);
+#else
+	int i;
+	for (i=0; i<4; i++)
+		out[i] = crush_hash32_3(a[i], b[i], c[i]);
+#endif
+}
+
+/* a, b, c: 8 lanes each */
+static __inline__ void crush_hash32_3_x8(const unsigned *a, const unsigned *b, const unsigned *c,
+					 unsigned *out) {
+#ifdef CRUSH_HASH_AVX2
+	__m256i va = _mm256_loadu_si256((const __m256i*)a);
+	__m256i vb = _mm256_loadu_si256((const __m256i*)b);
+	__m256i vc = _mm256_loadu_si256((const __m256i*)c);
+	__m256i hash = _mm256_xor_si256(_mm256_set1_epi32(crush_hash_seed),
+					_mm256_xor_si256(va, _mm256_xor_si256(vb, vc)));
+	__m256i x = _mm256_set1_epi32(231232);
+	__m256i y = _mm256_set1_epi32(1232);
+	hashmix_x8(va, vb, hash);
+	hashmix_x8(vc, x, hash);
+	hashmix_x8(y, va, hash);
+	hashmix_x8(vb, x, hash);
+	hashmix_x8(y, vc, hash);
+	_mm256_storeu_si256((__m256i*)out, hash);
+#else
+	crush_hash32_3_x4(a, b, c, out);
+	crush_hash32_3_x4(a+4, b+4, c+4, out+4);
+#endif
+}
+
+/* a, b, c, d: 4 lanes each */
+static __inline__ void crush_hash32_4_x4(const unsigned *a, const unsigned *b, const unsigned *c,
+					 const unsigned *d, unsigned *out) {
+#ifdef CRUSH_HASH_SSE2
+	__m128i va = _mm_loadu_si128((const __m128i*)a);
+	__m128i vb = _mm_loadu_si128((const __m128i*)b);
+	__m128i vc = _mm_loadu_si128((const __m128i*)c);
+	__m128i vd = _mm_loadu_si128((const __m128i*)d);
+	__m128i hash = _mm_xor_si128(_mm_xor_si128(_mm_set1_epi32(crush_hash_seed), va),
+				     _mm_xor_si128(_mm_xor_si128(vb, vc), vd));
+	__m128i x = _mm_set1_epi32(231232);
+	__m128i y = _mm_set1_epi32(1232);
+	hashmix_x4(va, vb, hash);
+	hashmix_x4(vc, vd, hash);
+	hashmix_x4(va, x, hash);
+	hashmix_x4(y, vb, hash);
+	hashmix_x4(vc, x, hash);
+	hashmix_x4(y, vd, hash);
+	_mm_storeu_si128((__m128i*)out, hash);
+#else
+	int i;
+	for (i=0; i<4; i++)
+		out[i] = crush_hash32_4(a[i], b[i], c[i], d[i]);
+#endif
+}
+
 #endif
@@ -15,12 +15,42 @@
 
 /* uniform */
 
+/*
+ * the offset and prime depend only on x and the bucket, not on r, so
+ * while mapping one x we remember them for the last few uniform buckets
+ * we passed through instead of rehashing on every rep and retry.
+ */
+#define CRUSH_UNIFORM_CACHE 4
+
+struct crush_uniform_cache {
+	struct crush_bucket_uniform *bucket[CRUSH_UNIFORM_CACHE];
+	unsigned o[CRUSH_UNIFORM_CACHE];
+	unsigned p[CRUSH_UNIFORM_CACHE];
+	int next;
+};
+
 static int 
-crush_bucket_uniform_choose(struct crush_bucket_uniform *bucket, int x, int r)
+crush_bucket_uniform_choose(struct crush_bucket_uniform *bucket, int x, int r,
+			    struct crush_uniform_cache *cache)
 {
 	unsigned o, p, s;
-	o = crush_hash32_2(x, bucket->h.id) & 0xffff;
-	p = bucket->primes[crush_hash32_2(bucket->h.id, x) % bucket->h.size];
+	int i;
+
+	for (i=0; i<CRUSH_UNIFORM_CACHE; i++)
+		if (cache->bucket[i] == bucket)
+			break;
+	if (i < CRUSH_UNIFORM_CACHE) {
+		o = cache->o[i];
+		p = cache->p[i];
+	} else {
+		o = crush_hash32_2(x, bucket->h.id) & 0xffff;
+		p = bucket->primes[crush_hash32_2(bucket->h.id, x) % bucket->h.size];
+		i = cache->next;
+		cache->next = (i + 1) % CRUSH_UNIFORM_CACHE;
+		cache->bucket[i] = bucket;
+		cache->o[i] = o;
+		cache->p[i] = p;
+	}
 	s = (x + o + (r+1)*p) % bucket->h.size;
 	/*printf("%d %d %d %d\n", x, o, r, p);*/
 	return bucket->h.items[s];
@@ -32,10 +62,27 @@ crush_bucket_uniform_choose(struct crush_bucket_uniform *bucket, int x, int r)
 static int 
 crush_bucket_list_choose(struct crush_bucket_list *bucket, int x, int r)
 {
-	int i;
+	int i, j;
 	__u64 w;
-	
-	for (i=0; i<bucket->h.size; i++) {
+	unsigned xs[4], rs[4], ids[4], h[4];
+
+	/* hash 4 items at a time; usually we stop in the first group */
+	for (j=0; j<4; j++) {
+		xs[j] = x;
+		rs[j] = r;
+		ids[j] = bucket->h.id;
+	}
+	for (i=0; i+4 <= bucket->h.size; i += 4) {
+		crush_hash32_4_x4(xs, (unsigned*)bucket->h.items + i, rs, ids, h);
+		for (j=0; j<4; j++) {
+			w = h[j] & 0xffff;
+			w *= bucket->sum_weights[i+j];
+			w = w >> 16;
+			if (w < bucket->item_weights[i+j])
+				return bucket->h.items[i+j];
+		}
+	}
+	for (; i<bucket->h.size; i++) {
 		w = crush_hash32_4(x, bucket->h.items[i], r, bucket->h.id);
 		w &= 0xffff;
 		/*printf("%d item %d weight %d sum_weight %d r %lld", 
@@ -107,12 +154,39 @@ crush_bucket_tree_choose(struct crush_bucket_tree *bucket, int x, int r)
 static int 
 crush_bucket_straw_choose(struct crush_bucket_straw *bucket, int x, int r)
 {
-	int i;
+	int i, j;
 	int high = 0;
 	__u64 high_draw = 0;
 	__u64 draw;
-	
-	for (i=0; i<bucket->h.size; i++) {
+	unsigned xs[8], rs[8], h[8];
+
+	/* hash 8 (or 4) items at a time, then pick the winner in order */
+	for (j=0; j<8; j++) {
+		xs[j] = x;
+		rs[j] = r;
+	}
+	for (i=0; i+8 <= bucket->h.size; i += 8) {
+		crush_hash32_3_x8(xs, (unsigned*)bucket->h.items + i, rs, h);
+		for (j=0; j<8; j++) {
+			draw = (h[j] & 0xffff) * (__u64)bucket->straws[i+j];
+			if (i+j == 0 || draw > high_draw) {
+				high = i+j;
+				high_draw = draw;
+			}
+		}
+	}
+	if (i+4 <= bucket->h.size) {
+		crush_hash32_3_x4(xs, (unsigned*)bucket->h.items + i, rs, h);
+		for (j=0; j<4; j++) {
+			draw = (h[j] & 0xffff) * (__u64)bucket->straws[i+j];
+			if (i+j == 0 || draw > high_draw) {
+				high = i+j;
+				high_draw = draw;
+			}
+		}
+		i += 4;
+	}
+	for (; i<bucket->h.size; i++) {
 		draw = crush_hash32_3(x, bucket->h.items[i], r);
 		draw &= 0xffff;
 		draw *= bucket->straws[i];
@@ -148,7 +222,8 @@ static int is_out(struct crush_map *map, int item, int x)
 static int crush_choose(struct crush_map *map,
 			struct crush_bucket *bucket,
 			int x, int numrep, int type,
-			int *out, int outpos, int firstn)
+			int *out, int outpos, int firstn,
+			struct crush_uniform_cache *cache)
 {
 	int rep;
 	int ftotal, flocal;
@@ -191,7 +266,7 @@ static int crush_choose(struct crush_map *map,
 				/* bucket choose */
 				switch (in->bucket_type) {
 				case CRUSH_BUCKET_UNIFORM:
-					item = crush_bucket_uniform_choose((struct crush_bucket_uniform*)in, x, r);
+					item = crush_bucket_uniform_choose((struct crush_bucket_uniform*)in, x, r, cache);
 					break;
 				case CRUSH_BUCKET_LIST:
 					item = crush_bucket_list_choose((struct crush_bucket_list*)in, x, r);
@@ -259,6 +334,88 @@ static int crush_choose(struct crush_map *map,
 }
 
 
+/*
+ * choose numrep distinct items of given type, where the position of
+ * each item matters (raid): an out or colliding choice is retried for
+ * that position alone, and never takes an item another position chose
+ * first, so the others don't move.  a position we can't fill is
+ * CRUSH_ITEM_NONE, not closed up.
+ */
+static int crush_choose_indep(struct crush_map *map,
+			      struct crush_bucket *bucket,
+			      int x, int numrep, int type,
+			      int *out, int outpos,
+			      struct crush_uniform_cache *cache)
+{
+	struct crush_bucket *in;
+	int left = numrep - outpos;
+	int rep, ftotal;
+	int r;
+	int i;
+	int item;
+	int itemtype;
+
+	for (rep = outpos; rep < numrep; rep++)
+		out[rep] = CRUSH_ITEM_NONE;
+
+	for (ftotal = 0; left > 0 && ftotal < 10; ftotal++) {
+		for (rep = outpos; rep < numrep; rep++) {
+			if (out[rep] != CRUSH_ITEM_NONE)
+				continue;
+
+			in = bucket;
+			while (1) {
+				if (in->bucket_type == CRUSH_BUCKET_UNIFORM)
+					r = rep + ftotal;  /* walk the permutation */
+				else
+					r = rep + numrep * ftotal;
+
+				switch (in->bucket_type) {
+				case CRUSH_BUCKET_UNIFORM:
+					item = crush_bucket_uniform_choose((struct crush_bucket_uniform*)in, x, r, cache);
+					break;
+				case CRUSH_BUCKET_LIST:
+					item = crush_bucket_list_choose((struct crush_bucket_list*)in, x, r);
+					break;
+				case CRUSH_BUCKET_TREE:
+					item = crush_bucket_tree_choose((struct crush_bucket_tree*)in, x, r);
+					break;
+				case CRUSH_BUCKET_STRAW:
+					item = crush_bucket_straw_choose((struct crush_bucket_straw*)in, x, r);
+					break;
+				default:
+					BUG_ON(1);
+					item = in->items[0];
+				}
+
+				if (item < 0)
+					itemtype = map->buckets[-1-item]->type;
+				else
+					itemtype = 0;
+				if (itemtype == type)
+					break;
+				BUG_ON(item >= 0 || (-1-item) >= map->max_buckets);
+				in = map->buckets[-1-item];
+			}
+
+			/* taken by any position, before or after? */
+			for (i = 0; i < numrep; i++)
+				if (out[i] == item)
+					break;
+			if (i < numrep)
+				continue;
+			if (itemtype == 0 && is_out(map, item, x))
+				continue;
+
+			out[rep] = item;
+			left--;
+		}
+	}
+
+	return numrep;
+}
+
+
 int crush_do_rule(struct crush_map *map,
 		  int ruleno,
 		  int x, int *result, int result_max,
@@ -278,7 +435,9 @@ int crush_do_rule(struct crush_map *map,
 	int step;
 	int i,j;
 	int numrep;
+	struct crush_uniform_cache cache;
 	
+	memset(&cache, 0, sizeof(cache));
 	rule = map->rules[ruleno];
 	result_len = 0;
 	w = a;
@@ -325,16 +484,31 @@ int crush_do_rule(struct crush_map *map,
 			
 			for (i = 0; i < wsize; i++) {
 				numrep = rule->steps[step].arg1;
+				if (w[i] == CRUSH_ITEM_NONE) {
+					/* a hole stays a hole, numrep wide */
+					if (rule->steps[step].op == CRUSH_RULE_CHOOSE_INDEP)
+						for (j = 0; j < numrep; j++)
+							o[osize++] = CRUSH_ITEM_NONE;
+					continue;
+				}
 				j = 0;
 				if (osize == 0 && force_pos >= 0) {
 					o[osize] = force_stack[force_pos];
 					j++;
 					force_pos--;
 				}
-				osize += crush_choose(map,
-						      map->buckets[-1-w[i]],
-						      x, numrep, rule->steps[step].arg2,
-						      o+osize, j, rule->steps[step].op == CRUSH_RULE_CHOOSE_FIRSTN);
+				if (rule->steps[step].op == CRUSH_RULE_CHOOSE_FIRSTN)
+					osize += crush_choose(map,
+							      map->buckets[-1-w[i]],
+							      x, numrep, rule->steps[step].arg2,
+							      o+osize, j, 1,
+							      &cache);
+				else
+					osize += crush_choose_indep(map,
+								    map->buckets[-1-w[i]],
+								    x, numrep, rule->steps[step].arg2,
+								    o+osize, j,
+								    &cache);
 			}
 			
 			/* swap t and w arrays */
@@ -362,4 +536,22 @@ int crush_do_rule(struct crush_map *map,
 	return result_len;
 }
 
+/*
+ * map nx inputs through the same rule.  results for x[i] go in
+ * result[i*result_max ...], with the count in result_len[i]; they are
+ * identical to crush_do_rule(map, ruleno, x[i], ..., -1).
+ */
+void crush_do_rule_batch(struct crush_map *map,
+			 int ruleno,
+			 const int *x, int nx,
+			 int *result, int result_max,
+			 int *result_len)
+{
+	int i;
+
+	for (i=0; i<nx; i++)
+		result_len[i] = crush_do_rule(map, ruleno, x[i],
+					      result + i*result_max, result_max,
+					      -1);
+}
 
@@ -11,6 +11,11 @@ extern int crush_do_rule(struct crush_map *map,
 			 int ruleno,
 			 int x, int *result, int result_max,
 			 int forcefeed); /* -1 for none */
+extern void crush_do_rule_batch(struct crush_map *map,
+				int ruleno,
+				const int *x, int nx,
+				int *result, int result_max,
+				int *result_len);
 
 #ifdef __cplusplus
 }
@@ -3,63 +3,209 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <sys/time.h>
 
 #include "crush.h"
+#include "hash.h"
 #include "mapper.h"
 #include "builder.h"
 
+/*
+ * conformance and throughput for the mapper.
+ *
+ *   test [n]
+ *
+ *  - the lane hashes against the scalar ones, on 4n random inputs
+ *  - crush_do_rule_batch against crush_do_rule, n inputs per map
+ *  - a checksum of every mapping, per map.  build with -DCRUSH_NO_SIMD
+ *    (make test_scalar) and compare: the output must be identical.
+ *  - mappings/sec, one at a time and batched
+ *
+ * maps: 10 domains of 10 devices under a uniform, list, tree and straw
+ * root, and a flat straw bucket of 100 devices.  a few devices are
+ * partly offloaded so that retries get exercised.
+ */
 
-int main()
+#define NDOM 10
+#define NPER 10
+#define NDEV (NDOM*NPER)
+#define NREP 3
+#define BATCH 256
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static struct crush_map *make_map(int roottype, int *ruleno)
+{
+	int sub[NDOM];
+	int subw[NDOM];
+	int o[NDEV];
+	int uw[NDOM] = { 1000, 1000, 500, 1000, 2000, 1000, 1000, 3000, 1000, 500 };
+	int i, j, d, root;
+	struct crush_bucket *b;
+	struct crush_rule *rule;
+	struct crush_map *map = crush_create();
+
+	if (roottype == 0) {
+		/* flat straw */
+		int w[NDEV];
+		for (i=0; i<NDEV; i++) {
+			o[i] = i;
+			w[i] = 0x10000 + (i % 7) * 0x1000;
+		}
+		root = crush_add_bucket(map, (struct crush_bucket*)crush_make_straw_bucket(1, NDEV, o, w));
+		rule = crush_make_rule(3);
+		crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, root, 0);
+		crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_FIRSTN, NREP, 0);
+		crush_rule_set_step(rule, 2, CRUSH_RULE_EMIT, 0, 0);
+		*ruleno = crush_add_rule(map, -1, rule);
+	} else {
+		d = 0;
+		for (i=0; i<NDOM; i++) {
+			for (j=0; j<NPER; j++)
+				o[j] = d++;
+			b = (struct crush_bucket*)crush_make_uniform_bucket(1, NPER, o, uw[i]);
+			sub[i] = crush_add_bucket(map, b);
+			subw[i] = b->weight;
+		}
+
+		switch (roottype) {
+		case CRUSH_BUCKET_UNIFORM:
+			b = (struct crush_bucket*)crush_make_uniform_bucket(2, NDOM, sub, 0x10000);
+			break;
+		case CRUSH_BUCKET_LIST:
+			b = (struct crush_bucket*)crush_make_list_bucket(2, NDOM, sub, subw);
+			break;
+		case CRUSH_BUCKET_TREE:
+			b = (struct crush_bucket*)crush_make_tree_bucket(2, NDOM, sub, subw);
+			break;
+		default:
+			b = (struct crush_bucket*)crush_make_straw_bucket(2, NDOM, sub, subw);
+		}
+		root = crush_add_bucket(map, b);
+
+		rule = crush_make_rule(4);
+		crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, root, 0);
+		crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_FIRSTN, NREP, 1);
+		crush_rule_set_step(rule, 2, CRUSH_RULE_CHOOSE_FIRSTN, 1, 0);
+		crush_rule_set_step(rule, 3, CRUSH_RULE_EMIT, 0, 0);
+		*ruleno = crush_add_rule(map, -1, rule);
+	}
+
+	crush_finalize(map);
+
+	/* some failed, some partly offloaded */
+	map->device_offload[3] = 0x10000;
+	map->device_offload[42] = 0x8000;
+	map->device_offload[77] = 0x4000;
+	return map;
+}
+
+static int check_hashes(int n)
 {
-  int sub[10];
-  int subw[10];
-  int i, j;
-  int d;
-  int o[100];
-  int root;
-  int ruleno;
-  int r[10];
-  
-  int uw[10] = { 1000, 1000, 500, 1000, 2000, 1000, 1000, 3000, 1000, 500 };
-
-  struct crush_bucket *b;
-  struct crush_rule *rule;
-  
-  struct crush_map *map = crush_create();
-
-  d = 0;
-  for (i=0; i<10; i++) {
-    for (j=0; j<10; j++)
-      o[j] = d++;
-    b = (struct crush_bucket*)crush_make_uniform_bucket(1, 10, o, uw[i]);
-    sub[i] = crush_add_bucket(map, b);
-    subw[i] = b->weight;
-    printf("make bucket %d weight %d\n", sub[i], subw[i]);
-  }
-
-  root = crush_add_bucket(map, (struct crush_bucket*)crush_make_tree_bucket(2, 10, sub, subw));
-
-  rule = crush_make_rule(4);
-  crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, root, 0);
-  crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_FIRSTN, 3, 1);
-  crush_rule_set_step(rule, 2, CRUSH_RULE_CHOOSE_FIRSTN, 1, 0);
-  crush_rule_set_step(rule, 3, CRUSH_RULE_EMIT, 0, 0);
-  ruleno = crush_add_rule(map, -1, rule);
-
-  crush_finalize(map);
-  printf("built\n");
-
-  /* test */
-  memset(o, 0, 100*sizeof(o[0]));
-  for (i=0; i<1000000; i++) {
-    crush_do_rule(map, ruleno, i, r, 3, -1);
-    /*printf("%d %d %d\n", r[0], r[1], r[2]);*/
-    for (j=0; j<3; j++)
-      o[r[j]]++;
-  }
-
-  for (i=0; i<100; i += 10)
-    printf("%2d : %d\n", i, o[i]); 
-
-  return 0;
+	unsigned a[8], b[8], c[8], d[8], h[8];
+	int i, j, bad = 0;
+
+	srand(1);
+	for (i=0; i<n; i += 8) {
+		for (j=0; j<8; j++) {
+			a[j] = rand() ^ (rand() << 16);
+			b[j] = rand() ^ (rand() << 16);
+			c[j] = rand() ^ (rand() << 16);
+			d[j] = rand() ^ (rand() << 16);
+		}
+		crush_hash32_3_x8(a, b, c, h);
+		for (j=0; j<8; j++)
+			if (h[j] != crush_hash32_3(a[j], b[j], c[j]))
+				bad++;
+		crush_hash32_3_x4(a, b, c, h);
+		for (j=0; j<4; j++)
+			if (h[j] != crush_hash32_3(a[j], b[j], c[j]))
+				bad++;
+		crush_hash32_4_x4(a, b, c, d, h);
+		for (j=0; j<4; j++)
+			if (h[j] != crush_hash32_4(a[j], b[j], c[j], d[j]))
+				bad++;
+	}
+	printf("hash lanes: %d inputs, %d mismatches\n", n, bad);
+	return bad;
+}
+
+static int run(const char *name, int roottype, int n)
+{
+	int ruleno;
+	struct crush_map *map = make_map(roottype, &ruleno);
+	int r[NREP], len;
+	int xs[BATCH], br[BATCH*NREP], blen[BATCH];
+	int i, j, k, bad = 0;
+	unsigned sum = 2166136261u;
+	double start, one, batch;
+
+	/* conformance: batch vs one at a time, and checksum */
+	for (i=0; i<n; i += BATCH) {
+		for (k=0; k<BATCH; k++)
+			xs[k] = i + k;
+		crush_do_rule_batch(map, ruleno, xs, BATCH, br, NREP, blen);
+		for (k=0; k<BATCH; k++) {
+			len = crush_do_rule(map, ruleno, xs[k], r, NREP, -1);
+			if (len != blen[k])
+				bad++;
+			for (j=0; j<len; j++) {
+				if (r[j] != br[k*NREP + j])
+					bad++;
+				sum = (sum ^ r[j]) * 16777619u;
+			}
+			sum = (sum ^ len) * 16777619u;
+		}
+	}
+
+	/* throughput */
+	start = now();
+	for (i=0; i<n; i++)
+		crush_do_rule(map, ruleno, i, r, NREP, -1);
+	one = now() - start;
+
+	start = now();
+	for (i=0; i<n; i += BATCH) {
+		for (k=0; k<BATCH; k++)
+			xs[k] = i + k;
+		crush_do_rule_batch(map, ruleno, xs, BATCH, br, NREP, blen);
+	}
+	batch = now() - start;
+
+	printf("%-8s checksum %08x  mismatches %d  %.0f maps/s  batched %.0f maps/s\n",
+	       name, sum, bad, n / one, n / batch);
+	crush_destroy(map);
+	return bad;
+}
+
+int main(int argc, char **argv)
+{
+	int n = 1000000;
+	int bad = 0;
+
+	if (argc > 1)
+		n = atoi(argv[1]);
+	n = (n + BATCH - 1) / BATCH * BATCH;
+
+#if defined(CRUSH_HASH_AVX2)
+	printf("lanes: avx2\n");
+#elif defined(CRUSH_HASH_SSE2)
+	printf("lanes: sse2\n");
+#else
+	printf("lanes: scalar\n");
+#endif
+
+	bad += check_hashes(4*n);
+	bad += run("uniform", CRUSH_BUCKET_UNIFORM, n);
+	bad += run("list", CRUSH_BUCKET_LIST, n);
+	bad += run("tree", CRUSH_BUCKET_TREE, n);
+	bad += run("straw", CRUSH_BUCKET_STRAW, n);
+	bad += run("flat", 0, n);
+
+	return bad ? 1 : 0;
 }
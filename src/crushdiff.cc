@@ -0,0 +1,379 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * crushdiff -- predict data movement between two osdmaps.
+ *
+ * every pg (for each requested pg size) is mapped through both maps, and
+ * we report the pgs that moved, the bytes each osd would send and receive,
+ * and how evenly the data is spread before and after.  pg sizes in bytes
+ * are either a flat --pg_bytes, or come from a sampled object population
+ * (--objects), hashed to pgs the same way the client does.
+ *
+ * the second map is a file, the first map plus an incremental (--inc),
+ * or the first map plus a proposed change on the command line.  with
+ * --createsimple the first map is generated the way the monitor does for
+ * a fresh cluster, so "what if we add 50 osds" is
+ *
+ *   crushdiff --createsimple 1000 --add_osds 50
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <math.h>
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+using namespace std;
+
+#include "config.h"
+#include "osd/OSDMap.h"
+#include "common/Thread.h"
+
+
+int read_file(const char *fn, bufferlist &bl)
+{
+  int fd = ::open(fn, O_RDONLY);
+  if (fd < 0) return fd;
+  struct stat st;
+  ::fstat(fd, &st);
+  bufferptr bp(st.st_size);
+  bl.append(bp);
+  ::read(fd, (void*)bl.c_str(), bl.length());
+  ::close(fd);
+  return 0;
+}
+
+void create_simple(OSDMap& m, int num_osd, int pg_num)
+{
+  m.set_max_osd(num_osd);
+  for (int i=0; i<num_osd; i++)
+    m.set_state(i, CEPH_OSD_EXISTS|CEPH_OSD_UP);
+  OSDMap::build_simple_crush(m.crush, num_osd);
+  m.set_pg_num(pg_num);
+}
+
+
+/*
+ * sampled objects -> bytes per pg.  each thread takes a slice of the
+ * population and fills its own table; we sum them after.
+ */
+struct pg_bytes_t {
+  vector<int> sizes;
+  int pg_num;
+  vector<double> bytes;   // [size index * pg_num + ps]
+  pg_bytes_t(vector<int>& s, int n) : sizes(s), pg_num(n), bytes(s.size() * n) {}
+  double& get(int si, int ps) { return bytes[si * pg_num + ps]; }
+};
+
+class ObjectSampler : public Thread {
+  OSDMap *osdmap;
+  __u64 from, to;
+  double object_size;
+public:
+  pg_bytes_t pgb;
+  ObjectSampler(OSDMap *m, vector<int>& sizes, __u64 f, __u64 t, double os) :
+    osdmap(m), from(f), to(t), object_size(os), pgb(sizes, m->get_pg_num()) {}
+  void *entry() {
+    for (__u64 i=from; i<to; i++) {
+      // files of 64 objects, like a striped file would be
+      object_t oid(0x10000000000ULL + i/64, i % 64);
+      int si = (i / 64) % pgb.sizes.size();
+      ceph_object_layout ol = osdmap->make_object_layout(oid, pg_t::TYPE_REP, pgb.sizes[si]);
+      pg_t pg(ol.ol_pgid);
+      pgb.get(si, pg.ps()) += object_size;
+    }
+    return 0;
+  }
+};
+
+
+void usage()
+{
+  cerr << "usage: crushdiff [options] <osdmap> [<osdmap2> | --inc <incremental>]" << std::endl;
+  cerr << "       crushdiff [options] --createsimple <num_osd> [--pg_bits <b>]" << std::endl;
+  cerr << "proposed changes (to the second map):" << std::endl;
+  cerr << "   --add_osds <n>           with --createsimple: n more osds" << std::endl;
+  cerr << "   --mark_out <osd>" << std::endl;
+  cerr << "   --offload <osd> <0..65536>" << std::endl;
+  cerr << "mapping:" << std::endl;
+  cerr << "   --size <n>               pg size to map; may be repeated (default 2)" << std::endl;
+  cerr << "   --pg_bytes <bytes>       data per pg, if no --objects (default 1GB)" << std::endl;
+  cerr << "   --objects <n>            sample n objects instead" << std::endl;
+  cerr << "   --object_size <bytes>    (default 4MB)" << std::endl;
+  cerr << "   --threads <n>            (default 4)" << std::endl;
+  cerr << "   --verbose                list every moved pg" << std::endl;
+  exit(1);
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  parse_config_options(args);
+
+  vector<const char*> files;
+  const char *incfn = 0;
+  int createsimple = 0, add_osds = 0, pg_bits = g_conf.osd_pg_bits;
+  map<int,unsigned> offload;
+  vector<int> sizes;
+  double pg_bytes = 1 << 30;
+  __u64 objects = 0;
+  double object_size = 4 << 20;
+  int threads = 4;
+  bool verbose = false;
+
+  for (unsigned i=0; i<args.size(); i++) {
+    if (strcmp(args[i], "--inc") == 0 && i+1 < args.size())
+      incfn = args[++i];
+    else if (strcmp(args[i], "--createsimple") == 0 && i+1 < args.size())
+      createsimple = atoi(args[++i]);
+    else if (strcmp(args[i], "--pg_bits") == 0 && i+1 < args.size())
+      pg_bits = atoi(args[++i]);
+    else if (strcmp(args[i], "--add_osds") == 0 && i+1 < args.size())
+      add_osds = atoi(args[++i]);
+    else if (strcmp(args[i], "--mark_out") == 0 && i+1 < args.size())
+      offload[atoi(args[++i])] = CEPH_OSD_OUT;
+    else if (strcmp(args[i], "--offload") == 0 && i+2 < args.size()) {
+      int o = atoi(args[++i]);
+      offload[o] = atoi(args[++i]);
+    }
+    else if (strcmp(args[i], "--size") == 0 && i+1 < args.size())
+      sizes.push_back(atoi(args[++i]));
+    else if (strcmp(args[i], "--pg_bytes") == 0 && i+1 < args.size())
+      pg_bytes = atof(args[++i]);
+    else if (strcmp(args[i], "--objects") == 0 && i+1 < args.size())
+      objects = atoll(args[++i]);
+    else if (strcmp(args[i], "--object_size") == 0 && i+1 < args.size())
+      object_size = atof(args[++i]);
+    else if (strcmp(args[i], "--threads") == 0 && i+1 < args.size())
+      threads = atoi(args[++i]);
+    else if (strcmp(args[i], "--verbose") == 0)
+      verbose = true;
+    else if (args[i][0] == '-')
+      usage();
+    else
+      files.push_back(args[i]);
+  }
+  if (sizes.empty())
+    sizes.push_back(2);
+  if (threads < 1)
+    threads = 1;
+  if (add_osds && !createsimple) {
+    cerr << "crushdiff: --add_osds needs --createsimple" << std::endl;
+    return 1;
+  }
+  if (createsimple ? files.size() > 0 : (files.size() < 1 || files.size() > 2))
+    usage();
+  for (unsigned i=0; i<sizes.size(); i++)
+    if (sizes[i] < 1 || sizes[i] > g_conf.osd_max_rep) {
+      if (!createsimple) {
+	cerr << "crushdiff: pg size " << sizes[i] << " not in 1.." << g_conf.osd_max_rep << std::endl;
+	return 1;
+      }
+      g_conf.osd_max_rep = sizes[i];  // our own crush map; make the rule
+    }
+
+  g_conf.osd_pg_layout = CEPH_PG_LAYOUT_CRUSH;
+  g_conf.osd_map_cache_mappings = true;
+  g_conf.osd_map_mapping_threads = threads;
+  g_conf.osd_map_mapping_parallel_min = 0;
+
+  // the maps
+  OSDMap a, b;
+  if (createsimple) {
+    int pg_num = MIN(createsimple << pg_bits, 65536);  // ps is 16 bits
+    create_simple(a, createsimple, pg_num);
+    create_simple(b, createsimple + add_osds, pg_num);
+  } else {
+    bufferlist abl;
+    if (read_file(files[0], abl) < 0) {
+      cerr << "crushdiff: can't read " << files[0] << std::endl;
+      return 1;
+    }
+    a.decode(abl);
+    if (files.size() == 2) {
+      bufferlist bbl;
+      if (read_file(files[1], bbl) < 0) {
+	cerr << "crushdiff: can't read " << files[1] << std::endl;
+	return 1;
+      }
+      b.decode(bbl);
+    } else {
+      b.decode(abl);
+      if (incfn) {
+	bufferlist ibl;
+	if (read_file(incfn, ibl) < 0) {
+	  cerr << "crushdiff: can't read " << incfn << std::endl;
+	  return 1;
+	}
+	OSDMap::Incremental inc;
+	int off = 0;
+	inc.decode(ibl, off);
+	b.apply_incremental(inc);
+      }
+    }
+  }
+  for (map<int,unsigned>::iterator p = offload.begin(); p != offload.end(); p++) {
+    if (!b.exists(p->first)) {
+      cerr << "crushdiff: osd" << p->first << " dne" << std::endl;
+      return 1;
+    }
+    b.set_offload(p->first, p->second);
+  }
+
+  cout << "before: e" << a.get_epoch() << ", " << a.get_num_osds() << " osds (" << a.get_num_in_osds() << " in), "
+       << a.get_pg_num() << " pgs per size" << std::endl;
+  cout << "after:  e" << b.get_epoch() << ", " << b.get_num_osds() << " osds (" << b.get_num_in_osds() << " in), "
+       << b.get_pg_num() << " pgs per size" << std::endl;
+
+  utime_t start = g_clock.now();
+
+  // bytes per pg.  objects go to pgs by the *old* pg_num.  if pg_num
+  // grows, each old pg splits: its bytes are shared evenly by the pgs
+  // whose ps folds back to it (itself included), and those start out
+  // where it was.
+  pg_bytes_t pgb(sizes, a.get_pg_num());
+  if (objects) {
+    vector<ObjectSampler*> samplers(threads);
+    __u64 per = (objects + threads - 1) / threads;
+    for (int i=0; i<threads; i++) {
+      samplers[i] = new ObjectSampler(&a, sizes, MIN(i*per, objects), MIN((i+1)*per, objects), object_size);
+      samplers[i]->create();
+    }
+    for (int i=0; i<threads; i++) {
+      samplers[i]->join();
+      for (unsigned j=0; j<pgb.bytes.size(); j++)
+	pgb.bytes[j] += samplers[i]->pgb.bytes[j];
+      delete samplers[i];
+    }
+  } else {
+    for (unsigned j=0; j<pgb.bytes.size(); j++)
+      pgb.bytes[j] = pg_bytes;
+  }
+
+  // map every pg through both
+  int max_osd = MAX(a.get_max_osd(), b.get_max_osd());
+  vector<double> before(max_osd), after(max_osd), in(max_osd), out(max_osd);
+  vector<int> pgs_before(max_osd), pgs_after(max_osd);
+  __u64 npgs = 0, moved = 0, primary = 0, replicas = 0;
+  double moved_bytes = 0;
+  int pg_num = MAX(a.get_pg_num(), b.get_pg_num());
+  int a_mask = (1 << calc_bits_of(a.get_pg_num()-1)) - 1;
+  vector<int> children(a.get_pg_num(), 1);
+  if (b.get_pg_num() > a.get_pg_num())
+    for (int ps=a.get_pg_num(); ps<b.get_pg_num(); ps++)
+      children[ceph_stable_mod(ps, a.get_pg_num(), a_mask)]++;
+
+  for (unsigned si=0; si<sizes.size(); si++) {
+    for (int ps=0; ps<pg_num; ps++) {
+      pg_t pg(pg_t::TYPE_REP, sizes[si], ps, -1);
+      int parent = ceph_stable_mod(ps, a.get_pg_num(), a_mask);
+      vector<int> ao, bo;
+      if (ps < a.get_pg_num())
+	a.pg_to_osds(pg, ao);
+      if (ps < b.get_pg_num())
+	b.pg_to_osds(pg, bo);
+      double bytes = pgb.get(si, parent);
+      if (ps < a.get_pg_num()) {
+	if (ao.empty())
+	  bytes = 0;  // nowhere to put it before, either
+	for (unsigned i=0; i<ao.size(); i++) {
+	  before[ao[i]] += bytes;
+	  pgs_before[ao[i]]++;
+	}
+      }
+
+      // where this pg's data is now: itself, or the pg it splits from
+      vector<int> from = ao;
+      if (ps >= a.get_pg_num()) {
+	a.pg_to_osds(pg_t(pg_t::TYPE_REP, sizes[si], parent, -1), from);
+	if (from.empty())
+	  bytes = 0;
+      }
+      bytes /= children[parent];
+
+      npgs++;
+      for (unsigned i=0; i<bo.size(); i++) {
+	after[bo[i]] += bytes;
+	pgs_after[bo[i]]++;
+      }
+      if (from == bo)
+	continue;
+
+      moved++;
+      if (from.empty() || bo.empty() || from[0] != bo[0])
+	primary++;
+      for (unsigned i=0; i<bo.size(); i++)
+	if (find(from.begin(), from.end(), bo[i]) == from.end()) {
+	  replicas++;
+	  moved_bytes += bytes;
+	  in[bo[i]] += bytes;
+	  // data comes from the old primary
+	  if (!from.empty())
+	    out[from[0]] += bytes;
+	}
+      if (verbose)
+	cout << "pg " << pg << " " << ao << " -> " << bo << std::endl;
+    }
+  }
+
+  double elapsed = (double)(g_clock.now() - start);
+
+  // spread over in osds
+  double sum_b = 0, sum_a = 0, sq_b = 0, sq_a = 0, max_b = 0, max_a = 0;
+  int n_b = 0, n_a = 0;
+  for (int o=0; o<max_osd; o++) {
+    if (a.is_in(o)) {
+      n_b++;
+      sum_b += before[o];
+      sq_b += before[o] * before[o];
+      max_b = MAX(max_b, before[o]);
+    }
+    if (b.is_in(o)) {
+      n_a++;
+      sum_a += after[o];
+      sq_a += after[o] * after[o];
+      max_a = MAX(max_a, after[o]);
+    }
+  }
+  double mean_b = n_b ? sum_b / n_b : 0;
+  double mean_a = n_a ? sum_a / n_a : 0;
+  double sd_b = n_b ? sqrt(MAX(0, sq_b / n_b - mean_b * mean_b)) : 0;
+  double sd_a = n_a ? sqrt(MAX(0, sq_a / n_a - mean_a * mean_a)) : 0;
+
+  cout << std::endl;
+  cout << "osd\tpgs_before\tpgs_after\tin_bytes\tout_bytes\tbytes_before\tbytes_after" << std::endl;
+  for (int o=0; o<max_osd; o++) {
+    if (!verbose && !in[o] && !out[o] && pgs_before[o] == pgs_after[o])
+      continue;
+    cout << "osd" << o << "\t" << pgs_before[o] << "\t" << pgs_after[o]
+	 << "\t" << in[o] << "\t" << out[o]
+	 << "\t" << before[o] << "\t" << after[o] << std::endl;
+  }
+
+  cout << std::endl;
+  cout << npgs << " pgs mapped (" << sizes.size() << " sizes) in " << elapsed << " s" << std::endl;
+  cout << moved << " pgs changed (" << (npgs ? 100.0 * moved / npgs : 0) << "%), "
+       << primary << " new primaries, "
+       << replicas << " replicas to copy, "
+       << moved_bytes << " bytes (" << (sum_b ? 100.0 * moved_bytes / sum_b : 0) << "% of data)" << std::endl;
+  cout << "per-osd bytes before: mean " << mean_b << " stddev/mean " << (mean_b ? sd_b / mean_b : 0)
+       << " max/mean " << (mean_b ? max_b / mean_b : 0) << std::endl;
+  cout << "per-osd bytes after:  mean " << mean_a << " stddev/mean " << (mean_a ? sd_a / mean_a : 0)
+       << " max/mean " << (mean_a ? max_a / mean_a : 0) << std::endl;
+  return 0;
+}
@@ -19,7 +19,7 @@
 
 
 #undef dout
-#define dout(x) if (x <= g_conf.debug_ebofs) *_dout << dbeginl << g_clock.now() << " ebofs(" << fs->dev.get_device_name() << ").allocator."
+#define dout(x) dout_if(x, x <= g_conf.debug_ebofs) << g_clock.now() << " ebofs(" << fs->dev.get_device_name() << ").allocator."
 
 
 void Allocator::dump_freelist()
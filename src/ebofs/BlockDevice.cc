@@ -60,8 +60,8 @@ inline ostream& operator<<(ostream& out, BlockDevice::biovec &bio)
  * ElevatorQueue
  */
 
-#define dout(x) if (x <= g_conf.debug_bdev) *_dout << dbeginl << g_clock.now() << " bdev(" << dev << ").elevatorq."
-#define derr(x) if (x <= g_conf.debug_bdev) *_derr << dbeginl << g_clock.now() << " bdev(" << dev << ").elevatorq."
+#define dout(x) dout_if(x, x <= g_conf.debug_bdev) << g_clock.now() << " bdev(" << dev << ").elevatorq."
+#define derr(x) derr_if(x, x <= g_conf.debug_bdev) << g_clock.now() << " bdev(" << dev << ").elevatorq."
 
 
 int BlockDevice::ElevatorQueue::dequeue_io(list<biovec*>& biols, 
@@ -210,7 +210,7 @@ int BlockDevice::ElevatorQueue::dequeue_io(list<biovec*>& biols,
  * BarrierQueue
  */
 #undef dout
-#define dout(x) if (x <= g_conf.debug_bdev) *_dout << dbeginl << g_clock.now() << " bdev(" << dev << ").barrierq."
+#define dout(x) dout_if(x, x <= g_conf.debug_bdev) << g_clock.now() << " bdev(" << dev << ").barrierq."
 
 void BlockDevice::BarrierQueue::barrier()
 {
@@ -259,7 +259,7 @@ int BlockDevice::BarrierQueue::dequeue_io(list<biovec*>& biols,
  */
 
 #undef dout
-#define dout(x) if (x <= g_conf.debug_bdev) *_dout << dbeginl << g_clock.now() << " bdev(" << dev << ")."
+#define dout(x) dout_if(x, x <= g_conf.debug_bdev) << g_clock.now() << " bdev(" << dev << ")."
 
 
 
@@ -449,11 +449,15 @@ void BlockDevice::do_io(int fd, list<biovec*>& biols)
   dout(20) << "do_io start " << (type==biovec::IO_WRITE?"write":"read") 
            << " " << start << "~" << length 
            << " " << numbio << " bits" << dendl;
+  utime_t io_start = g_clock.now();
   if (type == biovec::IO_WRITE) {
     r = _write(fd, start, length, bl);
   } else if (type == biovec::IO_READ) {
     r = _read(fd, start, length, bl);
   } else assert(0);
+  if (perf)
+    perf->tinc(type == biovec::IO_WRITE ? l_ebofs_disk_wr_lat:l_ebofs_disk_rd_lat,
+	       g_clock.now() - io_start);
   dout(20) << "do_io finish " << (type==biovec::IO_WRITE?"write":"read") 
            << " " << start << "~" << length << dendl;
   
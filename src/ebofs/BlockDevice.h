@@ -23,6 +23,7 @@ using namespace std;
 #include "common/Mutex.h"
 #include "common/Cond.h"
 #include "common/Thread.h"
+#include "common/PerfCounters.h"
 
 #include "types.h"
 
@@ -252,6 +253,7 @@ class BlockDevice {
     void *entry() { return (void*)dev->complete_thread_entry(); }
   } kicker_thread;
 
+  PerfCounters *perf;
 
 
  public:
@@ -261,11 +263,13 @@ class BlockDevice {
     io_stop(false), io_threads_started(0), io_threads_running(0), is_idle_waiting(false),
     complete_queue_len(0),
     complete_thread(this),
-    idle_kicker(0), kicker_thread(this) { }
+    idle_kicker(0), kicker_thread(this), perf(0) { }
   ~BlockDevice() {
     if (fd > 0) close();
   }
 
+  void set_perf_counters(PerfCounters *p) { perf = p; }
+
   // get size in blocks
   block_t get_num_blocks();
   const char *get_device_name() const { return dev.c_str(); }
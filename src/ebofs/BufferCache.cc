@@ -39,8 +39,8 @@ void do_apply_partial(bufferlist& bl, map<off_t, bufferlist>& pm)
 
 #undef dout
 #undef derr
-#define dout(x)  if (x <= g_conf.debug_ebofs) *_dout << dbeginl << g_clock.now() << " ebofs." << *this << "."
-#define derr(x)  if (x <= g_conf.debug_ebofs) *_derr << dbeginl << g_clock.now() << " ebofs." << *this << "."
+#define dout(x)  dout_if(x, x <= g_conf.debug_ebofs) << g_clock.now() << " ebofs." << *this << "."
+#define derr(x)  derr_if(x, x <= g_conf.debug_ebofs) << g_clock.now() << " ebofs." << *this << "."
 
 
 void BufferHead::add_partial(off_t off, bufferlist& p) 
@@ -128,8 +128,8 @@ void BufferHead::apply_partial()
 
 #undef dout
 #undef derr
-#define dout(x)  if (x <= g_conf.debug_ebofs) *_dout << dbeginl << g_clock.now() << " ebofs.oc."
-#define derr(x)  if (x <= g_conf.debug_ebofs) *_derr << dbeginl << g_clock.now() << " ebofs.oc."
+#define dout(x)  dout_if(x, x <= g_conf.debug_ebofs) << g_clock.now() << " ebofs.oc."
+#define derr(x)  derr_if(x, x <= g_conf.debug_ebofs) << g_clock.now() << " ebofs.oc."
 
 
 
@@ -990,7 +990,7 @@ void ObjectCache::scrub_csums()
 /************** BufferCache ***************/
 
 #undef dout
-#define dout(x)  if (x <= g_conf.debug_ebofs) *_dout << dbeginl << g_clock.now() << " ebofs.bc."
+#define dout(x)  dout_if(x, x <= g_conf.debug_ebofs) << g_clock.now() << " ebofs.bc."
 
 
 
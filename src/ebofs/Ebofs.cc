@@ -29,8 +29,8 @@
 
 // *******************
 
-#define dout(x) if (x <= g_conf.debug_ebofs) *_dout << dbeginl << g_clock.now() << " ebofs(" << dev.get_device_name() << ")."
-#define derr(x) if (x <= g_conf.debug_ebofs) *_derr << dbeginl << g_clock.now() << " ebofs(" << dev.get_device_name() << ")."
+#define dout(x) dout_if(x, x <= g_conf.debug_ebofs) << g_clock.now() << " ebofs(" << dev.get_device_name() << ")."
+#define derr(x) derr_if(x, x <= g_conf.debug_ebofs) << g_clock.now() << " ebofs(" << dev.get_device_name() << ")."
 
 
 char *nice_blocks(block_t b) 
@@ -46,6 +46,25 @@ char *nice_blocks(block_t b)
   return s;
 }
 
+static PerfCountersType ebofs_perftype(l_ebofs_first, l_ebofs_last);
+
+void Ebofs::init_perf()
+{
+  if (ebofs_perftype.empty()) {
+    ebofs_perftype.add_u64(l_ebofs_rd, "rd");
+    ebofs_perftype.add_u64(l_ebofs_rdb, "rdb");
+    ebofs_perftype.add_u64(l_ebofs_wr, "wr");
+    ebofs_perftype.add_u64(l_ebofs_wrb, "wrb");
+    ebofs_perftype.add_u64(l_ebofs_commit, "commit");
+    ebofs_perftype.add_lat(l_ebofs_commit_lat, "commit_lat");
+    ebofs_perftype.add_lat(l_ebofs_jlat, "jlat");
+    ebofs_perftype.add_lat(l_ebofs_disk_rd_lat, "disk_rd_lat");
+    ebofs_perftype.add_lat(l_ebofs_disk_wr_lat, "disk_wr_lat");
+  }
+  perf = new PerfCounters("ebofs", &ebofs_perftype);
+  dev.set_perf_counters(perf);
+}
+
 int Ebofs::mount()
 {
   Mutex::Locker locker(ebofs_lock);
@@ -472,6 +491,7 @@ int Ebofs::commit_thread_entry()
       // --- get ready for a new epoch ---
       super_epoch++;
       dirty = false;
+      utime_t commit_start = g_clock.now();
 
       derr(10) << "commit_thread commit start, new epoch " << super_epoch << dendl;
       dout(10) << "commit_thread commit start, new epoch " << super_epoch << dendl;
@@ -564,6 +584,8 @@ int Ebofs::commit_thread_entry()
       commit_waiters.erase(super_epoch-1);
       sync_cond.Signal();
 
+      perf->inc(l_ebofs_commit);
+      perf->tinc(l_ebofs_commit_lat, g_clock.now() - commit_start);
       dout(10) << "commit_thread commit finish" << dendl;
     }
 
@@ -2398,9 +2420,67 @@ int Ebofs::read(pobject_t oid,
   ebofs_lock.Lock();
   int r = _read(oid, off, len, bl);
   ebofs_lock.Unlock();
+  if (r >= 0) {
+    perf->inc(l_ebofs_rd);
+    perf->inc(l_ebofs_rdb, r);
+  }
   return r;
 }
 
+/*
+ * read it all, so blocks coming off the disk get checked against their
+ * checksums (a bad one makes this -EIO), then fold the checksums we
+ * already have.  the last partial block we sum from the data: its
+ * stored checksum also covers whatever is left past the end.
+ */
+int Ebofs::digest(pobject_t oid, off_t *size, uint64_t *d)
+{
+  assert(EBOFS_BLOCK_SIZE == SCRUB_BLOCK);
+  ebofs_lock.Lock();
+  bufferlist bl;
+  int r = _read(oid, 0, 0, bl);
+  Onode *on = 0;
+  if (r >= 0) {
+    on = get_onode(oid);
+    if (!on)
+      r = -ENOENT;
+    else if ((off_t)bl.length() != on->object_size)
+      r = -EIO;   // cut short by a bad byte extent
+  }
+  if (r >= 0) {
+    *size = on->object_size;
+    *d = 0;
+    block_t full = on->object_size / EBOFS_BLOCK_SIZE;
+    vector<extent_t> exv;
+    vector<csum_t> csum;
+    if (full)
+      on->map_extents(0, full, exv, &csum);
+    block_t b = 0;
+    unsigned c = 0;
+    for (unsigned i=0; i<exv.size(); i++)
+      for (block_t j=0; j<exv[i].length; j++, b++)
+	*d = digest_fold(*d, exv[i].start ? csum[c++] : 0);
+    for (; b < full; b++)
+      *d = digest_fold(*d, 0);
+
+    unsigned tail = on->object_size % EBOFS_BLOCK_SIZE;
+    if (tail) {
+      uint64_t buf[EBOFS_BLOCK_SIZE / sizeof(uint64_t)];
+      memset(buf, 0, sizeof(buf));
+      bl.copy(full * EBOFS_BLOCK_SIZE, tail, (char*)buf);
+      *d = digest_fold(*d, calc_csum((char*)buf, EBOFS_BLOCK_SIZE));
+    }
+  }
+  if (on)
+    put_onode(on);
+  ebofs_lock.Unlock();
+  if (r < 0)
+    return r;
+  perf->inc(l_ebofs_rd);
+  perf->inc(l_ebofs_rdb, *size);
+  return 0;
+}
+
 int Ebofs::_read(pobject_t oid, off_t off, size_t len, bufferlist& bl)
 {
   dout(7) << "_read " << oid << " " << off << "~" << len << dendl;
@@ -2892,6 +2972,8 @@ int Ebofs::write(pobject_t oid,
   // commit waiter
   if (r > 0) {
     assert((size_t)r == len);
+    perf->inc(l_ebofs_wr);
+    perf->inc(l_ebofs_wrb, r);
     if (journal) {
       Transaction t;
       t.write(oid, off, len, bl);
@@ -3699,7 +3781,7 @@ int Ebofs::collection_list(coll_t cid, list<pobject_t>& ls)
   Table<coll_pobject_t, bool>::Cursor cursor(co_tab);
 
   int num = 0;
-  if (co_tab->find(coll_pobject_t(cid,pobject_t()), cursor) >= 0) {
+  if (_co_tab_find(coll_pobject_t(cid,pobject_t()), cursor)) {
     while (1) {
       const coll_t c = cursor.current().key.first;
       const pobject_t o = cursor.current().key.second;
@@ -3707,7 +3789,7 @@ int Ebofs::collection_list(coll_t cid, list<pobject_t>& ls)
       dout(10) << "collection_list  " << hex << cid << " includes " << o << dec << dendl;
       ls.push_back(o);
       num++;
-      if (cursor.move_right() < 0) break;
+      if (cursor.move_right() <= 0) break;
     }
   }
 
@@ -3715,6 +3797,58 @@ int Ebofs::collection_list(coll_t cid, list<pobject_t>& ls)
   return num;
 }
 
+/*
+ * position cursor on the first co_tab entry >= key.  find() stops at
+ * the end of the leaf it searched, which may not be the end of the
+ * table.
+ */
+bool Ebofs::_co_tab_find(coll_pobject_t key, Table<coll_pobject_t, bool>::Cursor& cursor)
+{
+  int r = co_tab->find(key, cursor);
+  if (r >= 0)
+    return true;
+  if (co_tab->get_num_keys() == 0)
+    return false;
+  return cursor.move_right() > 0;
+}
+
+int Ebofs::collection_list_partial(coll_t cid, ListCursor& lc, int max, vector<pobject_t>& ls)
+{
+  ls.clear();
+  if (lc.end)
+    return 0;
+
+  ebofs_lock.Lock();
+  dout(9) << "collection_list_partial " << hex << cid << dec << " from " << lc.next 
+	  << " max " << max << dendl;
+
+  if (!_collection_exists(cid)) {
+    ebofs_lock.Unlock();
+    return -ENOENT;
+  }
+
+  Table<coll_pobject_t, bool>::Cursor cursor(co_tab);
+  lc.end = true;
+  if (_co_tab_find(coll_pobject_t(cid, lc.next), cursor)) {
+    while (1) {
+      const coll_pobject_t& k = cursor.current().key;
+      if (k.first != cid) 
+	break;   // end!
+      if ((int)ls.size() == max) {
+	lc.next = k.second;
+	lc.end = false;
+	break;
+      }
+      ls.push_back(k.second);
+      if (cursor.move_right() <= 0) 
+	break;
+    }
+  }
+
+  ebofs_lock.Unlock();
+  return ls.size();
+}
+
 
 int Ebofs::_collection_setattr(coll_t cid, const char *name, const void *value, size_t size)
 {
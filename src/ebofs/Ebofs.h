@@ -34,6 +34,7 @@ using namespace __gnu_cxx;
 
 #include "common/Mutex.h"
 #include "common/Cond.h"
+#include "common/PerfCounters.h"
 
 #include "osd/ObjectStore.h"
 
@@ -67,6 +68,9 @@ protected:
   void write_super(version_t epoch, bufferptr& bp);
   int commit_thread_entry();
 
+  PerfCounters *perf;
+  void init_perf();
+
   class CommitThread : public Thread {
     Ebofs *ebofs;
   public:
@@ -265,6 +269,7 @@ protected:
     finisher_stop(false), finisher_thread(this) {
     for (int i=0; i<EBOFS_NUM_FREE_BUCKETS; i++)
       free_tab[i] = 0;
+    init_perf();
     if (jfn) {
       journalfn = new char[strlen(jfn) + 1];
       strcpy(journalfn, jfn);
@@ -275,8 +280,11 @@ protected:
     }
   }
   ~Ebofs() {
+    delete perf;
   }
 
+  PerfCounters *get_perf_counters() { return perf; }
+
   int mkfs();
   int mount();
   int umount();
@@ -292,6 +300,7 @@ protected:
   bool exists(pobject_t);
   int stat(pobject_t, struct stat*);
   int read(pobject_t, off_t off, size_t len, bufferlist& bl);
+  int digest(pobject_t oid, off_t *size, uint64_t *d);
   int is_cached(pobject_t oid, off_t off, size_t len);
 
   int write(pobject_t oid, off_t off, size_t len, const bufferlist& bl, Context *onsafe);
@@ -326,6 +335,7 @@ protected:
   int collection_remove(coll_t c, pobject_t o, Context *onsafe);
 
   int collection_list(coll_t c, list<pobject_t>& o);
+  int collection_list_partial(coll_t c, ListCursor& cursor, int max, vector<pobject_t>& ls);
   
   int collection_setattr(coll_t cid, const char *name, const void *value, size_t size, Context *onsafe);
   int collection_setattrs(coll_t cid, map<string,bufferptr> &aset);
@@ -374,6 +384,7 @@ private:
   int _setattrs(pobject_t oid, map<string,bufferptr>& attrset);
   int _rmattr(pobject_t oid, const char *name);
   bool _collection_exists(coll_t c);
+  bool _co_tab_find(coll_pobject_t key, Table<coll_pobject_t, bool>::Cursor& cursor);
   int _create_collection(coll_t c);
   int _destroy_collection(coll_t c);
   int _collection_add(coll_t c, pobject_t o);
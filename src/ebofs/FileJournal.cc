@@ -23,8 +23,8 @@
 
 #include "config.h"
 
-#define dout(x) if (x <= g_conf.debug_ebofs) *_dout << dbeginl << g_clock.now() << " ebofs(" << ebofs->dev.get_device_name() << ").journal "
-#define derr(x) if (x <= g_conf.debug_ebofs) *_derr << dbeginl << g_clock.now() << " ebofs(" << ebofs->dev.get_device_name() << ").journal "
+#define dout(x) dout_if(x, x <= g_conf.debug_ebofs) << g_clock.now() << " ebofs(" << ebofs->dev.get_device_name() << ").journal "
+#define derr(x) derr_if(x, x <= g_conf.debug_ebofs) << g_clock.now() << " ebofs(" << ebofs->dev.get_device_name() << ").journal "
 
 
 int FileJournal::_open(bool forwrite)
@@ -393,6 +393,8 @@ void FileJournal::do_write(bufferlist& bl)
 	   << (must_write_header ? " + header":"")
 	   << dendl;
   
+  utime_t start = g_clock.now();
+
   // header
   if (hbp.length())
     ::pwrite(fd, hbp.c_str(), hbp.length(), 0);
@@ -413,6 +415,7 @@ void FileJournal::do_write(bufferlist& bl)
   }
   if (!directio)
     ::fdatasync(fd);
+  ebofs->get_perf_counters()->tinc(l_ebofs_jlat, g_clock.now() - start);
       
   write_lock.Lock();    
 
@@ -45,7 +45,7 @@
 */
 
 #undef debofs
-#define debofs(x) if (x <= g_conf.debug_ebofs) *_dout << dbeginl << "ebofs.nodepool."
+#define debofs(x) dout_if(x, x <= g_conf.debug_ebofs) << "ebofs.nodepool."
 
 
 class Node {
@@ -12,7 +12,7 @@
  * 
  */
 
-#define dout(x) if (x <= g_conf.debug_ebofs) *_dout << dbeginl
+#define dout(x) dout_if(x, x <= g_conf.debug_ebofs)
 
 #include <iostream>
 #include "ebofs/Ebofs.h"
@@ -46,6 +46,21 @@ using namespace __gnu_cxx;
 #endif
 #define ROUND_UP_2(n, d) (((n)+(d)-1) & ~((d)-1))
 
+// perf counters
+enum {
+  l_ebofs_first = 20000,
+  l_ebofs_rd,
+  l_ebofs_rdb,
+  l_ebofs_wr,
+  l_ebofs_wrb,
+  l_ebofs_commit,
+  l_ebofs_commit_lat,   // commit thread pass
+  l_ebofs_jlat,         // journal write + sync
+  l_ebofs_disk_rd_lat,  // block device read
+  l_ebofs_disk_wr_lat,  // block device write
+  l_ebofs_last
+};
+
 // disk
 typedef uint64_t block_t;        // disk location/sector/block
 
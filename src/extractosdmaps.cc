@@ -28,7 +28,7 @@ using namespace std;
 #include "ebofs/Ebofs.h"
 
 #include "osd/OSD.h"
-#include "mon/MonitorStore.h"
+#include "mon/FileMonitorStore.h"
 
 int main(int argc, char **argv)
 {
@@ -37,7 +37,7 @@ int main(int argc, char **argv)
 
   Ebofs eb("dev/osd0");
   eb.mount();
-  MonitorStore ms("mondata/mon0");
+  FileMonitorStore ms("mondata/mon0");
   ms.mount();
   
   epoch_t e = 1;
@@ -258,6 +258,7 @@ struct ceph_msg_header {
 #define CEPH_MSG_CLIENT_REQUEST_FORWARD 25
 #define CEPH_MSG_CLIENT_REPLY           26
 #define CEPH_MSG_CLIENT_FILECAPS        0x310
+#define CEPH_MSG_CLIENT_FILECAPS_BATCH  0x311
 
 /* osd */
 #define CEPH_MSG_OSD_GETMAP       40
@@ -489,6 +490,8 @@ enum {
 
 	CEPH_OSD_OP_PULL       = 30,
 	CEPH_OSD_OP_PUSH       = 31,
+	CEPH_OSD_OP_SCRUB      = 32,  /* digest a range of a pg's objects */
+	CEPH_OSD_OP_SCRUB_PUSH = 33,  /* push over an inconsistent copy */
 
 	CEPH_OSD_OP_BALANCEREADS   = 101,
 	CEPH_OSD_OP_UNBALANCEREADS = 102
@@ -0,0 +1,104 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef __CEPH_COMPRESS_H
+#define __CEPH_COMPRESS_H
+
+#ifdef HAVE_CONFIG_H
+# include "acconfig.h"
+#endif
+
+#include "buffer.h"
+#include <errno.h>
+
+#ifdef HAVE_LIBZ
+# include <zlib.h>
+#endif
+
+/*
+ * self-describing compressed blob:
+ *
+ *   __u8 method   (COMPRESS_NONE, COMPRESS_ZLIB)
+ *   __u32 len     (uncompressed length)
+ *   data
+ *
+ * without zlib we can only write (and read) COMPRESS_NONE.  we also
+ * fall back to it when compression doesn't actually save anything.
+ */
+
+#define COMPRESS_NONE  0
+#define COMPRESS_ZLIB  1
+
+inline void compress_bl(bufferlist& in, bufferlist& out, bool compress=true)
+{
+  __u8 method = COMPRESS_NONE;
+  __u32 len = in.length();
+#ifdef HAVE_LIBZ
+  if (compress && len) {
+    uLongf clen = compressBound(len);
+    bufferptr bp(clen);
+    if (::compress2((Bytef*)bp.c_str(), &clen, (const Bytef*)in.c_str(), len,
+		    Z_DEFAULT_COMPRESSION) == Z_OK &&
+	clen < len) {
+      bp.set_length(clen);
+      method = COMPRESS_ZLIB;
+      ::_encoderaw(method, out);
+      ::_encoderaw(len, out);
+      out.push_back(bp);
+      return;
+    }
+  }
+#endif
+  ::_encoderaw(method, out);
+  ::_encoderaw(len, out);
+  out.append(in);
+}
+
+/*
+ * returns 0, or -EINVAL if the blob is corrupt or uses a method we
+ * weren't built with.
+ */
+inline int decompress_bl(bufferlist& in, bufferlist& out)
+{
+  int off = 0;
+  __u8 method;
+  __u32 len;
+  if (in.length() < sizeof(method) + sizeof(len))
+    return -EINVAL;
+  ::_decoderaw(method, in, off);
+  ::_decoderaw(len, in, off);
+
+  if (method == COMPRESS_NONE) {
+    if (in.length() - off != len)
+      return -EINVAL;
+    out.substr_of(in, off, len);
+    return 0;
+  }
+#ifdef HAVE_LIBZ
+  if (method == COMPRESS_ZLIB) {
+    bufferlist data;
+    data.substr_of(in, off, in.length() - off);
+    bufferptr bp(len);
+    uLongf olen = len;
+    if (::uncompress((Bytef*)bp.c_str(), &olen, (const Bytef*)data.c_str(), data.length()) != Z_OK ||
+	olen != len)
+      return -EINVAL;
+    out.push_back(bp);
+    return 0;
+  }
+#endif
+  return -EINVAL;
+}
+
+#endif
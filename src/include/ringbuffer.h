@@ -0,0 +1,282 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef __RINGBUFFER_H
+#define __RINGBUFFER_H
+
+#include "buffer.h"
+#include <iterator>
+
+/*
+ * ringbuffer - a deque of plain old data in one contiguous ring.
+ *
+ * items are moved around with memcpy, never constructed or destroyed.
+ * each has an absolute position: the first pushed is 0, push_front
+ * goes negative, and an item keeps its position until it is popped,
+ * even when the ring is reallocated.  iterators are (ring, position),
+ * so like list<>'s they survive pushes and pops of other items, and
+ * end() stays end() as the ring grows.
+ *
+ * the ring lives in a bufferptr, so share() can hand it to a
+ * bufferlist without copying.  pushes copy a shared ring before
+ * writing to it, but don't write through an iterator while it is
+ * shared.
+ */
+template<class T>
+class ringbuffer {
+  bufferptr bp;
+  T *buf;
+  unsigned cap;     // items bp holds
+  unsigned first;   // slot of head
+  int64_t head;     // position of front()
+  unsigned count;
+
+  static int64_t npos() { return 0x7fffffffffffffffLL; }
+
+  unsigned slot(int64_t pos) const {
+    unsigned i = first + (unsigned)(pos - head);
+    return i >= cap ? i - cap : i;
+  }
+
+  bool shared() const {
+    return bp.get_raw() && bp.raw_nref() > 1;
+  }
+
+  void realloc(unsigned n) {
+    assert(n >= count);
+    bufferptr nbp;
+    T *nbuf = 0;
+    if (n) {
+      nbp = buffer::create(n * sizeof(T));
+      nbuf = (T*)nbp.c_str();
+      unsigned a = cap - first < count ? cap - first : count;
+      memcpy(nbuf, buf + first, a * sizeof(T));
+      memcpy(nbuf + a, buf, (count - a) * sizeof(T));
+    }
+    bp.swap(nbp);
+    buf = nbuf;
+    cap = n;
+    first = 0;
+  }
+  void make_room(unsigned n) {
+    if (n > cap)
+      realloc(n > cap + cap/2 + 16 ? n : cap + cap/2 + 16);
+    else if (shared())
+      realloc(cap);
+  }
+  void maybe_shrink() {
+    if (cap > 64 && count * 4 < cap)
+      realloc(count * 2);
+  }
+
+public:
+  template<class R, class V>
+  class iter {
+    R *r;
+    int64_t pos;
+  public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef V value_type;
+    typedef ptrdiff_t difference_type;
+    typedef V* pointer;
+    typedef V& reference;
+
+    iter() : r(0), pos(npos()) {}
+    iter(R *ring, int64_t p) : r(ring), pos(p) {}
+    template<class R2, class V2>
+    iter(const iter<R2,V2>& o) : r(o.get_ring()), pos(o.get_pos()) {}
+
+    R *get_ring() const { return r; }
+    int64_t get_pos() const { return pos; }
+
+    V& operator*() const { return r->at(pos); }
+    V* operator->() const { return &r->at(pos); }
+    iter& operator++() {
+      if (++pos == r->head + r->count)
+	pos = npos();
+      return *this;
+    }
+    iter operator++(int) {
+      iter t = *this;
+      ++*this;
+      return t;
+    }
+    iter& operator--() {
+      if (pos == npos())
+	pos = r->head + r->count;
+      --pos;
+      return *this;
+    }
+    iter operator--(int) {
+      iter t = *this;
+      --*this;
+      return t;
+    }
+    bool operator==(const iter& o) const { return pos == o.pos && r == o.r; }
+    bool operator!=(const iter& o) const { return pos != o.pos || r != o.r; }
+  };
+
+  typedef iter<ringbuffer, T> iterator;
+  typedef iter<const ringbuffer, const T> const_iterator;
+  typedef std::reverse_iterator<iterator> reverse_iterator;
+  typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+  ringbuffer() : buf(0), cap(0), first(0), head(0), count(0) {}
+  ringbuffer(const ringbuffer& o) : buf(0), cap(0), first(0), head(0), count(0) {
+    *this = o;
+  }
+  ringbuffer& operator=(const ringbuffer& o) {
+    if (this != &o) {
+      count = 0;
+      head = o.head;
+      append(o.begin(), o.end());
+    }
+    return *this;
+  }
+
+  unsigned size() const { return count; }
+  bool empty() const { return count == 0; }
+  unsigned capacity() const { return cap; }
+
+  // positions
+  int64_t front_pos() const { return head; }
+  int64_t end_pos() const { return head + count; }
+  bool contains(int64_t pos) const { return pos >= head && pos < head + count; }
+  T& at(int64_t pos) {
+    assert(contains(pos));
+    return buf[slot(pos)];
+  }
+  const T& at(int64_t pos) const {
+    assert(contains(pos));
+    return buf[slot(pos)];
+  }
+  iterator position(int64_t pos) { return iterator(this, contains(pos) ? pos : npos()); }
+
+  T& front() { return at(head); }
+  const T& front() const { return at(head); }
+  T& back() { return at(head + count - 1); }
+  const T& back() const { return at(head + count - 1); }
+
+  iterator begin() { return iterator(this, count ? head : npos()); }
+  iterator end() { return iterator(this, npos()); }
+  const_iterator begin() const { return const_iterator(this, count ? head : npos()); }
+  const_iterator end() const { return const_iterator(this, npos()); }
+  reverse_iterator rbegin() { return reverse_iterator(end()); }
+  reverse_iterator rend() { return reverse_iterator(begin()); }
+  const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+  const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+  void push_back(const T& v) {
+    T t = v;  // v may live in the ring
+    make_room(count + 1);
+    memcpy(buf + slot(head + count), &t, sizeof(T));
+    count++;
+  }
+  void push_front(const T& v) {
+    T t = v;
+    make_room(count + 1);
+    first = first ? first - 1 : cap - 1;
+    head--;
+    count++;
+    memcpy(buf + first, &t, sizeof(T));
+  }
+  void pop_front() {
+    assert(count);
+    if (++first == cap)
+      first = 0;
+    head++;
+    count--;
+    maybe_shrink();
+  }
+  void pop_back() {
+    assert(count);
+    count--;
+    maybe_shrink();
+  }
+
+  void clear() {
+    bufferptr z;
+    bp.swap(z);
+    buf = 0;
+    cap = first = count = 0;
+  }
+  void reserve(unsigned n) {
+    if (n > cap)
+      realloc(n);
+  }
+  void swap(ringbuffer& o) {
+    bp.swap(o.bp);
+    T *b = buf; buf = o.buf; o.buf = b;
+    unsigned c = cap; cap = o.cap; o.cap = c;
+    unsigned f = first; first = o.first; o.first = f;
+    int64_t h = head; head = o.head; o.head = h;
+    c = count; count = o.count; o.count = c;
+  }
+
+  // bulk
+  void append(const T *p, unsigned n) {
+    make_room(count + n);
+    while (n) {
+      unsigned s = slot(head + count);
+      unsigned len = cap - s < n ? cap - s : n;
+      memcpy(buf + s, p, len * sizeof(T));
+      count += len;
+      p += len;
+      n -= len;
+    }
+  }
+  void append(const_iterator from, const_iterator to) {
+    const ringbuffer *o = from.get_ring();
+    if (from == to || !o)
+      return;
+    int64_t pos = from.get_pos();
+    int64_t end = to == o->end() ? o->end_pos() : to.get_pos();
+    reserve(count + (unsigned)(end - pos));
+    while (pos < end) {
+      unsigned s = o->slot(pos);
+      unsigned len = o->cap - s < end - pos ? o->cap - s : (unsigned)(end - pos);
+      append(o->buf + s, len);
+      pos += len;
+    }
+  }
+
+  /*
+   * empty the ring and make room for n items in a row, starting at
+   * front_pos(), for the caller to fill in.
+   */
+  T *assign(unsigned n) {
+    count = 0;
+    if (n > cap || shared())
+      clear();
+    if (n > cap)
+      realloc(n);
+    first = 0;
+    count = n;
+    return buf;
+  }
+
+  /*
+   * append the items to bl (at most two pieces), sharing the ring's
+   * memory.
+   */
+  void share(bufferlist& bl) const {
+    unsigned a = cap - first < count ? cap - first : count;
+    if (a)
+      bl.append(bp, first * sizeof(T), a * sizeof(T));
+    if (count > a)
+      bl.append(bp, 0, (count - a) * sizeof(T));
+  }
+};
+
+#endif
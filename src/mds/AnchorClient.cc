@@ -32,8 +32,8 @@ using std::cerr;
 
 #include "config.h"
 
-#define dout(x)  if (x <= g_conf.debug_mds) *_dout << dbeginl << g_clock.now() << " " << mds->messenger->get_myname() << ".anchorclient "
-#define derr(x)  if (x <= g_conf.debug_mds) *_derr << dbeginl << g_clock.now() << " " << mds->messenger->get_myname() << ".anchorclient "
+#define dout(x)  dout_if(x, x <= g_conf.debug_mds) << g_clock.now() << " " << mds->messenger->get_myname() << ".anchorclient "
+#define derr(x)  derr_if(x, x <= g_conf.debug_mds) << g_clock.now() << " " << mds->messenger->get_myname() << ".anchorclient "
 
 
 void AnchorClient::dispatch(Message *m)
@@ -27,8 +27,8 @@
 
 #include "config.h"
 
-#define dout(x)  if (x <= g_conf.debug_mds) *_dout << dbeginl << g_clock.now() << " " << mds->messenger->get_myname() << ".anchortable "
-#define derr(x)  if (x <= g_conf.debug_mds) *_derr << dbeginl << g_clock.now() << " " << mds->messenger->get_myname() << ".anchortable "
+#define dout(x)  dout_if(x, x <= g_conf.debug_mds) << g_clock.now() << " " << mds->messenger->get_myname() << ".anchortable "
+#define derr(x)  derr_if(x, x <= g_conf.debug_mds) << g_clock.now() << " " << mds->messenger->get_myname() << ".anchortable "
 
 
 void AnchorTable::dump()
@@ -56,6 +56,7 @@ bool AnchorTable::add(inodeno_t ino, dirfrag_t dirfrag)
   if (anchor_map.count(ino) == 0) {
     // new item
     anchor_map[ino] = Anchor(ino, dirfrag);
+    dirty_anchors.insert(ino);
     dout(7) << "add added " << anchor_map[ino] << dendl;
     return true;
   } else {
@@ -73,6 +74,7 @@ void AnchorTable::inc(inodeno_t ino)
   while (1) {
     Anchor &anchor = anchor_map[ino];
     anchor.nref++;
+    dirty_anchors.insert(ino);
       
     dout(10) << "inc now " << anchor << dendl;
     ino = anchor.dirfrag.ino;
@@ -90,6 +92,7 @@ void AnchorTable::dec(inodeno_t ino)
   while (true) {
     Anchor &anchor = anchor_map[ino];
     anchor.nref--;
+    dirty_anchors.insert(ino);
       
     if (anchor.nref == 0) {
       dout(10) << "dec removing " << anchor << dendl;
@@ -507,9 +510,23 @@ void AnchorTable::handle_anchor_request(class MAnchor *req)
 
 
 
-// primitive load/save for now!
+// load/save
 
-// load/save entire table for now!
+/*
+ * the table lives in two objects: the base (bno 0), a full snapshot as
+ * of base_version, and the delta log (bno 1), a sequence of
+ *
+ *   __u32 len, version_t base_version, version_t version,
+ *   changed anchors, pending state
+ *
+ * records.  a save normally appends one record with the anchors that
+ * changed since the last save; once the log would grow past
+ * mds_table_delta_max, we write a fresh base instead and start the log
+ * over.  only one write is in flight at a time, so a log record is never
+ * written before the base it is tagged with is safe.  on load, records
+ * that don't match the base (stale ones from an older base, or the tail
+ * of a longer old log) end the replay.
+ */
 
 class C_AT_Saved : public Context {
   AnchorTable *at;
@@ -521,26 +538,52 @@ public:
   }
 };
 
-void AnchorTable::save(Context *onfinish)
+void AnchorTable::encode_pending(bufferlist& bl)
 {
-  dout(7) << "save v " << version << dendl;
-  if (!opened) {
-    assert(!onfinish);
-    return;
-  }
+  ::_encode(pending_reqmds, bl);
+  ::_encode(pending_create, bl);
+  ::_encode(pending_destroy, bl);
   
-  if (onfinish)
-    waiting_for_save[version].push_back(onfinish);
-
-  if (committing_version == version) {
-    dout(7) << "save already committing v " << version << dendl;
-    return;
+  size_t s = pending_update.size();
+  bl.append((char*)&s, sizeof(s));
+  for (map<version_t, pair<inodeno_t, vector<Anchor> > >::iterator p = pending_update.begin();
+       p != pending_update.end();
+       ++p) {
+    bl.append((char*)&p->first, sizeof(p->first));
+    bl.append((char*)&p->second.first, sizeof(p->second.first));
+    ::_encode(p->second.second, bl);
   }
-  committing_version = version;
+}
 
-  // build up write
-  bufferlist bl;
+void AnchorTable::decode_pending(bufferlist& bl, int& off)
+{
+  pending_reqmds.clear();
+  pending_create.clear();
+  pending_destroy.clear();
+  pending_update.clear();
 
+  ::_decode(pending_reqmds, bl, off);
+  ::_decode(pending_create, bl, off);
+  ::_decode(pending_destroy, bl, off);
+
+  size_t s;
+  bl.copy(off, sizeof(s), (char*)&s);
+  off += sizeof(s);
+  for (size_t i=0; i<s; i++) {
+    version_t atid;
+    bl.copy(off, sizeof(atid), (char*)&atid);
+    off += sizeof(atid);
+    inodeno_t ino;
+    bl.copy(off, sizeof(ino), (char*)&ino);
+    off += sizeof(ino);
+
+    pending_update[atid].first = ino;
+    ::_decode(pending_update[atid].second, bl, off);
+  }
+}
+
+void AnchorTable::encode_base(bufferlist& bl)
+{
   // version
   bl.append((char*)&version, sizeof(version));
 
@@ -556,28 +599,117 @@ void AnchorTable::save(Context *onfinish)
     dout(15) << "save encoded " << it->second << dendl;
   }
 
-  // pending
-  ::_encode(pending_reqmds, bl);
-  ::_encode(pending_create, bl);
-  ::_encode(pending_destroy, bl);
-  
-  size_t s = pending_update.size();
-  bl.append((char*)&s, sizeof(s));
-  for (map<version_t, pair<inodeno_t, vector<Anchor> > >::iterator p = pending_update.begin();
-       p != pending_update.end();
+  encode_pending(bl);
+}
+
+void AnchorTable::decode_base(bufferlist& bl)
+{
+  int off = 0;
+  bl.copy(off, sizeof(version), (char*)&version);
+  off += sizeof(version);
+
+  size_t size;
+  bl.copy(off, sizeof(size), (char*)&size);
+  off += sizeof(size);
+
+  for (size_t n=0; n<size; n++) {
+    Anchor a;
+    a._decode(bl, off);
+    anchor_map[a.ino] = a;   
+    dout(15) << "load_2 decoded " << a << dendl;
+  }
+
+  decode_pending(bl, off);
+
+  assert(off == (int)bl.length());
+  base_version = version;
+}
+
+/*
+ * append a delta record to bl.  false if it doesn't fit in the log.
+ */
+bool AnchorTable::encode_delta(bufferlist& bl)
+{
+  bufferlist rec;
+  rec.append((char*)&base_version, sizeof(base_version));
+  rec.append((char*)&version, sizeof(version));
+  __u32 n = dirty_anchors.size();
+  rec.append((char*)&n, sizeof(n));
+  for (set<inodeno_t>::iterator p = dirty_anchors.begin();
+       p != dirty_anchors.end();
        ++p) {
-    bl.append((char*)&p->first, sizeof(p->first));
-    bl.append((char*)&p->second.first, sizeof(p->second.first));
-    ::_encode(p->second.second, bl);
+    inodeno_t ino = *p;
+    rec.append((char*)&ino, sizeof(ino));
+    hash_map<inodeno_t, Anchor>::iterator it = anchor_map.find(ino);
+    __u8 present = (it != anchor_map.end());
+    rec.append((char*)&present, sizeof(present));
+    if (present)
+      it->second._encode(rec);
   }
+  encode_pending(rec);
 
-  // write!
-  object_t oid = object_t(MDS_INO_ANCHORTABLE+mds->get_nodeid(), 0);
-  mds->objecter->write(oid,
-		       0, bl.length(),
-		       mds->objecter->osdmap->file_to_object_layout(oid, g_OSD_MDAnchorTableLayout),
-		       bl, 
-		       NULL, new C_AT_Saved(this, version));
+  __u32 len = rec.length();
+  if (delta_off + sizeof(len) + len > (__u64)g_conf.mds_table_delta_max)
+    return false;
+  bl.append((char*)&len, sizeof(len));
+  bl.claim_append(rec);
+  return true;
+}
+
+void AnchorTable::save(Context *onfinish)
+{
+  dout(7) << "save v " << version << dendl;
+  if (!opened) {
+    assert(!onfinish);
+    return;
+  }
+
+  if (committed_version == version) {
+    dout(7) << "save v " << version << " already committed" << dendl;
+    if (onfinish)
+      mds->queue_waiter(onfinish);
+    return;
+  }
+  
+  if (onfinish)
+    waiting_for_save[version].push_back(onfinish);
+
+  if (committing_version == version) {
+    dout(7) << "save already committing v " << version << dendl;
+    return;
+  }
+  if (committing_version > committed_version) {
+    dout(7) << "save waiting for v " << committing_version << " to commit" << dendl;
+    save_pending = version;
+    return;  // _saved will come back for this
+  }
+  committing_version = version;
+
+  bufferlist bl;
+  if (base_version && encode_delta(bl)) {
+    dout(10) << "save v " << version << " delta " << dirty_anchors.size() 
+	     << " anchors, " << bl.length() << " bytes at " << delta_off << dendl;
+    object_t oid = object_t(MDS_INO_ANCHORTABLE+mds->get_nodeid(), 1);
+    mds->objecter->write(oid,
+			 delta_off, bl.length(),
+			 mds->objecter->osdmap->file_to_object_layout(oid, g_OSD_MDAnchorTableLayout),
+			 bl, 
+			 NULL, new C_AT_Saved(this, version));
+    delta_off += bl.length();
+  } else {
+    encode_base(bl);
+    dout(10) << "save v " << version << " base " << anchor_map.size()
+	     << " anchors, " << bl.length() << " bytes" << dendl;
+    object_t oid = object_t(MDS_INO_ANCHORTABLE+mds->get_nodeid(), 0);
+    mds->objecter->write(oid,
+			 0, bl.length(),
+			 mds->objecter->osdmap->file_to_object_layout(oid, g_OSD_MDAnchorTableLayout),
+			 bl, 
+			 NULL, new C_AT_Saved(this, version));
+    base_version = version;
+    delta_off = 0;
+  }
+  dirty_anchors.clear();
 }
 
 void AnchorTable::_saved(version_t v)
@@ -588,8 +720,18 @@ void AnchorTable::_saved(version_t v)
   assert(committed_version < v);
   committed_version = v;
   
-  finish_contexts(waiting_for_save[v], 0);
-  waiting_for_save.erase(v);  
+  list<Context*> ls;
+  while (!waiting_for_save.empty() &&
+	 waiting_for_save.begin()->first <= v) {
+    ls.splice(ls.end(), waiting_for_save.begin()->second);
+    waiting_for_save.erase(waiting_for_save.begin());
+  }
+  finish_contexts(ls, 0);
+
+  // anyone waiting on a later version, or a save we put off?
+  if (!waiting_for_save.empty() ||
+      save_pending > committed_version)
+    save(0);
 }
 
 
@@ -605,6 +747,16 @@ public:
   }
 };
 
+class C_AT_LoadDeltas : public Context {
+  AnchorTable *at;
+public:
+  bufferlist bl;
+  C_AT_LoadDeltas(AnchorTable *a) : at(a) {}
+  void finish(int result) {
+    at->_loaded_deltas(bl);   // may well not exist
+  }
+};
+
 void AnchorTable::load(Context *onfinish)
 {
   dout(7) << "load" << dendl;
@@ -624,41 +776,70 @@ void AnchorTable::_loaded(bufferlist& bl)
 {
   dout(10) << "_loaded got " << bl.length() << " bytes" << dendl;
 
-  int off = 0;
-  bl.copy(off, sizeof(version), (char*)&version);
-  off += sizeof(version);
-
-  size_t size;
-  bl.copy(off, sizeof(size), (char*)&size);
-  off += sizeof(size);
+  decode_base(bl);
 
-  for (size_t n=0; n<size; n++) {
-    Anchor a;
-    a._decode(bl, off);
-    anchor_map[a.ino] = a;   
-    dout(15) << "load_2 decoded " << a << dendl;
-  }
-
-  ::_decode(pending_reqmds, bl, off);
-  ::_decode(pending_create, bl, off);
-  ::_decode(pending_destroy, bl, off);
+  // now the deltas
+  C_AT_LoadDeltas *fin = new C_AT_LoadDeltas(this);
+  object_t oid = object_t(MDS_INO_ANCHORTABLE+mds->get_nodeid(), 1);
+  mds->objecter->read(oid,
+		      0, 0,
+		      mds->objecter->osdmap->file_to_object_layout(oid, g_OSD_MDAnchorTableLayout),
+		      &fin->bl, fin);
+}
 
-  size_t s;
-  bl.copy(off, sizeof(s), (char*)&s);
-  off += sizeof(s);
-  for (size_t i=0; i<s; i++) {
-    version_t atid;
-    bl.copy(off, sizeof(atid), (char*)&atid);
-    off += sizeof(atid);
+/*
+ * apply the record at off, if it follows what we have.
+ */
+bool AnchorTable::decode_delta(bufferlist& bl, int& off)
+{
+  __u32 len;
+  version_t bv, v;
+  if (off + sizeof(len) + sizeof(bv) + sizeof(v) > bl.length())
+    return false;
+  bl.copy(off, sizeof(len), (char*)&len);
+  if (len == 0 || off + sizeof(len) + len > bl.length())
+    return false;   // end of log, or torn
+  int p = off + sizeof(len);
+  bl.copy(p, sizeof(bv), (char*)&bv);
+  p += sizeof(bv);
+  bl.copy(p, sizeof(v), (char*)&v);
+  p += sizeof(v);
+  if (bv != base_version || v <= version)
+    return false;   // left over from an older base
+
+  __u32 n;
+  bl.copy(p, sizeof(n), (char*)&n);
+  p += sizeof(n);
+  while (n--) {
     inodeno_t ino;
-    bl.copy(off, sizeof(ino), (char*)&ino);
-    off += sizeof(ino);
-
-    pending_update[atid].first = ino;
-    ::_decode(pending_update[atid].second, bl, off);
+    bl.copy(p, sizeof(ino), (char*)&ino);
+    p += sizeof(ino);
+    __u8 present;
+    bl.copy(p, sizeof(present), (char*)&present);
+    p += sizeof(present);
+    if (present) {
+      Anchor a;
+      a._decode(bl, p);
+      anchor_map[ino] = a;
+    } else
+      anchor_map.erase(ino);
   }
+  decode_pending(bl, p);
+  assert(p == off + (int)sizeof(len) + (int)len);
 
-  assert(off == (int)bl.length());
+  version = v;
+  off = p;
+  return true;
+}
+
+void AnchorTable::_loaded_deltas(bufferlist& bl)
+{
+  int off = 0;
+  int n = 0;
+  while (decode_delta(bl, off))
+    n++;
+  delta_off = off;
+  dout(10) << "_loaded_deltas replayed " << n << " deltas, " << off << " bytes, now v " << version << dendl;
 
   // done.
   opened = true;
@@ -28,6 +28,7 @@ class MAnchor;
 class AnchorTable {
   MDS *mds;
 
+protected:
   // keep the entire table in memory.
   hash_map<inodeno_t, Anchor>  anchor_map;
 
@@ -40,10 +41,17 @@ class AnchorTable {
   version_t version;  // this includes anchor_map AND pending_* state.
   version_t committing_version;
   version_t committed_version;
+  version_t save_pending;       // a save asked for while one was committing
 
   // load/save state
   bool opening, opened;
 
+  // the table is stored as a full snapshot (base) plus a log of deltas,
+  // each tagged with the base version it applies to.  see save().
+  version_t base_version;          // version of the base on disk
+  __u64 delta_off;                 // end of the delta log
+  set<inodeno_t> dirty_anchors;    // changed since the last save
+
   // waiters
   list<Context*> waiting_for_open;
   map<version_t, list<Context*> > waiting_for_save;
@@ -92,8 +100,9 @@ protected:
 public:
   AnchorTable(MDS *m) :
     mds(m),
-    version(0), committing_version(0), committed_version(0), 
-    opening(false), opened(false) { }
+    version(0), committing_version(0), committed_version(0), save_pending(0),
+    opening(false), opened(false),
+    base_version(0), delta_off(0) { }
 
   void dispatch(class Message *m);
 
@@ -109,13 +118,26 @@ public:
     pending_create.clear();
     pending_destroy.clear();
     pending_update.clear();
+    base_version = 0;
+    delta_off = 0;
+    dirty_anchors.clear();
   }
 
-  // load/save entire table for now!
+  // load/save: base + deltas
   void save(Context *onfinish);
   void _saved(version_t v);
   void load(Context *onfinish);
   void _loaded(bufferlist& bl);
+  void _loaded_deltas(bufferlist& bl);
+
+protected:
+  void encode_pending(bufferlist& bl);
+  void decode_pending(bufferlist& bl, int& off);
+  void encode_base(bufferlist& bl);
+  void decode_base(bufferlist& bl);
+  bool encode_delta(bufferlist& bl);
+  bool decode_delta(bufferlist& bl, int& off);
+public:
 
   // recovery
   void handle_mds_recovery(int who);
@@ -33,7 +33,7 @@
 
 #include "config.h"
 
-#define dout(x)  if (x <= g_conf.debug || x <= g_conf.debug_mds) *_dout << dbeginl << g_clock.now() << " mds" << cache->mds->get_nodeid() << ".cache.dir(" << this->dirfrag() << ") "
+#define dout(x)  dout_if(x, x <= g_conf.debug || x <= g_conf.debug_mds) << g_clock.now() << " mds" << cache->mds->get_nodeid() << ".cache.dir(" << this->dirfrag() << ") "
 
 
 
@@ -179,7 +179,7 @@ CDentry* CDir::add_null_dentry(const string& dname)
   assert(items.count(dn->name) == 0);
   //assert(null_items.count(dn->name) == 0);
 
-  items[dn->name] = dn;
+  items.insert(dn->name, dn);
   nnull++;
 
   dout(12) << "add_null_dentry " << *dn << dendl;
@@ -211,7 +211,7 @@ CDentry* CDir::add_primary_dentry(const string& dname, CInode *in)
   assert(items.count(dn->name) == 0);
   //assert(null_items.count(dn->name) == 0);
 
-  items[dn->name] = dn;
+  items.insert(dn->name, dn);
   link_inode_work( dn, in );
 
   dout(12) << "add_primary_dentry " << *dn << dendl;
@@ -242,7 +242,7 @@ CDentry* CDir::add_remote_dentry(const string& dname, inodeno_t ino, unsigned ch
   assert(items.count(dn->name) == 0);
   //assert(null_items.count(dn->name) == 0);
 
-  items[dn->name] = dn;
+  items.insert(dn->name, dn);
   nitems++;
 
   dout(12) << "add_remote_dentry " << *dn << dendl;
@@ -462,7 +462,7 @@ void CDir::steal_dentry(CDentry *dn)
 {
   dout(15) << "steal_dentry " << *dn << dendl;
 
-  items[dn->name] = dn;
+  items.insert(dn->name, dn);
 
   dn->dir->items.erase(dn->name);
   if (dn->dir->items.empty())
@@ -556,17 +556,21 @@ void CDir::split(int bits, list<CDir*>& subs, list<Context*>& waiters)
     inode->add_dirfrag(f);
   }
   
-  // repartition dentries
-  while (!items.empty()) {
-    CDir::map_t::iterator p = items.begin();
-    
+  // repartition dentries.  pick_dirfrag uses the raw name hash but
+  // items are ordered by its rjhash32 mix, so the subfrags' dentries come
+  // out interleaved.  each subfrag still gets its own in key order, so
+  // every steal_dentry appends to its index without shifting.
+  CDir::map_t::iterator p = items.begin();
+  while (p != items.end()) {
     CDentry *dn = p->second;
-    frag_t subfrag = inode->pick_dirfrag(p->first);
+    ++p;   // steal_dentry erases dn; that leaves p alone.
+    frag_t subfrag = inode->pick_dirfrag(dn->name);
     int n = subfrag.value() >> frag.bits();
-    dout(15) << " subfrag " << subfrag << " n=" << n << " for " << p->first << dendl;
+    dout(15) << " subfrag " << subfrag << " n=" << n << " for " << dn->name << dendl;
     CDir *f = subfrags[n];
     f->steal_dentry(dn);
   }
+  assert(items.empty());
 
   purge_stolen(waiters);
   inode->close_dirfrag(frag); // selft deletion, watch out.
@@ -585,8 +589,13 @@ void CDir::merge(int bits, list<Context*>& waiters)
     dout(10) << " subfrag " << *p << " " << *dir << dendl;
     
     // steal dentries
-    while (!dir->items.empty()) 
-      steal_dentry(dir->items.begin()->second);
+    CDir::map_t::iterator q = dir->items.begin();
+    while (q != dir->items.end()) {
+      CDentry *dn = q->second;
+      ++q;
+      steal_dentry(dn);
+    }
+    assert(dir->items.empty());
     
     // merge replica map
     for (map<int,int>::iterator p = dir->replica_map.begin();
@@ -37,6 +37,7 @@ using __gnu_cxx::hash_map;
 
 
 #include "CInode.h"
+#include "DentryIndex.h"
 
 class CDentry;
 class MDCache;
@@ -156,8 +157,7 @@ class CDir : public MDSCacheObject {
   //int hack_num_accessed;
 
 public:
-  //typedef hash_map<string, CDentry*> map_t;   // there is a bug somewhere, valgrind me.
-  typedef map<string, CDentry*> map_t;
+  typedef DentryIndex map_t;   // hash ordered; see DentryIndex.h
 protected:
   // contents
   map_t items;       // non-null AND null
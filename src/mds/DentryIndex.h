@@ -0,0 +1,284 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef __DENTRYINDEX_H
+#define __DENTRYINDEX_H
+
+#include <assert.h>
+#include <string>
+using namespace std;
+
+#include "include/types.h"
+#include "include/hash.h"
+#include "include/blobhash.h"
+
+class CDentry;
+
+/*
+ * DentryIndex -- name -> CDentry* index for a single CDir.
+ *
+ * this is an ordered linear probing table (a la Amble and Knuth).  the key
+ * is the same name hash that pick_dirfrag() feeds to the fragtree, mixed so
+ * that its top bits are usable as the home slot, in the high word, and a
+ * second (blob) hash of the name in the low word to break the many ties
+ * hash<string> produces.  each entry sits at or after its home slot, and the
+ * table is kept sorted by (key, name), so
+ *
+ *  - lookups scan a short run of the compact key array, and stop as soon
+ *    as they pass where the name would be;
+ *  - iteration walks the array in key order, which depends only on the set
+ *    of names in the dir, not on insertion history (stable readdir order);
+ *  - split walks the parent in key order.  the subfrags' names are
+ *    interleaved (the fragtree goes by the unmixed hash), but each subfrag
+ *    still sees its own in key order, so its index is built by appending,
+ *    without shifting.
+ *
+ * erase leaves a tombstone and never moves other entries, so (unlike
+ * hash_map) erasing while iterating is safe, as with map<>.  insert may
+ * shift entries, and invalidates iterators.  so it is insert that
+ * reclaims tombstones: it rehashes, sized for the live entries, when the
+ * table is 3/4 full or tombstones outnumber live entries (and PAD).
+ *
+ * iterators look like map<string,CDentry*>::iterator (p->first, p->second).
+ */
+class DentryIndex {
+public:
+  struct value_type {
+    string first;          // dentry name.  do not modify.
+    CDentry *second;
+    value_type() : second(0) {}
+  };
+
+  static const unsigned SLOT_EMPTY = 0;
+  static const unsigned SLOT_LIVE  = 1;
+  static const unsigned SLOT_DEAD  = 2;   // tombstone; key kept for ordering
+
+  // slack past the last home slot, so that probe runs never wrap.
+  static const unsigned PAD = 16;
+  static const unsigned MIN_ORDER = 4;
+
+private:
+  struct slot_t {
+    __u64 key;
+    unsigned state;
+    slot_t() : key(0), state(SLOT_EMPTY) {}
+  };
+
+public:
+  class iterator {
+    slot_t *slots;
+    value_type *vals;
+    unsigned cur, last;
+    void skip() {
+      while (cur != last && slots[cur].state != SLOT_LIVE) cur++;
+    }
+  public:
+    iterator() : slots(0), vals(0), cur(0), last(0) {}
+    iterator(slot_t *s, value_type *v, unsigned c, unsigned l) :
+      slots(s), vals(v), cur(c), last(l) { skip(); }
+    value_type& operator*() { return vals[cur]; }
+    value_type* operator->() { return &vals[cur]; }
+    iterator& operator++() { cur++; skip(); return *this; }
+    iterator operator++(int) { iterator t = *this; ++*this; return t; }
+    bool operator==(const iterator& o) const { return cur == o.cur; }
+    bool operator!=(const iterator& o) const { return cur != o.cur; }
+    friend class DentryIndex;
+  };
+
+private:
+  slot_t *slots;
+  value_type *vals;
+  unsigned order;      // 2^order home slots
+  unsigned nslots;     // home slots + PAD
+  unsigned nlive, ndead;
+
+  unsigned home(__u64 k, unsigned o) const { return k >> (64 - o); }
+  unsigned home(__u64 k) const { return home(k, order); }
+
+  // does (ak,an) sort before slot i?
+  bool before(__u64 ak, const string& an, unsigned i) const {
+    return ak < slots[i].key || (ak == slots[i].key && an < vals[i].first);
+  }
+
+  void move_slot(unsigned from, unsigned to) {
+    slots[to] = slots[from];
+    slots[from].state = SLOT_EMPTY;
+    vals[to].first.swap(vals[from].first);
+    vals[to].second = vals[from].second;
+    vals[from].first.clear();
+    vals[from].second = 0;
+  }
+
+  void rehash(unsigned nr) {
+    if (nr < MIN_ORDER) nr = MIN_ORDER;
+
+    // make sure no probe run falls off the end at this order
+    while (1) {
+      unsigned nn = (1 << nr) + PAD;
+      unsigned pos = 0;
+      bool fits = true;
+      for (unsigned i=0; i<nslots && fits; i++) {
+	if (slots[i].state != SLOT_LIVE) continue;
+	unsigned h = home(slots[i].key, nr);
+	if (h > pos) pos = h;
+	if (pos >= nn) fits = false;
+	pos++;
+      }
+      if (fits) break;
+      nr++;
+    }
+
+    unsigned nn = (1 << nr) + PAD;
+    slot_t *ns = new slot_t[nn];
+    value_type *nv = new value_type[nn];
+    unsigned pos = 0;
+    for (unsigned i=0; i<nslots; i++) {
+      if (slots[i].state != SLOT_LIVE) continue;
+      unsigned h = home(slots[i].key, nr);
+      if (h > pos) pos = h;
+      ns[pos] = slots[i];
+      nv[pos].first.swap(vals[i].first);
+      nv[pos].second = vals[i].second;
+      pos++;
+    }
+    delete[] slots;
+    delete[] vals;
+    slots = ns;
+    vals = nv;
+    order = nr;
+    nslots = nn;
+    ndead = 0;
+  }
+
+  // no copying!
+  DentryIndex(const DentryIndex& other);
+  const DentryIndex& operator=(const DentryIndex& other);
+
+public:
+  DentryIndex() : slots(0), vals(0), order(MIN_ORDER), nslots(0), nlive(0), ndead(0) {}
+  ~DentryIndex() {
+    delete[] slots;
+    delete[] vals;
+  }
+
+  /*
+   * high word: the pick_dirfrag() hash, mixed.  rjhash32 is a bijection,
+   * so this never merges names the fragtree would tell apart.
+   */
+  static __u64 name_key(const string& n) {
+    static hash<string> H;
+    static blobhash B;
+    __u32 hi = rjhash32(H(n));
+    __u32 lo = B(n.data(), n.length());
+    return ((__u64)hi << 32) | lo;
+  }
+
+  unsigned size() const { return nlive; }
+  bool empty() const { return nlive == 0; }
+  unsigned capacity() const { return nslots; }
+
+  iterator begin() { return iterator(slots, vals, 0, nslots); }
+  iterator end() { return iterator(slots, vals, nslots, nslots); }
+
+  iterator find(const string& n) {
+    if (!nlive) return end();
+    __u64 k = name_key(n);
+    for (unsigned i = home(k); i < nslots; i++) {
+      if (slots[i].state == SLOT_EMPTY) break;
+      if (slots[i].state == SLOT_DEAD) continue;
+      if (slots[i].key == k && vals[i].first == n)
+	return iterator(slots, vals, i, nslots);
+      if (before(k, n, i)) break;   // passed it
+    }
+    return end();
+  }
+  unsigned count(const string& n) {
+    return find(n) != end() ? 1:0;
+  }
+
+  void insert(const string& n, CDentry *dn) {
+    if (!slots || 
+	(nlive + ndead + 1) * 4 > (1U << order) * 3 ||
+	(ndead > nlive && ndead > PAD)) {
+      // size for the live set; tombstones are dropped.
+      unsigned nr = MIN_ORDER;
+      while ((1U << nr) < (nlive + 1) * 2) nr++;
+      rehash(nr);
+    }
+    __u64 k = name_key(n);
+    unsigned h = home(k);
+    unsigned i = h;
+    while (i < nslots && slots[i].state != SLOT_EMPTY) {
+      if (slots[i].state == SLOT_LIVE && before(k, n, i))
+	break;
+      assert(slots[i].state != SLOT_LIVE || slots[i].key != k || vals[i].first != n);
+      i++;
+    }
+    if (i == nslots) {
+      rehash(order+1);
+      insert(n, dn);
+      return;
+    }
+    if (slots[i].state == SLOT_LIVE) {
+      if (i > h && slots[i-1].state == SLOT_DEAD) {
+	// reuse the tombstone just before our successor
+	i--;
+	ndead--;
+      } else {
+	// shift the run [i,j) right by one into the next hole
+	unsigned j = i+1;
+	while (j < nslots && slots[j].state == SLOT_LIVE) j++;
+	if (j == nslots) {
+	  rehash(order+1);
+	  insert(n, dn);
+	  return;
+	}
+	if (slots[j].state == SLOT_DEAD)
+	  ndead--;
+	for (unsigned m = j; m > i; m--)
+	  move_slot(m-1, m);
+      }
+    }
+    slots[i].key = k;
+    slots[i].state = SLOT_LIVE;
+    vals[i].first = n;
+    vals[i].second = dn;
+    nlive++;
+  }
+
+  void erase(iterator p) {
+    assert(p.cur < nslots && slots[p.cur].state == SLOT_LIVE);
+    slots[p.cur].state = SLOT_DEAD;
+    vals[p.cur].first.clear();
+    vals[p.cur].second = 0;
+    nlive--;
+    ndead++;
+  }
+  void erase(const string& n) {
+    iterator p = find(n);
+    assert(p != end());
+    erase(p);
+  }
+
+  void clear() {
+    delete[] slots;
+    delete[] vals;
+    slots = 0;
+    vals = 0;
+    order = MIN_ORDER;
+    nslots = nlive = ndead = 0;
+  }
+};
+
+#endif
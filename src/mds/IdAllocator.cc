@@ -26,7 +26,7 @@
 
 #include "config.h"
 
-#define dout(x)  if (x <= g_conf.debug_mds) *_dout << dbeginl << g_clock.now() << " mds" << mds->get_nodeid() << ".idalloc: "
+#define dout(x)  dout_if(x, x <= g_conf.debug_mds) << g_clock.now() << " mds" << mds->get_nodeid() << ".idalloc: "
 
 
 void IdAllocator::init_inode()
@@ -43,6 +43,7 @@
 
 #include "messages/MClientRequest.h"
 #include "messages/MClientFileCaps.h"
+#include "messages/MClientFileCapsBatch.h"
 
 #include "messages/MMDSSlaveRequest.h"
 
@@ -51,7 +52,7 @@
 
 #include "config.h"
 
-#define  dout(l)    if (l<=g_conf.debug || l <= g_conf.debug_mds) *_dout << dbeginl << g_clock.now() << " mds" << mds->get_nodeid() << ".locker "
+#define  dout(l)    dout_if(l, l<=g_conf.debug || l <= g_conf.debug_mds) << g_clock.now() << " mds" << mds->get_nodeid() << ".locker "
 
 
 
@@ -73,6 +74,9 @@ void Locker::dispatch(Message *m)
   case CEPH_MSG_CLIENT_FILECAPS:
     handle_client_file_caps((MClientFileCaps*)m);
     break;
+  case CEPH_MSG_CLIENT_FILECAPS_BATCH:
+    handle_client_file_caps_batch((MClientFileCapsBatch*)m);
+    break;
 
     
 
@@ -546,12 +550,12 @@ bool Locker::issue_caps(CInode *in)
         dout(7) << "   sending MClientFileCaps to client" << it->first << " seq " << cap->get_last_seq()
 		<< " new pending " << cap_string(cap->pending()) << " was " << cap_string(before) 
 		<< dendl;
-        mds->send_message_client(new MClientFileCaps(CEPH_CAP_OP_GRANT,
-						     in->inode,
-						     cap->get_last_seq(),
-						     cap->pending(),
-						     cap->wanted()),
-				 it->first);
+        send_caps(new MClientFileCaps(CEPH_CAP_OP_GRANT,
+				      in->inode,
+				      cap->get_last_seq(),
+				      cap->pending(),
+				      cap->wanted()),
+		  it->first);
       }
     }
   }
@@ -559,6 +563,67 @@ bool Locker::issue_caps(CInode *in)
   return (nissued == 0);  // true if no re-issued, no callbacks
 }
 
+class C_Locker_FlushCaps : public Context {
+  Locker *locker;
+public:
+  C_Locker_FlushCaps(Locker *l) : locker(l) {}
+  void finish(int r) {
+    locker->cap_flush_event = 0;
+    locker->flush_cap_batches();
+  }
+};
+
+void Locker::send_caps(MClientFileCaps *m, int client)
+{
+  if (!g_conf.mds_cap_batch) {
+    mds->send_message_client(m, client);
+    return;
+  }
+  MClientFileCapsBatch *b = cap_batch[client];
+  if (!b) 
+    b = cap_batch[client] = new MClientFileCapsBatch;
+  b->add(m);
+  delete m;
+
+  // nobody flushes at the end of a timer event; don't wait for the next
+  // dispatch or tick.
+  if (!mds->dispatching && !cap_flush_event) {
+    cap_flush_event = new C_Locker_FlushCaps(this);
+    mds->timer.add_event_after(0, cap_flush_event);
+  }
+}
+
+/*
+ * called before anything else goes to this client (see
+ * MDS::send_message_client), so batched grants are never reordered
+ * relative to other cap messages.
+ */
+void Locker::flush_cap_batch(int client)
+{
+  map<int, MClientFileCapsBatch*>::iterator p = cap_batch.find(client);
+  if (p == cap_batch.end()) 
+    return;
+  MClientFileCapsBatch *b = p->second;
+  cap_batch.erase(p);   // before we send; send_message_client calls back here
+
+  if (b->size() == 1) {
+    // not worth the wrapper
+    list<MClientFileCaps*> ls;
+    b->split(ls);
+    delete b;
+    mds->send_message_client(ls.front(), client);
+  } else {
+    dout(7) << "flush_cap_batch " << b->size() << " cap updates to client" << client << dendl;
+    mds->send_message_client(b, client);
+  }
+}
+
+void Locker::flush_cap_batches()
+{
+  while (!cap_batch.empty())
+    flush_cap_batch(cap_batch.begin()->first);
+}
+
 void Locker::revoke_stale_caps(Session *session)
 {
   dout(10) << "revoke_stale_caps for " << session->inst.name << dendl;
@@ -818,6 +883,26 @@ void Locker::handle_client_file_caps(MClientFileCaps *m)
 
 
 
+void Locker::handle_client_file_caps_batch(MClientFileCapsBatch *m)
+{
+  dout(7) << "handle_client_file_caps_batch " << m->size() 
+	  << " from " << m->get_source() << dendl;
+  list<MClientFileCaps*> ls;
+  m->split(ls);
+  delete m;
+  for (list<MClientFileCaps*>::iterator p = ls.begin(); p != ls.end(); ++p)
+    handle_client_file_caps(*p);
+}
+
+
+
+
+
+
+
+
+
+
 // locks ----------------------------------------------------------------
 
 SimpleLock *Locker::get_lock(int lock_type, MDSCacheObjectInfo &info) 
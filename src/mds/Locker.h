@@ -40,6 +40,8 @@ class MDentryUnlink;
 class MLock;
 
 class MClientRequest;
+class MClientFileCaps;
+class MClientFileCapsBatch;
 
 class Anchor;
 class Capability;
@@ -56,7 +58,7 @@ private:
   MDCache *mdcache;
  
  public:
-  Locker(MDS *m, MDCache *c) : mds(m), mdcache(c) {}  
+  Locker(MDS *m, MDCache *c) : mds(m), mdcache(c), cap_flush_event(0) {}  
 
   SimpleLock *get_lock(int lock_type, MDSCacheObjectInfo &info);
   
@@ -186,6 +188,21 @@ protected:
 
  protected:
   void handle_client_file_caps(class MClientFileCaps *m);
+  void handle_client_file_caps_batch(MClientFileCapsBatch *m);
+
+  // -- batched cap messages --
+  // with mds_cap_batch, grants are collected per client and sent as one
+  // MClientFileCapsBatch at the end of the current dispatch.  grants made
+  // outside dispatch (timer events, ms_handle_failure, ...) are flushed
+  // by a zero-delay timer event, once whoever holds mds_lock lets go.
+  map<int, MClientFileCapsBatch*> cap_batch;
+  Context *cap_flush_event;
+  friend class C_Locker_FlushCaps;
+ public:
+  void send_caps(MClientFileCaps *m, int client);
+  void flush_cap_batch(int client);
+  void flush_cap_batches();
+ protected:
 
   void request_inode_file_caps(CInode *in);
   void handle_inode_file_caps(class MInodeFileCaps *m);
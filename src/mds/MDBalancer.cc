@@ -33,7 +33,7 @@ using std::vector;
 
 #include "config.h"
 
-#define  dout(l)    if (l<=g_conf.debug_mds || l<=g_conf.debug_mds_balancer) *_dout << dbeginl << g_clock.now() << " mds" << mds->get_nodeid() << ".bal "
+#define  dout(l)    dout_if(l, l<=g_conf.debug_mds || l<=g_conf.debug_mds_balancer) << g_clock.now() << " mds" << mds->get_nodeid() << ".bal "
 
 #define MIN_LOAD    50   //  ??
 #define MIN_REEXPORT 5  // will automatically reexport
@@ -73,6 +73,8 @@ void MDBalancer::tick()
   if ((double)now - (double)last_sample > g_conf.mds_bal_sample_interval) {
     dout(15) << "tick last_sample now " << now << dendl;
     last_sample = now;
+    if (g_conf.mds_bal_predict)
+      sample_pop_history(now);
   }
 
   // balance?
@@ -151,6 +153,9 @@ mds_load_t MDBalancer::get_load()
     dout(20) << "get_load no root, no load" << dendl;
   }
 
+  if (g_conf.mds_bal_predict)
+    load.auth_forecast = get_forecast_load();
+
   load.req_rate = mds->get_req_rate();
   load.queue_len = mds->messenger->get_dispatch_queue_len();
 
@@ -356,6 +361,15 @@ void MDBalancer::do_rebalance(int beat)
   multimap<double,int> load_map;
   for (int i=0; i<cluster_size; i++) {
     double l = mds_load[i].mds_load() * load_fac;
+    if (g_conf.mds_bal_predict) {
+      // the sum of that node's subtree forecasts, in the same units
+      // get_pop() gives find_exports, so what we export adds up to what
+      // we're balancing.  (don't smooth the node total again: exports
+      // and imports move it in steps no history can predict.)
+      dout(7) << "  mds" << i << " load " << l << " forecast " 
+	      << mds_load[i].auth_forecast << dendl;
+      l = mds_load[i].auth_forecast;
+    }
     mds_meta_load[i] = l;
 
     if (whoami == 0)
@@ -562,19 +576,22 @@ void MDBalancer::do_rebalance(int beat)
         
         if (dir->inode->is_root()) continue;
         if (dir->is_freezing() || dir->is_frozen()) continue;  // export pbly already in progress
-        double pop = dir->pop_auth_subtree.meta_load(now);
+        double pop = get_pop(dir, now);
         assert(dir->inode->authority().first == target);  // cuz that's how i put it in the map, dummy
         
-        if (pop <= amount-have) {
+        if (pop > amount-have) {
+          dout(5) << "can't reexport " << *dir << ", too big " << pop << dendl;
+        } else if (!worth_exporting(dir, pop)) {
+          dout(5) << "won't reexport " << *dir << ", pop " << pop 
+		  << " doesn't pay for the move" << dendl;
+        } else {
           dout(-5) << "reexporting " << *dir 
                    << " pop " << pop 
                    << " back to mds" << target << dendl;
           mds->mdcache->migrator->export_dir_nicely(dir, target);
           have += pop;
           import_from_map.erase(plast);
-          import_pop_map.erase(pop);
-        } else {
-          dout(5) << "can't reexport " << *dir << ", too big " << pop << dendl;
+          import_pop_map.erase(dir->pop_auth_subtree.meta_load(now));
         }
         if (amount-have < MIN_OFFLOAD) break;
       }
@@ -663,7 +680,7 @@ void MDBalancer::find_exports(CDir *dir,
   list<CDir*> bigger_rep, bigger_unrep;
   multimap<double, CDir*> smaller;
 
-  double dir_pop = dir->pop_auth_subtree.meta_load(now);
+  double dir_pop = get_pop(dir, now);
   dout(7) << " find_exports in " << dir_pop << " " << *dir << " need " << need << " (" << needmin << " - " << needmax << ")" << dendl;
 
   double subdir_sum = 0;
@@ -686,11 +703,18 @@ void MDBalancer::find_exports(CDir *dir,
       if (subdir->is_frozen()) continue;  // can't export this right now!
       
       // how popular?
-      double pop = subdir->pop_auth_subtree.meta_load(now);
+      double pop = get_pop(subdir, now);
       subdir_sum += pop;
       dout(15) << "   subdir pop " << pop << " " << *subdir << dendl;
 
       if (pop < minchunk) continue;
+
+      // not worth the move?  (still worth descending into, though.)
+      if (!worth_exporting(subdir, pop)) {
+	if (pop > need && !subdir->is_rep())
+	  bigger_unrep.push_back(subdir);
+	continue;
+      }
       
       // lucky find?
       if (pop > needmin && pop < needmax) {
@@ -949,6 +973,157 @@ void MDBalancer::add_import(CDir *dir)
 
 
 
+/*
+ * predictive mode
+ *
+ * every sample interval, record rd/wr/meta load for each auth subtree
+ * root and the dirfrags below it (to mds_bal_predict_depth), and feed
+ * them to a LoadForecast.  do_rebalance and find_exports then work from
+ * the forecast instead of the instantaneous DecayCounter value, and
+ * skip anything whose forecast load over the horizon doesn't pay for
+ * the export itself.
+ */
+void MDBalancer::sample_pop_history(utime_t now)
+{
+  if (!mds->mdcache->get_root()) 
+    return;
+
+  num_samples++;
+  set<CDir*> subs;
+  mds->mdcache->get_fullauth_subtrees(subs);
+  for (set<CDir*>::iterator p = subs.begin(); p != subs.end(); ++p) {
+    if ((*p)->get_inode()->is_stray()) continue;
+    sample_dir(*p, now, g_conf.mds_bal_predict_depth);
+  }
+
+  // forget anything we didn't see this round (exported, trimmed, idle)
+  ofstream trace;
+  if (g_conf.mds_bal_predict_trace) {
+    char fn[40];
+    sprintf(fn, "baltrace.mds%d", mds->get_nodeid());
+    trace.open(fn, ios::app);
+  }
+  hash_map<dirfrag_t, pop_history_t>::iterator p = pop_history.begin();
+  while (p != pop_history.end()) {
+    if (p->second.last_sample != now) {
+      pop_history.erase(p++);
+      continue;
+    }
+    if (trace.is_open()) {
+      CDir *dir = mds->mdcache->get_dirfrag(p->first);
+      trace << num_samples << "\t" << p->first
+	    << "\t" << p->second.meta.get_last()
+	    << "\t" << p->second.rd.get_last()
+	    << "\t" << p->second.wr.get_last()
+	    << "\t" << (dir ? export_cost(dir) : 0)
+	    << std::endl;
+    }
+    ++p;
+  }
+  dout(15) << "sample_pop_history " << num_samples << ": " << pop_history.size() << " dirfrags" << dendl;
+}
+
+void MDBalancer::sample_dir(CDir *dir, utime_t now, int depth)
+{
+  double meta = dir->pop_auth_subtree.meta_load(now);
+  if (meta <= 0 && !pop_history.count(dir->dirfrag()))
+    return;  // cold and never seen; don't bother
+
+  pop_history_t& h = pop_history[dir->dirfrag()];
+  h.rd.sample(dir->pop_auth_subtree.get(META_POP_IRD).get(now) +
+	      dir->pop_auth_subtree.get(META_POP_READDIR).get(now));
+  h.wr.sample(dir->pop_auth_subtree.get(META_POP_IWR).get(now));
+  h.meta.sample(meta);
+  h.last_sample = now;
+
+  if (depth <= 0) 
+    return;
+  for (CDir::map_t::iterator it = dir->begin(); it != dir->end(); it++) {
+    CInode *in = it->second->get_inode();
+    if (!in || !in->is_dir()) continue;
+    list<CDir*> dfls;
+    in->get_dirfrags(dfls);
+    for (list<CDir*>::iterator p = dfls.begin(); p != dfls.end(); ++p)
+      if ((*p)->is_auth() && !(*p)->is_subtree_root())
+	sample_dir(*p, now, depth-1);
+  }
+}
+
+/*
+ * the load we expect this dirfrag to carry over the next
+ * mds_bal_predict_horizon bal intervals.
+ */
+double MDBalancer::get_pop(CDir *dir, utime_t now)
+{
+  if (g_conf.mds_bal_predict) {
+    hash_map<dirfrag_t, pop_history_t>::iterator p = pop_history.find(dir->dirfrag());
+    if (p != pop_history.end()) {
+      double steps = g_conf.mds_bal_predict_horizon * 
+	(double)g_conf.mds_bal_interval / g_conf.mds_bal_sample_interval;
+      return p->second.meta.predict(steps);
+    }
+  }
+  return dir->pop_auth_subtree.meta_load(now);
+}
+
+/*
+ * our forecast auth load: the sum over our auth subtrees.
+ */
+double MDBalancer::get_forecast_load()
+{
+  utime_t now = g_clock.now();
+  double l = 0;
+  set<CDir*> subs;
+  mds->mdcache->get_fullauth_subtrees(subs);
+  for (set<CDir*>::iterator p = subs.begin(); p != subs.end(); ++p) {
+    if ((*p)->get_inode()->is_stray()) continue;
+    l += get_pop(*p, now);
+  }
+  return l;
+}
+
+/*
+ * what it costs to move this dirfrag: the Migrator encodes every cached
+ * dentry+inode in the subtree, down to nested bounds.  (capped, we only
+ * need to know if it's big.)
+ */
+double MDBalancer::export_cost(CDir *dir)
+{
+  unsigned n = 0;
+  list<CDir*> q;
+  q.push_back(dir);
+  while (!q.empty() && n < 100000) {
+    CDir *d = q.front();
+    q.pop_front();
+    n += d->get_size();
+    for (CDir::map_t::iterator it = d->begin(); it != d->end(); it++) {
+      CInode *in = it->second->get_inode();
+      if (!in || !in->is_dir()) continue;
+      list<CDir*> dfls;
+      in->get_dirfrags(dfls);
+      for (list<CDir*>::iterator p = dfls.begin(); p != dfls.end(); ++p)
+	if (!(*p)->is_subtree_root())
+	  q.push_back(*p);
+    }
+  }
+  return (double)n * g_conf.mds_bal_predict_item_cost;
+}
+
+bool MDBalancer::worth_exporting(CDir *dir, double pop)
+{
+  if (!g_conf.mds_bal_predict) 
+    return true;
+  double benefit = pop * g_conf.mds_bal_predict_horizon;
+  double cost = export_cost(dir);
+  if (benefit > cost) 
+    return true;
+  dout(10) << "  not worth exporting " << *dir << ": benefit " << benefit 
+	   << " <= cost " << cost << dendl;
+  return false;
+}
+
+
+
 void MDBalancer::show_imports(bool external)
 {
   mds->mdcache->show_subtrees();
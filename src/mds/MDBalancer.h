@@ -27,6 +27,7 @@ using namespace __gnu_cxx;
 
 #include "include/types.h"
 #include "common/Clock.h"
+#include "common/LoadForecast.h"
 #include "CInode.h"
 
 
@@ -73,11 +74,32 @@ class MDBalancer {
     return mds_meta_load[ex] - target_load - exported[ex];    
   }
 
+  // -- predictive mode (mds_bal_predict) --
+  // per-dirfrag load history, sampled every mds_bal_sample_interval
+  struct pop_history_t {
+    LoadForecast rd, wr, meta;
+    utime_t last_sample;
+    pop_history_t() :
+      rd(g_conf.mds_bal_predict_alpha, g_conf.mds_bal_predict_beta),
+      wr(g_conf.mds_bal_predict_alpha, g_conf.mds_bal_predict_beta),
+      meta(g_conf.mds_bal_predict_alpha, g_conf.mds_bal_predict_beta) {}
+  };
+  hash_map<dirfrag_t, pop_history_t> pop_history;
+  int num_samples;
+
+  void sample_pop_history(utime_t now);
+  void sample_dir(CDir *dir, utime_t now, int depth);
+  double get_pop(CDir *dir, utime_t now);
+  double get_forecast_load();
+  double export_cost(CDir *dir);
+  bool worth_exporting(CDir *dir, double pop);
+
  public:
   MDBalancer(MDS *m) : 
     mds(m),
     beat_epoch(0),
-    last_epoch_under(0), last_epoch_over(0) { }
+    last_epoch_under(0), last_epoch_over(0),
+    num_samples(0) { }
   
   mds_load_t get_load();
 
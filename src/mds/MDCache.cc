@@ -84,7 +84,7 @@ using namespace std;
 
 #include "config.h"
 
-#define  dout(l)    if (l<=g_conf.debug || l <= g_conf.debug_mds) *_dout << dbeginl << g_clock.now() << " mds" << mds->get_nodeid() << ".cache "
+#define  dout(l)    dout_if(l, l<=g_conf.debug || l <= g_conf.debug_mds) << g_clock.now() << " mds" << mds->get_nodeid() << ".cache "
 
 
 
@@ -4412,9 +4412,9 @@ void MDCache::request_finish(MDRequest *mdr)
     mdr->more()->slave_commit = 0;
   }
 
-  if (mdr->client_request && mds->logger) {
-    mds->logger->inc("reply");
-    mds->logger->favg("replyl", g_clock.now() - mdr->client_request->get_recv_stamp());
+  if (mdr->client_request) {
+    mds->perf->inc(l_mds_reply);
+    mds->perf->tinc(l_mds_reply_lat, g_clock.now() - mdr->client_request->get_recv_stamp());
   }
 
   delete mdr->client_request;
@@ -4430,7 +4430,7 @@ void MDCache::request_forward(MDRequest *mdr, int who, int port)
   mds->forward_message_mds(mdr->client_request, who);  
   request_cleanup(mdr);
 
-  if (mds->logger) mds->logger->inc("fw");
+  mds->perf->inc(l_mds_fw);
 }
 
 
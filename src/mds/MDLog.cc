@@ -21,23 +21,33 @@
 
 #include "common/LogType.h"
 #include "common/Logger.h"
+#include "common/PerfCounters.h"
 
 #include "events/ESubtreeMap.h"
 
 #include "config.h"
 
-#define  dout(l)    if (l<=g_conf.debug_mds || l <= g_conf.debug_mds_log) *_dout << dbeginl << g_clock.now() << " mds" << mds->get_nodeid() << ".log "
-#define  derr(l)    if (l<=g_conf.debug_mds || l <= g_conf.debug_mds_log) *_derr << dbeginl << g_clock.now() << " mds" << mds->get_nodeid() << ".log "
+#define  dout(l)    dout_if(l, l<=g_conf.debug_mds || l <= g_conf.debug_mds_log) << g_clock.now() << " mds" << mds->get_nodeid() << ".log "
+#define  derr(l)    derr_if(l, l<=g_conf.debug_mds || l <= g_conf.debug_mds_log) << g_clock.now() << " mds" << mds->get_nodeid() << ".log "
 
 // cons/des
 
 LogType mdlog_logtype;
+PerfCountersType mdlog_perftype(l_mdl_first, l_mdl_last);
 
 
 MDLog::~MDLog()
 {
   if (journaler) { delete journaler; journaler = 0; }
   if (logger) { delete logger; logger = 0; }
+  delete perf;
+}
+
+void MDLog::init_perf()
+{
+  if (mdlog_perftype.empty())
+    mdlog_perftype.add_lat(l_mdl_jlat, "jlat");
+  perf = new PerfCounters("mdlog", &mdlog_perftype);
 }
 
 
@@ -46,8 +56,11 @@ void MDLog::reopen_logger(utime_t start, bool append)
   // logger
   char name[80];
   sprintf(name, "mds%d.log", mds->get_nodeid());
+  if (logger)
+    delete logger;
   logger = new Logger(name, &mdlog_logtype, append);
   logger->set_start(start);
+  logger->add_perf(perf);
 
   static bool didit = false;
   if (!didit) {
@@ -68,8 +81,6 @@ void MDLog::reopen_logger(utime_t start, bool append)
 
     mdlog_logtype.add_set("expos");
     mdlog_logtype.add_set("wrpos");
-
-    mdlog_logtype.add_avg("jlat");
   }
 
 }
@@ -86,7 +97,7 @@ void MDLog::init_journaler()
   
   // log streamer
   if (journaler) delete journaler;
-  journaler = new Journaler(log_inode, mds->objecter, logger, &mds->mds_lock);
+  journaler = new Journaler(log_inode, mds->objecter, perf, l_mdl_jlat, &mds->mds_lock);
 }
 
 void MDLog::write_head(Context *c) 
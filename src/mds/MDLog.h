@@ -36,10 +36,17 @@ class LogSegment;
 class ESubtreeMap;
 
 class Logger;
+class PerfCounters;
 
 #include <map>
 using std::map;
 
+enum {
+  l_mdl_first = 42000,
+  l_mdl_jlat,
+  l_mdl_last
+};
+
 
 class MDLog {
  protected:
@@ -56,6 +63,8 @@ class MDLog {
   Journaler *journaler;
 
   Logger *logger;
+  PerfCounters *perf;
+  void init_perf();
 
 
   // -- replay --
@@ -132,10 +141,11 @@ public:
 		  unflushed(0),
 		  capped(false),
 		  journaler(0),
-		  logger(0),
+		  logger(0), perf(0),
 		  replay_thread(this),
 		  expiring_events(0), expired_events(0),
 		  writing_subtree_map(false) {
+    init_perf();
   }		  
   ~MDLog();
 
@@ -59,16 +59,19 @@
 
 #include "config.h"
 
-#define  dout(l)    if (l<=g_conf.debug || l <= g_conf.debug_mds) *_dout << dbeginl << g_clock.now() << " mds" << whoami << " "
-#define  derr(l)    if (l<=g_conf.debug || l <= g_conf.debug_mds) *_derr << dbeginl << g_clock.now() << " mds" << whoami << " "
+#define  dout(l)    dout_if(l, l<=g_conf.debug || l <= g_conf.debug_mds) << g_clock.now() << " mds" << whoami << " "
+#define  derr(l)    derr_if(l, l<=g_conf.debug || l <= g_conf.debug_mds) << g_clock.now() << " mds" << whoami << " "
 
 
 
 
 
 // cons/des
+PerfCountersType mds_perftype(l_mds_first, l_mds_last);
+
 MDS::MDS(int whoami, Messenger *m, MonMap *mm) : 
   timer(mds_lock), 
+  dispatching(false),
   sessionmap(this) {
 
   this->whoami = whoami;
@@ -113,6 +116,13 @@ MDS::MDS(int whoami, Messenger *m, MonMap *mm) :
 
   logger = logger2 = 0;
 
+  if (mds_perftype.empty()) {
+    mds_perftype.add_u64(l_mds_reply, "reply");
+    mds_perftype.add_lat(l_mds_reply_lat, "reply_lat");
+    mds_perftype.add_u64(l_mds_fw, "fw");
+  }
+  perf = new PerfCounters("mds", &mds_perftype);
+
   // i'm ready!
   messenger->set_dispatcher(this);
 }
@@ -120,6 +130,10 @@ MDS::MDS(int whoami, Messenger *m, MonMap *mm) :
 MDS::~MDS() {
   Mutex::Locker lock(mds_lock);
 
+  // the loggers write out the perf counters (ours and the objecter's)
+  if (logger) { delete logger; logger = 0; }
+  if (logger2) { delete logger2; logger2 = 0; }
+
   if (mdcache) { delete mdcache; mdcache = NULL; }
   if (mdlog) { delete mdlog; mdlog = NULL; }
   if (balancer) { delete balancer; balancer = NULL; }
@@ -136,9 +150,7 @@ MDS::~MDS() {
   if (objecter) { delete objecter; objecter = 0; }
   if (messenger) { delete messenger; messenger = NULL; }
 
-  if (logger) { delete logger; logger = 0; }
-  if (logger2) { delete logger2; logger2 = 0; }
-
+  delete perf;
 }
 
 
@@ -150,9 +162,6 @@ void MDS::reopen_logger(utime_t start)
     didit = true;
     
     //mds_logtype.add_inc("req");
-    mds_logtype.add_inc("reply");
-    mds_logtype.add_inc("fw");
-    
     mds_logtype.add_inc("dir_f");
     mds_logtype.add_inc("dir_c");
     //mds_logtype.add_inc("mkdir");
@@ -205,8 +214,6 @@ void MDS::reopen_logger(utime_t start)
     mds_logtype.add_set("nim");
     */
 
-    mds_logtype.add_avg("replyl");
-
   }
  
   if (whoami < 0) return;
@@ -223,6 +230,8 @@ void MDS::reopen_logger(utime_t start)
 
   logger = new Logger(name, (LogType*)&mds_logtype, append);
   logger->set_start(start);
+  logger->add_perf(perf);
+  logger->add_perf(objecter->perf);
 
   char n[80];
   sprintf(n, "mds%d.cache", whoami);
@@ -277,6 +286,7 @@ void MDS::forward_message_mds(Message *req, int mds)
 
 void MDS::send_message_client(Message *m, int client)
 {
+  locker->flush_cap_batch(client);
   version_t seq = sessionmap.inc_push_seq(client);
   dout(10) << "send_message_client client" << client << " seq " << seq << " " << *m << dendl;
   messenger->send_message(m, sessionmap.get_session(entity_name_t::CLIENT(client))->inst);
@@ -284,6 +294,7 @@ void MDS::send_message_client(Message *m, int client)
 
 void MDS::send_message_client(Message *m, entity_inst_t clientinst)
 {
+  locker->flush_cap_batch(clientinst.name.num());
   version_t seq = sessionmap.inc_push_seq(clientinst.name.num());
   dout(10) << "send_message_client " << clientinst.name << " seq " << seq << " " << *m << dendl;
   messenger->send_message(m, clientinst);
@@ -351,6 +362,8 @@ void MDS::tick()
   if (is_active()) {
     balancer->tick();
   }
+
+  locker->flush_cap_batches();
 }
 
 
@@ -1032,7 +1045,9 @@ void MDS::suicide()
 void MDS::dispatch(Message *m)
 {
   mds_lock.Lock();
+  dispatching = true;
   _dispatch(m);
+  dispatching = false;
   mds_lock.Unlock();
 }
 
@@ -1132,6 +1147,8 @@ void MDS::_dispatch(Message *m)
     finish_contexts(ls);
   }
 
+  // send any cap grants batched up above
+  locker->flush_cap_batches();
 
   // HACK FOR NOW
   if (is_active() || is_stopping()) {
@@ -34,6 +34,7 @@ using namespace __gnu_cxx;
 #include "include/Context.h"
 #include "common/DecayCounter.h"
 #include "common/Logger.h"
+#include "common/PerfCounters.h"
 #include "common/Mutex.h"
 #include "common/Cond.h"
 #include "common/Timer.h"
@@ -76,6 +77,14 @@ class MHashReaddirReply;
 class MMDSBeacon;
 
 
+enum {
+  l_mds_first = 40000,
+  l_mds_reply,
+  l_mds_reply_lat,     // client request, received to reply
+  l_mds_fw,
+  l_mds_last
+};
+
 class MDS : public Dispatcher {
  public:
   Mutex        mds_lock;
@@ -106,6 +115,7 @@ class MDS : public Dispatcher {
   AnchorClient *anchorclient;
 
   Logger       *logger, *logger2;
+  PerfCounters *perf;
 
 
  protected:
@@ -150,6 +160,7 @@ class MDS : public Dispatcher {
 
   // -- waiters --
   list<Context*> finished_queue;
+  bool dispatching;   // in dispatch(); batched cap grants go out at its end
 
   void queue_waiter(Context *c) {
     finished_queue.push_back(c);
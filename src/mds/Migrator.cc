@@ -58,7 +58,7 @@
 
 #include "config.h"
 
-#define  dout(l)    if (l<=g_conf.debug || l <= g_conf.debug_mds || l <= g_conf.debug_mds_migrator) *_dout << dbeginl << g_clock.now() << " mds" << mds->get_nodeid() << ".migrator "
+#define  dout(l)    dout_if(l, l<=g_conf.debug || l <= g_conf.debug_mds || l <= g_conf.debug_mds_migrator) << g_clock.now() << " mds" << mds->get_nodeid() << ".migrator "
 
 
 
@@ -56,22 +56,28 @@ using namespace std;
 
 #include "config.h"
 
-#define  dout(l)    if (l<=g_conf.debug || l <= g_conf.debug_mds) *_dout << dbeginl << g_clock.now() << " mds" << mds->get_nodeid() << ".server "
-#define  derr(l)    if (l<=g_conf.debug || l <= g_conf.debug_mds) *_derr << dbeginl << g_clock.now() << " mds" << mds->get_nodeid() << ".server "
+#define  dout(l)    dout_if(l, l<=g_conf.debug || l <= g_conf.debug_mds) << g_clock.now() << " mds" << mds->get_nodeid() << ".server "
+#define  derr(l)    derr_if(l, l<=g_conf.debug || l <= g_conf.debug_mds) << g_clock.now() << " mds" << mds->get_nodeid() << ".server "
 
 
+static PerfCountersType mdserver_perftype(l_mdss_first, l_mdss_last);
+
+void Server::init_perf()
+{
+  if (mdserver_perftype.empty()) {
+    mdserver_perftype.add_u64(l_mdss_hcreq, "hcreq");
+    mdserver_perftype.add_u64(l_mdss_hsreq, "hsreq");
+    mdserver_perftype.add_u64(l_mdss_hcsess, "hcsess");
+    mdserver_perftype.add_u64(l_mdss_dcreq, "dcreq");
+    mdserver_perftype.add_u64(l_mdss_dsreq, "dsreq");
+    mdserver_perftype.add_u64(l_mdss_fastread, "fastread");
+  }
+  perf = new PerfCounters("server", &mdserver_perftype);
+}
+
 void Server::reopen_logger(utime_t start, bool append)
 {
-  static LogType mdserver_logtype;
-  static bool didit = false;
-  if (!didit) {
-    didit = true;
-    mdserver_logtype.add_inc("hcreq"); // handle client req
-    mdserver_logtype.add_inc("hsreq"); // slave
-    mdserver_logtype.add_inc("hcsess");    // client session
-    mdserver_logtype.add_inc("dcreq"); // dispatch client req
-    mdserver_logtype.add_inc("dsreq"); // slave
-  }
+  static LogType mdserver_logtype;  // everything is in perf
 
   if (logger) 
     delete logger;
@@ -81,6 +87,7 @@ void Server::reopen_logger(utime_t start, bool append)
   sprintf(name, "mds%d.server", mds->get_nodeid());
   logger = new Logger(name, &mdserver_logtype, append);
   logger->set_start(start);
+  logger->add_perf(perf);
 }
 
 
@@ -555,6 +562,150 @@ void Server::reply_request(MDRequest *mdr, MClientReply *reply, CInode *tracei)
 
 
 
+/***
+ * cached read-only requests
+ */
+
+bool Server::is_fastread(MClientRequest *req)
+{
+  if (!g_conf.mds_fastread ||
+      req->get_retry_attempt())
+    return false;
+  switch (req->get_op()) {
+  case CEPH_MDS_OP_STAT:
+  case CEPH_MDS_OP_LSTAT:
+  case CEPH_MDS_OP_FSTAT:
+  case CEPH_MDS_OP_READDIR:
+    return true;
+  }
+  return false;
+}
+
+/*
+ * like rdlock_path_pin_ref, but read-only: give up (return 0) on
+ * anything that would need a discover, a fetch, a remote link, a symlink,
+ * or a lock that isn't readable right now.
+ */
+CInode *Server::fastread_traverse(MClientRequest *req)
+{
+  const filepath& path = req->get_filepath();
+  CInode *cur = mdcache->get_inode(path.get_ino());
+  if (!cur) 
+    return 0;
+
+  for (unsigned depth = 0; depth < path.depth(); depth++) {
+    if (!cur->is_dir()) 
+      return 0;
+    const string& dname = path[depth];
+    CDir *dir = cur->get_dirfrag(cur->pick_dirfrag(dname));
+    if (!dir) 
+      return 0;
+    CDentry *dn = dir->lookup(dname);
+    if (!dn ||
+	!dn->is_primary() ||
+	!dn->lock.can_rdlock(0))
+      return 0;
+    cur = dn->get_inode();
+    if (cur->is_symlink() &&
+	(depth+1 < path.depth() || req->follow_trailing_symlink()))
+      return 0;
+  }
+  return cur;
+}
+
+/*
+ * answer a stat/readdir from cache, inline under mds_lock, if we can.
+ * returns false (having changed nothing) if the normal path must take it.
+ */
+bool Server::fastread(MClientRequest *req)
+{
+  CInode *ref = fastread_traverse(req);
+  if (!ref) 
+    return false;
+
+  MClientReply *reply;
+  CDir *dir = 0;     // readdir only
+  __u32 numfiles = 0;
+
+  switch (req->get_op()) {
+  case CEPH_MDS_OP_STAT:
+  case CEPH_MDS_OP_LSTAT:
+  case CEPH_MDS_OP_FSTAT:
+    {
+      int mask = req->head.args.stat.mask;
+      if ((mask & STAT_MASK_LINK) && !ref->linklock.can_rdlock(0)) return false;
+      if ((mask & STAT_MASK_AUTH) && !ref->authlock.can_rdlock(0)) return false;
+      if (ref->is_file() && (mask & STAT_MASK_FILE) && !ref->filelock.can_rdlock(0)) return false;
+      if (ref->is_dir() && (mask & STAT_MASK_MTIME) && !ref->dirlock.can_rdlock(0)) return false;
+
+      reply = new MClientReply(req);
+    }
+    break;
+
+  case CEPH_MDS_OP_READDIR:
+    {
+      if (!ref->is_dir()) 
+	return false;
+      frag_t fg = req->head.args.readdir.frag;
+      if (ref->dirfragtree[fg] != fg) 
+	return false;
+      dir = ref->get_dirfrag(fg);
+      if (!dir ||
+	  !dir->is_auth() ||
+	  !dir->is_complete() ||
+	  dir->is_frozen())
+	return false;
+
+      // same encoding as handle_client_readdir
+      bufferlist dirbl, dnbl;
+      DirStat::_encode(dirbl, dir, mds->get_nodeid());
+      for (CDir::map_t::iterator it = dir->begin(); it != dir->end(); it++) {
+	CDentry *dn = it->second;
+	if (dn->is_null()) continue;
+	CInode *in = dn->inode;
+	if (!in) 
+	  return false;   // unlinked remote; needs open_remote_ino
+	::_encode(it->first, dnbl);
+	InodeStat::_encode(dnbl, in);
+	numfiles++;
+      }
+      ::_encode_simple(numfiles, dirbl);
+      dirbl.claim_append(dnbl);
+
+      reply = new MClientReply(req);
+      reply->take_dir_items(dirbl);
+    }
+    break;
+
+  default:
+    return false;
+  }
+
+  reply->set_trace_dist(ref, mds->get_nodeid());
+  dout(7) << "fastread reply to " << *req << dendl;
+
+  perf->inc(l_mdss_fastread);
+  mds->perf->inc(l_mds_reply);
+  mds->perf->tinc(l_mds_reply_lat, g_clock.now() - req->get_recv_stamp());
+
+  utime_t now = g_clock.now();
+  if (dir) {
+    for (CDir::map_t::iterator it = dir->begin(); it != dir->end(); it++) 
+      if (!it->second->is_null())
+	mdcache->lru.lru_touch(it->second);
+    mds->balancer->hit_dir(now, dir, META_POP_IRD, -1, numfiles);
+  } else
+    mds->balancer->hit_inode(now, ref, META_POP_IRD,
+			     req->get_client_inst().name.num());
+
+  reply->set_mdsmap_epoch(mds->mdsmap->get_epoch());
+  messenger->send_message(reply, req->get_client_inst());
+  delete req;
+  return true;
+}
+
+
+
 /***
  * process a client request
  */
@@ -562,7 +713,7 @@ void Server::handle_client_request(MClientRequest *req)
 {
   dout(4) << "handle_client_request " << *req << dendl;
 
-  if (logger) logger->inc("hcreq");
+  perf->inc(l_mdss_hcreq);
 
   if (!mds->is_active() &&
       !(mds->is_stopping() && req->get_client_inst().name.is_mds())) {
@@ -613,6 +764,10 @@ void Server::handle_client_request(MClientRequest *req)
     session->trim_completed_requests(req->get_oldest_client_tid());
   }
 
+  // stat/readdir we can answer from cache skip the MDRequest
+  if (session && is_fastread(req) && fastread(req))
+    return;
+
   // register + dispatch
   MDRequest *mdr = mdcache->request_start(req);
   if (!mdr) return;
@@ -633,7 +788,7 @@ void Server::dispatch_client_request(MDRequest *mdr)
 {
   MClientRequest *req = mdr->client_request;
 
-  if (logger) logger->inc("dcreq");
+  perf->inc(l_mdss_dcreq);
 
   if (mdr->ref) {
     dout(7) << "dispatch_client_request " << *req << " ref " << *mdr->ref << dendl;
@@ -719,7 +874,7 @@ void Server::handle_slave_request(MMDSSlaveRequest *m)
   dout(4) << "handle_slave_request " << m->get_reqid() << " from " << m->get_source() << dendl;
   int from = m->get_source().num();
 
-  if (logger) logger->inc("hsreq");
+  perf->inc(l_mdss_hsreq);
 
   // reply?
   if (m->is_reply()) {
@@ -808,7 +963,7 @@ void Server::dispatch_slave_request(MDRequest *mdr)
     return;
   }
 
-  if (logger) logger->inc("dsreq");
+  perf->inc(l_mdss_dsreq);
 
   switch (mdr->slave_request->get_op()) {
   case MMDSSlaveRequest::OP_XLOCK:
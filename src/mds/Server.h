@@ -26,22 +26,38 @@ class EUpdate;
 class PVList;
 class MMDSSlaveRequest;
 
+enum {
+  l_mdss_first = 41000,
+  l_mdss_hcreq,        // handle client req
+  l_mdss_hsreq,        // slave
+  l_mdss_hcsess,       // client session
+  l_mdss_dcreq,        // dispatch client req
+  l_mdss_dsreq,        // slave
+  l_mdss_fastread,     // client req answered from cache (mds_fastread)
+  l_mdss_last
+};
+
 class Server {
   MDS *mds;
   MDCache *mdcache;
   MDLog *mdlog;
   Messenger *messenger;
   Logger *logger;
+  PerfCounters *perf;
+
+  void init_perf();
 
 public:
   Server(MDS *m) : 
     mds(m), 
     mdcache(mds->mdcache), mdlog(mds->mdlog),
     messenger(mds->messenger),
-    logger(0) {
+    logger(0), perf(0) {
+    init_perf();
   }
   ~Server() {
     delete logger;
+    delete perf;
   }
 
   void reopen_logger(utime_t start, bool append);
@@ -72,6 +88,19 @@ public:
   void reconnect_gather_finish();
 
   
+  // -- cached read-only requests --
+  /*
+   * mds_fastread: a stat or readdir that can be answered from cache, with
+   * every lock it needs already readable, is answered inline (still under
+   * mds_lock) without an MDRequest, pins or rdlocks.  anything else takes
+   * the normal path.
+   */
+private:
+  bool is_fastread(MClientRequest *req);
+  CInode *fastread_traverse(MClientRequest *req);
+  bool fastread(MClientRequest *req);
+
+public:
   // -- requests --
   void handle_client_request(MClientRequest *m);
 
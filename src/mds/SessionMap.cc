@@ -18,7 +18,7 @@
 
 #include "config.h"
 
-#define dout(x)  if (x <= g_conf.debug_mds) *_dout << dbeginl << g_clock.now() << " mds" << mds->get_nodeid() << ".sessionmap "
+#define dout(x)  dout_if(x, x <= g_conf.debug_mds) << g_clock.now() << " mds" << mds->get_nodeid() << ".sessionmap "
 
 void SessionMap::init_inode()
 {
@@ -42,6 +42,17 @@ void SessionMap::dump()
 // ----------------
 // LOAD
 
+/*
+ * like the AnchorTable, the session map is a base snapshot plus a log of
+ * delta records (__u32 len, base_version, version, payload) appended at
+ * DELTA_OFFSET in the same file.  a record only carries the sessions that
+ * changed, and for those only the push seq and the completed_requests
+ * trim point and additions, so a busy client doesn't cost a rewrite of
+ * every session's completed_requests on each save.  once the log would
+ * pass mds_table_delta_max we write a new base and restart the log.  one
+ * write in flight at a time, so records never land before their base.
+ */
+
 class C_SM_Load : public Context {
   SessionMap *sessionmap;
 public:
@@ -52,6 +63,16 @@ public:
   }
 };
 
+class C_SM_LoadDeltas : public Context {
+  SessionMap *sessionmap;
+public:
+  bufferlist bl;
+  C_SM_LoadDeltas(SessionMap *cm) : sessionmap(cm) {}
+  void finish(int r) {
+    sessionmap->_load_deltas_finish(bl);
+  }
+};
+
 void SessionMap::load(Context *onload)
 {
   dout(10) << "load" << dendl;
@@ -77,6 +98,26 @@ void SessionMap::_load_finish(bufferlist &bl)
 	   << ", " << session_map.size() << " sessions, "
 	   << bl.length() << " bytes"
 	   << dendl;
+  base_version = version;
+
+  C_SM_LoadDeltas *c = new C_SM_LoadDeltas(this);
+  mds->filer->read(inode,
+		   DELTA_OFFSET, g_conf.mds_table_delta_max,
+		   &c->bl,
+		   c);
+}
+
+void SessionMap::_load_deltas_finish(bufferlist &bl)
+{
+  unsigned off = 0;
+  int n = 0;
+  while (decode_delta(bl, off))
+    n++;
+  delta_off = off;
+  clear_deltas();
+  dout(10) << "_load_deltas_finish replayed " << n << " deltas, " << off << " bytes, now v " << version 
+	   << ", " << session_map.size() << " sessions" << dendl;
+
   projected = committing = committed = version;
   finish_contexts(waiting_for_load);
 }
@@ -106,16 +147,34 @@ void SessionMap::save(Context *onsave, version_t needv)
   }
 
   commit_waiters[version].push_back(onsave);
+
+  if (committing > committed) {
+    dout(10) << "save waiting for v " << committing << " to commit" << dendl;
+    return;  // _save_finish will come back for this
+  }
   
   bufferlist bl;
   
   init_inode();
-  encode(bl);
   committing = version;
-  mds->filer->write(inode,
-                    0, bl.length(), bl,
-                    0,
-		    0, new C_SM_Save(this, version));
+  if (base_version && encode_delta(bl)) {
+    dout(10) << "save v " << version << " delta " << bl.length() << " bytes at " << delta_off << dendl;
+    mds->filer->write(inode,
+		      DELTA_OFFSET + delta_off, bl.length(), bl,
+		      0,
+		      0, new C_SM_Save(this, version));
+    delta_off += bl.length();
+  } else {
+    encode(bl);
+    dout(10) << "save v " << version << " base " << bl.length() << " bytes" << dendl;
+    mds->filer->write(inode,
+		      0, bl.length(), bl,
+		      0,
+		      0, new C_SM_Save(this, version));
+    base_version = version;
+    delta_off = 0;
+  }
+  clear_deltas();
 }
 
 void SessionMap::_save_finish(version_t v)
@@ -123,8 +182,22 @@ void SessionMap::_save_finish(version_t v)
   dout(10) << "_save_finish v" << v << dendl;
   committed = v;
 
-  finish_contexts(commit_waiters[v]);
-  commit_waiters.erase(v);
+  list<Context*> ls;
+  while (!commit_waiters.empty() &&
+	 commit_waiters.begin()->first <= v) {
+    ls.splice(ls.end(), commit_waiters.begin()->second);
+    commit_waiters.erase(commit_waiters.begin());
+  }
+  finish_contexts(ls);
+
+  // anyone waiting on a later version?
+  if (!commit_waiters.empty()) {
+    list<Context*> more;
+    more.swap(commit_waiters.begin()->second);
+    commit_waiters.erase(commit_waiters.begin());
+    for (list<Context*>::iterator p = more.begin(); p != more.end(); ++p)
+      save(*p);
+  }
 }
 
 
@@ -155,3 +228,96 @@ void SessionMap::decode(bufferlist::iterator& p)
     s->last_cap_renew = now;
   }
 }
+
+void SessionMap::clear_deltas()
+{
+  for (hash_map<entity_name_t,Session*>::iterator p = session_map.begin(); 
+       p != session_map.end(); 
+       ++p) 
+    p->second->clear_delta();
+  delta_removed.clear();
+}
+
+/*
+ * append a delta record to bl.  false if it doesn't fit in the log.
+ */
+bool SessionMap::encode_delta(bufferlist& bl)
+{
+  bufferlist rec;
+  ::_encode_simple(base_version, rec);
+  ::_encode_simple(version, rec);
+  ::_encode_simple(delta_removed, rec);
+
+  __u32 n = 0;
+  for (hash_map<entity_name_t,Session*>::iterator p = session_map.begin(); 
+       p != session_map.end(); 
+       ++p) 
+    if (p->second->delta_dirty)
+      n++;
+  ::_encode_simple(n, rec);
+  for (hash_map<entity_name_t,Session*>::iterator p = session_map.begin(); 
+       p != session_map.end(); 
+       ++p) 
+    if (p->second->delta_dirty)
+      p->second->_encode_delta(rec);
+
+  __u32 len = rec.length();
+  if (delta_off + sizeof(len) + len > (__u64)g_conf.mds_table_delta_max)
+    return false;
+  ::_encode_simple(len, bl);
+  bl.claim_append(rec);
+  return true;
+}
+
+/*
+ * apply the record at off, if it follows what we have.
+ */
+bool SessionMap::decode_delta(bufferlist& bl, unsigned& off)
+{
+  __u32 len;
+  version_t bv, v;
+  if (off + sizeof(len) + sizeof(bv) + sizeof(v) > bl.length())
+    return false;
+  bl.copy(off, sizeof(len), (char*)&len);
+  if (len == 0 || off + sizeof(len) + len > bl.length())
+    return false;   // end of log, or torn
+  bufferlist::iterator p = bl.begin();
+  p.advance(off + sizeof(len));
+  ::_decode_simple(bv, p);
+  ::_decode_simple(v, p);
+  if (bv != base_version || v <= version)
+    return false;   // left over from an older base
+
+  utime_t now = g_clock.now();
+  set<entity_name_t> removed;
+  ::_decode_simple(removed, p);
+  for (set<entity_name_t>::iterator q = removed.begin(); q != removed.end(); ++q) 
+    if (session_map.count(*q)) {
+      delete session_map[*q];
+      session_map.erase(*q);
+    }
+
+  __u32 n;
+  ::_decode_simple(n, p);
+  while (n--) {
+    entity_name_t name;
+    bool full;
+    ::_decode_simple(name, p);
+    ::_decode_simple(full, p);
+    if (full) {
+      Session *s = new Session;
+      s->_decode(p);
+      s->last_cap_renew = now;
+      if (session_map.count(name))
+	delete session_map[name];
+      session_map[name] = s;
+    } else {
+      assert(session_map.count(name));
+      session_map[name]->_decode_delta(p);
+    }
+  }
+
+  version = v;
+  off += sizeof(len) + len;
+  return true;
+}
@@ -16,7 +16,9 @@
 #define __MDS_SESSIONMAP_H
 
 #include <set>
+#include <vector>
 using std::set;
+using std::vector;
 
 #include <ext/hash_map>
 using __gnu_cxx::hash_map;
@@ -65,7 +67,10 @@ public:
   utime_t last_cap_renew;
 
 public:
-  version_t inc_push_seq() { return ++cap_push_seq; }
+  version_t inc_push_seq() { 
+    delta_dirty = true;
+    return ++cap_push_seq; 
+  }
   version_t get_push_seq() const { return cap_push_seq; }
 
   // -- completed requests --
@@ -76,12 +81,20 @@ private:
 public:
   void add_completed_request(tid_t t) {
     completed_requests.insert(t);
+    delta_added.push_back(t);
+    delta_dirty = true;
   }
   void trim_completed_requests(tid_t mintid) {
     // trim
     while (!completed_requests.empty() && 
-	   (mintid == 0 || *completed_requests.begin() < mintid))
+	   (mintid == 0 || *completed_requests.begin() < mintid)) {
       completed_requests.erase(completed_requests.begin());
+      if (mintid == 0)
+	delta_trim = TRIM_ALL;
+      else if (mintid > delta_trim)
+	delta_trim = mintid;
+      delta_dirty = true;
+    }
 
     // kick waiters
     list<Context*> fls;
@@ -99,11 +112,56 @@ public:
     return completed_requests.count(tid);
   }
 
+  // -- changes since the last SessionMap::save --
+private:
+  bool delta_dirty;
+  bool delta_full;             // new (or re-opened); write the whole thing
+  tid_t delta_trim;            // trimmed everything below this
+  static const tid_t TRIM_ALL = (tid_t)-1;   // ...or everything
+  vector<tid_t> delta_added;   // completed since (some may be trimmed again)
+
+  void clear_delta() {
+    delta_dirty = delta_full = false;
+    delta_trim = 0;
+    delta_added.clear();
+  }
+public:
+  void _encode_delta(bufferlist& bl) const {
+    ::_encode_simple(inst.name, bl);
+    ::_encode_simple(delta_full, bl);
+    if (delta_full) {
+      _encode(bl);
+      return;
+    }
+    ::_encode_simple(cap_push_seq, bl);
+    ::_encode_simple(delta_trim, bl);
+    vector<tid_t> added;
+    for (unsigned i=0; i<delta_added.size(); i++)
+      if (completed_requests.count(delta_added[i]))
+	added.push_back(delta_added[i]);
+    ::_encode_simple(added, bl);
+  }
+  void _decode_delta(bufferlist::iterator& p) {
+    ::_decode_simple(cap_push_seq, p);
+    tid_t trim;
+    ::_decode_simple(trim, p);
+    if (trim == TRIM_ALL)
+      completed_requests.clear();
+    else if (trim)
+      while (!completed_requests.empty() &&
+	     *completed_requests.begin() < trim)
+	completed_requests.erase(completed_requests.begin());
+    vector<tid_t> added;
+    ::_decode_simple(added, p);
+    for (unsigned i=0; i<added.size(); i++)
+      completed_requests.insert(added[i]);
+  }
 
   Session() : 
     state(STATE_UNDEF), 
     session_list_item(this),
-    cap_push_seq(0) { }
+    cap_push_seq(0),
+    delta_dirty(true), delta_full(true), delta_trim(0) { }
 
   void _encode(bufferlist& bl) const {
     ::_encode_simple(inst, bl);
@@ -128,6 +186,7 @@ class SessionMap {
 private:
   MDS *mds;
   hash_map<entity_name_t, Session*> session_map;
+  set<entity_name_t> delta_removed;   // since the last save
 public:
   map<int,xlist<Session*> > by_state;
   
@@ -137,7 +196,8 @@ public:  // i am lazy
 
 public:
   SessionMap(MDS *m) : mds(m), 
-		       version(0), projected(0), committing(0), committed(0) 
+		       version(0), projected(0), committing(0), committed(0),
+		       base_version(0), delta_off(0)
   { }
     
   // sessions
@@ -152,11 +212,13 @@ public:
       return session_map[i.name];
     Session *s = session_map[i.name] = new Session;
     s->inst = i;
+    delta_removed.erase(i.name);
     return s;
   }
   void remove_session(Session *s) {
     s->trim_completed_requests(0);
     session_map.erase(s->inst.name);
+    delta_removed.insert(s->inst.name);
     delete s;
   }
   void touch_session(Session *s) {
@@ -195,6 +257,7 @@ public:
 	 ++p) {
       Session *session = get_or_add_session(p->second);
       session->inst = p->second;
+      session->delta_dirty = session->delta_full = true;
       set_state(session, Session::STATE_OPEN);
     }
     version++;
@@ -227,15 +290,24 @@ public:
   }
 
   // -- loading, saving --
+  // a base snapshot at offset 0 of our inode, plus a log of deltas at
+  // DELTA_OFFSET.  see SessionMap.cc.
+  static const __u64 DELTA_OFFSET = 1ULL << 32;
   inode_t inode;
   list<Context*> waiting_for_load;
+  version_t base_version;
+  __u64 delta_off;
 
   void encode(bufferlist& bl);
   void decode(bufferlist::iterator& blp);
+  bool encode_delta(bufferlist& bl);
+  bool decode_delta(bufferlist& bl, unsigned& off);
+  void clear_deltas();
 
   void init_inode();
   void load(Context *onload);
   void _load_finish(bufferlist &bl);
+  void _load_deltas_finish(bufferlist &bl);
   void save(Context *onsave, version_t needv=0);
   void _save_finish(version_t v);
  
@@ -48,8 +48,8 @@
 
 #include "config.h"
 
-#define  dout(l)    if (l<=g_conf.debug_mds || l <= g_conf.debug_mds_log || l <= g_conf.debug_mds_log_expire) *_dout << dbeginl << g_clock.now() << " mds" << mds->get_nodeid() << ".journal "
-#define  derr(l)    if (l<=g_conf.debug_mds || l <= g_conf.debug_mds_log || l <= g_conf.debug_mds_log_expire) *_dout << dbeginl << g_clock.now() << " mds" << mds->get_nodeid() << ".journal "
+#define  dout(l)    dout_if(l, l<=g_conf.debug_mds || l <= g_conf.debug_mds_log || l <= g_conf.debug_mds_log_expire) << g_clock.now() << " mds" << mds->get_nodeid() << ".journal "
+#define  derr(l)    dout_if(l, l<=g_conf.debug_mds || l <= g_conf.debug_mds_log || l <= g_conf.debug_mds_log_expire) << g_clock.now() << " mds" << mds->get_nodeid() << ".journal "
 
 
 // -----------------------
@@ -201,8 +201,8 @@ C_Gather *LogSegment::try_to_expire(MDS *mds)
 
 #undef dout
 #undef derr
-#define  dout(l)    if (l<=g_conf.debug_mds || l <= g_conf.debug_mds_log) *_dout << dbeginl << g_clock.now() << " mds" << mds->get_nodeid() << ".journal "
-#define  derr(l)    if (l<=g_conf.debug_mds || l <= g_conf.debug_mds_log) *_dout << dbeginl << g_clock.now() << " mds" << mds->get_nodeid() << ".journal "
+#define  dout(l)    dout_if(l, l<=g_conf.debug_mds || l <= g_conf.debug_mds_log) << g_clock.now() << " mds" << mds->get_nodeid() << ".journal "
+#define  derr(l)    dout_if(l, l<=g_conf.debug_mds || l <= g_conf.debug_mds_log) << g_clock.now() << " mds" << mds->get_nodeid() << ".journal "
 
 
 // -----------------------
@@ -248,8 +248,11 @@ class mds_load_t {
 
   double cpu_load_avg;
 
+  double auth_forecast;  // mds_bal_predict: forecast auth meta_load
+
   mds_load_t() : 
-    req_rate(0), cache_hit_rate(0), queue_len(0), cpu_load_avg(0) { 
+    req_rate(0), cache_hit_rate(0), queue_len(0), cpu_load_avg(0),
+    auth_forecast(0) { 
   }
   
   double mds_load();  // defiend in MDBalancer.cc
@@ -59,7 +59,12 @@ class MClientFileCaps : public Message {
   void set_mtime(const utime_t &t) { t.encode_timeval(&h.mtime); }
   void set_atime(const utime_t &t) { t.encode_timeval(&h.atime); }
 
+  ceph_mds_file_caps& get_header() { return h; }
+
   MClientFileCaps() {}
+  MClientFileCaps(const ceph_mds_file_caps& hh) :
+    Message(CEPH_MSG_CLIENT_FILECAPS),
+    h(hh) {}
   MClientFileCaps(int op,
 		  inode_t& inode,
                   long seq,
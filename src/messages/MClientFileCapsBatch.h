@@ -0,0 +1,68 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*- 
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software 
+ * Foundation.  See file COPYING.
+ * 
+ */
+
+#ifndef __MCLIENTFILECAPSBATCH_H
+#define __MCLIENTFILECAPSBATCH_H
+
+#include "msg/Message.h"
+#include "MClientFileCaps.h"
+
+/*
+ * many cap updates (grants from the mds, acks from the client) in one
+ * message.  each entry means exactly what the equivalent MClientFileCaps
+ * would; the batch as a whole counts as a single push for the session's
+ * cap_push_seq.
+ */
+class MClientFileCapsBatch : public Message {
+  vector<ceph_mds_file_caps> caps;
+
+ public:
+  MClientFileCapsBatch() :
+    Message(CEPH_MSG_CLIENT_FILECAPS_BATCH) {}
+
+  unsigned size() { return caps.size(); }
+  bool empty() { return caps.empty(); }
+
+  void add(MClientFileCaps *m) {
+    caps.push_back(m->get_header());
+  }
+
+  /*
+   * unpack into individual MClientFileCaps, in order, each with our
+   * envelope (so get_source() etc. work as if they came separately).
+   */
+  void split(list<MClientFileCaps*>& ls) {
+    for (unsigned i=0; i<caps.size(); i++) {
+      MClientFileCaps *m = new MClientFileCaps(caps[i]);
+      m->set_source_inst(get_source_inst());
+      m->set_dest_inst(get_dest_inst());
+      ls.push_back(m);
+    }
+  }
+
+  const char *get_type_name() { return "Cfcapb";}
+  void print(ostream& out) {
+    out << "client_file_caps_batch(" << caps.size() << ")";
+  }
+  
+  void decode_payload() {
+    bufferlist::iterator p = payload.begin();
+    ::_decode_simple(caps, p);
+  }
+  void encode_payload() {
+    ::_encode_simple(caps, payload);
+  }
+};
+
+#endif
@@ -25,6 +25,11 @@ class MOSDMap : public Message {
   map<epoch_t, bufferlist> maps;
   map<epoch_t, bufferlist> incremental_maps;
 
+  // merged incrementals, keyed by base epoch: merged_maps[b] takes a
+  // map at epoch b to merged_span[b].  compressed (see compress.h).
+  map<epoch_t, epoch_t> merged_span;
+  map<epoch_t, bufferlist> merged_maps;
+
   epoch_t get_first() {
     epoch_t e = 0;
     map<epoch_t, bufferlist>::iterator i = maps.begin();
@@ -32,6 +37,9 @@ class MOSDMap : public Message {
     i = incremental_maps.begin();    
     if (i != incremental_maps.end() &&
         (e == 0 || i->first < e)) e = i->first;
+    map<epoch_t, epoch_t>::iterator j = merged_span.begin();
+    if (j != merged_span.end() &&
+	(e == 0 || j->first+1 < e)) e = j->first+1;
     return e;
   }
   epoch_t get_last() {
@@ -41,6 +49,10 @@ class MOSDMap : public Message {
     i = incremental_maps.rbegin();    
     if (i != incremental_maps.rend() &&
         (e == 0 || i->first > e)) e = i->first;
+    for (map<epoch_t, epoch_t>::iterator j = merged_span.begin();
+	 j != merged_span.end();
+	 j++)
+      if (j->second > e) e = j->second;
     return e;
   }
 
@@ -56,10 +68,14 @@ class MOSDMap : public Message {
     int off = 0;
     ::_decode(incremental_maps, payload, off);
     ::_decode(maps, payload, off);
+    ::_decode(merged_span, payload, off);
+    ::_decode(merged_maps, payload, off);
   }
   void encode_payload() {
     ::_encode(incremental_maps, payload);
     ::_encode(maps, payload);
+    ::_encode(merged_span, payload);
+    ::_encode(merged_maps, payload);
   }
 
   const char *get_type_name() { return "omap"; }
@@ -53,6 +53,8 @@ public:
 
     case CEPH_OSD_OP_PULL: return "pull";
     case CEPH_OSD_OP_PUSH: return "push";
+    case CEPH_OSD_OP_SCRUB: return "scrub";
+    case CEPH_OSD_OP_SCRUB_PUSH: return "scrub-push";
     default: assert(0);
     }
     return 0;
@@ -27,6 +27,8 @@
  * oid - object id
  * op  - OSD_OP_DELETE, etc.
  *
+ * a replica may batch: the ops in batch_rep_tids (all later than
+ * rep_tid, same pg) got the same result and are acked/committed too.
  */
 
 class MOSDSubOpReply : public Message {
@@ -51,6 +53,7 @@ class MOSDSubOpReply : public Message {
   } st;
 
   map<string,bufferptr> attrset;
+  vector<tid_t> batch_rep_tids;
 
  public:
   epoch_t get_map_epoch() { return st.map_epoch; }
@@ -74,6 +77,10 @@ class MOSDSubOpReply : public Message {
   void set_attrset(map<string,bufferptr> &as) { attrset = as; }
   map<string,bufferptr>& get_attrset() { return attrset; } 
 
+  void add_rep_tid(tid_t t) { batch_rep_tids.push_back(t); }
+  vector<tid_t>& get_batch_rep_tids() { return batch_rep_tids; }
+  unsigned get_num_ops() { return 1 + batch_rep_tids.size(); }
+
 public:
   MOSDSubOpReply(MOSDSubOp *req, int result, epoch_t e, bool commit) :
     Message(MSG_OSD_SUBOPREPLY) {
@@ -96,10 +103,12 @@ public:
     int off = 0;
     ::_decode(st, payload, off);
     ::_decode(attrset, payload, off);
+    ::_decode(batch_rep_tids, payload, off);
   }
   virtual void encode_payload() {
     ::_encode(st, payload);
     ::_encode(attrset, payload);
+    ::_encode(batch_rep_tids, payload);
     env.data_off = st.offset;
   }
 
@@ -115,6 +124,8 @@ public:
 	out << " commit";
       else
 	out << " ack";
+      if (!batch_rep_tids.empty())
+	out << " +" << batch_rep_tids.size();
     }
     out << " = " << st.result;
     out << ")";
@@ -12,13 +12,13 @@
  * 
  */
 
-#include "MonitorStore.h"
+#include "FileMonitorStore.h"
 #include "common/Clock.h"
 
 #include "config.h"
 
-#define  dout(l) if (l<=g_conf.debug || l<=g_conf.debug_mon) *_dout << dbeginl << g_clock.now() << " store(" << dir <<") "
-#define  derr(l) if (l<=g_conf.debug || l<=g_conf.debug_mon) *_derr << dbeginl << g_clock.now() << " store(" << dir <<") "
+#define  dout(l) dout_if(l, l<=g_conf.debug || l<=g_conf.debug_mon) << g_clock.now() << " store(" << dir <<") "
+#define  derr(l) derr_if(l, l<=g_conf.debug || l<=g_conf.debug_mon) << g_clock.now() << " store(" << dir <<") "
 
 #include <stdio.h>
 #include <sys/types.h>
@@ -27,7 +27,7 @@
 #include <errno.h>
 #include <unistd.h>
 
-void MonitorStore::mount()
+void FileMonitorStore::mount()
 {
   dout(1) << "mount" << dendl;
   // verify dir exists
@@ -50,7 +50,7 @@ void MonitorStore::mount()
 }
 
 
-void MonitorStore::mkfs()
+void FileMonitorStore::mkfs()
 {
   dout(1) << "mkfs" << dendl;
 
@@ -61,7 +61,7 @@ void MonitorStore::mkfs()
 }
 
 
-version_t MonitorStore::get_int(const char *a, const char *b)
+version_t FileMonitorStore::get_int(const char *a, const char *b)
 {
   char fn[200];
   if (b)
@@ -88,7 +88,7 @@ version_t MonitorStore::get_int(const char *a, const char *b)
 }
 
 
-void MonitorStore::put_int(version_t val, const char *a, const char *b)
+void FileMonitorStore::put_int(version_t val, const char *a, const char *b)
 {
   char fn[200];
   sprintf(fn, "%s/%s", dir.c_str(), a);
@@ -121,7 +121,7 @@ void MonitorStore::put_int(version_t val, const char *a, const char *b)
 // ----------------------------------------
 // buffers
 
-bool MonitorStore::exists_bl_ss(const char *a, const char *b)
+bool FileMonitorStore::exists_bl_ss(const char *a, const char *b)
 {
   char fn[200];
   if (b) {
@@ -139,7 +139,7 @@ bool MonitorStore::exists_bl_ss(const char *a, const char *b)
 }
 
 
-int MonitorStore::get_bl_ss(bufferlist& bl, const char *a, const char *b)
+int FileMonitorStore::get_bl_ss(bufferlist& bl, const char *a, const char *b)
 {
   char fn[200];
   if (b) {
@@ -187,7 +187,7 @@ int MonitorStore::get_bl_ss(bufferlist& bl, const char *a, const char *b)
   return len;
 }
 
-int MonitorStore::put_bl_ss(bufferlist& bl, const char *a, const char *b)
+int FileMonitorStore::put_bl_ss(bufferlist& bl, const char *a, const char *b)
 {
   char fn[200];
   sprintf(fn, "%s/%s", dir.c_str(), a);
@@ -221,3 +221,33 @@ int MonitorStore::put_bl_ss(bufferlist& bl, const char *a, const char *b)
 
   return 0;
 }
+
+
+// ----------------------------------------
+// transactions
+
+/*
+ * no atomicity here: the puts are applied in order, each with its own
+ * sync.  callers order their puts so that a crash midway is harmless
+ * (e.g. values before the last_committed that points at them).
+ */
+int FileMonitorStore::apply_transaction(Transaction& t)
+{
+  dout(15) << "apply_transaction " << t.get_num_ops() << " ops" << dendl;
+  for (list<Transaction::Op>::iterator p = t.ops.begin();
+       p != t.ops.end();
+       ++p) {
+    const char *b = p->b.length() ? p->b.c_str() : 0;
+    switch (p->op) {
+    case Transaction::OP_PUT_INT:
+      put_int(p->val, p->a.c_str(), b);
+      break;
+    case Transaction::OP_PUT_BL:
+      put_bl_ss(p->bl, p->a.c_str(), b);
+      break;
+    default:
+      assert(0);
+    }
+  }
+  return 0;
+}
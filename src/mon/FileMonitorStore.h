@@ -0,0 +1,46 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*- 
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software 
+ * Foundation.  See file COPYING.
+ * 
+ */
+
+#ifndef __MON_FILEMONITORSTORE_H
+#define __MON_FILEMONITORSTORE_H
+
+#include "MonitorStore.h"
+
+/*
+ * a file per key: dir/a or dir/a/b.  every buffer put is written to a
+ * temp file, fsynced, and renamed into place.
+ */
+class FileMonitorStore : public MonitorStore {
+  string dir;
+
+public:
+  FileMonitorStore(const char *d) : dir(d) {
+  }
+  ~FileMonitorStore() {
+  }
+
+  void mkfs();  // wipe
+  void mount();
+
+  version_t get_int(const char *a, const char *b=0);
+  void put_int(version_t v, const char *a, const char *b=0);
+
+  bool exists_bl_ss(const char *a, const char *b=0);
+  int get_bl_ss(bufferlist& bl, const char *a, const char *b);
+  int put_bl_ss(bufferlist& bl, const char *a, const char *b);
+
+  int apply_transaction(Transaction& t);
+};
+
+#endif
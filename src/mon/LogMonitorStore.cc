@@ -0,0 +1,473 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "LogMonitorStore.h"
+#include "common/Clock.h"
+
+#include "config.h"
+
+#define  dout(l) dout_if(l, l<=g_conf.debug || l<=g_conf.debug_mon) << g_clock.now() << " logstore(" << dir <<") "
+#define  derr(l) derr_if(l, l<=g_conf.debug || l<=g_conf.debug_mon) << g_clock.now() << " logstore(" << dir <<") "
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+
+// don't let a single record grow without bound when compacting
+#define COMPACT_RECORD_MAX  (4 << 20)
+
+
+LogMonitorStore::~LogMonitorStore()
+{
+  if (fd >= 0)
+    ::close(fd);
+}
+
+void LogMonitorStore::mkfs()
+{
+  dout(1) << "mkfs" << dendl;
+
+  char cmd[200];
+  sprintf(cmd, "test -d %s && /bin/rm -r %s ; mkdir -p %s", dir.c_str(), dir.c_str(), dir.c_str());
+  dout(1) << cmd << dendl;
+  system(cmd);
+}
+
+void LogMonitorStore::mount()
+{
+  dout(1) << "mount" << dendl;
+  // verify dir exists
+  DIR *d = ::opendir(dir.c_str());
+  if (!d) {
+    derr(1) << "basedir " << dir << " dne" << dendl;
+    assert(0);
+  }
+  ::closedir(d);
+
+  if (g_conf.use_abspaths) {
+    // combine it with the cwd, in case fuse screws things up (i.e. fakefuse)
+    string old = dir;
+    char cwd[200];
+    getcwd(cwd, 200);
+    dir = cwd;
+    dir += "/";
+    dir += old;
+  }
+
+  string fn = dir + "/log";
+  fd = ::open(fn.c_str(), O_RDWR|O_CREAT, 0644);
+  if (fd < 0) {
+    derr(0) << "can't open " << fn << ": " << strerror(errno) << dendl;
+    assert(0);
+  }
+  _replay();
+}
+
+
+// ----------------------------------------
+// log
+
+uint32_t LogMonitorStore::checksum(bufferlist& bl)
+{
+  // fnv-1a
+  uint32_t h = 2166136261U;
+  for (list<bufferptr>::const_iterator it = bl.buffers().begin();
+       it != bl.buffers().end();
+       it++) {
+    const unsigned char *p = (const unsigned char*)it->c_str();
+    for (unsigned i=0; i<it->length(); i++)
+      h = (h ^ p[i]) * 16777619U;
+  }
+  return h;
+}
+
+void LogMonitorStore::_replay()
+{
+  struct stat st;
+  int r = ::fstat(fd, &st);
+  assert(r == 0);
+  off_t size = st.st_size;
+
+  off_t off = 0;
+  int nrec = 0;
+  index.clear();
+  live_bytes = 0;
+
+  while (off + (off_t)HEADER_LEN <= size) {
+    uint32_t h[3];
+    if (::pread(fd, h, HEADER_LEN, off) != (int)HEADER_LEN)
+      break;
+    if (h[0] != MAGIC ||
+	off + (off_t)HEADER_LEN + (off_t)h[1] > size) {
+      derr(0) << "bad record header at " << off << dendl;
+      break;
+    }
+
+    bufferptr bp(h[1]);
+    if (::pread(fd, bp.c_str(), h[1], off + HEADER_LEN) != (int)h[1])
+      break;
+    bufferlist bl;
+    bl.push_back(bp);
+    if (checksum(bl) != h[2]) {
+      derr(0) << "bad record checksum at " << off << dendl;
+      break;
+    }
+
+    // parse the whole record before applying any of it
+    const char *p = bp.c_str();
+    const char *end = p + h[1];
+    list<pair<string,entry_t> > ops;
+    bool bad = end - p < 4;
+    uint32_t nops = bad ? 0 : *(uint32_t*)p;
+    if (!bad)
+      p += 4;
+    for (uint32_t i=0; !bad && i<nops; i++) {
+      if (end - p < 4) {
+	bad = true;
+	break;
+      }
+      uint32_t klen = *(uint32_t*)p;
+      p += 4;
+      if ((uint32_t)(end - p) < klen) {
+	bad = true;
+	break;
+      }
+      string key(p, klen);
+      p += klen;
+      if (end - p < 4) {
+	bad = true;
+	break;
+      }
+      uint32_t vlen = *(uint32_t*)p;
+      p += 4;
+      if ((uint32_t)(end - p) < vlen) {
+	bad = true;
+	break;
+      }
+      ops.push_back(pair<string,entry_t>(key, entry_t(off + HEADER_LEN + (p - bp.c_str()), vlen)));
+      p += vlen;
+    }
+    if (bad) {
+      derr(0) << "bad record payload at " << off << dendl;
+      break;
+    }
+
+    // apply
+    for (list<pair<string,entry_t> >::iterator q = ops.begin();
+	 q != ops.end();
+	 ++q) {
+      entry_t& e = index[q->first];
+      live_bytes -= e.len;
+      e = q->second;
+      live_bytes += e.len;
+    }
+
+    off += HEADER_LEN + h[1];
+    nrec++;
+  }
+
+  if (off < size) {
+    derr(0) << "replay: discarding " << (size - off) << " bytes of torn/corrupt log at " << off << dendl;
+    ::ftruncate(fd, off);
+  }
+  log_end = off;
+  dout(10) << "replay " << nrec << " records, " << index.size() << " keys, "
+	   << live_bytes << " live of " << log_end << " bytes" << dendl;
+}
+
+/*
+ * write kv as a single record at end, fsync, and point idx at the new
+ * values.
+ */
+int LogMonitorStore::_write_record(int fd, off_t& end, list<pair<string,bufferlist> >& kv,
+				   map<string,entry_t>& idx)
+{
+  bufferlist payload;
+  uint32_t nops = kv.size();
+  payload.append((char*)&nops, sizeof(nops));
+
+  map<string,entry_t> updates;
+  for (list<pair<string,bufferlist> >::iterator p = kv.begin();
+       p != kv.end();
+       ++p) {
+    uint32_t klen = p->first.length();
+    payload.append((char*)&klen, sizeof(klen));
+    payload.append(p->first.c_str(), klen);
+    uint32_t vlen = p->second.length();
+    payload.append((char*)&vlen, sizeof(vlen));
+    updates[p->first] = entry_t(end + HEADER_LEN + payload.length(), vlen);
+    payload.claim_append(p->second);
+  }
+
+  uint32_t h[3];
+  h[0] = MAGIC;
+  h[1] = payload.length();
+  h[2] = checksum(payload);
+
+  bufferlist bl;
+  bl.append((char*)h, HEADER_LEN);
+  bl.claim_append(payload);
+
+  off_t pos = end;
+  for (list<bufferptr>::const_iterator it = bl.buffers().begin();
+       it != bl.buffers().end();
+       it++) {
+    int r = ::pwrite(fd, it->c_str(), it->length(), pos);
+    if (r != (int)it->length()) {
+      derr(0) << "_write_record ::pwrite() returned " << r << " not " << it->length()
+	      << ": " << strerror(errno) << dendl;
+      return -EIO;
+    }
+    pos += r;
+  }
+  if (::fsync(fd) < 0) {
+    derr(0) << "_write_record ::fsync() failed: " << strerror(errno) << dendl;
+    return -EIO;
+  }
+  end = pos;
+
+  for (map<string,entry_t>::iterator p = updates.begin();
+       p != updates.end();
+       ++p)
+    idx[p->first] = p->second;
+  return 0;
+}
+
+int LogMonitorStore::_append(list<pair<string,bufferlist> >& kv)
+{
+  assert(fd >= 0);
+
+  // note what we're superseding
+  map<string,uint32_t> old;
+  for (list<pair<string,bufferlist> >::iterator p = kv.begin();
+       p != kv.end();
+       ++p) {
+    if (old.count(p->first))
+      continue;
+    map<string,entry_t>::iterator q = index.find(p->first);
+    old[p->first] = (q != index.end()) ? q->second.len : 0;
+  }
+
+  int r = _write_record(fd, log_end, kv, index);
+  if (r < 0) {
+    // paxos takes a returned put as durable; don't limp on without it
+    derr(0) << "_append: can't write record to " << dir << "/log: " << r << dendl;
+    assert(0);
+  }
+
+  for (map<string,uint32_t>::iterator p = old.begin();
+       p != old.end();
+       ++p)
+    live_bytes += (off_t)index[p->first].len - (off_t)p->second;
+
+  if (log_end > (off_t)g_conf.mon_store_log_compact_min &&
+      log_end > (off_t)((double)live_bytes * g_conf.mon_store_log_compact_ratio))
+    _compact();
+  return 0;
+}
+
+void LogMonitorStore::_compact()
+{
+  dout(5) << "compact " << index.size() << " keys, " << live_bytes << " live of "
+	  << log_end << " bytes" << dendl;
+
+  string fn = dir + "/log";
+  string tfn = dir + "/log.new";
+  int nfd = ::open(tfn.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0644);
+  if (nfd < 0) {
+    derr(0) << "compact: can't open " << tfn << ": " << strerror(errno) << dendl;
+    return;
+  }
+
+  off_t nend = 0;
+  map<string,entry_t> nindex;
+  list<pair<string,bufferlist> > kv;
+  unsigned pending = 0;
+  for (map<string,entry_t>::iterator p = index.begin();
+       p != index.end();
+       ++p) {
+    bufferptr bp(p->second.len);
+    if (p->second.len &&
+	::pread(fd, bp.c_str(), p->second.len, p->second.off) != (int)p->second.len) {
+      derr(0) << "compact: short read on " << p->first << ", giving up" << dendl;
+      ::close(nfd);
+      ::unlink(tfn.c_str());
+      return;
+    }
+    kv.push_back(pair<string,bufferlist>(p->first, bufferlist()));
+    kv.back().second.push_back(bp);
+    pending += p->second.len;
+
+    if (pending >= COMPACT_RECORD_MAX) {
+      if (_write_record(nfd, nend, kv, nindex) < 0) {
+	::close(nfd);
+	::unlink(tfn.c_str());
+	return;
+      }
+      kv.clear();
+      pending = 0;
+    }
+  }
+  if (!kv.empty() &&
+      _write_record(nfd, nend, kv, nindex) < 0) {
+    ::close(nfd);
+    ::unlink(tfn.c_str());
+    return;
+  }
+
+  if (::rename(tfn.c_str(), fn.c_str()) < 0) {
+    derr(0) << "compact: can't rename " << tfn << " over " << fn << ": " << strerror(errno)
+	    << ", keeping the old log" << dendl;
+    ::close(nfd);
+    ::unlink(tfn.c_str());
+    return;
+  }
+
+  // make the rename durable before anything goes into the new log
+  int dfd = ::open(dir.c_str(), O_RDONLY);
+  if (dfd < 0 || ::fsync(dfd) < 0) {
+    derr(0) << "compact: can't fsync " << dir << ": " << strerror(errno) << dendl;
+    assert(0);
+  }
+  ::close(dfd);
+
+  ::close(fd);
+  fd = nfd;
+  index.swap(nindex);
+  log_end = nend;
+  dout(5) << "compact done, log now " << log_end << " bytes" << dendl;
+}
+
+
+// ----------------------------------------
+// ints
+
+version_t LogMonitorStore::get_int(const char *a, const char *b)
+{
+  bufferlist bl;
+  if (get_bl_ss(bl, a, b) <= 0)
+    return 0;
+
+  char buf[30];
+  unsigned len = MIN(bl.length(), sizeof(buf)-1);
+  bl.copy(0, len, buf);
+  buf[len] = 0;
+  version_t val = strtoull(buf, 0, 10);
+
+  if (b) {
+    dout(15) << "get_int " << a << "/" << b << " = " << val << dendl;
+  } else {
+    dout(15) << "get_int " << a << " = " << val << dendl;
+  }
+  return val;
+}
+
+void LogMonitorStore::put_int(version_t val, const char *a, const char *b)
+{
+  Transaction t;
+  t.put_int(val, a, b);
+  apply_transaction(t);
+}
+
+
+// ----------------------------------------
+// buffers
+
+bool LogMonitorStore::exists_bl_ss(const char *a, const char *b)
+{
+  if (b) {
+    dout(15) << "exists_bl " << a << "/" << b << dendl;
+  } else {
+    dout(15) << "exists_bl " << a << dendl;
+  }
+  return index.count(get_key(a, b));
+}
+
+int LogMonitorStore::get_bl_ss(bufferlist& bl, const char *a, const char *b)
+{
+  map<string,entry_t>::iterator p = index.find(get_key(a, b));
+  if (p == index.end()) {
+    if (b) {
+      dout(15) << "get_bl " << a << "/" << b << " DNE" << dendl;
+    } else {
+      dout(15) << "get_bl " << a << " DNE" << dendl;
+    }
+    return 0;
+  }
+
+  bl.clear();
+  bufferptr bp(p->second.len);
+  int off = 0;
+  while (off < (int)p->second.len) {
+    int r = ::pread(fd, bp.c_str()+off, p->second.len-off, p->second.off+off);
+    if (r < 0) derr(0) << "errno on read " << strerror(errno) << dendl;
+    assert(r>0);
+    off += r;
+  }
+  bl.append(bp);
+
+  if (b) {
+    dout(15) << "get_bl " << a << "/" << b << " = " << bl.length() << " bytes" << dendl;
+  } else {
+    dout(15) << "get_bl " << a << " = " << bl.length() << " bytes" << dendl;
+  }
+  return p->second.len;
+}
+
+int LogMonitorStore::put_bl_ss(bufferlist& bl, const char *a, const char *b)
+{
+  Transaction t;
+  t.put_bl_ss(bl, a, b);
+  return apply_transaction(t);
+}
+
+
+// ----------------------------------------
+// transactions
+
+int LogMonitorStore::apply_transaction(Transaction& t)
+{
+  dout(15) << "apply_transaction " << t.get_num_ops() << " ops" << dendl;
+
+  list<pair<string,bufferlist> > kv;
+  for (list<Transaction::Op>::iterator p = t.ops.begin();
+       p != t.ops.end();
+       ++p) {
+    const char *b = p->b.length() ? p->b.c_str() : 0;
+    kv.push_back(pair<string,bufferlist>(get_key(p->a.c_str(), b), bufferlist()));
+    bufferlist& v = kv.back().second;
+    switch (p->op) {
+    case Transaction::OP_PUT_INT:
+      {
+	char vs[30];
+#ifdef __LP64__
+	sprintf(vs, "%ld\n", p->val);
+#else
+	sprintf(vs, "%lld\n", p->val);
+#endif
+	v.append(vs, strlen(vs));
+      }
+      break;
+    case Transaction::OP_PUT_BL:
+      v = p->bl;
+      break;
+    default:
+      assert(0);
+    }
+  }
+  return _append(kv);
+}
@@ -0,0 +1,91 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*- 
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software 
+ * Foundation.  See file COPYING.
+ * 
+ */
+
+#ifndef __MON_LOGMONITORSTORE_H
+#define __MON_LOGMONITORSTORE_H
+
+#include "MonitorStore.h"
+
+#include <map>
+using std::map;
+
+/*
+ * a single append-only log, dir/log, with an in-memory index of where
+ * the current value of each key lives.
+ *
+ * each put or transaction is one record:
+ *
+ *   magic, payload length, payload checksum      (3 x u32)
+ *   payload: nops, then per op  keylen, key, vallen, value
+ *
+ * and one fsync.  on mount we replay the log; a torn or corrupt record
+ * at the tail is truncated away.  once the log is mostly superseded
+ * values (mon_store_log_compact_*), the live values are copied into a
+ * fresh log that is renamed over the old one.
+ */
+class LogMonitorStore : public MonitorStore {
+  string dir;
+  int fd;
+  off_t log_end;      // where the next record goes
+  off_t live_bytes;   // size of all current values
+
+  struct entry_t {
+    off_t off;        // of the value, in the log
+    uint32_t len;
+    entry_t() : off(0), len(0) {}
+    entry_t(off_t o, uint32_t l) : off(o), len(l) {}
+  };
+  map<string, entry_t> index;
+
+  static const uint32_t MAGIC = 0x676f6c6dU;  // "mlog"
+  static const unsigned HEADER_LEN = 12;
+
+  string get_key(const char *a, const char *b) {
+    string k = a;
+    if (b) {
+      k += "/";
+      k += b;
+    }
+    return k;
+  }
+  static uint32_t checksum(bufferlist& bl);
+
+  void _replay();
+  int _write_record(int fd, off_t& end, list<pair<string,bufferlist> >& kv,
+		    map<string,entry_t>& idx);
+  int _append(list<pair<string,bufferlist> >& kv);
+  void _compact();
+
+public:
+  LogMonitorStore(const char *d) : dir(d), fd(-1), log_end(0), live_bytes(0) {
+  }
+  ~LogMonitorStore();
+
+  void mkfs();  // wipe
+  void mount();
+
+  version_t get_int(const char *a, const char *b=0);
+  void put_int(version_t v, const char *a, const char *b=0);
+
+  bool exists_bl_ss(const char *a, const char *b=0);
+  int get_bl_ss(bufferlist& bl, const char *a, const char *b);
+  int put_bl_ss(bufferlist& bl, const char *a, const char *b);
+
+  int apply_transaction(Transaction& t);
+
+  off_t get_log_size() { return log_end; }
+  off_t get_live_bytes() { return live_bytes; }
+};
+
+#endif
@@ -18,7 +18,8 @@
 
 #include "osd/OSDMap.h"
 
-#include "MonitorStore.h"
+#include "FileMonitorStore.h"
+#include "LogMonitorStore.h"
 
 #include "msg/Message.h"
 #include "msg/Messenger.h"
@@ -33,6 +34,7 @@
 
 #include "common/Timer.h"
 #include "common/Clock.h"
+#include "common/Logger.h"
 
 #include "OSDMonitor.h"
 #include "MDSMonitor.h"
@@ -41,11 +43,13 @@
 
 #include "config.h"
 
-#define  dout(l) if (l<=g_conf.debug || l<=g_conf.debug_mon) *_dout << dbeginl << g_clock.now() << " mon" << whoami << (is_starting() ? (const char*)"(starting)":(is_leader() ? (const char*)"(leader)":(is_peon() ? (const char*)"(peon)":(const char*)"(?\?)"))) << " "
-#define  derr(l) if (l<=g_conf.debug || l<=g_conf.debug_mon) *_derr << dbeginl << g_clock.now() << " mon" << whoami << (is_starting() ? (const char*)"(starting)":(is_leader() ? (const char*)"(leader)":(is_peon() ? (const char*)"(peon)":(const char*)"(?\?)"))) << " "
+#define  dout(l) dout_if(l, l<=g_conf.debug || l<=g_conf.debug_mon) << g_clock.now() << " mon" << whoami << (is_starting() ? (const char*)"(starting)":(is_leader() ? (const char*)"(leader)":(is_peon() ? (const char*)"(peon)":(const char*)"(?\?)"))) << " "
+#define  derr(l) derr_if(l, l<=g_conf.debug || l<=g_conf.debug_mon) << g_clock.now() << " mon" << whoami << (is_starting() ? (const char*)"(starting)":(is_leader() ? (const char*)"(leader)":(is_peon() ? (const char*)"(peon)":(const char*)"(?\?)"))) << " "
 
 
 
+LogType mon_logtype;
+
 void Monitor::init()
 {
   lock.Lock();
@@ -55,12 +59,19 @@ void Monitor::init()
   // store
   char s[80];
   sprintf(s, "mondata/mon%d", whoami);
-  store = new MonitorStore(s);
+  if (g_conf.mon_store_log)
+    store = new LogMonitorStore(s);
+  else
+    store = new FileMonitorStore(s);
   
   if (g_conf.mkfs) 
     store->mkfs();
   
   store->mount();
+
+  // log
+  sprintf(s, "mon%d", whoami);
+  logger = new Logger(s, &mon_logtype);
   
   // create 
   osdmon = new OSDMonitor(this, &paxos_osdmap);
@@ -127,6 +138,10 @@ void Monitor::shutdown()
   // unmount my local storage
   if (store) 
     delete store;
+  if (logger) {
+    delete logger;
+    logger = 0;
+  }
   
   // clean up
   if (osdmon) delete osdmon;
@@ -320,6 +335,9 @@ void Monitor::dispatch(Message *m)
 	case PAXOS_CLIENTMAP:
 	  paxos_clientmap.dispatch(m);
 	  break;
+	case PAXOS_PGMAP:
+	  paxos_pgmap.dispatch(m);
+	  break;
 	default:
 	  assert(0);
 	}
@@ -39,6 +39,10 @@ class MDSMonitor;
 class ClientMonitor;
 class PGMonitor;
 
+class Logger;
+class LogType;
+extern LogType mon_logtype;
+
 class Monitor : public Dispatcher {
 public:
   // me
@@ -59,6 +63,8 @@ public:
 public:
   MonitorStore *store;
 
+  Logger *logger;
+
   // -- monitor state --
 private:
   const static int STATE_STARTING = 0; // electing
@@ -129,6 +135,7 @@ public:
     monmap(mm),
     timer(lock), tick_timer(0),
     store(0),
+    logger(0),
 
     state(STATE_STARTING), stopping(false),
 
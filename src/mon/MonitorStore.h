@@ -20,27 +20,77 @@
 
 #include <string.h>
 
+/*
+ * MonitorStore -- the monitor's local key/value storage.
+ *
+ * keys are (a, b) pairs, or just a.  values are buffers; ints are stored
+ * as ascii.  implementations are FileMonitorStore (a file per key) and
+ * LogMonitorStore (a single append-only log).
+ */
 class MonitorStore {
-  string dir;
-
 public:
-  MonitorStore(char *d) : dir(d) {
-  }
-  ~MonitorStore() {
-  }
+  /*
+   * a set of puts to be applied atomically (and, where the
+   * implementation allows, with a single sync).
+   */
+  class Transaction {
+  public:
+    static const int OP_PUT_INT = 1;  // a, b, val
+    static const int OP_PUT_BL =  2;  // a, b, bl
+
+    struct Op {
+      int op;
+      string a, b;     // b empty if none
+      version_t val;
+      bufferlist bl;
+    };
+    list<Op> ops;
 
-  void mkfs();  // wipe
-  void mount();
+    bool empty() { return ops.empty(); }
+    int get_num_ops() { return ops.size(); }
+
+    void put_int(version_t v, const char *a, const char *b=0) {
+      ops.push_back(Op());
+      Op &o = ops.back();
+      o.op = OP_PUT_INT;
+      o.a = a;
+      if (b) o.b = b;
+      o.val = v;
+    }
+    void put_bl_ss(bufferlist& bl, const char *a, const char *b) {
+      ops.push_back(Op());
+      Op &o = ops.back();
+      o.op = OP_PUT_BL;
+      o.a = a;
+      if (b) o.b = b;
+      o.val = 0;
+      o.bl = bl;
+    }
+    void put_bl_sn(bufferlist& bl, const char *a, version_t b) {
+      char bs[20];
+#ifdef __LP64__
+      sprintf(bs, "%lu", b);
+#else
+      sprintf(bs, "%llu", b);
+#endif
+      put_bl_ss(bl, a, bs);
+    }
+  };
+
+  virtual ~MonitorStore() { }
+
+  virtual void mkfs() = 0;  // wipe
+  virtual void mount() = 0;
 
   // ints (stored as ascii)
-  version_t get_int(const char *a, const char *b=0);
-  void put_int(version_t v, const char *a, const char *b=0);
+  virtual version_t get_int(const char *a, const char *b=0) = 0;
+  virtual void put_int(version_t v, const char *a, const char *b=0) = 0;
 
   // buffers
   // ss and sn varieties.
-  bool exists_bl_ss(const char *a, const char *b=0);
-  int get_bl_ss(bufferlist& bl, const char *a, const char *b);
-  int put_bl_ss(bufferlist& bl, const char *a, const char *b);
+  virtual bool exists_bl_ss(const char *a, const char *b=0) = 0;
+  virtual int get_bl_ss(bufferlist& bl, const char *a, const char *b) = 0;
+  virtual int put_bl_ss(bufferlist& bl, const char *a, const char *b) = 0;
   bool exists_bl_sn(const char *a, version_t b) {
     char bs[20];
 #ifdef __LP64__
@@ -69,6 +119,9 @@ public:
     return put_bl_ss(bl, a, bs);
   }
 
+  // transactions
+  virtual int apply_transaction(Transaction& t) = 0;
+
   /*
   version_t get_incarnation() { return get_int("incarnation"); }
   void set_incarnation(version_t i) { set_int(i, "incarnation"); }
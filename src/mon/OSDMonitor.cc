@@ -28,12 +28,15 @@
 #include "messages/MOSDOut.h"
 
 #include "common/Timer.h"
+#include "common/Logger.h"
+
+#include "include/compress.h"
 
 #include "config.h"
 
 
-#define  dout(l) if (l<=g_conf.debug || l<=g_conf.debug_mon) *_dout << dbeginl << g_clock.now() << " mon" << mon->whoami << (mon->is_starting() ? (const char*)"(starting)":(mon->is_leader() ? (const char*)"(leader)":(mon->is_peon() ? (const char*)"(peon)":(const char*)"(?\?)"))) << ".osd e" << osdmap.get_epoch() << " "
-#define  derr(l) if (l<=g_conf.debug || l<=g_conf.debug_mon) *_derr << dbeginl << g_clock.now() << " mon" << mon->whoami << (mon->is_starting() ? (const char*)"(starting)":(mon->is_leader() ? (const char*)"(leader)":(mon->is_peon() ? (const char*)"(peon)":(const char*)"(?\?)"))) << ".osd e" << osdmap.get_epoch() << " "
+#define  dout(l) dout_if(l, l<=g_conf.debug || l<=g_conf.debug_mon) << g_clock.now() << " mon" << mon->whoami << (mon->is_starting() ? (const char*)"(starting)":(mon->is_leader() ? (const char*)"(leader)":(mon->is_peon() ? (const char*)"(peon)":(const char*)"(?\?)"))) << ".osd e" << osdmap.get_epoch() << " "
+#define  derr(l) derr_if(l, l<=g_conf.debug || l<=g_conf.debug_mon) << g_clock.now() << " mon" << mon->whoami << (mon->is_starting() ? (const char*)"(starting)":(mon->is_leader() ? (const char*)"(leader)":(mon->is_peon() ? (const char*)"(peon)":(const char*)"(?\?)"))) << ".osd e" << osdmap.get_epoch() << " "
 
 
 // FAKING
@@ -96,6 +99,18 @@ void OSDMonitor::fake_reorg()
 
 /************ MAPS ****************/
 
+OSDMonitor::OSDMonitor(Monitor *mn, Paxos *p) : 
+  PaxosService(mn, p),
+  merged_cache_bytes(0)
+{
+  // what clients cost us to catch up, per send_incremental
+  mon_logtype.add_avg("osdmap.cubytes");
+  mon_logtype.add_avg("osdmap.cuepochs");
+  mon_logtype.add_avg("osdmap.cumaps");
+  mon_logtype.add_inc("osdmap.mhit");
+  mon_logtype.add_inc("osdmap.mmiss");
+}
+
 void OSDMonitor::create_initial()
 {
   assert(mon->is_leader());
@@ -177,105 +192,10 @@ void OSDMonitor::create_initial()
 void OSDMonitor::build_crush_map(CrushWrapper& crush,
 				 map<int,double>& weights)
 {
-  // new
-  crush.create();
-
-  if (g_conf.num_osd >= 12) {
-    int ndom = g_conf.osd_max_rep;
-    int ritems[ndom];
-    int rweights[ndom];
-
-    int nper = ((g_conf.num_osd - 1) / ndom) + 1;
-    derr(0) << ndom << " failure domains, " << nper << " osds each" << dendl;
-
-    int o = 0;
-    for (int i=0; i<ndom; i++) {
-      int items[nper];
-      //int w[nper];
-      int j;
-      rweights[i] = 0;
-      for (j=0; j<nper; j++, o++) {
-	if (o == g_conf.num_osd) break;
-	dout(20) << "added osd" << o << dendl;
-	items[j] = o;
-	//w[j] = weights[o] ? (0x10000 - (int)(weights[o] * 0x10000)):0x10000;
-	//rweights[i] += w[j];
-	rweights[i] += 0x10000;
-      }
-
-      crush_bucket_uniform *domain = crush_make_uniform_bucket(1, j, items, 0x10000);
-      ritems[i] = crush_add_bucket(crush.map, (crush_bucket*)domain);
-      dout(20) << "added domain bucket i " << ritems[i] << " of size " << j << dendl;
-    }
-    
-    // root
-    crush_bucket_list *root = crush_make_list_bucket(2, ndom, ritems, rweights);
-    int rootid = crush_add_bucket(crush.map, (crush_bucket*)root);
-    
-    // rules
-    // replication
-    for (int i=1; i<=ndom; i++) {
-      crush_rule *rule = crush_make_rule(4);
-      crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, rootid, 0);
-      crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_FIRSTN, i, 1);
-      crush_rule_set_step(rule, 2, CRUSH_RULE_CHOOSE_FIRSTN, 1, 0);
-      crush_rule_set_step(rule, 3, CRUSH_RULE_EMIT, 0, 0);
-      crush_add_rule(crush.map, CRUSH_REP_RULE(i), rule);
-    }
-
-    // raid
-    for (int i=g_conf.osd_min_raid_width; i <= g_conf.osd_max_raid_width; i++) {
-      if (ndom >= i) {
-	crush_rule *rule = crush_make_rule(4);
-	crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, rootid, 0);
-	crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_INDEP, i, 1);
-	crush_rule_set_step(rule, 2, CRUSH_RULE_CHOOSE_INDEP, 1, 0);
-	crush_rule_set_step(rule, 3, CRUSH_RULE_EMIT, 0, 0);
-	crush_add_rule(crush.map, CRUSH_RAID_RULE(i), rule);
-      } else {
-	crush_rule *rule = crush_make_rule(3);
-	crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, rootid, 0);
-	crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_INDEP, i, 0);
-	crush_rule_set_step(rule, 2, CRUSH_RULE_EMIT, 0, 0);
-	crush_add_rule(crush.map, CRUSH_RAID_RULE(i), rule);
-      }
-    }
-    
-  } else {
-    // one bucket
-
-    int items[g_conf.num_osd];
-    for (int i=0; i<g_conf.num_osd; i++) 
-      items[i] = i;
-    
-    crush_bucket_uniform *b = crush_make_uniform_bucket(1, g_conf.num_osd, items, 0x10000);
-    int root = crush_add_bucket(crush.map, (crush_bucket*)b);
-    
-    // rules
-    // replication
-    for (int i=1; i<=g_conf.osd_max_rep; i++) {
-      crush_rule *rule = crush_make_rule(3);
-      crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, root, 0);
-      crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_FIRSTN, i, 0);
-      crush_rule_set_step(rule, 2, CRUSH_RULE_EMIT, 0, 0);
-      crush_add_rule(crush.map, CRUSH_REP_RULE(i), rule);
-    }
-    // raid4
-    for (int i=g_conf.osd_min_raid_width; i <= g_conf.osd_max_raid_width; i++) {
-      crush_rule *rule = crush_make_rule(3);
-      crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, root, 0);
-      crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_INDEP, i, 0);
-      crush_rule_set_step(rule, 2, CRUSH_RULE_EMIT, 0, 0);
-      crush_add_rule(crush.map, CRUSH_RAID_RULE(i), rule);
-    }
-  }
-  
-  crush.finalize();
-
-  // mark all in
-  for (int i=0; i<g_conf.num_osd; i++)
-    crush.set_offload(i, CEPH_OSD_IN);
-
+  if (g_conf.num_osd >= 12)
+    derr(0) << g_conf.osd_max_rep << " failure domains, "
+	    << ((g_conf.num_osd - 1) / g_conf.osd_max_rep) + 1 << " osds each" << dendl;
+  OSDMap::build_simple_crush(crush, g_conf.num_osd);
   dout(20) << "crush max_devices " << crush.map->max_devices << dendl;
 }
 
@@ -303,6 +223,7 @@ bool OSDMonitor::update_from_paxos()
   } 
   
   // walk through incrementals
+  MonitorStore::Transaction t;
   while (paxosv > osdmap.epoch) {
     bufferlist bl;
     bool success = paxos->read(osdmap.epoch+1, bl);
@@ -317,7 +238,7 @@ bool OSDMonitor::update_from_paxos()
     // write out the full map, too.
     bl.clear();
     osdmap.encode(bl);
-    mon->store->put_bl_sn(bl, "osdmap_full", osdmap.epoch);
+    t.put_bl_sn(bl, "osdmap_full", osdmap.epoch);
 
     // share
     dout(1) << osdmap.get_num_osds() << " osds, "
@@ -325,7 +246,8 @@ bool OSDMonitor::update_from_paxos()
 	    << osdmap.get_num_in_osds() << " in" 
 	    << dendl;
   }
-  mon->store->put_int(osdmap.epoch, "osdmap_full","last_epoch");
+  t.put_int(osdmap.epoch, "osdmap_full","last_epoch");
+  mon->store->apply_transaction(t);
 
   // new map!
   bcast_latest_mds();
@@ -701,27 +623,125 @@ void OSDMonitor::send_incremental(entity_inst_t dest, epoch_t from)
 	  << " to " << dest << dendl;
   
   MOSDMap *m = new MOSDMap;
-  
-  for (epoch_t e = osdmap.get_epoch();
-       e >= from;
-       e--) {
-    bufferlist bl;
-    if (mon->store->get_bl_sn(bl, "osdmap", e) > 0) {
-      dout(20) << "send_incremental    inc " << e << " " << bl.length() << " bytes" << dendl;
-      m->incremental_maps[e] = bl;
-    } 
-    else if (mon->store->get_bl_sn(bl, "osdmap_full", e) > 0) {
-      dout(20) << "send_incremental   full " << e << dendl;
-      m->maps[e] = bl;
-    }
-    else {
-      assert(0);  // we should have all maps.
+  epoch_t last = osdmap.get_epoch();
+
+  // osds archive every epoch, so they get every epoch.  anyone else
+  // far enough behind gets merged incrementals.
+  if (g_conf.mon_osdmap_merge &&
+      !dest.name.is_osd() &&
+      from > 1 && from <= last &&
+      last - from + 1 >= (epoch_t)g_conf.mon_osdmap_merge_min) {
+    add_merged(m, from-1, last);
+  } else {
+    for (epoch_t e = last;
+	 e >= from;
+	 e--) {
+      bufferlist bl;
+      if (mon->store->get_bl_sn(bl, "osdmap", e) > 0) {
+	dout(20) << "send_incremental    inc " << e << " " << bl.length() << " bytes" << dendl;
+	m->incremental_maps[e] = bl;
+      } 
+      else if (mon->store->get_bl_sn(bl, "osdmap_full", e) > 0) {
+	dout(20) << "send_incremental   full " << e << dendl;
+	m->maps[e] = bl;
+      }
+      else {
+	assert(0);  // we should have all maps.
+      }
     }
   }
+
+  if (mon->logger && from <= last) {
+    unsigned bytes = 0;
+    map<epoch_t,bufferlist>::iterator p;
+    for (p = m->maps.begin(); p != m->maps.end(); p++)
+      bytes += p->second.length();
+    for (p = m->incremental_maps.begin(); p != m->incremental_maps.end(); p++)
+      bytes += p->second.length();
+    for (p = m->merged_maps.begin(); p != m->merged_maps.end(); p++)
+      bytes += p->second.length();
+    mon->logger->favg("osdmap.cubytes", bytes);
+    mon->logger->favg("osdmap.cuepochs", last - from + 1);
+    mon->logger->favg("osdmap.cumaps", 
+		      m->maps.size() + m->incremental_maps.size() + m->merged_maps.size());
+  }
   
   mon->messenger->send_message(m, dest);
 }
 
+/*
+ * cover (base,last] with power-of-two aligned spans: from base, take
+ * the largest 2^k that base is a multiple of and that doesn't overshoot
+ * last.  that's O(log n) pieces, and since the spans are aligned,
+ * clients starting from different epochs hit the same cache entries.
+ */
+void OSDMonitor::add_merged(MOSDMap *m, epoch_t base, epoch_t last)
+{
+  while (base < last) {
+    epoch_t len = 1;
+    while (base % (len*2) == 0 && base + len*2 <= last)
+      len *= 2;
+
+    bufferlist bl;
+    if (len > 1 && get_merged_bl(base, base+len, bl)) {
+      dout(20) << "send_incremental merged " << base << ".." << (base+len)
+	       << " " << bl.length() << " bytes" << dendl;
+      m->merged_span[base] = base+len;
+      m->merged_maps[base].claim(bl);
+    } else {
+      for (epoch_t e = base+1; e <= base+len; e++) {
+	bufferlist bl;
+	if (mon->store->get_bl_sn(bl, "osdmap", e) > 0)
+	  m->incremental_maps[e] = bl;
+	else if (mon->store->get_bl_sn(bl, "osdmap_full", e) > 0)
+	  m->maps[e] = bl;
+	else
+	  assert(0);  // we should have all maps.
+      }
+    }
+    base += len;
+  }
+}
+
+bool OSDMonitor::get_merged_bl(epoch_t base, epoch_t end, bufferlist& bl)
+{
+  pair<epoch_t,epoch_t> k(base, end);
+  if (merged_cache.count(k)) {
+    bl = merged_cache[k];
+    if (mon->logger) mon->logger->inc("osdmap.mhit");
+    return true;
+  }
+  if (mon->logger) mon->logger->inc("osdmap.mmiss");
+
+  bufferlist a, b;
+  if (mon->store->get_bl_sn(a, "osdmap_full", base) <= 0 ||
+      mon->store->get_bl_sn(b, "osdmap_full", end) <= 0)
+    return false;
+  OSDMap older, newer;
+  older.decode(a);
+  newer.decode(b);
+  OSDMap::Incremental inc;
+  if (!newer.build_incremental(older, inc)) {
+    dout(10) << "get_merged_bl " << base << ".." << end << " can't be merged" << dendl;
+    return false;
+  }
+  bufferlist raw;
+  inc.encode(raw);
+  compress_bl(raw, bl, g_conf.mon_osdmap_merge_compress);
+  dout(15) << "get_merged_bl " << base << ".." << end << " " << raw.length()
+	   << " -> " << bl.length() << " bytes" << dendl;
+
+  // cache it; drop the oldest spans if we're over
+  merged_cache[k] = bl;
+  merged_cache_bytes += bl.length();
+  while (merged_cache_bytes > g_conf.mon_osdmap_merge_cache &&
+	 !merged_cache.empty()) {
+    merged_cache_bytes -= merged_cache.begin()->second.length();
+    merged_cache.erase(merged_cache.begin());
+  }
+  return true;
+}
+
 
 void OSDMonitor::bcast_latest_mds()
 {
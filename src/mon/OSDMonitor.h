@@ -31,6 +31,7 @@ using namespace std;
 
 class Monitor;
 class MOSDBoot;
+class MOSDMap;
 
 class OSDMonitor : public PaxosService {
 public:
@@ -45,6 +46,13 @@ private:
 
   map<int,double> osd_weight;
 
+  // merged incrementals, (base,end) -> compressed Incremental.  spans
+  // are power-of-two aligned so clients at different epochs share them.
+  map<pair<epoch_t,epoch_t>, bufferlist> merged_cache;
+  int merged_cache_bytes;
+  bool get_merged_bl(epoch_t base, epoch_t end, bufferlist& bl);
+  void add_merged(MOSDMap *m, epoch_t base, epoch_t last);
+
   void build_crush_map(CrushWrapper& crush,
 		       map<int,double>& weights);
 
@@ -116,8 +124,7 @@ private:
   bool prepare_out(class MOSDOut *m);
 
  public:
-  OSDMonitor(Monitor *mn, Paxos *p) : 
-    PaxosService(mn, p) { }
+  OSDMonitor(Monitor *mn, Paxos *p);
 
   void tick();  // check state, take actions
 
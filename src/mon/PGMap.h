@@ -23,6 +23,30 @@
 
 #include "osd/osd_types.h"
 
+/*
+ * sums over some set of pgs
+ */
+struct pg_stat_sum_t {
+  int64_t num_pg;
+  int64_t num_bytes;
+  int64_t num_blocks;
+  int64_t num_objects;
+
+  pg_stat_sum_t() : num_pg(0), num_bytes(0), num_blocks(0), num_objects(0) {}
+  void add(const pg_stat_t& s) {
+    num_pg++;
+    num_bytes += s.num_bytes;
+    num_blocks += s.num_blocks;
+    num_objects += s.num_objects;
+  }
+  void sub(const pg_stat_t& s) {
+    num_pg--;
+    num_bytes -= s.num_bytes;
+    num_blocks -= s.num_blocks;
+    num_objects -= s.num_objects;
+  }
+};
+
 class PGMap {
 public:
   // the map
@@ -50,70 +74,91 @@ public:
     Incremental() : version(0) {}
   };
 
+  void update_pg(pg_t pgid, const pg_stat_t& s) {
+    hash_map<pg_t,pg_stat_t>::iterator p = pg_stat.find(pgid);
+    if (p != pg_stat.end()) {
+      stat_pg_sub(pgid, p->second);
+      p->second = s;
+    } else
+      pg_stat[pgid] = s;
+    stat_pg_add(pgid, s);
+  }
+  void update_osd(int osd, const osd_stat_t& s) {
+    hash_map<int,osd_stat_t>::iterator p = osd_stat.find(osd);
+    if (p != osd_stat.end()) {
+      stat_osd_sub(p->second);
+      p->second = s;
+    } else
+      osd_stat[osd] = s;
+    stat_osd_add(s);
+  }
+
   void apply_incremental(Incremental& inc) {
     assert(inc.version == version+1);
     version++;
     for (map<pg_t,pg_stat_t>::iterator p = inc.pg_stat_updates.begin();
 	 p != inc.pg_stat_updates.end();
-	 ++p) {
-      if (pg_stat.count(p->first))
-	stat_pg_sub(pg_stat[p->first]);
-      pg_stat[p->first] = p->second;
-      stat_pg_add(p->second);
-    }
+	 ++p)
+      update_pg(p->first, p->second);
     for (map<int,osd_stat_t>::iterator p = inc.osd_stat_updates.begin();
 	 p != inc.osd_stat_updates.end();
-	 ++p) {
-      if (osd_stat.count(p->first))
-	stat_osd_sub(osd_stat[p->first]);
-      osd_stat[p->first] = p->second;
-      stat_osd_add(p->second);
-    }
+	 ++p)
+      update_osd(p->first, p->second);
   }
 
-  // aggregate stats (soft state)
+  /*
+   * aggregate stats (soft state).  kept up to date as pgs and osds
+   * are updated, so they cost O(changes), never O(pgs).
+   */
   hash_map<int,int> num_pg_by_state;
-  int64_t num_pg;
-  int64_t total_pg_num_bytes;
-  int64_t total_pg_num_blocks;
-  int64_t total_pg_num_objects;
+  pg_stat_sum_t pg_sum;
+  hash_map<int,pg_stat_sum_t> pg_sum_by_kind;   // (type << 8 | size)
+  hash_map<int,pg_stat_sum_t> pg_sum_by_osd;    // primary
   int64_t num_osd;
   int64_t total_osd_num_blocks;
   int64_t total_osd_num_blocks_avail;
   int64_t total_osd_num_objects;
+
+  static int pg_kind(pg_t pgid) {
+    return (pgid.type() << 8) | pgid.size();
+  }
   
   void stat_zero() {
-    num_pg = 0;
     num_pg_by_state.clear();
-    total_pg_num_bytes = 0;
-    total_pg_num_blocks = 0;
-    total_pg_num_objects = 0;
+    pg_sum = pg_stat_sum_t();
+    pg_sum_by_kind.clear();
+    pg_sum_by_osd.clear();
     num_osd = 0;
     total_osd_num_blocks = 0;
     total_osd_num_blocks_avail = 0;
     total_osd_num_objects = 0;
   }
-  void stat_pg_add(pg_stat_t &s) {
-    num_pg++;
+  void stat_pg_add(pg_t pgid, const pg_stat_t &s) {
     num_pg_by_state[s.state]++;
-    total_pg_num_bytes += s.num_bytes;
-    total_pg_num_blocks += s.num_blocks;
-    total_pg_num_objects += s.num_objects;
+    pg_sum.add(s);
+    pg_sum_by_kind[pg_kind(pgid)].add(s);
+    pg_sum_by_osd[s.primary].add(s);
   }
-  void stat_osd_add(osd_stat_t &s) {
+  void stat_osd_add(const osd_stat_t &s) {
     num_osd++;
     total_osd_num_blocks += s.num_blocks;
     total_osd_num_blocks_avail += s.num_blocks_avail;
     total_osd_num_objects += s.num_objects;
   }
-  void stat_pg_sub(pg_stat_t &s) {
-    num_pg--;
-    num_pg_by_state[s.state]--;
-    total_pg_num_bytes -= s.num_bytes;
-    total_pg_num_blocks -= s.num_blocks;
-    total_pg_num_objects -= s.num_objects;
+  void stat_pg_sub(pg_t pgid, const pg_stat_t &s) {
+    if (--num_pg_by_state[s.state] == 0)
+      num_pg_by_state.erase(s.state);
+    pg_sum.sub(s);
+    hash_map<int,pg_stat_sum_t>::iterator p = pg_sum_by_kind.find(pg_kind(pgid));
+    p->second.sub(s);
+    if (p->second.num_pg == 0)
+      pg_sum_by_kind.erase(p);
+    p = pg_sum_by_osd.find(s.primary);
+    p->second.sub(s);
+    if (p->second.num_pg == 0)
+      pg_sum_by_osd.erase(p);
   }
-  void stat_osd_sub(osd_stat_t &s) {
+  void stat_osd_sub(const osd_stat_t &s) {
     num_osd--;
     total_osd_num_blocks -= s.num_blocks;
     total_osd_num_blocks_avail -= s.num_blocks_avail;
@@ -121,10 +166,6 @@ public:
   }
 
   PGMap() : version(0), 
-	    num_pg(0), 
-	    total_pg_num_bytes(0), 
-	    total_pg_num_blocks(0), 
-	    total_pg_num_objects(0), 
 	    num_osd(0),
 	    total_osd_num_blocks(0),
 	    total_osd_num_blocks_avail(0),
@@ -133,15 +174,17 @@ public:
   void _encode(bufferlist &bl) {
     ::_encode(version, bl);
     ::_encode(pg_stat, bl);
+    ::_encode(osd_stat, bl);
   }
   void _decode(bufferlist& bl, int& off) {
     ::_decode(version, bl, off);
     ::_decode(pg_stat, bl, off);
+    ::_decode(osd_stat, bl, off);
     stat_zero();
     for (hash_map<pg_t,pg_stat_t>::iterator p = pg_stat.begin();
 	 p != pg_stat.end();
 	 ++p)
-      stat_pg_add(p->second);
+      stat_pg_add(p->first, p->second);
     for (hash_map<int,osd_stat_t>::iterator p = osd_stat.begin();
 	 p != osd_stat.end();
 	 ++p)
@@ -33,8 +33,8 @@
 #include <sstream>
 
 
-#define  dout(l) if (l<=g_conf.debug || l<=g_conf.debug_mon) *_dout << dbeginl << g_clock.now() << " mon" << mon->whoami << (mon->is_starting() ? (const char*)"(starting)":(mon->is_leader() ? (const char*)"(leader)":(mon->is_peon() ? (const char*)"(peon)":(const char*)"(?\?)"))) << ".pg "
-#define  derr(l) if (l<=g_conf.debug || l<=g_conf.debug_mon) *_derr << dbeginl << g_clock.now() << " mon" << mon->whoami << (mon->is_starting() ? (const char*)"(starting)":(mon->is_leader() ? (const char*)"(leader)":(mon->is_peon() ? (const char*)"(peon)":(const char*)"(?\?)"))) << ".pg "
+#define  dout(l) dout_if(l, l<=g_conf.debug || l<=g_conf.debug_mon) << g_clock.now() << " mon" << mon->whoami << (mon->is_starting() ? (const char*)"(starting)":(mon->is_leader() ? (const char*)"(leader)":(mon->is_peon() ? (const char*)"(peon)":(const char*)"(?\?)"))) << ".pg "
+#define  derr(l) derr_if(l, l<=g_conf.debug || l<=g_conf.debug_mon) << g_clock.now() << " mon" << mon->whoami << (mon->is_starting() ? (const char*)"(starting)":(mon->is_leader() ? (const char*)"(leader)":(mon->is_peon() ? (const char*)"(peon)":(const char*)"(?\?)"))) << ".pg "
 
 
 /*
@@ -80,6 +80,7 @@ bool PGMonitor::update_from_paxos()
     mon->store->get_bl_ss(bl, "pgmap", "latest");
     int off = 0;
     pg_map._decode(bl, off);
+    last_full_version = pg_map.version;
   } 
 
   // walk through incrementals
@@ -92,28 +93,33 @@ bool PGMonitor::update_from_paxos()
       int off = 0;
       inc._decode(bl, off);
       pg_map.apply_incremental(inc);
-      
-      std::stringstream ss;
-      for (hash_map<int,int>::iterator p = pg_map.num_pg_by_state.begin();
-	   p != pg_map.num_pg_by_state.end();
-	   ++p) {
-	if (p != pg_map.num_pg_by_state.begin())
-	  ss << ", ";
-	ss << p->second << " " << PG::get_state_string(p->first) << "(" << p->first << ")";
-      }
-      string states = ss.str();
-      dout(0) << "v" << pg_map.version << " " << states << dendl;
-
     } else {
       dout(7) << "update_from_paxos  couldn't read incremental " << pg_map.version+1 << dendl;
       return false;
     }
   }
 
-  // save latest
-  bufferlist bl;
-  pg_map._encode(bl);
-  mon->store->put_bl_ss(bl, "pgmap", "latest");
+  std::stringstream ss;
+  for (hash_map<int,int>::iterator p = pg_map.num_pg_by_state.begin();
+       p != pg_map.num_pg_by_state.end();
+       ++p) {
+    if (p != pg_map.num_pg_by_state.begin())
+      ss << ", ";
+    ss << p->second << " " << PG::get_state_string(p->first) << "(" << p->first << ")";
+  }
+  string states = ss.str();
+  dout(0) << "v" << pg_map.version << " " << states << dendl;
+
+  /*
+   * save latest.  the full map is O(pgs), so only do it every so
+   * often; on startup we replay incrementals from wherever it left off.
+   */
+  if (pg_map.version - last_full_version >= (version_t)g_conf.mon_pgmap_full_interval) {
+    bufferlist bl;
+    pg_map._encode(bl);
+    mon->store->put_bl_ss(bl, "pgmap", "latest");
+    last_full_version = pg_map.version;
+  }
 
   return true;
 }
@@ -145,6 +151,10 @@ bool PGMonitor::preprocess_query(Message *m)
   case MSG_PGSTATS:
     {
       MPGStats *stats = (MPGStats*)m;
+      int from = stats->get_source().num();
+      if (pg_map.osd_stat.count(from) == 0 ||
+	  osd_stat_changed(stats->osd_stat, pg_map.osd_stat[from], 0))
+	return false;
       for (map<pg_t,pg_stat_t>::iterator p = stats->pg_stat.begin();
 	   p != stats->pg_stat.end();
 	   p++) {
@@ -152,7 +162,8 @@ bool PGMonitor::preprocess_query(Message *m)
 	    pg_map.pg_stat[p->first].reported < p->second.reported)
 	  return false;
       }
-      dout(10) << " message contains no new pg stats" << dendl;
+      dout(10) << " message contains no new pg or osd stats" << dendl;
+      delete m;
       return true;
     }
 
@@ -209,13 +220,13 @@ bool PGMonitor::handle_pg_stats(MPGStats *stats)
       !mon->osdmon->osdmap.is_up(from) ||
       stats->get_source_inst() != mon->osdmon->osdmap.get_inst(from)) {
     dout(1) << " ignoring stats from non-active osd" << dendl;
+    delete stats;
+    return false;
   }
       
   // osd stat
-  if (pg_map.osd_stat.count(from))
-    pg_map.stat_osd_sub(pg_map.osd_stat[from]);
-  pg_map.osd_stat[from] = stats->osd_stat;
-  pg_map.stat_osd_add(stats->osd_stat);
+  pending_inc.osd_stat_updates[from] = stats->osd_stat;
+  pg_map.update_osd(from, stats->osd_stat);
 
   // pg stats
   for (map<pg_t,pg_stat_t>::iterator p = stats->pg_stat.begin();
@@ -240,10 +251,7 @@ bool PGMonitor::handle_pg_stats(MPGStats *stats)
     pending_inc.pg_stat_updates[pgid] = p->second;
 
     // we don't care about consistency; apply to live map.
-    if (pg_map.pg_stat.count(pgid))
-      pg_map.stat_pg_sub(pg_map.pg_stat[pgid]);
-    pg_map.pg_stat[pgid] = p->second;
-    pg_map.stat_pg_add(pg_map.pg_stat[pgid]);
+    pg_map.update_pg(pgid, p->second);
   }
   
   delete stats;
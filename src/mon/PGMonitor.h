@@ -39,6 +39,7 @@ public:
 private:
   PGMap pg_map;
   PGMap::Incremental pending_inc;
+  version_t last_full_version;  // of the full pgmap in the store
 
   void create_initial();
   bool update_from_paxos();
@@ -54,7 +55,7 @@ private:
   bool handle_pg_stats(MPGStats *stats);
 
  public:
-  PGMonitor(Monitor *mn, Paxos *p) : PaxosService(mn, p) { }
+  PGMonitor(Monitor *mn, Paxos *p) : PaxosService(mn, p), last_full_version(0) { }
   
   //void tick();  // check state, take actions
 
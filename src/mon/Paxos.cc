@@ -18,11 +18,21 @@
 
 #include "messages/MMonPaxos.h"
 
+#include "common/Logger.h"
+
 #include "config.h"
 
-#define  dout(l) if (l<=g_conf.debug || l<=g_conf.debug_paxos) *_dout << dbeginl << g_clock.now() << " mon" << whoami << (mon->is_starting() ? (const char*)"(starting)":(mon->is_leader() ? (const char*)"(leader)":(mon->is_peon() ? (const char*)"(peon)":(const char*)"(?\?)"))) << ".paxos(" << machine_name << " " << get_statename(state) << " lc " << last_committed << ") "
-#define  derr(l) if (l<=g_conf.debug || l<=g_conf.debug_paxos) *_derr << dbeginl << g_clock.now() << " mon" << whoami << (mon->is_starting() ? (const char*)"(starting)":(mon->is_leader() ? (const char*)"(leader)":(mon->is_peon() ? (const char*)"(peon)":(const char*)"(?\?)"))) << ".paxos(" << machine_name << " " << get_statename(state) << " lc " << last_committed << ") "
+#define  dout(l) dout_if(l, l<=g_conf.debug || l<=g_conf.debug_paxos) << g_clock.now() << " mon" << whoami << (mon->is_starting() ? (const char*)"(starting)":(mon->is_leader() ? (const char*)"(leader)":(mon->is_peon() ? (const char*)"(peon)":(const char*)"(?\?)"))) << ".paxos(" << machine_name << " " << get_statename(state) << " lc " << last_committed << ") "
+#define  derr(l) derr_if(l, l<=g_conf.debug || l<=g_conf.debug_paxos) << g_clock.now() << " mon" << whoami << (mon->is_starting() ? (const char*)"(starting)":(mon->is_leader() ? (const char*)"(leader)":(mon->is_peon() ? (const char*)"(peon)":(const char*)"(?\?)"))) << ".paxos(" << machine_name << " " << get_statename(state) << " lc " << last_committed << ") "
 
+// mon_logtype keeps the key pointers, so they must outlive any Monitor
+static const char *paxos_logkeys[][3] = {
+  { "test.commit", "test.clat", "test.upe" },
+  { "mdsmap.commit", "mdsmap.clat", "mdsmap.upe" },
+  { "osdmap.commit", "osdmap.clat", "osdmap.upe" },
+  { "clientmap.commit", "clientmap.clat", "clientmap.upe" },
+  { "pgmap.commit", "pgmap.clat", "pgmap.upe" }
+};
 
 void Paxos::init()
 {
@@ -31,6 +41,14 @@ void Paxos::init()
   accepted_pn = mon->store->get_int(machine_name, "accepted_pn");
   last_committed = mon->store->get_int(machine_name, "last_committed");
 
+  assert(machine_id >= 0 && machine_id <= PAXOS_PGMAP);
+  logkey_commit = paxos_logkeys[machine_id][0];
+  logkey_commit_lat = paxos_logkeys[machine_id][1];
+  logkey_updates = paxos_logkeys[machine_id][2];
+  mon_logtype.add_inc(logkey_commit);
+  mon_logtype.add_avg(logkey_commit_lat);
+  mon_logtype.add_avg(logkey_updates);
+
   dout(10) << "init" << dendl;
 }
 
@@ -169,15 +187,17 @@ void Paxos::handle_last(MMonPaxos *last)
 
   // did we receive a committed value?
   if (last->last_committed > last_committed) {
+    MonitorStore::Transaction t;
     for (version_t v = last_committed+1;
 	 v <= last->last_committed;
 	 v++) {
-      mon->store->put_bl_sn(last->values[v], machine_name, v);
+      t.put_bl_sn(last->values[v], machine_name, v);
       dout(10) << "committing " << v << " " 
 	       << last->values[v].length() << " bytes" << dendl;
     }
     last_committed = last->last_committed;
-    mon->store->put_int(last_committed, machine_name, "last_committed");
+    t.put_int(last_committed, machine_name, "last_committed");
+    mon->store->apply_transaction(t);
     dout(10) << "last_committed now " << last_committed << dendl;
   }
       
@@ -250,14 +270,18 @@ void Paxos::begin(bufferlist& v)
   assert(new_value.length() == 0);
   
   // accept it ourselves
+  set<int>& accepted = accepting[last_committed+1];
   accepted.clear();
   accepted.insert(whoami);
   new_value = v;
-  mon->store->put_bl_sn(new_value, machine_name, last_committed+1);
+  begin_stamp = g_clock.now();
+  MonitorStore::Transaction t;
+  t.put_bl_sn(new_value, machine_name, last_committed+1);
 
   if (mon->get_quorum().size() == 1) {
-    // we're alone, take it easy
-    commit();
+    // we're alone, take it easy: the value and its commit go together
+    accepting.erase(last_committed+1);
+    commit(&t);
     state = STATE_ACTIVE;
     finish_contexts(waiting_for_active);
     finish_contexts(waiting_for_commit);
@@ -265,6 +289,7 @@ void Paxos::begin(bufferlist& v)
     finish_contexts(waiting_for_writeable);
     return;
   }
+  mon->store->apply_transaction(t);
 
   // ask others to accept it to!
   for (set<int>::const_iterator p = mon->get_quorum().begin();
@@ -281,9 +306,9 @@ void Paxos::begin(bufferlist& v)
     mon->messenger->send_message(begin, mon->monmap->get_inst(*p));
   }
 
-  // set timeout event
-  accept_timeout_event = new C_AcceptTimeout(this);
-  mon->timer.add_event_after(g_conf.mon_accept_timeout, accept_timeout_event);
+  // set timeout event, unless we're already waiting on an earlier value
+  if (!accept_timeout_event)
+    reset_accept_timeout();
 }
 
 // peon
@@ -307,7 +332,9 @@ void Paxos::handle_begin(MMonPaxos *begin)
   // yes.
   version_t v = last_committed+1;
   dout(10) << "accepting value for " << v << " pn " << accepted_pn << dendl;
-  mon->store->put_bl_sn(begin->values[v], machine_name, v);
+  MonitorStore::Transaction t;
+  t.put_bl_sn(begin->values[v], machine_name, v);
+  mon->store->apply_transaction(t);
   
   // reply
   MMonPaxos *accept = new MMonPaxos(mon->get_epoch(), MMonPaxos::OP_ACCEPT, machine_id);
@@ -330,45 +357,52 @@ void Paxos::handle_accept(MMonPaxos *accept)
     delete accept;
     return;
   }
-  if (last_committed > 0 &&
-      accept->last_committed < last_committed-1) {
-    dout(10) << " this is from an old round, ignoring" << dendl;
+
+  // which value?  the peon accepts v on top of v-1.
+  version_t v = accept->last_committed+1;
+  if (accepting.count(v) == 0) {
+    dout(10) << " " << v << " is from an old round, ignoring" << dendl;
     delete accept;
     return;
   }
-  assert(accept->last_committed == last_committed ||   // not committed
-	 accept->last_committed == last_committed-1);  // committed
 
-  assert(state == STATE_UPDATING);
+  set<int>& accepted = accepting[v];
   assert(accepted.count(from) == 0);
   accepted.insert(from);
-  dout(10) << " now " << accepted << " have accepted" << dendl;
+  dout(10) << " now " << accepted << " have accepted " << v << dendl;
 
   // new majority?
-  if (accepted.size() == (unsigned)mon->monmap->size()/2+1) {
+  if (v == last_committed+1 &&
+      accepted.size() == (unsigned)mon->monmap->size()/2+1) {
     // yay, commit!
-    // note: this may happen before the lease is reextended (below)
+    assert(state == STATE_UPDATING);
     dout(10) << " got majority, committing" << dendl;
     commit();
-  }
-
-  // done?
-  if (accepted == mon->get_quorum()) {
-    dout(10) << " got quorum, done with update" << dendl;
-    // cancel timeout event
-    mon->timer.cancel_event(accept_timeout_event);
-    accept_timeout_event = 0;
 
-    // yay!
+    // the value is safe; stragglers will learn it from the commit, so
+    // don't wait for their accepts before moving on.
     state = STATE_ACTIVE;
     extend_lease();
-  
+
     // wake people up
     finish_contexts(waiting_for_active);
     finish_contexts(waiting_for_commit);
     finish_contexts(waiting_for_readable);
-    finish_contexts(waiting_for_writeable);
   }
+
+  // done?
+  if (accepted == mon->get_quorum()) {
+    dout(10) << " got quorum, done with " << v << dendl;
+    accepting.erase(v);
+  }
+
+  // progress; push the timeout back, or cancel it if nothing is outstanding
+  reset_accept_timeout();
+
+  if (is_writeable())
+    finish_contexts(waiting_for_writeable);
+
+  delete accept;
 }
 
 void Paxos::accept_timeout()
@@ -376,18 +410,45 @@ void Paxos::accept_timeout()
   dout(5) << "accept timeout, calling fresh election" << dendl;
   accept_timeout_event = 0;
   assert(mon->is_leader());
-  assert(is_updating());
   cancel_events();
   mon->call_election();
 }
 
-void Paxos::commit()
+void Paxos::reset_accept_timeout()
+{
+  if (accept_timeout_event) {
+    mon->timer.cancel_event(accept_timeout_event);
+    accept_timeout_event = 0;
+  }
+  if (accepting.empty())
+    return;
+  dout(15) << "reset_accept_timeout waiting on " << accepting.size() << " values" << dendl;
+  accept_timeout_event = new C_AcceptTimeout(this);
+  mon->timer.add_event_after(g_conf.mon_accept_timeout, accept_timeout_event);
+}
+
+/*
+ * t, if any, has more writes (begin's value, when we're alone) to go
+ * down with last_committed.
+ */
+void Paxos::commit(MonitorStore::Transaction *t)
 {
   dout(10) << "commit " << last_committed+1 << dendl;
 
   // commit locally
   last_committed++;
-  mon->store->put_int(last_committed, machine_name, "last_committed");
+  MonitorStore::Transaction mine;
+  if (!t)
+    t = &mine;
+  t->put_int(last_committed, machine_name, "last_committed");
+  mon->store->apply_transaction(*t);
+
+  if (mon->logger) {
+    utime_t lat = g_clock.now();
+    lat -= begin_stamp;
+    mon->logger->inc(logkey_commit);
+    mon->logger->favg(logkey_commit_lat, (double)lat);
+  }
 
   // tell everyone
   for (set<int>::const_iterator p = mon->get_quorum().begin();
@@ -420,15 +481,17 @@ void Paxos::handle_commit(MMonPaxos *commit)
   }
 
   // commit locally.
+  MonitorStore::Transaction t;
   for (map<version_t,bufferlist>::iterator p = commit->values.begin();
        p != commit->values.end();
        ++p) {
     assert(p->first == last_committed+1);
     last_committed = p->first;
     dout(10) << " storing " << last_committed << " (" << p->second.length() << " bytes)" << dendl;
-    mon->store->put_bl_sn(p->second, machine_name, last_committed);
+    t.put_bl_sn(p->second, machine_name, last_committed);
   }
-  mon->store->put_int(last_committed, machine_name, "last_committed");
+  t.put_int(last_committed, machine_name, "last_committed");
+  mon->store->apply_transaction(t);
   
   delete commit;
 }
@@ -598,6 +661,11 @@ void Paxos::cancel_events()
     mon->timer.cancel_event(accept_timeout_event);
     accept_timeout_event = 0;
   }
+  cancel_lease_events();
+}
+
+void Paxos::cancel_lease_events()
+{
   if (lease_renew_event) {
     mon->timer.cancel_event(lease_renew_event);
     lease_renew_event = 0;
@@ -619,6 +687,7 @@ void Paxos::leader_init()
     return;
   } 
   cancel_events();
+  accepting.clear();
   state = STATE_RECOVERING;
   lease_expire = utime_t();
   dout(10) << "leader_init -- starting paxos recovery" << dendl;
@@ -628,6 +697,7 @@ void Paxos::leader_init()
 void Paxos::peon_init()
 {
   cancel_events();
+  accepting.clear();
   state = STATE_RECOVERING;
   lease_expire = utime_t();
   dout(10) << "peon_init -- i am a peon" << dendl;
@@ -642,6 +712,7 @@ void Paxos::election_starting()
   dout(10) << "election_starting -- canceling timeouts" << dendl;
   cancel_events();
   new_value.clear();
+  accepting.clear();
 
   finish_contexts(waiting_for_commit, -1);
 }
@@ -750,7 +821,8 @@ bool Paxos::is_writeable()
   return
     mon->is_leader() &&
     is_active() &&
-    g_clock.now() < lease_expire;
+    g_clock.now() < lease_expire &&
+    accepting.size() < (unsigned)g_conf.paxos_pipeline_window;
 }
 
 bool Paxos::propose_new_value(bufferlist& bl, Context *oncommit)
@@ -770,8 +842,9 @@ bool Paxos::propose_new_value(bufferlist& bl, Context *oncommit)
   
   assert(mon->is_leader() && is_active());
 
-  // cancel lease renewal and timeout events.
-  cancel_events();
+  // cancel lease renewal and timeout events.  leave the accept timeout
+  // alone; earlier values may still be waiting on stragglers.
+  cancel_lease_events();
 
   // ok!
   dout(5) << "propose_new_value " << last_committed+1 << " " << bl.length() << " bytes" << dendl;
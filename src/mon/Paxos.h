@@ -38,7 +38,10 @@ e 12v
 
 /*
  * NOTE: This libary is based on the Paxos algorithm, but varies in a few key ways:
- *  1- Only a single new value is generated at a time, simplifying the recovery logic.
+ *  1- Only a single new value is uncommitted at a time, simplifying the recovery logic.
+ *     The leader does begin the next value as soon as the previous one commits
+ *     (at a majority), without waiting for stragglers to accept it; at most
+ *     paxos_pipeline_window values may be waiting on stragglers.
  *  2- Nodes track "committed" values, and share them generously (and trustingly)
  *  3- A 'leasing' mechism is built-in, allowing nodes to determine when it is safe to 
  *     "read" their copy of the last committed value.
@@ -54,6 +57,7 @@ e 12v
 #include "mon_types.h"
 #include "include/buffer.h"
 #include "msg/Message.h"
+#include "MonitorStore.h"
 
 #include "include/Context.h"
 
@@ -126,10 +130,14 @@ private:
 
   // updating (paxos phase 2)
   bufferlist new_value;
-  set<int>   accepted;
+  utime_t    begin_stamp;   // when new_value was begun
+  map<version_t, set<int> > accepting;  // begun, but not yet accepted by the whole quorum
 
   Context    *accept_timeout_event;
 
+  // log keys
+  const char *logkey_commit, *logkey_commit_lat, *logkey_updates;
+
   list<Context*> waiting_for_writeable;
   list<Context*> waiting_for_commit;
 
@@ -178,7 +186,8 @@ private:
   void handle_begin(MMonPaxos*);
   void handle_accept(MMonPaxos*);
   void accept_timeout();
-  void commit();
+  void reset_accept_timeout();
+  void commit(MonitorStore::Transaction *t=0);
   void handle_commit(MMonPaxos*);
   void extend_lease();
   void handle_lease(MMonPaxos*);
@@ -188,6 +197,7 @@ private:
   void lease_renew_timeout();  // on leader, to renew the lease
   void lease_timeout();        // on peon, if lease isn't extended
 
+  void cancel_lease_events();
   void cancel_events();
 
   version_t get_new_proposal_number(version_t gt=0);
@@ -201,7 +211,8 @@ public:
 		   lease_renew_event(0),
 		   lease_ack_timeout_event(0),
 		   lease_timeout_event(0),
-		   accept_timeout_event(0) { }
+		   accept_timeout_event(0),
+		   logkey_commit(0), logkey_commit_lat(0), logkey_updates(0) { }
 
   void dispatch(Message *m);
 
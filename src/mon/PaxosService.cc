@@ -16,11 +16,13 @@
 #include "common/Clock.h"
 #include "Monitor.h"
 
+#include "common/Logger.h"
+
 
 
 #include "config.h"
 
-#define  dout(l) if (l<=g_conf.debug || l<=g_conf.debug_paxos) *_dout << dbeginl << g_clock.now() << " mon" << mon->whoami << (mon->is_starting() ? (const char*)"(starting)":(mon->is_leader() ? (const char*)"(leader)":(mon->is_peon() ? (const char*)"(peon)":(const char*)"(?\?)"))) << ".paxosservice(" << get_paxos_name(paxos->machine_id) << ") "
+#define  dout(l) dout_if(l, l<=g_conf.debug || l<=g_conf.debug_paxos) << g_clock.now() << " mon" << mon->whoami << (mon->is_starting() ? (const char*)"(starting)":(mon->is_leader() ? (const char*)"(leader)":(mon->is_peon() ? (const char*)"(peon)":(const char*)"(?\?)"))) << ".paxosservice(" << get_paxos_name(paxos->machine_id) << ") "
 
 
 
@@ -54,39 +56,65 @@ void PaxosService::dispatch(Message *m)
   // writeable?
   if (!paxos->is_writeable()) {
     dout(10) << " waiting for paxos -> writeable" << dendl;
-    paxos->wait_for_writeable(new C_RetryMessage(this, m));
+    num_waiting_for_writeable++;
+    paxos->wait_for_writeable(new C_RetryUpdate(this, m));
     return;
   }
 
   // update
   if (prepare_update(m)) {
-    double delay;
-    if (should_propose(delay)) {
-      if (delay == 0.0) {
-	propose_pending();
-      } else {
-	// delay a bit
-	if (!proposal_timer) {
-	  dout(10) << " setting propose timer with dealy of " << delay << dendl;
-	  proposal_timer = new C_Propose(this);
-	  mon->timer.add_event_after(delay, proposal_timer);
-	} else { 
-	  dout(10) << " propose timer already set" << dendl;
-	}
-      }
-    } else {
-      dout(10) << " not proposing" << dendl;
+    pending_updates++;
+
+    // if more updates are about to be retried (paxos just became
+    // writeable), let them land in this pending first.
+    if (num_waiting_for_writeable) {
+      dout(10) << " " << num_waiting_for_writeable << " more updates queued, holding proposal" << dendl;
+      return;
     }
+    maybe_propose();
   }     
 }
 
+void PaxosService::maybe_propose()
+{
+  if (!mon->is_leader() ||
+      !have_pending ||
+      !pending_updates ||
+      proposal_timer ||
+      !paxos->is_writeable())
+    return;
+
+  double delay;
+  if (should_propose(delay)) {
+    if (delay == 0.0) {
+      propose_pending();
+    } else {
+      // delay a bit
+      dout(10) << " setting propose timer with delay of " << delay << dendl;
+      proposal_timer = new C_Propose(this);
+      mon->timer.add_event_after(delay, proposal_timer);
+    }
+  } else {
+    dout(10) << " not proposing" << dendl;
+  }
+}
+
 bool PaxosService::should_propose(double& delay)
 {
-  // simple default policy: quick startup, then some damping.
-  if (paxos->last_committed <= 1)
-    delay = 0.0;
-  else
-    delay = g_conf.paxos_propose_interval;
+  // simple default policy: quick startup, then at most one proposal per
+  // paxos_propose_interval.  an update that arrives after a quiet spell
+  // goes out right away; during a storm everything that arrives within
+  // the interval is folded into the same epoch.
+  delay = 0.0;
+  if (paxos->last_committed > 1) {
+    utime_t next = last_propose;
+    next += g_conf.paxos_propose_interval;
+    utime_t now = g_clock.now();
+    if (now < next) {
+      next -= now;
+      delay = (double)next;
+    }
+  }
   return true;
 }
 
@@ -121,6 +149,12 @@ void PaxosService::propose_pending()
   encode_pending(bl);
   have_pending = false;
 
+  dout(10) << "propose_pending " << pending_updates << " updates" << dendl;
+  if (mon->logger)
+    mon->logger->favg(paxos->logkey_updates, pending_updates);
+  pending_updates = 0;
+  last_propose = g_clock.now();
+
   // apply to paxos
   paxos->wait_for_commit_front(new C_Commit(this));
   paxos->propose_new_value(bl);
@@ -137,6 +171,7 @@ void PaxosService::election_finished()
       !mon->is_leader()) {
     discard_pending();
     have_pending = false;
+    pending_updates = 0;
   }
 
   // make sure we update our state
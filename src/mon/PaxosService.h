@@ -35,6 +35,19 @@ protected:
       svc->dispatch(m);
     }
   };
+  class C_RetryUpdate : public Context {
+    PaxosService *svc;
+    Message *m;
+  public:
+    C_RetryUpdate(PaxosService *s, Message *m_) : svc(s), m(m_) {}
+    void finish(int r) {
+      svc->num_waiting_for_writeable--;
+      svc->dispatch(m);
+      if (svc->num_waiting_for_writeable == 0)
+	svc->maybe_propose();
+    }
+  };
+  friend class C_RetryUpdate;
   class C_Active : public Context {
     PaxosService *svc;
   public:
@@ -71,10 +84,16 @@ private:
   Context *proposal_timer;
   bool have_pending;
 
+  int pending_updates;            // updates folded into the current pending
+  int num_waiting_for_writeable;  // updates parked until paxos is writeable
+  utime_t last_propose;
+
 public:
   PaxosService(Monitor *mn, Paxos *p) : mon(mn), paxos(p),
 					proposal_timer(0),
-					have_pending(false) { }
+					have_pending(false),
+					pending_updates(0),
+					num_waiting_for_writeable(0) { }
   
   // i implement and you ignore
   void dispatch(Message *m);
@@ -83,6 +102,7 @@ public:
 private:
   void _active();
   void _commit();
+  void maybe_propose();
 
 public:
   // i implement and you use
@@ -27,6 +27,13 @@ class Dispatcher {
   // how i receive messages
   virtual void dispatch(Message *m) = 0;
 
+  /*
+   * called by the messenger as soon as a message arrives, from whatever
+   * thread read it, before it's queued for dispatch().  return true if
+   * you took care of it (and freed it).  don't block.
+   */
+  virtual bool ms_fast_dispatch(Message *m) { return false; }
+
   // how i deal with transmission failures.
   virtual void ms_handle_failure(Message *m, const entity_inst_t& inst) { delete m; }
 
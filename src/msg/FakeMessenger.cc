@@ -25,7 +25,7 @@
 
 #include "config.h"
 
-#define dout(x) if ((x) <= g_conf.debug_ms) *_dout << dbeginl << g_clock.now() << " "
+#define dout(x) dout_if(x, (x) <= g_conf.debug_ms) << g_clock.now() << " "
 
 
 
@@ -234,7 +234,8 @@ int fakemessenger_do_loop_2()
         didone = true;
 
         lock.Unlock();
-        mgr->dispatch(m);
+	if (!mgr->get_dispatcher()->ms_fast_dispatch(m))
+	  mgr->dispatch(m);
         lock.Lock();
       }
     }
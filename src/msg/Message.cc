@@ -53,6 +53,7 @@ using namespace std;
 #include "messages/MClientRequestForward.h"
 #include "messages/MClientReply.h"
 #include "messages/MClientFileCaps.h"
+#include "messages/MClientFileCapsBatch.h"
 
 #include "messages/MMDSSlaveRequest.h"
 
@@ -100,7 +101,7 @@ using namespace std;
 
 #include "config.h"
 
-#define dout(l)    if (l<=g_conf.debug) *_dout << dbeginl << g_clock.now() << " MESSENGER: "
+#define dout(l)    dout_if(l, l<=g_conf.debug) << g_clock.now() << " MESSENGER: "
 #define DEBUGLVL  10    // debug level of output
 
 
@@ -231,6 +232,9 @@ decode_message(ceph_msg_header& env, bufferlist& front, bufferlist& data)
   case CEPH_MSG_CLIENT_FILECAPS:
     m = new MClientFileCaps;
     break;
+  case CEPH_MSG_CLIENT_FILECAPS_BATCH:
+    m = new MClientFileCapsBatch;
+    break;
 
     // mds
   case MSG_MDS_SLAVE_REQUEST:
@@ -35,8 +35,8 @@
 
 #include "common/Timer.h"
 
-#define dout(l)  if (l<=g_conf.debug_ms) *_dout << dbeginl << g_clock.now() << " " << pthread_self() << " -- " << rank.rank_addr << " "
-#define derr(l)  if (l<=g_conf.debug_ms) *_derr << dbeginl << g_clock.now() << " " << pthread_self() << " -- " << rank.rank_addr << " "
+#define dout(l)  dout_if(l, l<=g_conf.debug_ms) << g_clock.now() << " " << pthread_self() << " -- " << rank.rank_addr << " "
+#define derr(l)  derr_if(l, l<=g_conf.debug_ms) << g_clock.now() << " " << pthread_self() << " -- " << rank.rank_addr << " "
 
 
 
@@ -728,8 +728,8 @@ void Rank::mark_down(entity_addr_t addr)
 
 #undef dout
 #undef derr
-#define dout(l)  if (l<=g_conf.debug_ms) *_dout << dbeginl << g_clock.now() << " " << pthread_self() << " -- " << rank.rank_addr << " >> " << peer_addr << " pipe(" << this << ")."
-#define derr(l)  if (l<=g_conf.debug_ms) *_derr << dbeginl << g_clock.now() << " " << pthread_self() << " -- " << rank.rank_addr << " >> " << peer_addr << " pipe(" << this << ")."
+#define dout(l)  dout_if(l, l<=g_conf.debug_ms) << g_clock.now() << " " << pthread_self() << " -- " << rank.rank_addr << " >> " << peer_addr << " pipe(" << this << ")."
+#define derr(l)  derr_if(l, l<=g_conf.debug_ms) << g_clock.now() << " " << pthread_self() << " -- " << rank.rank_addr << " >> " << peer_addr << " pipe(" << this << ")."
 
 /*
  * we have to be careful about connection races:
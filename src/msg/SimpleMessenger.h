@@ -232,6 +232,9 @@ private:
     void queue_message(Message *m) {
       // set recv stamp
       m->set_recv_stamp(g_clock.now());
+
+      if (get_dispatcher() && get_dispatcher()->ms_fast_dispatch(m))
+	return;
       
       lock.Lock();
       if (m->get_source().is_mon()) {
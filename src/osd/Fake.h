@@ -179,9 +179,11 @@ class FakeStoreAttrs {
     faker_lock.Unlock();
     return r;
   }
-  int setattrs(pobject_t oid, map<string,bufferptr>& aset) {
+  int setattrs(pobject_t oid, map<string,bufferptr>& aset,
+	       Context *onsafe=0) {
     faker_lock.Lock();
     int r = fakeoattrs[oid].setattrs(aset);
+    if (onsafe) store->sync(onsafe);
     faker_lock.Unlock();
     return r;
   }
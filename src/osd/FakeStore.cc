@@ -25,6 +25,9 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <limits.h>
 #include <iostream>
 #include <cassert>
 #include <errno.h>
@@ -41,14 +44,23 @@
 
 #include "config.h"
 
-#define  dout(l)    if (l<=g_conf.debug) *_dout << dbeginl << g_clock.now() << " fakestore(" << basedir << ") "
-#define  derr(l)    if (l<=g_conf.debug) *_derr << dbeginl << g_clock.now() << " fakestore(" << basedir << ") "
+#define  dout(l)    dout_if(l, l<=g_conf.debug) << g_clock.now() << " fakestore(" << basedir << ") "
+#define  derr(l)    derr_if(l, l<=g_conf.debug) << g_clock.now() << " fakestore(" << basedir << ") "
 
 #include "include/buffer.h"
 
 #include <map>
 
 
+#ifndef IOV_MAX
+# define IOV_MAX 1024
+#endif
+
+#ifdef DARWIN
+# define fdatasync fsync
+#endif
+
+
 // crap-a-crap hash
 //#define HASH_DIRS       0x80
 //#define HASH_MASK       0x7f
@@ -97,7 +109,7 @@ pobject_t FakeStore::parse_object(char *s)
   *(((uint64_t*)&o.oid) + 0) = strtoll(s+10, 0, 16);
   assert(s[26] == '.');
   *(((uint64_t*)&o.oid) + 1) = strtoll(s+27, 0, 16);
-  dout(0) << " got " << o << " errno " << errno << " on " << s << dendl;
+  dout(20) << " got " << o << " errno " << errno << " on " << s << dendl;
   return o;
 }
 
@@ -148,6 +160,8 @@ int FakeStore::mkfs()
 
   dout(1) << "mkfs in " << basedir << dendl;
 
+  close_all_fds();
+
   // wipe
   sprintf(cmd, "test -d %s && rm -r %s ; mkdir -p %s/collections && mkdir -p %s/objects",
 	  basedir.c_str(), basedir.c_str(), basedir.c_str(), basedir.c_str());
@@ -225,6 +239,17 @@ int FakeStore::mount()
   }
 #endif
 
+  // commits
+  if (g_conf.fakestore_fake_sync == 0.0) {
+    basedir_fd = ::open(basedir.c_str(), O_RDONLY);
+    if (basedir_fd < 0) {
+      derr(0) << "unable to open basedir " << basedir << ", " << strerror(errno) << dendl;
+      return -errno;
+    }
+    sync_stop = false;
+    sync_thread.create();
+  }
+
   // all okay.
   return 0;
 }
@@ -235,6 +260,17 @@ int FakeStore::umount()
   
   sync();
 
+  if (basedir_fd >= 0) {
+    synclock.Lock();
+    sync_stop = true;
+    commit_cond.Signal();
+    synclock.Unlock();
+    sync_thread.join();
+    ::close(basedir_fd);
+    basedir_fd = -1;
+  }
+  close_all_fds();
+
   if (g_conf.fakestore_dev) {
     char cmd[100];
     dout(0) << "umounting" << dendl;
@@ -273,12 +309,111 @@ int FakeStore::stat(pobject_t oid,
  
  
 
+/*
+ * open fds
+ */
+
+int FakeStore::get_fd(pobject_t oid, bool create)
+{
+  Mutex::Locker lock(fd_lock);
+  hash_map<pobject_t,OpenFile>::iterator p = open_files.find(oid);
+  if (p != open_files.end()) {
+    p->second.ref++;
+    fd_lru.splice(fd_lru.begin(), fd_lru, p->second.lru_pos);
+    return p->second.fd;
+  }
+
+  // open under fd_lock, so that a remove can't unlink the file between
+  // our open and our insert and leave the dead inode in the cache.
+  char fn[200];
+  get_oname(oid, fn);
+  int fd = ::open(fn, create ? (O_RDWR|O_CREAT) : O_RDWR, 0644);
+  if (fd < 0) {
+    int r = -errno;
+    dout(10) << "get_fd couldn't open " << fn << " " << strerror(errno) << dendl;
+    return r;
+  }
+
+  OpenFile& of = open_files[oid];
+  of.fd = fd;
+  of.ref = 1;
+  fd_lru.push_front(oid);
+  of.lru_pos = fd_lru.begin();
+  return fd;
+}
+
+void FakeStore::put_fd(pobject_t oid, int fd)
+{
+  fd_lock.Lock();
+  hash_map<pobject_t,OpenFile>::iterator p = open_files.find(oid);
+  if (p != open_files.end() && p->second.fd == fd) {
+    assert(p->second.ref > 0);
+    p->second.ref--;
+    trim_fds();
+  } else {
+    // removed while we had it open
+    assert(closing.count(fd));
+    if (--closing[fd] == 0) {
+      ::close(fd);
+      closing.erase(fd);
+    }
+  }
+  fd_lock.Unlock();
+}
+
+// with fd_lock
+void FakeStore::trim_fds()
+{
+  list<pobject_t>::iterator p = fd_lru.end();
+  while ((int)open_files.size() > g_conf.fakestore_fd_cache_size &&
+	 p != fd_lru.begin()) {
+    p--;
+    OpenFile& of = open_files[*p];
+    if (of.ref) continue;
+    ::close(of.fd);
+    open_files.erase(*p);
+    p = fd_lru.erase(p);
+  }
+}
+
+// with fd_lock
+void FakeStore::close_fd(pobject_t oid)
+{
+  hash_map<pobject_t,OpenFile>::iterator p = open_files.find(oid);
+  if (p != open_files.end()) {
+    if (p->second.ref)
+      closing[p->second.fd] = p->second.ref;
+    else
+      ::close(p->second.fd);
+    fd_lru.erase(p->second.lru_pos);
+    open_files.erase(p);
+  }
+}
+
+void FakeStore::close_all_fds()
+{
+  fd_lock.Lock();
+  for (hash_map<pobject_t,OpenFile>::iterator p = open_files.begin();
+       p != open_files.end();
+       p++) {
+    assert(p->second.ref == 0);
+    ::close(p->second.fd);
+  }
+  open_files.clear();
+  fd_lru.clear();
+  fd_lock.Unlock();
+}
+
+
 int FakeStore::remove(pobject_t oid, Context *onsafe) 
 {
   dout(20) << "remove " << oid << dendl;
   char fn[200];
   get_oname(oid,fn);
+  fd_lock.Lock();
+  close_fd(oid);
   int r = ::unlink(fn);
+  fd_lock.Unlock();
   if (onsafe) sync(onsafe);
   return r;
 }
@@ -287,9 +422,12 @@ int FakeStore::truncate(pobject_t oid, off_t size, Context *onsafe)
 {
   dout(20) << "truncate " << oid << " size " << size << dendl;
 
-  char fn[200];
-  get_oname(oid,fn);
-  int r = ::truncate(fn, size);
+  int fd = get_fd(oid, false);
+  if (fd < 0)
+    return fd;
+  int r = ::ftruncate(fd, size);
+  put_fd(oid, fd);
+  mark_dirty(oid);
   if (onsafe) sync(onsafe);
   return r;
 }
@@ -299,33 +437,34 @@ int FakeStore::read(pobject_t oid,
                     bufferlist& bl) {
   dout(20) << "read " << oid << " len " << len << " off " << offset << dendl;
 
-  char fn[200];
-  get_oname(oid,fn);
-  
-  int fd = ::open(fn, O_RDONLY);
-  if (fd < 0) {
-    dout(10) << "read couldn't open " << fn << " errno " << errno << " " << strerror(errno) << dendl;
+  int fd = get_fd(oid, false);
+  if (fd < 0)
     return fd;
-  }
-  ::flock(fd, LOCK_EX);    // lock for safety
-  
-  off_t actual = lseek(fd, offset, SEEK_SET);
-  size_t got = 0;
 
   if (len == 0) {
     struct stat st;
     ::fstat(fd, &st);
-    len = st.st_size;
+    len = st.st_size > offset ? st.st_size - offset : 0;
   }
 
-  if (actual == offset) {
-    bufferptr bptr(len);  // prealloc space for entire read
-    got = ::read(fd, bptr.c_str(), len);
-    bptr.set_length(got);   // properly size the buffer
-    if (got > 0) bl.push_back( bptr );   // put it in the target bufferlist
+  bufferptr bptr(len);  // prealloc space for entire read
+  size_t got = 0;
+  while (got < len) {
+    ssize_t r = ::pread(fd, bptr.c_str() + got, len - got, offset + got);
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      r = -errno;
+      derr(0) << "read " << oid << " " << offset << "~" << len << " " << strerror(errno) << dendl;
+      put_fd(oid, fd);
+      return r;
+    }
+    if (r == 0) break;    // eof
+    got += r;
   }
-  ::flock(fd, LOCK_UN);
-  ::close(fd);
+  put_fd(oid, fd);
+
+  bptr.set_length(got);   // properly size the buffer
+  if (got > 0) bl.push_back( bptr );   // put it in the target bufferlist
   return got;
 }
 
@@ -335,50 +474,65 @@ int FakeStore::write(pobject_t oid,
                      const bufferlist& bl, 
                      Context *onsafe)
 {
-  char fn[200];
-  get_oname(oid,fn);
-
-  dout(20) << "write " << fn << " len " << len << " off " << offset << dendl;
-
-  
-  ::mknod(fn, 0644, 0);  // in case it doesn't exist yet.
+  dout(20) << "write " << oid << " len " << len << " off " << offset << dendl;
 
-  int flags = O_WRONLY;//|O_CREAT;
-  int fd = ::open(fn, flags);
+  int fd = get_fd(oid, true);
   if (fd < 0) {
-    derr(0) << "write couldn't open " << fn << " flags " << flags << " errno " << errno << " " << strerror(errno) << dendl;
+    derr(0) << "write couldn't open " << oid << " " << strerror(-fd) << dendl;
     return fd;
   }
-  ::fchmod(fd, 0664);
-  ::flock(fd, LOCK_EX);    // lock for safety
-  
-  // seek
-  off_t actual = ::lseek(fd, offset, SEEK_SET);
+
+  // write straight out of the bufferlist, IOV_MAX segments at a time.
   int did = 0;
-  assert(actual == offset);
-
-  // write buffers
-  for (list<bufferptr>::const_iterator it = bl.buffers().begin();
-       it != bl.buffers().end();
-       it++) {
-    int r = ::write(fd, (char*)(*it).c_str(), (*it).length());
-    if (r > 0)
+  off_t pos = offset;
+  list<bufferptr>::const_iterator it = bl.buffers().begin();
+  while (it != bl.buffers().end()) {
+    struct iovec iov[IOV_MAX];
+    int n = 0;
+    size_t left = 0;
+    for (; it != bl.buffers().end() && n < IOV_MAX; it++) {
+      if ((*it).length() == 0) continue;
+      iov[n].iov_base = (void*)(*it).c_str();
+      iov[n].iov_len = (*it).length();
+      left += iov[n].iov_len;
+      n++;
+    }
+
+    struct iovec *v = iov;
+    while (left > 0) {
+#ifdef DARWIN
+      ssize_t r = ::pwrite(fd, v->iov_base, v->iov_len, pos);
+#else
+      ssize_t r = ::pwritev(fd, v, n, pos);
+#endif
+      if (r < 0) {
+	if (errno == EINTR) continue;
+	r = -errno;
+	derr(0) << "couldn't write to " << oid << " len " << len << " off " << offset 
+		<< " errno " << errno << " " << strerror(errno) << dendl;
+	put_fd(oid, fd);
+	return r;
+      }
+      pos += r;
       did += r;
-    else {
-      derr(0) << "couldn't write to " << fn << " len " << len << " off " << offset << " errno " << errno << " " << strerror(errno) << dendl;
+      left -= r;
+      // skip what we wrote; a short write may end mid-segment
+      while (r > 0 && (size_t)r >= v->iov_len) {
+	r -= v->iov_len;
+	v++;
+	n--;
+      }
+      if (r > 0) {
+	v->iov_base = (char*)v->iov_base + r;
+	v->iov_len -= r;
+      }
     }
   }
-  
-  if (did < 0) {
-    derr(0) << "couldn't write to " << fn << " len " << len << " off " << offset << " errno " << errno << " " << strerror(errno) << dendl;
-  }
-
-  ::flock(fd, LOCK_UN);
+  put_fd(oid, fd);
+  mark_dirty(oid);
 
   // schedule sync
   if (onsafe) sync(onsafe);
-
-  ::close(fd);
   
   return did;
 }
@@ -400,6 +554,7 @@ public:
   }
   void finish(int r) {
     c->finish(r);
+    delete c;
     
     lock->Lock();
     --(*n);
@@ -411,9 +566,19 @@ public:
 void FakeStore::sync()
 {
   synclock.Lock();
-  while (unsync > 0) {
-    dout(0) << "sync waiting for " << unsync << " items to (fake) sync" << dendl;
-    synccond.Wait(synclock);
+  if (basedir_fd >= 0) {
+    // wait for a commit that starts after now
+    version_t want = sync_epoch + 1;
+    dout(10) << "sync waiting for commit " << want << dendl;
+    commit_requested = true;
+    commit_cond.Signal();
+    while (committed_epoch < want)
+      synccond.Wait(synclock);
+  } else {
+    while (unsync > 0) {
+      dout(0) << "sync waiting for " << unsync << " items to (fake) sync" << dendl;
+      synccond.Wait(synclock);
+    }
   }
   synclock.Unlock();
 }
@@ -423,9 +588,79 @@ void FakeStore::sync(Context *onsafe)
   if (g_conf.fakestore_fake_sync > 0.0) {
     g_timer.add_event_after((float)g_conf.fakestore_fake_sync,
                             new C_FakeSync(onsafe, &unsync, &synclock, &synccond));
-    
   } else {
-    assert(0); // der..no implemented anymore
+    assert(basedir_fd >= 0);  // mounted
+    synclock.Lock();
+    sync_waiters.push_back(onsafe);
+    synclock.Unlock();
+  }
+}
+
+void FakeStore::sync_entry()
+{
+  synclock.Lock();
+  while (true) {
+    if (!sync_stop) {
+      int ms = g_conf.fakestore_commit_ms;
+      commit_cond.WaitInterval(synclock, utime_t(ms / 1000, (ms % 1000) * 1000));
+    }
+
+    version_t e = ++sync_epoch;
+    if (sync_waiters.empty() && dirty_objects.empty() && !commit_requested) {
+      committed_epoch = e;   // nothing to do
+    } else {
+      commit_requested = false;
+      list<Context*> ls;
+      ls.swap(sync_waiters);
+      set<pobject_t> dirty;
+      dirty.swap(dirty_objects);
+      synclock.Unlock();
+
+      utime_t start = g_clock.now();
+      do_commit(dirty);
+      dout(10) << "sync_entry committed " << e << ", " << ls.size() << " waiters, "
+	       << dirty.size() << " objects in " << (g_clock.now() - start) << dendl;
+      finish_contexts(ls, 0);
+
+      synclock.Lock();
+      committed_epoch = e;
+    }
+    synccond.Signal();
+
+    if (sync_stop)
+      break;
+  }
+  synclock.Unlock();
+}
+
+void FakeStore::do_commit(set<pobject_t>& dirty)
+{
+#ifdef SYS_syncfs
+  if (::syscall(SYS_syncfs, basedir_fd) == 0)
+    return;
+  dout(1) << "syncfs failed, " << strerror(errno) << ", falling back to fdatasync" << dendl;
+#endif
+
+  for (set<pobject_t>::iterator p = dirty.begin(); p != dirty.end(); p++) {
+    int fd = get_fd(*p, false);
+    if (fd < 0) continue;   // removed since
+    ::fdatasync(fd);
+    put_fd(*p, fd);
+  }
+
+  // and the directories, for creates, removes and links
+  char fn[200];
+  sprintf(fn, "%s/objects", basedir.c_str());
+  int fd = ::open(fn, O_RDONLY);
+  if (fd >= 0) {
+    ::fsync(fd);
+    ::close(fd);
+  }
+  sprintf(fn, "%s/collections", basedir.c_str());
+  fd = ::open(fn, O_RDONLY);
+  if (fd >= 0) {
+    ::fsync(fd);
+    ::close(fd);
   }
 }
 
@@ -447,12 +682,14 @@ int FakeStore::setattr(pobject_t oid, const char *name,
   get_oname(oid, fn);
   r = ::setxattr(fn, name, value, size, 0);
 #endif
+  if (onsafe) sync(onsafe);
   return r;
 }
 
-int FakeStore::setattrs(pobject_t oid, map<string,bufferptr>& aset) 
+int FakeStore::setattrs(pobject_t oid, map<string,bufferptr>& aset,
+			Context *onsafe) 
 {
-  if (fake_attrs) return attrs.setattrs(oid, aset);
+  if (fake_attrs) return attrs.setattrs(oid, aset, onsafe);
 
   char fn[100];
   get_oname(oid, fn);
@@ -468,6 +705,7 @@ int FakeStore::setattrs(pobject_t oid, map<string,bufferptr>& aset)
     }
   }
 #endif
+  if (onsafe) sync(onsafe);
   return r;
 }
 
@@ -517,6 +755,7 @@ int FakeStore::rmattr(pobject_t oid, const char *name, Context *onsafe)
   get_oname(oid, fn);
   r = ::removexattr(fn, name);
 #endif
+  if (onsafe) sync(onsafe);
   return r;
 }
 
@@ -538,6 +777,7 @@ int FakeStore::collection_setattr(coll_t c, const char *name,
 				  Context *onsafe) 
 {
   if (fake_attrs) return attrs.collection_setattr(c, name, value, size, onsafe);
+  if (onsafe) sync(onsafe);
   return 0;
 }
 
@@ -545,6 +785,7 @@ int FakeStore::collection_rmattr(coll_t c, const char *name,
 				 Context *onsafe) 
 {
   if (fake_attrs) return attrs.collection_rmattr(c, name, onsafe);
+  if (onsafe) sync(onsafe);
   return 0;
 }
 
@@ -619,6 +860,7 @@ int FakeStore::list_objects(list<pobject_t>& ls)
   while ((de = ::readdir(dir)) != 0) {
     if (de->d_name[0] == '.') continue;
     // parse
+    errno = 0;
     pobject_t o = parse_object(de->d_name);
     if (errno) continue;
     ls.push_back(o);
@@ -672,6 +914,7 @@ int FakeStore::destroy_collection(coll_t c,
 				  Context *onsafe) 
 {
   if (fake_collections) return collections.destroy_collection(c, onsafe);
+  list_ahead_drop(c);
 
   char fn[200];
   get_cdir(c, fn);
@@ -705,6 +948,7 @@ int FakeStore::collection_add(coll_t c, pobject_t o,
 			      Context *onsafe) 
 {
   if (fake_collections) return collections.collection_add(c, o, onsafe);
+  list_ahead_drop(c);
 
   char cof[200];
   get_coname(c, o, cof);
@@ -720,6 +964,7 @@ int FakeStore::collection_remove(coll_t c, pobject_t o,
 				 Context *onsafe) 
 {
   if (fake_collections) return collections.collection_remove(c, o, onsafe);
+  list_ahead_drop(c);
 
   char cof[200];
   get_coname(c, o, cof);
@@ -744,6 +989,7 @@ int FakeStore::collection_list(coll_t c, list<pobject_t>& ls)
     // parse
     if (de->d_name[0] == '.') continue;
     //cout << "  got object " << de->d_name << std::endl;
+    errno = 0;
     pobject_t o = parse_object(de->d_name);
     if (errno) continue;
     ls.push_back(o);
@@ -753,4 +999,81 @@ int FakeStore::collection_list(coll_t c, list<pobject_t>& ls)
   return 0;
 }
 
+/*
+ * scan the collection for the first max objects at or past from.
+ */
+void FakeStore::list_ahead_scan(coll_t c, pobject_t from, unsigned max)
+{
+  list_coll = c;
+  list_ahead.clear();
+  list_ahead_pos = 0;
+  list_ahead_end = true;
+
+  char fn[200];
+  get_cdir(c, fn);
+  DIR *dir = ::opendir(fn);
+  if (!dir)
+    return;
+
+  // keep one extra, to know where the next scan starts
+  set<pobject_t> first;
+  struct dirent *de;
+  while ((de = ::readdir(dir)) != 0) {
+    if (de->d_name[0] == '.') continue;
+    errno = 0;
+    pobject_t o = parse_object(de->d_name);
+    if (errno) continue;
+    if (o < from) continue;
+    if (first.size() == max + 1) {
+      set<pobject_t>::iterator last = first.end();
+      last--;
+      if (!(o < *last)) continue;
+      first.erase(last);
+    }
+    first.insert(o);
+  }
+  ::closedir(dir);
+
+  list_ahead_end = first.size() <= max;
+  list_ahead.assign(first.begin(), first.end());
+  dout(10) << "list_ahead_scan " << hex << c << dec << " from " << from 
+	   << " got " << list_ahead.size() << (list_ahead_end ? ", end":"") << dendl;
+}
+
+int FakeStore::collection_list_partial(coll_t c, ListCursor& cursor, int max, 
+				       vector<pobject_t>& ls)
+{
+  if (fake_collections) 
+    return ObjectStore::collection_list_partial(c, cursor, max, ls);
+
+  ls.clear();
+  if (cursor.end)
+    return 0;
+
+  list_lock.Lock();
+  
+  // can we pick up where the last piece left off?
+  unsigned avail = 0;
+  if (list_coll == c &&
+      list_ahead_pos < list_ahead.size() &&
+      list_ahead[list_ahead_pos] == cursor.next)
+    avail = list_ahead.size() - list_ahead_pos - (list_ahead_end ? 0:1);
+  if (avail < (unsigned)max && !(avail && list_ahead_end)) {
+    unsigned ahead = g_conf.fakestore_list_ahead;
+    list_ahead_scan(c, cursor.next, ahead > (unsigned)max ? ahead:max);
+    avail = list_ahead.size() - (list_ahead_end ? 0:1);
+  }
+
+  unsigned n = avail < (unsigned)max ? avail:max;
+  ls.assign(list_ahead.begin() + list_ahead_pos, list_ahead.begin() + list_ahead_pos + n);
+  list_ahead_pos += n;
+  if (list_ahead_pos < list_ahead.size())
+    cursor.next = list_ahead[list_ahead_pos];
+  else
+    cursor.end = true;
+
+  list_lock.Unlock();
+  return ls.size();
+}
+
 // eof.
@@ -19,6 +19,7 @@
 #include "ObjectStore.h"
 #include "common/ThreadPool.h"
 #include "common/Mutex.h"
+#include "common/Thread.h"
 
 #include "Fake.h"
 //#include "FakeStoreBDBCollections.h"
@@ -40,6 +41,82 @@ class FakeStore : public ObjectStore {
   Cond synccond;
   int unsync;
 
+  /*
+   * commits.  writes go to the page cache; every fakestore_commit_ms
+   * (or when someone waits in sync()) the sync thread makes everything
+   * durable with one syncfs() (or fdatasync on each dirty object, where
+   * we don't have it) and then completes the onsafe contexts that were
+   * queued before it started.
+   */
+  int basedir_fd;
+  bool sync_stop;
+  version_t sync_epoch, committed_epoch;
+  bool commit_requested;             // by sync()
+  Cond commit_cond;                  // kicks the sync thread
+  list<Context*> sync_waiters;       // onsafe, for the next commit
+  set<pobject_t> dirty_objects;      // only for the fdatasync fallback
+
+  void sync_entry();
+  void do_commit(set<pobject_t>& dirty);
+  void mark_dirty(pobject_t oid) {
+    synclock.Lock();
+    dirty_objects.insert(oid);
+    synclock.Unlock();
+  }
+
+  class SyncThread : public Thread {
+    FakeStore *fs;
+  public:
+    SyncThread(FakeStore *f) : fs(f) {}
+    void *entry() {
+      fs->sync_entry();
+      return 0;
+    }
+  } sync_thread;
+
+  /*
+   * open object fds, so that read/write don't open and close the file
+   * every time.  an fd in use (ref > 0) is never closed under the user;
+   * if the object is removed meanwhile it's moved to closing until the
+   * last put_fd().  a miss opens the file under fd_lock, and remove
+   * unlinks under it, so a cached fd is never for an unlinked file.
+   */
+  struct OpenFile {
+    int fd;
+    int ref;
+    list<pobject_t>::iterator lru_pos;
+  };
+  Mutex fd_lock;
+  hash_map<pobject_t, OpenFile> open_files;
+  list<pobject_t> fd_lru;            // front is most recent
+  map<int,int> closing;              // fd -> ref
+
+  int get_fd(pobject_t oid, bool create);
+  void put_fd(pobject_t oid, int fd);
+  void close_fd(pobject_t oid);
+  void trim_fds();
+  void close_all_fds();
+
+  /*
+   * partial listings.  the directory isn't sorted, so finding the next
+   * piece means a full scan; each scan keeps the next
+   * fakestore_list_ahead objects (sorted) so the following pieces come
+   * from here.  dropped when the collection changes.
+   */
+  Mutex list_lock;
+  coll_t list_coll;
+  vector<pobject_t> list_ahead;      // the last one is where to rescan, unless list_ahead_end
+  unsigned list_ahead_pos;
+  bool list_ahead_end;
+
+  void list_ahead_scan(coll_t c, pobject_t from, unsigned max);
+  void list_ahead_drop(coll_t c) {
+    list_lock.Lock();
+    if (list_coll == c)
+      list_ahead.clear();
+    list_lock.Unlock();
+  }
+
   // fake attrs?
   FakeStoreAttrs attrs;
   bool fake_attrs;
@@ -59,6 +136,10 @@ class FakeStore : public ObjectStore {
   FakeStore(const char *base) : 
     basedir(base),
     unsync(0),
+    basedir_fd(-1), sync_stop(false), sync_epoch(0), committed_epoch(0),
+    commit_requested(false),
+    sync_thread(this),
+    list_coll(0), list_ahead_pos(0), list_ahead_end(false),
     attrs(this), fake_attrs(false), 
     collections(this), fake_collections(false) { }
 
@@ -87,7 +168,7 @@ class FakeStore : public ObjectStore {
 
   // attrs
   int setattr(pobject_t oid, const char *name, const void *value, size_t size, Context *onsafe=0);
-  int setattrs(pobject_t oid, map<string,bufferptr>& aset);
+  int setattrs(pobject_t oid, map<string,bufferptr>& aset, Context *onsafe=0);
   int getattr(pobject_t oid, const char *name, void *value, size_t size);
   int getattrs(pobject_t oid, map<string,bufferptr>& aset);
   int rmattr(pobject_t oid, const char *name, Context *onsafe=0);
@@ -108,6 +189,7 @@ class FakeStore : public ObjectStore {
   int collection_add(coll_t c, pobject_t o, Context *onsafe=0);
   int collection_remove(coll_t c, pobject_t o, Context *onsafe=0);
   int collection_list(coll_t c, list<pobject_t>& o);
+  int collection_list_partial(coll_t c, ListCursor& cursor, int max, vector<pobject_t>& ls);
 
 
 
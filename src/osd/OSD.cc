@@ -73,8 +73,10 @@
 
 #include "config.h"
 
-#define  dout(l)    if (l<=g_conf.debug || l<=g_conf.debug_osd) *_dout << dbeginl << g_clock.now() << " osd" << whoami << " " << (osdmap ? osdmap->get_epoch():0) << " "
-#define  derr(l)    if (l<=g_conf.debug || l<=g_conf.debug_osd) *_derr << dbeginl << g_clock.now() << " osd" << whoami << " " << (osdmap ? osdmap->get_epoch():0) << " "
+#define  dout(l)    dout_if(l, l<=g_conf.debug || l<=g_conf.debug_osd) << g_clock.now() << " osd" << whoami << " " << (osdmap ? osdmap->get_epoch():0) << " "
+#define  derr(l)    derr_if(l, l<=g_conf.debug || l<=g_conf.debug_osd) << g_clock.now() << " osd" << whoami << " " << (osdmap ? osdmap->get_epoch():0) << " "
+// heartbeat thread and ms_fast_dispatch hold only heartbeat_lock; osdmap may be freed under them
+#define  hbdout(l)  dout_if(l, l<=g_conf.debug || l<=g_conf.debug_osd) << g_clock.now() << " osd" << whoami << " " << heartbeat_epoch << " "
 
 const char *osd_base_path = "./osddata";
 const char *ebofs_base_path = "./dev";
@@ -108,9 +110,14 @@ void OSD::force_remount()
 // cons/des
 
 LogType osd_logtype;
+PerfCountersType osd_perftype(l_osd_first, l_osd_last);
 
 OSD::OSD(int id, Messenger *m, MonMap *mm, const char *dev) : 
   timer(osd_lock),
+  pg_timer(pg_timer_lock),
+  heartbeat_stop(false),
+  heartbeat_epoch(0),
+  heartbeat_thread(this),
   stat_oprate(5.0),
   read_latency_calc(g_conf.osd_max_opq<1 ? 1:g_conf.osd_max_opq),
   qlen_calc(3),
@@ -119,6 +126,40 @@ OSD::OSD(int id, Messenger *m, MonMap *mm, const char *dev) :
   whoami = id;
   messenger = m;
   monmap = mm;
+  logger = 0;
+  osd_stat_updated = false;
+
+  if (osd_perftype.empty()) {
+    osd_perftype.add_set(l_osd_opq, "opq");
+    osd_perftype.add_u64(l_osd_op, "op");
+    osd_perftype.add_u64(l_osd_subop, "subop");
+    osd_perftype.add_u64(l_osd_c_rd, "c_rd");
+    osd_perftype.add_u64(l_osd_c_rdb, "c_rdb");
+    osd_perftype.add_u64(l_osd_c_wr, "c_wr");
+    osd_perftype.add_u64(l_osd_c_wrb, "c_wrb");
+    osd_perftype.add_u64(l_osd_r_wr, "r_wr");
+    osd_perftype.add_u64(l_osd_r_wrb, "r_wrb");
+    osd_perftype.add_u64(l_osd_r_push, "r_push");
+    osd_perftype.add_u64(l_osd_r_pushb, "r_pushb");
+    osd_perftype.add_u64(l_osd_shdout, "shdout");
+    osd_perftype.add_u64(l_osd_shdin, "shdin");
+    osd_perftype.add_lat(l_osd_r_lat, "r_lat");
+    osd_perftype.add_lat(l_osd_w_ack_lat, "w_ack_lat");
+    osd_perftype.add_lat(l_osd_w_commit_lat, "w_commit_lat");
+    osd_perftype.add_lat(l_osd_sub_lat, "sub_lat");
+    osd_perftype.add_u64(l_osd_scrub_obj, "scrub_obj");
+    osd_perftype.add_u64(l_osd_scrub_b, "scrub_b");
+    osd_perftype.add_u64(l_osd_scrub_bad, "scrub_bad");
+    osd_perftype.add_u64(l_osd_scrub_fix, "scrub_fix");
+    osd_perftype.add_u64(l_osd_scrub_pg, "scrub_pg");
+    osd_perftype.add_u64(l_osd_scrub_pause, "scrub_pause");
+    osd_perftype.add_lat(l_osd_scrub_lat, "scrub_lat");
+    osd_perftype.add_u64(l_osd_ctx_hit, "ctx_hit");
+    osd_perftype.add_u64(l_osd_ctx_miss, "ctx_miss");
+    osd_perftype.add_u64(l_osd_sub_reply, "sub_reply");
+    osd_perftype.add_u64(l_osd_sub_reply_ops, "sub_reply_ops");
+  }
+  perf = new PerfCounters("osd", &osd_perftype);
 
   osdmap = 0;
   boot_epoch = 0;
@@ -130,12 +171,17 @@ OSD::OSD(int id, Messenger *m, MonMap *mm, const char *dev) :
 
   stat_ops = 0;
   stat_qlen = 0;
+  stat_last_qlen = 0;
   stat_rd_ops = stat_rd_ops_shed_in = stat_rd_ops_shed_out = 0;
   stat_rd_ops_in_queue = 0;
 
   pending_ops = 0;
   waiting_for_no_ops = false;
 
+  scrubbing = false;
+  scrub_budget = 0;
+  scrub_bytes_seen = 0;
+
   if (g_conf.osd_remount_at) 
     timer.add_event_after(g_conf.osd_remount_at, new C_Remount(this));
 
@@ -186,6 +232,7 @@ OSD::~OSD()
   //if (monitor) { delete monitor; monitor = 0; }
   if (messenger) { delete messenger; messenger = 0; }
   if (logger) { delete logger; logger = 0; }
+  if (perf) { delete perf; perf = 0; }
   if (store) { delete store; store = 0; }
 }
 
@@ -263,32 +310,19 @@ int OSD::init()
   char name[80];
   sprintf(name, "osd%d", whoami);
   logger = new Logger(name, (LogType*)&osd_logtype);
-  osd_logtype.add_set("opq");
-  osd_logtype.add_inc("op");
-  osd_logtype.add_inc("c_rd");
-  osd_logtype.add_inc("c_rdb");
-  osd_logtype.add_inc("c_wr");
-  osd_logtype.add_inc("c_wrb");
-  
-  osd_logtype.add_inc("r_push");
-  osd_logtype.add_inc("r_pushb");
-  osd_logtype.add_inc("r_wr");
-  osd_logtype.add_inc("r_wrb");
-  
+  logger->add_perf(perf);
+  if (store->get_perf_counters())
+    logger->add_perf(store->get_perf_counters());
+
   osd_logtype.add_set("qlen");
   osd_logtype.add_set("rqlen");
   osd_logtype.add_set("rdlat");
   osd_logtype.add_set("rdlatm");
   osd_logtype.add_set("fshdin");
   osd_logtype.add_set("fshdout");
-  osd_logtype.add_inc("shdout");
-  osd_logtype.add_inc("shdin");
 
   osd_logtype.add_set("loadavg");
 
-  osd_logtype.add_inc("rlsum");
-  osd_logtype.add_inc("rlnum");
-
   osd_logtype.add_set("numpg");
   osd_logtype.add_set("hbto");
   osd_logtype.add_set("hbfrom");
@@ -318,11 +352,15 @@ int OSD::init()
   messenger->send_message(new MOSDBoot(messenger->get_myinst(), superblock), monmap->get_inst(mon));
   
   // start the heart
-  timer.add_event_after(g_conf.osd_heartbeat_interval, new C_Heartbeat(this));
+  heartbeat_thread.create();
 
   // and stat beacon
   timer.add_event_after(g_conf.osd_pg_stats_interval, new C_Stats(this));
 
+  // and scrub
+  scrub_last_tick = g_clock.now();
+  timer.add_event_after(g_conf.osd_scrub_tick, new C_Scrub(this));
+
   return 0;
 }
 
@@ -332,9 +370,20 @@ int OSD::shutdown()
 
   state = STATE_STOPPING;
 
+  // stop the heart
+  heartbeat_lock.Lock();
+  heartbeat_stop = true;
+  heartbeat_cond.Signal();
+  heartbeat_lock.Unlock();
+  heartbeat_thread.join();
+
   // cancel timers
   timer.cancel_all();
   timer.join();
+  pg_timer_lock.Lock();
+  pg_timer.cancel_all();
+  pg_timer.join();
+  pg_timer_lock.Unlock();
 
   // finish ops
   wait_for_no_ops();
@@ -460,19 +509,21 @@ void OSD::_remove_unlock_pg(PG *pg)
 
   dout(10) << "_remove_unlock_pg " << pgid << dendl;
 
-  // remove from store
-  list<pobject_t> olist;
-  store->collection_list(pgid, olist);
-  
-  ObjectStore::Transaction t;
-  {
-    for (list<pobject_t>::iterator p = olist.begin();
+  // remove from store, a piece at a time
+  ObjectStore::ListCursor cursor;
+  vector<pobject_t> olist;
+  while (store->collection_list_partial(pgid, cursor, g_conf.osd_list_max, olist) > 0) {
+    ObjectStore::Transaction t;
+    for (vector<pobject_t>::iterator p = olist.begin();
 	 p != olist.end();
 	 p++)
       t.remove(*p);
-    t.remove_collection(pgid);
-    t.remove(pgid.to_object());  // log too
+    store->apply_transaction(t);
   }
+
+  ObjectStore::Transaction t;
+  t.remove_collection(pgid);
+  t.remove(pgid.to_object());  // log too
   store->apply_transaction(t);
 
   // mark deleted
@@ -645,7 +696,7 @@ void OSD::_refresh_my_stat(utime_t now)
 
   // refresh?
   if (now - my_stat.stamp > g_conf.osd_stat_refresh_interval ||
-      pending_ops > 2*my_stat.qlen) {
+      stat_last_qlen > 2*my_stat.qlen) {
 
     now.encode_timeval(&my_stat.stamp);
     my_stat.oprate = stat_oprate.get(now);
@@ -686,7 +737,7 @@ void OSD::_refresh_my_stat(utime_t now)
     logger->fset("rdlatm", my_stat.read_latency_mine);
     logger->fset("fshdin", my_stat.frac_rd_ops_shed_in);
     logger->fset("fshdout", my_stat.frac_rd_ops_shed_out);
-    dout(12) << "_refresh_my_stat " << my_stat << dendl;
+    hbdout(12) << "_refresh_my_stat " << my_stat << dendl;
 
     stat_rd_ops = 0;
     stat_rd_ops_shed_in = 0;
@@ -707,15 +758,14 @@ osd_peer_stat_t OSD::get_my_stat_for(utime_t now, int peer)
 void OSD::take_peer_stat(int peer, const osd_peer_stat_t& stat)
 {
   Mutex::Locker lock(peer_stat_lock);
-  dout(10) << "take_peer_stat peer osd" << peer << " " << stat << dendl;
+  hbdout(10) << "take_peer_stat peer osd" << peer << " " << stat << dendl;
   peer_stat[peer] = stat;
 }
 
 void OSD::update_heartbeat_sets()
 {
   // build heartbeat to/from set
-  heartbeat_to.clear();
-  heartbeat_from.clear();
+  set<int> to, from;
   for (hash_map<pg_t, PG*>::iterator i = pg_map.begin();
        i != pg_map.end();
        i++) {
@@ -724,22 +774,79 @@ void OSD::update_heartbeat_sets()
     // replicas ping primary.
     if (pg->get_role() > 0) {
       assert(pg->acting.size() > 1);
-      heartbeat_to.insert(pg->acting[0]);
+      to.insert(pg->acting[0]);
     }
     else if (pg->get_role() == 0) {
       assert(pg->acting[0] == whoami);
       for (unsigned i=1; i<pg->acting.size(); i++) {
 	assert(pg->acting[i] != whoami);
-	heartbeat_from.insert(pg->acting[i]);
+	from.insert(pg->acting[i]);
       }
     }
   }
-  dout(10) << "hb   to: " << heartbeat_to << dendl;
-  dout(10) << "hb from: " << heartbeat_from << dendl;
+  dout(10) << "hb   to: " << to << dendl;
+  dout(10) << "hb from: " << from << dendl;
+
+  Mutex::Locker lock(heartbeat_lock);
+  heartbeat_to.swap(to);
+  heartbeat_from.swap(from);
+  heartbeat_epoch = osdmap->get_epoch();
+  heartbeat_inst.clear();
+  for (set<int>::iterator p = heartbeat_to.begin(); p != heartbeat_to.end(); p++)
+    heartbeat_inst[*p] = osdmap->get_inst(*p);
+  for (set<int>::iterator p = heartbeat_from.begin(); p != heartbeat_from.end(); p++)
+    heartbeat_inst[*p] = osdmap->get_inst(*p);
+
+  // forget peers we no longer expect to hear from
+  map<int, PhiAccrual>::iterator p = heartbeat_from_phi.begin();
+  while (p != heartbeat_from_phi.end()) 
+    if (heartbeat_from.count(p->first))
+      p++;
+    else
+      heartbeat_from_phi.erase(p++);
+
+  // the heartbeat thread can't share our map (that wants osd_lock), so
+  // do it here, once per new map, for the peers we ping.
+  for (set<int>::iterator p = heartbeat_to.begin(); p != heartbeat_to.end(); p++)
+    _share_map_outgoing(heartbeat_inst[*p]);
+}
+
+void OSD::heartbeat_entry()
+{
+  heartbeat_lock.Lock();
+  while (!heartbeat_stop) {
+    heartbeat();
+
+    // schedule next!  randomly.
+    utime_t wait;
+    wait += .5 + ((float)(rand() % 10)/10.0) * g_conf.osd_heartbeat_interval;
+    heartbeat_cond.WaitInterval(heartbeat_lock, wait);
+  }
+  heartbeat_lock.Unlock();
+}
+
+/*
+ * has 'peer' missed too many heartbeats?  with osd_heartbeat_phi set,
+ * that's when the phi accrual detector says so (once it has a few
+ * samples); osd_heartbeat_grace is the upper bound either way.
+ */
+bool OSD::heartbeat_failed(int peer, utime_t now)
+{
+  PhiAccrual &d = heartbeat_from_phi[peer];
+  utime_t grace = d.get_last();
+  grace += g_conf.osd_heartbeat_grace;
+  if (now > grace)
+    return true;
+  if (g_conf.osd_heartbeat_phi > 0 &&
+      d.get_num_samples() >= 3 &&
+      d.phi(now) > g_conf.osd_heartbeat_phi)
+    return true;
+  return false;
 }
 
 void OSD::heartbeat()
 {
+  assert(heartbeat_lock.is_locked());
   utime_t now = g_clock.now();
 
   // get CPU load avg
@@ -752,11 +859,11 @@ void OSD::heartbeat()
   }
 
   // calc my stats
-  Mutex::Locker lock(peer_stat_lock);
+  peer_stat_lock.Lock();
   _refresh_my_stat(now);
   my_stat_on_peer.clear();
 
-  dout(5) << "heartbeat: " << my_stat << dendl;
+  hbdout(5) << "heartbeat: " << my_stat << dendl;
 
   //load_calc.set_size(stat_ops);
   
@@ -764,28 +871,31 @@ void OSD::heartbeat()
   for (set<int>::iterator i = heartbeat_to.begin();
        i != heartbeat_to.end();
        i++) {
-    _share_map_outgoing( osdmap->get_inst(*i) );
     my_stat_on_peer[*i] = my_stat;
-    messenger->send_message(new MOSDPing(osdmap->get_epoch(), my_stat),
-			    osdmap->get_inst(*i));
+    messenger->send_message(new MOSDPing(heartbeat_epoch, my_stat),
+			    heartbeat_inst[*i]);
   }
+  peer_stat_lock.Unlock();
 
   // check for incoming heartbeats (move me elsewhere?)
-  utime_t grace = now;
-  grace -= g_conf.osd_heartbeat_grace;
   for (set<int>::iterator p = heartbeat_from.begin();
        p != heartbeat_from.end();
        p++) {
-    if (heartbeat_from_stamp.count(*p)) {
-      if (heartbeat_from_stamp[*p] < grace) {
-	dout(0) << "no heartbeat from osd" << *p << " since " << heartbeat_from_stamp[*p]
-		<< " (cutoff " << grace << ")" << dendl;
-	int mon = monmap->pick_mon();
-	messenger->send_message(new MOSDFailure(messenger->get_myinst(), osdmap->get_inst(*p), osdmap->get_epoch()),
-				monmap->get_inst(mon));
-      }
-    } else
-      heartbeat_from_stamp[*p] = now;  // fake initial
+    if (heartbeat_from_phi.count(*p) == 0) {
+      heartbeat_from_phi[*p].set_window(g_conf.osd_heartbeat_phi_window,
+					g_conf.osd_heartbeat_phi_min_stddev);
+      heartbeat_from_phi[*p].heartbeat(now);  // fake initial
+      continue;
+    }
+    if (heartbeat_failed(*p, now)) {
+      PhiAccrual &d = heartbeat_from_phi[*p];
+      hbdout(0) << "no heartbeat from osd" << *p << " since " << d.get_last()
+	      << " (phi " << d.phi(now) << ", mean " << d.get_mean()
+	      << " stddev " << d.get_stddev() << ")" << dendl;
+      int mon = monmap->pick_mon();
+      messenger->send_message(new MOSDFailure(messenger->get_myinst(), heartbeat_inst[*p], heartbeat_epoch),
+			      monmap->get_inst(mon));
+    }
   }
 
 
@@ -793,11 +903,11 @@ void OSD::heartbeat()
   if (logger) logger->set("hbfrom", heartbeat_from.size());
 
   // hack: fake reorg?
-  if (osdmap && g_conf.fake_osdmap_updates) {
+  if (heartbeat_epoch && g_conf.fake_osdmap_updates) {
     int mon = monmap->pick_mon();
     if ((rand() % g_conf.fake_osdmap_updates) == 0) {
       //if ((rand() % (g_conf.num_osd / g_conf.fake_osdmap_updates)) == whoami / g_conf.fake_osdmap_updates) {
-      messenger->send_message(new MOSDIn(osdmap->get_epoch()),
+      messenger->send_message(new MOSDIn(heartbeat_epoch),
                               monmap->get_inst(mon));
     }
     /*
@@ -812,10 +922,6 @@ void OSD::heartbeat()
     }
     */
   }
-
-  // schedule next!  randomly.
-  float wait = .5 + ((float)(rand() % 10)/10.0) * (float)g_conf.osd_heartbeat_interval;
-  timer.add_event_after(wait, new C_Heartbeat(this));
 }
 
 
@@ -830,34 +936,69 @@ void OSD::send_pg_stats()
   pg_stat_queue_lock.Lock();
   q.swap(pg_stat_queue);
   updated = osd_stat_updated;
-  osd_stat_updated = false;
+  osd_stat_updated = false;   // put back below if we don't send
   pg_stat_queue_lock.Unlock();
-  
-  if (!q.empty() || osd_stat_updated) {
-    dout(1) << "send_pg_stats - " << q.size() << " pgs updated" << dendl;
-    
-    MPGStats *m = new MPGStats;
-    while (!q.empty()) {
-      pg_t pgid = *q.begin();
-      q.erase(q.begin());
-      
-      if (!pg_map.count(pgid)) continue;
-      PG *pg = pg_map[pgid];
-      pg->pg_stats_lock.Lock();
+
+  /*
+   * only send pgs whose stats moved enough to matter (or that the
+   * monitor hasn't heard about in a while).  the rest stay queued.
+   */
+  utime_t now = g_clock.now();
+  utime_t max_age(g_conf.osd_pg_stats_max_age, 0);
+  MPGStats *m = new MPGStats;
+  set<pg_t> later;
+  for (set<pg_t>::iterator p = q.begin(); p != q.end(); p++) {
+    pg_t pgid = *p;
+    if (!pg_map.count(pgid)) continue;
+    PG *pg = pg_map[pgid];
+    pg->pg_stats_lock.Lock();
+    if (pg->pg_stats_sent_stamp.sec() == 0 ||
+	now > pg->pg_stats_sent_stamp + max_age ||
+	pg_stat_changed(pg->pg_stats, pg->pg_stats_sent, g_conf.osd_pg_stats_ratio)) {
       m->pg_stat[pgid] = pg->pg_stats;
+      pg->pg_stats_sent = pg->pg_stats;
+      pg->pg_stats_sent_stamp = now;
       dout(20) << " sending " << pgid << " " << pg->pg_stats.state << dendl;
-      pg->pg_stats_lock.Unlock();
-    }
-    
-    // fill in osd stats too
+    } else
+      later.insert(pgid);
+    pg->pg_stats_lock.Unlock();
+  }
+  if (!later.empty()) {
+    pg_stat_queue_lock.Lock();
+    pg_stat_queue.insert(later.begin(), later.end());
+    pg_stat_queue_lock.Unlock();
+  }
+
+  // osd stats go along with any pg stats.  alone, they follow the pg
+  // rule: once they move enough or the last report gets old.
+  bool send = !m->pg_stat.empty();
+  if (send || updated) {
     struct statfs stbuf;
     store->statfs(&stbuf);
     m->osd_stat.num_blocks = stbuf.f_blocks;
     m->osd_stat.num_blocks_avail = stbuf.f_bavail;
     m->osd_stat.num_objects = stbuf.f_files;
-    
+    if (!send)
+      send = osd_stat_sent_stamp.sec() == 0 ||
+	now > osd_stat_sent_stamp + max_age ||
+	osd_stat_changed(m->osd_stat, osd_stat_sent, g_conf.osd_pg_stats_ratio);
+  }
+  
+  if (send) {
+    dout(1) << "send_pg_stats - " << m->pg_stat.size() << " pgs updated, "
+	    << later.size() << " deferred" << dendl;
+    osd_stat_sent = m->osd_stat;
+    osd_stat_sent_stamp = now;
     int mon = monmap->pick_mon();
     messenger->send_message(m, monmap->get_inst(mon));  
+  } else {
+    delete m;
+    if (updated) {
+      // still unreported; look again next time
+      pg_stat_queue_lock.Lock();
+      osd_stat_updated = true;
+      pg_stat_queue_lock.Unlock();
+    }
   }
 
   // reschedule
@@ -865,6 +1006,78 @@ void OSD::send_pg_stats()
 }
 
 
+/*
+ * scrub a chunk of the pg we're scrubbing when the bandwidth budget
+ * allows and clients aren't waiting, or find the next pg that is due.
+ * bytes read for other primaries' scrubs come out of the budget too.
+ * pgs are only ever try_lock()ed here; a pg that is busy (maybe
+ * reading a chunk) can wait for the next tick.
+ */
+void OSD::scrub_tick()
+{
+  utime_t now = g_clock.now();
+  uint64_t b = perf->get(l_osd_scrub_b);
+  scrub_budget += (double)(now - scrub_last_tick) * (double)g_conf.osd_scrub_max_bps -
+    (double)(b - scrub_bytes_seen);
+  double cap = (double)g_conf.osd_scrub_max_bps * g_conf.osd_scrub_tick;
+  if (scrub_budget > cap)
+    scrub_budget = cap;
+  scrub_bytes_seen = b;
+  scrub_last_tick = now;
+
+  if (scrubbing &&
+      (!_have_pg(scrub_pgid) || !pg_map[scrub_pgid]->is_scrubbing())) {
+    dout(10) << "scrub_tick done with " << scrub_pgid << dendl;
+    scrubbing = false;
+  }
+
+  if (pending_ops > g_conf.osd_scrub_max_opq) {
+    dout(15) << "scrub_tick " << pending_ops << " ops queued, pausing" << dendl;
+    if (scrubbing)
+      perf->inc(l_osd_scrub_pause);
+    if (scrub_budget > 0)
+      scrub_budget = 0;
+  }
+  else if (!is_stopping()) {
+    if (!scrubbing && g_conf.osd_scrub_interval > 0) {
+      PG *oldest = 0;
+      for (hash_map<pg_t, PG*>::iterator p = pg_map.begin();
+	   p != pg_map.end();
+	   p++) {
+	PG *pg = p->second;
+	if (!pg->is_primary() || !pg->is_active() || !pg->is_clean())
+	  continue;
+	utime_t due = pg->info.last_scrub_stamp;
+	due += g_conf.osd_scrub_interval;
+	if (due > now)
+	  continue;
+	if (!oldest || pg->info.last_scrub_stamp < oldest->info.last_scrub_stamp)
+	  oldest = pg;
+      }
+      if (oldest && oldest->try_lock()) {
+	if (oldest->scrub_start()) {
+	  dout(10) << "scrub_tick starting " << *oldest << dendl;
+	  scrubbing = true;
+	  scrub_pgid = oldest->info.pgid;
+	}
+	oldest->unlock();
+      }
+    }
+
+    if (scrubbing && scrub_budget > 0) {
+      PG *pg = pg_map[scrub_pgid];
+      if (pg->try_lock()) {
+	if (pg->scrub_ready())
+	  pg->scrub_queue();
+	pg->unlock();
+      }
+    }
+  }
+
+  timer.add_event_after(g_conf.osd_scrub_tick, new C_Scrub(this));
+}
+
+
 
 
 // --------------------------------------
@@ -952,6 +1165,12 @@ void OSD::dispatch(Message *m)
     shutdown();
     delete m;
     break;
+
+    // replies to the (un)balance-reads ops a pg sends itself
+  case CEPH_MSG_OSD_OPREPLY:
+    dout(10) << "ignoring " << *m << dendl;
+    delete m;
+    break;
     
     
 
@@ -1083,15 +1302,44 @@ void OSD::ms_handle_failure(Message *m, const entity_inst_t& inst)
 
 
 
-void OSD::handle_osd_ping(MOSDPing *m)
+/*
+ * pings from peers on our map epoch are handled right here, on the
+ * messenger's thread, without osd_lock.  the rest go through dispatch
+ * so that we can share maps.
+ */
+bool OSD::ms_fast_dispatch(Message *m)
 {
-  dout(20) << "osdping from " << m->get_source() << " got stat " << m->peer_stat << dendl;
+  if (m->get_type() != MSG_OSD_PING)
+    return false;
+  MOSDPing *ping = (MOSDPing*)m;
+  Mutex::Locker lock(heartbeat_lock);
+  if (!heartbeat_epoch || ping->map_epoch != heartbeat_epoch)
+    return false;
+  _note_heartbeat(ping);
+  return true;
+}
 
+void OSD::handle_osd_ping(MOSDPing *m)
+{
   _share_map_incoming(m->get_source_inst(), ((MOSDPing*)m)->map_epoch);
+
+  Mutex::Locker lock(heartbeat_lock);
+  _note_heartbeat(m);
+}
+
+void OSD::_note_heartbeat(MOSDPing *m)
+{
+  assert(heartbeat_lock.is_locked());
+  hbdout(20) << "osdping from " << m->get_source() << " got stat " << m->peer_stat << dendl;
   
   int from = m->get_source().num();
   take_peer_stat(from, m->peer_stat);
-  heartbeat_from_stamp[from] = m->get_recv_stamp();
+  if (heartbeat_from.count(from)) {
+    if (heartbeat_from_phi.count(from) == 0)
+      heartbeat_from_phi[from].set_window(g_conf.osd_heartbeat_phi_window,
+					  g_conf.osd_heartbeat_phi_min_stddev);
+    heartbeat_from_phi[from].heartbeat(m->get_recv_stamp());
+  }
 
   delete m;
 }
@@ -1464,7 +1712,7 @@ void OSD::advance_map(ObjectStore::Transaction& t)
 	    vector<int> inset;
 	    osdmap->pg_to_osds(pg->info.pgid, inset);
 	    for (unsigned i=0; i<inset.size(); i++)
-	      if (!osdmap->is_down_clean(inset[i])) clean = false;
+	      if (inset[i] >= 0 && !osdmap->is_down_clean(inset[i])) clean = false;
 	    if (clean) {
 	      dout(1) << *pg << " is cleanly inactive" << dendl;
 	    } else {
@@ -2141,9 +2389,11 @@ void OSD::handle_op(MOSDOp *op)
   utime_t now = g_clock.now();
 
   // update qlen stats
+  peer_stat_lock.Lock();
   stat_oprate.hit(now);
   stat_ops++;
   stat_qlen += pending_ops;
+  stat_last_qlen = pending_ops;
   if (op->get_op() == CEPH_OSD_OP_READ) {
     stat_rd_ops++;
     if (op->get_source().is_osd()) {
@@ -2151,6 +2401,7 @@ void OSD::handle_op(MOSDOp *op)
       stat_rd_ops_shed_in++;
     }
   }
+  peer_stat_lock.Unlock();
 
   // require same or newer map
   if (!require_same_or_newer_map(op, op->get_map_epoch())) {
@@ -2404,7 +2655,7 @@ void OSD::enqueue_op(PG *pg, Message *op)
   // add to pg's op_queue
   pg->op_queue.push_back(op);
   pending_ops++;
-  logger->set("opq", pending_ops);
+  perf->set(l_osd_opq, pending_ops);
   
   // add pg to threadpool queue
   pg->get();   // we're exposing the pointer, here.
@@ -2462,7 +2713,7 @@ void OSD::dequeue_op(PG *pg)
       op_queue_cond.Signal();
     
     pending_ops--;
-    logger->set("opq", pending_ops);
+    perf->set(l_osd_opq, pending_ops);
     if (pending_ops == 0 && waiting_for_no_ops)
       no_pending_ops.Signal();
   }
@@ -27,6 +27,10 @@
 #include "PG.h"
 
 #include "common/DecayCounter.h"
+#include "common/PhiAccrual.h"
+#include "common/Thread.h"
+#include "common/Cond.h"
+#include "common/PerfCounters.h"
 
 
 #include <map>
@@ -43,6 +47,39 @@ class Logger;
 class ObjectStore;
 class OSDMap;
 
+enum {
+  l_osd_first = 10000,
+  l_osd_opq,
+  l_osd_op,
+  l_osd_subop,
+  l_osd_c_rd,
+  l_osd_c_rdb,
+  l_osd_c_wr,
+  l_osd_c_wrb,
+  l_osd_r_wr,
+  l_osd_r_wrb,
+  l_osd_r_push,
+  l_osd_r_pushb,
+  l_osd_shdout,
+  l_osd_shdin,
+  l_osd_r_lat,         // client read, received to reply
+  l_osd_w_ack_lat,     // client write, received to ack
+  l_osd_w_commit_lat,  // client write, received to commit
+  l_osd_sub_lat,       // replica write, received to commit
+  l_osd_scrub_obj,
+  l_osd_scrub_b,
+  l_osd_scrub_bad,     // inconsistent copies found
+  l_osd_scrub_fix,     // repairs sent
+  l_osd_scrub_pg,      // pg scrubs finished
+  l_osd_scrub_pause,   // scrub ticks skipped for client load
+  l_osd_scrub_lat,     // scrub chunk, queued to compared
+  l_osd_ctx_hit,       // object context found in pg cache
+  l_osd_ctx_miss,      // object context loaded from the store
+  l_osd_sub_reply,     // replica ack/commit messages sent
+  l_osd_sub_reply_ops, // ...and the sub ops they covered
+  l_osd_last
+};
+
 class OSD : public Dispatcher {
 public:
   // -- states --
@@ -57,8 +94,14 @@ protected:
   Mutex osd_lock;     // global lock
   SafeTimer timer;    // safe timer
 
+  // for pg events from threads that can't take osd_lock (store
+  // callbacks).  comes before pg locks.
+  Mutex pg_timer_lock;
+  SafeTimer pg_timer;
+
   Messenger   *messenger; 
   Logger      *logger;
+  PerfCounters *perf;
   ObjectStore *store;
   MonMap      *monmap;
 
@@ -93,29 +136,48 @@ public:
 private:
 
   // -- heartbeat --
+  /*
+   * heartbeats go out from their own thread and come in through
+   * ms_fast_dispatch, so a busy osd (osd_lock held, long dispatch
+   * queue) still pings and hears pings on time.  everything here is
+   * under heartbeat_lock, never osd_lock; update_heartbeat_sets copies
+   * what we need out of the osdmap.
+   */
+  Mutex heartbeat_lock;
+  Cond heartbeat_cond;
+  bool heartbeat_stop;
+  epoch_t heartbeat_epoch;
+  map<int, entity_inst_t> heartbeat_inst;
   set<int> heartbeat_to, heartbeat_from;
-  map<int, utime_t> heartbeat_from_stamp;
+  map<int, PhiAccrual> heartbeat_from_phi;
 
   void update_heartbeat_sets();
   void heartbeat();
+  void heartbeat_entry();
+  bool heartbeat_failed(int peer, utime_t now);
+  void _note_heartbeat(class MOSDPing *m);
 
-  class C_Heartbeat : public Context {
+  class HeartbeatThread : public Thread {
     OSD *osd;
   public:
-    C_Heartbeat(OSD *o) : osd(o) {}
-    void finish(int r) {
-      osd->heartbeat();
+    HeartbeatThread(OSD *o) : osd(o) {}
+    void *entry() {
+      osd->heartbeat_entry();
+      return 0;
     }
-  };
+  } heartbeat_thread;
 
 
   // -- stats --
+  // under peer_stat_lock: the heartbeat thread reads and resets them
+  // without osd_lock.
   DecayCounter stat_oprate;
   int stat_ops;  // ops since last heartbeat
   int stat_rd_ops;
   int stat_rd_ops_shed_in;
   int stat_rd_ops_shed_out;
   int stat_qlen; // cumulative queue length since last refresh
+  int stat_last_qlen;  // pending_ops when the last op came in
   int stat_rd_ops_in_queue;  // in queue
 
   Mutex peer_stat_lock;
@@ -298,6 +360,8 @@ private:
   Mutex pg_stat_queue_lock;
   set<pg_t> pg_stat_queue;
   bool osd_stat_updated;
+  osd_stat_t osd_stat_sent;
+  utime_t osd_stat_sent_stamp;
 
   class C_Stats : public Context {
     OSD *osd;
@@ -310,6 +374,25 @@ private:
   void send_pg_stats(); 
 
 
+  // -- scrub --
+  //  one pg at a time, a chunk at a time, at most osd_scrub_max_bps.
+  bool scrubbing;
+  pg_t scrub_pgid;
+  utime_t scrub_last_tick;
+  double scrub_budget;        // bytes we may read before the next chunk
+  uint64_t scrub_bytes_seen;  // l_osd_scrub_b as of the last tick
+
+  class C_Scrub : public Context {
+    OSD *osd;
+  public:
+    C_Scrub(OSD *o) : osd(o) {}
+    void finish(int r) {
+      osd->scrub_tick();
+    }
+  };
+  void scrub_tick();
+
+
   // -- tids --
   // for ops i issue
   tid_t               last_tid;
@@ -359,6 +442,7 @@ private:
 
   // messages
   virtual void dispatch(Message *m);
+  virtual bool ms_fast_dispatch(Message *m);
   virtual void ms_handle_failure(Message *m, const entity_inst_t& inst);
 
   void handle_osd_ping(class MOSDPing *m);
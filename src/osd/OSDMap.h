@@ -27,6 +27,7 @@
 #include "msg/Message.h"
 #include "common/Mutex.h"
 #include "common/Clock.h"
+#include "common/Thread.h"
 
 #include "crush/CrushWrapper.h"
 
@@ -69,6 +70,7 @@ public:
   public:
     ceph_fsid fsid;
     epoch_t epoch;   // new epoch; we are a diff from epoch-1 to epoch
+    epoch_t base_epoch; // or, if set, a merged diff from base_epoch to epoch
     epoch_t mon_epoch;  // monitor epoch (election iteration)
     utime_t ctime;
 
@@ -83,6 +85,8 @@ public:
     map<int32_t,uint32_t> new_offload;
     map<pg_t,uint32_t> new_pg_swap_primary;
     list<pg_t> old_pg_swap_primary;
+
+    epoch_t get_base_epoch() { return base_epoch ? base_epoch : epoch-1; }
     
     void encode(bufferlist& bl) {
       ::_encode(fsid, bl);
@@ -97,6 +101,7 @@ public:
       ::_encode(new_offload, bl);
       ::_encode(new_pg_swap_primary, bl);
       ::_encode(old_pg_swap_primary, bl);
+      ::_encode(base_epoch, bl);
     }
     void decode(bufferlist& bl, int& off) {
       ::_decode(fsid, bl, off);
@@ -111,9 +116,10 @@ public:
       ::_decode(new_offload, bl, off);
       ::_decode(new_pg_swap_primary, bl, off);
       ::_decode(old_pg_swap_primary, bl, off);
+      ::_decode(base_epoch, bl, off);
     }
 
-    Incremental(epoch_t e=0) : epoch(e), mon_epoch(0), new_max_osd(-1) {
+    Incremental(epoch_t e=0) : epoch(e), base_epoch(0), mon_epoch(0), new_max_osd(-1) {
       fsid.major = fsid.minor = 0;
     }
   };
@@ -132,6 +138,41 @@ private:
   vector<uint8_t>  osd_state;
   vector<entity_addr_t> osd_addr;
   map<pg_t,uint32_t> pg_swap_primary;  // force new osd to be pg primary (if already a member)
+
+  /*
+   * precomputed raw pg -> osd mappings, one table per pg (type, size),
+   * covering the non-localized pgs ps = 0..pg_num-1.  a table is built
+   * the first time any pg of its kind is mapped, all at once, and then
+   * lookups are an array index.  once a kind is in use, decode and
+   * apply_incremental rebuild it eagerly whenever it is invalidated.
+   *
+   * the raw mapping depends only on crush (including in/out offloads),
+   * pg_num and the layout.  up/down changes only filter it into the
+   * acting set, and pg_swap_primary is applied on top, so tables survive
+   * any incremental that doesn't carry a new crush map, offloads or
+   * pg_num.
+   */
+  struct pg_mapping_t {
+    int size;
+    vector<int32_t> osds;   // pg_num * size
+    vector<uint8_t> len;    // pg_num
+    pg_mapping_t() : size(0) {}
+  };
+  map<int, pg_mapping_t> pg_mappings;   // (type << 8 | size) -> table
+  Mutex pg_mapping_lock;   // lookups may come from several threads at once
+
+  class PGMappingThread : public Thread {
+    OSDMap *osdmap;
+    pg_mapping_t *m;
+    int type, from, to;
+  public:
+    PGMappingThread(OSDMap *om, pg_mapping_t *pm, int t, int f, int e) :
+      osdmap(om), m(pm), type(t), from(f), to(e) {}
+    void *entry() {
+      osdmap->_calc_pg_mapping(*m, type, from, to);
+      return 0;
+    }
+  };
   
  public:
   CrushWrapper     crush;       // hierarchical map
@@ -162,7 +203,7 @@ private:
   }
 
   int get_pg_num() const { return pg_num; }
-  void set_pg_num(int m) { pg_num = m; calc_pg_masks(); }
+  void set_pg_num(int m) { pg_num = m; calc_pg_masks(); clear_pg_mappings(); }
   int get_localized_pg_num() const { return localized_pg_num; }
 
   /* stamps etc */
@@ -216,6 +257,7 @@ private:
   }
   void set_offload(int o, unsigned off) {
     crush.set_offload(o, off);
+    clear_pg_mappings();
   }
 
   bool exists(int osd) { return osd < max_osd && osd_state[osd] & CEPH_OSD_EXISTS; }
@@ -271,8 +313,8 @@ private:
 
   void apply_incremental(Incremental &inc) {
     assert(ceph_fsid_equal(&inc.fsid, &fsid) || inc.epoch == 1);
-    assert(inc.epoch == epoch+1);
-    epoch++;
+    assert(inc.get_base_epoch() == epoch);
+    epoch = inc.epoch;
     mon_epoch = inc.mon_epoch;
     ctime = inc.ctime;
 
@@ -281,9 +323,11 @@ private:
       decode(inc.fullmap);
       return;
     }
+    bool remap = false;
     if (inc.crush.length()) {
       bufferlist::iterator blp = inc.crush.begin();
       crush._decode(blp);
+      remap = true;
     }
 
     // nope, incremental.
@@ -302,6 +346,8 @@ private:
          i++) {
       crush.set_offload(i->first, i->second);
     }
+    if (!inc.new_offload.empty())
+      remap = true;
 
     for (map<int32_t,entity_addr_t>::iterator i = inc.new_up.begin();
          i != inc.new_up.end(); 
@@ -319,6 +365,85 @@ private:
 	 i != inc.old_pg_swap_primary.end();
 	 i++)
       pg_swap_primary.erase(*i);
+
+    if (remap)
+      rebuild_pg_mappings();
+  }
+
+  /*
+   * build a (merged) incremental that takes older to this map.  fails
+   * if the difference isn't something an incremental can express (pg
+   * count, fsid, osd state bits other than up).  the addr of an osd
+   * that is down at both ends isn't carried; nobody talks to it anyway.
+   */
+  bool build_incremental(OSDMap& older, Incremental& inc) {
+    if (!ceph_fsid_equal(&fsid, &older.fsid) ||
+	pg_num != older.pg_num ||
+	localized_pg_num != older.localized_pg_num ||
+	older.epoch >= epoch)
+      return false;
+
+    inc = Incremental(epoch);
+    inc.fsid = fsid;
+    inc.base_epoch = older.epoch;
+    inc.mon_epoch = mon_epoch;
+    inc.ctime = ctime;
+
+    if (max_osd != older.max_osd)
+      inc.new_max_osd = max_osd;
+    for (int i=0; i<max_osd; i++) {
+      uint8_t os = i < older.max_osd ? older.osd_state[i] : 0;
+      if ((os & ~CEPH_OSD_UP) != (osd_state[i] & ~CEPH_OSD_UP))
+	return false;
+      bool wasup = os & CEPH_OSD_UP;
+      bool isup = osd_state[i] & CEPH_OSD_UP;
+      bool moved = wasup && isup && older.osd_addr[i] != osd_addr[i];
+      if (wasup && (!isup || moved))
+	inc.new_down[i] = 0;
+      if (isup && (!wasup || moved))
+	inc.new_up[i] = osd_addr[i];
+    }
+    // shrinking max_osd drops the tail along with its state
+    for (int i=max_osd; i<older.max_osd; i++)
+      if (older.osd_state[i] & CEPH_OSD_UP)
+	return false;
+
+    // crush: offload changes go as offloads; anything else ships the map
+    bufferlist a, b;
+    crush._encode(b);
+    older.crush._encode(a);
+    int n = crush.get_max_devices();
+    if (a.length() && n == older.crush.get_max_devices()) {
+      CrushWrapper tmp;
+      bufferlist::iterator p = a.begin();
+      tmp._decode(p);
+      for (int i=0; i<n; i++) 
+	if (tmp.get_offload(i) != crush.get_offload(i)) {
+	  inc.new_offload[i] = crush.get_offload(i);
+	  tmp.set_offload(i, crush.get_offload(i));
+	}
+      a.clear();
+      tmp._encode(a);
+    }
+    if (a.length() != b.length() ||
+	memcmp(a.c_str(), b.c_str(), a.length()) != 0) {
+      inc.crush = b;
+      inc.new_offload.clear();
+    }
+
+    for (map<pg_t,uint32_t>::iterator p = pg_swap_primary.begin();
+	 p != pg_swap_primary.end();
+	 p++) {
+      map<pg_t,uint32_t>::iterator q = older.pg_swap_primary.find(p->first);
+      if (q == older.pg_swap_primary.end() || q->second != p->second)
+	inc.new_pg_swap_primary[p->first] = p->second;
+    }
+    for (map<pg_t,uint32_t>::iterator q = older.pg_swap_primary.begin();
+	 q != older.pg_swap_primary.end();
+	 q++)
+      if (pg_swap_primary.count(q->first) == 0)
+	inc.old_pg_swap_primary.push_back(q->first);
+    return true;
   }
 
   // serialize, unserialize
@@ -363,6 +488,101 @@ private:
     crush._decode(cblp);
 
     //crush.update_offload_map(out_osds, overload_osds);
+    rebuild_pg_mappings();
+  }
+
+  /*
+   * the crush map for a fresh cluster of num_osd osds: osd_max_rep
+   * failure domains of uniform buckets under a list root (or a single
+   * uniform bucket for small clusters), with replication and raid
+   * rules, every osd in.  the monitor builds the initial map with this;
+   * crushdiff uses it for --createsimple.
+   */
+  static void build_simple_crush(CrushWrapper& crush, int num_osd) {
+    crush.create();
+
+    if (num_osd >= 12) {
+      int ndom = g_conf.osd_max_rep;
+      int ritems[ndom];
+      int rweights[ndom];
+      int nper = ((num_osd - 1) / ndom) + 1;
+
+      int o = 0;
+      for (int i=0; i<ndom; i++) {
+	int items[nper];
+	int j;
+	rweights[i] = 0;
+	for (j=0; j<nper; j++, o++) {
+	  if (o == num_osd) break;
+	  items[j] = o;
+	  rweights[i] += 0x10000;
+	}
+	crush_bucket_uniform *domain = crush_make_uniform_bucket(1, j, items, 0x10000);
+	ritems[i] = crush_add_bucket(crush.map, (crush_bucket*)domain);
+      }
+
+      // root
+      crush_bucket_list *root = crush_make_list_bucket(2, ndom, ritems, rweights);
+      int rootid = crush_add_bucket(crush.map, (crush_bucket*)root);
+
+      // replication
+      for (int i=1; i<=ndom; i++) {
+	crush_rule *rule = crush_make_rule(4);
+	crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, rootid, 0);
+	crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_FIRSTN, i, 1);
+	crush_rule_set_step(rule, 2, CRUSH_RULE_CHOOSE_FIRSTN, 1, 0);
+	crush_rule_set_step(rule, 3, CRUSH_RULE_EMIT, 0, 0);
+	crush_add_rule(crush.map, CRUSH_REP_RULE(i), rule);
+      }
+
+      // raid
+      for (int i=g_conf.osd_min_raid_width; i <= g_conf.osd_max_raid_width; i++) {
+	if (ndom >= i) {
+	  crush_rule *rule = crush_make_rule(4);
+	  crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, rootid, 0);
+	  crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_INDEP, i, 1);
+	  crush_rule_set_step(rule, 2, CRUSH_RULE_CHOOSE_INDEP, 1, 0);
+	  crush_rule_set_step(rule, 3, CRUSH_RULE_EMIT, 0, 0);
+	  crush_add_rule(crush.map, CRUSH_RAID_RULE(i), rule);
+	} else {
+	  crush_rule *rule = crush_make_rule(3);
+	  crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, rootid, 0);
+	  crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_INDEP, i, 0);
+	  crush_rule_set_step(rule, 2, CRUSH_RULE_EMIT, 0, 0);
+	  crush_add_rule(crush.map, CRUSH_RAID_RULE(i), rule);
+	}
+      }
+    } else {
+      // one bucket
+      int items[num_osd];
+      for (int i=0; i<num_osd; i++)
+	items[i] = i;
+      crush_bucket_uniform *b = crush_make_uniform_bucket(1, num_osd, items, 0x10000);
+      int root = crush_add_bucket(crush.map, (crush_bucket*)b);
+
+      // replication
+      for (int i=1; i<=g_conf.osd_max_rep; i++) {
+	crush_rule *rule = crush_make_rule(3);
+	crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, root, 0);
+	crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_FIRSTN, i, 0);
+	crush_rule_set_step(rule, 2, CRUSH_RULE_EMIT, 0, 0);
+	crush_add_rule(crush.map, CRUSH_REP_RULE(i), rule);
+      }
+      // raid4
+      for (int i=g_conf.osd_min_raid_width; i <= g_conf.osd_max_raid_width; i++) {
+	crush_rule *rule = crush_make_rule(3);
+	crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, root, 0);
+	crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_INDEP, i, 0);
+	crush_rule_set_step(rule, 2, CRUSH_RULE_EMIT, 0, 0);
+	crush_add_rule(crush.map, CRUSH_RAID_RULE(i), rule);
+      }
+    }
+
+    crush.finalize();
+
+    // mark all in
+    for (int i=0; i<num_osd; i++)
+      crush.set_offload(i, CEPH_OSD_IN);
   }
  
 
@@ -413,8 +633,8 @@ private:
   }
 
 
-  // pg -> (osd list)
-  int pg_to_osds(pg_t pg, vector<int>& osds) {
+  // pg -> (osd list), from scratch, before pg_swap_primary
+  int _pg_to_raw_osds(pg_t pg, vector<int>& osds) {
     // map to osds[]
     switch (g_conf.osd_pg_layout) {
     case CEPH_PG_LAYOUT_CRUSH:
@@ -486,6 +706,117 @@ private:
       if (is_out(osd))
         osds.erase(osds.begin());  // oops, but it's out
     }
+    return osds.size();
+  }
+
+  /* pg mapping tables */
+  void clear_pg_mappings() {
+    pg_mappings.clear();
+  }
+  /*
+   * rebuild whatever kinds were in use.  called from decode and
+   * apply_incremental, while the map is still private to the thread
+   * updating it, so readers of the new epoch find the tables ready.
+   */
+  void rebuild_pg_mappings() {
+    set<int> kinds;
+    for (map<int, pg_mapping_t>::iterator p = pg_mappings.begin();
+	 p != pg_mappings.end();
+	 p++)
+      kinds.insert(p->first);
+    pg_mappings.clear();
+    if (!g_conf.osd_map_cache_mappings)
+      return;
+    for (set<int>::iterator p = kinds.begin(); p != kinds.end(); p++)
+      build_pg_mapping(*p >> 8, *p & 0xff);
+  }
+  int get_num_pg_mappings() const { return pg_mappings.size(); }
+
+  void _calc_pg_mapping(pg_mapping_t& m, int type, int from, int to) {
+    if (g_conf.osd_pg_layout == CEPH_PG_LAYOUT_CRUSH && from < to) {
+      // the whole range through crush at once
+      int rule;
+      if (type == pg_t::TYPE_REP) rule = CRUSH_REP_RULE(m.size);
+      else if (type == pg_t::TYPE_RAID4) rule = CRUSH_RAID_RULE(m.size);
+      else assert(0);
+      vector<int> xs(to - from), out, outlen;
+      for (int ps=from; ps<to; ps++)
+	xs[ps-from] = ps;
+      crush.do_rule_batch(rule, xs, out, outlen, m.size);
+      for (int ps=from; ps<to; ps++) {
+	int n = outlen[ps-from];
+	m.len[ps] = n;
+	for (int i=0; i<n; i++)
+	  m.osds[ps*m.size + i] = out[(ps-from)*m.size + i];
+      }
+      return;
+    }
+
+    vector<int> osds;
+    for (int ps=from; ps<to; ps++) {
+      osds.clear();
+      _pg_to_raw_osds(pg_t(type, m.size, ps, -1), osds);
+      unsigned n = MIN(osds.size(), (unsigned)m.size);
+      m.len[ps] = n;
+      for (unsigned i=0; i<n; i++)
+	m.osds[ps*m.size + i] = osds[i];
+    }
+  }
+
+  pg_mapping_t& build_pg_mapping(int type, int size) {
+    // fill a private table; it is only published once complete
+    pg_mapping_t m;
+    m.size = size;
+    m.osds.resize(pg_num * size);
+    m.len.resize(pg_num);
+
+    int nthreads = g_conf.osd_map_mapping_threads;
+    if (pg_num < g_conf.osd_map_mapping_parallel_min)
+      nthreads = 1;
+    if (nthreads <= 1) {
+      _calc_pg_mapping(m, type, 0, pg_num);
+    } else {
+      // crush_do_rule only reads the map; each thread fills its own range.
+      vector<PGMappingThread*> threads(nthreads);
+      int per = (pg_num + nthreads - 1) / nthreads;
+      for (int i=0; i<nthreads; i++) {
+	threads[i] = new PGMappingThread(this, &m, type,
+					 MIN(i*per, pg_num), MIN((i+1)*per, pg_num));
+	threads[i]->create();
+      }
+      for (int i=0; i<nthreads; i++) {
+	threads[i]->join();
+	delete threads[i];
+      }
+    }
+    pg_mapping_t& r = pg_mappings[(type << 8) | size];
+    r.osds.swap(m.osds);
+    r.len.swap(m.len);
+    r.size = size;
+    return r;
+  }
+
+  // from the table, if this pg is covered by one.
+  bool lookup_pg_mapping(pg_t pg, vector<int>& osds) {
+    if (!g_conf.osd_map_cache_mappings ||
+	pg.preferred() >= 0 ||
+	(int)pg.ps() >= pg_num)
+      return false;
+    // tables are only dropped by decode/apply_incremental, which own the
+    // map; the lock covers the find and any first build of a new kind.
+    pg_mapping_lock.Lock();
+    map<int, pg_mapping_t>::iterator p = pg_mappings.find((pg.type() << 8) | pg.size());
+    pg_mapping_t& m = p != pg_mappings.end() ? p->second : build_pg_mapping(pg.type(), pg.size());
+    pg_mapping_lock.Unlock();
+    vector<int32_t>::iterator o = m.osds.begin() + pg.ps() * m.size;
+    osds.assign(o, o + m.len[pg.ps()]);
+    return true;
+  }
+
+  // pg -> (osd list)
+  int pg_to_osds(pg_t pg, vector<int>& osds) {
+    if (!lookup_pg_mapping(pg, osds))
+      _pg_to_raw_osds(pg, osds);
 
     // swap primary?
     if (pg_swap_primary.count(pg)) {
@@ -511,7 +842,7 @@ private:
     
     osds.clear();
     for (unsigned i=0; i<raw.size(); i++) {
-      if (is_down(raw[i])) continue;
+      if (raw[i] < 0 || is_down(raw[i])) continue;   // raid hole, or down
       osds.push_back( raw[i] );
     }
     return osds.size();
@@ -522,9 +853,10 @@ private:
   // pg -> primary osd
   int get_pg_primary(pg_t pg) {
     vector<int> group;
-    int nrep = pg_to_osds(pg, group);
-    if (nrep)
-      return group[0];
+    pg_to_osds(pg, group);
+    for (unsigned i=0; i<group.size(); i++)
+      if (group[i] >= 0)
+	return group[i];
     return -1;  // we fail!
   }
 
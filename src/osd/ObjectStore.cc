@@ -6,7 +6,7 @@
 #include "config.h"
 #include "common/Clock.h"
 
-#define dout(x) if (x < g_conf.debug) *_dout << dbeginl << g_clock.now() << " ager: " 
+#define dout(x) dout_if(x, x < g_conf.debug) << g_clock.now() << " ager: " 
 
 object_t ObjectStore::age_get_oid() {
     if (!age_free_oids.empty()) {
@@ -21,6 +21,7 @@
 #include "include/Context.h"
 #include "include/buffer.h"
 #include "include/pobject.h"
+#include "ebofs/csum.h"
 
 #include "include/Distribution.h"
 
@@ -33,12 +34,15 @@
 #endif /* DARWIN */
 
 #include <list>
+#include <algorithm>
 using std::list;
 
 #ifndef MIN
 # define MIN(a,b) ((a) < (b) ? (a):(b))
 #endif
 
+class PerfCounters;
+
 /*
  * low-level interface to the local OSD file system
  */
@@ -536,6 +540,8 @@ public:
   virtual ~ObjectStore() {}
 
   // mgmt
+  virtual PerfCounters *get_perf_counters() { return 0; }
+
   virtual int mount() = 0;
   virtual int umount() = 0;
   virtual int mkfs() = 0;  // wipe
@@ -576,6 +582,36 @@ public:
 			     off_t offset, 
                              size_t len) { return -1; }
 
+  /*
+   * for scrub: read all of an object and digest its data.  the digest
+   * folds together the 64-bit word sum (ebofs' block checksum) of each
+   * SCRUB_BLOCK of the object, zero padded past the end, so stores
+   * that keep those sums can use them instead of summing the data
+   * again.  that way every store comes up with the same digest.
+   */
+#define SCRUB_BLOCK 4096
+  static uint64_t digest_fold(uint64_t d, csum_t block) {
+    return (d ^ block) * 0x100000001b3ULL;
+  }
+  virtual int digest(pobject_t oid, off_t *size, uint64_t *d) {
+    bufferlist bl;
+    int r = read(oid, 0, 0, bl);
+    if (r < 0)
+      return r;
+    *size = bl.length();
+    *d = 0;
+    uint64_t buf[SCRUB_BLOCK / sizeof(uint64_t)];
+    bufferlist::iterator p = bl.begin();
+    for (unsigned off = 0; off < bl.length(); off += SCRUB_BLOCK) {
+      unsigned len = MIN(SCRUB_BLOCK, bl.length() - off);
+      p.copy(len, (char*)buf);
+      if (len < SCRUB_BLOCK)
+	memset((char*)buf + len, 0, SCRUB_BLOCK - len);
+      *d = digest_fold(*d, calc_csum((char*)buf, SCRUB_BLOCK));
+    }
+    return 0;
+  }
+
   virtual int setattr(pobject_t oid, const char *name,
                       const void *value, size_t size,
                       Context *onsafe=0) {return 0;} //= 0;
@@ -612,6 +648,43 @@ public:
                                 Context *onsafe=0) {return 0;}// = 0;
   virtual int collection_list(coll_t c, list<pobject_t>& o) {return 0;}//= 0;
 
+  /*
+   * list a collection a piece at a time: up to max objects, in
+   * pobject_t order, starting at cursor.next.  start with a fresh
+   * ListCursor and call until it returns 0 (cursor.end is set once
+   * the last piece is handed out).  ls is cleared first.
+   *
+   * stores should do this natively; this default lists everything
+   * each time.
+   */
+  struct ListCursor {
+    pobject_t next;     // first object not yet listed
+    bool end;
+    ListCursor() : end(false) {}
+  };
+  virtual int collection_list_partial(coll_t c, ListCursor& cursor, int max,
+				      vector<pobject_t>& ls) {
+    ls.clear();
+    if (cursor.end)
+      return 0;
+    list<pobject_t> all;
+    int r = collection_list(c, all);
+    if (r < 0)
+      return r;
+    vector<pobject_t> v;
+    for (list<pobject_t>::iterator p = all.begin(); p != all.end(); p++)
+      if (!(*p < cursor.next))
+	v.push_back(*p);
+    sort(v.begin(), v.end());
+    if ((int)v.size() > max) {
+      cursor.next = v[max];
+      v.resize(max);
+    } else
+      cursor.end = true;
+    ls.swap(v);
+    return ls.size();
+  }
+
   virtual int collection_setattr(coll_t cid, const char *name,
                                  const void *value, size_t size,
                                  Context *onsafe=0) {return 0;} //= 0;
@@ -26,22 +26,29 @@
 #include "messages/MOSDPGRemove.h"
 #include "messages/MOSDPGActivateSet.h"
 
-#define  dout(l)    if (l<=g_conf.debug || l<=g_conf.debug_osd) *_dout << dbeginl << g_clock.now() << " osd" << osd->whoami << " " << (osd->osdmap ? osd->osdmap->get_epoch():0) << " " << *this << " "
+#define  dout(l)    dout_if(l, l<=g_conf.debug || l<=g_conf.debug_osd) << g_clock.now() << " osd" << osd->whoami << " " << (osd->osdmap ? osd->osdmap->get_epoch():0) << " " << *this << " "
 
 
 /******* PGLog ********/
 
+/*
+ * the copy_* find where to start by walking back from the top, then
+ * copy the entries after that in (at most) two pieces.
+ */
 void PG::Log::copy_after(const Log &other, eversion_t v) 
 {
   assert(v >= other.bottom);
   top = bottom = other.top;
-  for (list<Entry>::const_reverse_iterator i = other.log.rbegin();
-       i != other.log.rend();
-       i++) {
+  ringbuffer<Entry>::const_iterator from = other.log.end();
+  while (from != other.log.begin()) {
+    ringbuffer<Entry>::const_iterator i = from;
+    --i;
     if (i->version == v) break;
     assert(i->version > v);
-    log.push_front(*i);
+    from = i;
   }
+  log.clear();
+  log.append(from, other.log.end());
   bottom = v;
 }
 
@@ -67,9 +74,10 @@ A     B     C
       -> i return full backlog.
   */
 
-  for (list<Entry>::const_reverse_iterator i = other.log.rbegin();
-       i != other.log.rend();
-       i++) {
+  ringbuffer<Entry>::const_iterator from = other.log.end();
+  while (from != other.log.begin()) {
+    ringbuffer<Entry>::const_iterator i = from;
+    --i;
     // is primary divergent? 
     // e.g. my 3'6 vs their 2'6 split
     if (i->version.version == split.version && i->version.epoch > split.epoch) {
@@ -80,8 +88,10 @@ A     B     C
     assert(i->version > floor);
 
     // e.g. my 2'23 > '12
-    log.push_front(*i);
+    from = i;
   }
+  log.clear();
+  log.append(from, other.log.end());
   bottom = floor;
   return true;
 }
@@ -91,13 +101,15 @@ void PG::Log::copy_non_backlog(const Log &other)
   if (other.backlog) {
     top = other.top;
     bottom = other.bottom;
-    for (list<Entry>::const_reverse_iterator i = other.log.rbegin();
-         i != other.log.rend();
-         i++) 
-      if (i->version > bottom)
-        log.push_front(*i);
-      else
-        break;
+    ringbuffer<Entry>::const_iterator from = other.log.end();
+    while (from != other.log.begin()) {
+      ringbuffer<Entry>::const_iterator i = from;
+      --i;
+      if (i->version <= bottom) break;
+      from = i;
+    }
+    log.clear();
+    log.append(from, other.log.end());
   } else {
     *this = other;
   }
@@ -119,7 +131,7 @@ void PG::IndexedLog::trim(ObjectStore::Transaction& t, eversion_t s)
     assert(requested_to != log.begin());
 
     // remove from index,
-    unindex(e);
+    unindex(log.begin());
 
     // from log
     log.pop_front();
@@ -135,11 +147,11 @@ void PG::IndexedLog::trim_write_ahead(eversion_t last_update)
 {
   while (!log.empty() &&
          log.rbegin()->version > last_update) {
-    // remove from index
-    unindex(*log.rbegin());
-    
     // remove
     log.pop_back();
+
+    // an older entry for the same object may be the newest now
+    unindex();
   }
 }
 
@@ -173,29 +185,30 @@ void PG::proc_replica_log(Log &olog, Missing& omissing, int from)
     peer_missing[from] = omissing;
 
     // iterate over peer log. in reverse.
-    list<Log::Entry>::reverse_iterator pp = olog.log.rbegin();
+    ringbuffer<Log::Entry>::reverse_iterator pp = olog.log.rbegin();
     eversion_t lu = peer_info[from].last_update;
     while (pp != olog.log.rend()) {
-      if (!log.objects.count(pp->oid)) {
+      if (!log.logged_object(pp->oid)) {
         dout(10) << " divergent " << *pp << " not in our log, generating backlog" << dendl;
         generate_backlog();
       }
       
-      if (!log.objects.count(pp->oid)) {
+      Log::Entry *latest = log.latest(pp->oid);
+      if (!latest) {
         dout(10) << " divergent " << *pp << " dne, must have been new, ignoring" << dendl;
         ++pp;
         continue;
       } 
 
-      if (log.objects[pp->oid]->version == pp->version) {
+      if (latest->version == pp->version) {
         break;  // we're no longer divergent.
         //++pp;
         //continue;
       }
 
-      if (log.objects[pp->oid]->version > pp->version) {
+      if (latest->version > pp->version) {
         dout(10) << " divergent " << *pp
-                 << " superceded by " << log.objects[pp->oid]
+                 << " superceded by " << *latest
                  << ", ignoring" << dendl;
       } else {
         dout(10) << " divergent " << *pp << ", adding to missing" << dendl;
@@ -241,7 +254,7 @@ void PG::merge_log(Log &olog, Missing &omissing, int fromosd)
 
     // find split point (old log.top) in new log
     // add new items to missing along the way.
-    for (list<Log::Entry>::reverse_iterator p = log.log.rbegin();
+    for (ringbuffer<Log::Entry>::reverse_iterator p = log.log.rbegin();
          p != log.log.rend();
          p++) {
       if (p->version <= log.top) {
@@ -256,15 +269,16 @@ void PG::merge_log(Log &olog, Missing &omissing, int fromosd)
           while (!olog.log.empty() && 
                  olog.log.rbegin()->version > p->version) {
             Log::Entry &oe = *olog.log.rbegin();  // old entry (possibly divergent)
-            if (log.objects.count(oe.oid)) {
-              if (log.objects[oe.oid]->version < oe.version) {
+            Log::Entry *latest = log.latest(oe.oid);
+            if (latest) {
+              if (latest->version < oe.version) {
                 dout(10) << "merge_log  divergent entry " << oe
-                         << " not superceded by " << *log.objects[oe.oid]
+                         << " not superceded by " << *latest
                          << ", adding to missing" << dendl;
                 missing.add(oe.oid, oe.version);
               } else {
                 dout(10) << "merge_log  divergent entry " << oe
-                         << " superceded by " << *log.objects[oe.oid] 
+                         << " superceded by " << *latest
                          << ", ignoring" << dendl;
               }
             } else {
@@ -302,16 +316,13 @@ void PG::merge_log(Log &olog, Missing &omissing, int fromosd)
              << dendl;
       
       // ok
-      list<Log::Entry>::iterator from = olog.log.begin();
-      list<Log::Entry>::iterator to;
+      ringbuffer<Log::Entry>::iterator from = olog.log.begin();
+      ringbuffer<Log::Entry>::iterator to;
       for (to = from;
            to != olog.log.end();
            to++) {
         if (to->version > log.bottom) break;
         
-        // update our index while we're here
-        log.index(*to);
-        
         dout(15) << *to << dendl;
         
         // new missing object?
@@ -324,9 +335,14 @@ void PG::merge_log(Log &olog, Missing &omissing, int fromosd)
       }
       assert(to != olog.log.end());
       
-      // splice into our log.
-      log.log.splice(log.log.begin(),
-                     olog.log, from, to);
+      // move them to the front of our log, and index them.
+      for (ringbuffer<Log::Entry>::iterator p = to; p != from; ) {
+        --p;
+        log.log.push_front(*p);
+        log.index(log.log.begin());
+      }
+      while (olog.log.begin() != to)
+        olog.log.pop_front();
       
       info.log_bottom = log.bottom = olog.bottom;
       info.log_backlog = log.backlog = olog.backlog;
@@ -337,8 +353,8 @@ void PG::merge_log(Log &olog, Missing &omissing, int fromosd)
         olog.bottom <= log.top) {
       dout(10) << "merge_log extending top to " << olog.top << dendl;
       
-      list<Log::Entry>::iterator to = olog.log.end();
-      list<Log::Entry>::iterator from = olog.log.end();
+      ringbuffer<Log::Entry>::iterator to = olog.log.end();
+      ringbuffer<Log::Entry>::iterator from = olog.log.end();
       while (1) {
         if (from == olog.log.begin()) break;
         from--;
@@ -348,7 +364,6 @@ void PG::merge_log(Log &olog, Missing &omissing, int fromosd)
           break;
         }
         
-        log.index(*from);
         dout(10) << "merge_log " << *from << dendl;
         
         // add to missing
@@ -359,6 +374,7 @@ void PG::merge_log(Log &olog, Missing &omissing, int fromosd)
       }
       
       // remove divergent items
+      bool popped = false;
       while (1) {
         Log::Entry *oldtail = &(*log.log.rbegin());
         if (oldtail->version.version+1 == from->version.version) break;
@@ -366,7 +382,12 @@ void PG::merge_log(Log &olog, Missing &omissing, int fromosd)
         // divergent!
         assert(oldtail->version.version >= from->version.version);
         
-        if (log.objects[oldtail->oid]->version == oldtail->version) {
+        // oldtail is our newest for its object; is a newer one coming?
+        bool superceded = false;
+        for (ringbuffer<Log::Entry>::iterator p = from; p != to; p++)
+          if (p->oid == oldtail->oid && p->version > oldtail->version)
+            superceded = true;
+        if (!superceded) {
           // and significant.
           dout(10) << "merge_log had divergent " << *oldtail << ", adding to missing" << dendl;
           //missing.add(oldtail->oid);
@@ -376,11 +397,19 @@ void PG::merge_log(Log &olog, Missing &omissing, int fromosd)
           assert(missing.is_missing(oldtail->oid));
         }
         log.log.pop_back();
+        popped = true;
       }
-
-      // splice
-      log.log.splice(log.log.end(), 
-                     olog.log, from, to);
+      if (popped)
+        log.unindex();
+
+      // append, and index
+      unsigned n = 0;
+      for (ringbuffer<Log::Entry>::iterator p = from; p != to; p++, n++) {
+        log.log.push_back(*p);
+        log.index(--log.log.end());
+      }
+      while (n--)
+        olog.log.pop_back();
       
       info.last_update = log.top = olog.top;
     }
@@ -424,46 +453,60 @@ void PG::proc_missing(Log &olog, Missing &omissing, int fromosd)
 
 
 
+struct entry_version_lt {
+  bool operator()(const PG::Log::Entry& a, const PG::Log::Entry& b) const {
+    return a.version < b.version;
+  }
+};
+
 void PG::generate_backlog()
 {
   dout(10) << "generate_backlog to " << log << dendl;
   assert(!log.backlog);
   log.backlog = true;
 
-  list<pobject_t> olist;
-  osd->store->collection_list(info.pgid, olist);
-  
+  // walk the collection a piece at a time, so we never hold a list of
+  // everything in it (or hold the store for the whole walk).
   int local = 0;
-  map<eversion_t,Log::Entry> add;
-  for (list<pobject_t>::iterator it = olist.begin();
-       it != olist.end();
-       it++) {
-    local++;
-    object_t oid = it->oid;
-
-    if (log.logged_object(oid)) continue; // already have it logged.
+  vector<Log::Entry> add;
+  ObjectStore::ListCursor cursor;
+  vector<pobject_t> olist;
+  while (osd->store->collection_list_partial(info.pgid, cursor, g_conf.osd_list_max, olist) > 0) {
+    for (vector<pobject_t>::iterator it = olist.begin();
+	 it != olist.end();
+	 it++) {
+      local++;
+      object_t oid = it->oid;
+
+      if (log.logged_object(oid)) continue; // already have it logged.
     
-    // add entry
-    Log::Entry e;
-    e.op = Log::Entry::MODIFY;           // FIXME when we do smarter op codes!
-    e.oid = oid;
-    osd->store->getattr(pobject_t(0,0,oid), 
-                        "version",
-                        &e.version, sizeof(e.version));
-    add[e.version] = e;
-    dout(10) << "generate_backlog found " << e << dendl;
+      // add entry
+      Log::Entry e;
+      e.op = Log::Entry::MODIFY;           // FIXME when we do smarter op codes!
+      e.oid = oid;
+      osd->store->getattr(*it, 
+			  "version",
+			  &e.version, sizeof(e.version));
+      add.push_back(e);
+      dout(10) << "generate_backlog found " << e << dendl;
+    }
   }
 
-  for (map<eversion_t,Log::Entry>::reverse_iterator i = add.rbegin();
-       i != add.rend();
-       i++) {
-    log.log.push_front(i->second);
-    log.index( *log.log.begin() );    // index
+  // oldest first; one entry per version (the last one found)
+  stable_sort(add.begin(), add.end(), entry_version_lt());
+  int added = 0;
+  log.log.reserve(log.log.size() + add.size());
+  for (int i = (int)add.size() - 1; i >= 0; i--) {
+    if (i + 1 < (int)add.size() && add[i].version == add[i+1].version)
+      continue;
+    log.log.push_front(add[i]);
+    log.index( log.log.begin() );    // index
+    added++;
   }
 
   dout(10) << local << " local objects, "
-           << add.size() << " objects added to backlog, " 
-           << log.objects.size() << " in pg" << dendl;
+           << added << " objects added to backlog, " 
+           << log.num_objects() << " in pg" << dendl;
 
   //log.print(cout);
 }
@@ -481,7 +524,7 @@ void PG::drop_backlog()
     if (e.version > log.bottom) break;
 
     dout(15) << "drop_backlog trimming " << e.version << dendl;
-    log.unindex(e);
+    log.unindex(log.log.begin());
     log.log.pop_front();
   }
 }
@@ -493,7 +536,7 @@ void PG::drop_backlog()
 ostream& PG::Log::print(ostream& out) const 
 {
   out << *this << dendl;
-  for (list<Entry>::const_iterator p = log.begin();
+  for (ringbuffer<Entry>::const_iterator p = log.begin();
        p != log.end();
        p++) 
     out << *p << dendl;
@@ -864,7 +907,7 @@ void PG::activate(ObjectStore::Transaction& t,
   // init complete pointer
   if (info.last_complete == info.last_update) {
     dout(10) << "activate - complete" << dendl;
-    log.complete_to == log.log.end();
+    log.complete_to = log.log.end();
     log.requested_to = log.log.end();
   } 
   else if (true) {
@@ -931,7 +974,7 @@ void PG::activate(ObjectStore::Transaction& t,
       if (m) {
         eversion_t plu = peer_info[peer].last_update;
         Missing& pm = peer_missing[peer];
-        for (list<Log::Entry>::iterator p = m->log.log.begin();
+        for (ringbuffer<Log::Entry>::iterator p = m->log.log.begin();
              p != m->log.log.end();
              p++) 
           if (p->version > plu)
@@ -1024,6 +1067,7 @@ void PG::update_stats()
     pg_stats_lock.Lock();
     pg_stats.reported = info.last_update;
     pg_stats.state = state;
+    pg_stats.primary = osd->whoami;
     pg_stats.num_bytes = stat_num_bytes;
     pg_stats.num_blocks = stat_num_blocks;
     pg_stats_lock.Unlock();
@@ -1038,6 +1082,13 @@ void PG::update_stats()
 }
 
 
+/*
+ * the ondisk log is the entries as they are in memory, one after
+ * another (or one per block with osd_pad_pg_log), so it loads with a
+ * read and a copy.
+ */
+typedef char __pg_log_entries_fill_blocks[(4096 % sizeof(PG::Log::Entry)) == 0 ? 1 : -1];
+
 void PG::write_log(ObjectStore::Transaction& t)
 {
   dout(10) << "write_log" << dendl;
@@ -1048,24 +1099,37 @@ void PG::write_log(ObjectStore::Transaction& t)
   // build buffer
   ondisklog.bottom = 0;
   ondisklog.block_map.clear();
-  for (list<Log::Entry>::iterator p = log.log.begin();
-       p != log.log.end();
-       p++) {
-    if (bl.length() % 4096 == 0)
+  if (g_conf.osd_pad_pg_log) {  // pad to 4k, until i fix ebofs reallocation crap.  FIXME.
+    for (ringbuffer<Log::Entry>::iterator p = log.log.begin();
+	 p != log.log.end();
+	 p++) {
       ondisklog.block_map[bl.length()] = p->version;
-    bl.append((char*)&(*p), sizeof(*p));
-    if (g_conf.osd_pad_pg_log) {  // pad to 4k, until i fix ebofs reallocation crap.  FIXME.
+      bl.append((char*)&(*p), sizeof(*p));
       bufferptr bp(4096 - sizeof(*p));
       bl.push_back(bp);
     }
+  } else {
+    for (ringbuffer<Log::Entry>::iterator p = log.log.begin();
+	 p != log.log.end();
+	 p++) {
+      if (bl.length() % 4096 == 0)
+	ondisklog.block_map[bl.length()] = p->version;
+      bl.append((char*)&(*p), sizeof(*p));
+    }
   }
   ondisklog.top = bl.length();
+
+  // leave the ring room to double before we have to do this again
+  ondisklog.size = 4096;
+  while (ondisklog.size < 2 * ondisklog.top)
+    ondisklog.size *= 2;
   
   // write it
   t.remove( info.pgid.to_object() );
   t.write( info.pgid.to_object() , 0, bl.length(), bl);
   t.collection_setattr(info.pgid, "ondisklog_bottom", &ondisklog.bottom, sizeof(ondisklog.bottom));
   t.collection_setattr(info.pgid, "ondisklog_top", &ondisklog.top, sizeof(ondisklog.top));
+  t.collection_setattr(info.pgid, "ondisklog_size", &ondisklog.size, sizeof(ondisklog.size));
   
   t.collection_setattr(info.pgid, "info", &info, sizeof(info)); 
 }
@@ -1101,7 +1165,9 @@ void PG::trim_ondisklog_to(ObjectStore::Transaction& t, eversion_t v)
   
   t.collection_setattr(info.pgid, "ondisklog_bottom", &ondisklog.bottom, sizeof(ondisklog.bottom));
   t.collection_setattr(info.pgid, "ondisklog_top", &ondisklog.top, sizeof(ondisklog.top));
-  t.zero(info.pgid.to_object(), 0, ondisklog.bottom);
+  if (!ondisklog.size)
+    t.zero(info.pgid.to_object(), 0, ondisklog.bottom);
+  // else the ring reuses the space.
 }
 
 
@@ -1117,14 +1183,23 @@ void PG::append_log(ObjectStore::Transaction& t, PG::Log::Entry& logentry,
     bufferptr bp(4096 - sizeof(logentry));
     bl.push_back(bp);
   }
-  t.write( info.pgid.to_object(), ondisklog.top, bl.length(), bl );
+
+  if (ondisklog.size &&
+      ondisklog.top + (off_t)bl.length() - ondisklog.bottom > ondisklog.size) {
+    // ring is full; rewrite it (bigger).  logentry is already in log.
+    dout(10) << " ondisklog [" << ondisklog.bottom << "," << ondisklog.top
+	     << ") full at " << ondisklog.size << ", rewriting" << dendl;
+    write_log(t);
+  } else {
+    t.write( info.pgid.to_object(), ondisklog.ring_offset(ondisklog.top), bl.length(), bl );
   
-  // update block map?
-  if (ondisklog.top % 4096 == 0) 
-    ondisklog.block_map[ondisklog.top] = logentry.version;
+    // update block map?
+    if (ondisklog.top % 4096 == 0) 
+      ondisklog.block_map[ondisklog.top] = logentry.version;
   
-  ondisklog.top += bl.length();
-  t.collection_setattr(info.pgid, "ondisklog_top", &ondisklog.top, sizeof(ondisklog.top));
+    ondisklog.top += bl.length();
+    t.collection_setattr(info.pgid, "ondisklog_top", &ondisklog.top, sizeof(ondisklog.top));
+  }
   
   // trim?
   if (trim_to > log.bottom) {
@@ -1141,45 +1216,70 @@ void PG::read_log(ObjectStore *store)
 {
   int r;
   // load bounds
-  ondisklog.bottom = ondisklog.top = 0;
+  ondisklog.bottom = ondisklog.top = ondisklog.size = 0;
   r = store->collection_getattr(info.pgid, "ondisklog_bottom", &ondisklog.bottom, sizeof(ondisklog.bottom));
   assert(r == sizeof(ondisklog.bottom));
   r = store->collection_getattr(info.pgid, "ondisklog_top", &ondisklog.top, sizeof(ondisklog.top));
   assert(r == sizeof(ondisklog.top));
+  r = store->collection_getattr(info.pgid, "ondisklog_size", &ondisklog.size, sizeof(ondisklog.size));
+  if (r != sizeof(ondisklog.size))
+    ondisklog.size = 0;  // old layout
 
-  dout(10) << "read_log [" << ondisklog.bottom << "," << ondisklog.top << ")" << dendl;
+  dout(10) << "read_log [" << ondisklog.bottom << "," << ondisklog.top << ")"
+	   << " ring " << ondisklog.size << dendl;
 
   log.backlog = info.log_backlog;
   log.bottom = info.log_bottom;
   
   if (ondisklog.top > 0) {
-    // read
+    // read, in two pieces if it wraps
     bufferlist bl;
-    store->read(info.pgid.to_object(), ondisklog.bottom, ondisklog.top-ondisklog.bottom, bl);
-    if (bl.length() < ondisklog.top-ondisklog.bottom) {
+    off_t len = ondisklog.top - ondisklog.bottom;
+    off_t start = ondisklog.ring_offset(ondisklog.bottom);
+    off_t first = len;
+    if (ondisklog.size && start + len > ondisklog.size)
+      first = ondisklog.size - start;
+    store->read(info.pgid.to_object(), start, first, bl);
+    if (first < len) {
+      bufferlist rest;
+      store->read(info.pgid.to_object(), 0, len - first, rest);
+      bl.claim_append(rest);
+    }
+    if (bl.length() < len) {
       dout(0) << "read_log data doesn't match attrs" << dendl;
       assert(0);
     }
     
-    PG::Log::Entry e;
-    off_t pos = ondisklog.bottom;
     assert(log.log.empty());
-    while (pos < ondisklog.top) {
-      bl.copy(pos-ondisklog.bottom, sizeof(e), (char*)&e);
-      dout(10) << "read_log " << pos << " " << e << dendl;
-
-      if (e.version > log.bottom || log.backlog) { // ignore items below log.bottom
-        if (pos % 4096 == 0)
-	  ondisklog.block_map[pos] = e.version;
-        log.log.push_back(e);
-      } else {
-	dout(10) << "read_log ignoring entry at " << pos << dendl;
+    int64_t base = log.log.front_pos();
+    off_t stride = sizeof(PG::Log::Entry);
+    if (g_conf.osd_pad_pg_log)   // pad to 4k, until i fix ebofs reallocation crap.  FIXME.
+      stride = 4096;
+    if (stride == sizeof(PG::Log::Entry)) {
+      // back to back, as in memory; copy them in all at once.
+      unsigned n = len / stride;
+      bl.copy(0, n * stride, (char*)log.log.assign(n));
+    } else {
+      PG::Log::Entry e;
+      for (off_t pos = 0; pos < len; pos += stride) {
+	bl.copy(pos, sizeof(e), (char*)&e);
+	log.log.push_back(e);
       }
-      
-      if (g_conf.osd_pad_pg_log)   // pad to 4k, until i fix ebofs reallocation crap.  FIXME.
-	pos += 4096;
-      else
-	pos += sizeof(e);
+    }
+
+    // ignore items below log.bottom
+    while (!log.log.empty() && !log.backlog &&
+	   log.log.front().version <= log.bottom) {
+      dout(10) << "read_log ignoring " << log.log.front() << dendl;
+      log.log.pop_front();
+    }
+
+    for (off_t pos = (ondisklog.bottom + 4095) & ~4095LL;
+	 pos < ondisklog.top;
+	 pos += 4096) {
+      int64_t q = base + (pos - ondisklog.bottom) / stride;
+      if (log.log.contains(q))
+	ondisklog.block_map[pos] = log.log.at(q).version;
     }
   }
   log.top = info.last_update;
@@ -1187,7 +1287,7 @@ void PG::read_log(ObjectStore *store)
 
   // build missing
   set<object_t> did;
-  for (list<Log::Entry>::reverse_iterator i = log.log.rbegin();
+  for (ringbuffer<Log::Entry>::reverse_iterator i = log.log.rbegin();
        i != log.log.rend();
        i++) {
     if (i->version <= info.last_complete) break;
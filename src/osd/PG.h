@@ -26,6 +26,8 @@
 
 #include "common/DecayCounter.h"
 
+#include "include/ringbuffer.h"
+
 #include <list>
 #include <string>
 using namespace std;
@@ -69,6 +71,8 @@ public:
     epoch_t last_epoch_started;  // last epoch started.
     epoch_t last_epoch_finished; // last epoch finished.
 
+    utime_t last_scrub_stamp;    // last scrub finished (by primary)
+
     struct History {
       epoch_t same_since;          // same acting set since
       epoch_t same_primary_since;  // same primary at least back through this epoch.
@@ -231,7 +235,7 @@ public:
       bool is_update() const { return is_clone() || is_modify(); }
     };
 
-    list<Entry> log;  // the actual log.
+    ringbuffer<Entry> log;  // the actual log.
 
     Log() : backlog(false) {}
 
@@ -245,11 +249,18 @@ public:
       return top.version == 0 && top.epoch == 0;
     }
 
+    /*
+     * same bytes as a list<Entry>, but the entries are shared with
+     * the ring, not copied: leave the log alone while blist is in use
+     * (MOSDPGLog is done with its log once it's encoded).
+     */
     void _encode(bufferlist& blist) const {
       blist.append((char*)&top, sizeof(top));
       blist.append((char*)&bottom, sizeof(bottom));
       blist.append((char*)&backlog, sizeof(backlog));
-      ::_encode(log, blist);
+      uint32_t n = log.size();
+      blist.append((char*)&n, sizeof(n));
+      log.share(blist);
     }
     void _decode(bufferlist& blist, int& off) {
       blist.copy(off, sizeof(top), (char*)&top);
@@ -259,7 +270,11 @@ public:
       blist.copy(off, sizeof(backlog), (char*)&backlog);
       off += sizeof(backlog);
 
-      ::_decode(log, blist, off);
+      uint32_t n;
+      blist.copy(off, sizeof(n), (char*)&n);
+      off += sizeof(n);
+      blist.copy(off, n * sizeof(Entry), (char*)log.assign(n));
+      off += n * sizeof(Entry);
     }
 
     void copy_after(const Log &other, eversion_t v);
@@ -271,18 +286,33 @@ public:
   /**
    * IndexLog - adds in-memory index of the log, by oid.
    * plus some methods to manipulate it all.
+   *
+   * the index is built the first time it's used, so a pg that is
+   * loaded (or handed a log) and never looked at doesn't pay for it.
+   * it maps each oid to the position of its newest entry in the ring.
    */
   class IndexedLog : public Log {
-  public:
-    hash_map<object_t,Entry*> objects;  // ptrs into log.  be careful!
+    bool indexed;
+    hash_map<object_t,int64_t> objects;  // oid -> position of newest entry
     hash_set<osd_reqid_t>      caller_ops;
 
+    void build_index() {
+      for (ringbuffer<Entry>::iterator i = log.begin();
+           i != log.end();
+           i++) {
+        objects[i->oid] = i.get_pos();
+        caller_ops.insert(i->reqid);
+      }
+      indexed = true;
+    }
+
+  public:
     // recovery pointers
-    list<Entry>::iterator requested_to; // not inclusive of referenced item
-    list<Entry>::iterator complete_to;  // not inclusive of referenced item
+    ringbuffer<Entry>::iterator requested_to; // not inclusive of referenced item
+    ringbuffer<Entry>::iterator complete_to;  // not inclusive of referenced item
     
     /****/
-    IndexedLog() {}
+    IndexedLog() : indexed(false) {}
 
     void clear() {
       assert(0);
@@ -290,50 +320,64 @@ public:
       Log::clear();
     }
 
+    Entry *latest(object_t oid) {
+      if (!indexed) build_index();
+      hash_map<object_t,int64_t>::iterator p = objects.find(oid);
+      if (p == objects.end()) return 0;
+      return &log.at(p->second);
+    }
+    unsigned num_objects() {
+      if (!indexed) build_index();
+      return objects.size();
+    }
+
     bool logged_object(object_t oid) {
-      return objects.count(oid);
+      return latest(oid);
     }
     bool logged_req(const osd_reqid_t &r) {
+      if (!indexed) build_index();
       return caller_ops.count(r);
     }
 
+    // (re)build on next use
     void index() {
-      objects.clear();
-      caller_ops.clear();
-      for (list<Entry>::iterator i = log.begin();
-           i != log.end();
-           i++) {
-        objects[i->oid] = &(*i);
-        caller_ops.insert(i->reqid);
-      }
+      unindex();
     }
 
-    void index(Entry& e) {
-      if (objects.count(e.oid) == 0 || 
-          objects[e.oid]->version < e.version)
-        objects[e.oid] = &e;
-      caller_ops.insert(e.reqid);
+    void index(ringbuffer<Entry>::iterator i) {
+      if (!indexed) return;
+      hash_map<object_t,int64_t>::iterator p = objects.find(i->oid);
+      if (p == objects.end())
+        objects[i->oid] = i.get_pos();
+      else if (log.at(p->second).version < i->version)
+        p->second = i.get_pos();
+      caller_ops.insert(i->reqid);
     }
     void unindex() {
       objects.clear();
       caller_ops.clear();
+      indexed = false;
     }
-    void unindex(Entry& e) {
+    void unindex(ringbuffer<Entry>::iterator i) {
       // NOTE: this only works if we remove from the _bottom_ of the log!
-      assert(objects.count(e.oid));
-      if (objects[e.oid]->version == e.version)
-        objects.erase(e.oid);
-      caller_ops.erase(e.reqid);
+      if (!indexed) return;
+      hash_map<object_t,int64_t>::iterator p = objects.find(i->oid);
+      assert(p != objects.end());
+      if (p->second == i.get_pos())
+        objects.erase(p);
+      caller_ops.erase(i->reqid);
     }
 
 
     // accessors
     Entry *is_updated(object_t oid) {
-      if (objects.count(oid) && objects[oid]->is_update()) return objects[oid];
+      Entry *e = latest(oid);
+      if (e && e->is_update()) return e;
       return 0;
     }
     Entry *is_deleted(object_t oid) {
-      if (objects.count(oid) && objects[oid]->is_delete()) return objects[oid];
+      Entry *e = latest(oid);
+      if (e && e->is_delete()) return e;
       return 0;
     }
     
@@ -346,8 +390,10 @@ public:
       top = e.version;
 
       // to our index
-      objects[e.oid] = &(log.back());
-      caller_ops.insert(e.reqid);
+      if (indexed) {
+        objects[e.oid] = log.end_pos() - 1;
+        caller_ops.insert(e.reqid);
+      }
     }
 
     void trim(ObjectStore::Transaction &t, eversion_t s);
@@ -357,15 +403,24 @@ public:
 
   /**
    * OndiskLog - some info about how we store the log on disk.
+   *
+   * the log object is a ring of 'size' bytes (a multiple of 4096, so
+   * each block holds a whole number of entries and none straddle the
+   * wrap).  bottom and top only ever grow; the entry at offset o is at
+   * o % size in the object.  size 0 is the old layout, where the
+   * object simply grows.
    */
   class OndiskLog {
   public:
     // ok
     off_t bottom;                     // first byte of log. 
     off_t top;                        // byte following end of log.
+    off_t size;                       // of the ring, or 0
     map<off_t,eversion_t> block_map;  // block -> first stamp logged there
 
-    OndiskLog() : bottom(0), top(0) {}
+    OndiskLog() : bottom(0), top(0), size(0) {}
+
+    off_t ring_offset(off_t o) const { return size ? o % size : o; }
 
     bool trim_to(eversion_t v, ObjectStore::Transaction& t);
   };
@@ -380,6 +435,7 @@ public:
   static const int STATE_CLEAN =  2;  // peers are complete, clean of stray replicas.
   static const int STATE_CRASHED = 4; // all replicas went down.
   static const int STATE_REPLAY = 8;  // crashed, waiting for replay
+  static const int STATE_SCRUBBING = 32; // comparing replicas' content
  
   // non-primary
   static const int STATE_STRAY =  16; // i must notify the primary i exist.
@@ -391,6 +447,7 @@ public:
     if (state & STATE_CRASHED) st += "crashed+";
     if (state & STATE_REPLAY) st += "replay+";
     if (state & STATE_STRAY) st += "stray+";
+    if (state & STATE_SCRUBBING) st += "scrubbing+";
     if (!st.length()) 
       st = "inactive";
     else 
@@ -417,6 +474,9 @@ public:
     //cout << this << " " << info.pgid << " lock" << endl;
     _lock.Lock();
   }
+  bool try_lock() {
+    return _lock.TryLock();
+  }
   void unlock() {
     //cout << this << " " << info.pgid << " unlock" << endl;
     _lock.Unlock();
@@ -488,7 +548,7 @@ protected:
   
   hash_map<object_t, list<Message*> > waiting_for_wr_unlock; 
 
-  bool block_if_wrlocked(MOSDOp* op);
+  virtual bool block_if_wrlocked(MOSDOp* op);
 
 
   // recovery
@@ -503,6 +563,8 @@ protected:
 
   Mutex pg_stats_lock;
   pg_stat_t pg_stats;
+  pg_stat_t pg_stats_sent;       // what the monitor last heard from us
+  utime_t pg_stats_sent_stamp;
 
   void update_stats();
 
@@ -617,6 +679,7 @@ public:
   //bool       is_complete()    { return state_test(STATE_COMPLETE); }
   bool       is_clean() const { return state_test(STATE_CLEAN); }
   bool       is_stray() const { return state_test(STATE_STRAY); }
+  bool       is_scrubbing() const { return state_test(STATE_SCRUBBING); }
 
   bool  is_empty() const { return info.last_update == eversion_t(0,0); }
 
@@ -660,6 +723,11 @@ public:
   virtual void on_acker_change() = 0;
   virtual void on_role_change() = 0;
   virtual void on_change() = 0;
+
+  // scrub [primary, osd_lock held]; only some pg types know how
+  virtual bool scrub_start() { return false; }
+  virtual bool scrub_ready() { return false; }
+  virtual void scrub_queue() { }
 };
 
 
@@ -1,4 +1,4 @@
-// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*- 
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
 /*
  * Ceph - scalable distributed file system
  *
@@ -6,9 +6,9 @@
  *
  * This is free software; you can redistribute it and/or
  * modify it under the terms of the GNU Lesser General Public
- * License version 2.1, as published by the Free Software 
+ * License version 2.1, as published by the Free Software
  * Foundation.  See file COPYING.
- * 
+ *
  */
 
 #include "RAID4PG.h"
@@ -18,18 +18,203 @@
 
 #include "messages/MOSDOp.h"
 #include "messages/MOSDOpReply.h"
+#include "messages/MOSDSubOp.h"
+#include "messages/MOSDSubOpReply.h"
 
 #include "messages/MOSDPGNotify.h"
 #include "messages/MOSDPGRemove.h"
 
 #include "config.h"
 
-#define  dout(l)    if (l<=g_conf.debug || l<=g_conf.debug_osd) *_dout << dbeginl << g_clock.now() << " osd" << osd->get_nodeid() << " " << (osd->osdmap ? osd->osdmap->get_epoch():0) << " " << *this << " "
+#define  dout(l)    dout_if(l, l<=g_conf.debug || l<=g_conf.debug_osd) << g_clock.now() << " osd" << osd->get_nodeid() << " " << (osd->osdmap ? osd->osdmap->get_epoch():0) << " " << *this << " "
+#define  derr(l)    derr_if(l, l<=g_conf.debug || l<=g_conf.debug_osd) << g_clock.now() << " osd" << osd->get_nodeid() << " " << (osd->osdmap ? osd->osdmap->get_epoch():0) << " " << *this << " "
 
 #include <errno.h>
 #include <sys/stat.h>
 
 
+RAID4PG::RAID4PG(OSD *o, pg_t p) : PG(o, p), num_recovering(0)
+{
+  int n = p.size();
+  int m = MIN(g_conf.osd_raid_parity, n-1);
+  if (m < 0) m = 0;
+  rs = new ReedSolomon(n - m, m);
+  chunk_size = g_conf.osd_raid_chunk_size;
+}
+
+RAID4PG::~RAID4PG()
+{
+  for (hash_map<tid_t,ECOp*>::iterator p = ec_ops.begin();
+       p != ec_ops.end();
+       p++) {
+    if (p->second->op)
+      delete p->second->op;
+    delete p->second;
+  }
+  delete rs;
+}
+
+
+// =======================
+// chunk layout
+
+/*
+ * chunk rank -> osd, -1 if that position is down (or not acting).
+ * the rank is the raw CRUSH position, which (with an indep rule)
+ * doesn't shift when other osds fail.
+ */
+void RAID4PG::get_chunk_osds(vector<int>& osds)
+{
+  vector<int> raw;
+  osd->osdmap->pg_to_osds(info.pgid, raw);
+  osds.assign(get_k() + get_m(), -1);
+  for (unsigned i=0; i<raw.size() && i<osds.size(); i++)
+    if (raw[i] >= 0 &&
+	osd->osdmap->is_up(raw[i]) &&
+	is_acting(raw[i]))
+      osds[i] = raw[i];
+}
+
+static int find_rank(vector<int>& osds, int o)
+{
+  for (unsigned i=0; i<osds.size(); i++)
+    if (osds[i] == o)
+      return i;
+  return -1;
+}
+
+bool RAID4PG::has_chunk(int o, object_t oid)
+{
+  if (o < 0)
+    return false;
+  if (o == osd->get_nodeid())
+    return !missing.is_missing(oid);
+  return !(peer_missing.count(o) && peer_missing[o].is_missing(oid));
+}
+
+/*
+ * copy logical bytes off~len to or from the chunk buffers, which hold
+ * stripes first_stripe.. .  a null buf (to_chunks) zeros.
+ */
+void RAID4PG::copy_stripes(vector<bufferptr>& chunks, off_t first_stripe,
+			   off_t off, off_t len, const char *buf, bool to_chunks)
+{
+  off_t sw = get_stripe_width();
+  while (len > 0) {
+    off_t s = off / sw;
+    int r = (off % sw) / chunk_size;
+    off_t o = off % chunk_size;
+    off_t l = MIN(len, chunk_size - o);
+    char *c = chunks[r].c_str() + (s - first_stripe) * chunk_size + o;
+    if (to_chunks) {
+      if (buf)
+	memcpy(c, buf, l);
+      else
+	memset(c, 0, l);
+    } else
+      memcpy((char*)buf, c, l);
+    if (buf)
+      buf += l;
+    off += l;
+    len -= l;
+  }
+}
+
+/*
+ * the stripes [s0,s1) a modify rewrites, and the logical range
+ * woff~wlen it supplies new bytes for; the rest of any stripe below the
+ * old size has to be read first.
+ */
+void RAID4PG::get_write_stripes(MOSDOp *op, off_t size,
+				off_t& s0, off_t& s1, off_t& woff, off_t& wlen)
+{
+  off_t sw = get_stripe_width();
+  woff = op->get_offset();
+  wlen = op->get_length();
+  s0 = s1 = 0;
+
+  switch (op->get_op()) {
+  case CEPH_OSD_OP_WRITE:
+  case CEPH_OSD_OP_ZERO:
+    if (wlen) {
+      s0 = woff / sw;
+      s1 = (woff + wlen + sw - 1) / sw;
+    }
+    break;
+
+  case CEPH_OSD_OP_TRUNCATE:
+    // rewrite the stripe we cut in the middle of, then truncate the
+    // chunks at its end (or, if we grow or cut on a stripe boundary,
+    // just truncate them).
+    woff = op->get_length();
+    wlen = 0;
+    if (woff < size && woff % sw) {
+      s0 = woff / sw;
+      s1 = s0 + 1;
+    } else
+      s0 = s1 = get_chunk_length(woff) / chunk_size;
+    break;
+  }
+}
+
+int RAID4PG::get_local_chunk(pobject_t poid, eversion_t& v, off_t& size)
+{
+  struct stat st;
+  int r = osd->store->stat(poid, &st);
+  if (r < 0)
+    return r;
+  v = eversion_t();
+  size = 0;
+  osd->store->getattr(poid, "version", &v, sizeof(v));
+  osd->store->getattr(poid, "size", &size, sizeof(size));
+  return 0;
+}
+
+
+// =======================
+// ops
+
+RAID4PG::ECOp *RAID4PG::new_ec_op(MOSDOp *op, object_t oid)
+{
+  ECOp *e = new ECOp(op, oid, osd->get_tid());
+  get_chunk_osds(e->osds);
+  e->start = g_clock.now();
+  ec_ops[e->rep_tid] = e;
+  assert(object_ops.count(oid) == 0);
+  object_ops[oid] = e;
+  if (!op)
+    num_recovering++;
+  return e;
+}
+
+void RAID4PG::finish_ec_op(ECOp *e)
+{
+  dout(15) << "finish_ec_op " << e->rep_tid << " " << e->oid
+	   << " " << (g_clock.now() - e->start) << dendl;
+  ec_ops.erase(e->rep_tid);
+  object_ops.erase(e->oid);
+  if (e->op)
+    delete e->op;
+  else
+    num_recovering--;
+
+  if (waiting_for_object.count(e->oid)) {
+    osd->take_waiters(waiting_for_object[e->oid]);
+    waiting_for_object.erase(e->oid);
+  }
+  delete e;
+}
+
+void RAID4PG::reply_op(MOSDOp *op, int result)
+{
+  dout(10) << "reply_op " << *op << " = " << result << dendl;
+  MOSDOpReply *reply = new MOSDOpReply(op, result, osd->osdmap->get_epoch(), true);
+  osd->messenger->send_message(reply, op->get_client_inst());
+  osd->perf->tinc(op->is_read() ? l_osd_r_lat:l_osd_w_commit_lat,
+		  g_clock.now() - op->get_recv_stamp());
+  delete op;
+}
+
 
 bool RAID4PG::preprocess_op(MOSDOp *op, utime_t now)
 {
@@ -38,129 +223,1356 @@ bool RAID4PG::preprocess_op(MOSDOp *op, utime_t now)
 
 void RAID4PG::do_op(MOSDOp *op)
 {
+  dout(15) << "do_op " << *op << dendl;
 
-  // a write will do something like
-  object_t oid = op->get_oid();   // logical object
-  pg_t pg = op->get_pg();
-  ceph_object_layout layout = op->get_layout();
-  bufferlist data = op->get_data();
-  off_t off = op->get_offset();
-  off_t left = op->get_length();
+  osd->perf->inc(l_osd_op);
 
-  // map data onto pobjects
-  int n = pg.size() - 1;  // n+1 raid4
-  int rank = (off % layout.ol_stripe_unit) % n;
-  off_t off_in_bl = 0;
-  while (left > 0) {
-    pobject_t po(0, rank, oid);
-    off_t off_in_po = off % layout.ol_stripe_unit;
-    off_t stripe_unit_end = off - off_in_po + layout.ol_stripe_unit;
-    off_t len_in_po = MAX(left, stripe_unit_end-off);
-    bufferlist data_in_po;
-    data_in_po.substr_of(data, off_in_bl, len_in_po);
-    
-    // next!
-    off_in_bl += len_in_po;
-    rank++;
-    if (rank == n) rank = 0;
+  if (!is_primary()) {
+    // only the primary can put an object back together.
+    dout(10) << "do_op not primary, fwd to osd" << get_primary() << dendl;
+    osd->messenger->send_message(op, osd->osdmap->get_inst(get_primary()));
+    return;
   }
 
-  
-  
+  // one op on an object at a time
+  object_t oid = op->get_oid();
+  if (object_ops.count(oid)) {
+    dout(10) << "do_op " << oid << " busy, waiting" << dendl;
+    waiting_for_object[oid].push_back(op);
+    return;
+  }
+
+  switch (op->get_op()) {
+
+    // reads
+  case CEPH_OSD_OP_READ:
+  case CEPH_OSD_OP_STAT:
+    op_read(op);
+    break;
 
+    // writes
+  case CEPH_OSD_OP_WRNOOP:
+  case CEPH_OSD_OP_WRITE:
+  case CEPH_OSD_OP_ZERO:
+  case CEPH_OSD_OP_DELETE:
+  case CEPH_OSD_OP_TRUNCATE:
+    op_modify(op);
+    break;
+
+  default:
+    // no locks or read balancing on a raid pg
+    dout(10) << "do_op " << MOSDOp::get_opname(op->get_op()) << " not supported" << dendl;
+    reply_op(op, -EOPNOTSUPP);
+  }
 }
 
 void RAID4PG::do_sub_op(MOSDSubOp *op)
 {
+  dout(15) << "do_sub_op " << *op << dendl;
+
+  osd->perf->inc(l_osd_subop);
+
+  switch (op->get_op()) {
+  case CEPH_OSD_OP_READ:
+    sub_op_read(op);
+    break;
+
+  case CEPH_OSD_OP_PUSH:
+    sub_op_push(op);
+    break;
+
+  case CEPH_OSD_OP_WRITE:
+  case CEPH_OSD_OP_DELETE:
+  case CEPH_OSD_OP_TRUNCATE:
+    sub_op_modify(op);
+    break;
 
+  default:
+    assert(0);
+  }
 }
 
-void RAID4PG::do_sub_op_reply(MOSDSubOpReply *reply)
+void RAID4PG::do_sub_op_reply(MOSDSubOpReply *r)
 {
+  tid_t rep_tid = r->get_rep_tid();
+  int fromosd = r->get_source().num();
+  osd->take_peer_stat(fromosd, r->get_peer_stat());
+
+  if (ec_ops.count(rep_tid) == 0) {
+    dout(10) << "do_sub_op_reply " << *r << ", rep_tid dne" << dendl;
+    delete r;
+    return;
+  }
+  ECOp *e = ec_ops[rep_tid];
 
+  if (r->get_op() == CEPH_OSD_OP_READ) {
+    if (e->writing) {
+      dout(10) << "do_sub_op_reply " << *r << ", already writing" << dendl;
+    } else {
+      got_chunk(e, r->get_poid().rank, r->get_offset(), r->get_result(),
+		r->get_data(), r->get_attrset());
+      check_reads(e);
+    }
+  } else {
+    op_commit(rep_tid, fromosd, r->get_pg_complete_thru());
+  }
+  delete r;
 }
 
 
 
-// -----------------
-// pg changes
+// ========================================================================
+// READS (gather chunks)
 
-bool RAID4PG::same_for_read_since(epoch_t e)
+/*
+ * ask for the chunks we still need: just the data chunks the op
+ * touches if we can, else any k.  local chunks are read right away.
+ */
+void RAID4PG::start_reads(ECOp *e)
 {
-  return e >= info.history.same_since;   // whole pg set same
+  int k = get_k(), n = k + get_m();
+
+  vector<bool> avail(n);
+  int navail = 0;
+  bool direct = true;
+  for (int r=0; r<n; r++) {
+    avail[r] = !e->bad_ranks.count(r) && has_chunk(e->osds[r], e->oid);
+    if (avail[r]) navail++;
+  }
+  for (set<int>::iterator p = e->need_ranks.begin(); p != e->need_ranks.end(); p++)
+    if (!avail[*p])
+      direct = false;
+
+  set<int> want;
+  if (direct) {
+    want = e->need_ranks;
+  } else {
+    if (navail < k) {
+      dout(0) << "start_reads " << e->oid << " only " << navail << " of " << k
+	      << " chunks available" << dendl;
+      read_error(e);
+      return;
+    }
+    // what we've already read, then data before parity
+    for (int r=0; r<n; r++)
+      if (avail[r] && e->read_ranks.count(r))
+	want.insert(r);
+    for (int r=0; r<n && (int)want.size() < k; r++)
+      if (avail[r])
+	want.insert(r);
+  }
+
+  list<int> ask;
+  for (set<int>::iterator p = want.begin(); p != want.end(); p++) {
+    if (e->read_ranks.count(*p)) continue;
+    e->read_ranks.insert(*p);
+    for (unsigned i=0; i<e->extents.size(); i++)
+      e->waitfor_read.insert(pair<int,off_t>(*p, e->extents[i].first));
+    if (e->osds[*p] == osd->get_nodeid())
+      ask.push_back(*p);      // locals last, so we don't finish early
+    else
+      ask.push_front(*p);
+  }
+
+  dout(10) << "start_reads " << e->oid << " v " << e->version
+	   << " need " << e->need_ranks << " reading " << e->read_ranks
+	   << " bad " << e->bad_ranks << dendl;
+
+  if (ask.empty() && e->waitfor_read.empty()) {
+    // nothing new to ask for.  if we still aren't there, we never will be.
+    set<int> good;
+    for (set<int>::iterator p = e->read_ranks.begin(); p != e->read_ranks.end(); p++)
+      if (!e->bad_ranks.count(*p))
+	good.insert(*p);
+    bool have_need = true;
+    for (set<int>::iterator p = e->need_ranks.begin(); p != e->need_ranks.end(); p++)
+      if (!good.count(*p))
+	have_need = false;
+    if (!have_need && (int)good.size() < k) {
+      read_error(e);
+      return;
+    }
+  }
+
+  for (list<int>::iterator p = ask.begin(); p != ask.end(); p++)
+    for (unsigned i=0; i<e->extents.size(); i++)
+      read_chunk(e, *p, e->extents[i].first, e->extents[i].second);
+
+  check_reads(e);
 }
 
-bool RAID4PG::same_for_modify_since(epoch_t e)
+void RAID4PG::read_chunk(ECOp *e, int rank, off_t off, off_t len)
 {
-  return e >= info.history.same_since;   // whole pg set same
+  pobject_t poid(0, rank, e->oid);
+  int o = e->osds[rank];
+
+  if (o == osd->get_nodeid()) {
+    bufferlist bl;
+    map<string,bufferptr> attrs;
+    int r = osd->store->read(poid, off, len, bl);
+    if (r >= 0)
+      osd->store->getattrs(poid, attrs);
+    got_chunk(e, rank, off, r, bl, attrs);
+  } else {
+    dout(10) << "read_chunk " << poid << " " << off << "~" << len << " from osd" << o << dendl;
+    osd_reqid_t reqid;
+    if (e->op)
+      reqid = e->op->get_reqid();
+    MOSDSubOp *op = new MOSDSubOp(reqid, info.pgid, poid, CEPH_OSD_OP_READ, off, len,
+				  osd->osdmap->get_epoch(), e->rep_tid, e->version);
+    osd->messenger->send_message(op, osd->osdmap->get_inst(o));
+  }
 }
 
-bool RAID4PG::same_for_rep_modify_since(epoch_t e)
+void RAID4PG::got_chunk(ECOp *e, int rank, off_t off, int result,
+			bufferlist& bl, map<string,bufferptr>& attrs)
 {
-  return e >= info.history.same_since;   // whole pg set same
+  e->waitfor_read.erase(pair<int,off_t>(rank, off));
+  if (e->bad_ranks.count(rank))
+    return;
+
+  eversion_t v;
+  if (attrs.count("version"))
+    memcpy(&v, attrs["version"].c_str(), sizeof(v));
+  if (result < 0 || v != e->version) {
+    dout(10) << "got_chunk " << e->oid << " rank " << rank << " r = " << result
+	     << " v " << v << " != " << e->version << ", bad" << dendl;
+    e->bad_ranks.insert(rank);
+    e->got.erase(rank);
+    return;
+  }
+
+  dout(15) << "got_chunk " << e->oid << " rank " << rank << " " << off << "~" << bl.length() << dendl;
+  e->got[rank][off].claim(bl);
+  if (e->attrs.empty())
+    e->attrs = attrs;
 }
 
+void RAID4PG::check_reads(ECOp *e)
+{
+  if (!e->waitfor_read.empty())
+    return;
 
-// -----------------
+  int good = 0;
+  bool have_need = true;
+  for (set<int>::iterator p = e->read_ranks.begin(); p != e->read_ranks.end(); p++)
+    if (!e->bad_ranks.count(*p))
+      good++;
+  for (set<int>::iterator p = e->need_ranks.begin(); p != e->need_ranks.end(); p++)
+    if (!e->read_ranks.count(*p) || e->bad_ranks.count(*p))
+      have_need = false;
+
+  if (have_need || good >= get_k())
+    reads_done(e);
+  else
+    start_reads(e);   // try others
+}
+
+void RAID4PG::read_error(ECOp *e)
+{
+  if (e->op) {
+    dout(0) << "read_error " << e->oid << ", EIO on " << *e->op << dendl;
+    MOSDOpReply *reply = new MOSDOpReply(e->op, -EIO, osd->osdmap->get_epoch(), true);
+    osd->messenger->send_message(reply, e->op->get_client_inst());
+    finish_ec_op(e);
+    return;
+  }
+
+  // recovery
+  object_t oid = e->oid;
+  dout(0) << "read_error " << oid << " v " << e->version << " is unrecoverable" << dendl;
+  unrecoverable.insert(oid);
+  finish_ec_op(e);
+
+  if (waiting_for_missing_object.count(oid)) {
+    list<Message*>& ls = waiting_for_missing_object[oid];
+    for (list<Message*>::iterator p = ls.begin(); p != ls.end(); p++)
+      reply_op((MOSDOp*)*p, -EIO);
+    waiting_for_missing_object.erase(oid);
+  }
+  if (is_active())
+    do_recovery();
+}
+
+/*
+ * chunk contents over extent off~len (0 = whole chunks), reconstructing
+ * any need_ranks we didn't get.  out holds all k+m chunks.
+ */
+bool RAID4PG::decode_extent(ECOp *e, off_t off, off_t len, vector<bufferptr>& out)
+{
+  int n = get_k() + get_m();
+
+  if (len == 0)
+    for (map<int, map<off_t,bufferlist> >::iterator p = e->got.begin(); p != e->got.end(); p++)
+      if (p->second.count(off))
+	len = MAX(len, (off_t)p->second[off].length());
+
+  out.resize(n);
+  vector<bool> have(n, false);
+  vector<uint8_t*> ptrs(n);
+  bool need_decode = false;
+  for (int r=0; r<n; r++) {
+    if (e->got.count(r) && e->got[r].count(off)) {
+      bufferlist& bl = e->got[r][off];
+      if ((off_t)bl.length() == len) {
+	bl.c_str();   // contiguous
+	out[r] = bl.buffers().front();
+      } else {
+	// short (sparse tail); pad with zeros
+	out[r] = bufferptr(len);
+	bl.copy(0, MIN((off_t)bl.length(), len), out[r].c_str());
+	out[r].zero(MIN((off_t)bl.length(), len), len - MIN((off_t)bl.length(), len));
+      }
+      have[r] = true;
+    } else {
+      out[r] = bufferptr(len);
+      if (e->need_ranks.count(r))
+	need_decode = true;
+    }
+    ptrs[r] = (uint8_t*)out[r].c_str();
+  }
+
+  if (!need_decode || len == 0)
+    return true;
+  dout(10) << "decode_extent " << e->oid << " " << off << "~" << len
+	   << " from " << e->read_ranks << " bad " << e->bad_ranks << dendl;
+  return rs->decode(&ptrs[0], have, len) == 0;
+}
+
+void RAID4PG::reads_done(ECOp *e)
+{
+  if (!e->op) {
+    push_recovered(e);
+    return;
+  }
+
+  if (!e->op->is_read()) {
+    issue_write(e);
+    return;
+  }
+
+  MOSDOp *op = e->op;
+  off_t off = op->get_offset();
+  off_t len = op->get_length();
+  off_t s0 = e->extents[0].first / chunk_size;
+
+  vector<bufferptr> chunks;
+  if (!decode_extent(e, e->extents[0].first, e->extents[0].second, chunks)) {
+    read_error(e);
+    return;
+  }
+
+  bufferptr bp(len);
+  copy_stripes(chunks, s0, off, len, bp.c_str(), false);
+
+  dout(10) << "op_read " << e->oid << " " << off << "~" << len << " v " << e->version
+	   << " from " << e->read_ranks << dendl;
+
+  MOSDOpReply *reply = new MOSDOpReply(op, 0, osd->osdmap->get_epoch(), true);
+  bufferlist bl;
+  bl.push_back(bp);
+  reply->set_data(bl);
+  reply->set_length(len);
+  osd->messenger->send_message(reply, op->get_client_inst());
+  osd->perf->tinc(l_osd_r_lat, g_clock.now() - op->get_recv_stamp());
+  finish_ec_op(e);
+}
+
+
+void RAID4PG::op_read(MOSDOp *op)
+{
+  object_t oid = op->get_oid();
+  vector<int> osds;
+  get_chunk_osds(osds);
+  int rank = find_rank(osds, osd->get_nodeid());
+
+  dout(10) << "op_read " << MOSDOp::get_opname(op->get_op())
+	   << " " << oid
+           << " " << op->get_offset() << "~" << op->get_length()
+           << dendl;
+
+  // we aren't missing it, so our chunk says what there is.
+  eversion_t v;
+  off_t size = 0;
+  if (rank < 0 ||
+      get_local_chunk(pobject_t(0, rank, oid), v, size) < 0) {
+    dout(10) << "op_read " << oid << " no chunk at rank " << rank << dendl;
+    reply_op(op, -ENOENT);
+    return;
+  }
+
+  dout(15) << "op_read " << oid << " v " << v << " size " << size << dendl;
+
+  if (op->get_op() == CEPH_OSD_OP_STAT) {
+    MOSDOpReply *reply = new MOSDOpReply(op, 0, osd->osdmap->get_epoch(), true);
+    reply->set_length(size);
+    osd->messenger->send_message(reply, op->get_client_inst());
+    delete op;
+    return;
+  }
+
+  // clip to object
+  off_t off = op->get_offset();
+  off_t len = op->get_length();
+  if (len == 0 || off + len > size)
+    len = size > off ? size - off : 0;
+  op->set_length(len);
+  if (len == 0) {
+    reply_op(op, 0);
+    return;
+  }
+
+  osd->perf->inc(l_osd_c_rd);
+  osd->perf->inc(l_osd_c_rdb, len);
+
+  ECOp *e = new_ec_op(op, oid);
+  e->version = v;
+  e->size = size;
+
+  off_t sw = get_stripe_width();
+  off_t s0 = off / sw;
+  off_t s1 = (off + len + sw - 1) / sw;
+  e->extents.push_back(pair<off_t,off_t>(s0 * chunk_size, (s1 - s0) * chunk_size));
+  for (off_t p = off;
+       p < off + len && (int)e->need_ranks.size() < get_k();
+       p = (p / chunk_size + 1) * chunk_size)
+    e->need_ranks.insert((p % sw) / chunk_size);
+
+  start_reads(e);
+}
+
+
+
+// ========================================================================
+// MODIFY
+
+void RAID4PG::prepare_log_transaction(ObjectStore::Transaction& t,
+				      osd_reqid_t reqid, pobject_t poid, int op, eversion_t version,
+				      eversion_t trim_to)
+{
+  int opcode = Log::Entry::MODIFY;
+  if (op == CEPH_OSD_OP_DELETE) opcode = Log::Entry::DELETE;
+  Log::Entry logentry(opcode, poid.oid, version, reqid);
+
+  dout(10) << "prepare_log_transaction " << op
+           << " " << logentry
+           << dendl;
+
+  // append to log
+  assert(version > log.top);
+  log.add(logentry);
+  assert(log.top == version);
+
+  // write to pg log on disk
+  append_log(t, logentry, trim_to);
+}
+
+/** prepare_op_transaction
+ * apply a chunk op to the store wrapped in a transaction.
+ */
+void RAID4PG::prepare_op_transaction(ObjectStore::Transaction& t,
+				     int op, pobject_t poid, off_t offset, off_t length,
+				     bufferlist& bl, off_t size, eversion_t version)
+{
+  dout(10) << "prepare_op_transaction " << MOSDOp::get_opname( op )
+           << " " << poid
+           << " v " << version
+	   << " " << offset << "~" << length
+	   << " size " << size
+           << dendl;
+
+  // raise last_complete?
+  if (info.last_complete == info.last_update)
+    info.last_complete = version;
+
+  // raise last_update.
+  assert(version > info.last_update);
+  info.last_update = version;
+
+  // write pg info
+  t.collection_setattr(info.pgid, "info", &info, sizeof(info));
+
+  switch (op) {
+  case CEPH_OSD_OP_WRITE:
+  case CEPH_OSD_OP_TRUNCATE:
+    if (length) {
+      assert(bl.length() == length);
+      bufferlist nbl;
+      nbl.claim(bl);
+      t.write(poid, offset, length, nbl);
+    }
+    if (op == CEPH_OSD_OP_TRUNCATE)
+      t.truncate(poid, offset + length);
+    break;
+
+  case CEPH_OSD_OP_DELETE:
+    t.remove(poid);
+    break;
+
+  default:
+    assert(0);
+  }
+
+  if (op == CEPH_OSD_OP_DELETE) {
+    t.collection_remove(info.pgid, poid);
+  } else {
+    t.collection_add(info.pgid, poid);
+    t.setattr(poid, "version", &version, sizeof(version));
+    t.setattr(poid, "size", &size, sizeof(size));
+  }
+}
+
+
+class C_RAID4PG_Commit : public Context {
+public:
+  RAID4PG *pg;
+  tid_t rep_tid;
+  eversion_t pg_last_complete;
+  C_RAID4PG_Commit(RAID4PG *p, tid_t rt, eversion_t lc) : pg(p), rep_tid(rt), pg_last_complete(lc) {
+    pg->get();  // we're copying the pointer
+  }
+  void finish(int r) {
+    pg->lock();
+    if (!pg->is_deleted())
+      pg->op_commit(rep_tid, pg->osd->get_nodeid(), pg_last_complete);
+    pg->put_unlock();
+  }
+};
+
+void RAID4PG::op_modify(MOSDOp *op)
+{
+  object_t oid = op->get_oid();
+  int opc = op->get_op();
+  const char *opname = MOSDOp::get_opname(opc);
+
+  // make sure it looks ok
+  if (opc == CEPH_OSD_OP_WRITE &&
+      op->get_length() != op->get_data().length()) {
+    dout(0) << "op_modify got bad write, claimed length " << op->get_length()
+	    << " != payload length " << op->get_data().length()
+	    << dendl;
+    delete op;
+    return;
+  }
+
+  // dup op?  earlier ops on the object are already committed (unless
+  // we restarted this one; rewriting is harmless).
+  bool restarted = restarting.erase(op->get_reqid());
+  if (opc == CEPH_OSD_OP_WRNOOP ||
+      (is_dup(op->get_reqid()) && !restarted)) {
+    dout(3) << "op_modify " << opname << " " << op->get_reqid() << ", doing WRNOOP" << dendl;
+    op->set_version(log.top);
+    reply_op(op, 0);
+    return;
+  }
+
+  if (unrecoverable.count(oid)) {
+    dout(0) << "op_modify " << opname << " " << oid << " is unrecoverable" << dendl;
+    reply_op(op, -EIO);
+    return;
+  }
+
+  vector<int> osds;
+  get_chunk_osds(osds);
+  int up = 0;
+  for (unsigned r=0; r<osds.size(); r++) {
+    if (osds[r] < 0) continue;
+    up++;
+    // bring the object up to date everywhere first; the write only
+    // touches some stripes.
+    if (opc != CEPH_OSD_OP_DELETE &&
+	!has_chunk(osds[r], oid)) {
+      dout(10) << "op_modify " << opname << " " << oid << " missing on osd" << osds[r]
+	       << ", recovering first" << dendl;
+      wait_for_missing_object(oid, op);
+      return;
+    }
+  }
+  if (up < get_k()) {
+    dout(0) << "op_modify " << opname << " " << oid << " only " << up << " of " << get_k()
+	    << " chunks up, EIO" << dendl;
+    reply_op(op, -EIO);
+    return;
+  }
+
+  // our chunk says what's there; without one we can't tell.
+  int rank = find_rank(osds, osd->get_nodeid());
+  if (rank < 0) {
+    dout(0) << "op_modify " << opname << " " << oid << " primary holds no chunk, EIO" << dendl;
+    reply_op(op, -EIO);
+    return;
+  }
+  eversion_t v;
+  off_t size = 0;
+  get_local_chunk(pobject_t(0, rank, oid), v, size);
+
+  if (opc == CEPH_OSD_OP_ZERO) {
+    // only zero what's there; the rest reads back as zeros already.
+    off_t off = op->get_offset();
+    off_t len = op->get_length();
+    if (off >= size)
+      len = 0;
+    else if (off + len > size)
+      len = size - off;
+    op->set_length(len);
+  }
+
+  if (opc == CEPH_OSD_OP_WRITE) {
+    osd->perf->inc(l_osd_c_wr);
+    osd->perf->inc(l_osd_c_wrb, op->get_length());
+  }
+
+  ECOp *e = new_ec_op(op, oid);
+  e->version = v;
+  e->size = size;
+
+  // partial stripes we have to read (and maybe reconstruct) first
+  off_t s0, s1, woff, wlen;
+  get_write_stripes(op, size, s0, s1, woff, wlen);
+  off_t sw = get_stripe_width();
+  off_t ends[2] = { s0, s1-1 };
+  for (int i=0; i<2 && s0 < s1; i++) {
+    off_t s = ends[i];
+    if (i && s == s0) break;
+    if (s * sw >= size) continue;
+    if (woff <= s * sw && (s+1) * sw <= woff + wlen) continue;   // overwritten
+    e->extents.push_back(pair<off_t,off_t>(s * chunk_size, chunk_size));
+  }
+
+  dout(10) << "op_modify " << opname
+           << " " << oid
+           << " " << op->get_offset() << "~" << op->get_length()
+	   << " size " << size
+	   << " stripes " << s0 << "~" << (s1-s0)
+	   << " reading " << e->extents.size()
+           << dendl;
+
+  if (e->extents.empty()) {
+    issue_write(e);
+  } else {
+    for (int r=0; r<get_k(); r++)
+      e->need_ranks.insert(r);
+    start_reads(e);
+  }
+}
+
+void RAID4PG::issue_write(ECOp *e)
+{
+  MOSDOp *op = e->op;
+  int opc = op->get_op();
+  int n = get_k() + get_m();
+  off_t size = e->size;
+
+  off_t s0, s1, woff, wlen;
+  get_write_stripes(op, size, s0, s1, woff, wlen);
+  off_t clen = (s1 - s0) * chunk_size;
+
+  // new chunk contents
+  vector<bufferptr> chunks(n);
+  off_t new_size = size;
+  if (clen) {
+    for (int r=0; r<n; r++) {
+      chunks[r] = bufferptr(clen);
+      if (r < get_k())
+	chunks[r].zero();
+    }
+
+    // old stripes
+    for (unsigned i=0; i<e->extents.size(); i++) {
+      vector<bufferptr> old;
+      if (!decode_extent(e, e->extents[i].first, e->extents[i].second, old)) {
+	read_error(e);
+	return;
+      }
+      off_t s = e->extents[i].first / chunk_size;
+      for (int r=0; r<get_k(); r++)
+	memcpy(chunks[r].c_str() + (s - s0) * chunk_size, old[r].c_str(), chunk_size);
+    }
+
+    // new bytes
+    switch (opc) {
+    case CEPH_OSD_OP_WRITE:
+      copy_stripes(chunks, s0, woff, wlen, op->get_data().c_str(), true);
+      new_size = MAX(size, woff + wlen);
+      break;
+    case CEPH_OSD_OP_ZERO:
+      copy_stripes(chunks, s0, woff, wlen, 0, true);
+      break;
+    case CEPH_OSD_OP_TRUNCATE:
+      copy_stripes(chunks, s0, woff, s1 * get_stripe_width() - woff, 0, true);
+      break;
+    }
+
+    vector<uint8_t*> ptrs(n);
+    for (int r=0; r<n; r++)
+      ptrs[r] = (uint8_t*)chunks[r].c_str();
+    rs->encode(&ptrs[0], clen);
+  }
+  if (opc == CEPH_OSD_OP_TRUNCATE)
+    new_size = woff;
+
+  // assign version now, so log order matches the order we write in.
+  eversion_t nv = log.top;
+  nv.epoch = osd->osdmap->get_epoch();
+  nv.version++;
+  op->set_version(nv);
+  e->version = nv;
+  e->writing = true;
+
+  int subop = opc == CEPH_OSD_OP_ZERO ? CEPH_OSD_OP_WRITE : opc;
+
+  dout(10) << "issue_write " << MOSDOp::get_opname(opc) << " " << e->oid << " v " << nv
+	   << " chunks " << (s0 * chunk_size) << "~" << clen
+	   << " size " << size << " -> " << new_size
+	   << " to " << e->osds << dendl;
+
+  map<string,bufferptr> attrs;
+  attrs["size"] = bufferptr((char*)&new_size, sizeof(new_size));
+
+  for (int r=0; r<n; r++) {
+    int o = e->osds[r];
+    if (o < 0) continue;
+    pobject_t poid(0, r, e->oid);
+    bufferlist bl;
+    if (clen)
+      bl.push_back(chunks[r]);
+    e->waitfor_commit.insert(o);
+
+    if (o == osd->get_nodeid()) {
+      ObjectStore::Transaction t;
+      prepare_log_transaction(t, op->get_reqid(), poid, subop, nv, peers_complete_thru);
+      prepare_op_transaction(t, subop, poid, s0 * chunk_size, clen, bl, new_size, nv);
+      unsigned tr = osd->store->apply_transaction(t, new C_RAID4PG_Commit(this, e->rep_tid,
+									   info.last_complete));
+      if (tr != 0 &&   // no errors
+	  tr != 2) {   // or error on collection_add
+	derr(0) << "error applying transaction: r = " << tr << dendl;
+	assert(tr == 0);
+      }
+    } else {
+      MOSDSubOp *sop = new MOSDSubOp(op->get_reqid(), info.pgid, poid, subop,
+				     s0 * chunk_size, clen,
+				     osd->osdmap->get_epoch(), e->rep_tid, nv);
+      sop->set_data(bl);
+      map<string,bufferptr> as = attrs;
+      sop->set_attrset(as);
+      sop->set_pg_trim_to(peers_complete_thru);
+      sop->set_peer_stat(osd->get_my_stat_for(g_clock.now(), o));
+      osd->messenger->send_message(sop, osd->osdmap->get_inst(o));
+    }
+  }
+}
+
+void RAID4PG::op_commit(tid_t rep_tid, int o, eversion_t pg_complete_thru)
+{
+  if (ec_ops.count(rep_tid) == 0) {
+    dout(10) << "op_commit rep_tid " << rep_tid << " dne" << dendl;
+    return;
+  }
+  ECOp *e = ec_ops[rep_tid];
+  if (!e->writing || !e->waitfor_commit.count(o)) {
+    dout(10) << "op_commit rep_tid " << rep_tid << " not waiting for osd" << o << dendl;
+    return;
+  }
+
+  dout(15) << "op_commit " << e->oid << " v " << e->version << " from osd" << o << dendl;
+  e->waitfor_commit.erase(o);
+  e->pg_complete_thru[o] = pg_complete_thru;
+
+  if (!e->op && e->push_to.count(o)) {
+    // pushed
+    if (peer_missing.count(o) && peer_missing[o].is_missing(e->oid)) {
+      peer_missing[o].got(e->oid);
+      if (peer_missing[o].num_missing() == 0) {
+	dout(10) << "op_commit osd" << o << " now uptodate" << dendl;
+	uptodate_set.insert(o);
+      }
+    }
+  }
+
+  check_commit(e);
+}
+
+void RAID4PG::check_commit(ECOp *e)
+{
+  if (!e->waitfor_commit.empty())
+    return;
+
+  if (!e->op) {
+    dout(10) << "check_commit recovered " << e->oid << " v " << e->version << dendl;
+    finish_ec_op(e);
+    if (is_active())
+      do_recovery();
+    return;
+  }
+
+  // peers_complete_thru
+  if (!e->pg_complete_thru.empty()) {
+    eversion_t min = e->pg_complete_thru.begin()->second;
+    for (map<int,eversion_t>::iterator p = e->pg_complete_thru.begin();
+	 p != e->pg_complete_thru.end();
+	 p++)
+      if (p->second < min) min = p->second;
+    if (min > peers_complete_thru) {
+      dout(10) << "check_commit peers_complete_thru " << peers_complete_thru << " -> " << min << dendl;
+      peers_complete_thru = min;
+    }
+  }
+
+  dout(10) << "check_commit " << *e->op << " committed" << dendl;
+  MOSDOpReply *reply = new MOSDOpReply(e->op, 0, osd->osdmap->get_epoch(), true);
+  osd->messenger->send_message(reply, e->op->get_client_inst());
+  osd->perf->tinc(l_osd_w_commit_lat, g_clock.now() - e->op->get_recv_stamp());
+  finish_ec_op(e);
+}
+
+
+// sub op modify
+
+class C_RAID4PG_SubOpCommit : public Context {
+public:
+  RAID4PG *pg;
+  MOSDSubOp *op;
+  eversion_t pg_last_complete;
+  C_RAID4PG_SubOpCommit(RAID4PG *p, MOSDSubOp *o, eversion_t lc) : pg(p), op(o), pg_last_complete(lc) {
+    pg->get();  // we're copying the pointer
+  }
+  void finish(int r) {
+    pg->lock();
+    pg->sub_op_modify_commit(op, pg_last_complete);
+    pg->put_unlock();
+  }
+};
+
+void RAID4PG::sub_op_read(MOSDSubOp *op)
+{
+  pobject_t poid = op->get_poid();
+  bufferlist bl;
+  map<string,bufferptr> attrs;
+  int r;
+
+  if (missing.is_missing(poid.oid)) {
+    r = -EAGAIN;
+  } else {
+    r = osd->store->read(poid, op->get_offset(), op->get_length(), bl);
+    if (r >= 0)
+      osd->store->getattrs(poid, attrs);
+  }
+
+  dout(10) << "sub_op_read " << poid << " " << op->get_offset() << "~" << op->get_length()
+	   << " = " << r << dendl;
+
+  MOSDSubOpReply *reply = new MOSDSubOpReply(op, r, osd->osdmap->get_epoch(), false);
+  reply->set_data(bl);
+  reply->set_attrset(attrs);
+  osd->messenger->send_message(reply, op->get_source_inst());
+  delete op;
+}
+
+void RAID4PG::sub_op_modify(MOSDSubOp *op)
+{
+  pobject_t poid = op->get_poid();
+  eversion_t nv = op->get_version();
+
+  dout(10) << "sub_op_modify " << MOSDOp::get_opname(op->get_op())
+           << " " << poid
+           << " v " << nv
+           << " " << op->get_offset() << "~" << op->get_length()
+           << dendl;
+
+  int fromosd = op->get_source().num();
+  osd->take_peer_stat(fromosd, op->get_peer_stat());
+
+  osd->perf->inc(l_osd_r_wr);
+  osd->perf->inc(l_osd_r_wrb, op->get_length());
+
+  off_t size = 0;
+  if (op->get_attrset().count("size"))
+    memcpy(&size, op->get_attrset()["size"].c_str(), sizeof(size));
+
+  ObjectStore::Transaction t;
+  prepare_log_transaction(t, op->get_reqid(), poid, op->get_op(), nv, op->get_pg_trim_to());
+  prepare_op_transaction(t, op->get_op(), poid,
+			 op->get_offset(), op->get_length(), op->get_data(), size, nv);
+
+  // the primary recovers objects before it modifies them, except deletes.
+  if (missing.is_missing(poid.oid)) {
+    dout(10) << "sub_op_modify " << poid << " was missing" << dendl;
+    assert(op->get_op() == CEPH_OSD_OP_DELETE);
+    missing.rm(poid.oid, nv);
+    update_last_complete();
+    t.collection_setattr(info.pgid, "info", &info, sizeof(info));
+  }
+
+  unsigned tr = osd->store->apply_transaction(t, new C_RAID4PG_SubOpCommit(this, op, info.last_complete));
+  if (tr != 0 &&   // no errors
+      tr != 2) {   // or error on collection_add
+    derr(0) << "error applying transaction: r = " << tr << dendl;
+    assert(tr == 0);
+  }
+}
+
+void RAID4PG::sub_op_modify_commit(MOSDSubOp *op, eversion_t last_complete)
+{
+  int primary = op->get_source().num();
+  dout(10) << "sub_op_modify_commit on op " << *op
+           << ", sending commit to osd" << primary
+           << dendl;
+  if (osd->osdmap->is_up(primary)) {
+    MOSDSubOpReply *commit = new MOSDSubOpReply(op, 0, osd->osdmap->get_epoch(), true);
+    commit->set_pg_complete_thru(last_complete);
+    commit->set_peer_stat(osd->get_my_stat_for(g_clock.now(), primary));
+    osd->messenger->send_message(commit, osd->osdmap->get_inst(primary));
+    osd->perf->tinc(l_osd_sub_lat, g_clock.now() - op->get_recv_stamp());
+  }
+  delete op;
+}
+
+
+
+// ========================================================================
 // RECOVERY
 
 bool RAID4PG::is_missing_object(object_t oid)
 {
-  return false;
+  return missing.is_missing(oid);
+}
+
+void RAID4PG::wait_for_missing_object(object_t oid, Message *m)
+{
+  waiting_for_missing_object[oid].push_back(m);
+
+  if (object_ops.count(oid)) {
+    dout(7) << "wait_for_missing_object " << oid << ", busy" << dendl;
+  } else {
+    dout(7) << "wait_for_missing_object " << oid << ", recovering" << dendl;
+    start_recovery(oid);
+  }
+}
+
+/*
+ * rebuild oid's chunk on every up osd that's missing it: read whole
+ * chunks from any k that have it, decode, push.
+ */
+void RAID4PG::start_recovery(object_t oid)
+{
+  assert(is_primary());
+  assert(object_ops.count(oid) == 0);
+
+  Log::Entry *latest = log.latest(oid);
+  if (!latest || latest->is_delete()) {
+    // nothing to rebuild; clean_up_local (will have) removed it.
+    dout(10) << "start_recovery " << oid << " deleted" << dendl;
+    got_object(oid);
+    return;
+  }
+
+  ECOp *e = new_ec_op(0, oid);
+  e->version = latest->version;
+  for (unsigned r=0; r<e->osds.size(); r++) {
+    int o = e->osds[r];
+    if (o >= 0 && !has_chunk(o, oid)) {
+      e->push_to[o] = r;
+      e->need_ranks.insert(r);
+    }
+  }
+  if (e->push_to.empty()) {
+    // whoever is missing it is down
+    dout(10) << "start_recovery " << oid << " no up osds need it" << dendl;
+    finish_ec_op(e);
+    return;
+  }
+
+  dout(10) << "start_recovery " << oid << " v " << e->version
+	   << " for ranks " << e->need_ranks << dendl;
+  e->extents.push_back(pair<off_t,off_t>(0, 0));
+  start_reads(e);
+}
+
+void RAID4PG::push_recovered(ECOp *e)
+{
+  vector<bufferptr> chunks;
+  if (!decode_extent(e, 0, 0, chunks)) {
+    read_error(e);
+    return;
+  }
+  off_t len = chunks[0].length();
+  object_t oid = e->oid;
+  e->writing = true;
+
+  for (map<int,int>::iterator p = e->push_to.begin(); p != e->push_to.end(); p++) {
+    int o = p->first;
+    pobject_t poid(0, p->second, oid);
+    bufferlist bl;
+    bl.push_back(chunks[p->second]);
+
+    if (o == osd->get_nodeid()) {
+      dout(7) << "push_recovered " << poid << " v " << e->version << " size " << len << " locally" << dendl;
+      ObjectStore::Transaction t;
+      t.remove(poid);  // in case old version exists
+      t.write(poid, 0, len, bl);
+      t.setattrs(poid, e->attrs);
+      t.collection_add(info.pgid, poid);
+      if (missing.is_missing(oid))
+	missing.got(oid);
+      update_last_complete();
+      t.collection_setattr(info.pgid, "info", &info, sizeof(info));
+      unsigned r = osd->store->apply_transaction(t);
+      assert(r == 0);
+    } else {
+      dout(7) << "push_recovered " << poid << " v " << e->version
+	      << " size " << len << " to osd" << o << dendl;
+      osd->perf->inc(l_osd_r_push);
+      osd->perf->inc(l_osd_r_pushb, len);
+      MOSDSubOp *sop = new MOSDSubOp(osd_reqid_t(), info.pgid, poid, CEPH_OSD_OP_PUSH,
+				     0, len, osd->osdmap->get_epoch(), e->rep_tid, e->version);
+      sop->set_data(bl);
+      map<string,bufferptr> as = e->attrs;
+      sop->set_attrset(as);
+      osd->messenger->send_message(sop, osd->osdmap->get_inst(o));
+      e->waitfor_commit.insert(o);
+    }
+  }
+
+  // local waiters can go (they'll queue behind us on the object)
+  if (!missing.is_missing(oid) &&
+      waiting_for_missing_object.count(oid)) {
+    osd->take_waiters(waiting_for_missing_object[oid]);
+    waiting_for_missing_object.erase(oid);
+  }
+
+  check_commit(e);
+}
+
+/*
+ * nothing to rebuild for oid (it's deleted); mark it found everywhere.
+ */
+void RAID4PG::got_object(object_t oid)
+{
+  if (missing.is_missing(oid)) {
+    missing.got(oid);
+    update_last_complete();
+    ObjectStore::Transaction t;
+    t.collection_setattr(info.pgid, "info", &info, sizeof(info));
+    osd->store->apply_transaction(t);
+  }
+  for (unsigned i=1; i<acting.size(); i++) {
+    int peer = acting[i];
+    if (peer_missing.count(peer) &&
+	peer_missing[peer].is_missing(oid)) {
+      peer_missing[peer].got(oid);
+      if (peer_missing[peer].num_missing() == 0)
+	uptodate_set.insert(peer);
+    }
+  }
+  if (waiting_for_missing_object.count(oid)) {
+    osd->take_waiters(waiting_for_missing_object[oid]);
+    waiting_for_missing_object.erase(oid);
+  }
 }
 
-void RAID4PG::wait_for_missing_object(object_t oid, Message *op)
+void RAID4PG::update_last_complete()
 {
-  //assert(0);
+  if (info.last_complete == info.last_update)
+    return;
+  assert(log.complete_to != log.log.end());
+  while (log.complete_to != log.log.end()) {
+    if (missing.missing.count(log.complete_to->oid)) break;
+    if (info.last_complete < log.complete_to->version)
+      info.last_complete = log.complete_to->version;
+    log.complete_to++;
+  }
+  dout(10) << "last_complete now " << info.last_complete << dendl;
+}
+
+void RAID4PG::sub_op_push(MOSDSubOp *op)
+{
+  pobject_t poid = op->get_poid();
+  eversion_t v = op->get_version();
+
+  dout(7) << "sub_op_push "
+          << poid
+          << " v " << v
+          << " size " << op->get_length() << " " << op->get_data().length()
+          << dendl;
+
+  assert(op->get_data().length() == op->get_length());
+
+  // write chunk and add it to the PG
+  ObjectStore::Transaction t;
+  t.remove(poid);  // in case old version exists
+  t.write(poid, 0, op->get_length(), op->get_data());
+  t.setattrs(poid, op->get_attrset());
+  t.collection_add(info.pgid, poid);
+
+  if (missing.is_missing(poid.oid)) {
+    missing.got(poid.oid);
+    update_last_complete();
+  } else {
+    dout(7) << "sub_op_push not missing " << poid << dendl;
+  }
+  t.collection_setattr(info.pgid, "info", &info, sizeof(info));
+
+  // ack when it's safe
+  unsigned r = osd->store->apply_transaction(t, new C_RAID4PG_SubOpCommit(this, op, info.last_complete));
+  assert(r == 0);
 }
 
+
+
+/*
+ * pg status change notification
+ */
+
 void RAID4PG::on_osd_failure(int o)
 {
   dout(10) << "on_osd_failure osd" << o << dendl;
-  //assert(0);
+  if (!is_primary())
+    return;   // on_role_change() will drop it all
+
+  // do async; check_reads()/check_commit() may finish (and free) ops
+  list<tid_t> ls;
+  for (hash_map<tid_t,ECOp*>::iterator p = ec_ops.begin();
+       p != ec_ops.end();
+       p++)
+    if (find_rank(p->second->osds, o) >= 0)
+      ls.push_back(p->first);
+
+  for (list<tid_t>::iterator p = ls.begin(); p != ls.end(); p++) {
+    if (ec_ops.count(*p) == 0) continue;
+    ECOp *e = ec_ops[*p];
+    int rank = find_rank(e->osds, o);
+    e->osds[rank] = -1;
+    if (e->writing) {
+      e->waitfor_commit.erase(o);
+      e->push_to.erase(o);
+      check_commit(e);
+    } else {
+      e->bad_ranks.insert(rank);
+      e->got.erase(rank);
+      for (unsigned i=0; i<e->extents.size(); i++)
+	e->waitfor_read.erase(pair<int,off_t>(rank, e->extents[i].first));
+      check_reads(e);
+    }
+  }
 }
 
 void RAID4PG::on_acker_change()
 {
   dout(10) << "on_acker_change" << dendl;
-  //assert(0);
 }
 
-
 void RAID4PG::on_role_change()
 {
   dout(10) << "on_role_change" << dendl;
-  //assert(0);
+  restarting.clear();
+
+  // take object waiters
+  for (hash_map<object_t, list<Message*> >::iterator it = waiting_for_missing_object.begin();
+       it != waiting_for_missing_object.end();
+       it++)
+    osd->take_waiters(it->second);
+  waiting_for_missing_object.clear();
 }
 
 void RAID4PG::on_change()
 {
   dout(10) << "on_change" << dendl;
-  //assert(0);
+
+  /*
+   * sub ops sent before the set changed will be dropped, so drop our
+   * op state.  client ops are requeued (in order, per object): they
+   * restart against the new set, or get dropped if we're no longer
+   * primary, in which case the client resends.  recovery restarts
+   * once we're active again.
+   */
+  list<Message*> ls;
+  for (hash_map<object_t,ECOp*>::iterator p = object_ops.begin();
+       p != object_ops.end();
+       p++) {
+    if (p->second->op) {
+      ls.push_back(p->second->op);
+      if (p->second->writing)
+	restarting.insert(p->second->op->get_reqid());  // may be in our log already
+    }
+    if (waiting_for_object.count(p->first)) {
+      ls.splice(ls.end(), waiting_for_object[p->first]);
+      waiting_for_object.erase(p->first);
+    }
+  }
+  for (hash_map<tid_t,ECOp*>::iterator p = ec_ops.begin();
+       p != ec_ops.end();
+       p++)
+    delete p->second;
+  ec_ops.clear();
+  object_ops.clear();
+  num_recovering = 0;
+
+  for (hash_map<object_t, list<Message*> >::iterator it = waiting_for_object.begin();
+       it != waiting_for_object.end();
+       it++)
+    ls.splice(ls.end(), it->second);
+  waiting_for_object.clear();
+  osd->take_waiters(ls);
+
+  // we'll re-peer, and may find chunks we couldn't before.
+  unrecoverable.clear();
 }
 
 
 // misc recovery crap
 
-void RAID4PG::clean_up_local(ObjectStore::Transaction&)
+/** clean_up_local
+ * remove chunks of objects the log says are deleted, and (with a
+ * backlog) chunks of objects it doesn't know, or for a rank we no
+ * longer hold.
+ */
+void RAID4PG::clean_up_local(ObjectStore::Transaction& t)
 {
+  dout(10) << "clean_up_local" << dendl;
+
+  assert(info.last_update >= log.bottom);  // otherwise we need some help!
+
+  vector<int> osds;
+  get_chunk_osds(osds);
+  int rank = find_rank(osds, osd->get_nodeid());
+
+  if (log.backlog) {
+    ObjectStore::ListCursor cursor;
+    vector<pobject_t> ls;
+    while (osd->store->collection_list_partial(info.pgid, cursor, g_conf.osd_list_max, ls) > 0)
+      for (vector<pobject_t>::iterator p = ls.begin(); p != ls.end(); p++) {
+	if (!log.logged_object(p->oid) ||
+	    log.latest(p->oid)->is_delete() ||
+	    (rank >= 0 && (int)p->rank != rank)) {
+	  dout(10) << " deleting " << *p << dendl;
+	  t.remove(*p);
+	}
+      }
+  } else if (rank >= 0) {
+    // just scan the log.
+    set<object_t> did;
+    for (ringbuffer<Log::Entry>::reverse_iterator p = log.log.rbegin();
+         p != log.log.rend();
+         p++) {
+      if (did.count(p->oid)) continue;
+      did.insert(p->oid);
+      if (p->is_delete()) {
+        dout(10) << " deleting " << p->oid
+                 << " when " << p->version << dendl;
+        t.remove(pobject_t(0, rank, p->oid));
+      }
+    }
+  }
 }
 
-void RAID4PG::cancel_recovery() 
+void RAID4PG::cancel_recovery()
 {
-  //assert(0);
+  dout(10) << "cancel_recovery" << dendl;
+
+  list<ECOp*> ls;
+  for (hash_map<tid_t,ECOp*>::iterator p = ec_ops.begin();
+       p != ec_ops.end();
+       p++)
+    if (!p->second->op)
+      ls.push_back(p->second);
+  for (list<ECOp*>::iterator p = ls.begin(); p != ls.end(); p++)
+    finish_ec_op(*p);
+  unrecoverable.clear();
 }
 
-bool RAID4PG::do_recovery() 
+/**
+ * start recovering objects, ours first, then the peers', oldest first,
+ * up to osd_max_pull at a time.  return true if any are in progress.
+ */
+bool RAID4PG::do_recovery()
 {
-  //assert(0);
+  assert(is_primary());
+
+  dout(10) << "do_recovery " << num_recovering << " recovering, " << missing << dendl;
+
+  list<object_t> ls;
+  set<object_t> did;
+  for (map<eversion_t,object_t>::iterator p = missing.rmissing.begin();
+       p != missing.rmissing.end();
+       p++)
+    if (did.insert(p->second).second)
+      ls.push_back(p->second);
+  for (unsigned i=1; i<acting.size(); i++) {
+    if (peer_missing.count(acting[i]) == 0) continue;
+    Missing& pm = peer_missing[acting[i]];
+    for (map<eversion_t,object_t>::iterator p = pm.rmissing.begin();
+	 p != pm.rmissing.end();
+	 p++)
+      if (did.insert(p->second).second)
+	ls.push_back(p->second);
+  }
+
+  for (list<object_t>::iterator p = ls.begin(); p != ls.end(); p++) {
+    if (num_recovering >= g_conf.osd_max_pull) break;
+    if (object_ops.count(*p) || unrecoverable.count(*p)) continue;
+    start_recovery(*p);
+  }
+
+  if (num_recovering)
+    return true;
+  if (!unrecoverable.empty()) {
+    dout(0) << "do_recovery " << unrecoverable.size() << " unrecoverable objects" << dendl;
+    return false;
+  }
+
+  // done?
+  if (missing.num_missing())
+    return false;
+  uptodate_set.insert(osd->get_nodeid());
+  for (unsigned i=1; i<acting.size(); i++) {
+    int peer = acting[i];
+    if (peer_missing.count(peer) && peer_missing[peer].num_missing())
+      return false;
+    uptodate_set.insert(peer);
+  }
+  dout(7) << "do_recovery complete" << dendl;
+  if (is_all_uptodate() && !is_clean())
+    finish_recovery();
   return false;
 }
 
-void RAID4PG::purge_strays() 
+void RAID4PG::purge_strays()
 {
-  //assert(0);
+  dout(10) << "purge_strays " << stray_set << dendl;
+
+  for (set<int>::iterator p = stray_set.begin();
+       p != stray_set.end();
+       p++) {
+    dout(10) << "sending PGRemove to osd" << *p << dendl;
+    set<pg_t> ls;
+    ls.insert(info.pgid);
+    MOSDPGRemove *m = new MOSDPGRemove(osd->osdmap->get_epoch(), ls);
+    osd->messenger->send_message(m, osd->osdmap->get_inst(*p));
+  }
+
+  stray_set.clear();
 }
 
 
+// -----------------
+// pg changes
 
+/*
+ * client ops only care about the primary; it drops and requeues
+ * them itself if the rest of the set changes (see on_change).
+ */
+bool RAID4PG::same_for_read_since(epoch_t e)
+{
+  return e >= info.history.same_primary_since;
+}
+
+bool RAID4PG::same_for_modify_since(epoch_t e)
+{
+  return e >= info.history.same_primary_since;
+}
+
+bool RAID4PG::same_for_rep_modify_since(epoch_t e)
+{
+  return e >= info.history.same_since;   // whole pg set same
+}
@@ -1,4 +1,4 @@
-// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*- 
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
 /*
  * Ceph - scalable distributed file system
  *
@@ -6,9 +6,9 @@
  *
  * This is free software; you can redistribute it and/or
  * modify it under the terms of the GNU Lesser General Public
- * License version 2.1, as published by the Free Software 
+ * License version 2.1, as published by the Free Software
  * Foundation.  See file COPYING.
- * 
+ *
  */
 
 #ifndef __RAID4PG_H
@@ -16,39 +16,139 @@
 
 
 #include "PG.h"
+#include "ReedSolomon.h"
 
 #include "messages/MOSDOp.h"
 
 
+/*
+ * k+m erasure coded pg.
+ *
+ * pg.size() = k+m osds, in CRUSH (indep) order; the osd in position r
+ * stores chunk r of every object, as pobject_t(0, r, oid).  chunks
+ * 0..k-1 are data, k.. parity (osd_raid_parity of them).  the object is
+ * striped over the data chunks osd_raid_chunk_size at a time: stripe s
+ * is chunk offset s*cs in every chunk.  each chunk carries the object
+ * version and logical size as attrs.
+ *
+ * the primary does everything: reads gather the chunks they need (any
+ * k, if some are down or stale), writes read-modify-write the partial
+ * stripes and send each osd its re-encoded chunk range.  ops on an
+ * object are serialized.  recovery rebuilds a missing chunk from k
+ * others and pushes it.
+ */
 class RAID4PG : public PG {
-public:  
+public:
+  /*
+   * primary state for a client op or a recovery: chunk reads, then
+   * chunk writes (or pushes).
+   */
+  class ECOp {
+  public:
+    MOSDOp *op;          // 0 for recovery
+    object_t oid;
+    tid_t rep_tid;
+    eversion_t version;  // of the chunks we read; then the new version
+    off_t size;          // logical size, before the op
+    vector<int> osds;    // chunk rank -> osd, -1 if down
+    utime_t start;
+
+    // reading: chunk extents (offset, length; length 0 for all of it)
+    vector< pair<off_t,off_t> > extents;
+    set<int> need_ranks;                     // chunks we want contents for
+    set<int> read_ranks;                     // chunks asked for
+    set<int> bad_ranks;                      // missing, stale, or failed
+    set< pair<int,off_t> > waitfor_read;     // rank, extent offset
+    map<int, map<off_t, bufferlist> > got;   // rank -> extent offset -> data
+    map<string,bufferptr> attrs;             // from a chunk at version
+
+    // writing
+    bool writing;
+    set<int> waitfor_commit;                 // osds
+    map<int,int> push_to;                    // recovery: osd -> rank
+    map<int,eversion_t> pg_complete_thru;
+
+    ECOp(MOSDOp *o, object_t oi, tid_t t) :
+      op(o), oid(oi), rep_tid(t), size(0), writing(false) {}
+  };
 
 protected:
-
-  void prepare_log_transaction(ObjectStore::Transaction& t, 
-			       MOSDOp *op, eversion_t& version, 
-			       objectrev_t crev, objectrev_t rev,
-			       eversion_t trim_to);
-  void prepare_op_transaction(ObjectStore::Transaction& t, 
-			      MOSDOp *op, eversion_t& version, 
-			      objectrev_t crev, objectrev_t rev);
-
-  void op_stat(MOSDOp *op);
-  int op_read(MOSDOp *op);
+  ReedSolomon *rs;
+  int chunk_size;
+
+  hash_map<tid_t, ECOp*> ec_ops;
+  hash_map<object_t, ECOp*> object_ops;                // one at a time
+  hash_map<object_t, list<Message*> > waiting_for_object;
+  set<object_t> unrecoverable;
+  set<osd_reqid_t> restarting;                         // writes requeued by on_change
+  int num_recovering;
+
+  int get_k() { return rs->get_data_chunks(); }
+  int get_m() { return rs->get_parity_chunks(); }
+  off_t get_stripe_width() { return (off_t)chunk_size * get_k(); }
+  off_t get_chunk_length(off_t size) {
+    off_t sw = get_stripe_width();
+    return (size + sw - 1) / sw * chunk_size;
+  }
+
+  void get_chunk_osds(vector<int>& osds);
+  bool has_chunk(int osd, object_t oid);
+  void copy_stripes(vector<bufferptr>& chunks, off_t first_stripe,
+		    off_t off, off_t len, const char *buf, bool to_chunks);
+  void get_write_stripes(MOSDOp *op, off_t size,
+			 off_t& s0, off_t& s1, off_t& woff, off_t& wlen);
+
+  ECOp *new_ec_op(MOSDOp *op, object_t oid);
+  void finish_ec_op(ECOp *e);
+  int get_local_chunk(pobject_t poid, eversion_t& v, off_t& size);
+
+  // reads
+  void start_reads(ECOp *e);
+  void read_chunk(ECOp *e, int rank, off_t off, off_t len);
+  void got_chunk(ECOp *e, int rank, off_t off, int result,
+		 bufferlist& bl, map<string,bufferptr>& attrs);
+  void check_reads(ECOp *e);
+  void read_error(ECOp *e);
+  bool decode_extent(ECOp *e, off_t off, off_t len, vector<bufferptr>& out);
+  void reads_done(ECOp *e);
+
+  // client ops
+  void op_read(MOSDOp *op);
   void op_modify(MOSDOp *op);
-  void op_rep_modify(MOSDOp *op);
-  void op_push(MOSDOp *op);
-  void op_pull(MOSDOp *op);
-
+  void issue_write(ECOp *e);
+  void op_commit(tid_t rep_tid, int osd, eversion_t pg_complete_thru);
+  void check_commit(ECOp *e);
+  void reply_op(MOSDOp *op, int result);
+
+  // replica side
+  void prepare_log_transaction(ObjectStore::Transaction& t,
+			       osd_reqid_t reqid, pobject_t poid, int op, eversion_t version,
+			       eversion_t trim_to);
+  void prepare_op_transaction(ObjectStore::Transaction& t,
+			      int op, pobject_t poid, off_t offset, off_t length,
+			      bufferlist& bl, off_t size, eversion_t version);
+  void sub_op_read(MOSDSubOp *op);
+  void sub_op_modify(MOSDSubOp *op);
+  void sub_op_modify_commit(MOSDSubOp *op, eversion_t last_complete);
+  void sub_op_push(MOSDSubOp *op);
+  friend class C_RAID4PG_Commit;
+  friend class C_RAID4PG_SubOpCommit;
+
+  // recovery
+  void start_recovery(object_t oid);
+  void push_recovered(ECOp *e);
+  void got_object(object_t oid);
+  void update_last_complete();
 
   void clean_up_local(ObjectStore::Transaction& t);
   void cancel_recovery();
   bool do_recovery();
   void purge_strays();
 
-  
+
 public:
-  RAID4PG(OSD *o, pg_t p) : PG(o,p) { }
+  RAID4PG(OSD *o, pg_t p);
+  ~RAID4PG();
 
   bool preprocess_op(MOSDOp *op, utime_t now);
   void do_op(MOSDOp *op);
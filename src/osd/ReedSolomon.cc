@@ -0,0 +1,326 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "ReedSolomon.h"
+
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <algorithm>
+using std::swap;
+
+#if !defined(RS_NO_SIMD) && defined(__AVX2__)
+# define RS_AVX2
+# include <immintrin.h>
+#elif !defined(RS_NO_SIMD) && defined(__SSE2__)
+# define RS_SSE2
+# include <emmintrin.h>
+#endif
+
+// parity is computed a block at a time, so the k data blocks stay in cache
+// while we walk the m parity rows over them.
+#define RS_BLOCK 4096
+
+
+// -- GF(2^8), x^8+x^4+x^3+x^2+1 --
+
+static uint8_t gf_exp[512];
+static uint8_t gf_log[256];
+static uint8_t gf_mul_table[256][256];
+
+static struct gf_tables_init {
+  gf_tables_init() {
+    int x = 1;
+    for (int i=0; i<255; i++) {
+      gf_exp[i] = gf_exp[i+255] = x;
+      gf_log[x] = i;
+      x <<= 1;
+      if (x & 0x100)
+	x ^= 0x11d;
+    }
+    gf_exp[510] = gf_exp[511] = gf_exp[0];
+    gf_log[0] = 0;
+    for (int a=0; a<256; a++)
+      for (int b=0; b<256; b++)
+	gf_mul_table[a][b] = (a && b) ? gf_exp[gf_log[a] + gf_log[b]] : 0;
+  }
+} gf_tables;
+
+uint8_t ReedSolomon::gf_mul(uint8_t a, uint8_t b)
+{
+  return gf_mul_table[a][b];
+}
+
+uint8_t ReedSolomon::gf_inv(uint8_t a)
+{
+  assert(a);
+  return gf_exp[255 - gf_log[a]];
+}
+
+const char *ReedSolomon::get_kernel_name()
+{
+#if defined(RS_AVX2)
+  return "avx2";
+#elif defined(RS_SSE2)
+  return "sse2";
+#else
+  return "table";
+#endif
+}
+
+
+// -- region kernels --
+
+void ReedSolomon::region_xor(uint8_t *dst, const uint8_t *src, size_t len)
+{
+  size_t i = 0;
+#if defined(RS_AVX2)
+  for (; i+64 <= len; i += 64) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(src+i));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(src+i+32));
+    a = _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i*)(dst+i)));
+    b = _mm256_xor_si256(b, _mm256_loadu_si256((const __m256i*)(dst+i+32)));
+    _mm256_storeu_si256((__m256i*)(dst+i), a);
+    _mm256_storeu_si256((__m256i*)(dst+i+32), b);
+  }
+#elif defined(RS_SSE2)
+  for (; i+32 <= len; i += 32) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(src+i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(src+i+16));
+    a = _mm_xor_si128(a, _mm_loadu_si128((const __m128i*)(dst+i)));
+    b = _mm_xor_si128(b, _mm_loadu_si128((const __m128i*)(dst+i+16)));
+    _mm_storeu_si128((__m128i*)(dst+i), a);
+    _mm_storeu_si128((__m128i*)(dst+i+16), b);
+  }
+#endif
+  for (; i+8 <= len; i += 8) {
+    uint64_t a, b;
+    memcpy(&a, src+i, 8);
+    memcpy(&b, dst+i, 8);
+    b ^= a;
+    memcpy(dst+i, &b, 8);
+  }
+  for (; i < len; i++)
+    dst[i] ^= src[i];
+}
+
+/*
+ * dst (^)= c * src.  the caller takes care of c = 0 and 1.
+ */
+static void _region_mul(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len, bool add)
+{
+  size_t i = 0;
+#if defined(RS_AVX2)
+  // c*x = c*(x & 0xf) ^ c*(x & 0xf0): two 16 entry tables, looked up a
+  // nibble at a time with vpshufb.
+  uint8_t lo[16], hi[16];
+  for (int j=0; j<16; j++) {
+    lo[j] = gf_mul_table[c][j];
+    hi[j] = gf_mul_table[c][j << 4];
+  }
+  __m256i tlo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)lo));
+  __m256i thi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)hi));
+  __m256i mask = _mm256_set1_epi8(0x0f);
+  for (; i+64 <= len; i += 64) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(src+i));
+    __m256i y = _mm256_loadu_si256((const __m256i*)(src+i+32));
+    __m256i px = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, _mm256_and_si256(x, mask)),
+				  _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask)));
+    __m256i py = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, _mm256_and_si256(y, mask)),
+				  _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(y, 4), mask)));
+    if (add) {
+      px = _mm256_xor_si256(px, _mm256_loadu_si256((const __m256i*)(dst+i)));
+      py = _mm256_xor_si256(py, _mm256_loadu_si256((const __m256i*)(dst+i+32)));
+    }
+    _mm256_storeu_si256((__m256i*)(dst+i), px);
+    _mm256_storeu_si256((__m256i*)(dst+i+32), py);
+  }
+#elif defined(RS_SSE2)
+  // no byte shuffle in SSE2.  c*x is the xor of c*2^b over the bits b
+  // set in x: walk x's bits down through the sign bit (x += x each
+  // step), and mask in the matching multiple of c.
+  __m128i cb[8];
+  for (int b=0; b<8; b++)
+    cb[b] = _mm_set1_epi8(gf_mul_table[c][1 << b]);
+  __m128i zero = _mm_setzero_si128();
+  for (; i+32 <= len; i += 32) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(src+i));
+    __m128i y = _mm_loadu_si128((const __m128i*)(src+i+16));
+    __m128i px = zero, py = zero;
+#define RS_SSE2_BIT(b)							\
+    px = _mm_xor_si128(px, _mm_and_si128(_mm_cmplt_epi8(x, zero), cb[b]));	\
+    py = _mm_xor_si128(py, _mm_and_si128(_mm_cmplt_epi8(y, zero), cb[b]));	\
+    x = _mm_add_epi8(x, x);						\
+    y = _mm_add_epi8(y, y);
+    RS_SSE2_BIT(7) RS_SSE2_BIT(6) RS_SSE2_BIT(5) RS_SSE2_BIT(4)
+    RS_SSE2_BIT(3) RS_SSE2_BIT(2) RS_SSE2_BIT(1)
+#undef RS_SSE2_BIT
+    px = _mm_xor_si128(px, _mm_and_si128(_mm_cmplt_epi8(x, zero), cb[0]));
+    py = _mm_xor_si128(py, _mm_and_si128(_mm_cmplt_epi8(y, zero), cb[0]));
+    if (add) {
+      px = _mm_xor_si128(px, _mm_loadu_si128((const __m128i*)(dst+i)));
+      py = _mm_xor_si128(py, _mm_loadu_si128((const __m128i*)(dst+i+16)));
+    }
+    _mm_storeu_si128((__m128i*)(dst+i), px);
+    _mm_storeu_si128((__m128i*)(dst+i+16), py);
+  }
+#endif
+  const uint8_t *t = gf_mul_table[c];
+  if (add)
+    for (; i < len; i++)
+      dst[i] ^= t[src[i]];
+  else
+    for (; i < len; i++)
+      dst[i] = t[src[i]];
+}
+
+void ReedSolomon::region_mul_add(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+  if (c == 0)
+    return;
+  if (c == 1)
+    region_xor(dst, src, len);
+  else
+    _region_mul(dst, src, c, len, true);
+}
+
+void ReedSolomon::region_mul(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+  if (c == 0)
+    memset(dst, 0, len);
+  else if (c == 1)
+    memcpy(dst, src, len);
+  else
+    _region_mul(dst, src, c, len, false);
+}
+
+
+// -- code --
+
+ReedSolomon::ReedSolomon(int k_, int m_) : k(k_), m(m_), coef(m_ * k_)
+{
+  assert(k > 0 && m >= 0 && k + m <= 256);
+
+  // cauchy: a_pd = 1/(x_p + y_d), x_p = k+p, y_d = d.  every square
+  // submatrix is invertible, which is what makes any k chunks enough.
+  // scaling column d by 1/a_0d keeps that, and makes row 0 all ones.
+  for (int p=0; p<m; p++)
+    for (int d=0; d<k; d++)
+      coef[p*k + d] = gf_inv((k + p) ^ d);
+  for (int d=0; d<k && m; d++) {
+    uint8_t s = gf_inv(coef[d]);
+    for (int p=0; p<m; p++)
+      coef[p*k + d] = gf_mul(coef[p*k + d], s);
+  }
+}
+
+void ReedSolomon::encode_parity(uint8_t **chunks, size_t len, const vector<bool> *have)
+{
+  for (size_t off = 0; off < len; off += RS_BLOCK) {
+    size_t l = MIN(RS_BLOCK, len - off);
+    for (int p=0; p<m; p++) {
+      if (have && (*have)[k+p])
+	continue;
+      uint8_t *dst = chunks[k+p] + off;
+      const uint8_t *row = &coef[p*k];
+      region_mul(dst, chunks[0] + off, row[0], l);
+      for (int d=1; d<k; d++)
+	region_mul_add(dst, chunks[d] + off, row[d], l);
+    }
+  }
+}
+
+void ReedSolomon::encode(uint8_t **chunks, size_t len)
+{
+  encode_parity(chunks, len, 0);
+}
+
+int ReedSolomon::decode(uint8_t **chunks, const vector<bool>& have, size_t len)
+{
+  // the first k chunks we have, data first
+  vector<int> use;
+  for (int i=0; i<k+m && (int)use.size() < k; i++)
+    if (have[i])
+      use.push_back(i);
+  if ((int)use.size() < k)
+    return -EIO;
+
+  int missing_data = 0;
+  for (int d=0; d<k; d++)
+    if (!have[d])
+      missing_data++;
+
+  if (missing_data == 1 && m && have[k] && use.back() == k) {
+    // xor parity and the other data chunks
+    int d = 0;
+    while (have[d]) d++;
+    for (size_t off = 0; off < len; off += RS_BLOCK) {
+      size_t l = MIN(RS_BLOCK, len - off);
+      memcpy(chunks[d] + off, chunks[k] + off, l);
+      for (int i=0; i<k; i++)
+	if (i != d)
+	  region_xor(chunks[d] + off, chunks[i] + off, l);
+    }
+  } else if (missing_data) {
+    // invert the generator rows of the chunks we're using (gauss-jordan)
+    vector<uint8_t> a(k*k, 0), inv(k*k, 0);
+    for (int r=0; r<k; r++) {
+      if (use[r] < k)
+	a[r*k + use[r]] = 1;
+      else
+	memcpy(&a[r*k], &coef[(use[r]-k)*k], k);
+      inv[r*k + r] = 1;
+    }
+    for (int c=0; c<k; c++) {
+      int p = c;
+      while (p < k && !a[p*k + c]) p++;
+      assert(p < k);
+      if (p != c)
+	for (int j=0; j<k; j++) {
+	  swap(a[p*k + j], a[c*k + j]);
+	  swap(inv[p*k + j], inv[c*k + j]);
+	}
+      uint8_t s = gf_inv(a[c*k + c]);
+      for (int j=0; j<k; j++) {
+	a[c*k + j] = gf_mul(a[c*k + j], s);
+	inv[c*k + j] = gf_mul(inv[c*k + j], s);
+      }
+      for (int r=0; r<k; r++) {
+	uint8_t f = a[r*k + c];
+	if (r == c || !f)
+	  continue;
+	for (int j=0; j<k; j++) {
+	  a[r*k + j] ^= gf_mul(f, a[c*k + j]);
+	  inv[r*k + j] ^= gf_mul(f, inv[c*k + j]);
+	}
+      }
+    }
+
+    for (size_t off = 0; off < len; off += RS_BLOCK) {
+      size_t l = MIN(RS_BLOCK, len - off);
+      for (int d=0; d<k; d++) {
+	if (have[d])
+	  continue;
+	uint8_t *dst = chunks[d] + off;
+	region_mul(dst, chunks[use[0]] + off, inv[d*k], l);
+	for (int r=1; r<k; r++)
+	  region_mul_add(dst, chunks[use[r]] + off, inv[d*k + r], l);
+      }
+    }
+  }
+
+  // missing parity, from the (now whole) data
+  encode_parity(chunks, len, &have);
+  return 0;
+}
@@ -0,0 +1,69 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef __REEDSOLOMON_H
+#define __REEDSOLOMON_H
+
+#include <vector>
+using std::vector;
+
+#include "include/types.h"
+
+/*
+ * k+m Reed-Solomon over GF(2^8), for RAID4PG.
+ *
+ * the parity rows are a Cauchy matrix with its columns scaled so that
+ * the first row is all ones, so parity chunk 0 is the plain xor of the
+ * data (and m=1 is RAID4).  any k of the k+m chunks recover the rest.
+ *
+ * the region kernels are picked at compile time: AVX2 (nibble table
+ * lookups with vpshufb), SSE2 (bit-serial multiply), or 64KB
+ * multiplication tables.  define RS_NO_SIMD to force the tables.
+ */
+class ReedSolomon {
+  int k, m;
+  vector<uint8_t> coef;   // m rows of k
+
+  void encode_parity(uint8_t **chunks, size_t len, const vector<bool> *have);
+
+public:
+  ReedSolomon(int k, int m);
+
+  int get_data_chunks() { return k; }
+  int get_parity_chunks() { return m; }
+  uint8_t get_coef(int p, int d) { return coef[p*k + d]; }
+
+  /*
+   * chunks[0..k) are data, chunks[k..k+m) are filled in with parity.
+   * each chunk is len bytes.
+   */
+  void encode(uint8_t **chunks, size_t len);
+
+  /*
+   * rebuild every chunks[i] with !have[i] from the others.  returns
+   * -EIO if fewer than k chunks are there.
+   */
+  int decode(uint8_t **chunks, const vector<bool>& have, size_t len);
+
+  // dst ^= c * src, and dst = c * src
+  static void region_mul_add(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len);
+  static void region_mul(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len);
+  static void region_xor(uint8_t *dst, const uint8_t *src, size_t len);
+
+  static uint8_t gf_mul(uint8_t a, uint8_t b);
+  static uint8_t gf_inv(uint8_t a);
+  static const char *get_kernel_name();
+};
+
+#endif
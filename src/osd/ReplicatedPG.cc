@@ -29,8 +29,8 @@
 
 #include "config.h"
 
-#define  dout(l)    if (l<=g_conf.debug || l<=g_conf.debug_osd) *_dout << dbeginl << g_clock.now() << " osd" << osd->get_nodeid() << " " << (osd->osdmap ? osd->osdmap->get_epoch():0) << " " << *this << " "
-#define  derr(l)    if (l<=g_conf.debug || l<=g_conf.debug_osd) *_derr << dbeginl << g_clock.now() << " osd" << osd->get_nodeid() << " " << (osd->osdmap ? osd->osdmap->get_epoch():0) << " " << *this << " "
+#define  dout(l)    dout_if(l, l<=g_conf.debug || l<=g_conf.debug_osd) << g_clock.now() << " osd" << osd->get_nodeid() << " " << (osd->osdmap ? osd->osdmap->get_epoch():0) << " " << *this << " "
+#define  derr(l)    derr_if(l, l<=g_conf.debug || l<=g_conf.debug_osd) << g_clock.now() << " osd" << osd->get_nodeid() << " " << (osd->osdmap ? osd->osdmap->get_epoch():0) << " " << *this << " "
 
 #include <errno.h>
 #include <sys/stat.h>
@@ -93,6 +93,95 @@ void ReplicatedPG::wait_for_missing_object(object_t oid, Message *m)
 }
 
 
+// ====================
+// object contexts
+
+static void decode_attr(map<string,bufferptr>& attrs, const char *name, void *v, unsigned len)
+{
+  map<string,bufferptr>::iterator p = attrs.find(name);
+  if (p != attrs.end())
+    memcpy(v, p->second.c_str(), MIN(len, p->second.length()));
+}
+
+ReplicatedPG::ObjectContext *ReplicatedPG::get_object_context(object_t oid)
+{
+  hash_map<object_t, ObjectContext*>::iterator p = object_contexts.find(oid);
+  if (p != object_contexts.end()) {
+    object_context_lru.lru_touch(p->second);
+    osd->perf->inc(l_osd_ctx_hit);
+    return p->second;
+  }
+
+  // make room
+  while (!object_contexts.empty() &&
+	 (int)object_contexts.size() >= g_conf.osd_object_context_max) {
+    ObjectContext *old = (ObjectContext*)object_context_lru.lru_expire();
+    assert(old);
+    object_contexts.erase(old->oid);
+    delete old;
+  }
+
+  ObjectContext *obc = new ObjectContext(oid);
+  struct stat st;
+  if (osd->store->stat(oid, &st) >= 0) {
+    obc->exists = true;
+    obc->size = st.st_size;
+  }
+  map<string,bufferptr> attrs;
+  osd->store->getattrs(oid, attrs);
+  decode_attr(attrs, "version", &obc->version, sizeof(obc->version));
+  decode_attr(attrs, "crev", &obc->crev, sizeof(obc->crev));
+  obc->balance_reads = attrs.count("balance-reads");
+  if (attrs.count("wrlock") &&
+      attrs["wrlock"].length() == sizeof(obc->wrlocker)) {
+    obc->wrlocked = true;
+    decode_attr(attrs, "wrlock", &obc->wrlocker, sizeof(obc->wrlocker));
+  }
+  dout(20) << "get_object_context loaded " << oid << (obc->exists ? "":" dne")
+	   << " size " << obc->size << " v " << obc->version << dendl;
+
+  object_contexts[oid] = obc;
+  object_context_lru.lru_insert_top(obc);
+  osd->perf->inc(l_osd_ctx_miss);
+  return obc;
+}
+
+void ReplicatedPG::forget_object_context(object_t oid)
+{
+  hash_map<object_t, ObjectContext*>::iterator p = object_contexts.find(oid);
+  if (p == object_contexts.end())
+    return;
+  object_context_lru.lru_remove(p->second);
+  delete p->second;
+  object_contexts.erase(p);
+}
+
+void ReplicatedPG::clear_object_contexts()
+{
+  for (hash_map<object_t, ObjectContext*>::iterator p = object_contexts.begin();
+       p != object_contexts.end();
+       p++) {
+    object_context_lru.lru_remove(p->second);
+    delete p->second;
+  }
+  object_contexts.clear();
+}
+
+/*
+ * same as PG's, but from the object context.
+ */
+bool ReplicatedPG::block_if_wrlocked(MOSDOp* op)
+{
+  object_t oid = op->get_oid();
+  ObjectContext *obc = get_object_context(oid);
+  if (obc->wrlocked && obc->wrlocker != op->get_client()) {
+    waiting_for_wr_unlock[oid].push_back(op);
+    return true;
+  }
+  return false;
+}
+
+
 // ==========================================================
 
 /** preprocess_op - preprocess an op (before it gets queued).
@@ -143,12 +232,7 @@ bool ReplicatedPG::preprocess_op(MOSDOp *op, utime_t now)
 		<< dendl;
 
       bool should_balance = is_flash_crowd_candidate || is_hotly_read;
-      bool is_balanced = false;
-      bool b;
-      // *** FIXME *** this may block, and we're in the fast path! ***
-      if (g_conf.osd_balance_reads &&
-	  osd->store->getattr(pobject_t(0,0,oid), "balance-reads", &b, 1) >= 0)
-	is_balanced = true;
+      bool is_balanced = get_object_context(oid)->balance_reads;
       
       if (!is_balanced && should_balance &&
 	  balancing_reads.count(oid) == 0) {
@@ -314,7 +398,7 @@ bool ReplicatedPG::preprocess_op(MOSDOp *op, utime_t now)
 	op->set_peer_stat(osd->my_stat);
 	osd->messenger->send_message(op, osd->osdmap->get_inst(shedto));
 	osd->stat_rd_ops_shed_out++;
-	osd->logger->inc("shdout");
+	osd->perf->inc(l_osd_shdout);
 	return true;
       }
     }
@@ -329,8 +413,7 @@ bool ReplicatedPG::preprocess_op(MOSDOp *op, utime_t now)
 			       op->get_length() ) == 0) {
       if (!is_primary() && !op->get_source().is_osd()) {
 	// am i allowed?
-	bool v;
-	if (osd->store->getattr(pobject_t(0,0,oid), "balance-reads", &v, 1) < 0) {
+	if (!get_object_context(oid)->balance_reads) {
 	  dout(-10) << "preprocess_op in-cache but no balance-reads on " << oid
 		    << ", fwd to primary" << dendl;
 	  osd->messenger->send_message(op, osd->osdmap->get_inst(get_primary()));
@@ -357,7 +440,7 @@ void ReplicatedPG::do_op(MOSDOp *op)
 {
   //dout(15) << "do_op " << *op << dendl;
 
-  osd->logger->inc("op");
+  osd->perf->inc(l_osd_op);
 
   switch (op->get_op()) {
     
@@ -394,7 +477,7 @@ void ReplicatedPG::do_sub_op(MOSDSubOp *op)
 {
   dout(15) << "do_sub_op " << *op << dendl;
 
-  osd->logger->inc("subop");
+  osd->perf->inc(l_osd_subop);
 
   switch (op->get_op()) {
     
@@ -403,8 +486,12 @@ void ReplicatedPG::do_sub_op(MOSDSubOp *op)
     sub_op_pull(op);
     break;
   case CEPH_OSD_OP_PUSH:
+  case CEPH_OSD_OP_SCRUB_PUSH:
     sub_op_push(op);
     break;
+  case CEPH_OSD_OP_SCRUB:
+    sub_op_scrub(op);
+    break;
     
     // writes
   case CEPH_OSD_OP_WRNOOP:
@@ -434,6 +521,11 @@ void ReplicatedPG::do_sub_op_reply(MOSDSubOpReply *r)
   if (r->get_op() == CEPH_OSD_OP_PUSH) {
     // continue peer recovery
     sub_op_push_reply(r);
+  } else if (r->get_op() == CEPH_OSD_OP_SCRUB) {
+    sub_op_scrub_reply(r);
+  } else if (r->get_op() == CEPH_OSD_OP_SCRUB_PUSH) {
+    dout(10) << "repaired " << r->get_poid() << " on " << r->get_source() << dendl;
+    delete r;
   } else {
     sub_op_modify_reply(r);
   }
@@ -471,7 +563,7 @@ void ReplicatedPG::op_read(MOSDOp *op)
 		<< ", them = " << op->get_peer_stat().read_latency
 		<< (osd->my_stat.read_latency_mine > op->get_peer_stat().read_latency ? " WTF":"")
 		<< dendl;
-      osd->logger->inc("shdin");
+      osd->perf->inc(l_osd_shdin);
 
       // does it look like they were wrong to do so?
       Mutex::Locker lock(osd->peer_stat_lock);
@@ -488,9 +580,8 @@ void ReplicatedPG::op_read(MOSDOp *op)
       }
     } else {
       // make sure i exist and am balanced, otherwise fw back to acker.
-      bool b;
-      if (!osd->store->exists(oid) || 
-	  osd->store->getattr(oid, "balance-reads", &b, 1) < 0) {
+      ObjectContext *obc = get_object_context(oid);
+      if (!obc->exists || !obc->balance_reads) {
 	dout(-10) << "read on replica, object " << oid 
 		  << " dne or no balance-reads, fw back to primary" << dendl;
 	osd->messenger->send_message(op, osd->osdmap->get_inst(get_acker()));
@@ -524,17 +615,17 @@ void ReplicatedPG::op_read(MOSDOp *op)
 	  reply->set_length(0);
 	dout(10) << " read got " << r << " / " << op->get_length() << " bytes from obj " << oid << dendl;
       }
-      osd->logger->inc("c_rd");
-      osd->logger->inc("c_rdb", op->get_length());
+      osd->perf->inc(l_osd_c_rd);
+      osd->perf->inc(l_osd_c_rdb, op->get_length());
       break;
 
     case CEPH_OSD_OP_STAT:
       {
-	struct stat st;
-	memset(&st, sizeof(st), 0);
-	r = osd->store->stat(oid, &st);
-	if (r >= 0)
-	  reply->set_length(st.st_size);
+	ObjectContext *obc = get_object_context(oid);
+	if (obc->exists)
+	  reply->set_length(obc->size);
+	else
+	  r = -ENOENT;
       }
       break;
 
@@ -550,6 +641,7 @@ void ReplicatedPG::op_read(MOSDOp *op)
     utime_t diff = now;
     diff -= op->get_recv_stamp();
     dout(10) <<  "op_read " << op->get_reqid() << " total op latency " << diff << dendl;
+    osd->perf->tinc(l_osd_r_lat, diff);
     Mutex::Locker lock(osd->peer_stat_lock);
     osd->stat_rd_ops_in_queue--;
     osd->read_latency_calc.add(diff);
@@ -645,6 +737,8 @@ void ReplicatedPG::prepare_op_transaction(ObjectStore::Transaction& t, const osd
   // write pg info
   t.collection_setattr(pgid, "info", &info, sizeof(info));
 
+  ObjectContext *obc = get_object_context(poid.oid);
+
   // clone?
   if (crev && rev && rev > crev) {
     assert(0);
@@ -663,11 +757,14 @@ void ReplicatedPG::prepare_op_transaction(ObjectStore::Transaction& t, const osd
   case CEPH_OSD_OP_WRLOCK:
     { // lock object
       t.setattr(poid, "wrlock", &reqid.name, sizeof(entity_name_t));
+      obc->wrlocked = true;
+      obc->wrlocker = reqid.name;
     }
     break;  
   case CEPH_OSD_OP_WRUNLOCK:
     { // unlock objects
       t.rmattr(poid, "wrlock");
+      obc->wrlocked = false;
     }
     break;
 
@@ -682,11 +779,13 @@ void ReplicatedPG::prepare_op_transaction(ObjectStore::Transaction& t, const osd
     {
       bool bal = true;
       t.setattr(poid, "balance-reads", &bal, sizeof(bal));
+      obc->balance_reads = true;
     }
     break;
   case CEPH_OSD_OP_UNBALANCEREADS:
     {
       t.rmattr(poid, "balance-reads");
+      obc->balance_reads = false;
     }
     break;
 
@@ -699,22 +798,24 @@ void ReplicatedPG::prepare_op_transaction(ObjectStore::Transaction& t, const osd
       bufferlist nbl;
       nbl.claim(bl);    // give buffers to store; we keep *op in memory for a long time!
       t.write(poid, offset, length, nbl);
+      obc->exists = true;
+      if (offset + length > obc->size)
+	obc->size = offset + length;
     }
     break;
     
   case CEPH_OSD_OP_ZERO:
     {
       // zero, remove, or truncate?
-      struct stat st;
-      int r = osd->store->stat(poid, &st);
-      if (r >= 0) {
-	if (offset == 0 && offset + length >= (off_t)st.st_size) 
+      if (obc->exists) {
+	if (offset == 0 && offset + length >= obc->size) {
 	  t.remove(poid);
-	else
+	  obc->reset();
+	} else
 	  t.zero(poid, offset, length);
       } else {
 	// noop?
-	dout(10) << "apply_transaction zero on " << poid << ", but dne?  stat returns " << r << dendl;
+	dout(10) << "apply_transaction zero on " << poid << ", but dne" << dendl;
       }
     }
     break;
@@ -722,12 +823,15 @@ void ReplicatedPG::prepare_op_transaction(ObjectStore::Transaction& t, const osd
   case CEPH_OSD_OP_TRUNCATE:
     { // truncate
       t.truncate(poid, length);
+      if (obc->exists)
+	obc->size = length;
     }
     break;
     
   case CEPH_OSD_OP_DELETE:
     { // delete
       t.remove(poid);
+      obc->reset();
     }
     break;
     
@@ -745,11 +849,14 @@ void ReplicatedPG::prepare_op_transaction(ObjectStore::Transaction& t, const osd
     
     // object version
     t.setattr(poid, "version", &version, sizeof(version));
+    obc->version = version;
 
     // set object crev
     if (crev == 0 ||   // new object
-	did_clone)     // we cloned
+	did_clone) {   // we cloned
       t.setattr(poid, "crev", &rev, sizeof(rev));
+      obc->crev = rev;
+    }
   }
 }
 
@@ -796,13 +903,25 @@ void ReplicatedPG::apply_repop(RepGather *repop)
   
   repop->applied = true;
 
+  update_stats();
+}
+
+/*
+ * every copy has applied the update; let go of whatever was waiting
+ * for that.  (our ack to the client may have gone out earlier, with
+ * osd_rep_ack_quorum.)
+ */
+void ReplicatedPG::repop_acked(RepGather *repop)
+{
+  dout(10) << "repop_acked " << *repop << dendl;
+  assert(!repop->acked);
+  repop->acked = true;
 
-  // any completion stuff to do here?
   object_t oid = repop->op->get_oid();
 
   switch (repop->op->get_op()) { 
   case CEPH_OSD_OP_UNBALANCEREADS:
-    dout(-10) << "apply_repop  completed unbalance-reads on " << oid << dendl;
+    dout(-10) << "repop_acked  completed unbalance-reads on " << oid << dendl;
     unbalancing_reads.erase(oid);
     if (waiting_for_unbalanced_reads.count(oid)) {
       osd->take_waiters(waiting_for_unbalanced_reads[oid]);
@@ -811,7 +930,8 @@ void ReplicatedPG::apply_repop(RepGather *repop)
     break;
 
   case CEPH_OSD_OP_BALANCEREADS:
-    dout(-10) << "apply_repop  completed balance-reads on " << oid << dendl;
+    dout(-10) << "repop_acked  completed balance-reads on " << oid << dendl;
+    balancing_reads.erase(oid);
     /*
     if (waiting_for_balanced_reads.count(oid)) {
       osd->take_waiters(waiting_for_balanced_reads[oid]);
@@ -821,16 +941,13 @@ void ReplicatedPG::apply_repop(RepGather *repop)
     break;
     
   case CEPH_OSD_OP_WRUNLOCK:
-    dout(-10) << "apply_repop  completed wrunlock on " << oid << dendl;
+    dout(-10) << "repop_acked  completed wrunlock on " << oid << dendl;
     if (waiting_for_wr_unlock.count(oid)) {
       osd->take_waiters(waiting_for_wr_unlock[oid]);
       waiting_for_wr_unlock.erase(oid);
     }
     break;
   }   
-  
-  update_stats();
-  
 }
 
 void ReplicatedPG::put_rep_gather(RepGather *repop)
@@ -845,27 +962,23 @@ void ReplicatedPG::put_rep_gather(RepGather *repop)
     dout(10) << "put_repop  sending commit on " << *repop << " " << reply << dendl;
     osd->messenger->send_message(reply, repop->op->get_client_inst());
     repop->sent_commit = true;
+    osd->perf->tinc(l_osd_w_commit_lat, g_clock.now() - repop->op->get_recv_stamp());
   }
 
   // ack?
   else if (repop->can_send_ack() &&
            repop->op->wants_ack()) {
-    // apply
-    if (!repop->applied)
-      apply_repop(repop);
-
     // send ack
     MOSDOpReply *reply = new MOSDOpReply(repop->op, 0, osd->osdmap->get_epoch(), false);
     dout(10) << "put_repop  sending ack on " << *repop << " " << reply << dendl;
     osd->messenger->send_message(reply, repop->op->get_client_inst());
     repop->sent_ack = true;
-
-    utime_t now = g_clock.now();
-    now -= repop->start;
-    osd->logger->finc("rlsum", now);
-    osd->logger->inc("rlnum", 1);
+    osd->perf->tinc(l_osd_w_ack_lat, g_clock.now() - repop->op->get_recv_stamp());
   }
 
+  if (!repop->acked && repop->waitfor_ack.empty())
+    repop_acked(repop);
+
   // done.
   if (repop->can_delete()) {
     // adjust peers_complete_thru
@@ -919,6 +1032,11 @@ ReplicatedPG::RepGather *ReplicatedPG::new_rep_gather(MOSDOp *op, tid_t rep_tid,
 {
   dout(10) << "new_rep_gather rep_tid " << rep_tid << " on " << *op << dendl;
   RepGather *repop = new RepGather(op, rep_tid, nv, info.last_complete);
+
+  repop->ack_quorum = acting.size();
+  if (g_conf.osd_rep_ack_quorum > 0 &&
+      g_conf.osd_rep_ack_quorum < (int)acting.size())
+    repop->ack_quorum = g_conf.osd_rep_ack_quorum;
   
   // osds. commits all come to me.
   for (unsigned i=0; i<acting.size(); i++) {
@@ -1024,8 +1142,7 @@ objectrev_t ReplicatedPG::assign_version(MOSDOp *op)
   object_t oid = op->get_oid();
 
   // check crev
-  objectrev_t crev = 0;
-  osd->store->getattr(oid, "crev", (char*)&crev, sizeof(crev));
+  objectrev_t crev = get_object_context(oid)->crev;
 
   // assign version
   eversion_t clone_version;
@@ -1094,7 +1211,8 @@ public:
     lock.Unlock();
 
     pg->lock();
-    pg->sub_op_modify_commit(op, destosd, pg_last_complete);
+    if (pg->sub_op_modify_commit(op, destosd, pg_last_complete))
+      pg->queue_rep_commit_flush();
     pg->put_unlock();
   }
   void ack() {
@@ -1135,9 +1253,8 @@ void ReplicatedPG::op_modify(MOSDOp *op)
     return; // op will be handled later, after the object unlocks
   
   // balance-reads set?
-  char v;
   if ((op->get_op() != CEPH_OSD_OP_BALANCEREADS && op->get_op() != CEPH_OSD_OP_UNBALANCEREADS) &&
-      (osd->store->getattr(op->get_oid(), "balance-reads", &v, 1) >= 0 ||
+      (get_object_context(oid)->balance_reads ||
        balancing_reads.count(op->get_oid()))) {
     
     if (!unbalancing_reads.count(op->get_oid())) {
@@ -1195,8 +1312,8 @@ void ReplicatedPG::op_modify(MOSDOp *op)
            << dendl;  
 
   if (op->get_op() == CEPH_OSD_OP_WRITE) {
-    osd->logger->inc("c_wr");
-    osd->logger->inc("c_wrb", op->get_length());
+    osd->perf->inc(l_osd_c_wr);
+    osd->perf->inc(l_osd_c_wrb, op->get_length());
   }
 
   // note my stats
@@ -1220,8 +1337,11 @@ void ReplicatedPG::op_modify(MOSDOp *op)
 			   nv, crev, op->get_oid().rev);
   }
   
-  // (logical) local ack.
-  // (if alone, this will apply the update.)
+  // apply it here while the replicas do the same; only our ack to the
+  // client waits for them.
+  apply_repop(repop);
+
+  // local ack.
   get_rep_gather(repop);
   {
     assert(repop->waitfor_ack.count(whoami));
@@ -1242,8 +1362,7 @@ void ReplicatedPG::sub_op_modify(MOSDSubOp *op)
   const char *opname = MOSDOp::get_opname(op->get_op());
 
   // check crev
-  objectrev_t crev = 0;
-  osd->store->getattr(poid, "crev", (char*)&crev, sizeof(crev));
+  objectrev_t crev = get_object_context(poid.oid)->crev;
 
   dout(10) << "sub_op_modify " << opname 
            << " " << poid 
@@ -1263,8 +1382,8 @@ void ReplicatedPG::sub_op_modify(MOSDSubOp *op)
 
   // do op
   int ackerosd = acting[0];
-  osd->logger->inc("r_wr");
-  osd->logger->inc("r_wrb", op->get_length());
+  osd->perf->inc(l_osd_r_wr);
+  osd->perf->inc(l_osd_r_wrb, op->get_length());
   
   if (op->get_op() != CEPH_OSD_OP_WRNOOP) {
     prepare_log_transaction(t, op->get_reqid(), op->get_poid(), op->get_op(), op->get_version(),
@@ -1285,28 +1404,147 @@ void ReplicatedPG::sub_op_modify(MOSDSubOp *op)
     assert(tr == 0);
   }
   
-  // send ack to acker
-  MOSDSubOpReply *ack = new MOSDSubOpReply(op, 0, osd->osdmap->get_epoch(), false);
-  ack->set_peer_stat(osd->get_my_stat_for(g_clock.now(), ackerosd));
-  osd->messenger->send_message(ack, osd->osdmap->get_inst(ackerosd));
+  // ack to acker, along with any writes queued behind this one
+  batch_rep_reply(rep_ack_batch, op, ackerosd, false);
+  if ((int)rep_ack_batch->get_num_ops() >= g_conf.osd_rep_batch_max ||
+      !sub_op_modify_queued())
+    flush_rep_acks();
   
   // ack myself.
   oncommit->ack(); 
 }
 
-void ReplicatedPG::sub_op_modify_commit(MOSDSubOp *op, int ackerosd, eversion_t last_complete)
+/*
+ * [replica] op is on disk; its commit joins the batch for the
+ * primary.  returns true if the batch wants a flush queued.
+ */
+bool ReplicatedPG::sub_op_modify_commit(MOSDSubOp *op, int ackerosd, eversion_t last_complete)
 {
-  // send commit.
   dout(10) << "rep_modify_commit on op " << *op
-           << ", sending commit to osd" << ackerosd
+           << ", batching commit to osd" << ackerosd
            << dendl;
-  if (osd->osdmap->is_up(ackerosd)) {
-    MOSDSubOpReply *commit = new MOSDSubOpReply(op, 0, osd->osdmap->get_epoch(), true);
-    commit->set_pg_complete_thru(last_complete);
-    commit->set_peer_stat(osd->get_my_stat_for(g_clock.now(), ackerosd));
-    osd->messenger->send_message(commit, osd->osdmap->get_inst(ackerosd));
-    delete op;
+  osd->perf->tinc(l_osd_sub_lat, g_clock.now() - op->get_recv_stamp());
+  batch_rep_reply(rep_commit_batch, op, ackerosd, true);
+  rep_commit_batch->set_pg_complete_thru(last_complete);
+  delete op;
+
+  if ((int)rep_commit_batch->get_num_ops() >= g_conf.osd_rep_batch_max ||
+      g_conf.osd_rep_batch_delay <= 0) {
+    flush_rep_commits();
+    return false;
+  }
+  return !rep_commit_flush_queued;
+}
+
+/*
+ * [replica] add op's ack or commit to batch.  both batches go to one
+ * primary; if that changes, send what we have for the old one first.
+ */
+void ReplicatedPG::batch_rep_reply(MOSDSubOpReply *&batch, MOSDSubOp *op, int ackerosd, bool commit)
+{
+  if (ackerosd != rep_batch_to) {
+    flush_rep_commits();
+    rep_batch_to = ackerosd;
+  }
+  if (batch)
+    batch->add_rep_tid(op->get_rep_tid());
+  else
+    batch = new MOSDSubOpReply(op, 0, osd->osdmap->get_epoch(), commit);
+}
+
+void ReplicatedPG::send_rep_reply(MOSDSubOpReply *&batch)
+{
+  MOSDSubOpReply *r = batch;
+  batch = 0;
+  dout(10) << "send_rep_reply " << *r << " to osd" << rep_batch_to << dendl;
+  if (!osd->osdmap->is_up(rep_batch_to)) {
+    delete r;
+    return;
+  }
+  osd->perf->inc(l_osd_sub_reply);
+  osd->perf->inc(l_osd_sub_reply_ops, r->get_num_ops());
+  r->set_peer_stat(osd->get_my_stat_for(g_clock.now(), rep_batch_to));
+  osd->messenger->send_message(r, osd->osdmap->get_inst(rep_batch_to));
+}
+
+void ReplicatedPG::flush_rep_acks()
+{
+  if (rep_ack_batch)
+    send_rep_reply(rep_ack_batch);
+}
+
+// acks first: the primary forgets an op once it has every commit
+void ReplicatedPG::flush_rep_commits()
+{
+  flush_rep_acks();
+  if (rep_commit_batch)
+    send_rep_reply(rep_commit_batch);
+}
+
+/*
+ * is another replicated write queued behind the one we're doing?
+ * then our ack can wait for its.
+ */
+bool ReplicatedPG::sub_op_modify_queued()
+{
+  for (list<Message*>::iterator p = op_queue.begin(); p != op_queue.end(); p++) {
+    if ((*p)->get_type() != MSG_OSD_SUBOP)
+      continue;
+    int o = ((MOSDSubOp*)*p)->get_op();
+    if (o != CEPH_OSD_OP_PULL && o != CEPH_OSD_OP_PUSH &&
+	o != CEPH_OSD_OP_SCRUB && o != CEPH_OSD_OP_SCRUB_PUSH)
+      return true;
+  }
+  return false;
+}
+
+class C_OSD_RepCommitFlush : public Context {
+public:
+  ReplicatedPG *pg;
+  bool ran;
+  C_OSD_RepCommitFlush(ReplicatedPG *p) : pg(p), ran(false) {
+    pg->get();
   }
+  // pg_timer.cancel_all() deletes us without finish(); the batch still
+  // has to go, and the ref be dropped.
+  ~C_OSD_RepCommitFlush() {
+    if (!ran)
+      finish(0);
+  }
+  void finish(int r) {
+    ran = true;
+    pg->lock();
+    pg->rep_commit_flush_queued = false;
+    pg->flush_rep_commits();
+    pg->put_unlock();
+  }
+};
+
+/*
+ * send the commit batch in osd_rep_batch_delay, so the rest of the
+ * store's commit can join it.  called with the pg locked (and
+ * referenced), from a commit callback.  that thread can't take
+ * osd_lock (force_remount holds it while umount joins the thread), so
+ * this goes on pg_timer, whose lock comes before ours: we let go of
+ * ours for a moment.
+ */
+void ReplicatedPG::queue_rep_commit_flush()
+{
+  dout(15) << "queue_rep_commit_flush in " << g_conf.osd_rep_batch_delay << dendl;
+  rep_commit_flush_queued = true;
+  Context *c = new C_OSD_RepCommitFlush(this);
+  unlock();
+  osd->pg_timer_lock.Lock();
+  if (osd->is_stopping()) {
+    // pg_timer is cancelled; send it now.
+    osd->pg_timer_lock.Unlock();
+    c->finish(0);
+    delete c;
+  } else {
+    osd->pg_timer.add_event_after(g_conf.osd_rep_batch_delay, c);
+    osd->pg_timer_lock.Unlock();
+  }
+  lock();
 }
 
 void ReplicatedPG::sub_op_modify_reply(MOSDSubOpReply *r)
@@ -1316,18 +1554,32 @@ void ReplicatedPG::sub_op_modify_reply(MOSDSubOpReply *r)
   int fromosd = r->get_source().num();
   
   osd->take_peer_stat(fromosd, r->get_peer_stat());
-  
-  if (rep_gather.count(rep_tid)) {
-    // oh, good.
-    repop_ack(rep_gather[rep_tid], 
-	      r->get_result(), r->get_commit(), 
-	      fromosd, 
-	      r->get_pg_complete_thru());
-    delete r;
-  } else {
-    // early ack.
+
+  if (!rep_gather.count(rep_tid)) {
+    // early ack.  the rest of the batch is newer; it waits too.
+    dout(10) << "sub_op_modify_reply rep_tid " << rep_tid << " early, waiting" << dendl;
     waiting_for_repop[rep_tid].push_back(r);
+    return;
+  }
+
+  // oh, good.  ours is the oldest tid; then the rest of the batch, in
+  // order, so the acks go out in order.
+  repop_ack(rep_gather[rep_tid], 
+	    r->get_result(), r->get_commit(), 
+	    fromosd, 
+	    r->get_pg_complete_thru());
+
+  vector<tid_t>& batch = r->get_batch_rep_tids();
+  for (unsigned i=0; i<batch.size(); i++) {
+    if (rep_gather.count(batch[i]))
+      repop_ack(rep_gather[batch[i]], 
+		r->get_result(), r->get_commit(), 
+		fromosd, 
+		r->get_pg_complete_thru());
+    else
+      dout(10) << "sub_op_modify_reply rep_tid " << batch[i] << " dne" << dendl;
   }
+  delete r;
 }
 
 
@@ -1370,8 +1622,9 @@ void ReplicatedPG::pull(pobject_t poid)
 
 
 /** push - send object to a peer
+ * (or, with CEPH_OSD_OP_SCRUB_PUSH, overwrite a copy scrub found bad)
  */
-void ReplicatedPG::push(pobject_t poid, int peer)
+void ReplicatedPG::push(pobject_t poid, int peer, int op)
 {
   // read data+attrs
   bufferlist bl;
@@ -1393,18 +1646,18 @@ void ReplicatedPG::push(pobject_t poid, int peer)
           << " to osd" << peer
           << dendl;
 
-  osd->logger->inc("r_push");
-  osd->logger->inc("r_pushb", bl.length());
+  osd->perf->inc(l_osd_r_push);
+  osd->perf->inc(l_osd_r_pushb, bl.length());
   
   // send
   osd_reqid_t rid;  // useless?
-  MOSDSubOp *subop = new MOSDSubOp(rid, info.pgid, poid, CEPH_OSD_OP_PUSH, 0, bl.length(),
+  MOSDSubOp *subop = new MOSDSubOp(rid, info.pgid, poid, op, 0, bl.length(),
 				osd->osdmap->get_epoch(), osd->get_tid(), v);
   subop->set_data(bl);   // note: claims bl, set length above here!
   subop->set_attrset(attrset);
   osd->messenger->send_message(subop, osd->osdmap->get_inst(peer));
   
-  if (is_primary()) {
+  if (is_primary() && op == CEPH_OSD_OP_PUSH) {
     peer_missing[peer].got(poid.oid);
     pushing[poid.oid].insert(peer);
   }
@@ -1491,8 +1744,15 @@ void ReplicatedPG::sub_op_push(MOSDSubOp *op)
   pobject_t poid = op->get_poid();
   eversion_t v = op->get_version();
 
+  if (op->get_op() == CEPH_OSD_OP_SCRUB_PUSH ||
+      (scrub_repairing.count(poid.oid) && !is_missing_object(poid.oid))) {
+    scrub_repair(op);
+    return;
+  }
+
   if (!is_missing_object(poid.oid)) {
     dout(7) << "sub_op_push not missing " << poid << dendl;
+    delete op;
     return;
   }
   
@@ -1510,6 +1770,7 @@ void ReplicatedPG::sub_op_push(MOSDSubOp *op)
   t.write(poid, 0, op->get_length(), op->get_data());
   t.setattrs(poid, op->get_attrset());
   t.collection_add(info.pgid, poid);
+  forget_object_context(poid.oid);
 
   // close out pull op?
   num_pulling--;
@@ -1566,6 +1827,392 @@ void ReplicatedPG::sub_op_push(MOSDSubOp *op)
 
 
 
+// ========================================================================
+// SCRUB
+//
+// the primary walks the pg a chunk at a time, in order.  for each chunk
+// it digests its own objects, then asks each replica for digests of
+// whatever it has in the same range (after the last chunk, through the
+// last object here, or to the end for the last chunk).  copies that
+// don't match the one most copies agree with (the primary's, in a tie)
+// are repaired by pushing the good one.
+// the osd decides when chunks go; see OSD::scrub_tick().
+
+bool ReplicatedPG::scrub_start()
+{
+  if (!is_primary() || !is_active() || !is_clean() || is_scrubbing())
+    return false;
+  dout(10) << "scrub_start" << dendl;
+  state_set(STATE_SCRUBBING);
+  scrub_cursor = ObjectStore::ListCursor();
+  scrub_last = pobject_t();
+  scrub_first_chunk = true;
+  scrub_stamp = g_clock.now();
+  scrub_objects = scrub_errors = scrub_fixed = 0;
+  scrub_bytes = 0;
+  update_stats();
+  return true;
+}
+
+bool ReplicatedPG::scrub_ready()
+{
+  return is_scrubbing() && !scrub_queued && !scrub_tid;
+}
+
+/*
+ * queue the next chunk to myself, so the reading happens in a worker
+ * thread.
+ */
+void ReplicatedPG::scrub_queue()
+{
+  scrub_queued = osd->get_tid();
+  MOSDSubOp *op = new MOSDSubOp(osd_reqid_t(), info.pgid, pobject_t(), CEPH_OSD_OP_SCRUB, 0, 0,
+				osd->osdmap->get_epoch(), scrub_queued, info.last_update);
+  if (g_conf.osd_maxthreads < 1)
+    do_sub_op(op);
+  else
+    osd->enqueue_op(this, op);
+}
+
+void ReplicatedPG::scrub_clear()
+{
+  if (is_scrubbing())
+    dout(10) << "scrub_clear, " << scrub_objects << " objects in" << dendl;
+  state_clear(STATE_SCRUBBING);
+  scrub_queued = scrub_tid = 0;
+  scrub_local.clear();
+  scrub_peer.clear();
+  scrub_waiting.clear();
+  scrub_repairing.clear();
+}
+
+static uint64_t digest_bytes(uint64_t d, const char *p, unsigned len)
+{
+  for (unsigned i=0; i<len; i++)
+    d = ObjectStore::digest_fold(d, (unsigned char)p[i]);
+  return ObjectStore::digest_fold(d, len);
+}
+
+void ReplicatedPG::scrub_object(pobject_t poid, scrub_object_t& so)
+{
+  off_t size = 0;
+  so.r = osd->store->digest(poid, &size, &so.digest);
+  so.size = size;
+  osd->store->getattr(poid, "version", &so.version, sizeof(so.version));
+
+  map<string,bufferptr> attrset;
+  osd->store->getattrs(poid, attrset);
+  so.attr_digest = 0;
+  for (map<string,bufferptr>::iterator p = attrset.begin(); p != attrset.end(); p++) {
+    if (p->first == "version")
+      continue;  // compared above; it's a raw struct, padding and all
+    so.attr_digest = digest_bytes(so.attr_digest, p->first.c_str(), p->first.length());
+    so.attr_digest = digest_bytes(so.attr_digest, p->second.c_str(), p->second.length());
+  }
+
+  if (so.r < 0)
+    derr(0) << "scrub can't read " << poid << ": " << strerror(-so.r) << dendl;
+  dout(20) << "scrub_object " << poid << " " << so << dendl;
+  osd->perf->inc(l_osd_scrub_obj);
+  osd->perf->inc(l_osd_scrub_b, size);
+}
+
+/*
+ * primary: digest the next chunk, up to osd_scrub_chunk objects or a
+ * tick's worth of bytes, and ask the replicas for theirs.
+ */
+void ReplicatedPG::scrub_chunk(MOSDSubOp *op)
+{
+  scrub_queued = 0;
+  scrub_chunk_start = g_clock.now();
+  pobject_t from = scrub_last;
+  bool first = scrub_first_chunk;
+
+  vector<pobject_t> ls;
+  osd->store->collection_list_partial(info.pgid, scrub_cursor, g_conf.osd_scrub_chunk, ls);
+  off_t limit = (off_t)((double)g_conf.osd_scrub_max_bps * g_conf.osd_scrub_tick);
+  off_t bytes = 0;
+  scrub_local.clear();
+  unsigned i;
+  for (i=0; i<ls.size() && (i == 0 || bytes < limit); i++) {
+    scrub_object_t& so = scrub_local[ls[i]];
+    scrub_object(ls[i], so);
+    bytes += so.size;
+  }
+  if (i < ls.size()) {
+    scrub_cursor.next = ls[i];
+    scrub_cursor.end = false;
+  }
+  if (i) {
+    scrub_last = ls[i-1];
+    scrub_first_chunk = false;
+  }
+  bool to_end = scrub_cursor.end;
+  scrub_objects += i;
+  scrub_bytes += bytes;
+
+  dout(10) << "scrub_chunk " << i << " objects, " << bytes << " bytes, "
+	   << (first ? "from start":"after ") << (first ? pobject_t():from)
+	   << " through " << (to_end ? "end" : "") << (to_end ? pobject_t():scrub_last)
+	   << dendl;
+
+  scrub_peer.clear();
+  scrub_waiting.clear();
+  if (acting.size() == 1) {
+    scrub_compare();
+    return;
+  }
+
+  scrub_tid = osd->get_tid();
+  bufferlist range;
+  ::_encode(first, range);
+  ::_encode(scrub_last, range);
+  ::_encode(to_end, range);
+  for (unsigned j=1; j<acting.size(); j++) {
+    MOSDSubOp *subop = new MOSDSubOp(osd_reqid_t(), info.pgid, from, CEPH_OSD_OP_SCRUB, 0, 0,
+				     osd->osdmap->get_epoch(), scrub_tid, info.last_update);
+    bufferlist bl = range;
+    subop->set_data(bl);
+    osd->messenger->send_message(subop, osd->osdmap->get_inst(acting[j]));
+    scrub_waiting.insert(acting[j]);
+  }
+}
+
+void ReplicatedPG::sub_op_scrub(MOSDSubOp *op)
+{
+  if (is_primary()) {
+    if (is_scrubbing() && op->get_rep_tid() == scrub_queued)
+      scrub_chunk(op);
+    else
+      dout(10) << "sub_op_scrub stale " << *op << dendl;
+    delete op;
+    return;
+  }
+
+  // replica: digest what i have in the primary's range
+  bool first, to_end;
+  pobject_t last;
+  int off = 0;
+  ::_decode(first, op->get_data(), off);
+  ::_decode(last, op->get_data(), off);
+  ::_decode(to_end, op->get_data(), off);
+  pobject_t from = op->get_poid();
+
+  map<pobject_t, scrub_object_t> scrubmap;
+  ObjectStore::ListCursor cursor;
+  if (!first)
+    cursor.next = from;
+  vector<pobject_t> ls;
+  bool done = false;
+  while (!done &&
+	 osd->store->collection_list_partial(info.pgid, cursor, g_conf.osd_scrub_chunk, ls) > 0)
+    for (vector<pobject_t>::iterator p = ls.begin(); p != ls.end(); p++) {
+      if (!first && !(from < *p))
+	continue;
+      if (!to_end && last < *p) {
+	done = true;
+	break;
+      }
+      scrub_object(*p, scrubmap[*p]);
+    }
+  dout(10) << "sub_op_scrub " << scrubmap.size() << " objects" << dendl;
+
+  bufferlist bl;
+  ::_encode(scrubmap, bl);
+  MOSDSubOpReply *reply = new MOSDSubOpReply(op, 0, osd->osdmap->get_epoch(), false);
+  reply->set_data(bl);
+  osd->messenger->send_message(reply, op->get_source_inst());
+  delete op;
+}
+
+void ReplicatedPG::sub_op_scrub_reply(MOSDSubOpReply *r)
+{
+  int from = r->get_source().num();
+  if (!is_scrubbing() || r->get_rep_tid() != scrub_tid || !scrub_waiting.count(from)) {
+    dout(10) << "sub_op_scrub_reply stale " << *r << dendl;
+    delete r;
+    return;
+  }
+  int off = 0;
+  ::_decode(scrub_peer[from], r->get_data(), off);
+  scrub_waiting.erase(from);
+  delete r;
+
+  dout(10) << "sub_op_scrub_reply " << scrub_peer[from].size() << " objects from osd" << from
+	   << ", waiting for " << scrub_waiting << dendl;
+  if (scrub_waiting.empty())
+    scrub_compare();
+}
+
+void ReplicatedPG::scrub_compare()
+{
+  scrub_tid = 0;
+  osd->perf->tinc(l_osd_scrub_lat, g_clock.now() - scrub_chunk_start);
+
+  set<pobject_t> all;
+  for (map<pobject_t, scrub_object_t>::iterator p = scrub_local.begin(); p != scrub_local.end(); p++)
+    all.insert(p->first);
+  for (map<int, map<pobject_t, scrub_object_t> >::iterator q = scrub_peer.begin();
+       q != scrub_peer.end();
+       q++)
+    for (map<pobject_t, scrub_object_t>::iterator p = q->second.begin(); p != q->second.end(); p++)
+      all.insert(p->first);
+
+  int whoami = osd->get_nodeid();
+  for (set<pobject_t>::iterator p = all.begin(); p != all.end(); p++) {
+    pobject_t poid = *p;
+    map<int, scrub_object_t*> copies;
+    if (scrub_local.count(poid))
+      copies[whoami] = &scrub_local[poid];
+    for (map<int, map<pobject_t, scrub_object_t> >::iterator q = scrub_peer.begin();
+	 q != scrub_peer.end();
+	 q++)
+      if (q->second.count(poid))
+	copies[q->first] = &q->second[poid];
+
+    // the good copy is the one most readable copies agree with; mine
+    // wins a tie.
+    int auth = -1;
+    unsigned best = 0;
+    for (map<int, scrub_object_t*>::iterator c = copies.begin(); c != copies.end(); c++) {
+      if (c->second->r)
+	continue;
+      unsigned n = 0;
+      for (map<int, scrub_object_t*>::iterator d = copies.begin(); d != copies.end(); d++)
+	if (c->second->same_as(*d->second))
+	  n++;
+      if (n > best || (n == best && c->first == whoami)) {
+	best = n;
+	auth = c->first;
+      }
+    }
+
+    set<int> bad;
+    for (unsigned i=0; i<acting.size(); i++)
+      if (!copies.count(acting[i]) || auth < 0 ||
+	  !copies[acting[i]]->same_as(*copies[auth]))
+	bad.insert(acting[i]);
+    if (bad.empty())
+      continue;
+
+    if (auth < 0) {
+      derr(0) << "scrub " << poid << " has no good copy" << dendl;
+      scrub_errors++;
+      osd->perf->inc(l_osd_scrub_bad);
+      continue;
+    }
+    scrub_object_t& good = *copies[auth];
+
+    // a write that was in flight when we looked changes the version
+    // somewhere; leave it for next time.
+    bool changing = false;
+    for (map<int, scrub_object_t*>::iterator c = copies.begin(); c != copies.end(); c++)
+      if (c->second->r == 0 && c->second->version != good.version)
+	changing = true;
+    eversion_t v;
+    bool mine_now = osd->store->getattr(poid, "version", &v, sizeof(v)) >= 0;
+    if (mine_now != (copies.count(whoami) > 0) ||
+	(mine_now && v != copies[whoami]->version))
+      changing = true;
+    if (changing) {
+      dout(10) << "scrub " << poid << " changed while we looked, skipping" << dendl;
+      continue;
+    }
+
+    // don't bring back something i deleted.
+    if (!copies.count(whoami) &&
+	(!log.is_updated(poid.oid) ||
+	 log.latest(poid.oid)->version != good.version)) {
+      derr(0) << "scrub " << poid << " v " << good.version << " is on osd" << auth
+	      << " but not here, and the log doesn't say it should be; leaving it" << dendl;
+      scrub_errors++;
+      osd->perf->inc(l_osd_scrub_bad);
+      continue;
+    }
+
+    for (set<int>::iterator b = bad.begin(); b != bad.end(); b++) {
+      if (copies.count(*b)) {
+	derr(0) << "scrub " << poid << " on osd" << *b << " is " << *copies[*b]
+		<< ", osd" << auth << " has " << good << dendl;
+      } else {
+	derr(0) << "scrub " << poid << " missing on osd" << *b
+		<< ", osd" << auth << " has " << good << dendl;
+      }
+    }
+    scrub_errors += bad.size();
+    scrub_fixed += bad.size();
+    osd->perf->inc(l_osd_scrub_bad, bad.size());
+    osd->perf->inc(l_osd_scrub_fix, bad.size());
+
+    if (bad.count(whoami)) {
+      // pull mine back, then push it on to the rest.
+      bad.erase(whoami);
+      scrub_repairing[poid.oid] = bad;
+      MOSDSubOp *subop = new MOSDSubOp(osd_reqid_t(), info.pgid, poid, CEPH_OSD_OP_PULL, 0, 0,
+				       osd->osdmap->get_epoch(), osd->get_tid(), good.version);
+      osd->messenger->send_message(subop, osd->osdmap->get_inst(auth));
+    } else {
+      for (set<int>::iterator b = bad.begin(); b != bad.end(); b++)
+	push(poid, *b, CEPH_OSD_OP_SCRUB_PUSH);
+    }
+  }
+
+  scrub_local.clear();
+  scrub_peer.clear();
+  if (scrub_cursor.end)
+    scrub_finish();
+}
+
+/*
+ * a good copy of an object scrub found bad here.
+ */
+void ReplicatedPG::scrub_repair(MOSDSubOp *op)
+{
+  pobject_t poid = op->get_poid();
+  dout(1) << "scrub_repair " << poid << " v " << op->get_version()
+	  << " size " << op->get_length() << " from " << op->get_source() << dendl;
+
+  ObjectStore::Transaction t;
+  t.remove(poid);
+  t.write(poid, 0, op->get_length(), op->get_data());
+  t.setattrs(poid, op->get_attrset());
+  t.collection_add(info.pgid, poid);
+  unsigned r = osd->store->apply_transaction(t);
+  assert(r == 0);
+  forget_object_context(poid.oid);
+
+  if (is_primary()) {
+    set<int>& peers = scrub_repairing[poid.oid];
+    for (set<int>::iterator p = peers.begin(); p != peers.end(); p++)
+      push(poid, *p, CEPH_OSD_OP_SCRUB_PUSH);
+    scrub_repairing.erase(poid.oid);
+  } else {
+    MOSDSubOpReply *reply = new MOSDSubOpReply(op, 0, osd->osdmap->get_epoch(), false);
+    osd->messenger->send_message(reply, op->get_source_inst());
+  }
+  delete op;
+}
+
+void ReplicatedPG::scrub_finish()
+{
+  utime_t now = g_clock.now();
+  double t = (double)(now - scrub_stamp);
+  dout(scrub_errors ? 0:1) << "scrub done: " << scrub_objects << " objects, "
+			   << scrub_bytes << " bytes in " << t << " s, "
+			   << scrub_errors << " errors, " << scrub_fixed << " fixed" << dendl;
+  state_clear(STATE_SCRUBBING);
+  osd->perf->inc(l_osd_scrub_pg);
+
+  info.last_scrub_stamp = now;
+  ObjectStore::Transaction tr;
+  tr.collection_setattr(info.pgid, "info", &info, sizeof(info));
+  unsigned r = osd->store->apply_transaction(tr);
+  assert(r == 0);
+  update_stats();
+}
+
+
+
 /*
  * pg status change notification
  */
@@ -1598,13 +2245,24 @@ void ReplicatedPG::on_change()
 {
   dout(10) << "on_change" << dendl;
 
+  scrub_clear();
+
   // apply all local repops
   //  (pg is inactive; we will repeer)
   for (hash_map<tid_t,RepGather*>::iterator p = rep_gather.begin();
        p != rep_gather.end();
-       p++) 
+       p++) {
     if (!p->second->applied)
       apply_repop(p->second);
+    if (!p->second->acked)
+      repop_acked(p->second);
+  }
+
+  // [replica] the primary still wants what we have for it
+  flush_rep_commits();
+
+  // the store has everything we did now; peering may change more.
+  clear_object_contexts();
 }
 
 void ReplicatedPG::on_role_change()
@@ -1673,8 +2331,7 @@ bool ReplicatedPG::do_recovery()
   Log::Entry *latest = 0;
 
   while (log.requested_to != log.log.end()) {
-    assert(log.objects.count(log.requested_to->oid));
-    latest = log.objects[log.requested_to->oid];
+    latest = log.latest(log.requested_to->oid);
     assert(latest);
 
     dout(10) << "do_recovery "
@@ -1782,6 +2439,7 @@ void ReplicatedPG::purge_strays()
 void ReplicatedPG::clean_up_local(ObjectStore::Transaction& t)
 {
   dout(10) << "clean_up_local" << dendl;
+  clear_object_contexts();
 
   assert(info.last_update >= log.bottom);  // otherwise we need some help!
 
@@ -1789,47 +2447,29 @@ void ReplicatedPG::clean_up_local(ObjectStore::Transaction& t)
 
     // FIXME: sloppy pobject vs object conversions abound!  ***
     
-    // be thorough.
-    list<pobject_t> ls;
-    osd->store->collection_list(info.pgid, ls);
-    set<object_t> s;
-    
-    for (list<pobject_t>::iterator i = ls.begin();
-         i != ls.end();
-         i++) 
-      s.insert(i->oid); 
-
-    set<object_t> did;
-    for (list<Log::Entry>::reverse_iterator p = log.log.rbegin();
-         p != log.log.rend();
-         p++) {
-      if (did.count(p->oid)) continue;
-      did.insert(p->oid);
-      
-      if (p->is_delete()) {
-        if (s.count(p->oid)) {
-          dout(10) << " deleting " << p->oid
-                   << " when " << p->version << dendl;
-          t.remove(p->oid);
-        }
-        s.erase(p->oid);
-      } else {
-        // just leave old objects.. they're missing or whatever
-        s.erase(p->oid);
+    // be thorough: anything the log says is deleted, or doesn't know
+    // about at all, goes.
+    ObjectStore::ListCursor cursor;
+    vector<pobject_t> ls;
+    while (osd->store->collection_list_partial(info.pgid, cursor, g_conf.osd_list_max, ls) > 0)
+      for (vector<pobject_t>::iterator i = ls.begin();
+	   i != ls.end();
+	   i++) {
+	Log::Entry *latest = log.latest(i->oid);
+	if (!latest) {
+	  dout(10) << " deleting stray " << i->oid << dendl;
+	  t.remove(i->oid);
+	} else if (latest->is_delete()) {
+	  dout(10) << " deleting " << i->oid
+		   << " when " << latest->version << dendl;
+	  t.remove(i->oid);
+	}
       }
-    }
-
-    for (set<object_t>::iterator i = s.begin(); 
-         i != s.end();
-         i++) {
-      dout(10) << " deleting stray " << *i << dendl;
-      t.remove(*i);
-    }
 
   } else {
     // just scan the log.
     set<object_t> did;
-    for (list<Log::Entry>::reverse_iterator p = log.log.rbegin();
+    for (ringbuffer<Log::Entry>::reverse_iterator p = log.log.rbegin();
          p != log.log.rend();
          p++) {
       if (did.count(p->oid)) continue;
@@ -17,6 +17,7 @@
 
 #include "PG.h"
 
+#include "include/lru.h"
 #include "messages/MOSDOp.h"
 class MOSDSubOp;
 class MOSDSubOpReply;
@@ -33,6 +34,7 @@ public:
 
     ObjectStore::Transaction t;
     bool applied;
+    bool acked;       // every copy has it (see repop_acked)
 
     set<int>  waitfor_ack;
     set<int>  waitfor_commit;
@@ -43,20 +45,21 @@ public:
     
     set<int>         osds;
     eversion_t       new_version;
+    unsigned         ack_quorum;   // acks (mine included) before the client's
 
     eversion_t       pg_local_last_complete;
     map<int,eversion_t> pg_complete_thru;
     
     RepGather(MOSDOp *o, tid_t rt, eversion_t nv, eversion_t lc) :
       op(o), rep_tid(rt),
-      applied(false),
+      applied(false), acked(false),
       sent_ack(false), sent_commit(false),
-      new_version(nv), 
+      new_version(nv), ack_quorum(0),
       pg_local_last_complete(lc) { }
 
     bool can_send_ack() { 
       return !sent_ack && !sent_commit &&
-        waitfor_ack.empty(); 
+        osds.size() - waitfor_ack.size() >= ack_quorum; 
     }
     bool can_send_commit() { 
       return !sent_commit &&
@@ -73,13 +76,52 @@ protected:
   hash_map<tid_t, RepGather*>            rep_gather;
   hash_map<tid_t, list<class Message*> > waiting_for_repop;
 
+  // [replica] acks and commits not yet sent to the primary, batched
+  // into one reply each.  acks go once no more sub ops are queued for
+  // us, commits osd_rep_batch_delay after the first one.
+  MOSDSubOpReply *rep_ack_batch, *rep_commit_batch;
+  int rep_batch_to;
+  bool rep_commit_flush_queued;
+
   // load balancing
   set<object_t> balancing_reads;
   set<object_t> unbalancing_reads;
   hash_map<object_t, list<Message*> > waiting_for_unbalanced_reads;  // i.e. primary-lock
 
+  // object contexts
+  //  what we know of a hot object's metadata, so ops needn't ask the
+  //  store.  our own transactions keep it current as they are
+  //  prepared; anything else that changes an object here drops its
+  //  context.  [pg lock]
+  struct ObjectContext : public LRUObject {
+    object_t oid;
+    bool exists;
+    off_t size;
+    eversion_t version;
+    objectrev_t crev;
+    bool balance_reads;
+    bool wrlocked;
+    entity_name_t wrlocker;
+    ObjectContext(object_t o) : oid(o) { reset(); }
+    void reset() {   // removed
+      exists = false;
+      size = 0;
+      version = eversion_t();
+      crev = 0;
+      balance_reads = wrlocked = false;
+    }
+  };
+  hash_map<object_t, ObjectContext*> object_contexts;
+  LRU object_context_lru;
+
+  ObjectContext *get_object_context(object_t oid);
+  void forget_object_context(object_t oid);
+  void clear_object_contexts();
+  bool block_if_wrlocked(MOSDOp *op);
+
   void get_rep_gather(RepGather*);
   void apply_repop(RepGather *repop);
+  void repop_acked(RepGather *repop);
   void put_rep_gather(RepGather*);
   void issue_repop(RepGather *repop, int dest, utime_t now);
   RepGather *new_rep_gather(MOSDOp *op, tid_t rep_tid, eversion_t nv);
@@ -91,13 +133,19 @@ protected:
   int num_pulling;
   map<object_t, set<int> > pushing;
 
-  void push(pobject_t oid, int dest);
+  void push(pobject_t oid, int dest, int op=CEPH_OSD_OP_PUSH);
   void pull(pobject_t oid);
 
   // modify
   objectrev_t assign_version(MOSDOp *op);
   void op_modify_commit(tid_t rep_tid, eversion_t pg_complete_thru);
-  void sub_op_modify_commit(MOSDSubOp *op, int ackerosd, eversion_t last_complete);
+  bool sub_op_modify_commit(MOSDSubOp *op, int ackerosd, eversion_t last_complete);
+  void batch_rep_reply(MOSDSubOpReply *&batch, MOSDSubOp *op, int ackerosd, bool commit);
+  void send_rep_reply(MOSDSubOpReply *&batch);
+  void flush_rep_acks();
+  bool sub_op_modify_queued();
+  void flush_rep_commits();
+  void queue_rep_commit_flush();
 
   void prepare_log_transaction(ObjectStore::Transaction& t, 
 			       osd_reqid_t reqid, pobject_t poid, int op, eversion_t version,
@@ -110,6 +158,7 @@ protected:
 
   friend class C_OSD_ModifyCommit;
   friend class C_OSD_RepModifyCommit;
+  friend class C_OSD_RepCommitFlush;
 
 
   // pg on-disk content
@@ -131,13 +180,43 @@ protected:
   void sub_op_push_reply(MOSDSubOpReply *reply);
   void sub_op_pull(MOSDSubOp *op);
 
+  // scrub [primary]
+  ObjectStore::ListCursor scrub_cursor;  // next chunk starts here
+  pobject_t scrub_last;           // last object the previous chunk covered
+  bool      scrub_first_chunk;
+  tid_t     scrub_queued;         // chunk op queued to myself, or 0
+  tid_t     scrub_tid;            // chunk out to replicas, or 0
+  utime_t   scrub_chunk_start;
+  map<pobject_t, scrub_object_t>         scrub_local;
+  map<int, map<pobject_t, scrub_object_t> > scrub_peer;
+  set<int>  scrub_waiting;
+  map<object_t, set<int> > scrub_repairing;  // my copy is being pulled back; push it to these after
+  utime_t   scrub_stamp;
+  int       scrub_objects, scrub_errors, scrub_fixed;
+  off_t     scrub_bytes;
+
+  void scrub_clear();
+  void scrub_object(pobject_t poid, scrub_object_t& so);
+  void scrub_chunk(MOSDSubOp *op);
+  void scrub_compare();
+  void scrub_repair(MOSDSubOp *op);
+  void scrub_finish();
+  void sub_op_scrub(MOSDSubOp *op);
+  void sub_op_scrub_reply(MOSDSubOpReply *reply);
+
 
 public:
   ReplicatedPG(OSD *o, pg_t p) : 
     PG(o,p),
-    num_pulling(0) 
+    rep_ack_batch(0), rep_commit_batch(0), rep_batch_to(-1),
+    rep_commit_flush_queued(false),
+    num_pulling(0),
+    scrub_first_chunk(true), scrub_queued(0), scrub_tid(0),
+    scrub_objects(0), scrub_errors(0), scrub_fixed(0), scrub_bytes(0)
   { }
-  ~ReplicatedPG() {}
+  ~ReplicatedPG() {
+    clear_object_contexts();
+  }
 
   bool preprocess_op(MOSDOp *op, utime_t now);
   void do_op(MOSDOp *op);
@@ -155,6 +234,10 @@ public:
   void on_acker_change();
   void on_role_change();
   void on_change();
+
+  bool scrub_start();
+  bool scrub_ready();
+  void scrub_queue();
 };
 
 
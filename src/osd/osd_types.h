@@ -54,8 +54,11 @@ inline bool operator>=(const osd_reqid_t& l, const osd_reqid_t& r) { return !(l
 namespace __gnu_cxx {
   template<> struct hash<osd_reqid_t> {
     size_t operator()(const osd_reqid_t &r) const { 
+      // the fields, not the struct: its padding is whatever was there
       static blobhash H;
-      return H((const char*)&r, sizeof(r));
+      __u32 b[5] = { r.name.v.type, r.name.v.num, (__u32)r.inc,
+		     (__u32)r.tid, (__u32)(r.tid >> 32) };
+      return H((const char*)b, sizeof(b));
     }
   };
 }
@@ -97,14 +100,14 @@ public:
     u = cpg;
   }
 
-  int type()      { return u.pg.type; }
-  bool is_rep()   { return type() == TYPE_REP; }
-  bool is_raid4() { return type() == TYPE_RAID4; }
+  int type() const      { return u.pg.type; }
+  bool is_rep() const   { return type() == TYPE_REP; }
+  bool is_raid4() const { return type() == TYPE_RAID4; }
 
-  int size() { return u.pg.size; }
-  ps_t ps() { return u.pg.ps; }
+  int size() const { return u.pg.size; }
+  ps_t ps() const { return u.pg.ps; }
   //pruleset_t ruleset() { return u.pg.ruleset; }
-  int preferred() { return u.pg.preferred; }   // hack: avoid negative.
+  int preferred() const { return u.pg.preferred; }   // hack: avoid negative.
   
   /*
   pg_t operator=(uint64_t v) { u.val = v; return *this; }
@@ -221,6 +224,20 @@ struct osd_stat_t {
 };
 
 
+inline bool osd_stat_changed(const osd_stat_t& now, const osd_stat_t& was, double ratio)
+{
+  if (now.num_blocks != was.num_blocks)
+    return true;
+  int64_t d = now.num_blocks_avail - was.num_blocks_avail;
+  if (d < 0) d = -d;
+  if ((double)d > ratio * (double)was.num_blocks_avail)
+    return true;
+  d = now.num_objects - was.num_objects;
+  if (d < 0) d = -d;
+  return d && (double)d > ratio * (double)was.num_objects;
+}
+
+
 /** pg_stat
  * aggregate stats for a single PG.
  */
@@ -228,13 +245,33 @@ struct pg_stat_t {
   eversion_t reported;
   
   int32_t state;
+  int32_t primary;      // reporting osd
   int64_t num_bytes;    // in bytes
   int64_t num_blocks;   // in 4k blocks
   int64_t num_objects;
   
-  pg_stat_t() : state(0), num_bytes(0), num_blocks(0), num_objects(0) {}
+  pg_stat_t() : state(0), primary(-1), num_bytes(0), num_blocks(0), num_objects(0) {}
 };
 
+/*
+ * is the change from 'was' to 'now' worth telling the monitor about?
+ * any state (or primary) change is; sizes only if they moved by more
+ * than 'ratio' of what we last reported.
+ */
+inline bool pg_stat_changed(const pg_stat_t& now, const pg_stat_t& was, double ratio)
+{
+  if (now.state != was.state || now.primary != was.primary)
+    return true;
+  int64_t a[3] = { now.num_bytes, now.num_blocks, now.num_objects };
+  int64_t b[3] = { was.num_bytes, was.num_blocks, was.num_objects };
+  for (int i=0; i<3; i++) {
+    int64_t d = a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+    if (d && (double)d > ratio * (double)b[i])
+      return true;
+  }
+  return false;
+}
+
 typedef struct ceph_osd_peer_stat osd_peer_stat_t;
 
 inline ostream& operator<<(ostream& out, const osd_peer_stat_t &stat) {
@@ -247,6 +284,33 @@ inline ostream& operator<<(ostream& out, const osd_peer_stat_t &stat) {
 	     << ")";
 }
 
+/*
+ * scrub: what one osd has of one object.  r is the error reading it,
+ * if any (ebofs says -EIO when a block doesn't match its checksum).
+ */
+struct scrub_object_t {
+  eversion_t version;
+  uint64_t size;
+  uint64_t digest;       // data; see ObjectStore::digest()
+  uint64_t attr_digest;
+  int32_t r;
+  scrub_object_t() : size(0), digest(0), attr_digest(0), r(0) {}
+
+  bool same_as(const scrub_object_t& o) const {
+    return r == 0 && o.r == 0 &&
+      version == o.version && size == o.size &&
+      digest == o.digest && attr_digest == o.attr_digest;
+  }
+};
+
+inline ostream& operator<<(ostream& out, const scrub_object_t& so) {
+  out << "v" << so.version << " " << so.size << " bytes " << hex << so.digest
+      << "/" << so.attr_digest << dec;
+  if (so.r)
+    out << " r=" << so.r;
+  return out;
+}
+
 // -----------------------------------------
 
 class ObjectExtent {
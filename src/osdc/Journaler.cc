@@ -15,13 +15,13 @@
 #include "Journaler.h"
 
 #include "include/Context.h"
-#include "common/Logger.h"
+#include "common/PerfCounters.h"
 #include "msg/Messenger.h"
 
 #include "config.h"
 
-#define dout(x)  if (x <= g_conf.debug || x <= g_conf.debug_journaler) *_dout << dbeginl << g_clock.now() << " " << objecter->messenger->get_myname() << ".journaler "
-#define derr(x)  if (x <= g_conf.debug || x <= g_conf.debug_journaler) *_derr << dbeginl << g_clock.now() << " " << objecter->messenger->get_myname() << ".journaler "
+#define dout(x)  dout_if(x, x <= g_conf.debug || x <= g_conf.debug_journaler) << g_clock.now() << " " << objecter->messenger->get_myname() << ".journaler "
+#define derr(x)  derr_if(x, x <= g_conf.debug || x <= g_conf.debug_journaler) << g_clock.now() << " " << objecter->messenger->get_myname() << ".journaler "
 
 
 
@@ -205,10 +205,10 @@ void Journaler::_finish_flush(int r, off_t start)
   assert(pending_flush.count(start));
 
   // calc latency?
-  if (logger) {
+  if (perf) {
     utime_t lat = g_clock.now();
     lat -= pending_flush[start];
-    logger->favg("jlat", lat);
+    perf->tinc(perf_lat, lat);
   }
 
   pending_flush.erase(start);
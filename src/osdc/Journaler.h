@@ -57,7 +57,7 @@
 #include <map>
 
 class Context;
-class Logger;
+class PerfCounters;
 
 class Journaler {
 
@@ -78,7 +78,8 @@ class Journaler {
   Objecter *objecter;
   Filer filer;
 
-  Logger *logger;
+  PerfCounters *perf;
+  int perf_lat;     // counter for write latency (submitted to safe)
 
   Mutex *lock;
   SafeTimer timer;
@@ -170,8 +171,8 @@ class Journaler {
   friend class C_Trim;
 
 public:
-  Journaler(inode_t& inode_, Objecter *obj, Logger *l, Mutex *lk, off_t fl=0, off_t pff=0) : 
-    inode(inode_), objecter(obj), filer(objecter), logger(l), 
+  Journaler(inode_t& inode_, Objecter *obj, PerfCounters *p, int plat, Mutex *lk, off_t fl=0, off_t pff=0) : 
+    inode(inode_), objecter(obj), filer(objecter), perf(p), perf_lat(plat), 
     lock(lk), timer(*lk), delay_flush_event(0),
     state(STATE_UNDEF),
     write_pos(0), flush_pos(0), ack_pos(0),
@@ -12,7 +12,7 @@
 
 /*** ObjectCacher::Object ***/
 
-#define dout(l)    if (l<=g_conf.debug || l<=g_conf.debug_objectcacher) *_dout << dbeginl << g_clock.now() << " " << oc->objecter->messenger->get_myname() << ".objectcacher.object(" << oid << ") "
+#define dout(l)    dout_if(l, l<=g_conf.debug || l<=g_conf.debug_objectcacher) << g_clock.now() << " " << oc->objecter->messenger->get_myname() << ".objectcacher.object(" << oid << ") "
 
 
 ObjectCacher::BufferHead *ObjectCacher::Object::split(BufferHead *left, off_t off)
@@ -22,6 +22,7 @@ ObjectCacher::BufferHead *ObjectCacher::Object::split(BufferHead *left, off_t of
   // split off right
   ObjectCacher::BufferHead *right = new BufferHead(this);
   right->last_write_tid = left->last_write_tid;
+  right->readahead = left->readahead;
   right->set_state(left->get_state());
   
   off_t newleftlen = off - left->start();
@@ -101,13 +102,17 @@ void ObjectCacher::Object::try_merge_bh(BufferHead *bh)
 {
   dout(10) << "try_merge_bh " << *bh << dendl;
 
+  // leave readahead alone: merged, it would take on the older bh's
+  // place in the lru, and could be trimmed before it's read.
+
   // to the left?
   map<off_t,BufferHead*>::iterator p = data.find(bh->start());
   assert(p->second == bh);
   if (p != data.begin()) {
     p--;
     if (p->second->end() == bh->start() &&
-	p->second->get_state() == bh->get_state()) {
+	p->second->get_state() == bh->get_state() &&
+	!p->second->readahead && !bh->readahead) {
       merge_left(p->second, bh);
       bh = p->second;
     } else 
@@ -118,7 +123,8 @@ void ObjectCacher::Object::try_merge_bh(BufferHead *bh)
   p++;
   if (p != data.end() &&
       p->second->start() == bh->end() &&
-      p->second->get_state() == bh->get_state()) 
+      p->second->get_state() == bh->get_state() &&
+      !p->second->readahead && !bh->readahead) 
     merge_left(bh, p->second);
 }
 
@@ -369,7 +375,7 @@ void ObjectCacher::Object::truncate(off_t s)
 /*** ObjectCacher ***/
 
 #undef dout
-#define dout(l)    if (l<=g_conf.debug || l<=g_conf.debug_objectcacher) *_dout << dbeginl << g_clock.now() << " " << objecter->messenger->get_myname() << ".objectcacher "
+#define dout(l)    dout_if(l, l<=g_conf.debug || l<=g_conf.debug_objectcacher) << g_clock.now() << " " << objecter->messenger->get_myname() << ".objectcacher "
 
 
 
@@ -422,6 +428,7 @@ void ObjectCacher::bh_read_finish(object_t oid, off_t start, size_t length, buff
     bl.push_back(bp);
   }
   
+  list<Context*> ls;
   if (objects.count(oid) == 0) {
     dout(7) << "bh_read_finish no object cache" << dendl;
   } else {
@@ -458,25 +465,31 @@ void ObjectCacher::bh_read_finish(object_t oid, off_t start, size_t length, buff
                        opos-bh->start(),
                        bh->length());
       mark_clean(bh);
+      if (bh->readahead) {
+	// below anything anybody asked for, after older readahead
+	lru_rest.lru_remove(bh);
+	lru_rest.lru_insert_mid(bh);
+      }
       dout(10) << "bh_read_finish read " << *bh << dendl;
       
       opos = bh->end();
-      p++;
 
       // finishers?
-      // called with lock held.
-      list<Context*> ls;
       for (map<off_t, list<Context*> >::iterator p = bh->waitfor_read.begin();
            p != bh->waitfor_read.end();
            p++)
         ls.splice(ls.end(), p->second);
       bh->waitfor_read.clear();
-      finish_contexts(ls);
 
       // clean up?
       ob->try_merge_bh(bh);
+      p = ob->data.lower_bound(opos);
     }
   }
+
+  // called with lock held.  do this last: a retried read may trim (and
+  // a readahead bh is the first thing trim takes).
+  finish_contexts(ls);
   //lock.Unlock();
 }
 
@@ -823,11 +836,13 @@ int ObjectCacher::readx(Objecter::OSDRead *rd, inodeno_t ino, Context *onfinish)
     }
   }
   
-  // bump hits in lru
+  // bump hits in lru.  readahead stays put, so a stream trims behind
+  // itself instead of pushing everything else out.
   for (list<BufferHead*>::iterator bhit = hit_ls.begin();
        bhit != hit_ls.end();
        bhit++) 
-    touch_bh(*bhit);
+    if (!(*bhit)->readahead)
+      touch_bh(*bhit);
   
   if (!success) return 0;  // wait!
 
@@ -858,6 +873,33 @@ int ObjectCacher::readx(Objecter::OSDRead *rd, inodeno_t ino, Context *onfinish)
 }
 
 
+/*
+ * start reading whatever part of rd isn't cached or already on its
+ * way, and don't wait for it.  the new bhs are marked readahead: they
+ * land in the bottom half of the lru when they come in and stay there
+ * when read, so trim takes them, oldest first, before anything that
+ * was asked for.
+ */
+void ObjectCacher::readahead(Objecter::OSDRead *rd, inodeno_t ino)
+{
+  for (list<ObjectExtent>::iterator ex_it = rd->extents.begin();
+       ex_it != rd->extents.end();
+       ex_it++) {
+    dout(10) << "readahead " << *ex_it << dendl;
+    Object *o = get_object(ex_it->oid, ino, ex_it->layout);
+    map<off_t, BufferHead*> hits, missing, rx;
+    o->map_read(rd, hits, missing, rx);
+    for (map<off_t, BufferHead*>::iterator bh_it = missing.begin();
+         bh_it != missing.end();
+         bh_it++) {
+      bh_it->second->readahead = true;
+      bh_read(bh_it->second);
+    }
+  }
+  delete rd;
+}
+
+
 int ObjectCacher::writex(Objecter::OSDWrite *wr, inodeno_t ino)
 {
   utime_t now = g_clock.now();
@@ -870,6 +912,7 @@ int ObjectCacher::writex(Objecter::OSDWrite *wr, inodeno_t ino)
 
     // map it all into a single bufferhead.
     BufferHead *bh = o->map_write(wr);
+    bh->readahead = false;
     
     // adjust buffer pointers (ie "copy" data into my cache)
     // this is over a single ObjectExtent, so we know that
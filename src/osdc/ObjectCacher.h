@@ -45,6 +45,7 @@ class ObjectCacher {
     bufferlist  bl;
     tid_t last_write_tid;  // version of bh (if non-zero)
     utime_t last_write;
+    bool readahead;        // prefetched; first to be trimmed
     
     map< off_t, list<Context*> > waitfor_read;
     
@@ -54,7 +55,8 @@ class ObjectCacher {
       state(STATE_MISSING),
       ref(0),
       ob(o),
-      last_write_tid(0) {}
+      last_write_tid(0),
+      readahead(false) {}
   
     // extent
     off_t start() { return ex.start; }
@@ -454,6 +456,7 @@ class ObjectCacher {
   // non-blocking.  async.
   int readx(Objecter::OSDRead *rd, inodeno_t ino, Context *onfinish);
   int writex(Objecter::OSDWrite *wr, inodeno_t ino);
+  void readahead(Objecter::OSDRead *rd, inodeno_t ino);
 
   // write blocking
   void wait_for_write(size_t len, Mutex& lock);
@@ -493,6 +496,14 @@ class ObjectCacher {
     return readx(rd, inode.ino, onfinish);
   }
 
+  void file_readahead(inode_t& inode,
+		      off_t offset, size_t len) {
+    bufferlist bl;
+    Objecter::OSDRead *rd = new Objecter::OSDRead(&bl);
+    filer.file_to_extents(inode, offset, len, rd->extents);
+    readahead(rd, inode.ino);
+  }
+
   int file_write(inode_t& inode,
                  off_t offset, size_t len, 
                  bufferlist& bl,
@@ -539,6 +550,7 @@ inline ostream& operator<<(ostream& out, ObjectCacher::BufferHead &bh)
   if (bh.is_dirty()) out << " dirty";
   if (bh.is_clean()) out << " clean";
   if (bh.is_missing()) out << " missing";
+  if (bh.readahead) out << " readahead";
   if (bh.bl.length() > 0) out << " firstbyte=" << (int)bh.bl[0];
   out << "]";
   return out;
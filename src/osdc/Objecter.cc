@@ -24,18 +24,37 @@
 #include "messages/MOSDMap.h"
 #include "messages/MOSDGetMap.h"
 
+#include "include/compress.h"
+
 #include "messages/MOSDFailure.h"
 
 #include <errno.h>
 
 #include "config.h"
 
-#define dout(x)  if (x <= g_conf.debug || x <= g_conf.debug_objecter) *_dout << dbeginl << g_clock.now() << " " << messenger->get_myname() << ".objecter "
-#define derr(x)  if (x <= g_conf.debug || x <= g_conf.debug_objecter) *_derr << dbeginl << g_clock.now() << " " << messenger->get_myname() << ".objecter "
+#define dout(x)  dout_if(x, x <= g_conf.debug || x <= g_conf.debug_objecter) << g_clock.now() << " " << messenger->get_myname() << ".objecter "
+#define derr(x)  derr_if(x, x <= g_conf.debug || x <= g_conf.debug_objecter) << g_clock.now() << " " << messenger->get_myname() << ".objecter "
 
 
 // messages ------------------------------
 
+static PerfCountersType objecter_perftype(l_objecter_first, l_objecter_last);
+
+void Objecter::init_perf()
+{
+  if (objecter_perftype.empty()) {
+    objecter_perftype.add_u64(l_objecter_rd, "rd");
+    objecter_perftype.add_u64(l_objecter_wr, "wr");
+    objecter_perftype.add_u64(l_objecter_stat, "stat");
+    objecter_perftype.add_u64(l_objecter_resend, "resend");
+    objecter_perftype.add_lat(l_objecter_rd_lat, "rd_lat");
+    objecter_perftype.add_lat(l_objecter_w_ack_lat, "w_ack_lat");
+    objecter_perftype.add_lat(l_objecter_w_commit_lat, "w_commit_lat");
+    objecter_perftype.add_lat(l_objecter_stat_lat, "stat_lat");
+  }
+  perf = new PerfCounters("objecter", &objecter_perftype);
+}
+
 void Objecter::init()
 {
   assert(client_lock.is_locked());  // otherwise event cancellation is unsafe
@@ -83,22 +102,45 @@ void Objecter::handle_osd_map(MOSDMap *m)
 
     set<pg_t> changed_pgs;
 
-    for (epoch_t e = osdmap->get_epoch() + 1;
-         e <= m->get_last();
-         e++) {
-      if (m->incremental_maps.count(e)) {
+    while (osdmap->get_epoch() < m->get_last()) {
+      epoch_t cur = osdmap->get_epoch();
+      epoch_t e = cur + 1;
+      OSDMap::Incremental inc;
+      bool have_inc = false;
+
+      if (m->merged_maps.count(cur)) {
+        bufferlist bl;
+        if (decompress_bl(m->merged_maps[cur], bl) == 0) {
+          int off = 0;
+          inc.decode(bl, off);
+          e = inc.epoch;
+          have_inc = true;
+          dout(3) << "handle_osd_map decoding merged " << cur << ".." << e << dendl;
+        } else {
+          dout(0) << "handle_osd_map can't decompress merged " << cur
+                  << ".." << m->merged_span[cur] << ", skipping" << dendl;
+        }
+      }
+      if (!have_inc && m->incremental_maps.count(e)) {
         dout(3) << "handle_osd_map decoding incremental epoch " << e << dendl;
-        OSDMap::Incremental inc;
         int off = 0;
         inc.decode(m->incremental_maps[e], off);
-        osdmap->apply_incremental(inc);
-    
-        // notify messenger
+        have_inc = true;
+      }
+
+      if (have_inc) {
+        // note addrs before they're replaced by a merged new_up
+        list<entity_addr_t> down;
         for (map<int32_t,uint8_t>::iterator i = inc.new_down.begin();
              i != inc.new_down.end();
              i++) 
-          messenger->mark_down(osdmap->get_addr(i->first));
-        
+          down.push_back(osdmap->get_addr(i->first));
+
+        osdmap->apply_incremental(inc);
+    
+        // notify messenger
+        for (list<entity_addr_t>::iterator p = down.begin(); p != down.end(); p++)
+          messenger->mark_down(*p);
       }
       else if (m->maps.count(e)) {
         dout(3) << "handle_osd_map decoding full epoch " << e << dendl;
@@ -216,6 +258,8 @@ void Objecter::kick_requests(set<pg_t>& changed_pgs)
       if (op_modify.count(tid)) {
         OSDModify *wr = op_modify[tid];
         op_modify.erase(tid);
+        window_put(tid);
+        window_unqueue(tid, wr);
         
         // WRITE
         if (wr->tid_version.count(tid)) {
@@ -225,11 +269,13 @@ void Objecter::kick_requests(set<pg_t>& changed_pgs)
           } else {
             dout(3) << "kick_requests missing commit, replay write " << tid
                     << " v " << wr->tid_version[tid] << dendl;
+            perf->inc(l_objecter_resend);
             modifyx_submit(wr, wr->waitfor_commit[tid], tid);
           }
         } 
         else if (wr->waitfor_ack.count(tid)) {
           dout(3) << "kick_requests missing ack, resub write " << tid << dendl;
+          perf->inc(l_objecter_resend);
           modifyx_submit(wr, wr->waitfor_ack[tid], tid);
         }
       }
@@ -238,9 +284,12 @@ void Objecter::kick_requests(set<pg_t>& changed_pgs)
         // READ
         OSDRead *rd = op_read[tid];
         op_read.erase(tid);
+        window_put(tid);
+        window_unqueue(tid, rd);
         dout(3) << "kick_requests resub read " << tid << dendl;
 
         // resubmit
+        perf->inc(l_objecter_resend);
         readx_submit(rd, rd->ops[tid], true);
         rd->ops.erase(tid);
       }
@@ -252,6 +301,7 @@ void Objecter::kick_requests(set<pg_t>& changed_pgs)
 	dout(3) << "kick_requests resub stat " << tid << dendl;
 		
         // resubmit
+        perf->inc(l_objecter_resend);
         stat_submit(st);
       }
 	  
@@ -318,6 +368,195 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 
 
 
+// osd window -----------------------------
+
+bool Objecter::window_has_room(OSDWindow& w)
+{
+  if (g_conf.objecter_osd_window &&
+      w.ops >= g_conf.objecter_osd_window)
+    return false;
+  if (g_conf.objecter_osd_window_bytes &&
+      w.ops &&
+      w.bytes >= (size_t)g_conf.objecter_osd_window_bytes)
+    return false;
+  return true;
+}
+
+bool Objecter::window_full(int osd)
+{
+  if (!osd_window.count(osd))
+    return false;
+  OSDWindow& w = osd_window[osd];
+  return !w.rr.empty() || !window_has_room(w);   // don't cut in line
+}
+
+void Objecter::window_get(int osd, tid_t tid, size_t len)
+{
+  assert(op_window.count(tid) == 0);
+  OSDWindow& w = osd_window[osd];
+  w.ops++;
+  w.bytes += len;
+  op_window[tid] = pair<int,size_t>(osd, len);
+}
+
+void Objecter::window_put(tid_t tid)
+{
+  if (op_window.count(tid) == 0)
+    return;
+  int osd = op_window[tid].first;
+  OSDWindow& w = osd_window[osd];
+  w.ops--;
+  w.bytes -= op_window[tid].second;
+  op_window.erase(tid);
+
+  window_kick(osd);
+
+  if (osd_window.count(osd) &&
+      osd_window[osd].ops == 0 &&
+      osd_window[osd].rr.empty())
+    osd_window.erase(osd);
+}
+
+void Objecter::window_queue(int osd, OSDOp *op, tid_t tid)
+{
+  OSDWindow& w = osd_window[osd];
+  if (w.queued.count(op) == 0)
+    w.rr.push_back(op);
+  w.queued[op].push_back(tid);
+  op_queued[tid] = osd;
+}
+
+bool Objecter::window_unqueue(tid_t tid, OSDOp *op)
+{
+  if (op_queued.count(tid) == 0)
+    return false;
+  OSDWindow& w = osd_window[op_queued[tid]];
+  op_queued.erase(tid);
+  w.queued[op].remove(tid);
+  if (w.queued[op].empty()) {
+    w.queued.erase(op);
+    w.rr.remove(op);
+  }
+  return true;
+}
+
+/*
+ * send queued ops to this osd while there's room, one from each
+ * request in turn.
+ */
+void Objecter::window_kick(int osd)
+{
+  while (osd_window.count(osd)) {
+    OSDWindow& w = osd_window[osd];
+    if (w.rr.empty() || !window_has_room(w))
+      break;
+
+    OSDOp *op = w.rr.front();
+    w.rr.pop_front();
+    tid_t tid = w.queued[op].front();
+    w.queued[op].pop_front();
+    if (w.queued[op].empty())
+      w.queued.erase(op);
+    else
+      w.rr.push_back(op);
+    op_queued.erase(tid);
+
+    if (op_read.count(tid)) {
+      OSDRead *rd = op_read[tid];
+      window_get(osd, tid, rd->ops[tid].length);
+      send_read(rd, tid, false);
+    } else {
+      assert(op_modify.count(tid));
+      OSDModify *wr = op_modify[tid];
+      window_get(osd, tid, wr->waitfor_commit[tid].length);
+      send_modify(wr, tid, false);
+    }
+  }
+}
+
+/*
+ * merge adjacent extents of the same object, then cut anything over
+ * objecter_max_op_bytes into pieces, so that one huge extent doesn't
+ * hold an osd's window (or its disk) for ages.  only extents whose
+ * buffer_extents cover them can be merged or split.
+ */
+static size_t buffer_len(ObjectExtent& ex)
+{
+  size_t len = 0;
+  for (map<size_t,size_t>::iterator p = ex.buffer_extents.begin();
+       p != ex.buffer_extents.end();
+       p++)
+    len += p->second;
+  return len;
+}
+
+void Objecter::prepare_extents(list<ObjectExtent>& extents)
+{
+  size_t max = g_conf.objecter_max_op_bytes;
+
+  // aggregate
+  list<ObjectExtent>::iterator p = extents.begin();
+  while (p != extents.end()) {
+    list<ObjectExtent>::iterator n = p;
+    n++;
+    if (n == extents.end())
+      break;
+    if (n->oid == p->oid &&
+	n->start == p->start + (off_t)p->length &&
+	(!max || p->length + n->length <= max) &&
+	!p->buffer_extents.empty() && buffer_len(*p) == p->length &&
+	!n->buffer_extents.empty() && buffer_len(*n) == n->length &&
+	n->buffer_extents.begin()->first >=
+	p->buffer_extents.rbegin()->first + p->buffer_extents.rbegin()->second) {
+      dout(15) << "prepare_extents merging " << *p << " and " << *n << dendl;
+      map<size_t,size_t>::iterator last = p->buffer_extents.end();
+      last--;
+      map<size_t,size_t>::iterator first = n->buffer_extents.begin();
+      if (last->first + last->second == first->first) {
+	last->second += first->second;
+	n->buffer_extents.erase(first);
+      }
+      p->buffer_extents.insert(n->buffer_extents.begin(), n->buffer_extents.end());
+      p->length += n->length;
+      extents.erase(n);
+    } else
+      p++;
+  }
+
+  // split
+  if (!max)
+    return;
+  for (p = extents.begin(); p != extents.end(); p++) {
+    if (p->length <= max ||
+	buffer_len(*p) != p->length)
+      continue;
+    dout(15) << "prepare_extents splitting " << *p << dendl;
+    while (p->length > max) {
+      ObjectExtent head(p->oid, p->start, max);
+      head.layout = p->layout;
+      size_t left = max;
+      while (left) {
+	map<size_t,size_t>::iterator b = p->buffer_extents.begin();
+	size_t boff = b->first, blen = b->second;
+	p->buffer_extents.erase(b);
+	if (blen <= left) {
+	  head.buffer_extents[boff] = blen;
+	  left -= blen;
+	} else {
+	  head.buffer_extents[boff] = left;
+	  p->buffer_extents[boff + left] = blen - left;
+	  left = 0;
+	}
+      }
+      p->start += max;
+      p->length -= max;
+      extents.insert(p, head);
+    }
+  }
+}
+
+
+
 // stat -----------------------------------
 
 tid_t Objecter::stat(object_t oid, off_t *size, ceph_object_layout ol, Context *onfinish)
@@ -326,6 +565,8 @@ tid_t Objecter::stat(object_t oid, off_t *size, ceph_object_layout ol, Context *
   st->extents.push_back(ObjectExtent(oid, 0, 0));
   st->extents.front().layout = ol;
   st->onfinish = onfinish;
+  st->start = g_clock.now();
+  perf->inc(l_objecter_stat);
 
   return stat_submit(st);
 }
@@ -407,6 +648,7 @@ void Objecter::handle_osd_stat_reply(MOSDOpReply *m)
 
   // finish, clean up
   Context *onfinish = st->onfinish;
+  perf->tinc(l_objecter_stat_lat, g_clock.now() - st->start);
 
   // done
   delete st;
@@ -436,6 +678,13 @@ tid_t Objecter::read(object_t oid, off_t off, size_t len, ceph_object_layout ol,
 tid_t Objecter::readx(OSDRead *rd, Context *onfinish)
 {
   rd->onfinish = onfinish;
+  rd->start = g_clock.now();
+  perf->inc(l_objecter_rd);
+
+  if (rd->extents.size() == 1 &&
+      rd->extents.front().buffer_extents.empty())
+    rd->extents.front().buffer_extents[0] = rd->extents.front().length;
+  prepare_extents(rd->extents);
   
   // issue reads
   for (list<ObjectExtent>::iterator it = rd->extents.begin();
@@ -460,10 +709,40 @@ tid_t Objecter::readx_submit(OSDRead *rd, ObjectExtent &ex, bool retry)
   op_read[last_tid] = rd;    
 
   pg.active_tids.insert(last_tid);
+
+  // send, or wait our turn?
+  int who = read_target(rd, pg);
+  if (who >= 0 && !retry && window_full(who)) {
+    dout(10) << "readx_submit " << rd << " tid " << last_tid
+	     << " oid " << ex.oid << " " << ex.start << "~" << ex.length
+	     << " queued for osd" << who << dendl;
+    window_queue(who, rd, last_tid);
+    return last_tid;
+  }
+  if (who >= 0)
+    window_get(who, last_tid, ex.length);
+  send_read(rd, last_tid, retry);
+  return last_tid;
+}
+
+int Objecter::read_target(OSDRead *rd, PG& pg)
+{
+  if (pg.acker() < 0)
+    return -1;
+  if (rd->balance_reads) {
+    int replica = messenger->get_myname().num() % pg.acting.size();
+    return pg.acting[replica];
+  }
+  return pg.acker();
+}
+
+void Objecter::send_read(OSDRead *rd, tid_t tid, bool retry)
+{
+  ObjectExtent &ex = rd->ops[tid];
+  PG &pg = get_pg( ex.layout.ol_pgid );
   pg.last = g_clock.now();
 
-  // send?
-  dout(10) << "readx_submit " << rd << " tid " << last_tid
+  dout(10) << "readx_submit " << rd << " tid " << tid
            << " oid " << ex.oid << " " << ex.start << "~" << ex.length
            << " (" << ex.buffer_extents.size() << " buffer fragments)" 
            << " " << ex.layout
@@ -471,25 +750,19 @@ tid_t Objecter::readx_submit(OSDRead *rd, ObjectExtent &ex, bool retry)
            << dendl;
 
   if (pg.acker() >= 0) {
-    MOSDOp *m = new MOSDOp(messenger->get_myinst(), client_inc, last_tid,
+    MOSDOp *m = new MOSDOp(messenger->get_myinst(), client_inc, tid,
 			   ex.oid, ex.layout, osdmap->get_epoch(), 
 			   CEPH_OSD_OP_READ);
     m->set_length(ex.length);
     m->set_offset(ex.start);
     m->set_retry_attempt(retry);
     
-    int who = pg.acker();
-    if (rd->balance_reads) {
-      int replica = messenger->get_myname().num() % pg.acting.size();
-      who = pg.acting[replica];
-      dout(-10) << "readx_submit reading from random replica " << replica
-		<< " = osd" << who <<  dendl;
-    }
+    int who = read_target(rd, pg);
+    if (rd->balance_reads)
+      dout(-10) << "readx_submit reading from random replica = osd" << who <<  dendl;
     messenger->send_message(m, osdmap->get_inst(who));
   } else 
     maybe_request_map();
-    
-  return last_tid;
 }
 
 
@@ -515,12 +788,14 @@ void Objecter::handle_osd_read_reply(MOSDOpReply *m)
   if (pg.active_tids.empty()) close_pg( m->get_pg() );
   
   // our op finished
+  ObjectExtent ex = rd->ops[tid];
   rd->ops.erase(tid);
+  window_put(tid);
 
   // success?
   if (m->get_result() == -EAGAIN) {
     dout(7) << " got -EAGAIN, resubmitting" << dendl;
-    readx_submit(rd, rd->ops[tid], true);
+    readx_submit(rd, ex, true);
     delete m;
     return;
   }
@@ -547,8 +822,8 @@ void Objecter::handle_osd_read_reply(MOSDOpReply *m)
        */
 
       // we have other fragments, assemble them all... blech!
-      rd->read_data[m->get_oid()] = new bufferlist;
-      rd->read_data[m->get_oid()]->claim( m->get_data() );
+      bufferlist *last = rd->read_data[pair<object_t,off_t>(ex.oid, ex.start)] = new bufferlist;
+      last->claim( m->get_data() );
 
       // map extents back into buffer
       map<off_t, bufferlist*> by_off;  // buffer offset -> bufferlist
@@ -557,7 +832,7 @@ void Objecter::handle_osd_read_reply(MOSDOpReply *m)
       for (list<ObjectExtent>::iterator eit = rd->extents.begin();
            eit != rd->extents.end();
            eit++) {
-        bufferlist *ox_buf = rd->read_data[eit->oid];
+        bufferlist *ox_buf = rd->read_data[pair<object_t,off_t>(eit->oid, eit->start)];
         unsigned ox_len = ox_buf->length();
         unsigned ox_off = 0;
         assert(ox_len <= eit->length);           
@@ -621,7 +896,7 @@ void Objecter::handle_osd_read_reply(MOSDOpReply *m)
       }
       
       // hose p->read_data bufferlist*'s
-      for (map<object_t, bufferlist*>::iterator it = rd->read_data.begin();
+      for (map<pair<object_t,off_t>, bufferlist*>::iterator it = rd->read_data.begin();
            it != rd->read_data.end();
            it++) {
         delete it->second;
@@ -636,6 +911,7 @@ void Objecter::handle_osd_read_reply(MOSDOpReply *m)
 
     // finish, clean up
     Context *onfinish = rd->onfinish;
+    perf->tinc(l_objecter_rd_lat, g_clock.now() - rd->start);
 
     dout(7) << " " << bytes_read << " bytes " 
             << rd->bl->length()
@@ -649,8 +925,8 @@ void Objecter::handle_osd_read_reply(MOSDOpReply *m)
     }
   } else {
     // store my bufferlist for later assembling
-    rd->read_data[m->get_oid()] = new bufferlist;
-    rd->read_data[m->get_oid()]->claim( m->get_data() );
+    bufferlist *bl = rd->read_data[pair<object_t,off_t>(ex.oid, ex.start)] = new bufferlist;
+    bl->claim( m->get_data() );
   }
 
   delete m;
@@ -705,6 +981,11 @@ tid_t Objecter::modifyx(OSDModify *wr, Context *onack, Context *oncommit)
 {
   wr->onack = onack;
   wr->oncommit = oncommit;
+  wr->start = g_clock.now();
+  perf->inc(l_objecter_wr);
+
+  if (wr->op == CEPH_OSD_OP_WRITE)
+    prepare_extents(wr->extents);
 
   // issue writes/whatevers
   for (list<ObjectExtent>::iterator it = wr->extents.begin();
@@ -734,12 +1015,34 @@ tid_t Objecter::modifyx_submit(OSDModify *wr, ObjectExtent &ex, tid_t usetid)
   wr->waitfor_commit[tid] = ex;
   op_modify[tid] = wr;
   pg.active_tids.insert(tid);
-  pg.last = g_clock.now();
 
   ++num_unacked;
   ++num_uncommitted;
 
-  // send?
+  // send, or wait our turn?
+  int who = pg.primary();
+  if (who >= 0 && usetid == 0 && window_full(who)) {
+    dout(10) << "modifyx_submit " << MOSDOp::get_opname(wr->op) << " tid " << tid
+	     << "  oid " << ex.oid << " " << ex.start << "~" << ex.length
+	     << " queued for osd" << who << dendl;
+    window_queue(who, wr, tid);
+  } else {
+    if (who >= 0)
+      window_get(who, tid, ex.length);
+    send_modify(wr, tid, usetid > 0);
+  }
+  
+  dout(5) << num_unacked << " unacked, " << num_uncommitted << " uncommitted" << dendl;
+  
+  return tid;
+}
+
+void Objecter::send_modify(OSDModify *wr, tid_t tid, bool retry)
+{
+  ObjectExtent &ex = wr->waitfor_commit[tid];
+  PG &pg = get_pg( ex.layout.ol_pgid );
+  pg.last = g_clock.now();
+
   dout(10) << "modifyx_submit " << MOSDOp::get_opname(wr->op) << " tid " << tid
            << "  oid " << ex.oid
            << " " << ex.start << "~" << ex.length 
@@ -752,7 +1055,7 @@ tid_t Objecter::modifyx_submit(OSDModify *wr, ObjectExtent &ex, tid_t usetid)
 			   wr->op);
     m->set_length(ex.length);
     m->set_offset(ex.start);
-    if (usetid > 0)
+    if (retry)
       m->set_retry_attempt(true);
     
     if (wr->tid_version.count(tid)) 
@@ -778,10 +1081,6 @@ tid_t Objecter::modifyx_submit(OSDModify *wr, ObjectExtent &ex, tid_t usetid)
     messenger->send_message(m, osdmap->get_inst(pg.primary()));
   } else 
     maybe_request_map();
-  
-  dout(5) << num_unacked << " unacked, " << num_uncommitted << " uncommitted" << dendl;
-  
-  return tid;
 }
 
 
@@ -819,6 +1118,9 @@ void Objecter::handle_osd_modify_reply(MOSDOpReply *m)
 
   assert(m->get_result() >= 0);
 
+  // the first of ack or commit frees our slot
+  window_put(tid);
+
   // ack or safe?
   if (m->is_safe()) {
     assert(wr->tid_version.count(tid) == 0 ||
@@ -840,6 +1142,7 @@ void Objecter::handle_osd_modify_reply(MOSDOpReply *m)
     if (wr->waitfor_commit.empty()) {
       onack = wr->onack;
       oncommit = wr->oncommit;
+      perf->tinc(l_objecter_w_commit_lat, g_clock.now() - wr->start);
       delete wr;
     }
   } else {
@@ -859,6 +1162,7 @@ void Objecter::handle_osd_modify_reply(MOSDOpReply *m)
     if (wr->waitfor_ack.empty()) {
       onack = wr->onack;
       wr->onack = 0;  // only do callback once
+      perf->tinc(l_objecter_w_ack_lat, g_clock.now() - wr->start);
       
       // buffer uncommitted?
       if (!g_conf.objecter_buffer_uncommitted &&
@@ -22,6 +22,7 @@
 #include "messages/MOSDOp.h"
 
 #include "common/Timer.h"
+#include "common/PerfCounters.h"
 
 #include <list>
 #include <map>
@@ -35,11 +36,25 @@ class OSDMap;
 class MonMap;
 class Message;
 
+enum {
+  l_objecter_first = 30000,
+  l_objecter_rd,
+  l_objecter_wr,
+  l_objecter_stat,
+  l_objecter_resend,
+  l_objecter_rd_lat,         // submit to data
+  l_objecter_w_ack_lat,      // submit to last ack
+  l_objecter_w_commit_lat,   // submit to last commit
+  l_objecter_stat_lat,
+  l_objecter_last
+};
+
 class Objecter {
  public:  
   Messenger *messenger;
   MonMap    *monmap;
   OSDMap    *osdmap;
+  PerfCounters *perf;
   
  private:
   tid_t last_tid;
@@ -70,6 +85,7 @@ class Objecter {
   class OSDOp {
   public:
     list<ObjectExtent> extents;
+    utime_t start;  // submitted
     virtual ~OSDOp() {}
   };
 
@@ -78,7 +94,7 @@ class Objecter {
     bufferlist *bl;
     Context *onfinish;
     map<tid_t, ObjectExtent> ops;
-    map<object_t, bufferlist*> read_data;  // bits of data as they come back
+    map<pair<object_t,off_t>, bufferlist*> read_data;  // bits of data as they come back, by (oid, start)
     int balance_reads;  // if non-zero, direct reads to a pseudo-random replica
 
     OSDRead(bufferlist *b) : bl(b), onfinish(0), balance_reads(0) {
@@ -165,6 +181,38 @@ class Objecter {
   }
   void scan_pgs(set<pg_t>& chnaged_pgs);
   void kick_requests(set<pg_t>& changed_pgs);
+
+
+  /**
+   * per-osd window
+   *  at most objecter_osd_window ops (and objecter_osd_window_bytes)
+   *  are in flight to any one osd.  the rest wait here, taking turns
+   *  by request, so that a small read isn't stuck behind every chunk
+   *  of a big one.  queued ops already have a tid and are in the pg
+   *  and request gather sets; they just haven't been sent.
+   */
+  class OSDWindow {
+  public:
+    int ops;
+    size_t bytes;
+    list<OSDOp*> rr;                  // requests with queued ops, in turn
+    map<OSDOp*, list<tid_t> > queued;
+    OSDWindow() : ops(0), bytes(0) {}
+  };
+
+  hash_map<int,OSDWindow> osd_window;
+  map<tid_t, pair<int,size_t> > op_window;  // tid -> (osd, bytes), holding a slot
+  map<tid_t, int> op_queued;                // tid -> osd, waiting for a slot
+
+  bool window_has_room(OSDWindow& w);
+  bool window_full(int osd);
+  void window_get(int osd, tid_t tid, size_t len);
+  void window_put(tid_t tid);
+  void window_queue(int osd, OSDOp *op, tid_t tid);
+  bool window_unqueue(tid_t tid, OSDOp *op);
+  void window_kick(int osd);
+
+  void prepare_extents(list<ObjectExtent>& extents);
     
 
  public:
@@ -174,8 +222,14 @@ class Objecter {
     num_unacked(0), num_uncommitted(0),
     last_epoch_requested(0),
     client_lock(l), timer(l)
-  { }
-  ~Objecter() { }
+  {
+    init_perf();
+  }
+  ~Objecter() {
+    delete perf;
+  }
+
+  void init_perf();
 
   void init();
   void shutdown();
@@ -193,6 +247,9 @@ class Objecter {
  private:
   tid_t readx_submit(OSDRead *rd, ObjectExtent& ex, bool retry=false);
   tid_t modifyx_submit(OSDModify *wr, ObjectExtent& ex, tid_t tid=0);
+  int read_target(OSDRead *rd, PG& pg);
+  void send_read(OSDRead *rd, tid_t tid, bool retry);
+  void send_modify(OSDModify *wr, tid_t tid, bool retry);
   tid_t stat_submit(OSDStat *st);
 
   // public interface
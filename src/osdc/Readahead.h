@@ -0,0 +1,88 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef __READAHEAD_H
+#define __READAHEAD_H
+
+#include "include/types.h"
+#include "config.h"
+
+/*
+ * sequential readahead state, one per open file handle.
+ *
+ * a read that starts where the last one ended is sequential; anything
+ * else collapses the window.  while sequential, once the reader gets
+ * within half a window of what we've already prefetched we fetch up to
+ * a window past the read, and double the window, starting from
+ * client_readahead_min and up to one stripe period
+ * (object_size * stripe_count, but no more than half the cache).  the
+ * prefetch ends on a window boundary, or a stripe unit boundary once
+ * the window is that big, so we don't keep nibbling at objects.
+ */
+class Readahead {
+  off_t next;     // where a sequential read would start
+  off_t end;      // how far we've prefetched
+  off_t window;   // 0 if not sequential
+
+public:
+  Readahead() : next(0), end(0), window(0) {}
+
+  off_t get_window() { return window; }
+
+  /*
+   * note a read of offset~len in a file of the given size and layout.
+   * sets ra_off~ra_len to what we should prefetch (ra_len 0 for
+   * nothing).
+   */
+  void update(off_t offset, off_t len, ceph_file_layout& layout, off_t size,
+	      off_t& ra_off, off_t& ra_len) {
+    ra_off = ra_len = 0;
+    off_t rend = offset + len;
+    if (g_conf.client_readahead_min <= 0 ||
+	offset != next) {
+      window = 0;
+      end = next = rend;
+      return;
+    }
+    next = rend;
+
+    off_t su = layout.fl_stripe_unit;
+    off_t max = ceph_file_layout_period(layout);
+    if (max > g_conf.client_oc_size / 2)
+      max = g_conf.client_oc_size / 2;
+    if (max < g_conf.client_readahead_min)
+      max = g_conf.client_readahead_min;
+
+    if (end < rend)
+      end = rend;
+    if (window && end - rend > window / 2)
+      return;   // far enough ahead
+
+    if (!window)
+      window = g_conf.client_readahead_min;
+    off_t align = MIN(window, su);
+    off_t target = (rend + window) / align * align;
+    if (target > size)
+      target = size;
+    if (window < max)
+      window = MIN(window * 2, max);
+    if (target <= end)
+      return;
+    ra_off = end;
+    ra_len = target - end;
+    end = target;
+  }
+};
+
+#endif
@@ -0,0 +1,366 @@
+/*
+ * a little cluster for the osd tests: real osds (FakeStore) and an
+ * Objecter client on the FakeMessenger, with a stub monitor that hands
+ * out osd maps.
+ *
+ * the test sets g_conf (num_osd, osd_max_rep, fakestore_*, ...) first,
+ * then
+ *
+ *   OSDCluster c(pg_t::TYPE_REP, 3);
+ *   if (c.start("testfoo") < 0) return 1;
+ *   c.wait_clean();
+ *
+ * start() works in a fresh temp dir.  only the pgs of the one type
+ * and size are watched.
+ */
+
+#ifndef __TEST_OSDCLUSTER_H
+#define __TEST_OSDCLUSTER_H
+
+#include <sys/stat.h>
+#include <iostream>
+#include <string>
+
+#include "config.h"
+
+#include "osd/OSD.h"
+#include "osd/OSDMap.h"
+#include "osdc/Objecter.h"
+#include "msg/FakeMessenger.h"
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "common/PerfCounters.h"
+
+#include "messages/MOSDBoot.h"
+#include "messages/MOSDMap.h"
+#include "messages/MOSDGetMap.h"
+#include "messages/MPGStats.h"
+
+
+/*
+ * just enough of a monitor: one map per epoch, every osd up once they
+ * have all booted, and whatever the test changes after that.  keeps
+ * the last pg state each primary reported.
+ */
+class StubMon : public Dispatcher {
+public:
+  Messenger *messenger;
+  Mutex lock;
+  Cond cond;
+  OSDMap osdmap;
+  map<epoch_t, bufferlist> maps;
+  map<int, entity_addr_t> booted;
+  list<entity_inst_t> subscribers;
+  map<pg_t, pg_stat_t> pg_stat;
+  int pg_type, pg_size;
+
+  StubMon(Messenger *m, int type, int size) : messenger(m), pg_type(type), pg_size(size) {
+    ceph_fsid f;
+    f.major = getpid();
+    f.minor = 1;
+    osdmap.set_fsid(f);
+    osdmap.set_pg_num(8);
+    osdmap.inc_epoch();  // 1
+    build_crush();
+    osdmap.set_max_osd(g_conf.num_osd);
+    for (int i=0; i<g_conf.num_osd; i++) {
+      osdmap.set_state(i, CEPH_OSD_EXISTS|CEPH_OSD_CLEAN);
+      osdmap.set_offload(i, CEPH_OSD_IN);
+    }
+    osdmap.encode(maps[1]);
+    messenger->set_dispatcher(this);
+  }
+
+  void build_crush() {
+    CrushWrapper& crush = osdmap.crush;
+    crush.create();
+    int items[g_conf.num_osd];
+    for (int i=0; i<g_conf.num_osd; i++)
+      items[i] = i;
+    crush_bucket_uniform *b = crush_make_uniform_bucket(1, g_conf.num_osd, items, 0x10000);
+    int root = crush_add_bucket(crush.map, (crush_bucket*)b);
+    for (int i=1; i<=g_conf.osd_max_rep; i++) {
+      crush_rule *rule = crush_make_rule(3);
+      crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, root, 0);
+      crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_FIRSTN, i, 0);
+      crush_rule_set_step(rule, 2, CRUSH_RULE_EMIT, 0, 0);
+      crush_add_rule(crush.map, CRUSH_REP_RULE(i), rule);
+    }
+    if (pg_type == pg_t::TYPE_RAID4) {
+      crush_rule *rule = crush_make_rule(3);
+      crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, root, 0);
+      crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_INDEP, pg_size, 0);
+      crush_rule_set_step(rule, 2, CRUSH_RULE_EMIT, 0, 0);
+      crush_add_rule(crush.map, CRUSH_RAID_RULE(pg_size), rule);
+    }
+    crush.finalize();
+  }
+
+  void send_maps(entity_inst_t to, epoch_t from) {
+    MOSDMap *m = new MOSDMap;
+    for (map<epoch_t,bufferlist>::iterator p = maps.lower_bound(from ? from:1);
+	 p != maps.end();
+	 p++)
+      m->maps[p->first] = p->second;
+    messenger->send_message(m, to);
+  }
+
+  // called with lock held
+  void publish(OSDMap::Incremental& inc) {
+    inc.fsid = osdmap.get_fsid();
+    inc.epoch = osdmap.get_epoch() + 1;
+
+    // forget the state of any pg whose osds change
+    map<pg_t, vector<int> > mapped;
+    for (map<pg_t,pg_stat_t>::iterator p = pg_stat.begin(); p != pg_stat.end(); p++) {
+      vector<int> a;
+      osdmap.pg_to_acting_osds(p->first, a);
+      mapped[p->first] = a;
+    }
+    osdmap.apply_incremental(inc);
+    for (map<pg_t, vector<int> >::iterator p = mapped.begin(); p != mapped.end(); p++) {
+      vector<int> a;
+      osdmap.pg_to_acting_osds(p->first, a);
+      if (a != p->second)
+	pg_stat.erase(p->first);
+    }
+
+    osdmap.encode(maps[osdmap.get_epoch()]);
+    cout << "mon: epoch " << osdmap.get_epoch() << std::endl;
+    for (list<entity_inst_t>::iterator p = subscribers.begin(); p != subscribers.end(); p++)
+      send_maps(*p, 1);
+    cond.Signal();
+  }
+
+  void dispatch(Message *m) {
+    lock.Lock();
+    switch (m->get_type()) {
+    case MSG_OSD_BOOT:
+      {
+	MOSDBoot *b = (MOSDBoot*)m;
+	booted[b->inst.name.num()] = b->inst.addr;
+	subscribers.push_back(b->inst);
+	if ((int)booted.size() == g_conf.num_osd) {
+	  OSDMap::Incremental inc;
+	  for (map<int,entity_addr_t>::iterator p = booted.begin(); p != booted.end(); p++)
+	    inc.new_up[p->first] = p->second;
+	  publish(inc);
+	}
+      }
+      break;
+
+    case CEPH_MSG_OSD_GETMAP:
+      if (osdmap.get_epoch() > 1)
+	send_maps(m->get_source_inst(), ((MOSDGetMap*)m)->get_start_epoch());
+      break;
+
+    case MSG_PGSTATS:
+      {
+	MPGStats *s = (MPGStats*)m;
+	for (map<pg_t,pg_stat_t>::iterator p = s->pg_stat.begin(); p != s->pg_stat.end(); p++)
+	  if (p->first.type() == pg_type && p->first.size() == pg_size)
+	    pg_stat[p->first] = p->second;
+	cond.Signal();
+      }
+      break;
+    }
+    lock.Unlock();
+    delete m;
+  }
+
+  // with lock held.  is the pg active+clean, by its current primary?
+  bool is_clean(pg_t pgid) {
+    vector<int> a;
+    osdmap.pg_to_acting_osds(pgid, a);
+    if (a.empty())
+      return true;
+    return pg_stat.count(pgid) &&
+      pg_stat[pgid].primary == a[0] &&
+      (pg_stat[pgid].state & (PG::STATE_ACTIVE|PG::STATE_CLEAN)) == (PG::STATE_ACTIVE|PG::STATE_CLEAN);
+  }
+  bool all_clean() {
+    for (int ps=0; ps<osdmap.get_pg_num(); ps++)
+      if (!is_clean(pg_t(pg_type, pg_size, ps, -1)))
+	return false;
+    return true;
+  }
+  void print_unclean(ostream& out) {
+    for (int ps=0; ps<osdmap.get_pg_num(); ps++) {
+      pg_t pgid(pg_type, pg_size, ps, -1);
+      if (is_clean(pgid))
+	continue;
+      if (pg_stat.count(pgid) == 0)
+	out << " " << pgid << "(unreported)";
+      else
+	out << " " << pgid << "(osd" << pg_stat[pgid].primary
+	    << " " << PG::get_state_string(pg_stat[pgid].state) << ")";
+    }
+  }
+};
+
+
+class TestClient : public Dispatcher {
+public:
+  Messenger *messenger;
+  Mutex lock;
+  Cond cond;
+  OSDMap osdmap;
+  Objecter *objecter;
+  int pg_type, pg_size;
+
+  TestClient(Messenger *m, MonMap *monmap, int type, int size) :
+    messenger(m), pg_type(type), pg_size(size) {
+    objecter = new Objecter(messenger, monmap, &osdmap, lock);
+    objecter->set_client_incarnation(0);
+    messenger->set_dispatcher(this);
+  }
+
+  void dispatch(Message *m) {
+    lock.Lock();
+    objecter->dispatch(m);
+    lock.Unlock();
+  }
+  void ms_handle_failure(Message *m, const entity_inst_t& inst) {
+    lock.Lock();
+    objecter->ms_handle_failure(m, inst.name, inst);
+    lock.Unlock();
+  }
+
+  ceph_object_layout layout(object_t oid) {
+    return osdmap.make_object_layout(oid, pg_type, pg_size);
+  }
+
+  // synchronous ops, until the commit (or the read reply)
+  void write(object_t oid, off_t off, bufferlist& bl) {
+    Cond c;
+    bool done;
+    lock.Lock();
+    objecter->write(oid, off, bl.length(), layout(oid), bl, 0,
+		    new C_SafeCond(&lock, &c, &done));
+    while (!done) c.Wait(lock);
+    lock.Unlock();
+  }
+  void zero(object_t oid, off_t off, size_t len) {
+    Cond c;
+    bool done;
+    lock.Lock();
+    objecter->zero(oid, off, len, layout(oid), 0,
+		   new C_SafeCond(&lock, &c, &done));
+    while (!done) c.Wait(lock);
+    lock.Unlock();
+  }
+  int read(object_t oid, off_t off, size_t len, bufferlist& bl) {
+    Cond c;
+    bool done;
+    int r;
+    lock.Lock();
+    objecter->read(oid, off, len, layout(oid), &bl,
+		   new C_SafeCond(&lock, &c, &done, &r));
+    while (!done) c.Wait(lock);
+    lock.Unlock();
+    return r;
+  }
+  int stat(object_t oid, off_t *size) {
+    Cond c;
+    bool done;
+    int r;
+    lock.Lock();
+    objecter->stat(oid, size, layout(oid),
+		   new C_SafeCond(&lock, &c, &done, &r));
+    while (!done) c.Wait(lock);
+    lock.Unlock();
+    return r;
+  }
+};
+
+
+// the counters are the osd's own business; the test peeks.
+class TestOSD : public OSD {
+public:
+  TestOSD(int id, Messenger *m, MonMap *mm) : OSD(id, m, mm) {}
+  uint64_t counter(int idx) { return perf->get(idx); }
+};
+
+
+class OSDCluster {
+public:
+  int pg_type, pg_size;
+  MonMap *monmap;
+  StubMon *mon;
+  vector<TestOSD*> osd;
+  vector<Messenger*> osdm;
+  TestClient *client;
+
+  OSDCluster(int type, int size) :
+    pg_type(type), pg_size(size), monmap(0), mon(0), client(0) {}
+
+  /*
+   * g_conf.num_osd osds and a client, in a temp dir named for the
+   * test.  returns once the osds and client have the first map with
+   * every osd up.
+   */
+  int start(const char *name) {
+    char dir[200];
+    sprintf(dir, "/tmp/%s.XXXXXX", name);
+    if (!mkdtemp(dir) || chdir(dir) < 0 || mkdir("osddata", 0755) < 0) {
+      cerr << "can't make temp dir" << std::endl;
+      return -1;
+    }
+
+    monmap = new MonMap(1);
+    entity_addr_t a;
+    a.v.nonce = getpid();
+    a.v.erank = 0;
+    monmap->mon_inst[0] = entity_inst_t(entity_name_t::MON(0), a);
+
+    mon = new StubMon(new FakeMessenger(entity_name_t::MON(0)), pg_type, pg_size);
+    for (int i=0; i<g_conf.num_osd; i++) {
+      osdm.push_back(new FakeMessenger(entity_name_t::OSD(i)));
+      osd.push_back(new TestOSD(i, osdm[i], monmap));
+    }
+    client = new TestClient(new FakeMessenger(entity_name_t::CLIENT(0)), monmap,
+			    pg_type, pg_size);
+
+    fakemessenger_startthread();
+    for (int i=0; i<g_conf.num_osd; i++)
+      osd[i]->init();
+
+    mon->lock.Lock();
+    while (mon->osdmap.get_epoch() < 2)
+      mon->cond.Wait(mon->lock);
+    mon->subscribers.push_back(client->messenger->get_myinst());
+    mon->send_maps(client->messenger->get_myinst(), 1);
+    mon->lock.Unlock();
+    client->lock.Lock();
+    client->objecter->init();
+    client->lock.Unlock();
+    return 0;
+  }
+
+  // wait up to a minute for every pg to go active+clean
+  bool wait_clean() {
+    utime_t until = g_clock.now();
+    until += 60;
+    mon->lock.Lock();
+    while (!mon->all_clean() && g_clock.now() < until)
+      mon->cond.WaitInterval(mon->lock, utime_t(1, 0));
+    bool clean = mon->all_clean();
+    if (!clean) {
+      cout << "  pgs never went clean:";
+      mon->print_unclean(cout);
+      cout << std::endl;
+    }
+    mon->lock.Unlock();
+    return clean;
+  }
+
+  // sum of an osd perf counter over every osd
+  uint64_t total(int idx) {
+    uint64_t t = 0;
+    for (unsigned i=0; i<osd.size(); i++)
+      t += osd[i]->counter(idx);
+    return t;
+  }
+};
+
+#endif
@@ -0,0 +1,249 @@
+
+/*
+ * offline replay of mds heat traces through the old (instantaneous) and
+ * predictive balancer policies.
+ *
+ *  testbalancer [--mds n] [--interval k] [--alpha a] [--beta b]
+ *               [--horizon h] [--min_rebalance f] [trace ...]
+ *
+ * a trace is what an mds writes with --mds_bal_predict_trace 1: one line
+ * per dirfrag per sample,
+ *
+ *   sample  dirfrag  meta  rd  wr  cost
+ *
+ * (cost already in load units.)  traces from several mds can be given
+ * together.  with no trace, a synthetic bursty workload is generated.
+ *
+ * every dirfrag starts out on a node chosen round-robin, and the
+ * balancer runs every k samples (default 3: mds_bal_interval /
+ * mds_bal_sample_interval).  both policies see the same load; we report
+ * migrations, total migration cost, ping-pongs (a dirfrag moved back to
+ * a node it left within the last 3 beats), and max/avg load imbalance
+ * averaged over all samples.
+ */
+
+#include "common/LoadForecast.h"
+
+#include <map>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+using namespace std;
+
+#ifndef MIN
+# define MIN(a,b) ((a) < (b) ? (a):(b))
+#endif
+
+struct sample_t {
+  double load, cost;
+};
+
+// sample -> dirfrag -> load
+typedef map<int, map<string, sample_t> > trace_t;
+
+int nmds = 4;
+int interval = 3;
+double level_alpha = .3, trend_beta = .02;
+double horizon = 2;
+double min_rebalance = .1;
+
+void load_trace(const char *fn, trace_t& t)
+{
+  ifstream in(fn);
+  if (!in.is_open()) {
+    cerr << "can't open " << fn << endl;
+    exit(1);
+  }
+  int s;
+  string df;
+  double meta, rd, wr, cost;
+  while (in >> s >> df >> meta >> rd >> wr >> cost) {
+    t[s][df].load += meta;
+    t[s][df].cost = cost;
+  }
+}
+
+/*
+ * 200 dirfrags.  most carry a steady load; some ramp up or down, and any
+ * of them can burst to 10x for a single sample.
+ */
+void make_trace(trace_t& t, int nsamples)
+{
+  srand(0);
+  int n = 200;
+  vector<double> base(n), ramp(n), cost(n);
+  for (int i=0; i<n; i++) {
+    base[i] = exp((double)(rand() % 600) / 100.0);   // 1 .. 400
+    ramp[i] = (rand() % 10 == 0) ? base[i] * ((rand() % 200) - 100) / 2000.0 : 0;
+    cost[i] = (double)(100 + rand() % 10000) * .05;
+  }
+  for (int s=0; s<nsamples; s++)
+    for (int i=0; i<n; i++) {
+      char df[20];
+      sprintf(df, "%x", 0x10000 + i);
+      double l = base[i] + ramp[i] * s;
+      if (l < 0) l = 0;
+      if (rand() % 50 == 0) l *= 10;
+      t[s][df].load = l;
+      t[s][df].cost = cost[i];
+    }
+}
+
+
+struct policy_t {
+  bool predict;
+  map<string, int> owner;
+  map<string, LoadForecast> pop;
+  map<string, map<int, int> > left;   // dirfrag -> node -> beat we left it
+
+  int migrations, pingpongs;
+  double moved_cost;
+  double imbalance_sum;
+  int imbalance_n;
+
+  policy_t(bool p) : predict(p), migrations(0), pingpongs(0), moved_cost(0),
+		     imbalance_sum(0), imbalance_n(0) {}
+
+  void place(const map<string, sample_t>& s) {
+    for (map<string, sample_t>::const_iterator p = s.begin(); p != s.end(); ++p)
+      if (!owner.count(p->first)) {
+	int n = owner.size() % nmds;
+	owner[p->first] = n;
+      }
+  }
+
+  void measure(const map<string, sample_t>& s) {
+    vector<double> l(nmds);
+    double total = 0;
+    for (map<string, sample_t>::const_iterator p = s.begin(); p != s.end(); ++p) {
+      l[owner[p->first]] += p->second.load;
+      total += p->second.load;
+      if (predict) {
+	pop[p->first].set_params(level_alpha, trend_beta);
+	pop[p->first].sample(p->second.load);
+      }
+    }
+    if (total <= 0) return;
+    double max = 0;
+    for (int i=0; i<nmds; i++)
+      if (l[i] > max) max = l[i];
+    imbalance_sum += max / (total / nmds);
+    imbalance_n++;
+  }
+
+  double get_pop(const string& df, const sample_t& s) {
+    if (!predict) return s.load;
+    return pop[df].predict(horizon * interval);
+  }
+
+  void move(const string& df, int to, double cost, int beat) {
+    int from = owner[df];
+    map<int,int>& l = left[df];
+    if (l.count(to) && beat - l[to] <= 3)
+      pingpongs++;
+    l[from] = beat;
+    owner[df] = to;
+    migrations++;
+    moved_cost += cost;
+  }
+
+  // same shape as MDBalancer::do_rebalance: big exporters to small
+  // importers, taking the biggest dirfrags that fit what's needed.
+  void rebalance(const map<string, sample_t>& s, int beat) {
+    vector<double> l(nmds);
+    map<int, multimap<double, string> > mine;
+    for (map<string, sample_t>::const_iterator p = s.begin(); p != s.end(); ++p) {
+      double pp = get_pop(p->first, p->second);
+      l[owner[p->first]] += pp;
+      mine[owner[p->first]].insert(pair<double,string>(pp, p->first));
+    }
+    // a node's load is the sum of its dirfrags' forecasts, as in
+    // MDBalancer::get_forecast_load.
+    double total = 0;
+    for (int i=0; i<nmds; i++)
+      total += l[i];
+    double target = total / nmds;
+
+    multimap<double,int> byload;
+    for (int i=0; i<nmds; i++)
+      byload.insert(pair<double,int>(l[i], i));
+
+    for (multimap<double,int>::reverse_iterator ex = byload.rbegin(); ex != byload.rend(); ++ex) {
+      int e = ex->second;
+      if (l[e] < target * (1.0 + min_rebalance)) break;
+      for (multimap<double,int>::iterator im = byload.begin(); im != byload.end(); ++im) {
+	int i = im->second;
+	if (i == e) continue;
+	double amount = MIN(l[e] - target, target - l[i]);
+	if (amount <= 0) continue;
+	double have = 0;
+	multimap<double,string>& c = mine[e];
+	for (multimap<double,string>::reverse_iterator p = c.rbegin();
+	     p != c.rend() && have < amount * .8;
+	     ++p) {
+	  if (owner[p->second] != e) continue;   // already moved
+	  const sample_t& sm = s.find(p->second)->second;
+	  if (p->first > amount - have ||
+	      (predict && p->first * horizon <= sm.cost))
+	    continue;
+	  have += p->first;
+	  move(p->second, i, sm.cost, beat);
+	}
+	l[e] -= have;
+	l[i] += have;
+      }
+    }
+  }
+};
+
+int main(int argc, char **argv)
+{
+  trace_t t;
+  for (int i=1; i<argc; i++) {
+    if (strcmp(argv[i], "--mds") == 0)
+      nmds = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--interval") == 0)
+      interval = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--alpha") == 0)
+      level_alpha = atof(argv[++i]);
+    else if (strcmp(argv[i], "--beta") == 0)
+      trend_beta = atof(argv[++i]);
+    else if (strcmp(argv[i], "--horizon") == 0)
+      horizon = atof(argv[++i]);
+    else if (strcmp(argv[i], "--min_rebalance") == 0)
+      min_rebalance = atof(argv[++i]);
+    else
+      load_trace(argv[i], t);
+  }
+  if (t.empty()) {
+    cout << "no trace given; using synthetic workload" << endl;
+    make_trace(t, 600);
+  }
+
+  policy_t pol[2] = { policy_t(false), policy_t(true) };
+  const char *name[2] = { "instantaneous", "predictive" };
+
+  for (int k=0; k<2; k++) {
+    int beat = 0;
+    for (trace_t::iterator p = t.begin(); p != t.end(); ++p) {
+      pol[k].place(p->second);
+      pol[k].measure(p->second);
+      if (p->first % interval == interval-1)
+	pol[k].rebalance(p->second, beat++);
+    }
+  }
+
+  cout << t.size() << " samples, " << nmds << " mds" << endl;
+  for (int k=0; k<2; k++)
+    cout << name[k]
+	 << "\tmigrations " << pol[k].migrations
+	 << "\tcost " << pol[k].moved_cost
+	 << "\tpingpongs " << pol[k].pingpongs
+	 << "\timbalance " << (pol[k].imbalance_n ? pol[k].imbalance_sum / pol[k].imbalance_n : 0)
+	 << endl;
+  return 0;
+}
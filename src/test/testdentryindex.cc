@@ -0,0 +1,159 @@
+
+/*
+ * compare DentryIndex against the old map<string,CDentry*> CDir index.
+ *
+ *  testdentryindex [n ...]
+ *
+ * for each n (default 10k, 100k, 1M), time n creates, n lookups of
+ * present names, n lookups of missing names, and a full iteration.
+ * then check erasing while iterating, and that trimming the index way
+ * down gives back the space on the next insert.
+ */
+
+#include "mds/DentryIndex.h"
+#include "common/Clock.h"
+
+#include <map>
+#include <vector>
+#include <iostream>
+#include <stdio.h>
+using namespace std;
+
+static double since(utime_t start)
+{
+  utime_t now = g_clock.now();
+  now -= start;
+  return (double)now;
+}
+
+static void report(const char *what, unsigned n, double secs)
+{
+  cout << "  " << what << "\t" << secs << " s\t"
+       << (secs > 0 ? (double)n / secs : 0) << " ops/s" << endl;
+}
+
+static void run(unsigned n)
+{
+  vector<string> names(n), missing(n);
+  char s[40];
+  for (unsigned i=0; i<n; i++) {
+    snprintf(s, sizeof(s), "file.%08u", i);
+    names[i] = s;
+    snprintf(s, sizeof(s), "nope.%08u", i);
+    missing[i] = s;
+  }
+  CDentry *fake = (CDentry*)0x1;
+  unsigned found;
+  utime_t start;
+
+  cout << "n = " << n << endl;
+
+  // old
+  {
+    map<string, CDentry*> m;
+    cout << " map<string,CDentry*>" << endl;
+    start = g_clock.now();
+    for (unsigned i=0; i<n; i++)
+      m[names[i]] = fake;
+    report("create", n, since(start));
+
+    found = 0;
+    start = g_clock.now();
+    for (unsigned i=0; i<n; i++)
+      if (m.find(names[(i * 7919) % n]) != m.end()) found++;
+    report("lookup", n, since(start));
+    assert(found == n);
+
+    found = 0;
+    start = g_clock.now();
+    for (unsigned i=0; i<n; i++)
+      if (m.find(missing[i]) != m.end()) found++;
+    report("miss", n, since(start));
+    assert(found == 0);
+
+    found = 0;
+    start = g_clock.now();
+    for (map<string, CDentry*>::iterator p = m.begin(); p != m.end(); ++p)
+      found++;
+    report("iterate", n, since(start));
+    assert(found == n);
+  }
+
+  // new
+  {
+    DentryIndex m;
+    cout << " DentryIndex" << endl;
+    start = g_clock.now();
+    for (unsigned i=0; i<n; i++)
+      m.insert(names[i], fake);
+    report("create", n, since(start));
+
+    found = 0;
+    start = g_clock.now();
+    for (unsigned i=0; i<n; i++)
+      if (m.find(names[(i * 7919) % n]) != m.end()) found++;
+    report("lookup", n, since(start));
+    assert(found == n);
+
+    found = 0;
+    start = g_clock.now();
+    for (unsigned i=0; i<n; i++)
+      if (m.find(missing[i]) != m.end()) found++;
+    report("miss", n, since(start));
+    assert(found == 0);
+
+    // iteration is in key order
+    found = 0;
+    start = g_clock.now();
+    for (DentryIndex::iterator p = m.begin(); p != m.end(); ++p)
+      found++;
+    report("iterate", n, since(start));
+    assert(found == n);
+    __u64 last = 0;
+    for (DentryIndex::iterator p = m.begin(); p != m.end(); ++p) {
+      __u64 k = DentryIndex::name_key(p->first);
+      assert(k >= last);
+      last = k;
+    }
+
+    // erase half while iterating, then everything must still be findable
+    unsigned i = 0;
+    for (DentryIndex::iterator p = m.begin(); p != m.end(); ++p)
+      if (i++ & 1) m.erase(p);
+    assert(m.size() == n - n/2);
+    found = 0;
+    for (unsigned i=0; i<n; i++)
+      if (m.find(names[i]) != m.end()) found++;
+    assert(found == m.size());
+
+    // trim down to 1 in 100; the next insert sheds the tombstones
+    i = 0;
+    for (DentryIndex::iterator p = m.begin(); p != m.end(); ++p)
+      if (i++ % 50) m.erase(p);
+    unsigned cap = m.capacity();
+    m.insert("new", fake);
+    cout << "  trim to " << m.size() << ": capacity " << cap << " -> " << m.capacity() << endl;
+    assert(m.capacity() * 10 < cap);
+    found = 0;
+    for (DentryIndex::iterator p = m.begin(); p != m.end(); ++p)
+      found++;
+    assert(found == m.size());
+    found = 0;
+    for (unsigned i=0; i<n; i++)
+      if (m.find(names[i]) != m.end()) found++;
+    assert(found + 1 == m.size());
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc > 1) {
+    for (int i=1; i<argc; i++)
+      run(atoi(argv[i]));
+  } else {
+    run(10000);
+    run(100000);
+    run(1000000);
+  }
+  return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * dout throughput under contention.
+ *
+ *  testdout [--threads n] [--lines n] [--assert] [--assert_locked]
+ *           [ceph options]
+ *
+ * each of --threads threads writes --lines dout(10) lines formatted
+ * like an osd op line.  run with --debug 10 --doutdir dir, and with
+ * --dout_async 0 for the old locked backend.  with --assert, the main
+ * thread fails an assert afterwards, so the recent-events dump (see
+ * --debug_recent) can be checked.  --assert_locked does the same while
+ * another thread holds _dout_lock; the dump should be skipped (with a
+ * note) rather than hang.
+ */
+
+#include "config.h"
+#include "common/Thread.h"
+#include "common/Clock.h"
+#include "include/object.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+using namespace std;
+
+#define  dout(l)    dout_if(l, l<=g_conf.debug) << g_clock.now() << " testdout "
+
+static int lines = 100000;
+
+class Holder : public Thread {
+public:
+  void *entry() {
+    _dout_lock.Lock();
+    while (1)
+      sleep(1000);
+    return 0;
+  }
+};
+
+class Writer : public Thread {
+  int id;
+public:
+  Writer(int i) : id(i) {}
+  void *entry() {
+    for (int i=0; i<lines; i++) {
+      object_t oid(1000 + id, i);
+      dout(10) << "thread " << id << " op " << i << " write " << oid
+	       << " " << (i * 4096) << "~4096 v " << id << "'" << i << dendl;
+    }
+    return 0;
+  }
+};
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  parse_config_options(args);
+
+  int threads = 4;
+  bool do_assert = false;
+  bool assert_locked = false;
+  for (unsigned i=0; i<args.size(); i++) {
+    if (strcmp(args[i], "--threads") == 0)
+      threads = atoi(args[++i]);
+    else if (strcmp(args[i], "--lines") == 0)
+      lines = atoi(args[++i]);
+    else if (strcmp(args[i], "--assert") == 0)
+      do_assert = true;
+    else if (strcmp(args[i], "--assert_locked") == 0)
+      do_assert = assert_locked = true;
+    else {
+      cerr << "unknown arg " << args[i] << std::endl;
+      return 1;
+    }
+  }
+
+  vector<Writer*> ws;
+  utime_t start = g_clock.now();
+  for (int i=0; i<threads; i++) {
+    ws.push_back(new Writer(i));
+    ws[i]->create();
+  }
+  for (int i=0; i<threads; i++)
+    ws[i]->join();
+  if (g_conf.dout_async)
+    dout_flush();
+  double t = (double)(g_clock.now() - start);
+
+  int n = threads * lines;
+  cout << threads << " threads, " << n << " lines in " << t << " s, "
+       << (int)((double)n / t) << " lines/sec ("
+       << (g_conf.dout_async ? "async":"locked") << ")" << std::endl;
+
+  if (do_assert) {
+    dout(0) << "failing an assert" << dendl;
+    if (assert_locked) {
+      Holder *h = new Holder;
+      h->create();
+      while (!_dout_lock.is_locked())
+	usleep(1000);
+    }
+    assert(0 == "testdout --assert");
+  }
+  return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ * false positives and detection time for osd heartbeat failure
+ * detection, fixed grace vs phi accrual.
+ *
+ *  testheartbeat [--interval secs] [--beats n] [--trials n]
+ *
+ * a stub osd pings a watcher over FakeMessenger on the osd's schedule
+ * (every .5..1.4 intervals).  the watcher takes pings through
+ * ms_fast_dispatch, as OSD does, and feeds every detector.  per delay
+ * distribution, injected by the sender before each ping:
+ *
+ *  - steady: nothing extra
+ *  - normal: N(0, .2) intervals
+ *  - exp: exponential, mean .5 intervals
+ *  - pause: 2% of pings held up for 5 intervals (a stalled sender)
+ *
+ * each trial sends --beats pings, then the sender "crashes".  a false
+ * positive is a detector declaring the sender failed while it was
+ * still pinging; detection time is from the last ping to the detector
+ * firing.  both are reported in heartbeat intervals.
+ *
+ * defaults: 5ms interval, 200 beats, 5 trials.  the phi detectors use
+ * osd_heartbeat_phi_min_stddev scaled to the interval.
+ */
+
+#include "config.h"
+
+#include "messages/MOSDPing.h"
+#include "msg/FakeMessenger.h"
+#include "common/PhiAccrual.h"
+#include "common/Clock.h"
+#include "common/Thread.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+using namespace std;
+
+static double interval = .005;
+static int nbeats = 200;
+static int ntrials = 5;
+
+struct Detector {
+  const char *name;
+  double grace;   // in intervals; 0 for phi
+  double phi;
+  PhiAccrual d;
+  bool failed;
+  int false_positives;
+  double detect_sum;
+  int detect_n;
+
+  Detector(const char *n, double g, double p) :
+    name(n), grace(g), phi(p), failed(false),
+    false_positives(0), detect_sum(0), detect_n(0) {}
+
+  void reset() {
+    d = PhiAccrual(g_conf.osd_heartbeat_phi_window,
+		   g_conf.osd_heartbeat_phi_min_stddev * interval);
+    failed = false;
+  }
+  bool check(utime_t now) {
+    if (d.get_last().sec() == 0)
+      return false;
+    if (grace > 0)
+      return (double)(now - d.get_last()) > grace * interval;
+    return d.get_num_samples() >= 3 && d.phi(now) > phi;
+  }
+};
+
+static vector<Detector*> detectors;
+static Mutex lock;
+
+
+class Watcher : public Dispatcher {
+public:
+  Messenger *messenger;
+  int pings;
+  Watcher() : pings(0) {
+    messenger = new FakeMessenger(entity_name_t::OSD(1));
+    messenger->set_dispatcher(this);
+  }
+  bool ms_fast_dispatch(Message *m) {
+    if (m->get_type() != MSG_OSD_PING)
+      return false;
+    lock.Lock();
+    for (unsigned i=0; i<detectors.size(); i++)
+      detectors[i]->d.heartbeat(m->get_recv_stamp());
+    pings++;
+    lock.Unlock();
+    delete m;
+    return true;
+  }
+  void dispatch(Message *m) {
+    delete m;
+  }
+};
+
+class Pinger : public Dispatcher, public Thread {
+public:
+  Messenger *messenger;
+  entity_inst_t to;
+  const char *dist;
+  bool done;
+
+  Pinger() : dist("steady"), done(true) {
+    messenger = new FakeMessenger(entity_name_t::OSD(0));
+    messenger->set_dispatcher(this);
+  }
+  void dispatch(Message *m) {
+    delete m;
+  }
+
+  double delay() {
+    double u = (double)(rand() + 1) / ((double)RAND_MAX + 2);
+    if (strcmp(dist, "normal") == 0) {
+      double v = (double)(rand() + 1) / ((double)RAND_MAX + 2);
+      double n = sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+      return n > 0 ? .2 * n : 0;
+    }
+    if (strcmp(dist, "exp") == 0)
+      return -.5 * log(u);
+    if (strcmp(dist, "pause") == 0)
+      return rand() % 50 == 0 ? 5 : 0;
+    return 0;
+  }
+
+  void *entry() {
+    osd_peer_stat_t stat;
+    memset(&stat, 0, sizeof(stat));
+    for (int i=0; i<nbeats; i++) {
+      double wait = .5 + ((float)(rand() % 10)/10.0) + delay();
+      usleep((useconds_t)(wait * interval * 1000000.0));
+      messenger->send_message(new MOSDPing(1, stat), to);
+    }
+    lock.Lock();
+    done = true;
+    lock.Unlock();
+    return 0;
+  }
+};
+
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  parse_config_options(args);
+  for (unsigned i=0; i<args.size(); i++) {
+    if (strcmp(args[i], "--interval") == 0)
+      interval = atof(args[++i]);
+    else if (strcmp(args[i], "--beats") == 0)
+      nbeats = atoi(args[++i]);
+    else if (strcmp(args[i], "--trials") == 0)
+      ntrials = atoi(args[++i]);
+    else {
+      cerr << "unknown arg " << args[i] << std::endl;
+      return 1;
+    }
+  }
+
+  Watcher watcher;
+  const char *dists[] = { "steady", "normal", "exp", "pause", 0 };
+
+  fakemessenger_startthread();
+
+  cout << "interval " << interval << "s, " << nbeats << " beats x " << ntrials << " trials"
+       << "; false positives per 1000 beats / mean detection, in intervals" << std::endl;
+  for (int di=0; dists[di]; di++) {
+    detectors.clear();
+    detectors.push_back(new Detector("grace 2", 2, 0));
+    detectors.push_back(new Detector("grace 5", 5, 0));
+    detectors.push_back(new Detector("grace 30", 30, 0));
+    detectors.push_back(new Detector("phi 4", 0, 4));
+    detectors.push_back(new Detector("phi 8", 0, 8));
+    detectors.push_back(new Detector("phi 12", 0, 12));
+
+    for (int t=0; t<ntrials; t++) {
+      lock.Lock();
+      for (unsigned i=0; i<detectors.size(); i++)
+	detectors[i]->reset();
+      lock.Unlock();
+
+      Pinger pinger;
+      pinger.to = watcher.messenger->get_myinst();
+      pinger.dist = dists[di];
+      pinger.done = false;
+      pinger.create();
+
+      // watch: while pinging, count false positives; then time detection
+      unsigned ndetected = 0;
+      while (1) {
+	usleep(200);
+	utime_t now = g_clock.now();
+	Mutex::Locker l(lock);
+	for (unsigned i=0; i<detectors.size(); i++) {
+	  Detector *d = detectors[i];
+	  bool f = d->check(now);
+	  if (!pinger.done) {
+	    if (f && !d->failed)
+	      d->false_positives++;
+	    d->failed = f;
+	  } else if (f && d->detect_n <= t) {
+	    d->detect_sum += (double)(now - d->d.get_last()) / interval;
+	    d->detect_n++;
+	    ndetected++;
+	  }
+	}
+	if (ndetected == detectors.size())
+	  break;
+      }
+      pinger.join();
+      pinger.messenger->shutdown();
+    }
+
+    cout << "  " << dists[di] << std::endl;
+    for (unsigned i=0; i<detectors.size(); i++) {
+      Detector *d = detectors[i];
+      cout << "    " << d->name
+	   << "\t" << (1000.0 * d->false_positives / (nbeats * ntrials))
+	   << "\t" << (d->detect_n ? d->detect_sum / d->detect_n : 0) << std::endl;
+      delete d;
+    }
+  }
+
+  watcher.messenger->shutdown();
+  fakemessenger_stopthread();
+  return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * collection listing: everything at once vs a piece at a time.
+ *
+ *  testlistbench [fakestore|ebofs] [--objects n] [--max n] [--dir path]
+ *                [ceph options]
+ *
+ * creates --objects empty objects with a "version" attr in one
+ * collection, remounts, then walks the collection the way
+ * generate_backlog does (getattr "version" on each object), once with
+ * collection_list and once with collection_list_partial --max at a
+ * time.  both walks must see the same objects, the partial one in
+ * order.  reports time and the memory held by the listing itself.
+ */
+
+#include "osd/FakeStore.h"
+#include "ebofs/Ebofs.h"
+#include "osd/osd_types.h"
+#include "common/Clock.h"
+#include "config.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <malloc.h>
+using namespace std;
+
+static ObjectStore *open_store(const char *type, const char *dir)
+{
+  char fn[200];
+  if (strcmp(type, "fakestore") == 0) {
+    sprintf(fn, "%s/fakestore", dir);
+    return new FakeStore(fn);
+  }
+  if (strcmp(type, "ebofs") == 0) {
+    sprintf(fn, "%s/ebofs", dir);
+    int fd = ::open(fn, O_CREAT|O_RDWR|O_TRUNC, 0644);
+    if (fd < 0 || ::ftruncate(fd, 40LL << 30) < 0) {
+      cerr << "can't create " << fn << ": " << strerror(errno) << std::endl;
+      exit(1);
+    }
+    ::close(fd);
+    return new Ebofs(fn);
+  }
+  cerr << "unknown store " << type << std::endl;
+  exit(1);
+}
+
+static long heap()
+{
+  return (long)mallinfo2().uordblks;   // mallinfo() is an int; it wraps past 2 GB
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  parse_config_options(args);
+
+  const char *type = "ebofs";
+  const char *dir = "/tmp";
+  int objects = 100000;
+  int max = g_conf.osd_list_max;
+  for (unsigned i=0; i<args.size(); i++) {
+    if (strcmp(args[i], "--objects") == 0)
+      objects = atoi(args[++i]);
+    else if (strcmp(args[i], "--max") == 0)
+      max = atoi(args[++i]);
+    else if (strcmp(args[i], "--dir") == 0)
+      dir = args[++i];
+    else if (args[i][0] != '-')
+      type = args[i];
+    else {
+      cerr << "unknown arg " << args[i] << std::endl;
+      return 1;
+    }
+  }
+
+  char base[200];
+  sprintf(base, "%s/testlistbench.XXXXXX", dir);
+  if (!mkdtemp(base)) {
+    cerr << "can't make temp dir in " << dir << std::endl;
+    return 1;
+  }
+
+  ObjectStore *store = open_store(type, base);
+  if (store->mkfs() < 0 || store->mount() < 0) {
+    cerr << "can't mkfs/mount " << type << " in " << base << std::endl;
+    return 1;
+  }
+
+  coll_t cid = 1;
+  store->create_collection(cid);
+  utime_t start = g_clock.now();
+  for (int i=0; i<objects; i++) {
+    pobject_t oid(0, 0, object_t(1000 + (i * 7919) % objects, 0));
+    eversion_t v(1, i + 1);
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    t.write(oid, 0, 0, bl);
+    t.setattr(oid, "version", &v, sizeof(v));
+    t.collection_add(cid, oid);
+    store->apply_transaction(t);
+  }
+  store->umount();
+  store->mount();
+  cout << type << ": " << objects << " objects, created in "
+       << (double)(g_clock.now() - start) << " s" << std::endl;
+
+  // all at once
+  long before = heap();
+  start = g_clock.now();
+  list<pobject_t> all;
+  store->collection_list(cid, all);
+  long held = heap() - before;
+  int n = 0;
+  for (list<pobject_t>::iterator p = all.begin(); p != all.end(); p++) {
+    eversion_t v;
+    store->getattr(*p, "version", &v, sizeof(v));
+    n++;
+  }
+  cout << "  collection_list: " << n << " objects in "
+       << (double)(g_clock.now() - start) << " s, listing holds "
+       << (held >> 10) << " KB" << std::endl;
+  all.clear();
+  store->umount();
+  store->mount();
+
+  // a piece at a time
+  held = 0;
+  start = g_clock.now();
+  ObjectStore::ListCursor cursor;
+  vector<pobject_t> ls;
+  int m = 0, pieces = 0, bad = 0;
+  pobject_t last;
+  while (store->collection_list_partial(cid, cursor, max, ls) > 0) {
+    if ((long)(ls.capacity() * sizeof(pobject_t)) > held)
+      held = ls.capacity() * sizeof(pobject_t);
+    pieces++;
+    for (vector<pobject_t>::iterator p = ls.begin(); p != ls.end(); p++) {
+      if (m && !(last < *p))
+	bad++;
+      last = *p;
+      eversion_t v;
+      store->getattr(*p, "version", &v, sizeof(v));
+      m++;
+    }
+  }
+  cout << "  collection_list_partial: " << m << " objects in "
+       << (double)(g_clock.now() - start) << " s, " << pieces
+       << " pieces of " << max << ", listing holds "
+       << (held >> 10) << " KB" << std::endl;
+
+  store->umount();
+  char cmd[300];
+  sprintf(cmd, "rm -rf %s", base);
+  system(cmd);
+
+  if (n != objects || m != objects || bad) {
+    cout << "mismatch: " << n << " / " << m << " listed, " << bad
+	 << " out of order" << std::endl;
+    return 1;
+  }
+  return 0;
+}
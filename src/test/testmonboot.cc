@@ -0,0 +1,218 @@
+
+/*
+ * time for the monitors to absorb an osd boot storm.
+ *
+ *  testmonboot [--osds n] [--spread secs] [--paxos_pipeline_window n]
+ *              [--paxos_propose_interval secs] [--num_mon n] ...
+ *
+ * monitors run for real over FakeMessenger; the osds are stubs that only
+ * send MOSDBoot and swallow whatever comes back.  we watch the leader's
+ * osdmap and report how long it takes, and how many epochs, until it
+ * settles:
+ *
+ *  - boot: every osd boots (mkfs; the first map waits for all of them)
+ *  - fail: every osd is reported failed at once
+ *  - reboot: every osd boots again, spread over --spread seconds
+ *
+ * defaults: 1000 osds, 3 monitors, reboots spread over 2 seconds.
+ */
+
+#include "config.h"
+
+#include "mon/Monitor.h"
+#include "mon/OSDMonitor.h"
+
+#include "messages/MOSDBoot.h"
+#include "messages/MOSDFailure.h"
+
+#include "msg/FakeMessenger.h"
+#include "common/Clock.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+using namespace std;
+
+
+class FakeOSD : public Dispatcher {
+public:
+  int whoami;
+  Messenger *messenger;
+  MonMap *monmap;
+
+  FakeOSD(int w, MonMap *mm) : whoami(w), monmap(mm) {
+    messenger = new FakeMessenger(entity_name_t::OSD(w));
+    messenger->set_dispatcher(this);
+  }
+
+  void boot() {
+    OSDSuperblock sb(whoami);
+    sb.weight = 1.0;
+    messenger->send_message(new MOSDBoot(messenger->get_myinst(), sb),
+			    monmap->get_inst(monmap->pick_mon()));
+  }
+
+  void dispatch(Message *m) {
+    delete m;   // maps, mostly
+  }
+};
+
+class Reporter : public Dispatcher {
+public:
+  Messenger *messenger;
+  Reporter() {
+    messenger = new FakeMessenger(entity_name_t::CLIENT(0));
+    messenger->set_dispatcher(this);
+  }
+  void dispatch(Message *m) {
+    delete m;
+  }
+};
+
+
+int nmon;
+Monitor **mon;
+
+static Monitor *get_leader()
+{
+  for (int i=0; i<nmon; i++)
+    if (mon[i]->is_leader())
+      return mon[i];
+  return 0;
+}
+
+/*
+ * wait until the leader's osdmap has 'want' osds up; return its epoch.
+ */
+static epoch_t wait_for_up(int want)
+{
+  while (1) {
+    Monitor *l = get_leader();
+    if (l) {
+      l->lock.Lock();
+      epoch_t e = 0;
+      if (l->osdmon && l->osdmon->osdmap.get_epoch() > 1 &&
+	  l->osdmon->osdmap.get_num_up_osds() == want)
+	e = l->osdmon->osdmap.get_epoch();
+      l->lock.Unlock();
+      if (e) return e;
+    }
+    usleep(10000);
+  }
+}
+
+static epoch_t get_epoch()
+{
+  Monitor *l;
+  while (!(l = get_leader()))
+    usleep(10000);
+  l->lock.Lock();
+  epoch_t e = l->osdmon ? l->osdmon->osdmap.get_epoch() : 0;
+  l->lock.Unlock();
+  return e;
+}
+
+static double since(utime_t start)
+{
+  utime_t now = g_clock.now();
+  now -= start;
+  return (double)now;
+}
+
+static void report(const char *what, double secs, epoch_t epochs, int nosd)
+{
+  cout << "  " << what << "\t" << secs << " s\t"
+       << epochs << " epochs\t"
+       << (epochs ? (double)nosd / (double)epochs : 0) << " updates/epoch" << std::endl;
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+
+  g_conf.num_mon = 3;
+  g_conf.num_osd = 1000;
+  g_conf.mkfs = true;
+  parse_config_options(args);
+
+  double spread = 2.0;
+  for (unsigned i=0; i<args.size(); i++) {
+    if (strcmp(args[i], "--osds") == 0)
+      g_conf.num_osd = atoi(args[++i]);
+    else if (strcmp(args[i], "--spread") == 0)
+      spread = atof(args[++i]);
+    else {
+      cerr << "unknown arg " << args[i] << std::endl;
+      return 1;
+    }
+  }
+  int nosd = g_conf.num_osd;
+  nmon = g_conf.num_mon;
+
+  MonMap *monmap = new MonMap(nmon);
+  entity_addr_t a;
+  a.v.nonce = getpid();
+  for (int i=0; i<nmon; i++) {
+    a.v.erank = i;
+    monmap->mon_inst[i] = entity_inst_t(entity_name_t::MON(i), a);  // hack ; see FakeMessenger.cc
+  }
+
+  mon = new Monitor*[nmon];
+  for (int i=0; i<nmon; i++)
+    mon[i] = new Monitor(i, new FakeMessenger(entity_name_t::MON(i)), monmap);
+  FakeOSD **osd = new FakeOSD*[nosd];
+  for (int i=0; i<nosd; i++)
+    osd[i] = new FakeOSD(i, monmap);
+  Reporter reporter;
+
+  fakemessenger_startthread();
+  for (int i=0; i<nmon; i++)
+    mon[i]->init();
+
+  // wait for the initial (empty) map
+  while (get_epoch() < 1)
+    usleep(10000);
+
+  cout << nmon << " monitors, " << nosd << " osds, window " << g_conf.paxos_pipeline_window
+       << ", propose interval " << g_conf.paxos_propose_interval << std::endl;
+
+  // boot
+  epoch_t e0 = get_epoch();
+  utime_t start = g_clock.now();
+  for (int i=0; i<nosd; i++)
+    osd[i]->boot();
+  epoch_t e = wait_for_up(nosd);
+  report("boot", since(start), e - e0, nosd);
+
+  // fail everyone
+  e0 = e;
+  start = g_clock.now();
+  {
+    Monitor *l = get_leader();
+    l->lock.Lock();
+    OSDMap &m = l->osdmon->osdmap;
+    for (int i=0; i<nosd; i++)
+      reporter.messenger->send_message(new MOSDFailure(reporter.messenger->get_myinst(),
+						       m.get_inst(i), m.get_epoch()),
+				       monmap->get_inst(monmap->pick_mon()));
+    l->lock.Unlock();
+  }
+  e = wait_for_up(0);
+  report("fail", since(start), e - e0, nosd);
+
+  // reboot, spread out
+  e0 = e;
+  start = g_clock.now();
+  for (int i=0; i<nosd; i++) {
+    osd[i]->boot();
+    if (spread > 0)
+      usleep((useconds_t)(spread * 1000000.0 / nosd));
+  }
+  e = wait_for_up(nosd);
+  report("reboot", since(start), e - e0, nosd);
+
+  fakemessenger_stopthread();
+  return 0;
+}
@@ -0,0 +1,181 @@
+
+/*
+ * commits/sec for the monitor store implementations.
+ *
+ *  testmonstore [--dir d] [--commits n] [--size bytes]
+ *
+ * a "commit" is what the leader writes for one osdmap epoch: the paxos
+ * value and last_committed, then the full map and its last_epoch.  each
+ * store is timed doing that as four separate puts and as one
+ * transaction, so the store and the batching can be told apart (the
+ * file store still syncs a file per key inside a transaction).  all run
+ * against the same directory (default ./testmonstore.tmp), so the same
+ * disk.  the log store is then remounted
+ * and read back, run with a tiny compaction threshold, and remounted with
+ * a well-checksummed but malformed record at the tail.
+ */
+
+#include "config.h"
+#include "mon/FileMonitorStore.h"
+#include "mon/LogMonitorStore.h"
+#include "common/Clock.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+using namespace std;
+
+static int ncommits = 1000;
+static int vsize = 4096;
+
+static double since(utime_t start)
+{
+  utime_t now = g_clock.now();
+  now -= start;
+  return (double)now;
+}
+
+static void make_value(bufferlist& bl, version_t v, int len)
+{
+  bufferptr bp(len);
+  for (int i=0; i<len; i++)
+    bp.c_str()[i] = (char)(v + i);
+  bl.clear();
+  bl.push_back(bp);
+}
+
+static void check_value(MonitorStore *s, const char *a, version_t v, int len)
+{
+  bufferlist bl, want;
+  int r = s->get_bl_sn(bl, a, v);
+  assert(r == len);
+  make_value(want, v, len);
+  assert(bl.length() == want.length());
+  assert(memcmp(bl.c_str(), want.c_str(), len) == 0);
+}
+
+static double run(MonitorStore *s, bool batched)
+{
+  bufferlist inc, full;
+  utime_t start = g_clock.now();
+  for (version_t v=1; v<=(version_t)ncommits; v++) {
+    make_value(inc, v, vsize / 4);
+    make_value(full, v, vsize);
+    if (batched) {
+      MonitorStore::Transaction t;
+      t.put_bl_sn(inc, "osdmap", v);
+      t.put_int(v, "osdmap", "last_committed");
+      t.put_bl_sn(full, "osdmap_full", v);
+      t.put_int(v, "osdmap_full", "last_epoch");
+      s->apply_transaction(t);
+    } else {
+      s->put_bl_sn(inc, "osdmap", v);
+      s->put_int(v, "osdmap", "last_committed");
+      s->put_bl_sn(full, "osdmap_full", v);
+      s->put_int(v, "osdmap_full", "last_epoch");
+    }
+  }
+  return since(start);
+}
+
+static void verify(MonitorStore *s)
+{
+  assert(s->get_int("osdmap", "last_committed") == (version_t)ncommits);
+  assert(s->get_int("osdmap_full", "last_epoch") == (version_t)ncommits);
+  for (version_t v=1; v<=(version_t)ncommits; v++) {
+    check_value(s, "osdmap", v, vsize / 4);
+    check_value(s, "osdmap_full", v, vsize);
+  }
+  assert(!s->exists_bl_sn("osdmap", ncommits+1));
+}
+
+/*
+ * a record whose checksum is fine but whose one op claims a key longer
+ * than the record.  replay must drop it, not read past it.
+ */
+static void append_bad_record(const char *dir)
+{
+  uint32_t payload[3] = { 1, 0x10000000, 0 };  // nops, klen, ...
+  uint32_t h[3] = { 0x676f6c6dU, sizeof(payload), 2166136261U };
+  const unsigned char *p = (const unsigned char*)payload;
+  for (unsigned i=0; i<sizeof(payload); i++)
+    h[2] = (h[2] ^ p[i]) * 16777619U;
+  string fn = string(dir) + "/log";
+  int fd = ::open(fn.c_str(), O_WRONLY|O_APPEND);
+  assert(fd >= 0);
+  ::write(fd, h, sizeof(h));
+  ::write(fd, payload, sizeof(payload));
+  ::close(fd);
+}
+
+static void report(const char *what, double secs)
+{
+  cout << "  " << what << "\t" << secs << " s\t"
+       << (secs > 0 ? (double)ncommits / secs : 0) << " commits/s" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  const char *dir = "testmonstore.tmp";
+  for (int i=1; i<argc; i++) {
+    if (strcmp(argv[i], "--dir") == 0)
+      dir = argv[++i];
+    else if (strcmp(argv[i], "--commits") == 0)
+      ncommits = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--size") == 0)
+      vsize = atoi(argv[++i]);
+  }
+  cout << ncommits << " commits, " << vsize << " byte maps, in " << dir << std::endl;
+
+  for (int batched=0; batched<2; batched++) {
+    FileMonitorStore s(dir);
+    s.mkfs();
+    s.mount();
+    report(batched ? "file, 1 txn" : "file, 4 puts", run(&s, batched));
+    verify(&s);
+  }
+  for (int batched=0; batched<2; batched++) {
+    LogMonitorStore s(dir);
+    s.mkfs();
+    s.mount();
+    report(batched ? "log, 1 txn" : "log, 4 puts", run(&s, batched));
+    verify(&s);
+  }
+  {
+    // replay
+    LogMonitorStore s(dir);
+    utime_t start = g_clock.now();
+    s.mount();
+    cout << "  replay\t" << since(start) << " s\t" << s.get_log_size() << " bytes" << std::endl;
+    verify(&s);
+  }
+  {
+    // rewrite everything a few times, compacting along the way
+    g_conf.mon_store_log_compact_min = 1 << 20;
+    LogMonitorStore s(dir);
+    s.mount();
+    run(&s, true);
+    run(&s, true);
+    report("log+compact", run(&s, true));
+    verify(&s);
+    cout << "  log " << s.get_log_size() << " bytes, " << s.get_live_bytes() << " live" << std::endl;
+  }
+  {
+    // malformed tail
+    off_t good;
+    {
+      LogMonitorStore s(dir);
+      s.mount();
+      good = s.get_log_size();
+    }
+    append_bad_record(dir);
+    LogMonitorStore s(dir);
+    s.mount();
+    assert(s.get_log_size() == good);
+    verify(&s);
+    cout << "  malformed tail record dropped" << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * object contexts: metadata for hot objects from the pg's cache
+ * instead of the store.
+ *
+ *  testobjctx [--objects n] [--ops n] [config options]
+ *
+ * an OSDCluster (see osdcluster.h) of 3 osds, with osd_balance_reads on.
+ * reads a small hot set of objects round robin, first with no object
+ * contexts kept (osd_object_context_max 0), then with them, and
+ * reports read latency and how often the osds went to the store for
+ * an object's metadata (a stat and a getattrs each time).  then
+ * checks that the contexts follow writes, truncating zeros, and
+ * recreation, through stat and read.
+ *
+ * run it from anywhere; it works in a temp dir.
+ */
+
+#include <iostream>
+#include <string>
+using namespace std;
+
+#include "osdcluster.h"
+
+static int nrep = 2;
+static int nobjects = 64;
+static int nops = 5000;
+static int object_size = 4096;
+
+
+static OSDCluster cluster(pg_t::TYPE_REP, nrep);
+static map<object_t, string> contents;
+static int errors = 0;
+
+static object_t oid_of(int i) { return object_t(0x9abc, i); }
+
+static void do_write(TestClient *client, int i, off_t off, size_t len)
+{
+  string& s = contents[oid_of(i)];
+  if (s.length() < off + len)
+    s.resize(off + len, 0);
+  bufferptr bp(len);
+  for (size_t j=0; j<len; j++)
+    bp[j] = s[off+j] = rand();
+  bufferlist bl;
+  bl.push_back(bp);
+  client->write(oid_of(i), off, bl);
+}
+
+static void check(TestClient *client, int i, const char *what)
+{
+  string& s = contents[oid_of(i)];
+  off_t size = -1;
+  int r = client->stat(oid_of(i), &size);
+  bufferlist bl;
+  client->read(oid_of(i), 0, s.length() + 100, bl);
+  bool ok = s.length() ? (r >= 0 && size == (off_t)s.length()) : (r < 0);
+  if (!ok || bl.length() != s.length() ||
+      (s.length() && memcmp(bl.c_str(), s.data(), s.length()) != 0)) {
+    cout << "  BAD " << what << " " << oid_of(i) << ": stat " << r << " size " << size
+	 << ", read " << bl.length() << " bytes, want " << s.length() << std::endl;
+    errors++;
+  }
+}
+
+static void hot_reads(TestClient *client, const char *what)
+{
+  uint64_t hit = cluster.total(l_osd_ctx_hit), miss = cluster.total(l_osd_ctx_miss);
+  utime_t start = g_clock.now();
+  for (int n=0; n<nops; n++) {
+    bufferlist bl;
+    client->read(oid_of(n % nobjects), 0, object_size, bl);
+    if (bl.length() != (unsigned)object_size)
+      errors++;
+  }
+  double t = (double)(g_clock.now() - start);
+  hit = cluster.total(l_osd_ctx_hit) - hit;
+  miss = cluster.total(l_osd_ctx_miss) - miss;
+  cout << what << ": " << (t * 1000000.0 / (double)nops) << " us/read, "
+       << ((double)(hit + miss) / (double)nops) << " lookups/read, "
+       << (2.0 * (double)miss / (double)nops) << " store metadata calls/read" << std::endl;
+}
+
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  for (unsigned i=0; i<args.size(); i++) {
+    if (strcmp(args[i], "--objects") == 0) nobjects = atoi(args[i+1]);
+    else if (strcmp(args[i], "--ops") == 0) nops = atoi(args[i+1]);
+    else continue;
+    args.erase(args.begin() + i, args.begin() + i + 2);
+    i--;
+  }
+  g_conf.num_mon = 1;
+  g_conf.num_osd = 3;
+  g_conf.osd_max_rep = nrep;
+  g_conf.osd_mkfs = true;
+  g_conf.ebofs = 0;
+  g_conf.fakestore_fake_sync = .05;
+  g_conf.fakestore_fake_attrs = true;
+  g_conf.fakestore_fake_collections = true;
+  g_conf.osd_pg_stats_interval = 1;
+  g_conf.osd_scrub_interval = 0;
+  g_conf.osd_balance_reads = true;
+  parse_config_options(args);
+  int max = g_conf.osd_object_context_max;
+  srand(getpid());
+  alarm(300);
+
+  cout << "testobjctx: " << nobjects << " hot objects, " << nops << " reads" << std::endl;
+
+  if (cluster.start("testobjctx") < 0)
+    return 1;
+  TestClient *client = cluster.client;
+  if (!cluster.wait_clean())
+    errors++;
+
+  g_conf.osd_object_context_max = 0;
+  for (int i=0; i<nobjects; i++)
+    do_write(client, i, 0, object_size);
+  hot_reads(client, "no contexts");
+  g_conf.osd_object_context_max = max;
+  hot_reads(client, "contexts");
+
+  // the contexts follow what we do
+  for (int i=0; i<nobjects; i++) {
+    do_write(client, i, object_size + rand() % 1000, 1 + rand() % 1000);
+    check(client, i, "extended");
+  }
+  for (int i=0; i<nobjects; i += 2) {
+    client->zero(oid_of(i), 0, contents[oid_of(i)].length());
+    contents[oid_of(i)].clear();
+    check(client, i, "zeroed");
+  }
+  for (int i=0; i<nobjects; i += 4) {
+    do_write(client, i, 100, 100);
+    check(client, i, "recreated");
+  }
+  for (int i=0; i<nobjects; i++)
+    check(client, i, "final");
+
+  cout << (errors ? "FAILED" : "ok") << std::endl;
+  _exit(errors ? 1 : 0);
+}
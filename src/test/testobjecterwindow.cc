@@ -0,0 +1,256 @@
+/*
+ * a big read stream and small random reads through one Objecter, with
+ * and without the per-osd window and extent splitting.
+ *
+ *  testobjecterwindow [--osds n] [--seconds n] [--bw MB/s] [--net ms]
+ *                     [--stream bytes] [--streams n] [--small bytes]
+ *                     [--small_interval ms]
+ *                     [--objecter_osd_window n] [--objecter_osd_window_bytes n]
+ *                     [--objecter_max_op_bytes n]
+ *
+ * the osds are simulated, in virtual time: each serves ops in arrival
+ * order at --bw MB/s plus .1ms per op, and the network adds --net ms
+ * each way.  the client keeps --streams file reads of --stream bytes
+ * (default 16MB, striped over 4MB objects) in flight, and issues a
+ * 4KB read of a random object every --small_interval ms.
+ *
+ *  - old: no window, no splitting (everything goes out at once)
+ *  - window: objecter_osd_window/_bytes and objecter_max_op_bytes
+ *    as configured
+ *
+ * reports stream throughput and small read latency.
+ */
+
+#include "config.h"
+#include "osdc/Objecter.h"
+#include "osdc/Filer.h"
+#include "msg/Messenger.h"
+#include "messages/MOSDOp.h"
+#include "messages/MOSDOpReply.h"
+
+#include <iostream>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+using namespace std;
+
+static int nosd = 8;
+static double seconds = 20;
+static double bw = 100;         // MB/s per osd
+static double net = .1;         // ms one way
+static int streamop = 16 << 20;
+static int nstream = 1;
+static int smallop = 4096;
+static double small_interval = 5;  // ms
+
+static double now = 0;          // virtual time, seconds
+static multimap<double, Message*> events;
+static vector<double> osd_busy;
+static bufferlist *zeros;
+
+class SimMessenger : public Messenger {
+public:
+  SimMessenger() : Messenger(entity_name_t::CLIENT(0)) {}
+  void reset_myname(entity_name_t m) {}
+  int shutdown() { return 0; }
+  void suicide() {}
+  int send_message(Message *m, entity_inst_t dest) {
+    MOSDOp *op = (MOSDOp*)m;
+    assert(m->get_type() == CEPH_MSG_OSD_OP);
+    int osd = dest.name.num();
+    double arrive = now + net / 1000.0;
+    double start = max(arrive, osd_busy[osd]);
+    double done = start + .0001 + (double)op->get_length() / (bw * 1024.0 * 1024.0);
+    osd_busy[osd] = done;
+
+    MOSDOpReply *reply = new MOSDOpReply(op, 0, 1, true);
+    reply->set_source(dest.name);
+    if (op->get_op() == CEPH_OSD_OP_READ) {
+      bufferlist bl;
+      bl.substr_of(*zeros, 0, op->get_length());
+      reply->set_data(bl);
+    }
+    events.insert(pair<double,Message*>(done + net / 1000.0, reply));
+    delete m;
+    return 0;
+  }
+};
+
+static void build_crush(CrushWrapper& crush, int nosd)
+{
+  crush.create();
+  int items[nosd];
+  for (int i=0; i<nosd; i++)
+    items[i] = i;
+  crush_bucket_uniform *b = crush_make_uniform_bucket(1, nosd, items, 0x10000);
+  int rootid = crush_add_bucket(crush.map, (crush_bucket*)b);
+  crush_rule *rule = crush_make_rule(3);
+  crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, rootid, 0);
+  crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_FIRSTN, 2, 0);
+  crush_rule_set_step(rule, 2, CRUSH_RULE_EMIT, 0, 0);
+  crush_add_rule(crush.map, CRUSH_REP_RULE(2), rule);
+  crush.finalize();
+  for (int i=0; i<nosd; i++)
+    crush.set_offload(i, CEPH_OSD_IN);
+}
+
+struct Stats {
+  uint64_t streamed;
+  vector<double> lat;
+};
+
+class C_Stream : public Context {
+public:
+  Filer *filer;
+  inode_t *inode;
+  off_t pos;
+  bufferlist bl;
+  Stats *stats;
+  C_Stream(Filer *f, inode_t *i, off_t p, Stats *s) : filer(f), inode(i), pos(p), stats(s) {}
+  void start() {
+    filer->read(*inode, pos, streamop, &bl, this);
+  }
+  void finish(int r) {
+    assert(bl.length() == (unsigned)streamop);
+    stats->streamed += bl.length();
+    C_Stream *c = new C_Stream(filer, inode, (pos + streamop * nstream) % (1024LL << 20), stats);
+    c->start();
+  }
+};
+
+class C_Small : public Context {
+public:
+  double start;
+  bufferlist bl;
+  Stats *stats;
+  C_Small(Stats *s) : start(now), stats(s) {}
+  void finish(int r) {
+    assert(bl.length() == (unsigned)smallop);
+    stats->lat.push_back(now - start);
+  }
+};
+
+static void run(const char *what, OSDMap& osdmap)
+{
+  now = 0;
+  events.clear();
+  osd_busy.clear();
+  osd_busy.resize(nosd);
+  srand(0);
+
+  Mutex lock;
+  SimMessenger messenger;
+  Objecter objecter(&messenger, 0, &osdmap, lock);
+  objecter.set_client_incarnation(0);
+  Filer filer(&objecter);
+  Stats stats;
+  stats.streamed = 0;
+
+  inode_t inode;
+  inode.ino = 0x2000;
+  inode.layout = g_OSD_FileLayout;
+
+  lock.Lock();
+  for (int i=0; i<nstream; i++) {
+    C_Stream *c = new C_Stream(&filer, &inode, (off_t)streamop * i, &stats);
+    c->start();
+  }
+
+  double next_small = 0;
+  while (now < seconds) {
+    if (events.empty() || next_small < events.begin()->first) {
+      now = next_small;
+      object_t oid(0x1000, rand() % 10000);
+      ceph_object_layout layout = osdmap.make_object_layout(oid, pg_t::TYPE_REP, 2);
+      C_Small *c = new C_Small(&stats);
+      objecter.read(oid, 0, smallop, layout, &c->bl, c);
+      next_small += small_interval / 1000.0;
+    } else {
+      now = events.begin()->first;
+      Message *m = events.begin()->second;
+      events.erase(events.begin());
+      objecter.dispatch(m);
+    }
+  }
+  lock.Unlock();
+
+  sort(stats.lat.begin(), stats.lat.end());
+  double sum = 0;
+  for (unsigned i=0; i<stats.lat.size(); i++)
+    sum += stats.lat[i];
+  unsigned n = stats.lat.size();
+  cout << "  " << what
+       << "\t" << ((double)stats.streamed / seconds / (1024.0*1024.0)) << " MB/s"
+       << "\tsmall lat ms avg " << (n ? 1000.0 * sum / n : 0)
+       << " p50 " << (n ? 1000.0 * stats.lat[n/2] : 0)
+       << " p99 " << (n ? 1000.0 * stats.lat[n*99/100] : 0)
+       << " (" << n << " reads)" << std::endl;
+
+  // drop whatever is still in flight
+  for (multimap<double,Message*>::iterator p = events.begin(); p != events.end(); p++)
+    delete p->second;
+  events.clear();
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  parse_config_options(args);
+  for (unsigned i=0; i<args.size(); i++) {
+    if (strcmp(args[i], "--osds") == 0)
+      nosd = atoi(args[++i]);
+    else if (strcmp(args[i], "--seconds") == 0)
+      seconds = atof(args[++i]);
+    else if (strcmp(args[i], "--bw") == 0)
+      bw = atof(args[++i]);
+    else if (strcmp(args[i], "--net") == 0)
+      net = atof(args[++i]);
+    else if (strcmp(args[i], "--stream") == 0)
+      streamop = atoi(args[++i]);
+    else if (strcmp(args[i], "--streams") == 0)
+      nstream = atoi(args[++i]);
+    else if (strcmp(args[i], "--small") == 0)
+      smallop = atoi(args[++i]);
+    else if (strcmp(args[i], "--small_interval") == 0)
+      small_interval = atof(args[++i]);
+    else {
+      cerr << "unknown arg " << args[i] << std::endl;
+      return 1;
+    }
+  }
+  g_conf.osd_pg_layout = CEPH_PG_LAYOUT_CRUSH;
+
+  bufferlist z;
+  bufferptr bp(max(streamop, smallop));
+  bp.zero();
+  z.push_back(bp);
+  zeros = &z;
+
+  OSDMap osdmap;
+  osdmap.set_max_osd(nosd);
+  for (int i=0; i<nosd; i++)
+    osdmap.set_state(i, CEPH_OSD_EXISTS|CEPH_OSD_UP);
+  build_crush(osdmap.crush, nosd);
+  osdmap.set_pg_num(1024);
+  osdmap.inc_epoch();
+
+  cout << nosd << " osds at " << bw << " MB/s, " << net << " ms net; "
+       << nstream << " x " << streamop << " byte stream reads, "
+       << smallop << " byte read every " << small_interval << " ms" << std::endl;
+
+  int window = g_conf.objecter_osd_window;
+  int window_bytes = g_conf.objecter_osd_window_bytes;
+  int max_op = g_conf.objecter_max_op_bytes;
+
+  g_conf.objecter_osd_window = 0;
+  g_conf.objecter_osd_window_bytes = 0;
+  g_conf.objecter_max_op_bytes = 0;
+  run("old", osdmap);
+
+  g_conf.objecter_osd_window = window;
+  g_conf.objecter_osd_window_bytes = window_bytes;
+  g_conf.objecter_max_op_bytes = max_op;
+  run("window", osdmap);
+  return 0;
+}
@@ -0,0 +1,216 @@
+
+/*
+ * time osdmap change processing with and without the pg mapping tables.
+ *
+ *  testosdmapmapping [--osds n] [--pgs n] [--size n] [--threads n]
+ *
+ * defaults: 1000 osds, 64k pgs, 3x replication.  the crush map is the
+ * one OSDMonitor builds for that many osds.  for each case we time a
+ * "scan": pg_to_acting_osds on every pg, which is what the osd and
+ * Objecter do after each new map.
+ *
+ *  - uncached: every lookup runs crush
+ *  - cold: first scan, which builds the table (serially / threaded)
+ *  - warm: second scan of the same epoch
+ *  - osd down: incremental that only marks an osd down; table reused
+ *  - osd out: incremental with an offload change; apply_incremental
+ *    rebuilds the table eagerly, so the time includes the apply
+ *  - concurrent: several threads scan a map with no tables at once;
+ *    the first lookup builds under the lock, the rest wait and share it
+ */
+
+#include "config.h"
+#include "osd/OSDMap.h"
+#include "common/Clock.h"
+#include "common/Thread.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+using namespace std;
+
+static int npgs = 65536;
+static int pgsize = 3;
+
+static double since(utime_t start)
+{
+  utime_t now = g_clock.now();
+  now -= start;
+  return (double)now;
+}
+
+static void report(const char *what, double secs)
+{
+  cout << "  " << what << "\t" << secs << " s\t"
+       << (secs > 0 ? (double)npgs / secs : 0) << " pgs/s" << std::endl;
+}
+
+static void build_crush(CrushWrapper& crush, int nosd)
+{
+  crush.create();
+
+  int ndom = g_conf.osd_max_rep;
+  int ritems[ndom];
+  int rweights[ndom];
+  int nper = ((nosd - 1) / ndom) + 1;
+  int o = 0;
+  for (int i=0; i<ndom; i++) {
+    int items[nper];
+    int j;
+    rweights[i] = 0;
+    for (j=0; j<nper; j++, o++) {
+      if (o == nosd) break;
+      items[j] = o;
+      rweights[i] += 0x10000;
+    }
+    crush_bucket_uniform *domain = crush_make_uniform_bucket(1, j, items, 0x10000);
+    ritems[i] = crush_add_bucket(crush.map, (crush_bucket*)domain);
+  }
+  crush_bucket_list *root = crush_make_list_bucket(2, ndom, ritems, rweights);
+  int rootid = crush_add_bucket(crush.map, (crush_bucket*)root);
+  for (int i=1; i<=ndom; i++) {
+    crush_rule *rule = crush_make_rule(4);
+    crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, rootid, 0);
+    crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_FIRSTN, i, 1);
+    crush_rule_set_step(rule, 2, CRUSH_RULE_CHOOSE_FIRSTN, 1, 0);
+    crush_rule_set_step(rule, 3, CRUSH_RULE_EMIT, 0, 0);
+    crush_add_rule(crush.map, CRUSH_REP_RULE(i), rule);
+  }
+  crush.finalize();
+  for (int i=0; i<nosd; i++)
+    crush.set_offload(i, CEPH_OSD_IN);
+}
+
+static unsigned scan(OSDMap& m)
+{
+  unsigned n = 0;
+  vector<int> acting;
+  for (int ps=0; ps<npgs; ps++) {
+    m.pg_to_acting_osds(pg_t(pg_t::TYPE_REP, pgsize, ps, -1), acting);
+    n += acting.size();
+  }
+  return n;
+}
+
+class ScanThread : public Thread {
+  OSDMap *m;
+public:
+  unsigned n;
+  ScanThread(OSDMap *om) : m(om), n(0) {}
+  void *entry() {
+    n = scan(*m);
+    return 0;
+  }
+};
+
+static void check(OSDMap& m)
+{
+  bool was = g_conf.osd_map_cache_mappings;
+  vector<int> a, b;
+  for (int ps=0; ps<npgs; ps++) {
+    pg_t pg(pg_t::TYPE_REP, pgsize, ps, -1);
+    g_conf.osd_map_cache_mappings = true;
+    m.pg_to_acting_osds(pg, a);
+    g_conf.osd_map_cache_mappings = false;
+    m.pg_to_acting_osds(pg, b);
+    assert(a == b);
+  }
+  g_conf.osd_map_cache_mappings = was;
+}
+
+int main(int argc, char **argv)
+{
+  int nosd = 1000;
+  int threads = 4;
+  for (int i=1; i<argc; i++) {
+    if (strcmp(argv[i], "--osds") == 0)
+      nosd = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--pgs") == 0)
+      npgs = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--size") == 0)
+      pgsize = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--threads") == 0)
+      threads = atoi(argv[++i]);
+  }
+  g_conf.num_osd = nosd;
+  g_conf.osd_pg_layout = CEPH_PG_LAYOUT_CRUSH;
+  if (g_conf.osd_max_rep < pgsize)
+    g_conf.osd_max_rep = pgsize;
+
+  OSDMap m;
+  m.set_max_osd(nosd);
+  for (int i=0; i<nosd; i++)
+    m.set_state(i, CEPH_OSD_EXISTS|CEPH_OSD_UP);
+  build_crush(m.crush, nosd);
+  m.set_pg_num(npgs);
+
+  cout << nosd << " osds, " << npgs << " pgs, size " << pgsize << std::endl;
+  utime_t start;
+
+  g_conf.osd_map_cache_mappings = false;
+  start = g_clock.now();
+  scan(m);
+  report("uncached", since(start));
+
+  g_conf.osd_map_cache_mappings = true;
+  g_conf.osd_map_mapping_threads = 1;
+  m.clear_pg_mappings();
+  start = g_clock.now();
+  scan(m);
+  report("cold, 1 thread", since(start));
+
+  g_conf.osd_map_mapping_threads = threads;
+  g_conf.osd_map_mapping_parallel_min = 0;
+  m.clear_pg_mappings();
+  start = g_clock.now();
+  scan(m);
+  char what[40];
+  snprintf(what, sizeof(what), "cold, %d threads", threads);
+  report(what, since(start));
+
+  start = g_clock.now();
+  scan(m);
+  report("warm", since(start));
+  check(m);
+
+  {
+    OSDMap::Incremental inc(m.get_epoch() + 1);
+    inc.new_down[7] = 0;
+    m.apply_incremental(inc);
+    assert(m.get_num_pg_mappings() == 1);
+    start = g_clock.now();
+    scan(m);
+    report("osd down", since(start));
+    check(m);
+  }
+  {
+    OSDMap::Incremental inc(m.get_epoch() + 1);
+    inc.new_offload[7] = CEPH_OSD_OUT;
+    start = g_clock.now();
+    m.apply_incremental(inc);
+    assert(m.get_num_pg_mappings() == 1);
+    scan(m);
+    report("osd out", since(start));
+    check(m);
+  }
+  {
+    unsigned expect = scan(m);
+    m.clear_pg_mappings();
+    vector<ScanThread*> ts(threads);
+    start = g_clock.now();
+    for (int i=0; i<threads; i++) {
+      ts[i] = new ScanThread(&m);
+      ts[i]->create();
+    }
+    for (int i=0; i<threads; i++) {
+      ts[i]->join();
+      assert(ts[i]->n == expect);
+      delete ts[i];
+    }
+    snprintf(what, sizeof(what), "concurrent, %d", threads);
+    report(what, since(start));
+    assert(m.get_num_pg_mappings() == 1);
+    check(m);
+  }
+  return 0;
+}
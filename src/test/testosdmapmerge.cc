@@ -0,0 +1,207 @@
+/*
+ * what it costs to bring a client's osdmap up to date, per-epoch
+ * incrementals vs merged incrementals.
+ *
+ *  testosdmapmerge [--osds n] [--epochs n] [--churn n] [--nocompress]
+ *
+ * we make --epochs maps (default 4096), each one --churn random osd
+ * events (down, up at a new addr, out, in) past the last, and keep the
+ * incremental and full encoding of each as the monitor would.  then for
+ * clients 1, 10, 100, ... epochs behind we build the message
+ * OSDMonitor::send_incremental would: one incremental per epoch, or
+ * power-of-two aligned merged spans (compressed unless --nocompress).
+ * both are applied to the client's old map and the results compared.
+ */
+
+#include "config.h"
+#include "osd/OSDMap.h"
+#include "include/compress.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+using namespace std;
+
+static int nosd = 1000;
+static bool use_compress = true;
+
+static void build_crush(CrushWrapper& crush, int nosd)
+{
+  crush.create();
+  int items[nosd];
+  for (int i=0; i<nosd; i++)
+    items[i] = i;
+  crush_bucket_uniform *b = crush_make_uniform_bucket(1, nosd, items, 0x10000);
+  int rootid = crush_add_bucket(crush.map, (crush_bucket*)b);
+  crush_rule *rule = crush_make_rule(3);
+  crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, rootid, 0);
+  crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_FIRSTN, 2, 0);
+  crush_rule_set_step(rule, 2, CRUSH_RULE_EMIT, 0, 0);
+  crush_add_rule(crush.map, CRUSH_REP_RULE(2), rule);
+  crush.finalize();
+  for (int i=0; i<nosd; i++)
+    crush.set_offload(i, CEPH_OSD_IN);
+}
+
+static void make_maps(vector<bufferlist>& incs, vector<bufferlist>& fulls,
+		      int nepochs, int churn)
+{
+  OSDMap m;
+  m.set_max_osd(nosd);
+  for (int i=0; i<nosd; i++)
+    m.set_state(i, CEPH_OSD_EXISTS|CEPH_OSD_UP);
+  build_crush(m.crush, nosd);
+  m.set_pg_num(1024);
+  m.inc_epoch();
+
+  incs.resize(nepochs+1);
+  fulls.resize(nepochs+1);
+  m.encode(fulls[1]);
+
+  for (int e=2; e<=nepochs; e++) {
+    OSDMap::Incremental inc(e);
+    for (int i=0; i<churn; i++) {
+      int o = rand() % nosd;
+      if (inc.new_down.count(o) || inc.new_up.count(o) || inc.new_offload.count(o))
+	continue;
+      switch (rand() % 4) {
+      case 0:
+      case 1:
+	if (m.is_up(o))
+	  inc.new_down[o] = 0;
+	else {
+	  entity_addr_t a;
+	  a.v.erank = o;
+	  a.v.nonce = e;
+	  inc.new_up[o] = a;
+	}
+	break;
+      case 2:
+	inc.new_offload[o] = m.crush.get_offload(o) ? CEPH_OSD_IN : CEPH_OSD_OUT;
+	break;
+      case 3:
+	if (rand() % 8 == 0)
+	  inc.new_pg_swap_primary[pg_t(pg_t::TYPE_REP, 2, rand() % 1024, -1)] = o;
+	break;
+      }
+    }
+    inc.encode(incs[e]);
+    m.apply_incremental(inc);
+    m.encode(fulls[e]);
+  }
+}
+
+/*
+ * a merged incremental doesn't carry the addr of an osd that is down at
+ * both ends (it may have come and gone in between), so compare addrs
+ * of up osds only.
+ */
+static bool same(OSDMap& a, OSDMap& b)
+{
+  if (a.get_max_osd() != b.get_max_osd())
+    return false;
+  for (int i=0; i<a.get_max_osd(); i++) {
+    if (a.exists(i) != b.exists(i))
+      return false;
+    if (!a.exists(i))
+      continue;
+    if (a.is_up(i) != b.is_up(i))
+      return false;
+    if (a.is_up(i) && a.get_addr(i) != b.get_addr(i))
+      return false;
+  }
+  bufferlist x, y;
+  a.crush._encode(x);
+  b.crush._encode(y);
+  if (x.length() != y.length() || memcmp(x.c_str(), y.c_str(), x.length()) != 0)
+    return false;
+  for (int ps=0; ps<1024; ps++) {
+    pg_t pg(pg_t::TYPE_REP, 2, ps, -1);
+    vector<int> p, q;
+    a.pg_to_acting_osds(pg, p);
+    b.pg_to_acting_osds(pg, q);
+    if (p != q)
+      return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  int nepochs = 4096;
+  int churn = 10;
+  for (int i=1; i<argc; i++) {
+    if (strcmp(argv[i], "--osds") == 0)
+      nosd = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--epochs") == 0)
+      nepochs = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--churn") == 0)
+      churn = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--nocompress") == 0)
+      use_compress = false;
+  }
+  g_conf.osd_pg_layout = CEPH_PG_LAYOUT_CRUSH;
+  vector<bufferlist> incs, fulls;   // by epoch
+  make_maps(incs, fulls, nepochs, churn);
+  epoch_t last = nepochs;
+  cout << nosd << " osds, " << nepochs << " epochs, " << churn << " events/epoch, "
+       << fulls[last].length() << " byte full map" << std::endl;
+  cout << "  behind\tinc bytes\tmaps\tmerged bytes\tmaps" << std::endl;
+
+  for (epoch_t behind = 1; behind < last; behind *= 10) {
+    epoch_t base = last - behind;
+
+    // one incremental per epoch
+    unsigned ibytes = 0;
+    OSDMap a;
+    a.decode(fulls[base]);
+    for (epoch_t e = base+1; e <= last; e++) {
+      OSDMap::Incremental inc;
+      int off = 0;
+      inc.decode(incs[e], off);
+      a.apply_incremental(inc);
+      ibytes += incs[e].length();
+    }
+
+    // merged, as OSDMonitor::add_merged does it
+    unsigned mbytes = 0, mmaps = 0;
+    OSDMap b;
+    b.decode(fulls[base]);
+    epoch_t cur = base;
+    while (cur < last) {
+      epoch_t len = 1;
+      while (cur % (len*2) == 0 && cur + len*2 <= last)
+	len *= 2;
+      OSDMap::Incremental inc;
+      if (len == 1) {
+	int off = 0;
+	inc.decode(incs[cur+1], off);
+	mbytes += incs[cur+1].length();
+      } else {
+	OSDMap older, newer;
+	older.decode(fulls[cur]);
+	newer.decode(fulls[cur+len]);
+	bool ok = newer.build_incremental(older, inc);
+	assert(ok);
+	bufferlist raw, z, back;
+	inc.encode(raw);
+	compress_bl(raw, z, use_compress);
+	mbytes += z.length();
+	int r = decompress_bl(z, back);
+	assert(r == 0);
+	inc = OSDMap::Incremental();
+	int off = 0;
+	inc.decode(back, off);
+      }
+      b.apply_incremental(inc);
+      mmaps++;
+      cur += len;
+    }
+
+    assert(a.get_epoch() == last && b.get_epoch() == last);
+    assert(same(a, b));
+    cout << "  " << behind << "\t" << ibytes << "\t" << behind
+	 << "\t" << mbytes << "\t" << mmaps << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * counter update throughput under contention.
+ *
+ *  testperfcounters [--threads n] [--ops n] [--logger] [ceph options]
+ *
+ * each of --threads threads does --ops counter increments and latency
+ * samples, through PerfCounters, or with --logger through the old
+ * Logger inc()/favg() calls (which take the Logger's lock).  the totals
+ * are checked afterwards.
+ */
+
+#include "config.h"
+#include "common/Thread.h"
+#include "common/Clock.h"
+#include "common/Logger.h"
+#include "common/LogType.h"
+#include "common/PerfCounters.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+using namespace std;
+
+enum {
+  l_test_first = 90000,
+  l_test_op,
+  l_test_lat,
+  l_test_last
+};
+
+static PerfCountersType test_perftype(l_test_first, l_test_last);
+static LogType test_logtype;
+
+static PerfCounters *perf;
+static Logger *logger;
+static int ops = 1000000;
+
+class Worker : public Thread {
+public:
+  void *entry() {
+    utime_t lat(0, 150);
+    if (logger)
+      for (int i=0; i<ops; i++) {
+	logger->inc("op");
+	logger->favg("lat", lat);
+      }
+    else
+      for (int i=0; i<ops; i++) {
+	perf->inc(l_test_op);
+	perf->tinc(l_test_lat, lat);
+      }
+    return 0;
+  }
+};
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  parse_config_options(args);
+
+  int threads = 4;
+  bool use_logger = false;
+  for (unsigned i=0; i<args.size(); i++) {
+    if (strcmp(args[i], "--threads") == 0)
+      threads = atoi(args[++i]);
+    else if (strcmp(args[i], "--ops") == 0)
+      ops = atoi(args[++i]);
+    else if (strcmp(args[i], "--logger") == 0)
+      use_logger = true;
+    else {
+      cerr << "unknown arg " << args[i] << std::endl;
+      return 1;
+    }
+  }
+
+  test_perftype.add_u64(l_test_op, "op");
+  test_perftype.add_lat(l_test_lat, "lat");
+  perf = new PerfCounters("test", &test_perftype);
+  if (use_logger) {
+    test_logtype.add_inc("op");
+    test_logtype.add_avg("lat");
+    logger = new Logger("testperfcounters", &test_logtype);
+  }
+
+  vector<Worker*> ws;
+  utime_t start = g_clock.now();
+  for (int i=0; i<threads; i++) {
+    ws.push_back(new Worker);
+    ws[i]->create();
+  }
+  for (int i=0; i<threads; i++)
+    ws[i]->join();
+  double t = (double)(g_clock.now() - start);
+
+  long long n = (long long)threads * ops;
+  cout << threads << " threads, " << n << " updates in " << t << " s, "
+       << (long long)((double)n / t) << " updates/sec ("
+       << (use_logger ? "Logger":"PerfCounters") << ")" << std::endl;
+
+  if (!use_logger) {
+    uint64_t count;
+    double sum;
+    vector<uint64_t> buckets;
+    perf->get_lat(l_test_lat, count, sum, buckets);
+    if (perf->get(l_test_op) != (uint64_t)n || count != (uint64_t)n ||
+	buckets[8] != (uint64_t)n) {   // 150us lands in [128,256)
+      cout << "bad totals: op " << perf->get(l_test_op)
+	   << " lat " << count << std::endl;
+      return 1;
+    }
+    perf->write_header(cout);
+    cout << std::endl;
+    perf->write_interval(cout);
+    cout << std::endl;
+    perf->dump_json(cout);
+    cout << std::endl;
+  }
+  delete logger;
+  return 0;
+}
@@ -0,0 +1,276 @@
+/*
+ * pg log: restart time, memory, and the ondisk ring.
+ *
+ *  testpglog [--pgs n] [--entries n] [--objects n] [--dir path]
+ *            [config options]
+ *
+ * one osd on ebofs in a temp dir (fakestore doesn't keep collection
+ * attrs), no messenger traffic.  makes --pgs pgs with --entries log
+ * entries each (spread over --objects objects per pg), writes them
+ * out with write_log, then "restarts": drops every pg, remounts the
+ * store, and times OSD::load_pgs.  reports the memory the loaded logs
+ * hold, the first object lookup in every pg (which builds its index),
+ * and copying and encoding every log (what peering does with
+ * MOSDPGLog).  then appends 5x --entries to one pg through
+ * append_log, trimming to --entries as the osd does, restarts again
+ * and checks that pg (and the size of its log object) and every
+ * other pg.
+ *
+ * --pgs 10000 --entries 3000 wants ~2 GB of disk and ~4.5 GB of ram
+ * once every index is built.
+ */
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <malloc.h>
+using namespace std;
+
+#include "config.h"
+
+#include "osd/OSD.h"
+#include "osd/OSDMap.h"
+#include "osd/PG.h"
+#include "ebofs/Ebofs.h"
+#include "msg/FakeMessenger.h"
+#include "common/Clock.h"
+
+static int npgs = 1000;
+static int nentries = 3000;
+static int nobjects = 1000;
+
+static size_t heap()
+{
+  return mallinfo2().uordblks;
+}
+
+static PG::Log::Entry entry_of(int pg, int v)
+{
+  PG::Log::Entry e;
+  e.op = PG::Log::Entry::MODIFY;
+  e.oid = object_t(1000000 + pg, (v * 7919) % nobjects);
+  e.version = eversion_t(1, v);
+  e.reqid.name = entity_name_t::CLIENT(4000 + pg % 16);
+  e.reqid.tid = v;
+  return e;
+}
+
+static pg_t pgid_of(int pg)
+{
+  return pg_t(pg_t::TYPE_REP, 1, pg, -1);
+}
+
+
+class TestOSD : public OSD {
+public:
+  TestOSD(ObjectStore *s, MonMap *mm) :
+    OSD(0, new FakeMessenger(entity_name_t::OSD(0)), mm) {
+    delete store;
+    store = s;
+
+    osdmap = new OSDMap;
+    osdmap->set_pg_num(npgs);
+    osdmap->inc_epoch();
+    CrushWrapper& crush = osdmap->crush;
+    crush.create();
+    int items[1] = { 0 };
+    crush_bucket_uniform *b = crush_make_uniform_bucket(1, 1, items, 0x10000);
+    int root = crush_add_bucket(crush.map, (crush_bucket*)b);
+    crush_rule *rule = crush_make_rule(3);
+    crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, root, 0);
+    crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_FIRSTN, 1, 0);
+    crush_rule_set_step(rule, 2, CRUSH_RULE_EMIT, 0, 0);
+    crush_add_rule(crush.map, CRUSH_REP_RULE(1), rule);
+    crush.finalize();
+    osdmap->set_max_osd(1);
+    osdmap->set_state(0, CEPH_OSD_EXISTS|CEPH_OSD_UP);
+    osdmap->set_offload(0, CEPH_OSD_IN);
+  }
+
+  PG *get_pg(int pg) { return pg_map[pgid_of(pg)]; }
+
+  void make_pgs() {
+    for (int i=0; i<npgs; i++) {
+      PG *pg = _new_lock_pg(pgid_of(i));
+      for (int v=1; v<=nentries; v++) {
+	PG::Log::Entry e = entry_of(i, v);
+	pg->log.add(e);
+      }
+      pg->info.last_update = pg->info.last_complete = pg->log.top;
+      ObjectStore::Transaction t;
+      t.create_collection(pgid_of(i));
+      pg->write_log(t);
+      store->apply_transaction(t);
+      pg->unlock();
+    }
+  }
+
+  void drop_pgs() {
+    while (!pg_map.empty()) {
+      PG *pg = pg_map.begin()->second;
+      pg_map.erase(pg_map.begin());
+      pg->lock();
+      pg->put_unlock();
+    }
+  }
+
+  void load() { load_pgs(); }
+  void restart() {
+    drop_pgs();
+    store->umount();
+    store->mount();
+    load_pgs();
+  }
+};
+
+
+static int errors = 0;
+
+static void check_log(PG *pg, int i, int from, int to)
+{
+  int v = from;
+  bool bad = pg->log.log.size() != (unsigned)(to - from + 1) ||
+    pg->log.top != eversion_t(1, to) ||
+    pg->log.bottom != eversion_t(from > 1 ? 1 : 0, from - 1);
+  for (PG::Log::Entry *e = 0; !bad && v <= to; v++) {
+    e = pg->log.is_updated(entry_of(i, v).oid);
+    bad = !e || !pg->log.logged_req(entry_of(i, v).reqid);
+  }
+  v = from;
+  for (ringbuffer<PG::Log::Entry>::iterator p = pg->log.log.begin(); !bad && p != pg->log.log.end(); p++, v++) {
+    PG::Log::Entry e = entry_of(i, v);
+    bad = p->oid != e.oid || p->version != e.version || p->reqid != e.reqid;
+  }
+  if (bad) {
+    cout << "pg " << i << ": bad log " << pg->log << std::endl;
+    errors++;
+  }
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  const char *base = "/tmp";
+  for (unsigned i=0; i<args.size(); i++) {
+    if (strcmp(args[i], "--pgs") == 0) npgs = atoi(args[i+1]);
+    else if (strcmp(args[i], "--entries") == 0) nentries = atoi(args[i+1]);
+    else if (strcmp(args[i], "--objects") == 0) nobjects = atoi(args[i+1]);
+    else if (strcmp(args[i], "--dir") == 0) base = args[i+1];
+    else continue;
+    args.erase(args.begin() + i, args.begin() + i + 2);
+    i--;
+  }
+  parse_config_options(args);
+
+  cout << "testpglog: " << npgs << " pgs x " << nentries << " entries, "
+       << nobjects << " objects per pg" << std::endl;
+
+  char dir[200];
+  sprintf(dir, "%s/testpglog.XXXXXX", base);
+  if (!mkdtemp(dir)) {
+    cerr << "can't make temp dir in " << base << std::endl;
+    return 1;
+  }
+
+  MonMap *monmap = new MonMap(1);
+  char fn[200];
+  sprintf(fn, "%s/ebofs", dir);
+  int fd = ::open(fn, O_CREAT|O_RDWR|O_TRUNC, 0644);
+  if (fd < 0 || ::ftruncate(fd, 40LL << 30) < 0) {
+    cerr << "can't create " << fn << ": " << strerror(errno) << std::endl;
+    return 1;
+  }
+  ::close(fd);
+  ObjectStore *store = new Ebofs(fn);
+  TestOSD *osd = new TestOSD(store, monmap);
+  if (store->mkfs() < 0 || store->mount() < 0) {
+    cerr << "can't mkfs/mount in " << dir << std::endl;
+    return 1;
+  }
+
+  utime_t start = g_clock.now();
+  osd->make_pgs();
+  cout << "  created in " << (double)(g_clock.now() - start) << " s" << std::endl;
+
+  // restart
+  osd->drop_pgs();
+  store->umount();
+  store->mount();
+  size_t before = heap();
+  start = g_clock.now();
+  osd->load();
+  double t = g_clock.now() - start;
+  size_t held = heap() - before;
+  cout << "  load_pgs: " << t << " s, logs hold " << (held >> 20) << " MB ("
+       << (held / ((size_t)npgs * nentries)) << " bytes/entry)" << std::endl;
+
+  // first lookup in each pg
+  start = g_clock.now();
+  int found = 0;
+  for (int i=0; i<npgs; i++)
+    if (osd->get_pg(i)->log.is_updated(entry_of(i, nentries).oid))
+      found++;
+  held = heap() - before;
+  cout << "  first lookup: " << (double)(g_clock.now() - start) << " s, logs+index hold "
+       << (held >> 20) << " MB" << std::endl;
+  if (found != npgs)
+    errors++;
+
+  // what peering does with them
+  start = g_clock.now();
+  size_t bytes = 0;
+  for (int i=0; i<npgs; i++) {
+    PG::Log copy;
+    copy.copy_after(osd->get_pg(i)->log, eversion_t(1, nentries / 2));
+    bufferlist bl;
+    copy._encode(bl);
+    PG::Log got;
+    int off = 0;
+    got._decode(bl, off);
+    bytes += bl.length();
+    if (got.log.size() != (unsigned)(nentries - nentries / 2))
+      errors++;
+  }
+  t = g_clock.now() - start;
+  cout << "  copy_after+encode+decode: " << t << " s, "
+       << ((double)bytes / t / 1048576.0) << " MB/s" << std::endl;
+
+  for (int i=0; i<npgs; i++)
+    check_log(osd->get_pg(i), i, 1, nentries);
+
+  // append with trimming, then restart
+  PG *pg = osd->get_pg(0);
+  pg->lock();
+  int top = nentries;
+  for (; top < nentries * 6; top++) {
+    PG::Log::Entry e = entry_of(0, top + 1);
+    pg->log.add(e);
+    pg->info.last_update = pg->info.last_complete = e.version;
+    ObjectStore::Transaction t;
+    pg->append_log(t, e, eversion_t(1, top + 1 - nentries));
+    t.collection_setattr(pg->info.pgid, "info", &pg->info, sizeof(pg->info));
+    store->apply_transaction(t);
+  }
+  pg->unlock();
+  start = g_clock.now();
+  osd->restart();
+  cout << "  restart: " << (double)(g_clock.now() - start) << " s" << std::endl;
+  struct stat st;
+  store->stat(pgid_of(0).to_object(), &st);
+  cout << "  pg 0 after " << (top - nentries) << " appends: " << osd->get_pg(0)->log.log.size()
+       << " entries, log object " << (st.st_size >> 10) << " KB" << std::endl;
+  check_log(osd->get_pg(0), 0, top - nentries + 1, top);
+  for (int i=1; i<npgs; i++)
+    check_log(osd->get_pg(i), i, 1, nentries);
+
+  osd->drop_pgs();
+  store->umount();
+  char cmd[300];
+  sprintf(cmd, "rm -rf %s", dir);
+  system(cmd);
+
+  cout << (errors ? "FAILED" : "ok") << std::endl;
+  _exit(errors ? 1 : 0);
+}
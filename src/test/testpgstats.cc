@@ -0,0 +1,206 @@
+/*
+ * pg stat reporting cost at the monitor.
+ *
+ *  testpgstats [--osds n] [--pgs n] [--seconds n] [--write_frac f]
+ *              [--osd_pg_stats_ratio f] [--osd_pg_stats_max_age secs]
+ *              [--mon_pgmap_full_interval n]
+ *
+ * defaults: 1000 osds with 100 primary pgs each, all reporting every
+ * second for 60 seconds, with half the pgs taking a (small) write each
+ * second and the occasional state change.  each second every osd sends
+ * a report, the monitor folds them into the live PGMap and the pending
+ * incremental, and then "commits": encodes the incremental as the paxos
+ * value and applies it.
+ *
+ *  - all: every touched pg is reported and the full map is stored on
+ *    every commit (the old behavior)
+ *  - delta: pgs are reported per osd_pg_stats_ratio/max_age, an osd with
+ *    nothing to report stays quiet until its osd stats are max_age old,
+ *    and the full map is stored every mon_pgmap_full_interval commits
+ *
+ * at the end the incrementally kept aggregates are checked against a
+ * recount.
+ */
+
+#include "config.h"
+#include "mon/PGMap.h"
+#include "common/Clock.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+using namespace std;
+
+static int nosd = 1000;
+static int npg = 100;     // per osd
+static int nsec = 60;
+static double write_frac = .5;
+
+struct sim_pg {
+  pg_t pgid;
+  pg_stat_t stat, sent;
+  int sent_at;
+  bool dirty;
+};
+
+static double since(utime_t start)
+{
+  utime_t now = g_clock.now();
+  now -= start;
+  return (double)now;
+}
+
+static void check(PGMap& m)
+{
+  pg_stat_sum_t sum;
+  map<int,int64_t> by_osd;
+  for (hash_map<pg_t,pg_stat_t>::iterator p = m.pg_stat.begin(); p != m.pg_stat.end(); ++p) {
+    sum.add(p->second);
+    by_osd[p->second.primary] += p->second.num_bytes;
+  }
+  assert(sum.num_pg == m.pg_sum.num_pg);
+  assert(sum.num_bytes == m.pg_sum.num_bytes);
+  assert(sum.num_objects == m.pg_sum.num_objects);
+  assert(by_osd.size() == m.pg_sum_by_osd.size());
+  for (map<int,int64_t>::iterator p = by_osd.begin(); p != by_osd.end(); ++p)
+    assert(m.pg_sum_by_osd[p->first].num_bytes == p->second);
+}
+
+static void run(const char *what, bool delta)
+{
+  srand(0);
+  vector<sim_pg> pgs(nosd * npg);
+  for (int o=0; o<nosd; o++)
+    for (int i=0; i<npg; i++) {
+      sim_pg& p = pgs[o*npg + i];
+      p.pgid = pg_t(pg_t::TYPE_REP, 2, o*npg + i, -1);
+      p.stat.primary = o;
+      p.stat.state = 1;
+      p.stat.num_objects = 1000 + rand() % 1000;
+      p.stat.num_bytes = p.stat.num_objects << 20;
+      p.stat.num_blocks = p.stat.num_bytes >> 12;
+      p.sent_at = -1;
+      p.dirty = true;
+    }
+
+  PGMap pg_map;
+  PGMap::Incremental pending;
+  pending.version = 1;
+  version_t last_full = 0;
+  vector<int> osd_sent_at(nosd, -1);
+  uint64_t reported = 0, report_bytes = 0, value_bytes = 0, full_bytes = 0;
+  uint64_t reports_sent = 0;
+  double cpu = 0;
+
+  for (int sec=0; sec<nsec; sec++) {
+    // osds: writes, then reports
+    vector< map<pg_t,pg_stat_t> > reports(nosd);
+    for (unsigned i=0; i<pgs.size(); i++) {
+      sim_pg& p = pgs[i];
+      if ((double)rand() / RAND_MAX < write_frac) {
+	p.stat.reported.version++;
+	p.stat.num_objects++;
+	p.stat.num_bytes += 4096 + rand() % 65536;
+	p.stat.num_blocks = p.stat.num_bytes >> 12;
+	p.dirty = true;
+      }
+      if (rand() % 10000 == 0) {
+	p.stat.state ^= 2;
+	p.dirty = true;
+      }
+      if (!p.dirty)
+	continue;
+      if (delta &&
+	  p.sent_at >= 0 &&
+	  sec - p.sent_at < g_conf.osd_pg_stats_max_age &&
+	  !pg_stat_changed(p.stat, p.sent, g_conf.osd_pg_stats_ratio))
+	continue;
+      reports[p.stat.primary][p.pgid] = p.stat;
+      p.sent = p.stat;
+      p.sent_at = sec;
+      p.dirty = false;
+    }
+    // osd stats ride along with pg stats; alone (they don't change
+    // here) only once the last report is max_age old
+    vector<bool> send(nosd);
+    for (int o=0; o<nosd; o++) {
+      send[o] = !delta || !reports[o].empty() || osd_sent_at[o] < 0 ||
+	sec - osd_sent_at[o] >= g_conf.osd_pg_stats_max_age;
+      if (!send[o])
+	continue;
+      osd_sent_at[o] = sec;
+      bufferlist bl;
+      ::_encode(reports[o], bl);
+      report_bytes += bl.length() + sizeof(osd_stat_t);
+      reported += reports[o].size();
+      reports_sent++;
+    }
+
+    // monitor: fold reports in (PGMonitor::handle_pg_stats), then commit
+    utime_t start = g_clock.now();
+    for (int o=0; o<nosd; o++) {
+      if (!send[o])
+	continue;
+      osd_stat_t os;
+      os.num_blocks = 1 << 20;
+      pending.osd_stat_updates[o] = os;
+      pg_map.update_osd(o, os);
+      for (map<pg_t,pg_stat_t>::iterator p = reports[o].begin(); p != reports[o].end(); ++p) {
+	pending.pg_stat_updates[p->first] = p->second;
+	pg_map.update_pg(p->first, p->second);
+      }
+    }
+    bufferlist value;
+    pending._encode(value);
+    value_bytes += value.length();
+    PGMap::Incremental inc;
+    int off = 0;
+    inc._decode(value, off);
+    pg_map.apply_incremental(inc);
+    if (!delta || pg_map.version - last_full >= (version_t)g_conf.mon_pgmap_full_interval) {
+      bufferlist bl;
+      pg_map._encode(bl);
+      full_bytes += bl.length();
+      last_full = pg_map.version;
+    }
+    pending = PGMap::Incremental();
+    pending.version = pg_map.version + 1;
+    cpu += since(start);
+  }
+  check(pg_map);
+
+  cout << "  " << what
+       << "\t" << (reports_sent / nsec) << " reports/s"
+       << "\t" << (reported / nsec) << " pgs/s"
+       << "\t" << (report_bytes / nsec) << " report B/s"
+       << "\t" << (value_bytes / nsec) << " paxos B/s"
+       << "\t" << (full_bytes / nsec) << " full B/s"
+       << "\t" << (cpu / nsec) << " mon s/s" << std::endl;
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  parse_config_options(args);
+  for (unsigned i=0; i<args.size(); i++) {
+    if (strcmp(args[i], "--osds") == 0)
+      nosd = atoi(args[++i]);
+    else if (strcmp(args[i], "--pgs") == 0)
+      npg = atoi(args[++i]);
+    else if (strcmp(args[i], "--seconds") == 0)
+      nsec = atoi(args[++i]);
+    else if (strcmp(args[i], "--write_frac") == 0)
+      write_frac = atof(args[++i]);
+    else {
+      cerr << "unknown arg " << args[i] << std::endl;
+      return 1;
+    }
+  }
+
+  cout << nosd << " osds x " << npg << " pgs, " << nsec << " s, "
+       << write_frac << " of pgs written per second" << std::endl;
+  run("all", false);
+  run("delta", true);
+  return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * raid pgs end to end, on an OSDCluster (see osdcluster.h).
+ *
+ *  testraid [--width n] [--parity n] [--objects n] [config options]
+ *
+ * runs width+1 osds (one is a spare), and
+ *  1. writes objects with unaligned, overlapping extents and reads them
+ *     back (and random pieces of them),
+ *  2. kills an osd and marks it down: degraded reads and writes,
+ *  3. marks it out, so the spare takes its place in every pg, waits for
+ *     recovery, then kills parity more osds and reads everything again;
+ *     that only works if the spare got its chunks.
+ *
+ * run it from anywhere; it works in a temp dir.
+ */
+
+#include <iostream>
+#include <string>
+using namespace std;
+
+#include "osdcluster.h"
+#include "osd/ReedSolomon.h"
+
+static int width = 5;
+static int parity = 2;
+static int nobjects = 24;
+static int max_object = 48 << 10;
+
+
+static OSDCluster *cluster;
+static map<object_t, string> contents;
+static int errors = 0;
+
+static object_t oid_of(int i) { return object_t(0x1234, i); }
+
+static void do_write(TestClient *client, int i)
+{
+  string& s = contents[oid_of(i)];
+  off_t off = rand() % max_object;
+  size_t len = 1 + rand() % (max_object - off);
+  if (rand() % 4 == 0)
+    len = MIN(len, 1 + rand() % 100);
+  if (s.length() < off + len)
+    s.resize(off + len, 0);
+  bufferptr bp(len);
+  for (size_t j=0; j<len; j++)
+    bp[j] = s[off+j] = rand();
+  bufferlist bl;
+  bl.push_back(bp);
+  client->write(oid_of(i), off, bl);
+}
+
+static void check_read(TestClient *client, int i, off_t off, size_t len)
+{
+  string& s = contents[oid_of(i)];
+  bufferlist bl;
+  client->read(oid_of(i), off, len, bl);
+  size_t want = off >= (off_t)s.length() ? 0 : MIN(len, s.length() - off);
+  if (bl.length() != want ||
+      (want && memcmp(bl.c_str(), s.data() + off, want) != 0)) {
+    cout << "  BAD read " << oid_of(i) << " " << off << "~" << len
+	 << ": got " << bl.length() << " bytes, want " << want << std::endl;
+    errors++;
+  }
+}
+
+static void check_all(TestClient *client, const char *what)
+{
+  int before = errors;
+  for (int i=0; i<nobjects; i++) {
+    string& s = contents[oid_of(i)];
+    check_read(client, i, 0, s.length());
+    for (int j=0; j<3; j++) {
+      off_t off = rand() % s.length();
+      check_read(client, i, off, 1 + rand() % (s.length() - off));
+    }
+  }
+  cout << what << ": " << (errors - before) << " bad reads" << std::endl;
+}
+
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  for (unsigned i=0; i<args.size(); i++) {
+    if (strcmp(args[i], "--width") == 0) width = atoi(args[i+1]);
+    else if (strcmp(args[i], "--parity") == 0) parity = atoi(args[i+1]);
+    else if (strcmp(args[i], "--objects") == 0) nobjects = atoi(args[i+1]);
+    else continue;
+    args.erase(args.begin() + i, args.begin() + i + 2);
+    i--;
+  }
+  g_conf.num_mon = 1;
+  g_conf.num_osd = width + 1;
+  g_conf.osd_max_rep = 2;
+  g_conf.osd_min_raid_width = g_conf.osd_max_raid_width = width;
+  g_conf.osd_raid_parity = parity;
+  g_conf.osd_mkfs = true;
+  g_conf.ebofs = 0;
+  g_conf.fakestore_fake_sync = .05;
+  g_conf.fakestore_fake_attrs = true;
+  g_conf.fakestore_fake_collections = true;
+  g_conf.osd_pg_stats_interval = 1;
+  parse_config_options(args);
+  srand(getpid());
+  alarm(300);
+
+  cout << "testraid: " << width - parity << "+" << parity
+       << ", " << g_conf.num_osd << " osds, chunk " << g_conf.osd_raid_chunk_size
+       << ", " << ReedSolomon::get_kernel_name() << std::endl;
+
+  cluster = new OSDCluster(pg_t::TYPE_RAID4, width);
+  if (cluster->start("testraid") < 0)
+    return 1;
+  StubMon *mon = cluster->mon;
+  TestClient *client = cluster->client;
+  vector<Messenger*>& osdm = cluster->osdm;
+  if (!cluster->wait_clean())
+    errors++;
+
+  // 1. healthy
+  for (int i=0; i<nobjects; i++)
+    do_write(client, i);
+  for (int i=0; i<nobjects*2; i++)
+    do_write(client, rand() % nobjects);
+  check_all(client, "healthy");
+
+  // 2. one down
+  int victim = 1;
+  cout << "killing osd" << victim << std::endl;
+  osdm[victim]->shutdown();
+  mon->lock.Lock();
+  {
+    OSDMap::Incremental inc;
+    inc.new_down[victim] = 0;
+    mon->publish(inc);
+  }
+  mon->lock.Unlock();
+  check_all(client, "degraded");
+  for (int i=0; i<nobjects; i++)
+    do_write(client, rand() % nobjects);
+  check_all(client, "degraded after writes");
+
+  // 3. out; the spare recovers its chunks
+  cout << "marking osd" << victim << " out" << std::endl;
+  mon->lock.Lock();
+  {
+    OSDMap::Incremental inc;
+    inc.new_offload[victim] = CEPH_OSD_OUT;
+    mon->publish(inc);
+  }
+  mon->lock.Unlock();
+  if (!cluster->wait_clean())
+    errors++;
+  check_all(client, "recovered");
+
+  mon->lock.Lock();
+  {
+    OSDMap::Incremental inc;
+    for (int i=0, n=0; n<parity && i<g_conf.num_osd; i++) {
+      if (i == victim) continue;
+      cout << "killing osd" << i << std::endl;
+      osdm[i]->shutdown();
+      inc.new_down[i] = 0;
+      n++;
+    }
+    if (!inc.new_down.empty())
+      mon->publish(inc);
+  }
+  mon->lock.Unlock();
+  check_all(client, "recovered, then degraded");
+
+  cout << (errors ? "FAILED" : "ok") << std::endl;
+  _exit(errors ? 1 : 0);
+}
@@ -0,0 +1,216 @@
+/*
+ * single stream sequential read throughput through the ObjectCacher,
+ * with and without readahead.
+ *
+ *  testreadahead [--osds n] [--mb n] [--bw MB/s] [--net ms] [--call us]
+ *                [--stripe_unit bytes] [--stripe_count n]
+ *                [--client_readahead_min bytes] [--client_oc_size bytes]
+ *
+ * the osds are simulated, in virtual time: each serves ops in arrival
+ * order at --bw MB/s plus .1ms per op, and the network adds --net ms
+ * each way.  a reader reads an --mb MB file front to back, 4KB, 64KB
+ * and 1MB at a time, as Client::_read does: the file handle's
+ * Readahead is updated, the read is issued, then the readahead, and we
+ * wait if the read missed.  each read() also costs --call us (syscall,
+ * fuse) of client time.
+ */
+
+#include "config.h"
+#include "osdc/ObjectCacher.h"
+#include "osdc/Readahead.h"
+#include "msg/Messenger.h"
+#include "messages/MOSDOp.h"
+#include "messages/MOSDOpReply.h"
+
+#include <iostream>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+using namespace std;
+
+static int nosd = 8;
+static int mb = 256;
+static double bw = 100;         // MB/s per osd
+static double net = .1;         // ms one way
+static double call = 20;        // us per read()
+
+static double now = 0;          // virtual time, seconds
+static multimap<double, Message*> events;
+static vector<double> osd_busy;
+static bufferlist *zeros;
+static int ops, op_bytes;
+
+class SimMessenger : public Messenger {
+public:
+  SimMessenger() : Messenger(entity_name_t::CLIENT(0)) {}
+  void reset_myname(entity_name_t m) {}
+  int shutdown() { return 0; }
+  void suicide() {}
+  int send_message(Message *m, entity_inst_t dest) {
+    MOSDOp *op = (MOSDOp*)m;
+    assert(m->get_type() == CEPH_MSG_OSD_OP);
+    int osd = dest.name.num();
+    double arrive = now + net / 1000.0;
+    double start = max(arrive, osd_busy[osd]);
+    double done = start + .0001 + (double)op->get_length() / (bw * 1024.0 * 1024.0);
+    osd_busy[osd] = done;
+    ops++;
+    op_bytes += op->get_length();
+
+    MOSDOpReply *reply = new MOSDOpReply(op, 0, 1, true);
+    reply->set_source(dest.name);
+    bufferlist bl;
+    bl.substr_of(*zeros, 0, op->get_length());
+    reply->set_data(bl);
+    events.insert(pair<double,Message*>(done + net / 1000.0, reply));
+    delete m;
+    return 0;
+  }
+};
+
+static void build_crush(CrushWrapper& crush, int nosd)
+{
+  crush.create();
+  int items[nosd];
+  for (int i=0; i<nosd; i++)
+    items[i] = i;
+  crush_bucket_uniform *b = crush_make_uniform_bucket(1, nosd, items, 0x10000);
+  int rootid = crush_add_bucket(crush.map, (crush_bucket*)b);
+  crush_rule *rule = crush_make_rule(3);
+  crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, rootid, 0);
+  crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_FIRSTN, 2, 0);
+  crush_rule_set_step(rule, 2, CRUSH_RULE_EMIT, 0, 0);
+  crush_add_rule(crush.map, CRUSH_REP_RULE(2), rule);
+  crush.finalize();
+  for (int i=0; i<nosd; i++)
+    crush.set_offload(i, CEPH_OSD_IN);
+}
+
+static void deliver(Objecter& objecter, double until)
+{
+  while (!events.empty() && events.begin()->first <= until) {
+    now = MAX(now, events.begin()->first);
+    Message *m = events.begin()->second;
+    events.erase(events.begin());
+    objecter.dispatch(m);
+  }
+}
+
+class C_Done : public Context {
+  bool *done;
+public:
+  C_Done(bool *d) : done(d) {}
+  void finish(int r) { *done = true; }
+};
+
+static double run(OSDMap& osdmap, inode_t& inode, int rsize)
+{
+  now = 0;
+  events.clear();
+  osd_busy.clear();
+  osd_busy.resize(nosd);
+  ops = op_bytes = 0;
+
+  // leaked, since the cacher's flusher thread hangs on to them
+  Mutex *lock = new Mutex;
+  SimMessenger *messenger = new SimMessenger;
+  Objecter *objecter = new Objecter(messenger, 0, &osdmap, *lock);
+  objecter->set_client_incarnation(0);
+  lock->Lock();
+  ObjectCacher *oc = new ObjectCacher(objecter, *lock);
+  Readahead ra;
+
+  for (off_t pos = 0; pos < (off_t)inode.size; pos += rsize) {
+    now += call / 1000000.0;
+    deliver(*objecter, now);
+
+    off_t ra_off, ra_len;
+    ra.update(pos, rsize, inode.layout, inode.size, ra_off, ra_len);
+    bufferlist bl;
+    bool done = false;
+    C_Done *c = new C_Done(&done);
+    int r = oc->file_read(inode, pos, rsize, &bl, c);
+    if (ra_len)
+      oc->file_readahead(inode, ra_off, ra_len);
+    if (r > 0)
+      delete c;
+    else
+      while (!done) {
+	assert(!events.empty());
+	deliver(*objecter, events.begin()->first);
+      }
+    assert(bl.length() == (unsigned)rsize);
+  }
+  lock->Unlock();
+  return now;
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  parse_config_options(args);
+  int su = g_OSD_FileLayout.fl_stripe_unit;
+  int sc = g_OSD_FileLayout.fl_stripe_count;
+  for (unsigned i=0; i<args.size(); i++) {
+    if (strcmp(args[i], "--osds") == 0)
+      nosd = atoi(args[++i]);
+    else if (strcmp(args[i], "--mb") == 0)
+      mb = atoi(args[++i]);
+    else if (strcmp(args[i], "--bw") == 0)
+      bw = atof(args[++i]);
+    else if (strcmp(args[i], "--net") == 0)
+      net = atof(args[++i]);
+    else if (strcmp(args[i], "--call") == 0)
+      call = atof(args[++i]);
+    else if (strcmp(args[i], "--stripe_unit") == 0)
+      su = atoi(args[++i]);
+    else if (strcmp(args[i], "--stripe_count") == 0)
+      sc = atoi(args[++i]);
+    else {
+      cerr << "unknown arg " << args[i] << std::endl;
+      return 1;
+    }
+  }
+  g_conf.osd_pg_layout = CEPH_PG_LAYOUT_CRUSH;
+
+  bufferlist z;
+  bufferptr bp(g_OSD_FileLayout.fl_object_size);
+  bp.zero();
+  z.push_back(bp);
+  zeros = &z;
+
+  OSDMap osdmap;
+  osdmap.set_max_osd(nosd);
+  for (int i=0; i<nosd; i++)
+    osdmap.set_state(i, CEPH_OSD_EXISTS|CEPH_OSD_UP);
+  build_crush(osdmap.crush, nosd);
+  osdmap.set_pg_num(1024);
+  osdmap.inc_epoch();
+
+  inode_t inode;
+  inode.ino = 0x2000;
+  inode.layout = g_OSD_FileLayout;
+  inode.layout.fl_stripe_unit = su;
+  inode.layout.fl_stripe_count = sc;
+  inode.size = (off_t)mb << 20;
+
+  cout << nosd << " osds at " << bw << " MB/s, " << net << " ms net, " << call << " us/call; "
+       << mb << " MB file, stripe unit " << su << " x " << sc
+       << ", object " << inode.layout.fl_object_size << std::endl;
+  cout << "  read\tno readahead\t\treadahead (min " << g_conf.client_readahead_min << ")" << std::endl;
+
+  int ra_min = g_conf.client_readahead_min;
+  int sizes[] = { 4096, 65536, 1 << 20, 0 };
+  for (int i=0; sizes[i]; i++) {
+    g_conf.client_readahead_min = 0;
+    double t0 = run(osdmap, inode, sizes[i]);
+    int ops0 = ops;
+    g_conf.client_readahead_min = ra_min;
+    double t1 = run(osdmap, inode, sizes[i]);
+    cout << "  " << sizes[i]
+	 << "\t" << ((double)mb / t0) << " MB/s (" << ops0 << " ops)"
+	 << "\t" << ((double)mb / t1) << " MB/s (" << ops << " ops)" << std::endl;
+  }
+  return 0;
+}
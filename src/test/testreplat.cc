@@ -0,0 +1,180 @@
+/*
+ * replication pipeline: 4KB write latency at 3x.
+ *
+ *  testreplat [--writes n] [--inflight n] [config options]
+ *
+ * an OSDCluster (see osdcluster.h) of 3 osds.  writes 4KB objects round
+ * robin, one at a time and then --inflight at a time, and reports
+ * ack and commit latency percentiles (as the client sees them) and
+ * how many replies the replicas sent for how many sub op acks and
+ * commits:
+ *
+ *   unbatched        osd_rep_batch_max 1, every copy acks
+ *   batched          replica acks/commits batched, every copy acks
+ *   batched, quorum  ...and the client ack after 2 of the 3 copies
+ *
+ * then reads everything back.
+ *
+ * run it from anywhere; it works in a temp dir.
+ */
+
+#include <iostream>
+#include <string>
+#include <algorithm>
+using namespace std;
+
+#include "osdcluster.h"
+
+static int nrep = 3;
+static int nobjects = 64;
+static int nwrites = 2000;
+static int inflight = 16;
+static int object_size = 4096;
+
+
+// an ack or commit: note how long it took, and wake the writer
+class C_Lat : public Context {
+  TestClient *client;
+  utime_t start;
+  vector<double> *lat;
+  int *pending;
+public:
+  C_Lat(TestClient *c, vector<double> *l, int *p) :
+    client(c), start(g_clock.now()), lat(l), pending(p) {}
+  void finish(int r) {
+    client->lock.Lock();
+    lat->push_back((double)(g_clock.now() - start));
+    (*pending)--;
+    client->cond.Signal();
+    client->lock.Unlock();
+  }
+};
+
+static OSDCluster cluster(pg_t::TYPE_REP, nrep);
+static map<object_t, string> contents;
+static int errors = 0;
+
+static object_t oid_of(int i) { return object_t(0x7e9, i); }
+
+static double pct(vector<double>& v, double p)
+{
+  if (v.empty())
+    return 0;
+  unsigned i = (unsigned)(p * (double)v.size());
+  if (i >= v.size())
+    i = v.size() - 1;
+  return v[i];
+}
+
+/*
+ * nwrites 4KB writes, at most 'depth' unacked at once.  then wait for
+ * every commit.
+ */
+static void run(TestClient *client, const char *what, int depth)
+{
+  vector<double> ack, commit;
+  int unacked = 0, uncommitted = 0;
+  uint64_t replies = cluster.total(l_osd_sub_reply), subops = cluster.total(l_osd_sub_reply_ops);
+
+  client->lock.Lock();
+  utime_t start = g_clock.now();
+  for (int n=0; n<nwrites; n++) {
+    while (unacked >= depth)
+      client->cond.Wait(client->lock);
+    object_t oid = oid_of(n % nobjects);
+    string& s = contents[oid];
+    s.resize(object_size);
+    bufferptr bp(object_size);
+    for (int j=0; j<object_size; j++)
+      bp[j] = s[j] = rand();
+    bufferlist bl;
+    bl.push_back(bp);
+    unacked++;
+    uncommitted++;
+    client->objecter->write(oid, 0, object_size, client->layout(oid), bl,
+			    new C_Lat(client, &ack, &unacked),
+			    new C_Lat(client, &commit, &uncommitted));
+  }
+  double t = (double)(g_clock.now() - start);
+  while (uncommitted)
+    client->cond.Wait(client->lock);
+  client->lock.Unlock();
+
+  replies = cluster.total(l_osd_sub_reply) - replies;
+  subops = cluster.total(l_osd_sub_reply_ops) - subops;
+  if ((int)ack.size() != nwrites || (int)commit.size() != nwrites) {
+    cout << "  BAD " << what << ": " << ack.size() << " acks, " << commit.size()
+	 << " commits for " << nwrites << " writes" << std::endl;
+    errors++;
+  }
+  sort(ack.begin(), ack.end());
+  sort(commit.begin(), commit.end());
+  cout << "  " << what << ", " << depth << " in flight: "
+       << (int)((double)nwrites / t) << " writes/s" << std::endl
+       << "    ack    us p50 " << (int)(pct(ack, .5) * 1000000.0)
+       << "  p90 " << (int)(pct(ack, .9) * 1000000.0)
+       << "  p99 " << (int)(pct(ack, .99) * 1000000.0)
+       << "  p99.9 " << (int)(pct(ack, .999) * 1000000.0) << std::endl
+       << "    commit ms p50 " << (pct(commit, .5) * 1000.0)
+       << "  p99 " << (pct(commit, .99) * 1000.0) << std::endl
+       << "    " << replies << " replica replies for " << subops << " sub op acks/commits ("
+       << ((double)subops / (double)(replies ? replies:1)) << " each)" << std::endl;
+}
+
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  for (unsigned i=0; i<args.size(); i++) {
+    if (strcmp(args[i], "--writes") == 0) nwrites = atoi(args[i+1]);
+    else if (strcmp(args[i], "--inflight") == 0) inflight = atoi(args[i+1]);
+    else continue;
+    args.erase(args.begin() + i, args.begin() + i + 2);
+    i--;
+  }
+  g_conf.num_mon = 1;
+  g_conf.num_osd = 3;
+  g_conf.osd_max_rep = nrep;
+  g_conf.osd_mkfs = true;
+  g_conf.ebofs = 0;
+  g_conf.fakestore_fake_sync = 0;  // commits in bursts, as a real sync makes them
+  g_conf.fakestore_fake_attrs = true;
+  g_conf.fakestore_fake_collections = true;
+  g_conf.osd_pg_stats_interval = 1;
+  g_conf.osd_scrub_interval = 0;
+  parse_config_options(args);
+  int batch_max = g_conf.osd_rep_batch_max;
+  srand(getpid());
+  alarm(300);
+
+  cout << "testreplat: " << nwrites << " 4KB writes to " << nobjects
+       << " objects, " << nrep << "x" << std::endl;
+
+  if (cluster.start("testreplat") < 0)
+    return 1;
+  TestClient *client = cluster.client;
+  if (!cluster.wait_clean())
+    errors++;
+
+  const char *what[3] = { "unbatched", "batched", "batched, quorum 2" };
+  for (int i=0; i<3; i++) {
+    g_conf.osd_rep_batch_max = i ? batch_max : 1;
+    g_conf.osd_rep_ack_quorum = i == 2 ? 2 : 0;
+    run(client, what[i], 1);
+    run(client, what[i], inflight);
+  }
+
+  for (int i=0; i<nobjects; i++) {
+    string& s = contents[oid_of(i)];
+    bufferlist bl;
+    client->read(oid_of(i), 0, object_size, bl);
+    if (bl.length() != s.length() || memcmp(bl.c_str(), s.data(), s.length()) != 0) {
+      cout << "  BAD read " << oid_of(i) << ": " << bl.length() << " bytes" << std::endl;
+      errors++;
+    }
+  }
+
+  cout << (errors ? "FAILED" : "ok") << std::endl;
+  _exit(errors ? 1 : 0);
+}
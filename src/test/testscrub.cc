@@ -0,0 +1,214 @@
+/*
+ * scrub end to end, on an OSDCluster (see osdcluster.h).
+ *
+ *  testscrub [--objects n] [--ops n] [config options]
+ *
+ * writes objects to 3x replicated pgs, then, with scrub off, times
+ * client reads.  then it damages some copies behind the osds' backs
+ * (scribbles on a primary's copy, and on replicas' copies; truncates
+ * one; grows one), turns scrub on, and waits for every copy to be
+ * put back.  client reads are timed again while the pgs are scrubbed
+ * over and over, and everything is read back.
+ *
+ * run it from anywhere; it works in a temp dir.
+ */
+
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+using namespace std;
+
+#include "osdcluster.h"
+
+static int nrep = 3;
+static int nobjects = 32;
+static int nops = 300;
+static int max_object = 64 << 10;
+
+
+static OSDCluster cluster(pg_t::TYPE_REP, nrep);
+static map<object_t, string> contents;
+static int errors = 0;
+
+static object_t oid_of(int i) { return object_t(0x5678, i); }
+
+static void fn_of(int osd, object_t oid, char *fn)
+{
+  pobject_t poid(0, 0, oid);
+  uint64_t w[2];
+  memcpy(w, &poid.oid, sizeof(w));
+  sprintf(fn, "osddata/osd%d/objects/0000.0000.%016llx.%016llx", osd,
+	  (unsigned long long)w[0], (unsigned long long)w[1]);
+}
+
+static string file_of(int osd, object_t oid)
+{
+  char fn[200];
+  fn_of(osd, oid, fn);
+  string s;
+  int fd = ::open(fn, O_RDONLY);
+  if (fd < 0)
+    return "";
+  char buf[4096];
+  int r;
+  while ((r = ::read(fd, buf, sizeof(buf))) > 0)
+    s.append(buf, r);
+  ::close(fd);
+  return s;
+}
+
+static void do_write(TestClient *client, int i)
+{
+  string& s = contents[oid_of(i)];
+  size_t len = max_object / 2 + rand() % (max_object / 2);
+  s.resize(len);
+  bufferptr bp(len);
+  for (size_t j=0; j<len; j++)
+    bp[j] = s[j] = rand();
+  bufferlist bl;
+  bl.push_back(bp);
+  client->write(oid_of(i), 0, bl);
+}
+
+static void check_all(TestClient *client, const char *what)
+{
+  int before = errors;
+  for (int i=0; i<nobjects; i++) {
+    string& s = contents[oid_of(i)];
+    bufferlist bl;
+    client->read(oid_of(i), 0, s.length(), bl);
+    if (bl.length() != s.length() || memcmp(bl.c_str(), s.data(), s.length()) != 0) {
+      cout << "  BAD read " << oid_of(i) << ": got " << bl.length()
+	   << " bytes, want " << s.length() << std::endl;
+      errors++;
+    }
+  }
+  cout << what << ": " << (errors - before) << " bad reads" << std::endl;
+}
+
+// average client read latency, in ms
+static double time_reads(TestClient *client)
+{
+  utime_t start = g_clock.now();
+  for (int n=0; n<nops; n++) {
+    int i = rand() % nobjects;
+    bufferlist bl;
+    client->read(oid_of(i), 0, contents[oid_of(i)].length(), bl);
+  }
+  return (double)(g_clock.now() - start) * 1000.0 / (double)nops;
+}
+
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  for (unsigned i=0; i<args.size(); i++) {
+    if (strcmp(args[i], "--objects") == 0) nobjects = atoi(args[i+1]);
+    else if (strcmp(args[i], "--ops") == 0) nops = atoi(args[i+1]);
+    else continue;
+    args.erase(args.begin() + i, args.begin() + i + 2);
+    i--;
+  }
+  g_conf.num_mon = 1;
+  g_conf.num_osd = nrep;
+  g_conf.osd_max_rep = nrep;
+  g_conf.osd_mkfs = true;
+  g_conf.ebofs = 0;
+  g_conf.fakestore_fake_sync = .05;
+  g_conf.fakestore_fake_attrs = true;
+  g_conf.fakestore_fake_collections = true;
+  g_conf.osd_pg_stats_interval = 1;
+  g_conf.osd_scrub_interval = 0;
+  parse_config_options(args);
+  srand(getpid());
+  alarm(300);
+
+  cout << "testscrub: " << nobjects << " objects, " << nrep << " copies, scrub "
+       << (g_conf.osd_scrub_max_bps >> 20) << " MB/s max, " << g_conf.osd_scrub_chunk
+       << " objects per chunk" << std::endl;
+
+  if (cluster.start("testscrub") < 0)
+    return 1;
+  TestClient *client = cluster.client;
+  if (!cluster.wait_clean())
+    errors++;
+
+  for (int i=0; i<nobjects; i++)
+    do_write(client, i);
+  check_all(client, "written");
+  double idle = time_reads(client);
+
+  // damage: 0 on its primary, 1 and 2 on a replica, 3 truncated,
+  // 4 grown.  (not removed: the store keeps fds open, so it wouldn't
+  // notice.)
+  vector<int> damaged_on(5);
+  for (int i=0; i<5; i++) {
+    object_t oid = oid_of(i);
+    vector<int> acting;
+    client->osdmap.pg_to_acting_osds(pg_t(client->layout(oid).ol_pgid), acting);
+    int who = damaged_on[i] = acting[i == 0 ? 0 : 1 + i % (acting.size() - 1)];
+    char fn[200];
+    fn_of(who, oid, fn);
+    cout << "damaging " << oid << " on osd" << who << std::endl;
+    if (i == 4)
+      ::truncate(fn, contents[oid].length() + 5000);
+    else if (i == 3)
+      ::truncate(fn, contents[oid].length() / 3);
+    else {
+      int fd = ::open(fn, O_WRONLY);
+      char junk[100];
+      for (unsigned j=0; j<sizeof(junk); j++)
+	junk[j] = ~contents[oid][1000 * i + j];
+      ::pwrite(fd, junk, sizeof(junk), 1000 * i);
+      ::close(fd);
+    }
+  }
+
+  // scrub everything, over and over
+  utime_t start = g_clock.now();
+  g_conf.osd_scrub_interval = .5;
+  utime_t until = start;
+  until += 60;
+  int left = 5;
+  while (left && g_clock.now() < until) {
+    usleep(100000);
+    left = 0;
+    for (int i=0; i<5; i++)
+      if (file_of(damaged_on[i], oid_of(i)) != contents[oid_of(i)])
+	left++;
+  }
+  cout << "repaired " << (5 - left) << " of 5 in " << (double)(g_clock.now() - start)
+       << " s" << std::endl;
+  if (left)
+    errors++;
+
+  double busy = time_reads(client);
+  check_all(client, "repaired");
+
+  double t = (double)(g_clock.now() - start);
+  uint64_t pgs = cluster.total(l_osd_scrub_pg);
+  uint64_t bytes = cluster.total(l_osd_scrub_b);
+  uint64_t bad = cluster.total(l_osd_scrub_bad);
+  uint64_t fixed = cluster.total(l_osd_scrub_fix);
+  uint64_t paused = cluster.total(l_osd_scrub_pause);
+  cout << "scrubbed " << pgs << " pgs, " << (bytes >> 10) << " KB in " << t << " s ("
+       << ((double)bytes / t / (double)(1 << 20)) << " MB/s), " << bad << " bad, "
+       << fixed << " fixed, " << paused << " pauses" << std::endl;
+  cout << "client read latency: " << idle << " ms idle, " << busy << " ms while scrubbing"
+       << std::endl;
+  if (fixed < 5)
+    errors++;
+
+  // nothing left to fix
+  uint64_t fixed_before = fixed;
+  sleep(2);
+  fixed = cluster.total(l_osd_scrub_fix);
+  if (fixed != fixed_before) {
+    cout << "  still fixing: " << (fixed - fixed_before) << " more" << std::endl;
+    errors++;
+  }
+
+  cout << (errors ? "FAILED" : "ok") << std::endl;
+  _exit(errors ? 1 : 0);
+}
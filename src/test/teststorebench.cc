@@ -0,0 +1,221 @@
+/*
+ * small-object ObjectStore benchmark.
+ *
+ *  teststorebench [fakestore|ebofs] [--objects n] [--size bytes]
+ *                 [--hot n] [--dir path] [ceph options]
+ *
+ * creates --objects objects of --size bytes, overwrites a random
+ * --size/4 piece of each (in random order), does the same again
+ * --objects times over a hot set of --hot objects, then reads them all
+ * back (in random order, after a remount so the store's own caches are
+ * cold) and reads the hot set over again.  every write carries an
+ * onsafe context; a phase is done when the last one fires, so write
+ * ops/sec include the commits.
+ *
+ * run fakestore with --fakestore_fd_cache_size 0 for the old
+ * open-per-call behavior, and --fakestore_fake_sync .2 for the old
+ * timer "commits".  ebofs gets a 1GB sparse file in --dir.
+ */
+
+#include "osd/FakeStore.h"
+#include "ebofs/Ebofs.h"
+#include "common/Clock.h"
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "config.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+using namespace std;
+
+static Mutex lock;
+static Cond cond;
+static int unsafe = 0;
+
+class C_Safe : public Context {
+public:
+  void finish(int r) {
+    lock.Lock();
+    if (--unsafe == 0)
+      cond.Signal();
+    lock.Unlock();
+  }
+};
+
+static void start_op()
+{
+  lock.Lock();
+  unsafe++;
+  lock.Unlock();
+}
+
+static void wait_safe()
+{
+  lock.Lock();
+  while (unsafe > 0)
+    cond.Wait(lock);
+  lock.Unlock();
+}
+
+static ObjectStore *open_store(const char *type, const char *dir)
+{
+  char fn[200];
+  if (strcmp(type, "fakestore") == 0) {
+    sprintf(fn, "%s/fakestore", dir);
+    return new FakeStore(fn);
+  }
+  if (strcmp(type, "ebofs") == 0) {
+    sprintf(fn, "%s/ebofs", dir);
+    int fd = ::open(fn, O_CREAT|O_RDWR|O_TRUNC, 0644);
+    if (fd < 0 || ::ftruncate(fd, 1LL << 30) < 0) {
+      cerr << "can't create " << fn << ": " << strerror(errno) << std::endl;
+      exit(1);
+    }
+    ::close(fd);
+    return new Ebofs(fn);
+  }
+  cerr << "unknown store " << type << std::endl;
+  exit(1);
+}
+
+static void report(const char *what, int n, utime_t start)
+{
+  double t = (double)(g_clock.now() - start);
+  cout << "  " << what << ": " << n << " ops in " << t << " s, "
+       << (int)((double)n / t) << " ops/sec" << std::endl;
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  parse_config_options(args);
+
+  const char *type = "fakestore";
+  const char *dir = "/tmp";
+  int objects = 10000;
+  int size = 4096;
+  int hot = 100;
+  for (unsigned i=0; i<args.size(); i++) {
+    if (strcmp(args[i], "--objects") == 0)
+      objects = atoi(args[++i]);
+    else if (strcmp(args[i], "--size") == 0)
+      size = atoi(args[++i]);
+    else if (strcmp(args[i], "--hot") == 0)
+      hot = atoi(args[++i]);
+    else if (strcmp(args[i], "--dir") == 0)
+      dir = args[++i];
+    else if (args[i][0] != '-')
+      type = args[i];
+    else {
+      cerr << "unknown arg " << args[i] << std::endl;
+      return 1;
+    }
+  }
+
+  char base[200];
+  sprintf(base, "%s/teststorebench.XXXXXX", dir);
+  if (!mkdtemp(base)) {
+    cerr << "can't make temp dir in " << dir << std::endl;
+    return 1;
+  }
+
+  ObjectStore *store = open_store(type, base);
+  if (store->mkfs() < 0 || store->mount() < 0) {
+    cerr << "can't mkfs/mount " << type << " in " << base << std::endl;
+    return 1;
+  }
+  cout << type << ": " << objects << " objects of " << size << " bytes";
+  if (strcmp(type, "fakestore") == 0)
+    cout << ", fd cache " << g_conf.fakestore_fd_cache_size
+	 << (g_conf.fakestore_fake_sync > 0 ? ", fake sync" : "");
+  cout << std::endl;
+
+  vector<pobject_t> oids(objects);
+  for (int i=0; i<objects; i++)
+    oids[i] = pobject_t(0, 0, object_t(1000 + i, 0));
+  vector<int> order(objects);
+  for (int i=0; i<objects; i++)
+    order[i] = i;
+
+  bufferptr bp(size);
+  for (int i=0; i<size; i++)
+    bp.c_str()[i] = i;
+
+  // create
+  utime_t start = g_clock.now();
+  for (int i=0; i<objects; i++) {
+    bufferlist bl;
+    bl.push_back(bp);
+    start_op();
+    store->write(oids[i], 0, size, bl, new C_Safe);
+  }
+  wait_safe();
+  report("create", objects, start);
+
+  // overwrite
+  for (int i=0; i<objects; i++)
+    swap(order[i], order[rand() % objects]);
+  int piece = size / 4;
+  start = g_clock.now();
+  for (int i=0; i<objects; i++) {
+    bufferlist bl;
+    bl.push_back(bufferptr(bp, (rand() % 4) * piece, piece));
+    start_op();
+    store->write(oids[order[i]], (rand() % 4) * piece, piece, bl, new C_Safe);
+  }
+  wait_safe();
+  report("overwrite", objects, start);
+
+  if (hot > objects)
+    hot = objects;
+  start = g_clock.now();
+  for (int i=0; i<objects; i++) {
+    bufferlist bl;
+    bl.push_back(bufferptr(bp, (rand() % 4) * piece, piece));
+    start_op();
+    store->write(oids[rand() % hot], (rand() % 4) * piece, piece, bl, new C_Safe);
+  }
+  wait_safe();
+  report("overwrite hot", objects, start);
+
+  // read, cold
+  store->umount();
+  store->mount();
+  for (int i=0; i<objects; i++)
+    swap(order[i], order[rand() % objects]);
+  int bad = 0;
+  start = g_clock.now();
+  for (int i=0; i<objects; i++) {
+    bufferlist bl;
+    int r = store->read(oids[order[i]], 0, size, bl);
+    if (r != size)
+      bad++;
+  }
+  report("read", objects, start);
+
+  start = g_clock.now();
+  for (int i=0; i<objects; i++) {
+    bufferlist bl;
+    int r = store->read(oids[rand() % hot], 0, size, bl);
+    if (r != size)
+      bad++;
+  }
+  report("read hot", objects, start);
+
+  store->umount();
+  char cmd[300];
+  sprintf(cmd, "rm -rf %s", base);
+  system(cmd);
+
+  if (bad) {
+    cout << bad << " bad reads" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,395 @@
+/*
+ * anchortable and sessionmap base + delta log replay.
+ *
+ *  testtabledelta [--anchors n] [--deltas n]
+ *
+ * no mds, osds or messenger: the tables are encoded into bufferlists
+ * standing in for the base and log objects, and replayed into fresh
+ * tables through the load path.  checks that replay
+ *
+ *  - applies every record of an intact log
+ *  - stops before a torn (truncated) last record
+ *  - stops at a record tagged with another base version, and at the
+ *    stale tail of a longer log left behind by a compaction
+ *  - stops at a record whose version doesn't move forward
+ *  - applies a full completed_requests trim (TRIM_ALL) in a session delta
+ *
+ * and that encode_delta refuses a record once the log would pass
+ * mds_table_delta_max, which is when save() writes a new base instead.
+ * then times a base save, a delta save and a load of --anchors anchors
+ * (default 1M) with --deltas delta records (default 1000) of 100
+ * changed anchors each.
+ */
+
+#include "mds/AnchorTable.h"
+#include "mds/SessionMap.h"
+#include "common/Clock.h"
+#include "config.h"
+
+#include <map>
+#include <vector>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+using namespace std;
+
+static double since(utime_t start)
+{
+  utime_t now = g_clock.now();
+  now -= start;
+  return (double)now;
+}
+
+static bufferlist sub(bufferlist& bl, unsigned off, unsigned len)
+{
+  bufferlist r;
+  r.substr_of(bl, off, len);
+  return r;
+}
+
+
+// -- anchortable --
+
+typedef map<inodeno_t, pair<inodeno_t,int> > anchor_snap_t;
+
+class TestTable : public AnchorTable {
+public:
+  TestTable() : AnchorTable(0) {
+    create_fresh();
+  }
+
+  // a root-level anchor, or a child of one we already have
+  void anchor(inodeno_t ino, inodeno_t parent) {
+    add(ino, dirfrag_t(parent, frag_t()));
+    inc(ino);
+  }
+  void unanchor(inodeno_t ino) {
+    dec(ino);
+  }
+  void bump() {
+    version++;
+  }
+
+  void save_base(bufferlist& bl) {
+    encode_base(bl);
+    base_version = version;
+    delta_off = 0;
+    dirty_anchors.clear();
+  }
+  bool save_delta(bufferlist& log) {
+    bufferlist bl;
+    if (!encode_delta(bl))
+      return false;
+    delta_off += bl.length();
+    log.claim_append(bl);
+    dirty_anchors.clear();
+    return true;
+  }
+  void load_base(bufferlist& base) {
+    decode_base(base);
+  }
+  void load(bufferlist& base, bufferlist& log) {
+    decode_base(base);
+    _loaded_deltas(log);
+  }
+
+  unsigned size() { return anchor_map.size(); }
+  version_t get_delta_off() { return delta_off; }
+
+  void snap(anchor_snap_t& s) {
+    s.clear();
+    for (hash_map<inodeno_t, Anchor>::iterator p = anchor_map.begin();
+	 p != anchor_map.end();
+	 ++p)
+      s[p->first] = pair<inodeno_t,int>(p->second.dirfrag.ino, p->second.nref);
+  }
+};
+
+static void check_anchor_load(bufferlist& base, bufferlist& log,
+			      version_t v, anchor_snap_t& expect, const char *what)
+{
+  TestTable t;
+  t.load(base, log);
+  anchor_snap_t got;
+  t.snap(got);
+  if (t.get_version() != v || got != expect) {
+    cout << "anchortable " << what << ": got v " << t.get_version() << " with "
+	 << got.size() << " anchors, expected v " << v << " with "
+	 << expect.size() << std::endl;
+    assert(0);
+  }
+  cout << "  anchortable " << what << "\tv " << v << ", " << got.size() << " anchors ok" << std::endl;
+}
+
+static void test_anchortable()
+{
+  TestTable t;
+  for (int i=0; i<100; i++)
+    t.anchor(1000 + i, 1);
+  t.bump();
+  bufferlist base;
+  t.save_base(base);
+
+  // five deltas: adds, a nested add, a ref drop, a removal
+  vector<anchor_snap_t> snaps;
+  vector<version_t> versions;
+  vector<unsigned> ends;
+  bufferlist log;
+  for (int d=0; d<5; d++) {
+    t.anchor(2000 + d, 1);
+    t.anchor(3000 + d, 1000 + d);
+    if (d & 1)
+      t.unanchor(1050 + d);
+    t.bump();
+    assert(t.save_delta(log));
+    snaps.push_back(anchor_snap_t());
+    t.snap(snaps.back());
+    versions.push_back(t.get_version());
+    ends.push_back(log.length());
+  }
+  check_anchor_load(base, log, versions[4], snaps[4], "intact");
+
+  // torn last record: every cut inside it replays the first four
+  for (unsigned cut = ends[3] + 1; cut < ends[4]; cut += 7) {
+    bufferlist torn = sub(log, 0, cut);
+    TestTable r;
+    r.load(base, torn);
+    anchor_snap_t got;
+    r.snap(got);
+    assert(r.get_version() == versions[3] && got == snaps[3]);
+    assert(r.get_delta_off() == ends[3]);
+  }
+  cout << "  anchortable torn\tok" << std::endl;
+
+  // a record repeated: version doesn't move forward
+  {
+    bufferlist dup = log;
+    bufferlist last = sub(log, ends[3], ends[4] - ends[3]);
+    dup.claim_append(last);
+    check_anchor_load(base, dup, versions[4], snaps[4], "repeated");
+  }
+
+  // compaction: new base, then a short log over the start of the old one
+  base.clear();
+  t.save_base(base);
+  anchor_snap_t at_base;
+  t.snap(at_base);
+  version_t base_v = t.get_version();
+  t.anchor(4000, 1);
+  t.bump();
+  bufferlist log2;
+  assert(t.save_delta(log2));
+  anchor_snap_t after;
+  t.snap(after);
+  assert(log2.length() < log.length());
+  {
+    // record aligned after ours, tagged with the old base
+    bufferlist stale = log2;
+    bufferlist old = sub(log, ends[3], ends[4] - ends[3]);
+    stale.claim_append(old);
+    check_anchor_load(base, stale, t.get_version(), after, "old base tag");
+
+    // old log tail where the new log ends, as on disk
+    bufferlist ondisk = log2;
+    bufferlist rest = sub(log, log2.length(), log.length() - log2.length());
+    ondisk.claim_append(rest);
+    check_anchor_load(base, ondisk, t.get_version(), after, "old log tail");
+
+    // only the base
+    bufferlist none;
+    check_anchor_load(base, none, base_v, at_base, "empty log");
+  }
+
+  // a record that would overflow the log is refused
+  int was = g_conf.mds_table_delta_max;
+  g_conf.mds_table_delta_max = t.get_delta_off() + 16;
+  t.anchor(4001, 1);
+  t.bump();
+  bufferlist over;
+  assert(!t.save_delta(over));
+  assert(over.length() == 0);
+  g_conf.mds_table_delta_max = was;
+  cout << "  anchortable full log\tencode_delta refused" << std::endl;
+}
+
+
+// -- sessionmap --
+
+static entity_inst_t client(int n)
+{
+  entity_inst_t i;
+  i.name = entity_name_t::CLIENT(n);
+  return i;
+}
+
+static void sm_load(SessionMap& m, bufferlist& base, bufferlist& log)
+{
+  bufferlist::iterator p = base.begin();
+  m.decode(p);
+  m.base_version = m.version;
+  unsigned off = 0;
+  while (m.decode_delta(log, off)) ;
+  m.delta_off = off;
+}
+
+static void sm_save_delta(SessionMap& m, bufferlist& log)
+{
+  bufferlist bl;
+  assert(m.encode_delta(bl));
+  m.delta_off += bl.length();
+  log.claim_append(bl);
+  m.clear_deltas();
+}
+
+static void test_sessionmap()
+{
+  SessionMap m(0);
+  for (int c=0; c<3; c++) {
+    Session *s = m.get_or_add_session(client(c));
+    for (tid_t t=1; t<=3; t++)
+      s->add_completed_request(t);
+  }
+  m.version++;
+  bufferlist base;
+  m.encode(base);
+  m.base_version = m.version;
+  m.delta_off = 0;
+  m.clear_deltas();
+
+  bufferlist log;
+  // 1: client0 trims everything (TRIM_ALL), then completes 7
+  Session *s0 = m.get_session(entity_name_t::CLIENT(0));
+  s0->trim_completed_requests(0);
+  s0->add_completed_request(7);
+  // client1 trims below 3, bumps its push seq
+  Session *s1 = m.get_session(entity_name_t::CLIENT(1));
+  s1->trim_completed_requests(3);
+  s1->inc_push_seq();
+  m.version++;
+  sm_save_delta(m, log);
+  unsigned end1 = log.length();
+
+  // 2: client2 goes away, client3 shows up
+  m.remove_session(m.get_session(entity_name_t::CLIENT(2)));
+  m.get_or_add_session(client(3))->add_completed_request(9);
+  m.version++;
+  sm_save_delta(m, log);
+  unsigned end2 = log.length();
+
+  {
+    SessionMap r(0);
+    sm_load(r, base, log);
+    assert(r.version == m.version);
+    Session *c0 = r.get_session(entity_name_t::CLIENT(0));
+    assert(c0);
+    for (tid_t t=1; t<=3; t++)
+      assert(!c0->have_completed_request(t));
+    assert(c0->have_completed_request(7));
+    Session *c1 = r.get_session(entity_name_t::CLIENT(1));
+    assert(!c1->have_completed_request(2) && c1->have_completed_request(3));
+    assert(c1->get_push_seq() == 1);
+    assert(!r.get_session(entity_name_t::CLIENT(2)));
+    assert(r.get_session(entity_name_t::CLIENT(3))->have_completed_request(9));
+    cout << "  sessionmap intact\tv " << r.version << ", TRIM_ALL applied" << std::endl;
+  }
+
+  // torn second record: stops after the first
+  for (unsigned cut = end1 + 1; cut < end2; cut += 3) {
+    bufferlist torn = sub(log, 0, cut);
+    SessionMap r(0);
+    sm_load(r, base, torn);
+    assert(r.version == m.version - 1);
+    assert(r.delta_off == end1);
+    assert(r.get_session(entity_name_t::CLIENT(2)));
+    assert(!r.get_session(entity_name_t::CLIENT(3)));
+  }
+  cout << "  sessionmap torn\tok" << std::endl;
+
+  // repeated record, and one tagged with another base
+  {
+    bufferlist dup = log;
+    bufferlist last = sub(log, end1, end2 - end1);
+    dup.claim_append(last);
+    SessionMap r(0);
+    sm_load(r, base, dup);
+    assert(r.version == m.version && r.delta_off == end2);
+
+    bufferlist base2;
+    m.encode(base2);
+    SessionMap r2(0);
+    sm_load(r2, base2, log);
+    assert(r2.version == m.version && r2.delta_off == 0);
+    cout << "  sessionmap repeated/old base tag\tok" << std::endl;
+  }
+}
+
+
+// -- timing --
+
+static void time_anchortable(int nanchors, int ndeltas)
+{
+  int was = g_conf.mds_table_delta_max;
+  g_conf.mds_table_delta_max = 1 << 30;
+
+  TestTable t;
+  for (int i=0; i<nanchors; i++)
+    t.anchor(1000 + i, 1);
+  t.bump();
+
+  utime_t start = g_clock.now();
+  bufferlist base;
+  t.save_base(base);
+  double base_secs = since(start);
+
+  bufferlist log;
+  double delta_secs = 0;
+  unsigned one = 0;
+  for (int d=0; d<ndeltas; d++) {
+    for (int i=0; i<100; i++)
+      t.anchor(1000 + (rand() % nanchors), 1);   // nref++
+    t.bump();
+    unsigned before = log.length();
+    start = g_clock.now();
+    assert(t.save_delta(log));
+    delta_secs += since(start);
+    one = log.length() - before;
+  }
+
+  TestTable r;
+  start = g_clock.now();
+  r.load_base(base);
+  double load_base = since(start);
+  start = g_clock.now();
+  r._loaded_deltas(log);
+  double load_deltas = since(start);
+  assert(r.get_version() == t.get_version());
+  assert(r.size() == t.size());
+
+  cout << nanchors << " anchors:" << std::endl;
+  cout << "  base save\t" << base.length() << " bytes\t" << base_secs << " s" << std::endl;
+  cout << "  delta save\t" << one << " bytes\t" << (delta_secs / ndeltas) << " s (100 anchors, mean of "
+       << ndeltas << ")" << std::endl;
+  cout << "  load\tbase " << load_base << " s, " << ndeltas << " deltas ("
+       << log.length() << " bytes) " << load_deltas << " s" << std::endl;
+
+  g_conf.mds_table_delta_max = was;
+}
+
+int main(int argc, char **argv)
+{
+  int nanchors = 1000000;
+  int ndeltas = 1000;
+  for (int i=1; i<argc; i++) {
+    if (strcmp(argv[i], "--anchors") == 0)
+      nanchors = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--deltas") == 0)
+      ndeltas = atoi(argv[++i]);
+  }
+  g_conf.debug_mds = 0;
+
+  cout << "replay:" << std::endl;
+  test_anchortable();
+  test_sessionmap();
+  time_anchortable(nanchors, ndeltas);
+  return 0;
+}
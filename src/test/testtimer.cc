@@ -0,0 +1,161 @@
+/*
+ * timer add/cancel throughput, and firing.
+ *
+ *  testtimer [--events n] [--fire n] [ceph options]
+ *
+ * schedules --events events 10s to an hour out, then times adding and
+ * canceling another --events short-lived events (like request timeouts
+ * that get canceled when the reply comes back) with those still
+ * pending, then cancels everything in random order.  lastly --fire
+ * events are scheduled over the next 200ms, and each checks that it
+ * didn't fire early.  the same runs through a SafeTimer.
+ */
+
+#include "config.h"
+#include "common/Timer.h"
+#include "common/Clock.h"
+#include "common/Mutex.h"
+#include "common/Cond.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+using namespace std;
+
+static Mutex lock;
+static Cond cond;
+static int fired = 0, early = 0;
+static double max_late = 0;
+
+class C_Nop : public Context {
+public:
+  void finish(int r) {}
+};
+
+class C_Fire : public Context {
+  utime_t when;
+public:
+  C_Fire(utime_t w) : when(w) {}
+  void finish(int r) {
+    utime_t now = g_clock.now();
+    lock.Lock();
+    if (now < when)
+      early++;
+    else if ((double)(now - when) > max_late)
+      max_late = (double)(now - when);
+    fired++;
+    cond.Signal();
+    lock.Unlock();
+  }
+};
+
+static void report(const char *what, int n, utime_t start)
+{
+  double t = (double)(g_clock.now() - start);
+  cout << "  " << what << ": " << n << " in " << t << " s, "
+       << (int)((double)n / t) << "/sec" << std::endl;
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  parse_config_options(args);
+
+  int events = 1000000;
+  int nfire = 10000;
+  for (unsigned i=0; i<args.size(); i++) {
+    if (strcmp(args[i], "--events") == 0)
+      events = atoi(args[++i]);
+    else if (strcmp(args[i], "--fire") == 0)
+      nfire = atoi(args[++i]);
+    else {
+      cerr << "unknown arg " << args[i] << std::endl;
+      return 1;
+    }
+  }
+
+  cout << "Timer, " << events << " pending" << std::endl;
+
+  // pending
+  vector<Context*> cs(events);
+  utime_t now = g_clock.now();
+  utime_t start = g_clock.now();
+  for (int i=0; i<events; i++) {
+    cs[i] = new C_Nop;
+    utime_t when = now;
+    when += 10.0 + (double)(rand() % 3590000) / 1000.0;
+    g_timer.add_event_at(when, cs[i]);
+  }
+  report("add", events, start);
+
+  // short-lived
+  start = g_clock.now();
+  for (int i=0; i<events; i++) {
+    Context *c = new C_Nop;
+    g_timer.add_event_after(5.0, c);
+    g_timer.cancel_event(c);
+  }
+  report("add+cancel", events, start);
+
+  random_shuffle(cs.begin(), cs.end());
+  start = g_clock.now();
+  int bad = 0;
+  for (int i=0; i<events; i++)
+    if (!g_timer.cancel_event(cs[i]))
+      bad++;
+  report("cancel", events, start);
+  if (g_timer.num_event != 0 || bad) {
+    cout << "bad cancels " << bad << ", " << g_timer.num_event << " left" << std::endl;
+    return 1;
+  }
+
+  // firing
+  now = g_clock.now();
+  for (int i=0; i<nfire; i++) {
+    utime_t when = now;
+    when += (double)(rand() % 200000) / 1000000.0;
+    g_timer.add_event_at(when, new C_Fire(when));
+  }
+  lock.Lock();
+  while (fired < nfire)
+    cond.Wait(lock);
+  lock.Unlock();
+  cout << "  fired " << fired << ", " << early << " early, max "
+       << (max_late * 1000.0) << " ms late" << std::endl;
+  if (early)
+    return 1;
+
+  // through a SafeTimer
+  cout << "SafeTimer, " << events << " pending" << std::endl;
+  Mutex safe_lock;
+  SafeTimer timer(safe_lock);
+  safe_lock.Lock();
+  now = g_clock.now();
+  start = g_clock.now();
+  for (int i=0; i<events; i++) {
+    cs[i] = new C_Nop;
+    utime_t when = now;
+    when += 10.0 + (double)(rand() % 3590000) / 1000.0;
+    timer.add_event_at(when, cs[i]);
+  }
+  report("add", events, start);
+
+  start = g_clock.now();
+  for (int i=0; i<events; i++) {
+    Context *c = new C_Nop;
+    timer.add_event_after(5.0, c);
+    timer.cancel_event(c);
+  }
+  report("add+cancel", events, start);
+
+  start = g_clock.now();
+  timer.cancel_all();
+  report("cancel", events, start);
+  timer.join();
+  safe_lock.Unlock();
+
+  g_timer.shutdown();
+  return 0;
+}